@@ -3,15 +3,50 @@
 #include <string.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "./cJSON.h"
 #include "./database.h"
 #include "./interface.h"
 
 #define HASH_MOD 5831
 #define HASH_SHIFT_BITS 5
-#define HASH_TABLE_SIZE 137
+// Initial size of the hash table
+#define HASH_TABLE_INITIAL_SIZE 137
+// Load factor threshold for expanding the hash table
+#define HASH_TABLE_LOAD_FACTOR_EXPAND 1.0
+// Load factor threshold for shrinking the hash table
+#define HASH_TABLE_LOAD_FACTOR_SHRINK 0.1
+// Non-empty buckets a rehash moves along with each operation on the table, and empty buckets it
+// may pass over for each before the operation gives up
+#define HASH_TABLE_REHASH_STEP_BUCKETS 4
+#define HASH_TABLE_REHASH_EMPTY_VISITS 10
+// Buckets of each secondary hash index
+#define INDEX_TABLE_SIZE 137
+#define SAVE_SEGMENT_PATH_SIZE 4096
+
+typedef struct DBItemTable
+{
+  DBItem **buckets;
+  unsigned long size;
+  unsigned long count;
+} DBItemTable;
+
+// Items live in tables[0]; when it grows or shrinks, tables[1] is made at the new size and the items
+// move over a few buckets at a time with each operation, from the last bucket down to
+// `rehashing_index`, so no single operation pays for the whole resize.
+DBItemTable tables[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+long rehashing_index = -1;
+
+// The items of each segment file, and whether it changed since it was last written or read
+typedef struct DBSegment
+{
+  DBItem *items;
+  bool dirty;
+} DBSegment;
 
-DBItem **hash_table = NULL;
+DBSegment segments[SAVE_SEGMENTS];
 
 pthread_mutex_t _db_mutex = PTHREAD_MUTEX_INITIALIZER;
 // The mutex is locked while the database is being read and written.
@@ -22,7 +57,13 @@ unsigned long static hash(const char *string);
 DBItem static *create_item_with_json(const char *key, cJSON *json);
 DBItem static *add_item_to_hash_table(const char *key, DBItem *item);
 DBItem static *remove_item_from_hash_table(const char *key);
+DBItem static *find_item(const char *key);
+void static create_hash_table();
 DBItem static *set_item_key(DBItem *item, const char *key);
+void static free_hash_table();
+void static index_item(DBItem *item);
+void static unindex_item(DBItem *item);
+void static clear_indexes();
 
 // DJB2 hash
 unsigned long static hash(const char *string)
@@ -36,7 +77,7 @@ unsigned long static hash(const char *string)
   {
     hash_value = ((hash_value << HASH_SHIFT_BITS) + hash_value) + current_char;
   }
-  return hash_value % HASH_TABLE_SIZE;
+  return hash_value;
 }
 
 DBItem static *create_item_with_json(const char *key, cJSON *json)
@@ -52,19 +93,151 @@ DBItem static *create_item_with_json(const char *key, cJSON *json)
   item->key = NULL;
   item->json = json;
   item->next = NULL;
+  item->hash = 0;
+  item->index_entries = NULL;
+  item->segment_prev = NULL;
+  item->segment_next = NULL;
   set_item_key(item, key);
 
   return item;
 }
 
+bool static is_rehashing()
+{
+  return rehashing_index != -1;
+}
+
+DBItem static **allocate_buckets(unsigned long size)
+{
+  DBItem **buckets = (DBItem **)calloc(size, sizeof(DBItem *));
+
+  if (!buckets)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  return buckets;
+}
+
+// Moves up to `buckets` non-empty buckets of a running rehash, passing over at most
+// HASH_TABLE_REHASH_EMPTY_VISITS empty ones for each
+void static rehash_step(unsigned long buckets)
+{
+  unsigned long empty_visits = buckets * HASH_TABLE_REHASH_EMPTY_VISITS;
+  DBItem *item = NULL;
+  DBItem *next = NULL;
+
+  while (buckets > 0 && is_rehashing())
+  {
+    item = tables[0].buckets[rehashing_index];
+    if (item == NULL)
+    {
+      rehashing_index--;
+      // a sparse table can't make one operation walk its empty buckets for long
+      if (--empty_visits == 0)
+        break;
+      continue;
+    }
+
+    while (item != NULL)
+    {
+      next = item->next;
+      unsigned long index = item->hash % tables[1].size;
+      item->next = tables[1].buckets[index];
+      tables[1].buckets[index] = item;
+      tables[1].count++;
+      tables[0].count--;
+      item = next;
+    }
+    tables[0].buckets[rehashing_index] = NULL;
+    rehashing_index--;
+    buckets--;
+  }
+
+  if (rehashing_index == -1 && tables[1].buckets != NULL)
+  {
+    // every item moved, the new table takes over
+    free(tables[0].buckets);
+    tables[0] = tables[1];
+    tables[1].buckets = NULL;
+    tables[1].size = 0;
+    tables[1].count = 0;
+  }
+}
+
+// Starts a resize when the load factor leaves its bounds, or moves a running one along
+// Executed during each operation on the table, with the mutex locked
+void static hash_table_maintenance()
+{
+  if (is_rehashing())
+  {
+    rehash_step(HASH_TABLE_REHASH_STEP_BUCKETS);
+    return;
+  }
+
+  unsigned long new_size = 0;
+  if (tables[0].count > HASH_TABLE_LOAD_FACTOR_EXPAND * tables[0].size)
+    new_size = tables[0].size * 2;
+  else if (tables[0].size > HASH_TABLE_INITIAL_SIZE && tables[0].count < HASH_TABLE_LOAD_FACTOR_SHRINK * tables[0].size)
+    new_size = tables[0].size / 2;
+  else
+    return;
+
+  tables[1].buckets = allocate_buckets(new_size);
+  tables[1].size = new_size;
+  tables[1].count = 0;
+  rehashing_index = (long)tables[0].size - 1;
+}
+
+void static create_hash_table()
+{
+  tables[0].buckets = allocate_buckets(HASH_TABLE_INITIAL_SIZE);
+  tables[0].size = HASH_TABLE_INITIAL_SIZE;
+  tables[0].count = 0;
+}
+
+void static link_item_to_segment(DBItem *item)
+{
+  DBSegment *segment = &segments[item->hash % SAVE_SEGMENTS];
+
+  item->segment_prev = NULL;
+  item->segment_next = segment->items;
+  if (segment->items != NULL)
+    segment->items->segment_prev = item;
+  segment->items = item;
+  segment->dirty = true;
+}
+
+void static unlink_item_from_segment(DBItem *item)
+{
+  DBSegment *segment = &segments[item->hash % SAVE_SEGMENTS];
+
+  if (item->segment_prev != NULL)
+    item->segment_prev->segment_next = item->segment_next;
+  else
+    segment->items = item->segment_next;
+  if (item->segment_next != NULL)
+    item->segment_next->segment_prev = item->segment_prev;
+  item->segment_prev = NULL;
+  item->segment_next = NULL;
+  segment->dirty = true;
+}
+
 DBItem static *add_item_to_hash_table(const char *key, DBItem *item)
 {
   if (item == NULL)
     return NULL;
 
-  unsigned long index = hash(key);
-  item->next = hash_table[index];
-  hash_table[index] = item;
+  if (tables[0].buckets == NULL)
+    create_hash_table();
+  hash_table_maintenance();
+
+  // while rehashing, new items go straight to the new table
+  DBItemTable *table = is_rehashing() ? &tables[1] : &tables[0];
+  item->hash = hash(key);
+  unsigned long index = item->hash % table->size;
+  item->next = table->buckets[index];
+  table->buckets[index] = item;
+  table->count++;
+  link_item_to_segment(item);
 
   return item;
 }
@@ -74,23 +247,57 @@ DBItem static *remove_item_from_hash_table(const char *key)
   if (key == NULL)
     return NULL;
 
-  unsigned long index = hash(key);
-  DBItem *prev = NULL;
-  DBItem *curr = hash_table[index];
+  hash_table_maintenance();
 
-  while (curr != NULL)
+  unsigned long key_hash = hash(key);
+  for (int i = 0; i < 2; i++)
   {
-    if (strcmp(curr->key, key) == 0)
+    if (tables[i].buckets == NULL)
+      continue;
+
+    unsigned long index = key_hash % tables[i].size;
+    DBItem *prev = NULL;
+    DBItem *curr = tables[i].buckets[index];
+
+    while (curr != NULL)
     {
-      if (prev == NULL)
-        hash_table[index] = curr->next;
-      else
-        prev->next = curr->next;
+      if (curr->hash == key_hash && strcmp(curr->key, key) == 0)
+      {
+        if (prev == NULL)
+          tables[i].buckets[index] = curr->next;
+        else
+          prev->next = curr->next;
+        tables[i].count--;
+        unlink_item_from_segment(curr);
+
+        return curr;
+      }
+      prev = curr;
+      curr = curr->next;
+    }
+  }
+
+  return NULL;
+}
 
-      return curr;
+// Looks a key up in both tables; called with the mutex locked
+DBItem static *find_item(const char *key)
+{
+  hash_table_maintenance();
+
+  unsigned long key_hash = hash(key);
+  for (int i = 0; i < 2; i++)
+  {
+    if (tables[i].buckets == NULL)
+      continue;
+
+    DBItem *item = tables[i].buckets[key_hash % tables[i].size];
+    while (item != NULL)
+    {
+      if (item->hash == key_hash && strcmp(item->key, key) == 0)
+        return item;
+      item = item->next;
     }
-    prev = curr;
-    curr = curr->next;
   }
 
   return NULL;
@@ -123,22 +330,11 @@ DBItem *get_item(const char *key)
   if (key == NULL)
     return NULL;
 
-  unsigned long index = hash(key);
   pthread_mutex_lock(db_mutex);
-  DBItem *item = hash_table[index];
-
-  while (item != NULL)
-  {
-    if (strcmp(item->key, key) == 0)
-    {
-      pthread_mutex_unlock(db_mutex);
-      return item;
-    }
-    item = item->next;
-  }
-
+  DBItem *item = find_item(key);
   pthread_mutex_unlock(db_mutex);
-  return NULL;
+
+  return item;
 }
 
 DBItem *set_item(const char *key, cJSON *json)
@@ -152,6 +348,7 @@ DBItem *set_item(const char *key, cJSON *json)
   {
     if (oldItem->json == json)
     {
+      reindex_item(key);
       return oldItem;
     }
     delete_item(key);
@@ -160,6 +357,7 @@ DBItem *set_item(const char *key, cJSON *json)
   DBItem *item = create_item_with_json(key, json);
   pthread_mutex_lock(db_mutex);
   add_item_to_hash_table(key, item);
+  index_item(item);
 
   pthread_mutex_unlock(db_mutex);
   return item;
@@ -174,7 +372,7 @@ DBItem *rename_item(const char *old_key, const char *new_key)
   // remove item with old key
   DBItem *item = remove_item_from_hash_table(old_key);
 
-  // add item with new key
+  // add item with new key; the indexes point at the item itself, so they need no change
   add_item_to_hash_table(new_key, item);
   pthread_mutex_unlock(db_mutex);
 
@@ -189,6 +387,8 @@ bool delete_item(const char *key)
 {
   pthread_mutex_lock(db_mutex);
   DBItem *item = remove_item_from_hash_table(key);
+  if (item != NULL)
+    unindex_item(item);
   pthread_mutex_unlock(db_mutex);
 
   if (item == NULL)
@@ -200,6 +400,401 @@ bool delete_item(const char *key)
   return true;
 }
 
+// An entry of an item in a secondary index.
+typedef struct DBIndexEntry
+{
+  struct DBIndex *index;
+  DBItem *item;
+  // Canonical form of the value in a hash index, the number in an ordered index
+  char *value;
+  double number;
+  // Next entry in the same bucket of a hash index
+  struct DBIndexEntry *next;
+  // Next entry of the same item, in any index
+  struct DBIndexEntry *item_next;
+} DBIndexEntry;
+
+typedef struct DBIndex
+{
+  char *field;
+  DBIndexType type;
+  // Hash index: INDEX_TABLE_SIZE buckets of entries
+  DBIndexEntry **buckets;
+  // Ordered index: entries sorted by number
+  DBIndexEntry **entries;
+  int length;
+  int capacity;
+} DBIndex;
+
+DBIndex **indexes = NULL;
+int indexes_length = 0;
+
+#define INDEX_ENTRIES_CHUNK_SIZE 64
+
+// Canonical form of a scalar JSON value, its type first so that "1" and 1 differ
+// Returns NULL for objects and arrays
+char static *index_value(const cJSON *json)
+{
+  char buffer[32];
+  const char *text = buffer;
+  char type = 0;
+
+  if (cJSON_IsString(json))
+  {
+    type = 's';
+    text = json->valuestring;
+  }
+  else if (cJSON_IsNumber(json))
+  {
+    type = 'n';
+    snprintf(buffer, sizeof(buffer), "%.17g", json->valuedouble);
+  }
+  else if (cJSON_IsBool(json))
+  {
+    type = 'b';
+    text = cJSON_IsTrue(json) ? "true" : "false";
+  }
+  else if (cJSON_IsNull(json))
+  {
+    type = 'z';
+    text = "";
+  }
+  else
+    return NULL;
+
+  char *value = (char *)malloc((strlen(text) + 2) * sizeof(char));
+  if (!value)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  value[0] = type;
+  strcpy(value + 1, text);
+
+  return value;
+}
+
+DBIndex static *find_index(const char *field, DBIndexType type)
+{
+  if (field == NULL)
+    return NULL;
+
+  for (int i = 0; i < indexes_length; i++)
+  {
+    if (indexes[i]->type == type && strcmp(indexes[i]->field, field) == 0)
+      return indexes[i];
+  }
+
+  return NULL;
+}
+
+// Position of the first entry of an ordered index whose number is not less than `number`
+int static lower_bound_entry(DBIndex *index, double number)
+{
+  int low = 0, high = index->length;
+  while (low < high)
+  {
+    int middle = low + (high - low) / 2;
+    if (index->entries[middle]->number < number)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+void static add_index_entry(DBIndex *index, DBItem *item, const cJSON *json)
+{
+  DBIndexEntry *entry = NULL;
+
+  if (index->type == DBIndexType_Hash)
+  {
+    char *value = index_value(json);
+    if (value == NULL)
+      return;
+
+    // an array holding a value twice is found once
+    for (entry = item->index_entries; entry != NULL; entry = entry->item_next)
+    {
+      if (entry->index == index && strcmp(entry->value, value) == 0)
+      {
+        free(value);
+        return;
+      }
+    }
+
+    entry = (DBIndexEntry *)malloc(sizeof(DBIndexEntry));
+    if (!entry)
+      memory_error_handler(__FILE__, __LINE__, __func__);
+
+    unsigned long bucket = hash(value) % INDEX_TABLE_SIZE;
+    entry->value = value;
+    entry->number = 0;
+    entry->next = index->buckets[bucket];
+    index->buckets[bucket] = entry;
+  }
+  else
+  {
+    if (!cJSON_IsNumber(json))
+      return;
+
+    entry = (DBIndexEntry *)malloc(sizeof(DBIndexEntry));
+    if (!entry)
+      memory_error_handler(__FILE__, __LINE__, __func__);
+
+    entry->value = NULL;
+    entry->number = json->valuedouble;
+    entry->next = NULL;
+
+    if (index->length == index->capacity)
+    {
+      index->capacity += INDEX_ENTRIES_CHUNK_SIZE;
+      index->entries = (DBIndexEntry **)realloc(index->entries, index->capacity * sizeof(DBIndexEntry *));
+      if (!index->entries)
+        memory_error_handler(__FILE__, __LINE__, __func__);
+    }
+
+    // after the entries of equal numbers, so equal numbers keep the order they were added in
+    int position = lower_bound_entry(index, entry->number);
+    while (position < index->length && index->entries[position]->number == entry->number)
+      position++;
+    memmove(&index->entries[position + 1], &index->entries[position], (index->length - position) * sizeof(DBIndexEntry *));
+    index->entries[position] = entry;
+    index->length++;
+  }
+
+  entry->index = index;
+  entry->item = item;
+  entry->item_next = item->index_entries;
+  item->index_entries = entry;
+}
+
+void static index_item_field(DBIndex *index, DBItem *item)
+{
+  cJSON *json = cJSON_GetObjectItemCaseSensitive(item->json, index->field);
+  cJSON *element = NULL;
+
+  if (cJSON_IsArray(json) && index->type == DBIndexType_Hash)
+  {
+    cJSON_ArrayForEach(element, json)
+    {
+      add_index_entry(index, item, element);
+    }
+  }
+  else if (json != NULL)
+    add_index_entry(index, item, json);
+}
+
+// Called with the mutex locked
+void static index_item(DBItem *item)
+{
+  for (int i = 0; i < indexes_length; i++)
+    index_item_field(indexes[i], item);
+}
+
+void static remove_index_entry(DBIndexEntry *entry)
+{
+  DBIndex *index = entry->index;
+
+  if (index->type == DBIndexType_Hash)
+  {
+    DBIndexEntry **link = &index->buckets[hash(entry->value) % INDEX_TABLE_SIZE];
+    while (*link != entry)
+      link = &(*link)->next;
+    *link = entry->next;
+    free(entry->value);
+  }
+  else
+  {
+    int position = lower_bound_entry(index, entry->number);
+    while (index->entries[position] != entry)
+      position++;
+    memmove(&index->entries[position], &index->entries[position + 1], (index->length - position - 1) * sizeof(DBIndexEntry *));
+    index->length--;
+  }
+
+  free(entry);
+}
+
+// Called with the mutex locked
+void static unindex_item(DBItem *item)
+{
+  DBIndexEntry *entry = item->index_entries;
+  DBIndexEntry *next = NULL;
+
+  while (entry != NULL)
+  {
+    next = entry->item_next;
+    remove_index_entry(entry);
+    entry = next;
+  }
+  item->index_entries = NULL;
+}
+
+// Drops every entry but keeps the index definitions; called with the items about to be freed
+void static clear_indexes()
+{
+  DBIndexEntry *entry = NULL;
+  DBIndexEntry *next = NULL;
+
+  for (int i = 0; i < indexes_length; i++)
+  {
+    DBIndex *index = indexes[i];
+    if (index->type == DBIndexType_Hash)
+    {
+      for (int j = 0; j < INDEX_TABLE_SIZE; j++)
+      {
+        for (entry = index->buckets[j]; entry != NULL; entry = next)
+        {
+          next = entry->next;
+          free(entry->value);
+          free(entry);
+        }
+        index->buckets[j] = NULL;
+      }
+    }
+    else
+    {
+      for (int j = 0; j < index->length; j++)
+        free(index->entries[j]);
+      index->length = 0;
+    }
+  }
+}
+
+bool def_index(const char *field, DBIndexType type)
+{
+  if (field == NULL || find_index(field, type) != NULL)
+    return false;
+
+  DBIndex *index = (DBIndex *)malloc(sizeof(DBIndex));
+  if (!index)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  index->field = (char *)malloc((strlen(field) + 1) * sizeof(char));
+  if (!index->field)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+  strcpy(index->field, field);
+  index->type = type;
+  index->buckets = NULL;
+  index->entries = NULL;
+  index->length = 0;
+  index->capacity = 0;
+
+  if (type == DBIndexType_Hash)
+  {
+    index->buckets = (DBIndexEntry **)calloc(INDEX_TABLE_SIZE, sizeof(DBIndexEntry *));
+    if (!index->buckets)
+      memory_error_handler(__FILE__, __LINE__, __func__);
+  }
+
+  pthread_mutex_lock(db_mutex);
+  indexes = (DBIndex **)realloc(indexes, (indexes_length + 1) * sizeof(DBIndex *));
+  if (!indexes)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+  indexes[indexes_length++] = index;
+
+  // build the index from the items already stored
+  for (int t = 0; t < 2; t++)
+  {
+    for (unsigned long i = 0; i < tables[t].size; i++)
+    {
+      for (DBItem *item = tables[t].buckets[i]; item != NULL; item = item->next)
+        index_item_field(index, item);
+    }
+  }
+  pthread_mutex_unlock(db_mutex);
+
+  return true;
+}
+
+void reindex_item(const char *key)
+{
+  DBItem *item = get_item(key);
+  if (item == NULL)
+    return;
+
+  pthread_mutex_lock(db_mutex);
+  unindex_item(item);
+  index_item(item);
+  segments[item->hash % SAVE_SEGMENTS].dirty = true;
+  pthread_mutex_unlock(db_mutex);
+}
+
+DBKeys static *create_keys(int length)
+{
+  DBKeys *keys = (DBKeys *)malloc(sizeof(DBKeys));
+  if (!keys)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  keys->length = length;
+  keys->keys = NULL;
+  if (length > 0)
+  {
+    keys->keys = (const char **)malloc(length * sizeof(const char *));
+    if (!keys->keys)
+      memory_error_handler(__FILE__, __LINE__, __func__);
+  }
+
+  return keys;
+}
+
+DBKeys *get_index_keys(const char *field, const cJSON *value)
+{
+  DBIndex *index = find_index(field, DBIndexType_Hash);
+  char *canonical = index_value(value);
+  DBIndexEntry *entry = NULL;
+  DBKeys *keys = NULL;
+  int count = 0;
+
+  if (index == NULL)
+  {
+    free(canonical);
+    return NULL;
+  }
+  if (canonical == NULL)
+    return create_keys(0);
+
+  pthread_mutex_lock(db_mutex);
+  DBIndexEntry *bucket = index->buckets[hash(canonical) % INDEX_TABLE_SIZE];
+  for (entry = bucket; entry != NULL; entry = entry->next)
+    count += strcmp(entry->value, canonical) == 0;
+
+  keys = create_keys(count);
+  count = 0;
+  for (entry = bucket; entry != NULL; entry = entry->next)
+  {
+    if (strcmp(entry->value, canonical) == 0)
+      keys->keys[count++] = entry->item->key;
+  }
+  pthread_mutex_unlock(db_mutex);
+
+  free(canonical);
+  return keys;
+}
+
+DBKeys *get_index_range_keys(const char *field, double min, double max)
+{
+  DBIndex *index = find_index(field, DBIndexType_Ordered);
+
+  if (index == NULL)
+    return NULL;
+  if (!(min <= max))
+    return create_keys(0);
+
+  pthread_mutex_lock(db_mutex);
+  int start = lower_bound_entry(index, min);
+  int end = start;
+  while (end < index->length && index->entries[end]->number <= max)
+    end++;
+
+  DBKeys *keys = create_keys(end - start);
+  for (int i = start; i < end; i++)
+    keys->keys[i - start] = index->entries[i]->item->key;
+  pthread_mutex_unlock(db_mutex);
+
+  return keys;
+}
+
 // Returns the attribute Model.
 DBModel *def_model(DBModel *parent, const char *key, DBModelType type)
 {
@@ -293,6 +888,206 @@ DBKeys *get_model_keys(DBModel *model)
   return keys;
 }
 
+// Whether an attribute of an object model is one of its fields, not a constraint
+bool static is_model_field(DBModel *attribute)
+{
+  return attribute != NULL && attribute->key != NULL && attribute->type < DBModelAttr_ArrayTypeGetter;
+}
+
+// Count the checks and object fields a model compiles to
+void static count_model_checks(DBModel *model, int *checks_length, int *fields_length)
+{
+  (*checks_length)++;
+
+  if (model->type == DBModelType_Object)
+  {
+    for (int i = 0; i < model->intvalue; i++)
+    {
+      if (!is_model_field(model->attributes[i]))
+        continue;
+      (*fields_length)++;
+      count_model_checks(model->attributes[i], checks_length, fields_length);
+    }
+  }
+  else if (model->type == DBModelType_Array && get_model_attr(model, DBModelAttr_ArrayTypeGetter))
+  {
+    count_model_checks(get_model_attr(model, DBModelAttr_ArrayTypeGetter), checks_length, fields_length);
+  }
+}
+
+// Append the checks of a model to the program; returns the index of its own check
+int static compile_model_check(DBModelProgram *program, DBModel *model)
+{
+  int index = program->length++;
+  DBModelCheck *check = &program->checks[index];
+
+  check->type = model->type;
+  check->key = model->key;
+  check->first_field = 0;
+  check->fields_length = 0;
+  check->element = -1;
+  check->min_length = -1;
+  check->max_length = -1;
+
+  if (model->type == DBModelType_Object)
+  {
+    // reserve the field slots first, so the fields of one object stay together
+    int fields_length = 0;
+    for (int i = 0; i < model->intvalue; i++)
+      fields_length += is_model_field(model->attributes[i]);
+    check->first_field = program->fields_length;
+    check->fields_length = fields_length;
+    program->fields_length += fields_length;
+
+    int field_slot = 0;
+    for (int i = 0; i < model->intvalue; i++)
+    {
+      if (!is_model_field(model->attributes[i]))
+        continue;
+      program->fields[check->first_field + field_slot] = compile_model_check(program, model->attributes[i]);
+      field_slot++;
+    }
+  }
+  else if (model->type == DBModelType_Array)
+  {
+    DBModel *attribute = get_model_attr(model, DBModelAttr_MinLength);
+    check->min_length = attribute ? attribute->intvalue : -1;
+    attribute = get_model_attr(model, DBModelAttr_MaxLength);
+    check->max_length = attribute ? attribute->intvalue : -1;
+
+    DBModel *array_type = get_model_attr(model, DBModelAttr_ArrayTypeGetter);
+    if (array_type)
+      check->element = compile_model_check(program, array_type);
+  }
+
+  return index;
+}
+
+DBModelProgram *compile_model(DBModel *model)
+{
+  if (model == NULL)
+    return NULL;
+
+  int checks_length = 0, fields_length = 0;
+  count_model_checks(model, &checks_length, &fields_length);
+
+  DBModelProgram *program = (DBModelProgram *)malloc(sizeof(DBModelProgram));
+  if (!program)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  program->checks = (DBModelCheck *)malloc(checks_length * sizeof(DBModelCheck));
+  program->fields = (int *)malloc((fields_length + 1) * sizeof(int));
+  if (!program->checks || !program->fields)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  program->length = 0;
+  program->fields_length = 0;
+  compile_model_check(program, model);
+
+  return program;
+}
+
+void free_model_program(DBModelProgram *program)
+{
+  if (program == NULL)
+    return;
+
+  free(program->checks);
+  free(program->fields);
+  free(program);
+}
+
+bool static validate_check(const DBModelProgram *program, int index, const cJSON *json)
+{
+  const DBModelCheck *check = &program->checks[index];
+
+  switch (check->type)
+  {
+  case DBModelType_String:
+    return cJSON_IsString(json);
+
+  case DBModelType_Number:
+    return cJSON_IsNumber(json);
+
+  case DBModelType_Boolean:
+    return cJSON_IsBool(json);
+
+  case DBModelType_Null:
+    return cJSON_IsNull(json);
+
+  case DBModelType_Array:
+  {
+    if (!cJSON_IsArray(json))
+      return false;
+
+    int length = 0;
+    const cJSON *element = NULL;
+    cJSON_ArrayForEach(element, json)
+    {
+      if (check->element < 0 || !validate_check(program, check->element, element))
+        return false;
+      length++;
+    }
+
+    return (check->min_length < 0 || length >= check->min_length) && (check->max_length < 0 || length <= check->max_length);
+  }
+
+  case DBModelType_Object:
+  {
+    if (!cJSON_IsObject(json))
+      return false;
+
+    const int *fields = &program->fields[check->first_field];
+    bool seen[check->fields_length + 1];
+    memset(seen, 0, sizeof(seen));
+
+    // documents usually list the fields in model order, so the next field is tried first
+    int next_slot = 0, seen_length = 0;
+    const cJSON *member = NULL;
+    cJSON_ArrayForEach(member, json)
+    {
+      int slot = -1;
+      if (next_slot < check->fields_length && strcmp(program->checks[fields[next_slot]].key, member->string) == 0)
+        slot = next_slot;
+      else
+      {
+        for (int i = 0; i < check->fields_length; i++)
+        {
+          if (strcmp(program->checks[fields[i]].key, member->string) == 0)
+          {
+            slot = i;
+            break;
+          }
+        }
+      }
+
+      // an unknown or repeated field
+      if (slot < 0 || seen[slot])
+        return false;
+      if (!validate_check(program, fields[slot], member))
+        return false;
+
+      seen[slot] = true;
+      seen_length++;
+      next_slot = slot + 1;
+    }
+
+    return seen_length == check->fields_length;
+  }
+
+  default:
+    return false;
+  }
+}
+
+bool validate_cjson_with_model(const DBModelProgram *program, const cJSON *json)
+{
+  if (program == NULL || json == NULL)
+    return false;
+
+  return validate_check(program, 0, json);
+}
+
 #define GET_KEYS_CHUNK_SIZE 8
 
 DBKeys *get_cjson_keys(cJSON *json)
@@ -345,29 +1140,34 @@ DBKeys *get_database_keys()
   int count = 0;
   DBItem *cursor = NULL;
 
-  for (int i = 0; i < HASH_TABLE_SIZE; i++)
+  pthread_mutex_lock(db_mutex);
+  for (int t = 0; t < 2; t++)
   {
-    cursor = hash_table[i];
-    while (cursor != NULL)
+    for (unsigned long i = 0; i < tables[t].size; i++)
     {
-      count++;
-      if (keys->length < count)
+      cursor = tables[t].buckets[i];
+      while (cursor != NULL)
       {
-        keys->length += GET_KEYS_CHUNK_SIZE;
-        keys->keys = (const char **)realloc(keys->keys, keys->length * sizeof(const char *));
-        if (!keys->keys)
-          memory_error_handler(__FILE__, __LINE__, __func__);
+        count++;
+        if (keys->length < count)
+        {
+          keys->length += GET_KEYS_CHUNK_SIZE;
+          keys->keys = (const char **)realloc(keys->keys, keys->length * sizeof(const char *));
+          if (!keys->keys)
+            memory_error_handler(__FILE__, __LINE__, __func__);
+        }
+        keys->keys[count - 1] = cursor->key;
+        cursor = cursor->next;
       }
-      keys->keys[count - 1] = cursor->key;
-      cursor = cursor->next;
     }
   }
+  pthread_mutex_unlock(db_mutex);
 
   if (keys->length != count)
   {
     keys->length = count;
     keys->keys = (const char **)realloc(keys->keys, count * sizeof(const char *));
-    if (!keys->keys)
+    if (!keys->keys && count > 0)
       memory_error_handler(__FILE__, __LINE__, __func__);
   }
 
@@ -383,81 +1183,205 @@ void free_keys(DBKeys *keys)
   free(keys);
 }
 
+void static free_hash_table()
+{
+  clear_indexes();
+  DBItem *item = NULL;
+  DBItem *next = NULL;
+  for (int t = 0; t < 2; t++)
+  {
+    for (unsigned long i = 0; i < tables[t].size; i++)
+    {
+      item = tables[t].buckets[i];
+      while (item != NULL)
+      {
+        next = item->next;
+        free(item->key);
+        free(item);
+        item = next;
+      }
+    }
+    free(tables[t].buckets);
+    tables[t].buckets = NULL;
+    tables[t].size = 0;
+    tables[t].count = 0;
+  }
+  rehashing_index = -1;
+
+  for (int i = 0; i < SAVE_SEGMENTS; i++)
+  {
+    segments[i].items = NULL;
+    segments[i].dirty = false;
+  }
+}
+
+// Adds the items of a JSON object file, parsing one at a time so the file is never held in memory whole;
+// called with the mutex locked. Returns false if the file is not a valid object
+bool static load_items(FILE *file)
+{
+  cJSON_Stream *json_stream = cJSON_StreamNewFromFile(file);
+  cJSON *json_member = NULL;
+  DBItem *item = NULL;
+
+  while ((json_member = cJSON_StreamNextMember(json_stream)) != NULL)
+  {
+    item = create_item_with_json(json_member->string, json_member);
+    add_item_to_hash_table(json_member->string, item);
+    index_item(item);
+  }
+  bool is_valid = !cJSON_StreamFailed(json_stream);
+
+  cJSON_StreamDelete(json_stream);
+  return is_valid;
+}
+
 void load_database(const char *filename)
 {
-  // read the JSON file
+  // open the JSON file
   FILE *file = fopen(filename, "r");
-  char *db_json_string = NULL;
-  long length = 0;
 
   if (file == NULL)
   {
     printf("Warning: Failed to open file %s\n", filename);
   }
-  else
+
+  // clear table if table is not NULL
+  free_hash_table();
+
+  // create hash table
+  create_hash_table();
+
+  pthread_mutex_lock(db_mutex);
+  // an invalid file loads as an empty database
+  if (!load_items(file) && file != NULL)
   {
-    fseek(file, 0, SEEK_END);
-    length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    db_json_string = (char *)calloc((length + 1), sizeof(char));
-    if (!db_json_string)
-      memory_error_handler(__FILE__, __LINE__, __func__);
-    fread(db_json_string, 1, length, file);
-    fclose(file);
-    // prevent memory leak
-    db_json_string[length] = '\0';
+    free_hash_table();
+    create_hash_table();
   }
+  // every segment is written by the next incremental save, stale files in its directory included
+  for (int i = 0; i < SAVE_SEGMENTS; i++)
+    segments[i].dirty = true;
+  pthread_mutex_unlock(db_mutex);
 
-  // clear table if table is not NULL
-  if (hash_table != NULL)
+  if (file != NULL)
+    fclose(file);
+}
+
+void static segment_path(char *path, const char *dirname, int segment, const char *suffix)
+{
+  snprintf(path, SAVE_SEGMENT_PATH_SIZE, "%s/segment-%03d.json%s", dirname, segment, suffix);
+}
+
+bool load_database_segments(const char *dirname)
+{
+  struct stat dir_stat;
+  if (dirname == NULL || stat(dirname, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))
+    return false;
+
+  free_hash_table();
+  create_hash_table();
+
+  char path[SAVE_SEGMENT_PATH_SIZE];
+  bool is_valid = true;
+  // what was just read needs no writing, but an item found in another segment's file has to be
+  // written to its own, and that file rewritten without it
+  bool is_misplaced[SAVE_SEGMENTS] = {false};
+
+  pthread_mutex_lock(db_mutex);
+  for (int i = 0; i < SAVE_SEGMENTS && is_valid; i++)
   {
-    DBItem *item = NULL;
-    DBItem *next = NULL;
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-    {
-      item = hash_table[i];
-      while (item != NULL)
+    segment_path(path, dirname, i, "");
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+      continue;
+    is_valid = load_items(file);
+    fclose(file);
+
+    // adding an item marks the segment it belongs to
+    segments[i].dirty = false;
+    for (int j = 0; j < SAVE_SEGMENTS; j++)
+      if (segments[j].dirty)
       {
-        next = item->next;
-        free(item->key);
-        free(item);
-        item = next;
+        is_misplaced[i] = is_misplaced[j] = true;
+        segments[j].dirty = false;
       }
-    }
-    free(hash_table);
-    hash_table = NULL;
   }
 
-  // create hash table
-  hash_table = (DBItem **)calloc(HASH_TABLE_SIZE, sizeof(DBItem *));
+  // an invalid segment loads as an empty database, as an invalid file does
+  if (!is_valid)
+  {
+    printf("Warning: Invalid segment %s\n", path);
+    free_hash_table();
+    create_hash_table();
+  }
 
-  if (!hash_table)
+  for (int i = 0; i < SAVE_SEGMENTS; i++)
+    segments[i].dirty = is_valid && is_misplaced[i];
+  pthread_mutex_unlock(db_mutex);
+
+  return true;
+}
+
+// Writes one segment to a temporary file and renames it over the segment; called with the mutex locked
+bool static write_segment(const char *dirname, int segment)
+{
+  char path[SAVE_SEGMENT_PATH_SIZE];
+  char temp_path[SAVE_SEGMENT_PATH_SIZE];
+  segment_path(path, dirname, segment, "");
+  segment_path(temp_path, dirname, segment, ".tmp");
+
+  cJSON_Arena *json_arena = cJSON_ArenaNew(0);
+  if (!json_arena)
     memory_error_handler(__FILE__, __LINE__, __func__);
+  cJSON_Arena *previous_arena = cJSON_ArenaUse(json_arena);
+  cJSON *json_root = cJSON_CreateObject();
+  for (DBItem *item = segments[segment].items; item != NULL; item = item->segment_next)
+    cJSON_AddItemReferenceToObject(json_root, item->key, item->json);
+  cJSON_ArenaUse(previous_arena);
 
-  // create json root
-  cJSON *json_root = NULL;
-  if (db_json_string)
+  char *data = cJSON_Print(json_root);
+  cJSON_ArenaDelete(json_arena);
+  if (!data)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+
+  FILE *file = fopen(temp_path, "w");
+  bool is_written = file != NULL && fputs(data, file) >= 0 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  if (file != NULL && fclose(file) != 0)
+    is_written = false;
+  free(data);
+
+  if (!is_written || rename(temp_path, path) != 0)
   {
-    json_root = cJSON_Parse(db_json_string);
-    free(db_json_string);
+    printf("Warning: Failed to write segment %s\n", path);
+    remove(temp_path);
+    return false;
   }
-  if (json_root == NULL)
-    json_root = cJSON_CreateObject();
 
-  // load items
-  cJSON *json_cursor = json_root->child;
-  DBItem *item = NULL;
+  return true;
+}
+
+int save_database_segments(const char *dirname)
+{
+  if (dirname == NULL || (mkdir(dirname, 0755) != 0 && errno != EEXIST))
+    return -1;
 
+  int written = 0;
   pthread_mutex_lock(db_mutex);
-  while (json_cursor != NULL)
+  for (int i = 0; i < SAVE_SEGMENTS; i++)
   {
-    item = create_item_with_json(json_cursor->string, cJSON_Duplicate(json_cursor, true));
-    add_item_to_hash_table(json_cursor->string, item);
-    json_cursor = json_cursor->next;
+    if (!segments[i].dirty)
+      continue;
+    if (!write_segment(dirname, i))
+    {
+      written = -1;
+      break;
+    }
+    segments[i].dirty = false;
+    written++;
   }
   pthread_mutex_unlock(db_mutex);
 
-  cJSON_Delete(json_root);
+  return written;
 }
 
 void save_database(const char *filename)
@@ -466,25 +1390,34 @@ void save_database(const char *filename)
   if (file == NULL)
     return;
 
+  // the root and its references only live until printed, so they come from one arena
+  cJSON_Arena *json_arena = cJSON_ArenaNew(0);
+  if (!json_arena)
+    memory_error_handler(__FILE__, __LINE__, __func__);
+  cJSON_Arena *previous_arena = cJSON_ArenaUse(json_arena);
   cJSON *json_root = cJSON_CreateObject();
 
   pthread_mutex_lock(db_mutex);
 
-  // iter hash table and get items, then set to json root
+  // iter both hash tables and get items, then set to json root
   DBItem *item = NULL;
-  for (int i = 0; i < HASH_TABLE_SIZE; i++)
+  for (int t = 0; t < 2; t++)
   {
-    item = hash_table[i];
-    while (item != NULL)
+    for (unsigned long i = 0; i < tables[t].size; i++)
     {
-      cJSON_AddItemReferenceToObject(json_root, item->key, item->json);
-      item = item->next;
+      item = tables[t].buckets[i];
+      while (item != NULL)
+      {
+        cJSON_AddItemReferenceToObject(json_root, item->key, item->json);
+        item = item->next;
+      }
     }
   }
   pthread_mutex_unlock(db_mutex);
+  cJSON_ArenaUse(previous_arena);
 
   char *data = cJSON_Print(json_root);
-  cJSON_Delete(json_root);
+  cJSON_ArenaDelete(json_arena);
   if (data)
   {
     fprintf(file, "%s", data);
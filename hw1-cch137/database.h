@@ -5,6 +5,9 @@
 #include "./cJSON.h"
 
 #define DATABASE_FILENAME "database.json"
+#define DATABASE_SEGMENTS_DIRNAME "database.segments"
+// Segment files of the on-disk layout; an item is saved in the segment its key hashes to
+#define SAVE_SEGMENTS 256
 
 // Struct for storing key-value pairs in the database.
 // Each DBItem contains a key (string) and a value (cJSON object), along with a pointer to the next item (for linked list chaining).
@@ -13,6 +16,13 @@ typedef struct DBItem
   char *key;
   cJSON *json;
   struct DBItem *next;
+  // Hash of the key, kept for moving the item when the table is resized
+  unsigned long hash;
+  // Entries of the item in the secondary indexes, so they can be removed without reading the json again
+  struct DBIndexEntry *index_entries;
+  // Neighbours among the items saved in the same segment file
+  struct DBItem *segment_prev;
+  struct DBItem *segment_next;
 } DBItem;
 
 // Check if an item with the given key exists
@@ -77,6 +87,44 @@ typedef struct DBKeys
 // Get all keys in a model
 DBKeys *get_model_keys(DBModel *model);
 
+// One node of a compiled model.
+typedef struct DBModelCheck
+{
+  DBModelType type;
+  // For an object field, its key
+  const char *key;
+  // For an object, where the check indices of its fields start in `fields`, and how many there are
+  int first_field;
+  int fields_length;
+  // For an array, the check of its elements (-1 if it has to be empty) and its length bounds (-1 for none)
+  int element;
+  int min_length;
+  int max_length;
+} DBModelCheck;
+
+// A model compiled into a flat program: its nodes in depth-first order, with object fields resolved
+// to check indices and array bounds read from the attributes once, so a document is validated in one
+// pass over it without searching the model.
+typedef struct DBModelProgram
+{
+  int length;
+  DBModelCheck *checks;
+  // Check index of every object field, the fields of each object together and in model order
+  int fields_length;
+  int *fields;
+} DBModelProgram;
+
+// Compile a model for validation
+// The program does not follow later changes to the model
+DBModelProgram *compile_model(DBModel *model);
+
+// Free a compiled model
+void free_model_program(DBModelProgram *program);
+
+// Check that a cJSON value matches a compiled model: every object has exactly the fields of its model,
+// every value has the model's type, and every array its length bounds and element type
+bool validate_cjson_with_model(const DBModelProgram *program, const cJSON *json);
+
 // Get all keys in a cJSON object
 DBKeys *get_cjson_keys(cJSON *json);
 
@@ -86,10 +134,45 @@ DBKeys *get_database_keys();
 // Free memory allocated for the keys
 void free_keys(DBKeys *keys);
 
+// Kinds of secondary index on a field of the items' json.
+// A hash index finds the items whose field equals a value; an array field is indexed by each of its elements.
+// An ordered index finds the items whose number field lies in a range.
+typedef enum DBIndexType
+{
+  DBIndexType_Hash,
+  DBIndexType_Ordered
+} DBIndexType;
+
+// Define a secondary index on a top-level field and build it from the items already stored
+// Returns false if the field already has an index of this type
+// The indexes are kept up to date by set_item, delete_item and rename_item
+bool def_index(const char *field, DBIndexType type);
+
+// Refresh the indexes of an item after its json was edited in place, and mark it for the next incremental save
+void reindex_item(const char *key);
+
+// Get the keys of the items whose field equals the value, through the hash index of the field
+// Returns NULL if the field has no hash index
+DBKeys *get_index_keys(const char *field, const cJSON *value);
+
+// Get the keys of the items whose number field is within [min, max], in ascending order, through the ordered index of the field
+// Returns NULL if the field has no ordered index
+DBKeys *get_index_range_keys(const char *field, double min, double max);
+
 // Load the database from a JSON file
 void load_database(const char *filename);
 
 // Save the current state of the database to a JSON file
 void save_database(const char *filename);
 
+// Load the database from the segment files in a directory written by save_database_segments
+// Returns false, leaving the database as it was, if the directory does not exist
+bool load_database_segments(const char *dirname);
+
+// Save the database as segment files in a directory, each a JSON object holding the items whose key hashes to it
+// Only the segments whose items were set, deleted, renamed or reindexed since the last save or load are rewritten,
+// each through a temporary file renamed over the old one, so a segment on disk is always whole
+// Returns the number of segments written, or -1 if one could not be
+int save_database_segments(const char *dirname);
+
 #endif
@@ -480,10 +480,34 @@ void print_person(DBItem *item)
   printf("----------------------------------------------------------------\n");
 }
 
+// The person model compiled on first use; main_menu never changes the model after defining it
+DBModelProgram *person_program = NULL;
+DBModel *person_program_model = NULL;
+
+bool validate_person(DBModel *person_model, cJSON *person_json)
+{
+  if (person_program_model != person_model)
+  {
+    free_model_program(person_program);
+    person_program = compile_model(person_model);
+    person_program_model = person_model;
+  }
+
+  return validate_cjson_with_model(person_program, person_json);
+}
+
 void create_person(DBModel *person_model)
 {
   printf("Creating a new person.\n");
   cJSON *person_json = input_cjson_with_model(person_model, 0);
+
+  if (!validate_person(person_model, person_json))
+  {
+    printf("Person does not match the model. Person has not been created.\n");
+    cJSON_Delete(person_json);
+    return;
+  }
+
   char *name = cJSON_GetObjectItem(person_json, "name")->valuestring;
 
   if (exists(name))
@@ -554,8 +578,20 @@ void update_person(DBModel *person_model)
     memory_error_handler(__FILE__, __LINE__, __func__);
   strcpy(before_name, name_buffer);
 
-  // edit cjson
+  // edit cjson, keeping a copy to go back to if the result does not match the model
+  cJSON *before_json = cJSON_Duplicate(item->json, true);
   bool is_success = edit_cjson_with_model(person_model, item->json, 0);
+
+  if (!validate_person(person_model, item->json))
+  {
+    printf("Person does not match the model. Operation canceled.\n");
+    cJSON_Delete(item->json);
+    item->json = before_json;
+    free(before_name);
+    return;
+  }
+  cJSON_Delete(before_json);
+
   char *after_name = cJSON_GetObjectItem(item->json, "name")->valuestring;
 
   // if name changed, check if it exists, cancel the update
@@ -571,6 +607,7 @@ void update_person(DBModel *person_model)
     }
     rename_item(before_name, after_name);
   }
+  reindex_item(after_name);
 
   free(before_name);
   if (is_success)
@@ -579,6 +616,43 @@ void update_person(DBModel *person_model)
     printf("Person has not been updated.\n");
 }
 
+void query_persons()
+{
+  printf("Enter the field to query: ");
+  char *field = input_string();
+  printf("Enter the value, or min~max for a range of numbers: ");
+  char *value_string = input_string();
+
+  DBKeys *keys = NULL;
+  double min = 0, max = 0;
+  char tail = 0;
+  if (sscanf(value_string, "%lf~%lf%c", &min, &max, &tail) == 2)
+    keys = get_index_range_keys(field, min, max);
+  else
+  {
+    // a value that is not valid JSON is taken as a string
+    cJSON *value = cJSON_Parse(value_string);
+    if (value == NULL)
+      value = cJSON_CreateString(value_string);
+    keys = get_index_keys(field, value);
+    cJSON_Delete(value);
+  }
+
+  if (keys == NULL)
+    printf("The field %s has no index for this query.\n", field);
+  else if (keys->length == 0)
+    printf("No person found.\n");
+  else
+  {
+    for (int i = 0; i < keys->length; i++)
+      printf("%d) %s\n", i + 1, keys->keys[i]);
+  }
+
+  free_keys(keys);
+  free(field);
+  free(value_string);
+}
+
 void delete_person()
 {
   printf("Enter the name of the person to delete: ");
@@ -613,6 +687,14 @@ void main_menu()
   def_model(person_model, "isMarried", DBModelType_Boolean);
   def_model(person_model, "isEmployed", DBModelType_Boolean);
 
+  // ################ Indexes ################
+  def_index("jobTitle", DBIndexType_Hash);
+  def_index("isMarried", DBIndexType_Hash);
+  def_index("isEmployed", DBIndexType_Hash);
+  def_index("phoneNumbers", DBIndexType_Hash);
+  def_index("emailAddresses", DBIndexType_Hash);
+  def_index("age", DBIndexType_Ordered);
+
   while (1)
   {
     printf("\n################ Main Menu ################\n");
@@ -622,6 +704,7 @@ void main_menu()
     printf("R - Find a person\n");
     printf("U - Update a person\n");
     printf("D - Delete a person\n");
+    printf("Q - Query persons by a field\n");
     printf("K - List keys\n");
     printf("S - Save database\n");
     printf("X - Exit\n");
@@ -649,10 +732,17 @@ void main_menu()
       delete_person();
       break;
 
+    case 'Q':
+    case 'q':
+      query_persons();
+      break;
+
     case 'S':
     case 's':
-      save_database(DATABASE_FILENAME);
-      printf("Database saved successfully.\n");
+      if (save_database_segments(DATABASE_SEGMENTS_DIRNAME) < 0)
+        printf("Failed to save database.\n");
+      else
+        printf("Database saved successfully.\n");
       break;
 
     case 'K':
@@ -23,6 +23,9 @@ void update_person(DBModel *person_model);
 // Delete a person from the database
 void delete_person();
 
+// Query persons through the index of a field, by value or by a range of numbers
+void query_persons();
+
 // Capture user input and create a cJSON object based on a model
 cJSON *input_cjson_with_model(DBModel *model, int tab_depth);
 
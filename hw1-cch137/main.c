@@ -3,9 +3,11 @@
 
 int main()
 {
-  load_database(DATABASE_FILENAME);
+  // the single file is only read until the first save writes the segments
+  if (!load_database_segments(DATABASE_SEGMENTS_DIRNAME))
+    load_database(DATABASE_FILENAME);
   main_menu();
-  save_database(DATABASE_FILENAME);
+  save_database_segments(DATABASE_SEGMENTS_DIRNAME);
 
   return 0;
 }
@@ -186,12 +186,145 @@ bool test_get_cjson_keys(cJSON *json, int expected_count)
   }
 }
 
+bool test_get_index_keys(const char *field, cJSON *value, int expected_count)
+{
+  char *value_string = cJSON_PrintUnformatted(value);
+  DBKeys *keys = get_index_keys(field, value);
+  bool result = expected_count < 0 ? keys == NULL : keys != NULL && keys->length == expected_count;
+
+  if (!result)
+    printf("get_index_keys(%s, %s) " FAIL " - expected %d keys, got %d\n", field, value_string, expected_count, keys ? keys->length : -1);
+  else
+    printf("get_index_keys(%s, %s) " PASS "\n", field, value_string);
+
+  free_keys(keys);
+  cJSON_free(value_string);
+  cJSON_Delete(value);
+  return result;
+}
+
+bool test_get_index_range_keys(const char *field, double min, double max, int expected_count, const char *expected_first)
+{
+  DBKeys *keys = get_index_range_keys(field, min, max);
+
+  if (keys == NULL || keys->length != expected_count)
+  {
+    printf("get_index_range_keys(%s, %g, %g) " FAIL " - expected %d keys, got %d\n", field, min, max, expected_count, keys ? keys->length : -1);
+    free_keys(keys);
+    return false;
+  }
+  if (expected_first != NULL && strcmp(keys->keys[0], expected_first) != 0)
+  {
+    printf("get_index_range_keys(%s, %g, %g) " FAIL " - expected %s first, got %s\n", field, min, max, expected_first, keys->keys[0]);
+    free_keys(keys);
+    return false;
+  }
+  printf("get_index_range_keys(%s, %g, %g) " PASS "\n", field, min, max);
+  free_keys(keys);
+  return true;
+}
+
+// Sets and deletes enough items for the table to grow and shrink again, checking every key on the way
+bool test_hash_table_resize(int count)
+{
+  char key[32];
+  int missing = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    snprintf(key, sizeof(key), "resize-%d", i);
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "name", key);
+    set_item(key, json);
+  }
+  for (int i = 0; i < count; i++)
+  {
+    snprintf(key, sizeof(key), "resize-%d", i);
+    DBItem *item = get_item(key);
+    missing += item == NULL || strcmp(item->key, key) != 0;
+  }
+
+  DBKeys *keys = get_database_keys();
+  int grown_length = keys->length;
+  free_keys(keys);
+
+  for (int i = 0; i < count; i++)
+  {
+    snprintf(key, sizeof(key), "resize-%d", i);
+    missing += !delete_item(key);
+  }
+  for (int i = 0; i < count; i++)
+  {
+    snprintf(key, sizeof(key), "resize-%d", i);
+    missing += exists(key);
+  }
+
+  if (missing != 0 || grown_length < count)
+  {
+    printf("hash table resize(%d) " FAIL " - %d keys lost or left, %d keys listed\n", count, missing, grown_length);
+    return false;
+  }
+  printf("hash table resize(%d) " PASS "\n", count);
+  return true;
+}
+
+bool test_validate_cjson_with_model(const DBModelProgram *program, const char *json_string, bool expected_value)
+{
+  cJSON *json = cJSON_Parse(json_string);
+  bool result = validate_cjson_with_model(program, json);
+  cJSON_Delete(json);
+
+  if (result != expected_value)
+  {
+    printf("validate_cjson_with_model(%s) " FAIL " - expected %s\n", json_string, expected_value ? "valid" : "invalid");
+    return false;
+  }
+  printf("validate_cjson_with_model(%s) " PASS "\n", json_string);
+  return true;
+}
+
+bool test_save_database_segments(const char *dirname, int expected_keys)
+{
+  char path[4096];
+  int first = save_database_segments(dirname);
+  int unchanged = save_database_segments(dirname);
+  reindex_item("Bob");
+  int edited = save_database_segments(dirname);
+
+  bool is_loaded = load_database_segments(dirname);
+  DBKeys *keys = get_database_keys();
+  int loaded_keys = keys->length;
+  free_keys(keys);
+  int reloaded = save_database_segments(dirname);
+
+  for (int i = 0; i < SAVE_SEGMENTS; i++)
+  {
+    snprintf(path, sizeof(path), "%s/segment-%03d.json", dirname, i);
+    remove(path);
+  }
+  remove(dirname);
+
+  if (first <= 0 || unchanged != 0 || edited != 1 || !is_loaded || loaded_keys != expected_keys || reloaded != 0)
+  {
+    printf("save_database_segments(%s) " FAIL " - wrote %d, %d, %d, %d segments, loaded %d keys\n", dirname, first, unchanged, edited, reloaded, loaded_keys);
+    return false;
+  }
+  printf("save_database_segments(%s) " PASS "\n", dirname);
+  return true;
+}
+
 int main()
 {
   // Load the database twice to test the cleaning functionality
   load_database("test-before.json");
   load_database("test-before.json");
 
+  // defined before the writes below, which have to keep them up to date
+  def_index("jobTitle", DBIndexType_Hash);
+  def_index("isEmployed", DBIndexType_Hash);
+  def_index("phoneNumbers", DBIndexType_Hash);
+  def_index("age", DBIndexType_Ordered);
+
   int test_stats[2] = {0, 0}; // Index 0: FAIL, Index 1: PASS
 
   test_stats[test_get_item("Alice", "Alice")]++;
@@ -220,6 +353,46 @@ int main()
   test_stats[test_get_database_keys(26)]++;
   test_stats[test_get_cjson_keys(new_person1, 2)]++;
 
+  test_stats[test_get_index_keys("jobTitle", cJSON_CreateString("Engineer"), 1)]++;
+  test_stats[test_get_index_keys("jobTitle", cJSON_CreateString("Software Engineer"), 0)]++;
+  test_stats[test_get_index_keys("isEmployed", cJSON_CreateTrue(), 25)]++;
+  test_stats[test_get_index_keys("phoneNumbers", cJSON_CreateString("555-123-4567"), 1)]++;
+  test_stats[test_get_index_keys("address", cJSON_CreateString("456 Elm St"), -1)]++;
+  test_stats[test_get_index_range_keys("age", 25, 30, 13, "Bob")]++;
+  test_stats[test_get_index_range_keys("age", 31, 30, 0, NULL)]++;
+
+  test_stats[test_hash_table_resize(50000)]++;
+  test_stats[test_get_database_keys(26)]++;
+  test_stats[test_get_item("Bob", "Bob")]++;
+
+  cJSON_SetValuestring(cJSON_GetObjectItem(get_item("Bob")->json, "jobTitle"), "Data Engineer");
+  reindex_item("Bob");
+  test_stats[test_get_index_keys("jobTitle", cJSON_CreateString("Data Scientist"), 0)]++;
+  test_stats[test_get_index_keys("jobTitle", cJSON_CreateString("Data Engineer"), 1)]++;
+
+  test_stats[test_save_database_segments("test-segments", 26)]++;
+  test_stats[test_get_item("Bob", "Bob")]++;
+  test_stats[test_get_index_keys("jobTitle", cJSON_CreateString("Data Engineer"), 1)]++;
+
+  DBModel *person_model = def_model(NULL, "Person", DBModelType_Object);
+  def_model(person_model, "name", DBModelType_String);
+  def_model(person_model, "age", DBModelType_Number);
+  DBModel *phone_numbers_model = def_model(person_model, "phoneNumbers", DBModelType_Array);
+  def_model(phone_numbers_model, DBModel_ArrayTypeSymbol, DBModelType_String);
+  def_model_attr(phone_numbers_model, DBModelAttr_MaxLength, 2);
+  def_model(person_model, "isMarried", DBModelType_Boolean);
+  DBModelProgram *person_program = compile_model(person_model);
+
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":1,\"phoneNumbers\":[\"1\"],\"isMarried\":true}", true)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"isMarried\":false,\"phoneNumbers\":[],\"age\":1,\"name\":\"A\"}", true)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":\"1\",\"phoneNumbers\":[],\"isMarried\":true}", false)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":1,\"phoneNumbers\":[\"1\",\"2\",\"3\"],\"isMarried\":true}", false)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":1,\"phoneNumbers\":[1],\"isMarried\":true}", false)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":1,\"phoneNumbers\":[]}", false)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"name\":\"B\",\"age\":1,\"phoneNumbers\":[]}", false)]++;
+  test_stats[test_validate_cjson_with_model(person_program, "{\"name\":\"A\",\"age\":1,\"phoneNumbers\":[],\"isMarried\":true,\"extra\":null}", false)]++;
+  free_model_program(person_program);
+
   save_database("test-after.json");
 
   printf("\ntotal " PASS ": %d\ntotal " FAIL ": %d\n", test_stats[1], test_stats[0]);
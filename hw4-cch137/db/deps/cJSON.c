@@ -49,6 +49,14 @@
 #include <locale.h>
 #endif
 
+#if !defined(CJSON_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define CJSON_SIMD_X86
+#include <immintrin.h>
+#elif !defined(CJSON_NO_SIMD) && defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define CJSON_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning (pop)
 #endif
@@ -185,7 +193,172 @@ static void * CJSON_CDECL internal_realloc(void *pointer, size_t size)
 
 static internal_hooks global_hooks = { internal_malloc, internal_free, internal_realloc };
 
-static unsigned char* cJSON_strdup(const unsigned char* string, const internal_hooks * const hooks)
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define CJSON_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define CJSON_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define CJSON_THREAD_LOCAL __declspec(thread)
+#else
+#define CJSON_THREAD_LOCAL
+#endif
+
+#define CJSON_ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+/* sized so that what follows it is aligned for any member of cJSON */
+typedef union arena_block
+{
+    union arena_block *next;
+    double number;
+    void *pointer;
+} arena_block;
+
+struct cJSON_Arena
+{
+    arena_block *blocks;
+    /* the block being bumped through, NULL before the first one */
+    arena_block *current;
+    unsigned char *next;
+    size_t left;
+    size_t block_size;
+    size_t size;
+};
+
+/* Every node is allocated with the arena it came from in front of it, NULL for the hooks, so that
+ * freeing the node and allocating its strings know where the memory belongs. */
+typedef struct node_header
+{
+    cJSON_Arena *arena;
+    cJSON item;
+} node_header;
+
+#define node_header_of(item) ((node_header*)(void*)((unsigned char*)(item) - offsetof(node_header, item)))
+
+static CJSON_THREAD_LOCAL cJSON_Arena *current_arena = NULL;
+
+static void *arena_allocate(cJSON_Arena * const arena, size_t size)
+{
+    arena_block *block = NULL;
+    unsigned char *allocated = NULL;
+
+    size = (size + sizeof(arena_block) - 1) / sizeof(arena_block) * sizeof(arena_block);
+    if (size > arena->left)
+    {
+        block = (arena_block*)global_hooks.allocate(sizeof(arena_block) + ((size > arena->block_size) ? size : arena->block_size));
+        if (block == NULL)
+        {
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+        if (size > arena->block_size)
+        {
+            /* too large to share a block, the one being bumped through stays */
+            arena->size += sizeof(arena_block) + size;
+            return block + 1;
+        }
+        arena->size += sizeof(arena_block) + arena->block_size;
+        arena->current = block;
+        arena->next = (unsigned char*)(block + 1);
+        arena->left = arena->block_size;
+    }
+
+    allocated = arena->next;
+    arena->next += size;
+    arena->left -= size;
+
+    return allocated;
+}
+
+/* Memory for a string of item, from the item's arena if it has one. */
+static void *allocate_for(const cJSON * const item, size_t size, const internal_hooks * const hooks)
+{
+    cJSON_Arena *arena = node_header_of(item)->arena;
+    if (arena != NULL)
+    {
+        return arena_allocate(arena, size);
+    }
+
+    return hooks->allocate(size);
+}
+
+static void deallocate_for(const cJSON * const item, void *pointer, const internal_hooks * const hooks)
+{
+    if (node_header_of(item)->arena == NULL)
+    {
+        hooks->deallocate(pointer);
+    }
+}
+
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaNew(size_t block_size)
+{
+    cJSON_Arena *arena = (cJSON_Arena*)global_hooks.allocate(sizeof(cJSON_Arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    memset(arena, '\0', sizeof(cJSON_Arena));
+    arena->block_size = (block_size > 0) ? block_size : CJSON_ARENA_DEFAULT_BLOCK_SIZE;
+
+    return arena;
+}
+
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaUse(cJSON_Arena *arena)
+{
+    cJSON_Arena *previous = current_arena;
+    current_arena = arena;
+
+    return previous;
+}
+
+CJSON_PUBLIC(void) cJSON_ArenaReset(cJSON_Arena *arena)
+{
+    arena_block *block = NULL;
+    arena_block *next = NULL;
+
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    for (block = arena->blocks; block != NULL; block = next)
+    {
+        next = block->next;
+        if (block != arena->current)
+        {
+            global_hooks.deallocate(block);
+        }
+    }
+    arena->blocks = arena->current;
+    arena->size = 0;
+    arena->left = 0;
+    if (arena->current != NULL)
+    {
+        arena->current->next = NULL;
+        arena->size = sizeof(arena_block) + arena->block_size;
+        arena->next = (unsigned char*)(arena->current + 1);
+        arena->left = arena->block_size;
+    }
+}
+
+CJSON_PUBLIC(size_t) cJSON_ArenaSize(const cJSON_Arena *arena)
+{
+    return (arena != NULL) ? arena->size : 0;
+}
+
+CJSON_PUBLIC(void) cJSON_ArenaDelete(cJSON_Arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    arena->current = NULL;
+    cJSON_ArenaReset(arena);
+    global_hooks.deallocate(arena);
+}
+
+static unsigned char* cJSON_strdup(const unsigned char* string, const cJSON * const owner, const internal_hooks * const hooks)
 {
     size_t length = 0;
     unsigned char *copy = NULL;
@@ -196,7 +369,7 @@ static unsigned char* cJSON_strdup(const unsigned char* string, const internal_h
     }
 
     length = strlen((const char*)string) + sizeof("");
-    copy = (unsigned char*)hooks->allocate(length);
+    copy = (unsigned char*)allocate_for(owner, length, hooks);
     if (copy == NULL)
     {
         return NULL;
@@ -240,13 +413,23 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 {
-    cJSON* node = (cJSON*)hooks->allocate(sizeof(cJSON));
-    if (node)
+    node_header *header = NULL;
+    if (current_arena != NULL)
     {
-        memset(node, '\0', sizeof(cJSON));
+        header = (node_header*)arena_allocate(current_arena, sizeof(node_header));
     }
+    else
+    {
+        header = (node_header*)hooks->allocate(sizeof(node_header));
+    }
+    if (header == NULL)
+    {
+        return NULL;
+    }
+    memset(header, '\0', sizeof(node_header));
+    header->arena = current_arena;
 
-    return node;
+    return &header->item;
 }
 
 /* Delete a cJSON structure. */
@@ -256,6 +439,12 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
     while (item != NULL)
     {
         next = item->next;
+        if (node_header_of(item)->arena != NULL)
+        {
+            /* freed with its arena, children and strings included */
+            item = next;
+            continue;
+        }
         if (!(item->type & cJSON_IsReference) && (item->child != NULL))
         {
             cJSON_Delete(item->child);
@@ -270,7 +459,7 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
             global_hooks.deallocate(item->string);
             item->string = NULL;
         }
-        global_hooks.deallocate(item);
+        global_hooks.deallocate(node_header_of(item));
         item = next;
     }
 }
@@ -418,14 +607,14 @@ CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
         strcpy(object->valuestring, valuestring);
         return object->valuestring;
     }
-    copy = (char*) cJSON_strdup((const unsigned char*)valuestring, &global_hooks);
+    copy = (char*) cJSON_strdup((const unsigned char*)valuestring, object, &global_hooks);
     if (copy == NULL)
     {
         return NULL;
     }
     if (object->valuestring != NULL)
     {
-        cJSON_free(object->valuestring);
+        deallocate_for(object, object->valuestring, &global_hooks);
     }
     object->valuestring = copy;
 
@@ -778,6 +967,102 @@ fail:
 }
 
 /* Parse the input text into an unescaped cinput, and populate item. */
+/* Finds the first byte in [pointer, end) a JSON string can't hold as it is: a quote, a backslash or
+ * a control character. Runs of plain bytes are skipped 16 or 32 at a time with SSE2, AVX2 or NEON;
+ * AVX2 is used if the CPU has it. Building with CJSON_NO_SIMD leaves only the byte loop. */
+#ifdef CJSON_SIMD_X86
+__attribute__((target("avx2")))
+static const unsigned char *scan_string_avx2(const unsigned char *pointer, const unsigned char * const end)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    __m256i chunk;
+    unsigned int mask = 0;
+
+    while ((end - pointer) >= 32)
+    {
+        chunk = _mm256_loadu_si256((const __m256i*)(const void*)pointer);
+        /* a byte at most 0x1F is its own maximum with 0x1F */
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control)));
+        if (mask != 0)
+        {
+            return pointer + __builtin_ctz(mask);
+        }
+        pointer += 32;
+    }
+    return pointer;
+}
+
+static const unsigned char *scan_string_sse2(const unsigned char *pointer, const unsigned char * const end)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    __m128i chunk;
+    unsigned int mask = 0;
+
+    while ((end - pointer) >= 16)
+    {
+        chunk = _mm_loadu_si128((const __m128i*)(const void*)pointer);
+        mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control)));
+        if (mask != 0)
+        {
+            return pointer + __builtin_ctz(mask);
+        }
+        pointer += 16;
+    }
+    return pointer;
+}
+#endif
+
+#ifdef CJSON_SIMD_NEON
+static const unsigned char *scan_string_neon(const unsigned char *pointer, const unsigned char * const end)
+{
+    const uint8x16_t quote = vdupq_n_u8('\"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x20);
+    uint8x16_t chunk;
+    uint64_t mask = 0;
+
+    while ((end - pointer) >= 16)
+    {
+        chunk = vld1q_u8(pointer);
+        chunk = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)), vcltq_u8(chunk, control));
+        /* narrowing with a shift leaves 4 bits of every byte, NEON having no movemask */
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(chunk), 4)), 0);
+        if (mask != 0)
+        {
+            return pointer + (__builtin_ctzll(mask) >> 2);
+        }
+        pointer += 16;
+    }
+    return pointer;
+}
+#endif
+
+static const unsigned char *scan_string(const unsigned char *pointer, const unsigned char * const end)
+{
+#if defined(CJSON_SIMD_X86)
+    if (((end - pointer) >= 32) && __builtin_cpu_supports("avx2"))
+    {
+        pointer = scan_string_avx2(pointer, end);
+    }
+    pointer = scan_string_sse2(pointer, end);
+#elif defined(CJSON_SIMD_NEON)
+    pointer = scan_string_neon(pointer, end);
+#endif
+    while ((pointer < end) && (*pointer != '\"') && (*pointer != '\\') && (*pointer > 31))
+    {
+        pointer++;
+    }
+    return pointer;
+}
+
 static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer)
 {
     const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
@@ -795,12 +1080,19 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
         /* calculate approximate size of the output (overestimate) */
         size_t allocation_length = 0;
         size_t skipped_bytes = 0;
-        while (((size_t)(input_end - input_buffer->content) < input_buffer->length) && (*input_end != '\"'))
+        const unsigned char * const content_end = input_buffer->content + input_buffer->length;
+        for (;;)
         {
+            /* plain runs are skipped at once */
+            input_end = scan_string(input_end, content_end);
+            if ((input_end >= content_end) || (*input_end == '\"'))
+            {
+                break;
+            }
             /* is escape sequence */
             if (input_end[0] == '\\')
             {
-                if ((size_t)(input_end + 1 - input_buffer->content) >= input_buffer->length)
+                if ((input_end + 1) >= content_end)
                 {
                     /* prevent buffer overflow when last input character is a backslash */
                     goto fail;
@@ -817,7 +1109,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 
         /* This is at most how much we need for the output */
         allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-        output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+        output = (unsigned char*)allocate_for(item, allocation_length + sizeof(""), &input_buffer->hooks);
         if (output == NULL)
         {
             goto fail; /* allocation failure */
@@ -830,7 +1122,15 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     {
         if (*input_pointer != '\\')
         {
-            *output_pointer++ = *input_pointer++;
+            /* copy up to the next escape sequence at once */
+            const unsigned char *run_end = (const unsigned char*)memchr(input_pointer, '\\', (size_t)(input_end - input_pointer));
+            if (run_end == NULL)
+            {
+                run_end = input_end;
+            }
+            memcpy(output_pointer, input_pointer, (size_t)(run_end - input_pointer));
+            output_pointer += run_end - input_pointer;
+            input_pointer = run_end;
         }
         /* escape sequence */
         else
@@ -895,7 +1195,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 fail:
     if (output != NULL)
     {
-        input_buffer->hooks.deallocate(output);
+        deallocate_for(item, output, &input_buffer->hooks);
         output = NULL;
     }
 
@@ -911,6 +1211,8 @@ fail:
 static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffer * const output_buffer)
 {
     const unsigned char *input_pointer = NULL;
+    const unsigned char *input_end = NULL;
+    const unsigned char *run_end = NULL;
     unsigned char *output = NULL;
     unsigned char *output_pointer = NULL;
     size_t output_length = 0;
@@ -935,8 +1237,9 @@ static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffe
         return true;
     }
 
-    /* set "flag" to 1 if something needs to be escaped */
-    for (input_pointer = input; *input_pointer; input_pointer++)
+    /* set "flag" to 1 if something needs to be escaped, only looking at what isn't plain */
+    input_end = input + strlen((const char*)input);
+    for (input_pointer = scan_string(input, input_end); input_pointer < input_end; input_pointer = scan_string(input_pointer + 1, input_end))
     {
         switch (*input_pointer)
         {
@@ -959,7 +1262,7 @@ static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffe
                 break;
         }
     }
-    output_length = (size_t)(input_pointer - input) + escape_characters;
+    output_length = (size_t)(input_end - input) + escape_characters;
 
     output = ensure(output_buffer, output_length + sizeof("\"\""));
     if (output == NULL)
@@ -981,46 +1284,48 @@ static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffe
     output[0] = '\"';
     output_pointer = output + 1;
     /* copy the string */
-    for (input_pointer = input; *input_pointer != '\0'; (void)input_pointer++, output_pointer++)
+    for (input_pointer = input; input_pointer < input_end; (void)input_pointer++, output_pointer++)
     {
-        if ((*input_pointer > 31) && (*input_pointer != '\"') && (*input_pointer != '\\'))
+        /* normal characters, copied a run at a time */
+        run_end = scan_string(input_pointer, input_end);
+        memcpy(output_pointer, input_pointer, (size_t)(run_end - input_pointer));
+        output_pointer += run_end - input_pointer;
+        input_pointer = run_end;
+        if (input_pointer == input_end)
         {
-            /* normal character, copy */
-            *output_pointer = *input_pointer;
+            break;
         }
-        else
+
+        /* character needs to be escaped */
+        *output_pointer++ = '\\';
+        switch (*input_pointer)
         {
-            /* character needs to be escaped */
-            *output_pointer++ = '\\';
-            switch (*input_pointer)
-            {
-                case '\\':
-                    *output_pointer = '\\';
-                    break;
-                case '\"':
-                    *output_pointer = '\"';
-                    break;
-                case '\b':
-                    *output_pointer = 'b';
-                    break;
-                case '\f':
-                    *output_pointer = 'f';
-                    break;
-                case '\n':
-                    *output_pointer = 'n';
-                    break;
-                case '\r':
-                    *output_pointer = 'r';
-                    break;
-                case '\t':
-                    *output_pointer = 't';
-                    break;
-                default:
-                    /* escape and print as unicode codepoint */
-                    sprintf((char*)output_pointer, "u%04x", *input_pointer);
-                    output_pointer += 4;
-                    break;
-            }
+            case '\\':
+                *output_pointer = '\\';
+                break;
+            case '\"':
+                *output_pointer = '\"';
+                break;
+            case '\b':
+                *output_pointer = 'b';
+                break;
+            case '\f':
+                *output_pointer = 'f';
+                break;
+            case '\n':
+                *output_pointer = 'n';
+                break;
+            case '\r':
+                *output_pointer = 'r';
+                break;
+            case '\t':
+                *output_pointer = 't';
+                break;
+            default:
+                /* escape and print as unicode codepoint */
+                sprintf((char*)output_pointer, "u%04x", *input_pointer);
+                output_pointer += 4;
+                break;
         }
     }
     output[output_length + 1] = '\"';
@@ -1191,6 +1496,246 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_len
     return cJSON_ParseWithLengthOpts(value, buffer_length, 0, 0);
 }
 
+#define CJSON_STREAM_CHUNK_SIZE 4096
+
+typedef enum
+{
+    stream_before_object,
+    stream_in_object,
+    stream_done,
+    stream_failed
+} stream_state;
+
+struct cJSON_Stream
+{
+    cJSON_StreamReadFn read_fn;
+    void *context;
+    char chunk[CJSON_STREAM_CHUNK_SIZE];
+    size_t chunk_length;
+    size_t chunk_offset;
+    /* the text of the member being read, in braces so it parses as an object of its own */
+    unsigned char *member;
+    size_t member_length;
+    size_t member_capacity;
+    size_t members_read;
+    stream_state state;
+};
+
+static size_t stream_read_file(void *context, char *buffer, size_t size)
+{
+    return fread(buffer, 1, size, (FILE*)context);
+}
+
+/* next byte of the input, -1 at its end */
+static int stream_next_byte(cJSON_Stream * const stream)
+{
+    if (stream->chunk_offset == stream->chunk_length)
+    {
+        stream->chunk_length = stream->read_fn(stream->context, stream->chunk, sizeof(stream->chunk));
+        stream->chunk_offset = 0;
+        if (stream->chunk_length == 0)
+        {
+            return -1;
+        }
+    }
+    return (unsigned char)stream->chunk[stream->chunk_offset++];
+}
+
+static int stream_next_token(cJSON_Stream * const stream)
+{
+    int c;
+    do
+    {
+        c = stream_next_byte(stream);
+    } while ((c >= 0) && (c <= 32));
+    return c;
+}
+
+static cJSON_bool stream_append(cJSON_Stream * const stream, unsigned char c)
+{
+    unsigned char *grown = NULL;
+    size_t capacity = 0;
+
+    if (stream->member_length == stream->member_capacity)
+    {
+        capacity = stream->member_capacity ? stream->member_capacity * 2 : 256;
+        if (global_hooks.reallocate != NULL)
+        {
+            grown = (unsigned char*)global_hooks.reallocate(stream->member, capacity);
+        }
+        else
+        {
+            grown = (unsigned char*)global_hooks.allocate(capacity);
+            if (grown != NULL && stream->member != NULL)
+            {
+                memcpy(grown, stream->member, stream->member_length);
+                global_hooks.deallocate(stream->member);
+            }
+        }
+        if (grown == NULL)
+        {
+            return false;
+        }
+        stream->member = grown;
+        stream->member_capacity = capacity;
+    }
+    stream->member[stream->member_length++] = c;
+    return true;
+}
+
+CJSON_PUBLIC(cJSON_Stream *) cJSON_StreamNew(cJSON_StreamReadFn read_fn, void *context)
+{
+    cJSON_Stream *stream = NULL;
+
+    if (read_fn == NULL)
+    {
+        return NULL;
+    }
+    stream = (cJSON_Stream*)global_hooks.allocate(sizeof(cJSON_Stream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    memset(stream, 0, sizeof(cJSON_Stream));
+    stream->read_fn = read_fn;
+    stream->context = context;
+    stream->state = stream_before_object;
+    return stream;
+}
+
+CJSON_PUBLIC(cJSON_Stream *) cJSON_StreamNewFromFile(FILE *file)
+{
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    return cJSON_StreamNew(stream_read_file, file);
+}
+
+/* Finds where the member ends by counting brackets outside of strings, then leaves the parsing
+ * to the usual parser. */
+CJSON_PUBLIC(cJSON *) cJSON_StreamNextMember(cJSON_Stream *stream)
+{
+    cJSON *object = NULL;
+    cJSON *member = NULL;
+    size_t depth = 0;
+    cJSON_bool in_string = false;
+    cJSON_bool escaped = false;
+    int c = 0;
+
+    if ((stream == NULL) || (stream->state == stream_done) || (stream->state == stream_failed))
+    {
+        return NULL;
+    }
+
+    if (stream->state == stream_before_object)
+    {
+        c = stream_next_token(stream);
+        /* a UTF-8 byte order mark */
+        if ((c == 0xEF) && (stream_next_byte(stream) == 0xBB) && (stream_next_byte(stream) == 0xBF))
+        {
+            c = stream_next_token(stream);
+        }
+        if (c != '{')
+        {
+            stream->state = stream_failed;
+            return NULL;
+        }
+        stream->state = stream_in_object;
+    }
+
+    c = stream_next_token(stream);
+    if ((c == '}') && (stream->members_read == 0))
+    {
+        stream->state = stream_done;
+        return NULL;
+    }
+    stream->member_length = 0;
+    if ((c != '\"') || !stream_append(stream, '{') || !stream_append(stream, (unsigned char)c))
+    {
+        stream->state = stream_failed;
+        return NULL;
+    }
+
+    in_string = true;
+    for (;;)
+    {
+        c = stream_next_byte(stream);
+        if (c < 0)
+        {
+            stream->state = stream_failed;
+            return NULL;
+        }
+        if (in_string)
+        {
+            in_string = escaped || (c != '\"');
+            escaped = !escaped && (c == '\\');
+        }
+        else if (c == '\"')
+        {
+            in_string = true;
+        }
+        else if ((c == '{') || (c == '['))
+        {
+            depth++;
+        }
+        else if (((c == '}') || (c == ']')) && (depth > 0))
+        {
+            depth--;
+        }
+        else if ((depth == 0) && ((c == ',') || (c == '}')))
+        {
+            break;
+        }
+        if (!stream_append(stream, (unsigned char)c))
+        {
+            stream->state = stream_failed;
+            return NULL;
+        }
+    }
+    if (c == '}')
+    {
+        stream->state = stream_done;
+    }
+
+    if (!stream_append(stream, '}'))
+    {
+        stream->state = stream_failed;
+        return NULL;
+    }
+    object = cJSON_ParseWithLength((const char*)stream->member, stream->member_length);
+    member = object != NULL ? object->child : NULL;
+    if ((member == NULL) || (member->next != NULL))
+    {
+        cJSON_Delete(object);
+        stream->state = stream_failed;
+        return NULL;
+    }
+    object->child = NULL;
+    cJSON_Delete(object);
+    member->prev = NULL;
+    stream->members_read++;
+    return member;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_StreamFailed(const cJSON_Stream *stream)
+{
+    return (stream == NULL) || (stream->state == stream_failed);
+}
+
+CJSON_PUBLIC(void) cJSON_StreamDelete(cJSON_Stream *stream)
+{
+    if (stream == NULL)
+    {
+        return;
+    }
+    if (stream->member != NULL)
+    {
+        global_hooks.deallocate(stream->member);
+    }
+    global_hooks.deallocate(stream);
+}
+
 #define cjson_min(a, b) (((a) < (b)) ? (a) : (b))
 
 static unsigned char *print(const cJSON * const item, cJSON_bool format, const internal_hooks * const hooks)
@@ -2043,7 +2588,7 @@ static cJSON_bool add_item_to_object(cJSON * const object, const char * const st
     }
     else
     {
-        new_key = (char*)cJSON_strdup((const unsigned char*)string, hooks);
+        new_key = (char*)cJSON_strdup((const unsigned char*)string, item, hooks);
         if (new_key == NULL)
         {
             return false;
@@ -2054,7 +2599,7 @@ static cJSON_bool add_item_to_object(cJSON * const object, const char * const st
 
     if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
     {
-        hooks->deallocate(item->string);
+        deallocate_for(item, item->string, hooks);
     }
 
     item->string = new_key;
@@ -2381,9 +2926,9 @@ static cJSON_bool replace_item_in_object(cJSON *object, const char *string, cJSO
     /* replace the name in the replacement */
     if (!(replacement->type & cJSON_StringIsConst) && (replacement->string != NULL))
     {
-        cJSON_free(replacement->string);
+        deallocate_for(replacement, replacement->string, &global_hooks);
     }
-    replacement->string = (char*)cJSON_strdup((const unsigned char*)string, &global_hooks);
+    replacement->string = (char*)cJSON_strdup((const unsigned char*)string, replacement, &global_hooks);
     if (replacement->string == NULL)
     {
         return false;
@@ -2481,7 +3026,7 @@ CJSON_PUBLIC(cJSON *) cJSON_CreateString(const char *string)
     if(item)
     {
         item->type = cJSON_String;
-        item->valuestring = (char*)cJSON_strdup((const unsigned char*)string, &global_hooks);
+        item->valuestring = (char*)cJSON_strdup((const unsigned char*)string, item, &global_hooks);
         if(!item->valuestring)
         {
             cJSON_Delete(item);
@@ -2531,7 +3076,7 @@ CJSON_PUBLIC(cJSON *) cJSON_CreateRaw(const char *raw)
     if(item)
     {
         item->type = cJSON_Raw;
-        item->valuestring = (char*)cJSON_strdup((const unsigned char*)raw, &global_hooks);
+        item->valuestring = (char*)cJSON_strdup((const unsigned char*)raw, item, &global_hooks);
         if(!item->valuestring)
         {
             cJSON_Delete(item);
@@ -2750,7 +3295,7 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
     newitem->valuedouble = item->valuedouble;
     if (item->valuestring)
     {
-        newitem->valuestring = (char*)cJSON_strdup((unsigned char*)item->valuestring, &global_hooks);
+        newitem->valuestring = (char*)cJSON_strdup((unsigned char*)item->valuestring, newitem, &global_hooks);
         if (!newitem->valuestring)
         {
             goto fail;
@@ -2758,7 +3303,7 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
     }
     if (item->string)
     {
-        newitem->string = (item->type&cJSON_StringIsConst) ? item->string : (char*)cJSON_strdup((unsigned char*)item->string, &global_hooks);
+        newitem->string = (item->type&cJSON_StringIsConst) ? item->string : (char*)cJSON_strdup((unsigned char*)item->string, newitem, &global_hooks);
         if (!newitem->string)
         {
             goto fail;
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "benchmark.h"
+
+typedef struct BenchmarkEntry
+{
+  const char *name;
+  void (*run)();
+} BenchmarkEntry;
+
+static const BenchmarkEntry benchmarks[] = {
+    {"queue", run_queue_benchmark},
+    {"pipeline", run_pipeline_benchmark},
+    {"hash", run_hash_benchmark},
+    {"prefetch", run_prefetch_benchmark},
+    {"glob", run_glob_benchmark},
+    {"slab", run_slab_benchmark},
+    {"list", run_list_benchmark},
+    {"zset", run_zset_benchmark},
+    {"micro", run_micro_benchmark},
+    {"load", run_load_benchmark},
+    {"memory", run_memory_benchmark},
+    {"json", run_json_benchmark},
+};
+
+// Usage: ./bench [name ...], runs every benchmark when no name is given
+int main(int argc, char **argv)
+{
+  size_t benchmark_count = sizeof(benchmarks) / sizeof(BenchmarkEntry);
+
+  for (size_t i = 0; i < benchmark_count; ++i)
+  {
+    int selected = argc < 2;
+    for (int j = 1; j < argc && !selected; ++j)
+      selected = strcmp(argv[j], benchmarks[i].name) == 0;
+    if (selected)
+      benchmarks[i].run();
+  }
+
+  return 0;
+}
@@ -0,0 +1,1660 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <threads.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "db/utils.h"
+#include "db/queue.h"
+#include "db/obj.h"
+#include "db/interaction.h"
+#include "db/api.h"
+#include "db/hash.h"
+#include "db/hashobj.h"
+#include "db/flathash.h"
+#include "db/slab.h"
+#include "db/list.h"
+#include "db/quicklist.h"
+#include "db/zset.h"
+#include "db/zaggregate.h"
+#include "db/glob.h"
+#include "db/latency.h"
+#include "db/net.h"
+#include "db/deps/cJSON.h"
+#include "benchmark.h"
+
+#define QUEUE_BENCHMARK_TASKS (1 << 20)
+#define QUEUE_BENCHMARK_CAPACITY 1024
+
+#define PIPELINE_BENCHMARK_REQUESTS (1 << 18)
+#define PIPELINE_BENCHMARK_KEYS 4096
+#define PIPELINE_BENCHMARK_PERSISTENCE_FILE "benchmark-db.json"
+
+#define HASH_BENCHMARK_KEYS (1 << 18)
+// Enough keys that the buckets and entries are far beyond the last level cache
+#define PREFETCH_BENCHMARK_KEYS 10000000
+
+// Keys every pattern of the glob benchmark is tried on
+#define GLOB_BENCHMARK_KEYS 10000000
+
+// Blocks alive at once in the slab benchmark, allocated and freed this many times
+#define SLAB_BENCHMARK_BLOCKS (1 << 16)
+#define SLAB_BENCHMARK_ROUNDS 32
+
+// Elements pushed to the list in the list benchmark, which reads the whole list this many times
+#define LIST_BENCHMARK_ELEMENTS (1 << 18)
+#define LIST_BENCHMARK_RANGES 16
+// Single elements read at scattered positions, the way a deep page of a feed is read
+#define LIST_BENCHMARK_LOOKUPS 4096
+
+// Members added to the sorted set in the zset benchmark, with scores spread over [0, 1)
+#define ZSET_BENCHMARK_MEMBERS (1 << 18)
+// Score windows read with ZRANGEBYSCORE, each holding about this many members
+#define ZSET_BENCHMARK_WINDOWS 16384
+#define ZSET_BENCHMARK_WINDOW_MEMBERS 16
+
+// Structure sizes the micro benchmark runs at, from the smallest up by factors of 10; build with
+// -DMICRO_BENCHMARK_MAX_SIZE=... for a shorter run
+#define MICRO_BENCHMARK_MIN_SIZE 1000
+#ifndef MICRO_BENCHMARK_MAX_SIZE
+#define MICRO_BENCHMARK_MAX_SIZE 10000000
+#endif
+// Operations timed per row on a structure that is already built
+#define MICRO_BENCHMARK_SAMPLES 100000
+// Elements read by each ranged read
+#define MICRO_BENCHMARK_RANGE 100
+// ZINTERSTORE reads both sources whole, so it stops at this size and runs a few rounds
+#define MICRO_BENCHMARK_ZINTER_MAX_SIZE 1000000
+#define MICRO_BENCHMARK_ZINTER_ROUNDS 5
+// Bytes of each generated key or member, NUL included
+#define MICRO_BENCHMARK_KEY_LENGTH 16
+
+// Keys the load generator spreads its requests over, all set before a round is timed
+#define LOAD_BENCHMARK_KEYS 100000
+// Requests of one round, split evenly between its clients
+#define LOAD_BENCHMARK_REQUESTS 400000
+// Port the load generator serves this database on, and where it looks for a real Redis, as in
+// hw2's benchmark; rounds against Redis are skipped when nothing listens there
+#define LOAD_BENCHMARK_NET_PORT 26380
+#define LOAD_BENCHMARK_REDIS_IP "127.0.0.1"
+#define LOAD_BENCHMARK_REDIS_PORT 6379
+#define LOAD_BENCHMARK_PERSISTENCE_FILE "benchmark-load-db.json"
+
+// Keys of each type the memory benchmark loads, and the elements in each list, hash or sorted set
+#ifndef MEMORY_BENCHMARK_KEYS
+#define MEMORY_BENCHMARK_KEYS 100000
+#endif
+#define MEMORY_BENCHMARK_ELEMENTS 16
+#define MEMORY_BENCHMARK_VALUE_SIZE 32
+#define MEMORY_BENCHMARK_PERSISTENCE_FILE "benchmark-memory-db.json"
+
+// People in the document of the JSON benchmark, shaped like hw1's database.json, and the times
+// each pass over it is repeated
+#define JSON_BENCHMARK_RECORDS 20000
+#define JSON_BENCHMARK_ROUNDS 5
+
+uint64_t benchmark_now_ns()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+// The task queue as it was before the ring: one malloc per task, appended under the lock
+// that the consumer also holds while it drains a whole batch.
+typedef struct ListTask
+{
+  DBTask task;
+  struct ListTask *next;
+} ListTask;
+
+typedef struct ListQueue
+{
+  mtx_t lock;
+  cnd_t cond;
+  ListTask *head;
+  ListTask *tail;
+} ListQueue;
+
+typedef struct QueueBenchmarkContext
+{
+  DBTaskQueue *ring;
+  ListQueue *list;
+  int tasks_per_producer;
+  int total_tasks;
+} QueueBenchmarkContext;
+
+static int list_queue_producer(void *arg)
+{
+  QueueBenchmarkContext *ctx = (QueueBenchmarkContext *)arg;
+  for (int i = 0; i < ctx->tasks_per_producer; ++i)
+  {
+    ListTask *node = (ListTask *)malloc(sizeof(ListTask));
+    if (!node)
+      EXIT_ON_MEMORY_ERROR();
+    node->task.created_at = 0;
+    node->task.request = NULL;
+    node->task.reply = NULL;
+    node->next = NULL;
+    mtx_lock(&ctx->list->lock);
+    if (ctx->list->tail)
+      ctx->list->tail->next = node;
+    else
+      ctx->list->head = node;
+    ctx->list->tail = node;
+    cnd_signal(&ctx->list->cond);
+    mtx_unlock(&ctx->list->lock);
+  }
+  return 0;
+}
+
+static int list_queue_consumer(void *arg)
+{
+  QueueBenchmarkContext *ctx = (QueueBenchmarkContext *)arg;
+  int consumed = 0;
+  ListTask *node;
+  mtx_lock(&ctx->list->lock);
+  while (consumed < ctx->total_tasks)
+  {
+    while (!ctx->list->head)
+      cnd_wait(&ctx->list->cond, &ctx->list->lock);
+    while (ctx->list->head)
+    {
+      node = ctx->list->head;
+      ctx->list->head = node->next;
+      if (!ctx->list->head)
+        ctx->list->tail = NULL;
+      free(node);
+      ++consumed;
+    }
+  }
+  mtx_unlock(&ctx->list->lock);
+  return 0;
+}
+
+static int ring_queue_producer(void *arg)
+{
+  QueueBenchmarkContext *ctx = (QueueBenchmarkContext *)arg;
+  DBTask task = {.created_at = 0, .request = NULL, .reply = NULL};
+  for (int i = 0; i < ctx->tasks_per_producer; ++i)
+    queue_push(ctx->ring, &task);
+  return 0;
+}
+
+static int ring_queue_consumer(void *arg)
+{
+  QueueBenchmarkContext *ctx = (QueueBenchmarkContext *)arg;
+  int consumed = 0;
+  DBTask task;
+  while (consumed < ctx->total_tasks)
+  {
+    if (queue_pop(ctx->ring, &task))
+      ++consumed;
+    else
+      queue_wait(ctx->ring, 1000000L);
+  }
+  return 0;
+}
+
+static double run_queue_round(const char *name, int producers)
+{
+  QueueBenchmarkContext ctx;
+  ListQueue list;
+  thrd_t consumer;
+  thrd_t *threads = (thrd_t *)malloc(producers * sizeof(thrd_t));
+  if (!threads)
+    EXIT_ON_MEMORY_ERROR();
+
+  int is_ring = name[0] == 'r';
+  ctx.tasks_per_producer = QUEUE_BENCHMARK_TASKS / producers;
+  ctx.total_tasks = ctx.tasks_per_producer * producers;
+  ctx.ring = is_ring ? queue_create(QUEUE_BENCHMARK_CAPACITY, DB_QUEUE_BLOCK) : NULL;
+  ctx.list = is_ring ? NULL : &list;
+  if (!is_ring)
+  {
+    mtx_init(&list.lock, mtx_plain);
+    cnd_init(&list.cond);
+    list.head = NULL;
+    list.tail = NULL;
+  }
+
+  uint64_t started_at = benchmark_now_ns();
+  thrd_create(&consumer, is_ring ? ring_queue_consumer : list_queue_consumer, &ctx);
+  for (int i = 0; i < producers; ++i)
+    thrd_create(&threads[i], is_ring ? ring_queue_producer : list_queue_producer, &ctx);
+  for (int i = 0; i < producers; ++i)
+    thrd_join(threads[i], NULL);
+  thrd_join(consumer, NULL);
+  uint64_t elapsed_ns = benchmark_now_ns() - started_at;
+
+  if (is_ring)
+  {
+    queue_free(ctx.ring);
+  }
+  else
+  {
+    cnd_destroy(&list.cond);
+    mtx_destroy(&list.lock);
+  }
+  free(threads);
+
+  double elapsed_ms = elapsed_ns / 1e6;
+  printf("%s,%d,%d,%.3f,%.0f\n", name, producers, ctx.total_tasks, elapsed_ms, ctx.total_tasks / (elapsed_ns / 1e9));
+  return elapsed_ms;
+}
+
+void run_queue_benchmark()
+{
+  const int producer_counts[] = {1, 4, 16, 64};
+
+  printf("queue,producers,tasks,elapsed_ms,ops_per_sec\n");
+  for (size_t i = 0; i < sizeof(producer_counts) / sizeof(int); ++i)
+  {
+    run_queue_round("list", producer_counts[i]);
+    run_queue_round("ring", producer_counts[i]);
+  }
+}
+
+static DBRequest *create_set_request(int i)
+{
+  char key[32];
+  sprintf(key, "bench:%d", i % PIPELINE_BENCHMARK_KEYS);
+  DBRequest *request = create_request(DB_SET);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  add_request_arg(request, dbobj_create_string_with_dup("value"));
+  return request;
+}
+
+static void run_pipeline_round(const char *name, int depth)
+{
+  DBPipeline *pipeline = create_pipeline();
+  DBRequest *request;
+
+  uint64_t started_at = benchmark_now_ns();
+  for (int i = 0; i < PIPELINE_BENCHMARK_REQUESTS;)
+  {
+    if (!depth)
+    {
+      request = create_set_request(i++);
+      free_reply(dbapi_request_sync(request));
+      free_request(request);
+      continue;
+    }
+    for (int j = 0; j < depth && i < PIPELINE_BENCHMARK_REQUESTS; ++j)
+      add_pipeline_request(pipeline, create_set_request(i++));
+    reset_pipeline(dbapi_pipeline_sync(pipeline));
+  }
+  uint64_t elapsed_ns = benchmark_now_ns() - started_at;
+
+  free_pipeline(pipeline);
+
+  printf("%s,%d,%d,%.3f,%.0f\n", name, depth, PIPELINE_BENCHMARK_REQUESTS, elapsed_ns / 1e6, PIPELINE_BENCHMARK_REQUESTS / (elapsed_ns / 1e9));
+}
+
+void run_pipeline_benchmark()
+{
+  const int depths[] = {1, 16, 256};
+
+  server_config_persistence_filepath(PIPELINE_BENCHMARK_PERSISTENCE_FILE);
+  dbapi_start_server();
+
+  printf("pipeline,depth,requests,elapsed_ms,ops_per_sec\n");
+  run_pipeline_round("request", 0);
+  for (size_t i = 0; i < sizeof(depths) / sizeof(int); ++i)
+    run_pipeline_round("pipeline", depths[i]);
+
+  dbapi_flushall();
+  dbapi_shutdown();
+  remove(PIPELINE_BENCHMARK_PERSISTENCE_FILE);
+}
+
+// Keys are generated before timing so both tables hash and compare the same strings
+static char **create_hash_benchmark_keys(const char *prefix)
+{
+  char key[32];
+  char **keys = (char **)malloc(HASH_BENCHMARK_KEYS * sizeof(char *));
+  if (!keys)
+    EXIT_ON_MEMORY_ERROR();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+  {
+    sprintf(key, "%s:%d", prefix, i);
+    keys[i] = dbutil_strdup(key);
+  }
+  return keys;
+}
+
+static void shuffle_hash_benchmark_keys(char **keys)
+{
+  char *key;
+  srand(HASH_BENCHMARK_KEYS);
+  for (int i = HASH_BENCHMARK_KEYS - 1; i > 0; --i)
+  {
+    int j = rand() % (i + 1);
+    key = keys[i];
+    keys[i] = keys[j];
+    keys[j] = key;
+  }
+}
+
+static void print_hash_benchmark_row(const char *name, const char *operation, uint64_t elapsed_ns)
+{
+  printf("%s,%s,%d,%.3f,%.0f\n", name, operation, HASH_BENCHMARK_KEYS, elapsed_ns / 1e6, HASH_BENCHMARK_KEYS / (elapsed_ns / 1e9));
+}
+
+static void run_chained_hash_round(char **keys, char **shuffled_keys, char **missing_keys)
+{
+  DBHash *ht = ht_create();
+  uint64_t started_at;
+  db_uint_t found = 0;
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    hset(ht, keys[i], dbobj_create_string_with_dup("value"), NULL);
+  print_hash_benchmark_row("chained", "set", benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    found += hget(ht, shuffled_keys[i], NULL) != NULL;
+  print_hash_benchmark_row("chained", "get_hit", benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    found += hget(ht, missing_keys[i], NULL) != NULL;
+  print_hash_benchmark_row("chained", "get_miss", benchmark_now_ns() - started_at);
+
+  if (found != HASH_BENCHMARK_KEYS)
+    fprintf(stderr, "chained: found %llu keys\n", (unsigned long long)found);
+  ht_free(ht);
+}
+
+static void run_flat_hash_round(char **keys, char **shuffled_keys, char **missing_keys)
+{
+  DBFlatHash *ht = fht_create();
+  uint64_t started_at;
+  db_uint_t found = 0;
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    fht_set(ht, keys[i], dbobj_create_string_with_dup("value"));
+  print_hash_benchmark_row("flat", "set", benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    found += fht_get(ht, shuffled_keys[i]) != NULL;
+  print_hash_benchmark_row("flat", "get_hit", benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+    found += fht_get(ht, missing_keys[i]) != NULL;
+  print_hash_benchmark_row("flat", "get_miss", benchmark_now_ns() - started_at);
+
+  if (found != HASH_BENCHMARK_KEYS)
+    fprintf(stderr, "flat: found %llu keys\n", (unsigned long long)found);
+  fht_free(ht);
+}
+
+void run_hash_benchmark()
+{
+  char **keys = create_hash_benchmark_keys("bench");
+  char **shuffled_keys = (char **)malloc(HASH_BENCHMARK_KEYS * sizeof(char *));
+  char **missing_keys = create_hash_benchmark_keys("missing");
+  if (!shuffled_keys)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(shuffled_keys, keys, HASH_BENCHMARK_KEYS * sizeof(char *));
+  shuffle_hash_benchmark_keys(shuffled_keys);
+
+  printf("hash,operation,keys,elapsed_ms,ops_per_sec\n");
+  run_chained_hash_round(keys, shuffled_keys, missing_keys);
+  run_flat_hash_round(keys, shuffled_keys, missing_keys);
+
+  for (int i = 0; i < HASH_BENCHMARK_KEYS; ++i)
+  {
+    free(keys[i]);
+    free(missing_keys[i]);
+  }
+  free(keys);
+  free(shuffled_keys);
+  free(missing_keys);
+}
+
+static void print_prefetch_benchmark_row(const char *name, int batch, uint64_t elapsed_ns)
+{
+  printf("%s,%d,%d,%.3f,%.1f,%.0f\n", name, batch, PREFETCH_BENCHMARK_KEYS, elapsed_ns / 1e6,
+         (double)elapsed_ns / PREFETCH_BENCHMARK_KEYS, PREFETCH_BENCHMARK_KEYS / (elapsed_ns / 1e9));
+}
+
+void run_prefetch_benchmark()
+{
+  static const int batch_sizes[] = {8, 16, 32};
+  char key[32];
+  DBHash *ht = ht_create();
+  DBKey *keys = (DBKey *)malloc(PREFETCH_BENCHMARK_KEYS * sizeof(DBKey));
+  char **names = (char **)malloc(PREFETCH_BENCHMARK_KEYS * sizeof(char *));
+  if (!keys || !names)
+    EXIT_ON_MEMORY_ERROR();
+
+  // Every entry holds the same immortal value, the table is all that takes memory.
+  for (int i = 0; i < PREFETCH_BENCHMARK_KEYS; ++i)
+  {
+    sprintf(key, "prefetch:%d", i);
+    names[i] = dbutil_strdup(key);
+    hset(ht, names[i], dbobj_shared_null(), NULL);
+  }
+  // Shuffled and hashed before timing, so each lookup is a cache miss and nothing else.
+  srand(PREFETCH_BENCHMARK_KEYS);
+  for (int i = PREFETCH_BENCHMARK_KEYS - 1; i > 0; --i)
+  {
+    int j = (int)((((uint64_t)rand() << 31) | (uint64_t)rand()) % (uint64_t)(i + 1));
+    char *name = names[i];
+    names[i] = names[j];
+    names[j] = name;
+  }
+  for (int i = 0; i < PREFETCH_BENCHMARK_KEYS; ++i)
+    keys[i] = ht_key(names[i]);
+
+  DBHashEntry *entries[HT_BATCH_MAX];
+  uint64_t started_at;
+  db_uint_t found = 0;
+  printf("lookup,batch,keys,elapsed_ms,ns_per_op,ops_per_sec\n");
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < PREFETCH_BENCHMARK_KEYS; ++i)
+    found += hget_key(ht, &keys[i], NULL) != NULL;
+  print_prefetch_benchmark_row("single", 1, benchmark_now_ns() - started_at);
+
+  for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b)
+  {
+    int batch = batch_sizes[b];
+    started_at = benchmark_now_ns();
+    for (int i = 0; i < PREFETCH_BENCHMARK_KEYS; i += batch)
+      found += hget_keys(ht, &keys[i], i + batch < PREFETCH_BENCHMARK_KEYS ? batch : PREFETCH_BENCHMARK_KEYS - i, entries, NULL);
+    print_prefetch_benchmark_row("batched", batch, benchmark_now_ns() - started_at);
+  }
+
+  if (found != (db_uint_t)PREFETCH_BENCHMARK_KEYS * (1 + sizeof(batch_sizes) / sizeof(batch_sizes[0])))
+    fprintf(stderr, "prefetch: found %llu keys\n", (unsigned long long)found);
+  ht_free(ht);
+  for (int i = 0; i < PREFETCH_BENCHMARK_KEYS; ++i)
+    free(names[i]);
+  free(names);
+  free(keys);
+}
+
+static void print_glob_benchmark_row(const char *pattern, const char *matcher, db_uint_t matched, uint64_t elapsed_ns)
+{
+  printf("\"%s\",%s,%d,%llu,%.3f,%.2f,%.0f\n", pattern, matcher, GLOB_BENCHMARK_KEYS, (unsigned long long)matched,
+         elapsed_ns / 1e6, (double)elapsed_ns / GLOB_BENCHMARK_KEYS, GLOB_BENCHMARK_KEYS / (elapsed_ns / 1e9));
+}
+
+void run_glob_benchmark()
+{
+  static const char *patterns[] = {"*", "tenant:0042:*", "*:cart", "*user:1234*", "*:?????42:*", "tenant:00??:*:profile", "*user:*7*:session"};
+  static const char *suffixes[] = {"profile", "session", "cart"};
+  char key[64];
+  // The keys lie one after another, as many as the keyspace would spread over its entries.
+  char *bytes = (char *)malloc((size_t)GLOB_BENCHMARK_KEYS * 40);
+  size_t *offsets = (size_t *)malloc(GLOB_BENCHMARK_KEYS * sizeof(size_t));
+  db_uint_t *lengths = (db_uint_t *)malloc(GLOB_BENCHMARK_KEYS * sizeof(db_uint_t));
+  if (!bytes || !offsets || !lengths)
+    EXIT_ON_MEMORY_ERROR();
+
+  size_t used = 0;
+  srand(GLOB_BENCHMARK_KEYS);
+  for (int i = 0; i < GLOB_BENCHMARK_KEYS; ++i)
+  {
+    int length = sprintf(key, "tenant:%04d:user:%d:%s", rand() % 10000, rand() % 100000000, suffixes[rand() % 3]);
+    memcpy(bytes + used, key, length + 1);
+    offsets[i] = used;
+    lengths[i] = (db_uint_t)length;
+    used += length + 1;
+  }
+
+  printf("pattern,matcher,keys,matched,elapsed_ms,ns_per_key,keys_per_sec\n");
+  for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p)
+  {
+    db_uint_t matched = 0, compiled_matched = 0;
+    uint64_t started_at = benchmark_now_ns();
+    for (int i = 0; i < GLOB_BENCHMARK_KEYS; ++i)
+      matched += dbutil_match_keys(bytes + offsets[i], patterns[p]);
+    print_glob_benchmark_row(patterns[p], "backtracking", matched, benchmark_now_ns() - started_at);
+
+    started_at = benchmark_now_ns();
+    DBGlob *glob = glob_compile(patterns[p]);
+    for (int i = 0; i < GLOB_BENCHMARK_KEYS; ++i)
+      compiled_matched += glob_match(glob, bytes + offsets[i], lengths[i]);
+    glob_free(glob);
+    print_glob_benchmark_row(patterns[p], "compiled", compiled_matched, benchmark_now_ns() - started_at);
+
+    if (matched != compiled_matched)
+      fprintf(stderr, "glob: \"%s\" matched %llu keys compiled, %llu backtracking\n", patterns[p],
+              (unsigned long long)compiled_matched, (unsigned long long)matched);
+  }
+
+  free(bytes);
+  free(offsets);
+  free(lengths);
+}
+
+static void run_slab_round(const char *name, size_t size, void **blocks, db_bool_t use_slab)
+{
+  uint64_t started_at = benchmark_now_ns();
+  uint64_t operations = (uint64_t)SLAB_BENCHMARK_BLOCKS * SLAB_BENCHMARK_ROUNDS;
+
+  for (int round = 0; round < SLAB_BENCHMARK_ROUNDS; ++round)
+  {
+    for (int i = 0; i < SLAB_BENCHMARK_BLOCKS; ++i)
+    {
+      blocks[i] = use_slab ? slab_alloc(size) : malloc(size);
+      if (!blocks[i])
+        EXIT_ON_MEMORY_ERROR();
+      // Touch the block the way a constructor would.
+      *(char *)blocks[i] = (char)i;
+    }
+    // An odd stride visits every block of a power-of-two count, in a scattered order.
+    for (int i = 0; i < SLAB_BENCHMARK_BLOCKS; ++i)
+    {
+      int j = (int)(((uint64_t)i * 40503u) % SLAB_BENCHMARK_BLOCKS);
+      if (use_slab)
+        slab_free(blocks[j], size);
+      else
+        free(blocks[j]);
+    }
+  }
+
+  uint64_t elapsed_ns = benchmark_now_ns() - started_at;
+  printf("%s,%zu,%llu,%.3f,%.0f\n", name, size, (unsigned long long)operations, elapsed_ns / 1e6, operations / (elapsed_ns / 1e9));
+}
+
+void run_slab_benchmark()
+{
+  // The sizes of DBObj, DBListNode and DBHashEntry
+  const size_t sizes[] = {sizeof(DBObj), sizeof(DBListNode), sizeof(DBHashEntry)};
+  void **blocks = (void **)malloc(SLAB_BENCHMARK_BLOCKS * sizeof(void *));
+  if (!blocks)
+    EXIT_ON_MEMORY_ERROR();
+
+  printf("allocator,size,operations,elapsed_ms,ops_per_sec\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+  {
+    run_slab_round("malloc", sizes[i], blocks, false);
+    run_slab_round("slab", sizes[i], blocks, true);
+  }
+
+  free(blocks);
+}
+
+static void print_list_benchmark_row(const char *name, const char *operation, uint64_t operations, uint64_t elapsed_ns, size_t memory)
+{
+  printf("%s,%s,%llu,%.3f,%.0f,%zu\n", name, operation, (unsigned long long)operations, elapsed_ns / 1e6, operations / (elapsed_ns / 1e9), memory);
+}
+
+static void run_linked_list_round(char **values)
+{
+  DBList *list = create_dblist(), *range;
+  uint64_t started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+    rpush(list, create_dblistnode_with_string(values[i]));
+  print_list_benchmark_row("linked", "rpush", LIST_BENCHMARK_ELEMENTS, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_RANGES; ++i)
+  {
+    range = lrange(list, 0, DB_UINT_MAX);
+    free_dblist(range);
+  }
+  print_list_benchmark_row("linked", "lrange", (uint64_t)LIST_BENCHMARK_ELEMENTS * LIST_BENCHMARK_RANGES, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_LOOKUPS; ++i)
+  {
+    db_uint_t position = (db_uint_t)(((uint64_t)i * 40503u) % LIST_BENCHMARK_ELEMENTS);
+    free_dblist(lrange(list, position, position));
+  }
+  print_list_benchmark_row("linked", "lindex", LIST_BENCHMARK_LOOKUPS, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+    free_dblistnode(lpop(list));
+  print_list_benchmark_row("linked", "lpop", LIST_BENCHMARK_ELEMENTS, benchmark_now_ns() - started_at, list->memory);
+  free_dblist(list);
+}
+
+static void run_quicklist_round(char **values)
+{
+  DBQuickList *list = ql_create();
+  DBList *range;
+  uint64_t started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+    ql_rpush(list, values[i]);
+  print_list_benchmark_row("quicklist", "rpush", LIST_BENCHMARK_ELEMENTS, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_RANGES; ++i)
+  {
+    range = ql_lrange(list, 0, DB_UINT_MAX);
+    free_dblist(range);
+  }
+  print_list_benchmark_row("quicklist", "lrange", (uint64_t)LIST_BENCHMARK_ELEMENTS * LIST_BENCHMARK_RANGES, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_LOOKUPS; ++i)
+    free_dbobj(ql_lindex(list, (db_uint_t)(((uint64_t)i * 40503u) % LIST_BENCHMARK_ELEMENTS)));
+  print_list_benchmark_row("quicklist", "lindex", LIST_BENCHMARK_LOOKUPS, benchmark_now_ns() - started_at, list->memory);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+    free_dbobj(ql_lpop(list));
+  print_list_benchmark_row("quicklist", "lpop", LIST_BENCHMARK_ELEMENTS, benchmark_now_ns() - started_at, list->memory);
+  ql_free(list);
+}
+
+void run_list_benchmark()
+{
+  char **values = (char **)malloc(LIST_BENCHMARK_ELEMENTS * sizeof(char *));
+  char value[32];
+  if (!values)
+    EXIT_ON_MEMORY_ERROR();
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+  {
+    snprintf(value, sizeof(value), "element:%d", i);
+    values[i] = dbutil_strdup(value);
+  }
+
+  // `memory` is the bytes the list holds after the operation.
+  printf("list,operation,operations,elapsed_ms,ops_per_sec,memory\n");
+  run_linked_list_round(values);
+  run_quicklist_round(values);
+
+  for (int i = 0; i < LIST_BENCHMARK_ELEMENTS; ++i)
+    free(values[i]);
+  free(values);
+}
+
+static void print_zset_benchmark_row(const char *operation, uint64_t operations, uint64_t elapsed_ns, uint64_t results)
+{
+  printf("%s,%llu,%.3f,%.0f,%llu\n", operation, (unsigned long long)operations, elapsed_ns / 1e6, operations / (elapsed_ns / 1e9), (unsigned long long)results);
+}
+
+void run_zset_benchmark()
+{
+  char member[32];
+  db_double_t *scores = (db_double_t *)malloc(ZSET_BENCHMARK_MEMBERS * sizeof(db_double_t));
+  if (!scores)
+    EXIT_ON_MEMORY_ERROR();
+  // Fractional scores, most of them less than 1 apart from their neighbours, in shuffled order
+  for (int i = 0; i < ZSET_BENCHMARK_MEMBERS; ++i)
+    scores[i] = (double)(((uint64_t)i * 40503u) % ZSET_BENCHMARK_MEMBERS) / ZSET_BENCHMARK_MEMBERS;
+
+  // `results` is the members the operation returned or counted in total.
+  printf("operation,operations,elapsed_ms,ops_per_sec,results\n");
+  DBZSet *zset = zset_create();
+  uint64_t started_at = benchmark_now_ns();
+  for (int i = 0; i < ZSET_BENCHMARK_MEMBERS; ++i)
+  {
+    snprintf(member, sizeof(member), "member:%d", i);
+    zadd(zset, scores[i], member);
+  }
+  print_zset_benchmark_row("zadd", ZSET_BENCHMARK_MEMBERS, benchmark_now_ns() - started_at, zcard(zset));
+
+  uint64_t results = 0;
+  db_double_t width = (double)ZSET_BENCHMARK_WINDOW_MEMBERS / ZSET_BENCHMARK_MEMBERS;
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < ZSET_BENCHMARK_WINDOWS; ++i)
+  {
+    db_double_t min = scores[i];
+    DBList *range = zrangebyscore(zset, min, true, min + width, false, false, NULL);
+    results += range ? range->length : 0;
+    free_dblist(range);
+  }
+  print_zset_benchmark_row("zrangebyscore", ZSET_BENCHMARK_WINDOWS, benchmark_now_ns() - started_at, results);
+
+  results = 0;
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < ZSET_BENCHMARK_WINDOWS; ++i)
+    results += zcount(zset, scores[i], true, scores[i] + width, false);
+  print_zset_benchmark_row("zcount", ZSET_BENCHMARK_WINDOWS, benchmark_now_ns() - started_at, results);
+
+  results = 0;
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < ZSET_BENCHMARK_WINDOWS; ++i)
+  {
+    snprintf(member, sizeof(member), "member:%d", i);
+    DBObj *rank = zrank(zset, member, false);
+    results += dbobj_is_int(rank);
+    free_dbobj(rank);
+  }
+  print_zset_benchmark_row("zrank", ZSET_BENCHMARK_WINDOWS, benchmark_now_ns() - started_at, results);
+
+  started_at = benchmark_now_ns();
+  for (int i = 0; i < ZSET_BENCHMARK_MEMBERS; ++i)
+  {
+    snprintf(member, sizeof(member), "member:%d", i);
+    zrem(zset, member);
+  }
+  print_zset_benchmark_row("zrem", ZSET_BENCHMARK_MEMBERS, benchmark_now_ns() - started_at, zcard(zset));
+
+  free_dbzset(zset);
+  free(scores);
+}
+
+// Latencies of the operations of one output row, each timed on its own
+typedef struct MicroBenchmarkRow
+{
+  DBLatencyHistogram histogram;
+  uint64_t elapsed_ns;
+} MicroBenchmarkRow;
+
+#define MICRO_TIME(row, statement)                 \
+  do                                               \
+  {                                                \
+    uint64_t _started_at = latency_now_ns();       \
+    statement;                                     \
+    uint64_t _elapsed = latency_now_ns() - _started_at; \
+    latency_record(&(row)->histogram, _elapsed);   \
+    (row)->elapsed_ns += _elapsed;                 \
+  } while (0)
+
+static void micro_reset(MicroBenchmarkRow *row)
+{
+  memset(row, 0, sizeof(*row));
+}
+
+// A load factor of -1 leaves the column empty, it only applies to hash tables
+static void print_micro_benchmark_row(const char *structure, const char *operation, db_uint_t size, double load_factor, MicroBenchmarkRow *row)
+{
+  const DBLatencyHistogram *histogram = &row->histogram;
+  char load[32] = "";
+  if (load_factor >= 0)
+    snprintf(load, sizeof(load), "%.3f", load_factor);
+  printf("%s,%s,%llu,%s,%llu,%.3f,%.0f,%llu,%llu,%llu,%llu\n", structure, operation, (unsigned long long)size, load,
+         (unsigned long long)histogram->count, row->elapsed_ns / 1e6, histogram->count / (row->elapsed_ns / 1e9),
+         (unsigned long long)latency_percentile(histogram, 50), (unsigned long long)latency_percentile(histogram, 99),
+         (unsigned long long)latency_percentile(histogram, 99.9), (unsigned long long)histogram->max_ns);
+  fflush(stdout);
+}
+
+// Fixed-width keys "key:<i>" for 0 <= i < `count`, with `offset` added to i
+static char *create_micro_benchmark_keys(db_uint_t count, db_uint_t offset)
+{
+  char *keys = (char *)malloc((size_t)count * MICRO_BENCHMARK_KEY_LENGTH);
+  if (!keys)
+    EXIT_ON_MEMORY_ERROR();
+  for (db_uint_t i = 0; i < count; ++i)
+    snprintf(keys + (size_t)i * MICRO_BENCHMARK_KEY_LENGTH, MICRO_BENCHMARK_KEY_LENGTH, "key:%llu", (unsigned long long)(i + offset));
+  return keys;
+}
+
+#define MICRO_KEY(keys, i) ((keys) + (size_t)(i) * MICRO_BENCHMARK_KEY_LENGTH)
+
+// Scattered index below `size`, the same sequence on every run
+static inline db_uint_t micro_index(db_uint_t i, db_uint_t size)
+{
+  return (db_uint_t)(((uint64_t)i * 2654435761u) % size);
+}
+
+static double micro_load_factor(DBHash *ht)
+{
+  return ht->size0 ? (double)(ht->count0 + ht->count1) / ht->size0 : 0;
+}
+
+static void run_micro_hash_round(db_uint_t size)
+{
+  char *keys = create_micro_benchmark_keys(size, 0);
+  char *missing_keys = create_micro_benchmark_keys(MICRO_BENCHMARK_SAMPLES, size);
+  MicroBenchmarkRow row;
+  DBHash *ht = ht_create();
+  DBObj *value;
+
+  // Growing the table, rehash steps included
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < size; ++i)
+  {
+    value = dbobj_create_string_with_dup("value");
+    MICRO_TIME(&row, hset(ht, MICRO_KEY(keys, i), value, NULL));
+  }
+  print_micro_benchmark_row("hash", "hset_insert", size, micro_load_factor(ht), &row);
+  double load_factor = micro_load_factor(ht);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < MICRO_BENCHMARK_SAMPLES; ++i)
+    MICRO_TIME(&row, hget(ht, MICRO_KEY(keys, micro_index(i, size)), NULL));
+  print_micro_benchmark_row("hash", "hget_hit", size, load_factor, &row);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < MICRO_BENCHMARK_SAMPLES; ++i)
+    MICRO_TIME(&row, hget(ht, MICRO_KEY(missing_keys, i), NULL));
+  print_micro_benchmark_row("hash", "hget_miss", size, load_factor, &row);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < MICRO_BENCHMARK_SAMPLES; ++i)
+  {
+    value = dbobj_create_string_with_dup("other");
+    MICRO_TIME(&row, hset(ht, MICRO_KEY(keys, micro_index(i, size)), value, NULL));
+  }
+  print_micro_benchmark_row("hash", "hset_update", size, load_factor, &row);
+
+  // Every deleted key is put back untimed, so the table keeps its size.
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < MICRO_BENCHMARK_SAMPLES; ++i)
+  {
+    const char *key = MICRO_KEY(keys, micro_index(i, size));
+    MICRO_TIME(&row, hdel(ht, key, NULL));
+    hset(ht, key, dbobj_create_string_with_dup("value"), NULL);
+  }
+  print_micro_benchmark_row("hash", "hdel", size, load_factor, &row);
+
+  // Add keys until the table starts growing, then read while it moves a bucket per operation.
+  db_uint_t added = 0;
+  while (ht->rehashing_index == -1 && added < MICRO_BENCHMARK_SAMPLES)
+    hset(ht, MICRO_KEY(missing_keys, added++), dbobj_create_string_with_dup("value"), NULL);
+  micro_reset(&row);
+  for (db_uint_t i = 0; ht->rehashing_index != -1; ++i)
+    MICRO_TIME(&row, hget(ht, MICRO_KEY(keys, micro_index(i, size)), NULL));
+  if (row.histogram.count)
+    print_micro_benchmark_row("hash", "hget_rehashing", size, micro_load_factor(ht), &row);
+
+  ht_free(ht);
+  free(keys);
+  free(missing_keys);
+}
+
+static void run_micro_list_round(db_uint_t size)
+{
+  char *values = create_micro_benchmark_keys(size, 0);
+  MicroBenchmarkRow row;
+  DBQuickList *list = ql_create();
+  db_uint_t samples = size < MICRO_BENCHMARK_SAMPLES ? size : MICRO_BENCHMARK_SAMPLES;
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < size; ++i)
+    MICRO_TIME(&row, ql_rpush(list, MICRO_KEY(values, i)));
+  print_micro_benchmark_row("list", "rpush", size, -1, &row);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < samples / 10; ++i)
+  {
+    db_uint_t start = micro_index(i, size - MICRO_BENCHMARK_RANGE);
+    DBList *range;
+    MICRO_TIME(&row, range = ql_lrange(list, start, start + MICRO_BENCHMARK_RANGE - 1));
+    free_dblist(range);
+  }
+  print_micro_benchmark_row("list", "lrange_100", size, -1, &row);
+
+  // Popped elements are pushed back untimed, so the list keeps its size.
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < samples; ++i)
+  {
+    DBObj *element;
+    MICRO_TIME(&row, element = ql_lpop(list));
+    ql_rpush(list, element->value.string);
+    free_dbobj(element);
+  }
+  print_micro_benchmark_row("list", "lpop", size, -1, &row);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < samples; ++i)
+  {
+    DBObj *element;
+    MICRO_TIME(&row, element = ql_rpop(list));
+    ql_rpush(list, element->value.string);
+    free_dbobj(element);
+  }
+  print_micro_benchmark_row("list", "rpop", size, -1, &row);
+
+  ql_free(list);
+  free(values);
+}
+
+static void run_micro_zset_round(db_uint_t size)
+{
+  char *members = create_micro_benchmark_keys(size, 0);
+  MicroBenchmarkRow row;
+  DBZSet *zset = zset_create();
+  db_uint_t samples = size < MICRO_BENCHMARK_SAMPLES ? size : MICRO_BENCHMARK_SAMPLES;
+  DBList *range;
+
+  // Scores in [0, 1), in scattered order
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < size; ++i)
+    MICRO_TIME(&row, zadd(zset, (double)micro_index(i, size) / size, MICRO_KEY(members, i)));
+  print_micro_benchmark_row("zset", "zadd", size, -1, &row);
+
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < samples / 10; ++i)
+  {
+    db_uint_t start = micro_index(i, size - MICRO_BENCHMARK_RANGE);
+    MICRO_TIME(&row, range = zrange(zset, start, start + MICRO_BENCHMARK_RANGE - 1, false, NULL));
+    free_dblist(range);
+  }
+  print_micro_benchmark_row("zset", "zrange_100", size, -1, &row);
+
+  db_double_t width = (double)MICRO_BENCHMARK_RANGE / size;
+  micro_reset(&row);
+  for (db_uint_t i = 0; i < samples / 10; ++i)
+  {
+    db_double_t min = (double)micro_index(i, size) / size;
+    MICRO_TIME(&row, range = zrangebyscore(zset, min, true, min + width, false, false, NULL));
+    free_dblist(range);
+  }
+  print_micro_benchmark_row("zset", "zrangebyscore_100", size, -1, &row);
+
+  if (size <= MICRO_BENCHMARK_ZINTER_MAX_SIZE)
+  {
+    // The second set shares every other member of the first.
+    DBZSet *other = zset_create();
+    for (db_uint_t i = 0; i < size; i += 2)
+      zadd(other, 1, MICRO_KEY(members, i));
+    DBList *zsets = create_dblist();
+    rpush(zsets, create_dblistnode(dbobj_create_zset(zset)));
+    rpush(zsets, create_dblistnode(dbobj_create_zset(other)));
+
+    micro_reset(&row);
+    for (db_uint_t i = 0; i < MICRO_BENCHMARK_ZINTER_ROUNDS; ++i)
+    {
+      DBObj *result;
+      MICRO_TIME(&row, result = zinterstore(zsets, NULL, DB_AGG_SUM));
+      free_dbobj(result);
+    }
+    print_micro_benchmark_row("zset", "zinterstore", size, -1, &row);
+    // Frees both sets.
+    free_dblist(zsets);
+  }
+  else
+    free_dbzset(zset);
+
+  free(members);
+}
+
+void run_micro_benchmark()
+{
+  // Latencies are in nanoseconds; `size` is the elements in the structure while it is read.
+  printf("structure,operation,size,load_factor,operations,elapsed_ms,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+  for (db_uint_t size = MICRO_BENCHMARK_MIN_SIZE; size <= MICRO_BENCHMARK_MAX_SIZE; size *= 10)
+  {
+    run_micro_hash_round(size);
+    run_micro_list_round(size);
+    run_micro_zset_round(size);
+  }
+}
+
+typedef enum
+{
+  // Straight through dbapi_pipeline_async in this process
+  LOAD_TARGET_API,
+  // RESP over TCP to the network server of this process
+  LOAD_TARGET_NET,
+  // RESP over TCP to a real Redis
+  LOAD_TARGET_REDIS,
+} load_target_t;
+
+typedef enum
+{
+  LOAD_UNIFORM,
+  LOAD_ZIPF,
+} load_distribution_t;
+
+typedef struct LoadBenchmarkConfig
+{
+  db_uint_t clients;
+  // Commands each client sends before it waits for their replies
+  db_uint_t pipeline;
+  // Percent of the commands that are SET, the rest are GET
+  db_uint_t set_percent;
+  db_uint_t value_size;
+  load_distribution_t distribution;
+} LoadBenchmarkConfig;
+
+// Every round runs against every target
+static const LoadBenchmarkConfig load_rounds[] = {
+    {1, 1, 10, 64, LOAD_UNIFORM},
+    {8, 1, 10, 64, LOAD_UNIFORM},
+    {32, 1, 10, 64, LOAD_UNIFORM},
+    {32, 1, 10, 64, LOAD_ZIPF},
+    {1, 16, 10, 64, LOAD_UNIFORM},
+    {8, 16, 10, 64, LOAD_UNIFORM},
+    {32, 16, 10, 64, LOAD_UNIFORM},
+    {32, 16, 10, 64, LOAD_ZIPF},
+    {32, 16, 50, 64, LOAD_ZIPF},
+    {32, 16, 10, 1024, LOAD_UNIFORM},
+    {32, 16, 50, 1024, LOAD_UNIFORM},
+};
+
+static const char *const load_target_names[] = {"api", "net", "redis"};
+static const char *const load_distribution_names[] = {"uniform", "zipf"};
+
+// Chance of each key rank under Zipf's law, the rank-k key drawn in proportion to 1/k, summed up;
+// built once
+static double *load_zipf_cdf = NULL;
+
+typedef struct LoadClient
+{
+  load_target_t target;
+  int fd;
+  DBPipeline *pipeline;
+  // Commands encoded for a TCP target, and replies read and not parsed yet
+  char *out;
+  size_t out_length;
+  size_t out_capacity;
+  char *in;
+  size_t in_start;
+  size_t in_length;
+  size_t in_capacity;
+} LoadClient;
+
+typedef struct LoadWorker
+{
+  thrd_t thread;
+  load_target_t target;
+  const LoadBenchmarkConfig *config;
+  db_uint_t requests;
+  uint64_t seed;
+  const char *value;
+  DBLatencyHistogram histogram;
+  db_bool_t is_failed;
+} LoadWorker;
+
+static inline uint64_t load_random(uint64_t *state)
+{
+  // xorshift64*, plenty for picking keys
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+
+static void load_build_zipf_cdf()
+{
+  if (load_zipf_cdf)
+    return;
+  load_zipf_cdf = (double *)malloc(LOAD_BENCHMARK_KEYS * sizeof(double));
+  if (!load_zipf_cdf)
+    EXIT_ON_MEMORY_ERROR();
+  double sum = 0;
+  for (db_uint_t i = 0; i < LOAD_BENCHMARK_KEYS; ++i)
+    load_zipf_cdf[i] = sum += 1.0 / (i + 1);
+  for (db_uint_t i = 0; i < LOAD_BENCHMARK_KEYS; ++i)
+    load_zipf_cdf[i] /= sum;
+}
+
+static db_uint_t load_pick_key(load_distribution_t distribution, uint64_t *state)
+{
+  if (distribution == LOAD_UNIFORM)
+    return load_random(state) % LOAD_BENCHMARK_KEYS;
+
+  double u = (load_random(state) >> 11) * (1.0 / 9007199254740992.0);
+  db_uint_t low = 0, high = LOAD_BENCHMARK_KEYS - 1;
+  while (low < high)
+  {
+    db_uint_t mid = (low + high) / 2;
+    if (load_zipf_cdf[mid] < u)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  // The hot ranks are scattered over the keyspace, and so over the shards.
+  return (db_uint_t)(((uint64_t)low * 2654435761u) % LOAD_BENCHMARK_KEYS);
+}
+
+static int load_connect(const char *ip, db_uint_t port)
+{
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons((uint16_t)port)};
+  if (inet_pton(AF_INET, ip, &address.sin_addr) != 1)
+    return -1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+static db_bool_t load_client_open(LoadClient *client, load_target_t target)
+{
+  memset(client, 0, sizeof(*client));
+  client->target = target;
+  client->fd = -1;
+  if (target == LOAD_TARGET_API)
+  {
+    client->pipeline = create_pipeline();
+    return true;
+  }
+  if (target == LOAD_TARGET_NET)
+    client->fd = load_connect("127.0.0.1", LOAD_BENCHMARK_NET_PORT);
+  else
+    client->fd = load_connect(LOAD_BENCHMARK_REDIS_IP, LOAD_BENCHMARK_REDIS_PORT);
+  return client->fd >= 0;
+}
+
+static void load_client_close(LoadClient *client)
+{
+  if (client->pipeline)
+    free_pipeline(client->pipeline);
+  if (client->fd >= 0)
+    close(client->fd);
+  free(client->out);
+  free(client->in);
+}
+
+static void load_append(LoadClient *client, const char *data, size_t length)
+{
+  if (client->out_length + length > client->out_capacity)
+  {
+    size_t capacity = client->out_capacity ? client->out_capacity : 4096;
+    while (client->out_length + length > capacity)
+      capacity *= 2;
+    char *out = (char *)realloc(client->out, capacity);
+    if (!out)
+      EXIT_ON_MEMORY_ERROR();
+    client->out = out;
+    client->out_capacity = capacity;
+  }
+  memcpy(client->out + client->out_length, data, length);
+  client->out_length += length;
+}
+
+static void load_append_bulk(LoadClient *client, const char *data, size_t length)
+{
+  char header[32];
+  load_append(client, header, (size_t)snprintf(header, sizeof(header), "$%zu\r\n", length));
+  load_append(client, data, length);
+  load_append(client, "\r\n", 2);
+}
+
+// Queues one command on the client; `value` is NULL for a GET
+static void load_client_add(LoadClient *client, const char *key, const char *value, db_uint_t value_size)
+{
+  if (client->target == LOAD_TARGET_API)
+  {
+    DBRequest *request = create_request(value ? DB_SET : DB_GET);
+    add_request_arg(request, dbobj_create_string_with_dup(key));
+    if (value)
+      add_request_arg(request, dbobj_create_string_with_dup(value));
+    add_pipeline_request(client->pipeline, request);
+    return;
+  }
+  load_append(client, value ? "*3\r\n$3\r\nSET\r\n" : "*2\r\n$3\r\nGET\r\n", 13);
+  load_append_bulk(client, key, strlen(key));
+  if (value)
+    load_append_bulk(client, value, value_size);
+}
+
+// Length of the reply at the start of `data`, 0 while it is incomplete; only the reply types of
+// GET and SET are expected
+static size_t load_reply_length(const char *data, size_t length)
+{
+  const char *end = memchr(data, '\n', length);
+  if (!end)
+    return 0;
+  size_t line = (size_t)(end - data) + 1;
+  if (data[0] != '$')
+    return line;
+  long long bulk = atoll(data + 1);
+  if (bulk < 0)
+    return line;
+  size_t total = line + (size_t)bulk + 2;
+  return total <= length ? total : 0;
+}
+
+// Reads `count` replies, returning false when the connection fails or a reply is an error
+static db_bool_t load_client_read(LoadClient *client, db_uint_t count)
+{
+  db_bool_t is_ok = true;
+  while (count)
+  {
+    size_t reply_length;
+    while (count && (reply_length = load_reply_length(client->in + client->in_start, client->in_length - client->in_start)))
+    {
+      is_ok = is_ok && client->in[client->in_start] != '-';
+      client->in_start += reply_length;
+      --count;
+    }
+    if (!count)
+      break;
+
+    // Keep the partial reply and make room behind it.
+    memmove(client->in, client->in + client->in_start, client->in_length - client->in_start);
+    client->in_length -= client->in_start;
+    client->in_start = 0;
+    if (client->in_capacity - client->in_length < NET_READ_CHUNK)
+    {
+      size_t capacity = client->in_capacity ? client->in_capacity * 2 : 2 * NET_READ_CHUNK;
+      char *in = (char *)realloc(client->in, capacity);
+      if (!in)
+        EXIT_ON_MEMORY_ERROR();
+      client->in = in;
+      client->in_capacity = capacity;
+    }
+    ssize_t n = read(client->fd, client->in + client->in_length, client->in_capacity - client->in_length);
+    if (n <= 0)
+      return false;
+    client->in_length += (size_t)n;
+  }
+  return is_ok;
+}
+
+// Sends the queued commands and waits for every reply
+static db_bool_t load_client_flush(LoadClient *client, db_uint_t count)
+{
+  if (client->target == LOAD_TARGET_API)
+  {
+    reset_pipeline(dbapi_await_pipeline(dbapi_pipeline_async(client->pipeline)));
+    return true;
+  }
+  for (size_t written = 0; written < client->out_length;)
+  {
+    ssize_t n = write(client->fd, client->out + written, client->out_length - written);
+    if (n <= 0)
+      return false;
+    written += (size_t)n;
+  }
+  client->out_length = 0;
+  return load_client_read(client, count);
+}
+
+static int load_worker_run(void *arg)
+{
+  LoadWorker *worker = (LoadWorker *)arg;
+  const LoadBenchmarkConfig *config = worker->config;
+  LoadClient client;
+  uint64_t state = worker->seed;
+  char key[32];
+
+  if (!load_client_open(&client, worker->target))
+  {
+    worker->is_failed = true;
+    return 1;
+  }
+  for (db_uint_t sent = 0; sent < worker->requests && !worker->is_failed;)
+  {
+    db_uint_t batch = 0;
+    for (; batch < config->pipeline && sent < worker->requests; ++batch, ++sent)
+    {
+      snprintf(key, sizeof(key), "key:%llu", (unsigned long long)load_pick_key(config->distribution, &state));
+      db_bool_t is_set = load_random(&state) % 100 < config->set_percent;
+      load_client_add(&client, key, is_set ? worker->value : NULL, config->value_size);
+    }
+    // As in redis-benchmark, every command of a batch waits as long as the whole batch.
+    uint64_t started_at = latency_now_ns();
+    worker->is_failed = !load_client_flush(&client, batch);
+    uint64_t elapsed = latency_now_ns() - started_at;
+    for (db_uint_t i = 0; i < batch; ++i)
+      latency_record(&worker->histogram, elapsed);
+  }
+  load_client_close(&client);
+  return 0;
+}
+
+static char *create_load_value(db_uint_t value_size)
+{
+  char *value = (char *)malloc(value_size + 1);
+  if (!value)
+    EXIT_ON_MEMORY_ERROR();
+  memset(value, 'x', value_size);
+  value[value_size] = '\0';
+  return value;
+}
+
+// Sets every key once so GETs hit, over one client at a deep pipeline
+static db_bool_t load_fill_keys(load_target_t target, db_uint_t value_size)
+{
+  LoadClient client;
+  char *value = create_load_value(value_size);
+  char key[32];
+  db_bool_t is_ok = load_client_open(&client, target);
+
+  for (db_uint_t i = 0; i < LOAD_BENCHMARK_KEYS && is_ok;)
+  {
+    db_uint_t batch = 0;
+    for (; batch < 256 && i < LOAD_BENCHMARK_KEYS; ++batch, ++i)
+    {
+      snprintf(key, sizeof(key), "key:%llu", (unsigned long long)i);
+      load_client_add(&client, key, value, value_size);
+    }
+    is_ok = load_client_flush(&client, batch);
+  }
+  load_client_close(&client);
+  free(value);
+  return is_ok;
+}
+
+static db_bool_t run_load_round(load_target_t target, const LoadBenchmarkConfig *config)
+{
+  LoadWorker *workers = (LoadWorker *)calloc(config->clients, sizeof(LoadWorker));
+  char *value = create_load_value(config->value_size);
+  DBLatencyHistogram histogram;
+  db_bool_t is_failed = false;
+  if (!workers)
+    EXIT_ON_MEMORY_ERROR();
+  if (!load_fill_keys(target, config->value_size))
+  {
+    free(workers);
+    free(value);
+    return false;
+  }
+
+  uint64_t started_at = latency_now_ns();
+  for (db_uint_t i = 0; i < config->clients; ++i)
+  {
+    workers[i].target = target;
+    workers[i].config = config;
+    workers[i].requests = LOAD_BENCHMARK_REQUESTS / config->clients;
+    workers[i].seed = 0x9e3779b97f4a7c15ull * (i + 1);
+    workers[i].value = value;
+    thrd_create(&workers[i].thread, load_worker_run, &workers[i]);
+  }
+  memset(&histogram, 0, sizeof(histogram));
+  for (db_uint_t i = 0; i < config->clients; ++i)
+  {
+    thrd_join(workers[i].thread, NULL);
+    latency_merge(&histogram, &workers[i].histogram);
+    is_failed = is_failed || workers[i].is_failed;
+  }
+  uint64_t elapsed_ns = latency_now_ns() - started_at;
+
+  if (!is_failed)
+    printf("%s,%s,%llu,%llu,%llu,%llu,%llu,%.3f,%.0f,%.1f,%.1f,%.1f\n", load_target_names[target],
+           load_distribution_names[config->distribution], (unsigned long long)config->clients,
+           (unsigned long long)config->pipeline, (unsigned long long)config->set_percent,
+           (unsigned long long)config->value_size, (unsigned long long)histogram.count, elapsed_ns / 1e6,
+           histogram.count / (elapsed_ns / 1e9), latency_percentile(&histogram, 50) / 1e3,
+           latency_percentile(&histogram, 99) / 1e3, latency_percentile(&histogram, 99.9) / 1e3);
+  fflush(stdout);
+  free(workers);
+  free(value);
+  return !is_failed;
+}
+
+static int load_serve(void *arg)
+{
+  (void)arg;
+  return dbapi_start_network_server(LOAD_BENCHMARK_NET_PORT) ? 0 : 1;
+}
+
+// Waits for the network server to listen, up to a second
+static db_bool_t load_wait_for_server()
+{
+  for (int attempt = 0; attempt < 100; ++attempt)
+  {
+    int fd = load_connect("127.0.0.1", LOAD_BENCHMARK_NET_PORT);
+    if (fd >= 0)
+    {
+      close(fd);
+      return true;
+    }
+    thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000 * 1000}, NULL);
+  }
+  return false;
+}
+
+void run_load_benchmark()
+{
+  size_t round_count = sizeof(load_rounds) / sizeof(LoadBenchmarkConfig);
+  thrd_t server;
+
+  load_build_zipf_cdf();
+  server_config_persistence_filepath(LOAD_BENCHMARK_PERSISTENCE_FILE);
+  dbapi_start_server();
+  thrd_create(&server, load_serve, NULL);
+  db_bool_t is_serving = load_wait_for_server();
+
+  printf("target,distribution,clients,pipeline,set_percent,value_size,requests,elapsed_ms,ops_per_sec,p50_us,p99_us,p999_us\n");
+  for (load_target_t target = LOAD_TARGET_API; target <= LOAD_TARGET_REDIS; ++target)
+  {
+    if (target == LOAD_TARGET_NET && !is_serving)
+    {
+      fprintf(stderr, "load: the network server did not start on port %d, skipping\n", LOAD_BENCHMARK_NET_PORT);
+      continue;
+    }
+    for (size_t i = 0; i < round_count; ++i)
+      if (!run_load_round(target, &load_rounds[i]))
+      {
+        fprintf(stderr, "load: no %s at %s:%d, skipping\n", load_target_names[target],
+                target == LOAD_TARGET_REDIS ? LOAD_BENCHMARK_REDIS_IP : "127.0.0.1",
+                target == LOAD_TARGET_REDIS ? LOAD_BENCHMARK_REDIS_PORT : LOAD_BENCHMARK_NET_PORT);
+        break;
+      }
+  }
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  dbapi_flushall();
+  dbapi_shutdown();
+  remove(LOAD_BENCHMARK_PERSISTENCE_FILE);
+  free(load_zipf_cdf);
+  load_zipf_cdf = NULL;
+}
+
+typedef struct MemoryBenchmarkRound
+{
+  const char *type;
+  const char *encoding;
+  db_action_t action;
+  db_uint_t list_block_size;
+  db_uint_t zset_packed_max_members;
+  db_uint_t hash_packed_max_fields;
+} MemoryBenchmarkRound;
+
+// Each encoding is loaded next to the one it replaces; strings have a single value per key
+static const MemoryBenchmarkRound memory_rounds[] = {
+    {"string", "raw", DB_SET, 0, ZSET_PACKED_MAX_MEMBERS, HASH_PACKED_MAX_FIELDS},
+    {"list", "quicklist", DB_RPUSH, 0, ZSET_PACKED_MAX_MEMBERS, HASH_PACKED_MAX_FIELDS},
+    // A block too small for two elements, which is a linked list with a header per element
+    {"list", "node_per_element", DB_RPUSH, 1, ZSET_PACKED_MAX_MEMBERS, HASH_PACKED_MAX_FIELDS},
+    {"hash", "packed", DB_HSET, 0, ZSET_PACKED_MAX_MEMBERS, HASH_PACKED_MAX_FIELDS},
+    {"hash", "hashtable", DB_HSET, 0, ZSET_PACKED_MAX_MEMBERS, 0},
+    {"zset", "packed", DB_ZADD, 0, ZSET_PACKED_MAX_MEMBERS, HASH_PACKED_MAX_FIELDS},
+    {"zset", "skiplist", DB_ZADD, 0, 0, HASH_PACKED_MAX_FIELDS},
+};
+
+typedef struct MemorySample
+{
+  size_t rss;
+  size_t malloc;
+} MemorySample;
+
+// Resident set size from /proc, and bytes malloc has handed out, chunk headers included
+static MemorySample memory_sample()
+{
+  MemorySample sample = {0, 0};
+  unsigned long long pages_total, pages_resident;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file)
+  {
+    if (fscanf(file, "%llu %llu", &pages_total, &pages_resident) == 2)
+      sample.rss = (size_t)pages_resident * (size_t)sysconf(_SC_PAGESIZE);
+    fclose(file);
+  }
+  sample.malloc = mallinfo2().uordblks;
+  return sample;
+}
+
+// What the engine counts of its dataset, summed from malloc_usable_size of every allocation
+static size_t memory_accounted_bytes()
+{
+  DBRequest *request = create_request(DB_INFO_DATASET_MEMORY);
+  DBReply *reply = dbapi_request_sync(request);
+  size_t bytes = 0;
+  const char *field = "dataset_total_bytes:";
+
+  if (dbobj_is_list(reply->data))
+    for (DBListNode *node = reply->data->value.list->head; node; node = node->next)
+      if (strncmp(((DBObj *)node->data)->value.string, field, strlen(field)) == 0)
+        bytes = (size_t)strtoull(((DBObj *)node->data)->value.string + strlen(field), NULL, 10);
+  free_reply(reply);
+  free_request(request);
+  return bytes;
+}
+
+static DBRequest *create_memory_request(const MemoryBenchmarkRound *round, db_uint_t i, const char *value)
+{
+  char text[32];
+  DBRequest *request = create_request(round->action);
+
+  snprintf(text, sizeof(text), "%s:%llu", round->type, (unsigned long long)i);
+  add_request_arg(request, dbobj_create_string_with_dup(text));
+  if (round->action == DB_SET)
+  {
+    add_request_arg(request, dbobj_create_string_with_dup(value));
+    return request;
+  }
+  for (db_uint_t j = 0; j < MEMORY_BENCHMARK_ELEMENTS; ++j)
+  {
+    snprintf(text, sizeof(text), "%llu", (unsigned long long)j);
+    if (round->action != DB_RPUSH)
+      add_request_arg(request, dbobj_create_string_with_dup(text));
+    if (round->action == DB_ZADD)
+      snprintf(text, sizeof(text), "element:%llu", (unsigned long long)j);
+    add_request_arg(request, dbobj_create_string_with_dup(round->action == DB_ZADD ? text : value));
+  }
+  return request;
+}
+
+static void run_memory_round(const MemoryBenchmarkRound *round)
+{
+  DBPipeline *pipeline = create_pipeline();
+  char value[MEMORY_BENCHMARK_VALUE_SIZE + 1];
+  db_uint_t elements = round->action == DB_SET ? 1 : MEMORY_BENCHMARK_ELEMENTS;
+
+  memset(value, 'x', MEMORY_BENCHMARK_VALUE_SIZE);
+  value[MEMORY_BENCHMARK_VALUE_SIZE] = '\0';
+  server_config_list_block_size(round->list_block_size);
+  server_config_zset_packed(round->zset_packed_max_members, ZSET_PACKED_MAX_LENGTH);
+  server_config_hash_packed(round->hash_packed_max_fields, HASH_PACKED_MAX_LENGTH);
+
+  // Whatever the last round freed goes back to the system first, so the RSS delta is this round's.
+  dbapi_flushall();
+  malloc_trim(0);
+  MemorySample before = memory_sample();
+  for (db_uint_t i = 0; i < MEMORY_BENCHMARK_KEYS;)
+  {
+    for (db_uint_t j = 0; j < 256 && i < MEMORY_BENCHMARK_KEYS; ++j)
+      add_pipeline_request(pipeline, create_memory_request(round, i++, value));
+    reset_pipeline(dbapi_pipeline_sync(pipeline));
+  }
+  free_pipeline(pipeline);
+  malloc_trim(0);
+  MemorySample after = memory_sample();
+  size_t accounted = memory_accounted_bytes();
+
+  size_t rss = after.rss > before.rss ? after.rss - before.rss : 0;
+  size_t allocated = after.malloc > before.malloc ? after.malloc - before.malloc : 0;
+  printf("%s,%s,%d,%llu,%zu,%zu,%zu,%.1f,%.1f,%.1f\n", round->type, round->encoding, MEMORY_BENCHMARK_KEYS,
+         (unsigned long long)elements, rss, allocated, accounted, (double)rss / MEMORY_BENCHMARK_KEYS,
+         (double)allocated / MEMORY_BENCHMARK_KEYS, (double)accounted / MEMORY_BENCHMARK_KEYS);
+  fflush(stdout);
+}
+
+void run_memory_benchmark()
+{
+  server_config_persistence_filepath(MEMORY_BENCHMARK_PERSISTENCE_FILE);
+  dbapi_start_server();
+
+  printf("type,encoding,keys,elements_per_key,rss_bytes,malloc_bytes,accounted_bytes,rss_per_key,malloc_per_key,accounted_per_key\n");
+  for (size_t i = 0; i < sizeof(memory_rounds) / sizeof(MemoryBenchmarkRound); ++i)
+    run_memory_round(&memory_rounds[i]);
+
+  server_config_list_block_size(0);
+  server_config_zset_packed(ZSET_PACKED_MAX_MEMBERS, ZSET_PACKED_MAX_LENGTH);
+  server_config_hash_packed(HASH_PACKED_MAX_FIELDS, HASH_PACKED_MAX_LENGTH);
+  dbapi_flushall();
+  dbapi_shutdown();
+  remove(MEMORY_BENCHMARK_PERSISTENCE_FILE);
+}
+
+// A database.json of `records` people; the address runs long and now and then holds a quote or a
+// tab, so string scanning sees both long plain runs and escapes
+static cJSON *json_benchmark_document(size_t records)
+{
+  static const char *jobs[] = {"Tech Lead", "System Administrator", "Software Tester", "Data \"Wrangler\""};
+  cJSON *root = cJSON_CreateObject();
+  char name[32], text[256];
+
+  for (size_t i = 0; i < records; ++i)
+  {
+    cJSON *person = cJSON_CreateObject();
+    snprintf(name, sizeof(name), "Person%zu", i);
+    cJSON_AddStringToObject(person, "name", name);
+    cJSON_AddStringToObject(person, "jobTitle", jobs[i % 4]);
+    cJSON_AddNumberToObject(person, "age", (double)(20 + i % 50));
+    snprintf(text, sizeof(text), "%zu Pineapple Street, Building %zu, Floor %zu,%sNorth District of the Old Harbour Town, "
+                                 "delivery to the back door after six in the evening only%s",
+             i, i % 97, i % 13, i % 8 ? " " : "\t", i % 16 ? "" : " (\"ring twice\")");
+    cJSON_AddStringToObject(person, "address", text);
+    cJSON_AddItemToObject(person, "phoneNumbers", cJSON_CreateArray());
+    snprintf(text, sizeof(text), "%03zu-%03zu-%04zu", i % 1000, (i / 7) % 1000, i % 10000);
+    cJSON_AddItemToArray(cJSON_GetObjectItem(person, "phoneNumbers"), cJSON_CreateString(text));
+    cJSON_AddItemToObject(person, "emailAddresses", cJSON_CreateArray());
+    snprintf(text, sizeof(text), "person%zu@example.com", i);
+    cJSON_AddItemToArray(cJSON_GetObjectItem(person, "emailAddresses"), cJSON_CreateString(text));
+    cJSON_AddBoolToObject(person, "isMarried", i % 3 == 0);
+    cJSON_AddBoolToObject(person, "isEmployed", i % 5 != 0);
+    cJSON_AddItemToObject(root, name, person);
+  }
+  return root;
+}
+
+static void json_benchmark_row(const char *operation, size_t bytes, uint64_t elapsed_ns)
+{
+  double seconds = (double)elapsed_ns / NANOSECONDS_PER_SECOND;
+  printf("%s,%d,%zu,%.6f,%.2f\n", operation, JSON_BENCHMARK_RECORDS, bytes, seconds,
+         (double)bytes * JSON_BENCHMARK_ROUNDS / seconds / (1024 * 1024));
+}
+
+void run_json_benchmark()
+{
+  cJSON *document = json_benchmark_document(JSON_BENCHMARK_RECORDS);
+  char *formatted = cJSON_Print(document);
+  char *unformatted = cJSON_PrintUnformatted(document);
+  size_t formatted_length = strlen(formatted), unformatted_length = strlen(unformatted);
+  uint64_t started_at;
+
+  printf("operation,records,bytes,seconds,mb_per_s\n");
+
+  started_at = benchmark_now_ns();
+  for (int round = 0; round < JSON_BENCHMARK_ROUNDS; ++round)
+    cJSON_Delete(cJSON_ParseWithLength(formatted, formatted_length));
+  json_benchmark_row("parse", formatted_length, benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int round = 0; round < JSON_BENCHMARK_ROUNDS; ++round)
+    cJSON_free(cJSON_Print(document));
+  json_benchmark_row("print", formatted_length, benchmark_now_ns() - started_at);
+
+  started_at = benchmark_now_ns();
+  for (int round = 0; round < JSON_BENCHMARK_ROUNDS; ++round)
+    cJSON_free(cJSON_PrintUnformatted(document));
+  json_benchmark_row("print_unformatted", unformatted_length, benchmark_now_ns() - started_at);
+
+  // Building and freeing the tree, one allocation per node and string against one arena
+  started_at = benchmark_now_ns();
+  for (int round = 0; round < JSON_BENCHMARK_ROUNDS; ++round)
+    cJSON_Delete(json_benchmark_document(JSON_BENCHMARK_RECORDS));
+  json_benchmark_row("build_heap", formatted_length, benchmark_now_ns() - started_at);
+
+  cJSON_Arena *arena = cJSON_ArenaNew(0);
+  started_at = benchmark_now_ns();
+  for (int round = 0; round < JSON_BENCHMARK_ROUNDS; ++round)
+  {
+    cJSON_Arena *previous = cJSON_ArenaUse(arena);
+    json_benchmark_document(JSON_BENCHMARK_RECORDS);
+    cJSON_ArenaUse(previous);
+    cJSON_ArenaReset(arena);
+  }
+  json_benchmark_row("build_arena", formatted_length, benchmark_now_ns() - started_at);
+  cJSON_ArenaDelete(arena);
+
+  cJSON_free(formatted);
+  cJSON_free(unformatted);
+  cJSON_Delete(document);
+}
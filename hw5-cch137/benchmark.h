@@ -0,0 +1,91 @@
+#ifndef DB_BENCHMARK_H
+#define DB_BENCHMARK_H
+
+#include <stdint.h>
+
+#include "db/types.h"
+
+// Every benchmark prints comma separated rows to stdout, starting with a header row,
+// so the output can be collected the same way as hw2's `benchmark-data/averaged.csv`.
+
+// Helper functions
+
+// Returns a wall clock timestamp in nanoseconds
+uint64_t benchmark_now_ns();
+
+// Queue benchmarks
+
+// Compares the task ring with a mutex-guarded linked list at 1, 4, 16 and 64 producer threads
+void run_queue_benchmark();
+
+// Pipeline benchmarks
+
+// Measures SET throughput through the API with one request per round trip and at pipeline depths 1, 16 and 256
+void run_pipeline_benchmark();
+
+// Hash table benchmarks
+
+// Compares DBHash with DBFlatHash on SET, GET of present keys in shuffled order and GET of missing keys
+void run_hash_benchmark();
+
+// Looks up every key of a DBHash of 10 million, in shuffled order, one hget_key at a time and with
+// hget_keys in batches of 8, 16 and 32, which prefetch the buckets and entries of a batch before
+// walking any of them
+void run_prefetch_benchmark();
+
+// Pattern benchmarks
+
+// Matches 10 million keys shaped like tenant:0042:user:12345678:session against KEYS patterns with
+// literal prefixes, suffixes, middles and '?', byte at a time with dbutil_match_keys and compiled
+// with glob.h, and reports the keys each matched, which must agree, and the time per key. The
+// patterns are checked for correctness against the table of test_glob_match in test.c
+void run_glob_benchmark();
+
+// Allocator benchmarks
+
+// Compares malloc with the slab pools on allocating and freeing blocks the size of the core structs
+void run_slab_benchmark();
+
+// List benchmarks
+
+// Compares the linked DBList with the packed DBQuickList on RPUSH, LRANGE of the whole list, reads
+// of single elements at scattered positions and LPOP
+void run_list_benchmark();
+
+// Sorted set benchmarks
+
+// Times ZADD, ZRANGEBYSCORE and ZCOUNT over narrow score windows, ZRANK and ZREM on a set with
+// fractional scores
+void run_zset_benchmark();
+
+// Micro benchmarks
+
+// Times hget/hset/hdel, list push/pop/range and zadd/zrange/zrangebyscore/zinterstore on their own,
+// at sizes from 1e3 to 1e7, with throughput and latency percentiles for every operation. Hash rows
+// carry the load factor of the table, and one row reads a table while it rehashes
+void run_micro_benchmark();
+
+// Load benchmarks
+
+// Drives GET/SET traffic in the manner of redis-benchmark from 1 to 32 concurrent clients, at
+// pipeline depths 1 and 16, with uniform and Zipfian keys, several SET ratios and value sizes.
+// Each mix runs through the API, over TCP against the network server of this database, and over
+// TCP against a real Redis on 127.0.0.1:6379 when one is running, with throughput and p50/p99/p999
+void run_load_benchmark();
+
+// Memory benchmarks
+
+// Loads 100000 keys of each type, in each encoding, and reports what they take three ways: the
+// growth of the resident set, the growth of what malloc has handed out, and the engine's own
+// count from malloc_usable_size, each in total and per key
+void run_memory_benchmark();
+
+// JSON benchmarks
+
+// Parses and prints, formatted and not, a document shaped like hw1's database.json with 20000
+// people in it, and reports the throughput of each in MB/s. Building cJSON with -DCJSON_NO_SIMD
+// gives the byte-at-a-time string scanning to compare with. Two more rows build and free the
+// document, node by node on the heap and all at once in an arena
+void run_json_benchmark();
+
+#endif
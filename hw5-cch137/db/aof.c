@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "interaction.h"
+#include "uring.h"
+#include "aof.h"
+
+#define AOF_READ_BUFFER_SIZE (64 * 1024)
+
+typedef struct AofReader
+{
+  int fd;
+  char buffer[AOF_READ_BUFFER_SIZE];
+  size_t position;
+  size_t length;
+  // Bytes consumed from the file so far
+  off_t offset;
+  db_bool_t failed;
+} AofReader;
+
+static int aof_fsync_worker(void *arg);
+
+static void aof_buffer_reserve(DBAofBuffer *buffer, size_t length)
+{
+  if (buffer->length + length <= buffer->capacity)
+    return;
+  size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+  while (capacity < buffer->length + length)
+    capacity *= 2;
+  char *data = (char *)realloc(buffer->data, capacity);
+  if (!data)
+    EXIT_ON_MEMORY_ERROR();
+  buffer->data = data;
+  buffer->capacity = capacity;
+}
+
+static void aof_buffer_append_u32(DBAofBuffer *buffer, uint32_t value)
+{
+  aof_buffer_reserve(buffer, 4);
+  buffer->data[buffer->length++] = (char)value;
+  buffer->data[buffer->length++] = (char)(value >> 8);
+  buffer->data[buffer->length++] = (char)(value >> 16);
+  buffer->data[buffer->length++] = (char)(value >> 24);
+}
+
+void aof_buffer_begin(DBAofBuffer *buffer, db_uint_t argc)
+{
+  aof_buffer_append_u32(buffer, argc);
+}
+
+void aof_buffer_append_arg(DBAofBuffer *buffer, const char *arg)
+{
+  aof_buffer_append_bytes(buffer, arg, arg ? strlen(arg) : 0);
+}
+
+void aof_buffer_append_bytes(DBAofBuffer *buffer, const char *arg, size_t length)
+{
+  aof_buffer_append_u32(buffer, (uint32_t)length);
+  aof_buffer_reserve(buffer, length);
+  memcpy(buffer->data + buffer->length, arg, length);
+  buffer->length += length;
+}
+
+void aof_buffer_append_request(DBAofBuffer *buffer, const char *name, DBList *args)
+{
+  char number[32];
+  DBListNode *node;
+
+  aof_buffer_begin(buffer, 1 + (args ? args->length : 0));
+  aof_buffer_append_arg(buffer, name);
+  for (node = args ? args->head : NULL; node; node = node->next)
+  {
+    // Handlers convert their numeric arguments in place.
+    switch (node->data->type)
+    {
+    case DB_TYPE_STRING:
+      aof_buffer_append_arg(buffer, node->data->value.string);
+      break;
+    case DB_TYPE_INT:
+      sprintf(number, "%d", node->data->value.int_value);
+      aof_buffer_append_arg(buffer, number);
+      break;
+    case DB_TYPE_UINT:
+      sprintf(number, "%u", node->data->value.uint_value);
+      aof_buffer_append_arg(buffer, number);
+      break;
+    case DB_TYPE_DOUBLE:
+      sprintf(number, "%.17g", node->data->value.double_value);
+      aof_buffer_append_arg(buffer, number);
+      break;
+    default:
+      aof_buffer_append_arg(buffer, NULL);
+      break;
+    }
+  }
+}
+
+void aof_buffer_free(DBAofBuffer *buffer)
+{
+  if (!buffer)
+    return;
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+}
+
+db_bool_t aof_buffer_write_fd(DBAofBuffer *buffer, int fd)
+{
+  db_bool_t is_success = uring_write_all(fd, buffer->data, buffer->length, false);
+  buffer->length = 0;
+  return is_success;
+}
+
+DBAof *aof_open(const char *filepath, db_aof_fsync_t policy)
+{
+  int fd = open(filepath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    perror("Failed to open append-only log.");
+    return NULL;
+  }
+
+  DBAof *aof = (DBAof *)malloc(sizeof(DBAof));
+  if (!aof)
+    EXIT_ON_MEMORY_ERROR();
+  aof->filepath = dbutil_strdup(filepath);
+  aof->fd = fd;
+  aof->policy = policy;
+  aof->is_dirty = false;
+  aof->is_closing = false;
+  mtx_init(&aof->lock, mtx_plain);
+  cnd_init(&aof->stop_cond);
+
+  aof->has_fsync_thread = policy == DB_AOF_FSYNC_EVERYSEC;
+  if (aof->has_fsync_thread)
+    thrd_create(&aof->fsync_thread, aof_fsync_worker, aof);
+
+  return aof;
+}
+
+void aof_close(DBAof *aof)
+{
+  if (!aof)
+    return;
+
+  mtx_lock(&aof->lock);
+  aof->is_closing = true;
+  cnd_signal(&aof->stop_cond);
+  mtx_unlock(&aof->lock);
+  if (aof->has_fsync_thread)
+    thrd_join(aof->fsync_thread, NULL);
+
+  if (aof->policy != DB_AOF_FSYNC_NO)
+    fsync(aof->fd);
+  close(aof->fd);
+  cnd_destroy(&aof->stop_cond);
+  mtx_destroy(&aof->lock);
+  free(aof->filepath);
+  free(aof);
+}
+
+// Syncs the log once a second while there are unsynced writes, so the workers never wait on the disk
+static int aof_fsync_worker(void *arg)
+{
+  DBAof *aof = (DBAof *)arg;
+  struct timespec deadline;
+
+  mtx_lock(&aof->lock);
+  while (!aof->is_closing)
+  {
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += 1;
+    cnd_timedwait(&aof->stop_cond, &aof->lock, &deadline);
+    if (aof->is_dirty)
+    {
+      aof->is_dirty = false;
+      fdatasync(aof->fd);
+    }
+  }
+  mtx_unlock(&aof->lock);
+
+  return 0;
+}
+
+db_bool_t aof_write(DBAof *aof, DBAofBuffer *buffer)
+{
+  if (!aof || !buffer || !buffer->length)
+    return true;
+
+  mtx_lock(&aof->lock);
+  // With a ring, the write and the sync of the always policy cost one system call.
+  db_bool_t is_success = uring_write_all(aof->fd, buffer->data, buffer->length, aof->policy == DB_AOF_FSYNC_ALWAYS);
+  buffer->length = 0;
+  if (aof->policy != DB_AOF_FSYNC_ALWAYS)
+    aof->is_dirty = true;
+  mtx_unlock(&aof->lock);
+
+  if (!is_success)
+    perror("Failed to write append-only log.");
+  return is_success;
+}
+
+void aof_truncate(DBAof *aof)
+{
+  if (!aof)
+    return;
+
+  mtx_lock(&aof->lock);
+  if (ftruncate(aof->fd, 0) != 0)
+    perror("Failed to truncate append-only log.");
+  aof->is_dirty = true;
+  mtx_unlock(&aof->lock);
+}
+
+static db_bool_t aof_reopen(DBAof *aof)
+{
+  int fd = open(aof->filepath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+  close(aof->fd);
+  aof->fd = fd;
+  return true;
+}
+
+db_bool_t aof_rotate(DBAof *aof, const char *rotated_filepath)
+{
+  if (!aof)
+    return false;
+
+  mtx_lock(&aof->lock);
+  db_bool_t is_success = rename(aof->filepath, rotated_filepath) == 0 && aof_reopen(aof);
+  mtx_unlock(&aof->lock);
+
+  if (!is_success)
+    perror("Failed to rotate append-only log.");
+  return is_success;
+}
+
+db_bool_t aof_absorb(DBAof *aof, const char *head_filepath)
+{
+  if (!aof)
+    return false;
+
+  char buffer[AOF_READ_BUFFER_SIZE];
+  ssize_t n = 0;
+  db_bool_t is_success = false;
+
+  mtx_lock(&aof->lock);
+  int head_fd = open(head_filepath, O_WRONLY | O_APPEND);
+  int tail_fd = open(aof->filepath, O_RDONLY);
+  if (head_fd >= 0 && tail_fd >= 0)
+  {
+    is_success = true;
+    while (is_success && (n = read(tail_fd, buffer, sizeof(buffer))) > 0)
+      is_success = write(head_fd, buffer, n) == n;
+    is_success = is_success && n == 0 && fsync(head_fd) == 0;
+  }
+  if (head_fd >= 0)
+    close(head_fd);
+  if (tail_fd >= 0)
+    close(tail_fd);
+  is_success = is_success && rename(head_filepath, aof->filepath) == 0 && aof_reopen(aof);
+  mtx_unlock(&aof->lock);
+
+  if (!is_success)
+    perror("Failed to install append-only log.");
+  return is_success;
+}
+
+static void aof_reader_read(AofReader *reader, void *data, size_t length)
+{
+  char *bytes = (char *)data;
+  size_t chunk;
+  ssize_t n;
+
+  while (length && !reader->failed)
+  {
+    if (reader->position == reader->length)
+    {
+      n = read(reader->fd, reader->buffer, AOF_READ_BUFFER_SIZE);
+      if (n <= 0)
+      {
+        reader->failed = true;
+        break;
+      }
+      reader->length = n;
+      reader->position = 0;
+    }
+    chunk = reader->length - reader->position;
+    chunk = chunk < length ? chunk : length;
+    memcpy(bytes, reader->buffer + reader->position, chunk);
+    reader->position += chunk;
+    reader->offset += chunk;
+    bytes += chunk, length -= chunk;
+  }
+}
+
+static uint32_t aof_reader_read_u32(AofReader *reader)
+{
+  unsigned char bytes[4] = {0};
+  aof_reader_read(reader, bytes, 4);
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static char *aof_reader_read_string(AofReader *reader)
+{
+  uint32_t length = aof_reader_read_u32(reader);
+  if (reader->failed || length > AOF_MAX_ARG_LENGTH)
+  {
+    reader->failed = true;
+    return NULL;
+  }
+
+  char *string = (char *)malloc(length + 1);
+  if (!string)
+    EXIT_ON_MEMORY_ERROR();
+  aof_reader_read(reader, string, length);
+  string[length] = '\0';
+  if (reader->failed)
+    return free(string), NULL;
+  return string;
+}
+
+static AofReader *aof_reader_create(int fd)
+{
+  AofReader *reader = (AofReader *)malloc(sizeof(AofReader));
+  if (!reader)
+    EXIT_ON_MEMORY_ERROR();
+  reader->fd = fd;
+  reader->position = 0;
+  reader->length = 0;
+  reader->offset = 0;
+  reader->failed = false;
+  return reader;
+}
+
+// Hands every complete record to the handler until the input ends or fails, advancing `progress`,
+// if given, past each once the handler returns; returns the offset just past the last complete record
+static off_t aof_reader_replay(AofReader *reader, aof_command_handler_t handler, void *context, _Atomic uint64_t *progress)
+{
+  off_t record_offset = 0;
+  uint32_t argc;
+  char *arg;
+  DBRequest *request;
+
+  while (true)
+  {
+    record_offset = reader->offset;
+    argc = aof_reader_read_u32(reader);
+    if (reader->failed || !argc)
+      break;
+
+    arg = aof_reader_read_string(reader);
+    request = create_request(arg ? db_action_from_name(arg) : DB_UNKNOWN_COMMAND);
+    free(arg);
+    for (uint32_t i = 1; i < argc && !reader->failed; ++i)
+    {
+      arg = aof_reader_read_string(reader);
+      if (arg)
+        add_request_arg(request, dbobj_create_string(arg));
+    }
+
+    if (reader->failed)
+    {
+      free_request(request);
+      break;
+    }
+    handler(request, context);
+    free_request(request);
+    if (progress)
+      atomic_fetch_add(progress, (uint64_t)(reader->offset - record_offset));
+  }
+  return record_offset;
+}
+
+db_bool_t aof_load(const char *filepath, aof_command_handler_t handler, void *context)
+{
+  int fd = open(filepath, O_RDWR);
+  if (fd < 0)
+    return false;
+  AofReader *reader = aof_reader_create(fd);
+  off_t record_offset = aof_reader_replay(reader, handler, context, NULL);
+
+  // Whatever follows the last complete record is a write that was cut off by a crash.
+  if (reader->offset != record_offset || lseek(reader->fd, 0, SEEK_END) != record_offset)
+  {
+    fprintf(stderr, "Truncating a torn record at the end of %s.\n", filepath);
+    if (ftruncate(reader->fd, record_offset) != 0)
+      perror("Failed to truncate append-only log.");
+  }
+
+  close(reader->fd);
+  free(reader);
+  return true;
+}
+
+void aof_replay_fd(int fd, aof_command_handler_t handler, void *context, _Atomic uint64_t *offset)
+{
+  AofReader *reader = aof_reader_create(fd);
+  aof_reader_replay(reader, handler, context, offset);
+  free(reader);
+}
@@ -0,0 +1,96 @@
+#ifndef DB_AOF_H
+#define DB_AOF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "types.h"
+
+// Append-only log of the mutating commands served since the last save.
+// Every record is argc (u32) followed by argc length-prefixed (u32) strings, the first
+// one being the command name; integers are little-endian.
+
+// A shard buffer is written out as soon as it grows past this size
+#define AOF_BUFFER_FLUSH_SIZE (64 * 1024)
+
+// Lists and sorted sets are rewritten as commands of at most this many items
+#define AOF_REWRITE_ITEMS_PER_COMMAND 64
+
+// The log moved aside while a forked child captures the dataset
+#define AOF_ROTATED_SUFFIX ".prev"
+// Where the child writes the rewritten log
+#define AOF_REWRITE_SUFFIX ".rewrite"
+
+// Longest argument a record may hold, anything longer is treated as a torn write
+#define AOF_MAX_ARG_LENGTH (512 * 1024 * 1024)
+
+// Pending records of one shard, only touched by the thread holding that shard
+typedef struct DBAofBuffer
+{
+  char *data;
+  size_t length;
+  size_t capacity;
+} DBAofBuffer;
+
+typedef struct DBAof
+{
+  char *filepath;
+  int fd;
+  db_aof_fsync_t policy;
+  // Guards `fd` and `is_dirty`; shards write their buffers under it
+  mtx_t lock;
+  cnd_t stop_cond;
+  db_bool_t is_dirty;
+  db_bool_t is_closing;
+  thrd_t fsync_thread;
+  db_bool_t has_fsync_thread;
+} DBAof;
+
+// Receives every replayed command; the request is freed after the call
+typedef void (*aof_command_handler_t)(DBRequest *request, void *context);
+
+// Opens the log for appending, creating it if needed; returns NULL if it can't be opened
+DBAof *aof_open(const char *filepath, db_aof_fsync_t policy);
+
+// Flushes the log to disk and closes it
+void aof_close(DBAof *aof);
+
+// Starts a record of `argc` arguments, which must be appended right after
+void aof_buffer_begin(DBAofBuffer *buffer, db_uint_t argc);
+
+void aof_buffer_append_arg(DBAofBuffer *buffer, const char *arg);
+
+// Appends an argument of `length` bytes, which need no NUL
+void aof_buffer_append_bytes(DBAofBuffer *buffer, const char *arg, size_t length);
+
+// Appends a whole request; numeric arguments are written back as strings
+void aof_buffer_append_request(DBAofBuffer *buffer, const char *name, DBList *args);
+
+void aof_buffer_free(DBAofBuffer *buffer);
+
+// Writes the buffer to a file descriptor and empties it; returns false on a write error
+db_bool_t aof_buffer_write_fd(DBAofBuffer *buffer, int fd);
+
+// Writes a shard buffer to the log, applying the fsync policy
+db_bool_t aof_write(DBAof *aof, DBAofBuffer *buffer);
+
+// Empties the log, called once a save has captured everything in it
+void aof_truncate(DBAof *aof);
+
+// Moves the current log to `rotated_filepath` and continues with an empty one
+db_bool_t aof_rotate(DBAof *aof, const char *rotated_filepath);
+
+// Appends the current log to `head_filepath`, then puts the result in place of the log
+db_bool_t aof_absorb(DBAof *aof, const char *head_filepath);
+
+// Replays every complete record of a log; a torn record at the end is cut off.
+// Returns false if the file doesn't exist
+db_bool_t aof_load(const char *filepath, aof_command_handler_t handler, void *context);
+
+// Replays the records read from `fd`, a socket, until it is closed or a read fails; `offset` is
+// advanced by the bytes of each record once the handler has returned
+void aof_replay_fd(int fd, aof_command_handler_t handler, void *context, _Atomic uint64_t *offset);
+
+#endif
@@ -8,9 +8,10 @@
 #include "interaction.h"
 #include "list.h"
 #include "core.h"
+#include "net.h"
 #include "api.h"
 
-// Parses command string into DBRequest structure
+// Parses command string into DBRequest structure in a single pass over it
 static DBRequest *parse_command(const char *command);
 
 static db_bool_t reply_is_error(const DBReply *reply);
@@ -30,6 +31,13 @@ void server_config_hash_seed(db_uint_t hash_seed)
   core_unlock();
 }
 
+void server_config_shard_count(db_uint_t shard_count)
+{
+  core_lock();
+  db_config_shard_count(shard_count);
+  core_unlock();
+}
+
 void server_config_persistence_filepath(const char *persistence_filepath)
 {
   core_lock();
@@ -37,6 +45,130 @@ void server_config_persistence_filepath(const char *persistence_filepath)
   core_unlock();
 }
 
+void server_config_persistence_format(db_persistence_format_t persistence_format)
+{
+  core_lock();
+  db_config_persistence_format(persistence_format);
+  core_unlock();
+}
+
+void server_config_aof_enabled(db_bool_t aof_enabled)
+{
+  core_lock();
+  db_config_aof_enabled(aof_enabled);
+  core_unlock();
+}
+
+void server_config_aof_filepath(const char *aof_filepath)
+{
+  core_lock();
+  db_config_aof_filepath(aof_filepath);
+  core_unlock();
+}
+
+void server_config_aof_fsync(db_aof_fsync_t aof_fsync)
+{
+  core_lock();
+  db_config_aof_fsync(aof_fsync);
+  core_unlock();
+}
+
+void server_config_queue_capacity(db_uint_t queue_capacity)
+{
+  core_lock();
+  db_config_queue_capacity(queue_capacity);
+  core_unlock();
+}
+
+void server_config_queue_policy(db_queue_policy_t queue_policy)
+{
+  core_lock();
+  db_config_queue_policy(queue_policy);
+  core_unlock();
+}
+
+void server_config_list_block_size(db_uint_t block_size)
+{
+  core_lock();
+  db_config_list_block_size(block_size);
+  core_unlock();
+}
+
+void server_config_zset_packed(db_uint_t max_members, db_uint_t max_length)
+{
+  core_lock();
+  db_config_zset_packed(max_members, max_length);
+  core_unlock();
+}
+
+void server_config_hash_packed(db_uint_t max_fields, db_uint_t max_length)
+{
+  core_lock();
+  db_config_hash_packed(max_fields, max_length);
+  core_unlock();
+}
+
+void server_config_key_index(db_bool_t enabled)
+{
+  core_lock();
+  db_config_key_index(enabled);
+  core_unlock();
+}
+
+void server_config_mapped_load(db_bool_t enabled)
+{
+  core_lock();
+  db_config_mapped_load(enabled);
+  core_unlock();
+}
+
+void server_config_worker_idle(db_uint_t busy_poll_us, db_bool_t pin_workers)
+{
+  core_lock();
+  db_config_worker_idle(busy_poll_us, pin_workers);
+  core_unlock();
+}
+
+void server_config_slowlog(db_int_t threshold_us, db_uint_t max_length)
+{
+  core_lock();
+  db_config_slowlog(threshold_us, max_length);
+  core_unlock();
+}
+
+void server_config_cluster_enabled(db_bool_t enabled)
+{
+  core_lock();
+  db_config_cluster_enabled(enabled);
+  core_unlock();
+}
+
+void server_config_concurrent_reads(db_bool_t enabled)
+{
+  core_lock();
+  db_config_concurrent_reads(enabled);
+  core_unlock();
+}
+
+void server_config_pages_mode(db_pages_mode_t mode)
+{
+  core_lock();
+  db_config_pages_mode(mode);
+  core_unlock();
+}
+
+void server_config_maxmemory(size_t maxmemory, db_maxmemory_policy_t policy)
+{
+  core_lock();
+  db_config_maxmemory(maxmemory, policy);
+  core_unlock();
+}
+
+void server_config_net_io_threads(db_uint_t io_thread_count)
+{
+  net_config_io_threads(io_thread_count);
+}
+
 void dbapi_start_server()
 {
   core_lock();
@@ -69,6 +201,17 @@ void dbapi_start_terminal_client()
   printf("Goodbye! The database has been shut down.\n");
 }
 
+db_bool_t dbapi_start_network_server(db_uint_t port)
+{
+  dbapi_start_server();
+  return net_serve(port);
+}
+
+void dbapi_stop_network_server()
+{
+  net_stop();
+}
+
 void dbapi_run_command(const char *command)
 {
   DBRequest *request = parse_command(command);
@@ -81,11 +224,7 @@ DBReply *dbapi_request_async(DBRequest *request)
   if (!request)
     return NULL;
 
-  core_lock();
-  DBReply *reply = db_handle_request(request);
-  core_unlock();
-
-  return reply;
+  return db_handle_request(request);
 };
 
 DBReply *dbapi_request_sync(DBRequest *request)
@@ -95,115 +234,56 @@ DBReply *dbapi_request_sync(DBRequest *request)
 
 DBReply *dbapi_await_reply(DBReply *reply)
 {
-  if (!reply)
+  return reply_wait(reply);
+};
+
+DBPipeline *dbapi_pipeline_async(DBPipeline *pipeline)
+{
+  if (!pipeline)
     return NULL;
 
-  while (true)
-  {
-    core_lock();
-    if (reply->done)
-    {
-      core_unlock();
-      break;
-    }
-    core_unlock();
-  }
+  db_handle_pipeline(pipeline);
+  return pipeline;
+}
 
-  return reply;
-};
+DBPipeline *dbapi_pipeline_sync(DBPipeline *pipeline)
+{
+  return dbapi_await_pipeline(dbapi_pipeline_async(pipeline));
+}
+
+DBPipeline *dbapi_await_pipeline(DBPipeline *pipeline)
+{
+  if (!pipeline)
+    return NULL;
+
+  // Each shard serves its part of the pipeline in order, so waiting from the back
+  // parks at most once per shard.
+  for (db_uint_t i = pipeline->length; i-- > 0;)
+    reply_wait(pipeline->replies[i]);
+  return pipeline;
+}
 
 static DBRequest *parse_command(const char *command)
 {
   if (!command)
     return NULL;
 
-  DBRequest *request = (DBRequest *)calloc(1, sizeof(DBRequest));
-  if (!request)
-    EXIT_ON_MEMORY_ERROR();
-
-  // Duplicate command for tokenization
-  char *command_copy = dbutil_strdup(command);
-  if (!command_copy)
-    EXIT_ON_MEMORY_ERROR();
-
-  char *token = strtok(command_copy, " ");
-
-  // Parse action string into db_action_t
-  to_uppercase(token);
-  if (!token)
-    request->action = DB_UNKNOWN_COMMAND;
-  if (strcmp(token, "SAVE") == 0)
-    request->action = DB_SAVE;
-  else if (strcmp(token, "START") == 0)
-    request->action = DB_START;
-  else if (strcmp(token, "SET") == 0)
-    request->action = DB_SET;
-  else if (strcmp(token, "GET") == 0)
-    request->action = DB_GET;
-  else if (strcmp(token, "RENAME") == 0)
-    request->action = DB_RENAME;
-  else if (strcmp(token, "DEL") == 0)
-    request->action = DB_DEL;
-  else if (strcmp(token, "LPUSH") == 0)
-    request->action = DB_LPUSH;
-  else if (strcmp(token, "LPOP") == 0)
-    request->action = DB_LPOP;
-  else if (strcmp(token, "RPUSH") == 0)
-    request->action = DB_RPUSH;
-  else if (strcmp(token, "RPOP") == 0)
-    request->action = DB_RPOP;
-  else if (strcmp(token, "LLEN") == 0)
-    request->action = DB_LLEN;
-  else if (strcmp(token, "LRANGE") == 0)
-    request->action = DB_LRANGE;
-  else if (strcmp(token, "HGET") == 0)
-    request->action = DB_HGET;
-  else if (strcmp(token, "HSET") == 0)
-    request->action = DB_HSET;
-  else if (strcmp(token, "HDEL") == 0)
-    request->action = DB_HDEL;
-  else if (strcmp(token, "EXPIRE") == 0)
-    request->action = DB_EXPIRE;
-  else if (strcmp(token, "ZSCORE") == 0)
-    request->action = DB_ZSCORE;
-  else if (strcmp(token, "ZADD") == 0)
-    request->action = DB_ZADD;
-  else if (strcmp(token, "ZCARD") == 0)
-    request->action = DB_ZCARD;
-  else if (strcmp(token, "ZCOUNT") == 0)
-    request->action = DB_ZCOUNT;
-  else if (strcmp(token, "ZINTERSTORE") == 0)
-    request->action = DB_ZINTERSTORE;
-  else if (strcmp(token, "ZUNIONSTORE") == 0)
-    request->action = DB_ZUNIONSTORE;
-  else if (strcmp(token, "ZRANGE") == 0)
-    request->action = DB_ZRANGE;
-  else if (strcmp(token, "ZRANGEBYSCORE") == 0)
-    request->action = DB_ZRANGEBYSCORE;
-  else if (strcmp(token, "ZRANK") == 0)
-    request->action = DB_ZRANK;
-  else if (strcmp(token, "ZREM") == 0)
-    request->action = DB_ZREM;
-  else if (strcmp(token, "ZREMRANGEBYSCORE") == 0)
-    request->action = DB_ZREMRANGEBYSCORE;
-  else if (strcmp(token, "KEYS") == 0)
-    request->action = DB_KEYS;
-  else if (strcmp(token, "FLUSHALL") == 0)
-    request->action = DB_FLUSHALL;
-  else if (strcmp(token, "INFO_DATASET_MEMORY") == 0)
-    request->action = DB_INFO_DATASET_MEMORY;
-  else if (strcmp(token, "SHUTDOWN") == 0)
-    request->action = DB_SHUTDOWN;
-  else
-    request->action = DB_UNKNOWN_COMMAND;
+  const char *pos = command;
+  const char *start;
+  size_t escapes;
 
-  // Move past action in original command string
-  const char *pos = command + strlen(token);
+  // The command name is looked up where it stands, in whatever case it was typed.
+  while (isspace((unsigned char)*pos))
+    ++pos;
+  start = pos;
+  while (*pos != '\0' && !isspace((unsigned char)*pos))
+    ++pos;
+  DBRequest *request = create_request(db_action_from_slice(start, pos - start));
 
-  while (*pos != '\0')
+  while (true)
   {
     // Skip extra whitespace
-    while (isspace(*pos))
+    while (isspace((unsigned char)*pos))
       ++pos;
 
     if (*pos == '\0')
@@ -211,72 +291,53 @@ static DBRequest *parse_command(const char *command)
 
     if (*pos == '"')
     {
-      // Parse quoted string
-      ++pos;
-      const char *start = pos;
-      size_t length = 0;
-      char *string_value = NULL;
-
-      // Continue until end of string or until reaching an unescaped quote
-      while (*pos != '\0' && (*pos != '"' || (*(pos - 1) == '\\' && pos != start)))
+      // Parse quoted string, in which \" stands for a quote
+      start = ++pos;
+      escapes = 0;
+      while (*pos != '\0' && *pos != '"')
       {
-        // Handle escape
         if (*pos == '\\' && *(pos + 1) == '"')
-          ++pos;
+          ++pos, ++escapes;
         ++pos;
-        ++length;
       }
 
-      if (*pos == '"')
+      // An unterminated string is dropped
+      if (*pos != '"')
+        break;
+
+      if (!escapes)
+      {
+        add_request_arg(request, dbobj_create_string_from_bytes(start, pos - start));
+      }
+      else
       {
-        string_value = (char *)malloc(length + 1);
+        char *string_value = (char *)malloc(pos - start - escapes + 1);
         if (!string_value)
           EXIT_ON_MEMORY_ERROR();
 
         // Remove escape sequences
         size_t i = 0;
-        const char *src = start;
-        while (src < pos)
+        for (const char *src = start; src < pos; ++src)
         {
           if (*src == '\\' && *(src + 1) == '"')
-          {
-            string_value[i++] = '"';
-            src += 2;
-          }
-          else
-          {
-            string_value[i++] = *src++;
-          }
+            ++src;
+          string_value[i++] = *src;
         }
         string_value[i] = '\0';
-        ++pos;
-
-        add_request_arg(request, dbobj_create_string_with_dup(string_value));
-        free(string_value);
+        add_request_arg(request, dbobj_create_string(string_value));
       }
+      ++pos;
     }
     else
     {
-      // Parse signed or unsigned integer, or treat as a string
-      char *endptr = NULL;
-      const char *start = pos;
-      while (*pos != '\0' && !isspace(*pos))
+      // Numbers are recognised as the argument is stored, see DB_ENCODING_INT
+      start = pos;
+      while (*pos != '\0' && !isspace((unsigned char)*pos))
         ++pos;
-      size_t length = pos - start;
-
-      char *string_value = (char *)malloc(length + 1);
-      if (!string_value)
-        EXIT_ON_MEMORY_ERROR();
-
-      strncpy(string_value, start, length);
-      string_value[length] = '\0';
-
-      add_request_arg(request, dbobj_create_string_with_dup(string_value));
-      free(string_value);
+      add_request_arg(request, dbobj_create_string_from_bytes(start, pos - start));
     }
   }
 
-  free(command_copy);
   return request;
 }
 
@@ -291,13 +352,13 @@ char *dbapi_get(const char *key)
   add_request_arg(request, dbobj_create_string_with_dup(key));
   DBReply *reply = dbapi_request_sync(request);
   free_request(request);
-  if (reply_is_error(reply))
+  if (reply_is_error(reply) || !dbobj_is_string(reply->data))
   {
     free_reply(reply);
     return NULL;
   }
-  char *result = reply->data->value.string;
-  reply->data->value.string = NULL;
+  char *result = dbobj_extract_string(reply->data);
+  reply->data = NULL;
   free_reply(reply);
   return result;
 }
@@ -319,6 +380,59 @@ db_bool_t dbapi_set(const char *key, const char *value)
   return result;
 }
 
+DBList *dbapi_mget(const char *key, ...)
+{
+  DBRequest *request = create_request(DB_MGET);
+  va_list args;
+  va_start(args, key);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  while (true)
+  {
+    const char *next = va_arg(args, const char *);
+    if (next == NULL)
+      break;
+    add_request_arg(request, dbobj_create_string_with_dup(next));
+  }
+  va_end(args);
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  if (reply_is_error(reply) || !dbobj_is_list(reply->data))
+  {
+    free_reply(reply);
+    return NULL;
+  }
+  DBList *result = reply->data->value.list;
+  reply->data->value.list = NULL;
+  free_reply(reply);
+  return result;
+}
+
+db_bool_t dbapi_mset(const char *key, ...)
+{
+  DBRequest *request = create_request(DB_MSET);
+  va_list args;
+  va_start(args, key);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  while (true)
+  {
+    const char *next = va_arg(args, const char *);
+    if (next == NULL)
+      break;
+    add_request_arg(request, dbobj_create_string_with_dup(next));
+  }
+  va_end(args);
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  if (reply_is_error(reply))
+  {
+    free_reply(reply);
+    return false;
+  }
+  db_bool_t result = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, OK) == 0;
+  free_reply(reply);
+  return result;
+}
+
 db_uint_t dbapi_del(const char *key)
 {
   DBRequest *request = create_request(DB_DEL);
@@ -406,8 +520,8 @@ char *dbapi_lpop(const char *key)
     free_reply(reply);
     return NULL;
   }
-  char *result = reply->data->value.string;
-  reply->data->value.string = NULL;
+  char *result = dbobj_extract_string(reply->data);
+  reply->data = NULL;
   free_reply(reply);
   return result;
 }
@@ -466,12 +580,84 @@ char *dbapi_rpop(const char *key)
     free_reply(reply);
     return NULL;
   }
-  char *result = reply->data->value.string;
-  reply->data->value.string = NULL;
+  char *result = dbobj_extract_string(reply->data);
+  reply->data = NULL;
+  free_reply(reply);
+  return result;
+}
+
+// Pops up to `count` elements with LPOP or RPOP; the command replies with the element itself when
+// it pops one, which is wrapped in a list here
+static char *dbapi_blocking_pop(db_action_t action, const char *key, db_double_t timeout)
+{
+  DBRequest *request = create_request(action);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  add_request_arg(request, dbobj_create_double(timeout));
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  if (reply_is_error(reply) || !dbobj_is_list(reply->data) || !reply->data->value.list->tail)
+  {
+    free_reply(reply);
+    return NULL;
+  }
+  // The reply is the key and the element.
+  char *result = dbobj_extract_string(reply->data->value.list->tail->data);
+  reply->data->value.list->tail->data = NULL;
+  free_reply(reply);
+  return result;
+}
+
+char *dbapi_blpop(const char *key, db_double_t timeout)
+{
+  return dbapi_blocking_pop(DB_BLPOP, key, timeout);
+}
+
+char *dbapi_brpop(const char *key, db_double_t timeout)
+{
+  return dbapi_blocking_pop(DB_BRPOP, key, timeout);
+}
+
+static DBList *dbapi_pop_n(db_action_t action, const char *key, db_uint_t count)
+{
+  DBRequest *request = create_request(action);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  add_request_arg(request, dbobj_create_uint(count));
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  if (reply_is_error(reply))
+  {
+    free_reply(reply);
+    return NULL;
+  }
+  DBList *result;
+  if (dbobj_is_list(reply->data))
+  {
+    result = reply->data->value.list;
+    reply->data->value.list = NULL;
+  }
+  else
+  {
+    result = create_dblist();
+    if (dbobj_is_string(reply->data))
+    {
+      rpush(result, create_dblistnode(reply->data));
+      reply->data = NULL;
+    }
+  }
   free_reply(reply);
   return result;
 }
 
+DBList *dbapi_lpop_n(const char *key, db_uint_t count)
+{
+  return dbapi_pop_n(DB_LPOP, key, count);
+}
+
+DBList *dbapi_rpop_n(const char *key, db_uint_t count)
+{
+  return dbapi_pop_n(DB_RPOP, key, count);
+}
+
 db_uint_t dbapi_llen(const char *key)
 {
   DBRequest *request = create_request(DB_LLEN);
@@ -517,8 +703,9 @@ DBList *dbapi_keys()
     free_reply(reply);
     return NULL;
   }
-  DBList *result = reply->data->value.list;
-  reply->data->value.list = NULL;
+  // The keys are in the arena of the reply, and copied out of it.
+  DBList *result = dbobj_extract_list(reply->data);
+  reply->data = NULL;
   free_reply(reply);
   return result;
 }
@@ -550,6 +737,61 @@ db_bool_t dbapi_save()
   return result;
 }
 
+db_bool_t dbapi_bgsave()
+{
+  DBRequest *request = create_request(DB_BGSAVE);
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  db_bool_t result = !reply_is_error(reply);
+  free_reply(reply);
+  return result;
+}
+
+db_bool_t dbapi_bgrewriteaof()
+{
+  DBRequest *request = create_request(DB_BGREWRITEAOF);
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  db_bool_t result = !reply_is_error(reply);
+  free_reply(reply);
+  return result;
+}
+
+db_uint_t dbapi_lastsave()
+{
+  DBRequest *request = create_request(DB_LASTSAVE);
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  db_uint_t result = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  free_reply(reply);
+  return result;
+}
+
+db_uint_t dbapi_memory_usage(const char *key)
+{
+  DBRequest *request = create_request(DB_MEMORY_USAGE);
+  add_request_arg(request, dbobj_create_string_with_dup(key));
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  db_uint_t result = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  free_reply(reply);
+  return result;
+}
+
+db_bool_t dbapi_replicaof(const char *host, db_uint_t port)
+{
+  char port_string[24];
+  DBRequest *request = create_request(DB_REPLICAOF);
+  sprintf(port_string, "%llu", (unsigned long long)port);
+  add_request_arg(request, dbobj_create_string_with_dup(host ? host : "NO"));
+  add_request_arg(request, dbobj_create_string_with_dup(host ? port_string : "ONE"));
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  db_bool_t result = !reply_is_error(reply);
+  free_reply(reply);
+  return result;
+}
+
 db_bool_t dbapi_flushall()
 {
   DBRequest *request = create_request(DB_FLUSHALL);
@@ -5,18 +5,51 @@
 
 db_bool_t server_is_running();
 void server_config_hash_seed(db_uint_t hash_seed);
+void server_config_shard_count(db_uint_t shard_count);
 void server_config_persistence_filepath(const char *persistence_filepath);
+void server_config_persistence_format(db_persistence_format_t persistence_format);
+void server_config_aof_enabled(db_bool_t aof_enabled);
+void server_config_aof_filepath(const char *aof_filepath);
+void server_config_aof_fsync(db_aof_fsync_t aof_fsync);
+void server_config_queue_capacity(db_uint_t queue_capacity);
+void server_config_queue_policy(db_queue_policy_t queue_policy);
+void server_config_list_block_size(db_uint_t block_size);
+void server_config_zset_packed(db_uint_t max_members, db_uint_t max_length);
+void server_config_hash_packed(db_uint_t max_fields, db_uint_t max_length);
+void server_config_key_index(db_bool_t enabled);
+void server_config_mapped_load(db_bool_t enabled);
+void server_config_worker_idle(db_uint_t busy_poll_us, db_bool_t pin_workers);
+void server_config_slowlog(db_int_t threshold_us, db_uint_t max_length);
+void server_config_cluster_enabled(db_bool_t enabled);
+void server_config_concurrent_reads(db_bool_t enabled);
+void server_config_maxmemory(size_t maxmemory, db_maxmemory_policy_t policy);
+void server_config_pages_mode(db_pages_mode_t mode);
+void server_config_net_io_threads(db_uint_t io_thread_count);
 
 void dbapi_start_server();
 void dbapi_start_terminal_client();
 void dbapi_run_command(const char *command);
+// Serves RESP clients on a TCP port until the database shuts down or dbapi_stop_network_server is
+// called, see net.h; returns false if the port can't be listened on
+db_bool_t dbapi_start_network_server(db_uint_t port);
+void dbapi_stop_network_server();
 
 DBReply *dbapi_request_async(DBRequest *request);
 DBReply *dbapi_request_sync(DBRequest *request);
 DBReply *dbapi_await_reply(DBReply *reply);
 
+// Submits every request of the pipeline at once; the replies are filled in as the core serves them
+DBPipeline *dbapi_pipeline_async(DBPipeline *pipeline);
+DBPipeline *dbapi_pipeline_sync(DBPipeline *pipeline);
+// Blocks until every reply of a submitted pipeline is done
+DBPipeline *dbapi_await_pipeline(DBPipeline *pipeline);
+
 char *dbapi_get(const char *key);
 db_bool_t dbapi_set(const char *key, const char *value);
+// Each takes the keys, or keys and values in turn, ending with NULL; MGET replies with a null
+// object where a key holds no string
+DBList *dbapi_mget(const char *key, ...);
+db_bool_t dbapi_mset(const char *key, ...);
 db_uint_t dbapi_del(const char *key);
 db_bool_t dbapi_rename(const char *old_key, const char *new_key);
 db_uint_t dbapi_lpush(const char *key, const char *value);
@@ -25,12 +58,29 @@ char *dbapi_lpop(const char *key);
 db_uint_t dbapi_rpush(const char *key, const char *value);
 db_uint_t dbapi_rpush_n(const char *key, ...);
 char *dbapi_rpop(const char *key);
+// Pops up to `count` elements in one request; the list is empty if the key holds none
+DBList *dbapi_lpop_n(const char *key, db_uint_t count);
+DBList *dbapi_rpop_n(const char *key, db_uint_t count);
+// Pops an element, waiting up to `timeout` seconds, 0 for ever, for one to be pushed; NULL if none was
+char *dbapi_blpop(const char *key, db_double_t timeout);
+char *dbapi_brpop(const char *key, db_double_t timeout);
 db_uint_t dbapi_llen(const char *key);
 DBList *dbapi_lrange(const char *key, db_uint_t start, db_uint_t end);
 DBList *dbapi_keys();
 db_bool_t dbapi_shutdown();
 db_bool_t dbapi_save();
+// Starts saving in a forked child; returns false if a background save is already running
+db_bool_t dbapi_bgsave();
+// Starts rewriting the append-only log in a forked child; returns false if it is disabled or a child is running
+db_bool_t dbapi_bgrewriteaof();
+// Returns the unix time of the last successful save, 0 if there is none
+db_uint_t dbapi_lastsave();
+// Returns the bytes allocated for a key and its value, 0 if it doesn't exist
+db_uint_t dbapi_memory_usage(const char *key);
 db_bool_t dbapi_flushall();
+// Replicates the primary at `host`:`port`, or with a NULL host stops replicating; returns false
+// if the arguments are refused
+db_bool_t dbapi_replicaof(const char *host, db_uint_t port);
 
 void dbapi_free(char *s);
 void dbapi_free_list(DBList *list);
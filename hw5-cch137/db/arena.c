@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#include "utils.h"
+#include "arena.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define ARENA_USE_MALLOC 1
+#endif
+
+static DBArenaChunk *arena_add_chunk(DBArena *arena, size_t size)
+{
+  DBArenaChunk *chunk = (DBArenaChunk *)malloc(sizeof(DBArenaChunk) + size);
+  if (!chunk)
+    EXIT_ON_MEMORY_ERROR();
+  chunk->next = arena->chunks;
+  chunk->size = size;
+  chunk->used = 0;
+  arena->chunks = chunk;
+  arena->memory += dbutil_alloc_size(chunk);
+  return chunk;
+}
+
+DBArena *arena_create()
+{
+  DBArena *arena = (DBArena *)malloc(sizeof(DBArena));
+  if (!arena)
+    EXIT_ON_MEMORY_ERROR();
+  arena->chunks = NULL;
+  arena->memory = dbutil_alloc_size(arena);
+  return arena;
+}
+
+void *arena_alloc(DBArena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  DBArenaChunk *chunk = arena->chunks;
+
+#ifdef ARENA_USE_MALLOC
+  chunk = arena_add_chunk(arena, size);
+#else
+  if (!chunk || chunk->size - chunk->used < size)
+  {
+    size_t chunk_size = chunk ? chunk->size * 2 : ARENA_CHUNK_SIZE;
+    if (chunk_size > ARENA_CHUNK_MAX_SIZE)
+      chunk_size = ARENA_CHUNK_MAX_SIZE;
+    // A block larger than a chunk gets one of its own.
+    chunk = arena_add_chunk(arena, size > chunk_size ? size : chunk_size);
+  }
+#endif
+
+  void *block = chunk->data + chunk->used;
+  chunk->used += size;
+  return block;
+}
+
+void arena_free(DBArena *arena)
+{
+  if (!arena)
+    return;
+  DBArenaChunk *next;
+  for (DBArenaChunk *chunk = arena->chunks; chunk; chunk = next)
+  {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(arena);
+}
@@ -0,0 +1,47 @@
+#ifndef DB_ARENA_H
+#define DB_ARENA_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+// Bump allocator for the objects of one reply. A command that answers with many values, ZRANGE
+// WITHSCORES or KEYS, takes its objects, list and nodes from the arena of its reply, see
+// reply_arena, instead of one slab slot each; they are never freed on their own but all at once,
+// chunk by chunk, with the reply. free_dbobj leaves an object of an arena alone, so code that
+// frees replies the usual way needs no change.
+//
+// Sanitizer builds give every block a chunk of its own, so overruns stay detectable.
+
+// Bytes of the first chunk; each one after it is twice the size of the last, up to the maximum
+#define ARENA_CHUNK_SIZE 1024
+#define ARENA_CHUNK_MAX_SIZE (64 * 1024)
+// Alignment of every block, enough for any value of the database
+#define ARENA_ALIGNMENT 16
+
+typedef struct DBArenaChunk
+{
+  struct DBArenaChunk *next;
+  size_t size;
+  size_t used;
+  _Alignas(ARENA_ALIGNMENT) char data[];
+} DBArenaChunk;
+
+typedef struct DBArena
+{
+  // Chunk being carved, the newest; the older ones follow it
+  DBArenaChunk *chunks;
+  // Bytes taken from malloc for the chunks
+  size_t memory;
+} DBArena;
+
+DBArena *arena_create();
+
+// Allocates `size` bytes aligned to ARENA_ALIGNMENT, which live until the arena is freed; exits
+// if out of memory
+void *arena_alloc(DBArena *arena, size_t size);
+
+// Frees the arena and every block allocated from it
+void arena_free(DBArena *arena);
+
+#endif
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "interaction.h"
+#include "blocking.h"
+
+static _Atomic db_uint_t clients = 0;
+
+DBBlockingTable *blocking_create()
+{
+  DBBlockingTable *table = (DBBlockingTable *)calloc(1, sizeof(DBBlockingTable));
+  if (!table)
+    EXIT_ON_MEMORY_ERROR();
+  table->size = BLOCKING_INITIAL_SIZE;
+  table->buckets = (DBBlockingKey **)calloc(table->size, sizeof(DBBlockingKey *));
+  if (!table->buckets)
+    EXIT_ON_MEMORY_ERROR();
+  return table;
+}
+
+DBBlockedPop *blocking_pop_create(DBReply *reply, db_bool_t is_left, uint64_t deadline_ms)
+{
+  DBBlockedPop *pop = (DBBlockedPop *)malloc(sizeof(DBBlockedPop));
+  if (!pop)
+    EXIT_ON_MEMORY_ERROR();
+  pop->reply = reply;
+  pop->is_left = is_left;
+  pop->deadline_ms = deadline_ms;
+  atomic_init(&pop->is_claimed, false);
+  atomic_init(&pop->refcount, 0);
+  atomic_fetch_add(&clients, 1);
+  return pop;
+}
+
+db_bool_t blocking_claim(DBBlockedPop *pop)
+{
+  db_bool_t expected = false;
+  if (!atomic_compare_exchange_strong(&pop->is_claimed, &expected, true))
+    return false;
+  atomic_fetch_sub(&clients, 1);
+  return true;
+}
+
+// Drops one registration of the pop, freeing it with the last
+static void blocking_release(DBBlockedPop *pop)
+{
+  if (atomic_fetch_sub(&pop->refcount, 1) == 1)
+    free(pop);
+}
+
+static DBBlockingKey *blocking_find(DBBlockingTable *table, const DBKey *key)
+{
+  DBBlockingKey *curr = table->buckets[key->hash & (table->size - 1)];
+  while (curr && (curr->hash != key->hash || strcmp(curr->key, key->string) != 0))
+    curr = curr->next;
+  return curr;
+}
+
+static void blocking_grow(DBBlockingTable *table)
+{
+  db_uint_t size = table->size * 2;
+  DBBlockingKey **buckets = (DBBlockingKey **)calloc(size, sizeof(DBBlockingKey *));
+  if (!buckets)
+    EXIT_ON_MEMORY_ERROR();
+  for (db_uint_t i = 0; i < table->size; ++i)
+  {
+    DBBlockingKey *curr = table->buckets[i], *next;
+    for (; curr; curr = next)
+    {
+      next = curr->next;
+      curr->next = buckets[curr->hash & (size - 1)];
+      buckets[curr->hash & (size - 1)] = curr;
+    }
+  }
+  free(table->buckets);
+  table->buckets = buckets;
+  table->size = size;
+}
+
+// Unhooks a key nobody waits on any more; it must not be on the ready chain
+static void blocking_remove(DBBlockingTable *table, DBBlockingKey *blocking_key)
+{
+  DBBlockingKey **link = &table->buckets[blocking_key->hash & (table->size - 1)];
+  while (*link != blocking_key)
+    link = &(*link)->next;
+  *link = blocking_key->next;
+  --table->count;
+  free(blocking_key->key);
+  free(blocking_key);
+}
+
+void blocking_add(DBBlockingTable *table, const DBKey *key, DBBlockedPop *pop)
+{
+  DBBlockingKey *blocking_key = blocking_find(table, key);
+  if (!blocking_key)
+  {
+    if (table->count >= table->size)
+      blocking_grow(table);
+    blocking_key = (DBBlockingKey *)calloc(1, sizeof(DBBlockingKey));
+    if (!blocking_key)
+      EXIT_ON_MEMORY_ERROR();
+    blocking_key->key = dbutil_strdup(key->string);
+    blocking_key->hash = key->hash;
+    blocking_key->next = table->buckets[key->hash & (table->size - 1)];
+    table->buckets[key->hash & (table->size - 1)] = blocking_key;
+    ++table->count;
+  }
+
+  DBBlockingWaiter *waiter = (DBBlockingWaiter *)malloc(sizeof(DBBlockingWaiter));
+  if (!waiter)
+    EXIT_ON_MEMORY_ERROR();
+  waiter->pop = pop;
+  waiter->next = NULL;
+  if (blocking_key->tail)
+    blocking_key->tail->next = waiter;
+  else
+    blocking_key->head = waiter;
+  blocking_key->tail = waiter;
+  atomic_fetch_add(&pop->refcount, 1);
+  ++table->waiters;
+}
+
+void blocking_signal(DBBlockingTable *table, const DBKey *key)
+{
+  if (!table->waiters || !key->string)
+    return;
+  DBBlockingKey *blocking_key = blocking_find(table, key);
+  if (!blocking_key || blocking_key->is_ready)
+    return;
+  blocking_key->is_ready = true;
+  blocking_key->next_ready = table->ready;
+  table->ready = blocking_key;
+}
+
+// Drops the first waiter of a key
+static void blocking_shift(DBBlockingTable *table, DBBlockingKey *blocking_key)
+{
+  DBBlockingWaiter *waiter = blocking_key->head;
+  blocking_key->head = waiter->next;
+  if (!blocking_key->head)
+    blocking_key->tail = NULL;
+  blocking_release(waiter->pop);
+  free(waiter);
+  --table->waiters;
+}
+
+void blocking_serve(DBBlockingTable *table, blocking_serve_fn serve, void *context)
+{
+  while (table->ready)
+  {
+    DBBlockingKey *blocking_key = table->ready;
+    table->ready = blocking_key->next_ready;
+    blocking_key->is_ready = false;
+
+    while (blocking_key->head)
+    {
+      DBBlockedPop *pop = blocking_key->head->pop;
+      if (!atomic_load(&pop->is_claimed) && !serve(blocking_key->key, pop, context))
+        break;
+      blocking_shift(table, blocking_key);
+    }
+    if (!blocking_key->head)
+      blocking_remove(table, blocking_key);
+  }
+}
+
+void blocking_expire(DBBlockingTable *table, uint64_t now_ms)
+{
+  if (!table->waiters)
+    return;
+
+  for (db_uint_t i = 0; i < table->size; ++i)
+  {
+    DBBlockingKey *blocking_key = table->buckets[i], *next_key;
+    for (; blocking_key; blocking_key = next_key)
+    {
+      next_key = blocking_key->next;
+      DBBlockingWaiter **link = &blocking_key->head, *waiter;
+      blocking_key->tail = NULL;
+      while ((waiter = *link))
+      {
+        DBBlockedPop *pop = waiter->pop;
+        db_bool_t is_done = atomic_load(&pop->is_claimed);
+        // Unclaimed, the reply is still there to look at.
+        db_bool_t is_due = atomic_load(&pop->reply->is_cancelled) || (pop->deadline_ms && pop->deadline_ms <= now_ms);
+        if (!is_done && is_due && blocking_claim(pop))
+        {
+          reply_done(reply_data(pop->reply, dbobj_shared_null()));
+          is_done = true;
+        }
+        if (!is_done)
+        {
+          blocking_key->tail = waiter;
+          link = &waiter->next;
+          continue;
+        }
+        *link = waiter->next;
+        blocking_release(pop);
+        free(waiter);
+        --table->waiters;
+      }
+      // A ready key is unhooked by blocking_serve, which still has it chained.
+      if (!blocking_key->head && !blocking_key->is_ready)
+        blocking_remove(table, blocking_key);
+    }
+  }
+}
+
+void blocking_free(DBBlockingTable *table, const char *message)
+{
+  if (!table)
+    return;
+  for (db_uint_t i = 0; i < table->size; ++i)
+  {
+    DBBlockingKey *blocking_key = table->buckets[i], *next_key;
+    for (; blocking_key; blocking_key = next_key)
+    {
+      next_key = blocking_key->next;
+      while (blocking_key->head)
+      {
+        DBBlockedPop *pop = blocking_key->head->pop;
+        if (blocking_claim(pop))
+          reply_done(reply_error(pop->reply, message));
+        blocking_shift(table, blocking_key);
+      }
+      free(blocking_key->key);
+      free(blocking_key);
+    }
+  }
+  free(table->buckets);
+  free(table);
+}
+
+db_uint_t blocking_clients()
+{
+  return atomic_load(&clients);
+}
@@ -0,0 +1,90 @@
+#ifndef DB_BLOCKING_H
+#define DB_BLOCKING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Clients parked by BLPOP and BRPOP. Every shard keeps a table of its keys that have waiters, the
+// waiters of each key in the order they came. A push only marks its key ready; once the command
+// that pushed is done the shard hands elements to the waiters of its ready keys, so nobody spins
+// on the list. A client waiting on keys of several shards is registered with each of them and
+// served by whichever claims it first.
+
+#define BLOCKING_INITIAL_SIZE 16
+
+// One blocked BLPOP or BRPOP, shared by its registrations
+typedef struct DBBlockedPop
+{
+  DBReply *reply;
+  db_bool_t is_left;
+  // Clock of ht_clock_ms at which the client gives up, 0 to wait for ever
+  uint64_t deadline_ms;
+  // Set by the shard that answers the client; only the one that set it may touch `reply`
+  _Atomic db_bool_t is_claimed;
+  // Registrations not yet dropped
+  _Atomic db_uint_t refcount;
+} DBBlockedPop;
+
+typedef struct DBBlockingWaiter
+{
+  DBBlockedPop *pop;
+  struct DBBlockingWaiter *next;
+} DBBlockingWaiter;
+
+typedef struct DBBlockingKey
+{
+  char *key;
+  db_uint_t hash;
+  DBBlockingWaiter *head;
+  DBBlockingWaiter *tail;
+  struct DBBlockingKey *next;
+  // Pushed to since the shard last served it, and chained on `ready`
+  db_bool_t is_ready;
+  struct DBBlockingKey *next_ready;
+} DBBlockingKey;
+
+typedef struct DBBlockingTable
+{
+  DBBlockingKey **buckets;
+  db_uint_t size;
+  db_uint_t count;
+  DBBlockingKey *ready;
+  // Registrations in the table, claimed ones included until they are dropped
+  db_uint_t waiters;
+} DBBlockingTable;
+
+// Called for each waiter of a ready key in turn, with the shard of the key held. Returns false if
+// the list has nothing left for it, which leaves it waiting and ends the key; otherwise the waiter
+// is dropped, having been answered here or claimed elsewhere
+typedef db_bool_t (*blocking_serve_fn)(const char *key, DBBlockedPop *pop, void *context);
+
+DBBlockingTable *blocking_create();
+
+// Frees the table, answering every waiter it can still claim with `message`
+void blocking_free(DBBlockingTable *table, const char *message);
+
+// A blocked pop with no registrations yet, answered through `reply`
+DBBlockedPop *blocking_pop_create(DBReply *reply, db_bool_t is_left, uint64_t deadline_ms);
+
+// Registers the pop under a key, after the waiters already there
+void blocking_add(DBBlockingTable *table, const DBKey *key, DBBlockedPop *pop);
+
+// Marks a key ready if anyone waits on it
+void blocking_signal(DBBlockingTable *table, const DBKey *key);
+
+// Takes the pop for the caller; false if another shard already did
+db_bool_t blocking_claim(DBBlockedPop *pop);
+
+// Hands the ready keys to `serve`, see blocking_serve_fn
+void blocking_serve(DBBlockingTable *table, blocking_serve_fn serve, void *context);
+
+// Answers with a null the waiters whose deadline is at or before `now_ms` or whose client went
+// away, and drops those claimed elsewhere
+void blocking_expire(DBBlockingTable *table, uint64_t now_ms);
+
+// Clients blocked in every table and not answered yet
+db_uint_t blocking_clients();
+
+#endif
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "net.h"
+#include "cluster.h"
+
+typedef struct ClusterNode
+{
+  char *host;
+  db_uint_t port;
+} ClusterNode;
+
+static _Atomic db_bool_t is_enabled = false;
+
+// Slots hold indexes into `nodes`, which only grows, so a reader never sees a node go away.
+static ClusterNode nodes[CLUSTER_MAX_NODES];
+static _Atomic db_uint_t nodes_length = 1;
+static _Atomic uint16_t owners[CLUSTER_SLOTS];
+// The state of a slot in the high half, its peer in the low one, so both change together
+static _Atomic uint32_t peers[CLUSTER_SLOTS];
+
+static mtx_t nodes_lock;
+static once_flag init_once = ONCE_FLAG_INIT;
+static uint16_t crc16_table[256];
+
+static void cluster_init()
+{
+  mtx_init(&nodes_lock, mtx_plain);
+  // CRC-16/XMODEM, polynomial 0x1021, as Redis Cluster uses.
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint16_t crc = (uint16_t)(i << 8);
+    for (int bit = 0; bit < 8; ++bit)
+      crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    crc16_table[i] = crc;
+  }
+  for (db_uint_t slot = 0; slot < CLUSTER_SLOTS; ++slot)
+  {
+    atomic_init(&owners[slot], CLUSTER_NODE_NONE);
+    atomic_init(&peers[slot], CLUSTER_NODE_NONE);
+  }
+}
+
+void cluster_config_enabled(db_bool_t enabled)
+{
+  call_once(&init_once, cluster_init);
+  atomic_store(&is_enabled, enabled);
+}
+
+db_bool_t cluster_is_enabled()
+{
+  return atomic_load_explicit(&is_enabled, memory_order_relaxed);
+}
+
+uint16_t cluster_crc16(const char *data, size_t length)
+{
+  call_once(&init_once, cluster_init);
+  uint16_t crc = 0;
+  for (size_t i = 0; i < length; ++i)
+    crc = (uint16_t)((crc << 8) ^ crc16_table[((crc >> 8) ^ (unsigned char)data[i]) & 0xFF]);
+  return crc;
+}
+
+db_uint_t cluster_keyslot(const char *key)
+{
+  size_t length = strlen(key);
+  const char *open = memchr(key, '{', length);
+  const char *close = open ? memchr(open + 1, '}', length - (size_t)(open + 1 - key)) : NULL;
+
+  // An empty tag hashes the whole key, as Redis Cluster does.
+  if (close && close > open + 1)
+    return cluster_crc16(open + 1, (size_t)(close - open - 1)) & (CLUSTER_SLOTS - 1);
+  return cluster_crc16(key, length) & (CLUSTER_SLOTS - 1);
+}
+
+uint16_t cluster_node(const char *host, db_uint_t port)
+{
+  call_once(&init_once, cluster_init);
+  mtx_lock(&nodes_lock);
+  db_uint_t length = atomic_load(&nodes_length);
+  for (db_uint_t i = 1; i < length; ++i)
+    if (nodes[i].port == port && strcmp(nodes[i].host, host) == 0)
+    {
+      mtx_unlock(&nodes_lock);
+      return (uint16_t)i;
+    }
+  if (length == CLUSTER_MAX_NODES)
+  {
+    mtx_unlock(&nodes_lock);
+    return CLUSTER_NODE_NONE;
+  }
+  nodes[length].host = dbutil_strdup(host);
+  nodes[length].port = port;
+  atomic_store(&nodes_length, length + 1);
+  mtx_unlock(&nodes_lock);
+  return (uint16_t)length;
+}
+
+void cluster_node_address(uint16_t node, char *address, size_t size)
+{
+  if (node == CLUSTER_NODE_MYSELF || node >= atomic_load(&nodes_length))
+    snprintf(address, size, "myself");
+  else
+    snprintf(address, size, "%s:%llu", nodes[node].host, (unsigned long long)nodes[node].port);
+}
+
+uint16_t cluster_slot_owner(db_uint_t slot)
+{
+  call_once(&init_once, cluster_init);
+  return atomic_load(&owners[slot]);
+}
+
+void cluster_set_slot_owner(db_uint_t slot, uint16_t node)
+{
+  call_once(&init_once, cluster_init);
+  atomic_store(&owners[slot], node);
+}
+
+uint16_t cluster_slot_peer(db_uint_t slot, cluster_slot_state_t *state)
+{
+  call_once(&init_once, cluster_init);
+  uint32_t peer = atomic_load(&peers[slot]);
+  if (state)
+    *state = (cluster_slot_state_t)(peer >> 16);
+  return (uint16_t)peer;
+}
+
+void cluster_set_slot_state(db_uint_t slot, cluster_slot_state_t state, uint16_t peer)
+{
+  call_once(&init_once, cluster_init);
+  atomic_store(&peers[slot], state == CLUSTER_SLOT_STABLE ? CLUSTER_NODE_NONE : ((uint32_t)state << 16) | peer);
+}
+
+void cluster_reset()
+{
+  call_once(&init_once, cluster_init);
+  for (db_uint_t slot = 0; slot < CLUSTER_SLOTS; ++slot)
+  {
+    atomic_store(&owners[slot], CLUSTER_NODE_NONE);
+    atomic_store(&peers[slot], CLUSTER_NODE_NONE);
+  }
+}
+
+static uint32_t cluster_read_u32(const char *data)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// Appends one argument of a RESP command
+static void cluster_append_bulk(DBAofBuffer *out, const char *data, size_t length)
+{
+  char header[32];
+  int header_length = snprintf(header, sizeof(header), "$%zu\r\n", length);
+  size_t needed = out->length + (size_t)header_length + length + 2;
+  if (needed > out->capacity)
+  {
+    out->capacity = needed * 2;
+    out->data = (char *)realloc(out->data, out->capacity);
+    if (!out->data)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  memcpy(out->data + out->length, header, (size_t)header_length);
+  memcpy(out->data + out->length + header_length, data, length);
+  memcpy(out->data + out->length + header_length + length, "\r\n", 2);
+  out->length = needed;
+}
+
+// Appends the header of a RESP command of `argc` arguments
+static void cluster_append_command(DBAofBuffer *out, uint32_t argc)
+{
+  char header[32];
+  int header_length = snprintf(header, sizeof(header), "*%u\r\n", (unsigned)argc);
+  if (out->length + (size_t)header_length > out->capacity)
+  {
+    out->capacity = (out->length + (size_t)header_length) * 2;
+    out->data = (char *)realloc(out->data, out->capacity);
+    if (!out->data)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  memcpy(out->data + out->length, header, (size_t)header_length);
+  out->length += (size_t)header_length;
+}
+
+static void cluster_append_asking(DBAofBuffer *out)
+{
+  cluster_append_command(out, 1);
+  cluster_append_bulk(out, "ASKING", 6);
+}
+
+// Turns the records into RESP commands, each behind an ASKING; returns how many commands there are,
+// or 0 if a record is cut short
+static db_uint_t cluster_records_to_resp(const DBAofBuffer *records, DBAofBuffer *out)
+{
+  size_t position = 0;
+  db_uint_t commands = 0;
+
+  while (position < records->length)
+  {
+    if (records->length - position < 4)
+      return 0;
+    uint32_t argc = cluster_read_u32(records->data + position);
+    position += 4;
+    cluster_append_asking(out);
+    cluster_append_command(out, argc);
+    for (uint32_t i = 0; i < argc; ++i)
+    {
+      if (records->length - position < 4)
+        return 0;
+      uint32_t length = cluster_read_u32(records->data + position);
+      position += 4;
+      if (records->length - position < length)
+        return 0;
+      cluster_append_bulk(out, records->data + position, length);
+      position += length;
+    }
+    commands += 2;
+  }
+  return commands;
+}
+
+static db_bool_t cluster_send_all(int fd, const char *data, size_t length)
+{
+  while (length)
+  {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+// Reads `count` one-line replies; false on an error reply, a timeout or a closed connection
+static db_bool_t cluster_read_replies(int fd, db_uint_t count)
+{
+  char buffer[512];
+  db_bool_t is_line_start = true;
+
+  while (count)
+  {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    for (ssize_t i = 0; i < n && count; ++i)
+    {
+      if (is_line_start && buffer[i] == '-')
+        return false;
+      is_line_start = buffer[i] == '\n';
+      count -= is_line_start;
+    }
+  }
+  return true;
+}
+
+db_bool_t cluster_migrate(const char *host, db_uint_t port, const char *key, const DBAofBuffer *records, db_uint_t timeout_ms)
+{
+  DBAofBuffer out = {0};
+  struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+
+  cluster_append_asking(&out);
+  cluster_append_command(&out, 2);
+  cluster_append_bulk(&out, "DEL", 3);
+  cluster_append_bulk(&out, key, strlen(key));
+  db_uint_t commands = cluster_records_to_resp(records, &out);
+  if (!commands && records->length)
+  {
+    free(out.data);
+    return false;
+  }
+
+  int fd = net_connect(host, port);
+  db_bool_t is_success = fd >= 0;
+  if (is_success)
+  {
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    is_success = cluster_send_all(fd, out.data, out.length) && cluster_read_replies(fd, 2 + commands);
+    close(fd);
+  }
+  free(out.data);
+  return is_success;
+}
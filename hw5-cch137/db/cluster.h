@@ -0,0 +1,73 @@
+#ifndef DB_CLUSTER_H
+#define DB_CLUSTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "aof.h"
+
+// Cluster mode: the keyspace is cut into CLUSTER_SLOTS hash slots, a key going to the CRC16 of its
+// name, or of the part between the first `{` and the next `}` if that isn't empty, so related keys
+// can be put together; the same slots as Redis Cluster, so its clients route by them unchanged.
+// Every node serves the slots it owns and answers a command on any other slot with
+// "MOVED <slot> <host>:<port>" naming the owner it knows of. Nodes don't talk to each other about
+// who owns what; an operator, or a script, tells each of them with CLUSTER_ADDSLOTS and
+// CLUSTER_SETSLOT.
+// A slot is moved without downtime by marking it IMPORTING on the node it goes to and MIGRATING on
+// the one it leaves, then moving its keys one at a time with MIGRATE. Meanwhile the old owner still
+// serves the keys it has and sends clients asking for one it doesn't to the new owner with
+// "ASK <slot> <host>:<port>"; the new owner serves a key of a slot it imports only to a client that
+// said ASKING right before. Once the slot is empty both nodes are told it is owned by the new one.
+
+#define CLUSTER_SLOTS 16384
+// Nodes a node can know of, itself included
+#define CLUSTER_MAX_NODES 1024
+// This node, always known
+#define CLUSTER_NODE_MYSELF 0
+// Owner of a slot nobody was given, and the peer of a slot neither migrating nor importing
+#define CLUSTER_NODE_NONE 0xFFFF
+// How long MIGRATE waits on its target when not told otherwise
+#define CLUSTER_MIGRATE_DEFAULT_TIMEOUT_MS 1000
+
+typedef enum
+{
+  CLUSTER_SLOT_STABLE,
+  CLUSTER_SLOT_MIGRATING,
+  CLUSTER_SLOT_IMPORTING
+} cluster_slot_state_t;
+
+// Takes effect at once; a node starts out owning no slot, so it answers keyed commands with
+// DB_ERR_CLUSTERDOWN until it is given some
+void cluster_config_enabled(db_bool_t enabled);
+
+db_bool_t cluster_is_enabled();
+
+uint16_t cluster_crc16(const char *data, size_t length);
+
+// Slot of a key, see the top of this file
+db_uint_t cluster_keyslot(const char *key);
+
+// Index of the node at `host`:`port`, adding it if it is new; CLUSTER_NODE_NONE once
+// CLUSTER_MAX_NODES are known
+uint16_t cluster_node(const char *host, db_uint_t port);
+
+// Writes `host:port` of a node, or "myself", into `address` of `size` bytes
+void cluster_node_address(uint16_t node, char *address, size_t size);
+
+uint16_t cluster_slot_owner(db_uint_t slot);
+void cluster_set_slot_owner(db_uint_t slot, uint16_t node);
+
+// The node a slot is migrating to or importing from, CLUSTER_NODE_NONE if it is stable
+uint16_t cluster_slot_peer(db_uint_t slot, cluster_slot_state_t *state);
+void cluster_set_slot_state(db_uint_t slot, cluster_slot_state_t state, uint16_t peer);
+
+// Forgets the owner and state of every slot; the nodes stay known
+void cluster_reset();
+
+// Sends the commands of `records`, in the format of the append-only log, to the node at
+// `host`:`port`, each after an ASKING and the whole after a DEL of `key`, so the key is replaced;
+// returns whether every command was accepted within `timeout_ms`
+db_bool_t cluster_migrate(const char *host, db_uint_t port, const char *key, const DBAofBuffer *records, db_uint_t timeout_ms);
+
+#endif
@@ -3,46 +3,369 @@
 #include <malloc.h>
 #include <threads.h>
 #include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <ctype.h>
 
 #include "deps/cJSON.h"
 #include "utils.h"
 #include "list.h"
+#include "quicklist.h"
+#include "rope.h"
 #include "hash.h"
+#include "hashobj.h"
+#include "zset.h"
+#include "zaggregate.h"
 #include "interaction.h"
+#include "queue.h"
+#include "snapshot.h"
+#include "aof.h"
+#include "slab.h"
+#include "pages.h"
+#include "typedhash.h"
+#include "glob.h"
+#include "latency.h"
+#include "trace.h"
+#include "lazyfree.h"
+#include "blocking.h"
+#include "epoch.h"
+#include "repl.h"
+#include "cluster.h"
+#include "evict.h"
+#include "hotkeys.h"
+#include "transaction.h"
 #include "core.h"
 
-typedef struct DBTask
+// Keys of the mapped snapshot a shard still serves from it, each with where its record starts
+DB_TYPED_HASH(DBMappedIndex, mapped_index, const uint8_t *)
+
+// An independent slice of the keyspace, served by its own worker thread
+typedef struct DBShard
+{
+  db_uint_t index;
+  DBHash *main_ht;
+  DBHash *expr_ht;
+  // Set when the last expire cycle ran out of time with many stale keys left, so the worker
+  // comes back for them sooner
+  db_bool_t expire_is_behind;
+  // Keys removed by the expire cycle, the time it ran and how often it hit its budget
+  uint64_t expired_keys;
+  uint64_t expire_cycle_us;
+  uint64_t expire_time_cap_reached;
+  // Time the worker spent rehashing its tables while it had nothing queued
+  uint64_t rehash_idle_us;
+  // Bytes held by the lists, hashes and sorted sets of the shard beyond what its keyspace counts for
+  // them, see core_shard_memory
+  size_t value_contents;
+  // Keys deleted to stay under maxmemory
+  uint64_t evicted_keys;
+  // How the worker waited while idle: tasks it took while polling, times it parked and time it
+  // spent polling, see db_config_worker_idle
+  uint64_t busy_poll_hits;
+  uint64_t parks;
+  uint64_t busy_poll_ns;
+  // Time from the push of a task to the worker it woke from a park taking it
+  DBLatencyHistogram wakeup;
+  // Sampled accesses to the keys of the shard, see core_sample_key
+  DBHotKeys *hotkeys;
+  DBTaskQueue *task_queue;
+  // Held by the shard worker while it dispatches a batch; producers never take it to submit a task
+  mtx_t lock;
+  thrd_t worker_thread;
+  db_bool_t has_worker;
+  // Log records of the commands served by this shard that are not written out yet
+  DBAofBuffer aof_buffer;
+  // Clients blocked on lists of this shard
+  DBBlockingTable *blocking;
+  // Latencies of the commands served by this shard, indexed by action and allocated on first use
+  DBCommandStats *command_stats[DB_ACTION_COUNT];
+  // Versions WATCH compares, bumped by every write to a key hashing to the slot, see core_touch_keys
+  uint64_t watch_versions[CORE_WATCH_SLOTS];
+  // Keys served from the mapped snapshot, NULL if there are none; a key moves to `main_ht` the
+  // first time a command other than GET, LRANGE or ZRANGE names it, see core_fault_in
+  DBMappedIndex *mapped;
+} DBShard;
+
+// A request that touches several shards. It is queued on every shard, and the last worker
+// to reach it runs the request while the other workers wait, so it is ordered against
+// everything queued before it on every shard.
+typedef struct DBBarrier
+{
+  mtx_t lock;
+  cnd_t cond;
+  db_uint_t arrived;
+  db_uint_t released;
+  db_bool_t done;
+} DBBarrier;
+
+// The rest of a long LRANGE or ZRANGE, answered a chunk per task so the requests queued behind it
+// on the shard run in between, see core_stream_start
+typedef struct DBStream
 {
-  clock_t created_at;
-  DBRequest *request;
   DBReply *reply;
-  struct DBTask *next;
-} DBTask;
+  // A holder of the list or sorted set, which a write copies instead of changing while there is
+  // one, see core_unshare_keys; so the chunks come from the value as the command found it
+  DBObj *value;
+  // Position or rank of the next element and of the last one
+  db_uint_t next;
+  db_uint_t stop;
+  // Where a list stopped being read, so a chunk doesn't walk to its start again
+  DBQuickListIter iter;
+  db_bool_t withscores;
+  db_bool_t reverse;
+} DBStream;
 
 static inline void core_lock_init();
 
+static void core_dispatch(DBRequest *request, DBReply *reply);
+static uint64_t core_dispatch_timed(DBShard *_shard, DBRequest *request, DBReply *reply, uint64_t created_at, uint64_t started_at);
+
 static DBListNode *get_arg_head_node(DBRequest *request);
 
-static int core_worker();
+static int core_worker(void *arg);
+
+// Periodic work of a shard worker, called with the shard lock held
+static void core_maintain_shard(DBShard *_shard);
+
+// Deletes expired keys sampled from the shard's deadlines until few of them are stale or the budget runs out
+static void core_expire_cycle(DBShard *_shard);
+
+// Moves the resizes of the shard's tables along for up to CORE_REHASH_IDLE_BUDGET_US; returns
+// false if neither table is rehashing
+static db_bool_t core_rehash_idle(DBShard *_shard);
+
+// Answers the range from `start` to `stop` of a list or sorted set as a stream if it has at least
+// CORE_STREAM_MIN_LENGTH elements and the command runs on a worker; returns whether it does, with
+// the first chunk sent and the rest queued behind the requests already waiting
+static db_bool_t core_stream_start(DBReply *reply, DBObj *value, db_uint_t start, db_uint_t stop, db_bool_t withscores, db_bool_t reverse);
+
+// Sends the next chunk of a stream, then queues it again or ends it after the last one
+static void core_stream_continue(DBShard *_shard, DBStream *stream);
+
+// Sends what is left of a stream at once, as when the database stops with it queued
+static void core_stream_finish(DBStream *stream);
+
+// Gives the lists and sorted sets a write names a copy of their own if a stream holds them
+static void core_unshare_keys(DBRequest *request);
+
+// Replaces the value of an entry of the shard with a copy if it is a list or sorted set a stream holds
+static void core_unshare_entry(DBShard *_shard, DBHashEntry *entry);
+
+// Polls the queue of an idle worker for up to the busy-poll window; returns whether a task came
+static db_bool_t core_busy_poll(DBShard *_shard, DBTask *task);
+
+// Binds the calling worker to the `index`-th of the CPUs the process may run on, modulo their count
+static void core_pin_worker(db_uint_t index);
+
+// Reaps a finished background save; blocks until it finishes if `wait` is set
+static void core_poll_bgsave(db_bool_t wait);
+
+// Kills a running background save
+static void core_stop_bgsave();
+
+// Flushes every shard and starts a new log before forking, so the child's image and the
+// log after it don't overlap
+static db_bool_t core_rotate_aof();
+
+// Puts the log rotated away by core_rotate_aof back in front of the current one
+static void core_unrotate_aof();
+
+// Creates the shards for the configured shard count, or resets the existing ones
+static void core_init_shards();
+
+// Waits for the workers of a previous run to exit
+static void core_join_workers();
+
+// Returns the shard index owning the key
+static db_uint_t core_route_key(const DBKey *key);
+
+// Makes `main_ht` and `expr_ht` of the calling thread point to the shard's tables
+static void core_select_shard(DBShard *_shard);
+
+// Returns true if the request has to see every shard
+static db_bool_t core_request_is_global(DBRequest *request);
+
+// Whether the keys of a multi-key command route to more than one shard
+static db_bool_t core_request_spans_shards(DBRequest *request);
+
+// Queues the request on every shard behind a shared barrier
+static void core_submit_global(DBRequest *request, DBReply *reply);
+
+// Queues each shard's batch as a single task
+static void core_submit_batches(DBBatch **batches);
+
+// Stores an entry read from a snapshot in the shard owning its key
+static void core_load_entry(char *key, DBObj *value, uint64_t expire_at_ms, void *context);
+
+// Presizes the shard tables for the key counts of a snapshot
+static void core_reserve_tables(uint64_t key_count, uint64_t expires_count, void *context);
+
+// Inserts a decoded snapshot chunk, taking each shard lock once; called from several threads at once
+static void core_load_chunk(SnapshotEntry *entries, db_uint_t length, void *context);
+
+// Converts a value to its JSON form; zset scores that JSON can't hold are written as strings
+static cJSON *core_json_from_obj(DBObj *obj);
+
+// Converts the JSON form of a value back; returns NULL if `type` or the value is unknown
+static DBObj *core_obj_from_json(cJSON *json, db_type_t type);
+
+// Loads a JSON persistence file; returns false if it can't be opened
+static db_bool_t core_load_json(const char *filepath);
+
+// Called by a worker that popped a barrier task
+static void core_run_barrier(DBShard *_shard, DBTask *task);
+
+// Returns true for the commands that change the dataset and so go to the append-only log
+static db_bool_t core_request_is_write(DBRequest *request);
+
+// Where the keys of a command are among its arguments; false for a command without keys
+static db_bool_t core_request_key_range(DBRequest *request, db_uint_t *last, db_uint_t *step);
+
+// Bumps the versions WATCH looks at for the keys a write named
+static void core_touch_keys(DBRequest *request);
+
+// Counts a command in the hot keys of the shard of its first key, when it is sampled
+static void core_sample_key(DBRequest *request, DBReply *reply, db_bool_t is_write);
+
+// Whether the queue and watched keys of the transaction of an EXEC all belong to the shard of
+// its key, see core_route_transaction
+static db_bool_t core_transaction_is_local(DBRequest *request);
+
+// Finds the slot of the keys of a command, CLUSTER_SLOTS if it has none; false if they hash to
+// several slots
+static db_bool_t core_request_slot(DBRequest *request, db_uint_t *slot);
+
+// Bytes taken by the data of a shard: its tables and the contents of its values
+static size_t core_shard_memory(DBShard *_shard);
+
+// Keeps the value contents of the shards a write touches up to date, called before and after it
+static void core_account_keys(DBRequest *request, db_bool_t is_after);
+
+// Evicts from the shards a write touches until they fit in maxmemory; returns whether it may run
+static db_bool_t core_make_room(DBShard *_shard, DBRequest *request, DBReply *reply);
+
+// Answers a keyed command this node must not serve with where to go instead; returns whether it may run
+static db_bool_t core_cluster_check(DBRequest *request, DBReply *reply);
+
+// Appends the commands that recreate a value to a log buffer
+static void core_rewrite_table_entry(DBAofBuffer *buffer, const char *key, DBObj *obj);
+
+// Appends a served write command to the log buffer of the shard
+static void core_feed_aof(DBShard *_shard, DBRequest *request, DBReply *reply);
+
+// Whether served writes are recorded, for the append-only log or for replicas
+static db_bool_t core_is_logging();
+
+// Writes the log buffer of a shard, and hands it to the replicas; the caller holds the shard
+static void core_flush_aof(DBShard *_shard);
+
+// Writes the log buffers of every shard; the caller holds every shard
+static void core_flush_aof_all();
+
+// Applies a command read back from the append-only log
+static void core_replay_command(DBRequest *request, void *context);
+
+// Indexes a record of the mapped snapshot in the shard owning its key
+static void core_map_record(const char *key, db_uint_t key_length, const uint8_t *record, void *context);
+
+// Drops the keys still served from the mapped snapshot, and the mapping; the caller holds every shard
+static void core_unmap_snapshot();
+
+// Moves the keys a command names from the mapped snapshot to the keyspace before it runs
+static void core_fault_in(DBRequest *request);
+
+// Returns a new string of `filepath` followed by `suffix`
+static char *core_filepath_with_suffix(const char *filepath, const char *suffix);
+
+// Hands the lists pushed to since the last call to the clients blocked on them; the caller holds the shard
+static void core_serve_blocked(DBShard *_shard);
+
+// Whether the command just dispatched left its reply to be answered later, which clears the mark
+static db_bool_t core_take_deferred_reply();
 
 // Retrieves a string by key;
-static const char const *core_retrieve_string(const char *key);
+static DBObj *core_retrieve_string(const DBKey *key);
 
 // Retrieves a list by key;
-static DBList *core_retrieve_list(const char *key, const db_bool_t create_new_if_not_found);
+static DBQuickList *core_retrieve_list(const DBKey *key, const db_bool_t create_new_if_not_found);
+
+// Retrieves a sorted set by key;
+static DBZSet *core_retrieve_zset(const DBKey *key, const db_bool_t create_new_if_not_found, db_bool_t *wrong_type);
 
 // File path for database persistence
 static char *persistence_filepath = NULL;
-
-static db_bool_t is_running = false;
-static DBHash *main_ht = NULL;
-static DBHash *expr_ht = NULL;
-static db_uint_t expr_check_index = 0;
+static db_persistence_format_t persistence_format = DB_PERSISTENCE_SNAPSHOT;
+
+// Background save state; only touched while shard 0 is held, by its worker or a barrier
+static pid_t bgsave_child = -1;
+static time_t bgsave_started_at = 0;
+static time_t last_save_at = 0;
+static db_bool_t last_bgsave_is_success = true;
+// Shared with the child, which counts the keys it has written
+static SnapshotProgress *bgsave_progress = NULL;
+// The child is rewriting the append-only log instead of saving a snapshot
+static db_bool_t bgsave_is_rewrite = false;
+static db_bool_t last_bgrewrite_is_success = true;
+
+// Idle policy of the workers, see db_config_worker_idle
+static _Atomic db_uint_t busy_poll_us = 0;
+static db_bool_t pin_workers = false;
+
+// Whether db_start maps a binary snapshot instead of loading it, see db_config_mapped_load
+static db_bool_t mapped_load_enabled = false;
+// The snapshot mapped by db_start, while any shard serves keys from it; concurrent readers look at
+// whether there is one
+static _Atomic(SnapshotMap *) mapped_snapshot = NULL;
+
+// Whether each shard keeps its keys in a prefix tree for KEYS, see db_config_key_index
+static db_bool_t key_index_enabled = false;
+
+// Bytes of data the shards may hold between them, 0 for no limit; see db_config_maxmemory
+static _Atomic size_t maxmemory = 0;
+
+// Whether GET is served on the thread that submits it, see db_config_concurrent_reads
+static _Atomic db_bool_t concurrent_reads_enabled = false;
+static _Atomic uint64_t concurrent_reads_served = 0;
+
+static db_bool_t aof_enabled = false;
+static char *aof_filepath = NULL;
+static db_aof_fsync_t aof_fsync = DB_AOF_FSYNC_EVERYSEC;
+// Open while the database runs with the log enabled; only touched by threads holding a shard
+static DBAof *aof = NULL;
+
+static _Atomic db_bool_t is_running = false;
+// Guards configuration and start-up; workers never take it
 static mtx_t *lock = NULL;
-static thrd_t core_worker_thread = -1;
 
-static DBTask *task_queue_head = NULL;
-static DBTask *task_queue_tail = NULL;
+static DBShard *shards = NULL;
+static db_uint_t shards_length = 0;
+static db_uint_t shard_count = 1;
+// Producers queueing barriers hold this, so every shard sees barriers in the same order
+static mtx_t barrier_submit_lock;
+static once_flag barrier_submit_lock_once = ONCE_FLAG_INIT;
+
+// The shard the calling thread is working on; handlers only ever use these tables
+static thread_local DBShard *shard = NULL;
+static thread_local DBHash *main_ht = NULL;
+static thread_local DBHash *expr_ht = NULL;
+// Set by a handler that parked its reply for a blocked client, who is answered by a later push or
+// the timeout instead of when the handler returns
+static thread_local db_bool_t reply_is_deferred = false;
+// Set while EXEC runs its queue, in which a blocking pop doesn't block
+static thread_local db_bool_t is_in_transaction = false;
+// Set on the shard workers, the only threads that may carry a reply over to a later task
+static thread_local db_bool_t is_worker = false;
+// Streams not answered in full yet; until there is one no write looks for a shared value
+static _Atomic db_uint_t live_streams = 0;
+// Set by the first WATCH; until then no write needs to bump a version
+static _Atomic db_bool_t watch_is_used = false;
+
+static db_uint_t queue_capacity = DEFAULT_TASK_QUEUE_CAPACITY;
+static db_queue_policy_t queue_policy = DB_QUEUE_BLOCK;
 
 static inline void core_lock_init()
 {
@@ -80,855 +403,6065 @@ static DBListNode *get_arg_head_node(DBRequest *request)
   return request->args->head;
 }
 
-void db_start()
+static void barrier_submit_lock_init()
 {
-  if (is_running)
-    return;
-
-  srand(time(NULL));
-  is_running = true;
-
-  if (main_ht)
-    ht_reset(main_ht);
-  else
-    main_ht = ht_create();
-
-  if (expr_ht)
-    ht_reset(expr_ht);
-  else
-    expr_ht = ht_create();
-
-  db_flushall(NULL, NULL);
+  mtx_init(&barrier_submit_lock, mtx_plain);
+}
 
-  db_config_hash_seed(hash_seed);
-  if (!persistence_filepath)
-    db_config_persistence_filepath(DEFAULT_PERSISTENCE_FILE);
+static void core_init_shards()
+{
+  db_uint_t i;
 
-  // load data
-  FILE *file = fopen(persistence_filepath, "r");
-  if (file)
+  if (shards && shards_length != shard_count)
   {
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    for (i = 0; i < shards_length; ++i)
+    {
+      ht_free(shards[i].main_ht);
+      ht_free(shards[i].expr_ht);
+      queue_free(shards[i].task_queue);
+      aof_buffer_free(&shards[i].aof_buffer);
+      blocking_free(shards[i].blocking, DB_ERR_DB_IS_CLOSED);
+      hotkeys_free(shards[i].hotkeys);
+      for (db_uint_t action = 0; action < DB_ACTION_COUNT; ++action)
+        free(shards[i].command_stats[action]);
+      mtx_destroy(&shards[i].lock);
+    }
+    free(shards);
+    shards = NULL;
+  }
 
-    char *buffer = (char *)malloc(file_size + 1);
-    if (!buffer)
+  if (!shards)
+  {
+    shards = (DBShard *)calloc(shard_count, sizeof(DBShard));
+    if (!shards)
       EXIT_ON_MEMORY_ERROR();
-    fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';
-    fclose(file);
-
-    char *key = NULL;
-    DBList *list;
-    cJSON *cjson_cursor = cJSON_Parse(buffer);
-    cJSON *cjson_array_cursor = NULL;
-    free(buffer);
-
-    if (cjson_cursor)
-      cjson_cursor = cjson_cursor->child;
-
-    while (cjson_cursor)
+    shards_length = shard_count;
+    for (i = 0; i < shards_length; ++i)
     {
-      key = cjson_cursor->string;
+      shards[i].index = i;
+      shards[i].main_ht = ht_create();
+      shards[i].expr_ht = ht_create();
+      shards[i].blocking = blocking_create();
+      shards[i].hotkeys = hotkeys_create();
+      mtx_init(&shards[i].lock, mtx_plain);
+    }
+  }
 
-      if (!key)
-      {
-        cjson_cursor = cjson_cursor->next;
-        continue;
-      }
+  for (i = 0; i < shards_length; ++i)
+  {
+    ht_reset(shards[i].main_ht);
+    ht_reset(shards[i].expr_ht);
+    ht_config_key_index(shards[i].main_ht, key_index_enabled);
+    ht_config_concurrent_reads(shards[i].main_ht, concurrent_reads_enabled);
+    ht_config_keyspace(shards[i].main_ht, true);
+    shards[i].value_contents = 0;
+    shards[i].evicted_keys = 0;
+    shards[i].expire_is_behind = false;
+    shards[i].expired_keys = 0;
+    shards[i].expire_cycle_us = 0;
+    shards[i].expire_time_cap_reached = 0;
+    shards[i].rehash_idle_us = 0;
+    shards[i].busy_poll_hits = 0;
+    shards[i].parks = 0;
+    shards[i].busy_poll_ns = 0;
+    memset(&shards[i].wakeup, 0, sizeof(shards[i].wakeup));
+    hotkeys_reset(shards[i].hotkeys);
+    for (db_uint_t action = 0; action < DB_ACTION_COUNT; ++action)
+    {
+      free(shards[i].command_stats[action]);
+      shards[i].command_stats[action] = NULL;
+    }
+    // The queue is empty while the database is stopped, so it can be resized here.
+    queue_free(shards[i].task_queue);
+    shards[i].task_queue = queue_create(queue_capacity, queue_policy);
+  }
 
-      if (cJSON_IsString(cjson_cursor))
-      {
-        hset(main_ht, dbutil_strdup(key), dbobj_create_string_with_dup(cJSON_GetStringValue(cjson_cursor)), expr_ht);
-      }
+  core_select_shard(&shards[0]);
+}
 
-      else if (cJSON_IsArray(cjson_cursor))
-      {
-        cjson_array_cursor = cjson_cursor->child;
+static void core_join_workers()
+{
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    if (shards[i].has_worker && !thrd_equal(thrd_current(), shards[i].worker_thread))
+      thrd_join(shards[i].worker_thread, NULL);
+    shards[i].has_worker = false;
+  }
+}
 
-        list = create_dblist();
-        while (cjson_array_cursor)
-        {
-          if (cJSON_IsString(cjson_array_cursor))
-          {
-            rpush(list, create_dblistnode_with_string(cJSON_GetStringValue(cjson_array_cursor)));
-          }
+static db_uint_t core_route_key(const DBKey *key)
+{
+  if (shards_length <= 1 || !key->string)
+    return 0;
+  // Use the high bits, the low bits of the same hash pick the bucket inside the shard.
+  return (db_uint_t)(((uint64_t)key->hash * shards_length) >> 32);
+}
 
-          cjson_array_cursor = cjson_array_cursor->next;
-        }
-        hset(main_ht, dbutil_strdup(key), dbobj_create_string_with_dup(cJSON_GetStringValue(cjson_cursor)), expr_ht);
-      }
+static void core_select_shard(DBShard *_shard)
+{
+  shard = _shard;
+  main_ht = _shard ? _shard->main_ht : NULL;
+  expr_ht = _shard ? _shard->expr_ht : NULL;
+}
 
-      cjson_cursor = cjson_cursor->next;
-    }
+static db_bool_t core_request_is_global(DBRequest *request)
+{
+  switch (request->action)
+  {
+  case DB_SAVE:
+  case DB_BGSAVE:
+  case DB_BGREWRITEAOF:
+  case DB_KEYS:
+  case DB_SCAN:
+  case DB_FLUSHALL:
+  case DB_INFO_DATASET_MEMORY:
+  case DB_INFO_STATS:
+  case DB_INFO_COMMANDSTATS:
+  case DB_HOTKEYS_GET:
+  case DB_HOTKEYS_BYTES:
+  case DB_HOTKEYS_RESET:
+  case DB_SHUTDOWN:
+  case DB_RENAME:
+  case DB_ZINTERSTORE:
+  case DB_ZUNIONSTORE:
+  case DB_PSYNC:
+  case DB_REPLICA_LOAD:
+  case DB_CLUSTER_COUNTKEYSINSLOT:
+  case DB_CLUSTER_GETKEYSINSLOT:
+    return true;
+  // Only when their keys span several shards; otherwise the shard of the first one serves them.
+  case DB_DEL:
+  case DB_UNLINK:
+  case DB_MGET:
+  case DB_WATCH:
+    return request->args && request->args->length > 1 && core_request_spans_shards(request);
+  case DB_EXEC:
+    return !core_transaction_is_local(request);
+  case DB_MSET:
+  case DB_MSETNX:
+  case DB_BLPOP:
+  case DB_BRPOP:
+    return request->args && request->args->length > 2 && core_request_spans_shards(request);
+  default:
+    return false;
   }
-
-  thrd_create(&core_worker_thread, core_worker, NULL);
 }
 
-db_bool_t db_is_running()
+static db_bool_t core_request_is_write(DBRequest *request)
 {
-  return is_running;
+  switch (request->action)
+  {
+  case DB_SET:
+  case DB_MSET:
+  case DB_MSETNX:
+  case DB_INCR:
+  case DB_DECR:
+  case DB_INCRBY:
+  case DB_DECRBY:
+  case DB_INCRBYFLOAT:
+  case DB_APPEND:
+  case DB_SETRANGE:
+  case DB_RENAME:
+  case DB_DEL:
+  case DB_UNLINK:
+  case DB_LPUSH:
+  case DB_LPOP:
+  case DB_RPUSH:
+  case DB_RPOP:
+  case DB_BLPOP:
+  case DB_BRPOP:
+  case DB_LSET:
+  case DB_LINSERT:
+  case DB_HSET:
+  case DB_HDEL:
+  case DB_HINCRBY:
+  case DB_EXPIRE:
+  case DB_EXPIREAT:
+  case DB_PEXPIRE:
+  case DB_PEXPIREAT:
+  case DB_ZADD:
+  case DB_ZREM:
+  case DB_ZREMRANGEBYSCORE:
+  case DB_ZINTERSTORE:
+  case DB_ZUNIONSTORE:
+  case DB_FLUSHALL:
+  case DB_MIGRATE:
+    return true;
+  default:
+    return false;
+  }
 }
 
-void db_config_hash_seed(db_uint_t _hash_seed)
+// The keys are every `step`th argument from the first up to `last`, see core_request_is_key_at.
+static db_bool_t core_request_key_range(DBRequest *request, db_uint_t *last, db_uint_t *step)
 {
-  hash_seed = _hash_seed ? _hash_seed : (db_uint_t)time(NULL);
+  db_uint_t argc = request->args ? request->args->length : 0;
+  DBListNode *node = request->args ? request->args->head : NULL;
+
+  *last = 0;
+  *step = 1;
+  switch (request->action)
+  {
+  case DB_SET:
+  case DB_GET:
+  case DB_INCR:
+  case DB_DECR:
+  case DB_INCRBY:
+  case DB_DECRBY:
+  case DB_INCRBYFLOAT:
+  case DB_APPEND:
+  case DB_STRLEN:
+  case DB_GETRANGE:
+  case DB_SETRANGE:
+  case DB_LPUSH:
+  case DB_LPOP:
+  case DB_RPUSH:
+  case DB_RPOP:
+  case DB_LLEN:
+  case DB_LRANGE:
+  case DB_LINDEX:
+  case DB_LSET:
+  case DB_LINSERT:
+  case DB_HGET:
+  case DB_HSET:
+  case DB_HDEL:
+  case DB_HMGET:
+  case DB_HGETALL:
+  case DB_HINCRBY:
+  case DB_HSCAN:
+  case DB_EXPIRE:
+  case DB_EXPIREAT:
+  case DB_PEXPIRE:
+  case DB_PEXPIREAT:
+  case DB_TTL:
+  case DB_PTTL:
+  case DB_ZSCORE:
+  case DB_ZADD:
+  case DB_ZCARD:
+  case DB_ZCOUNT:
+  case DB_ZRANGE:
+  case DB_ZRANGEBYSCORE:
+  case DB_ZRANK:
+  case DB_ZREVRANGE:
+  case DB_ZREVRANK:
+  case DB_ZREM:
+  case DB_ZREMRANGEBYSCORE:
+  case DB_ZSCAN:
+  case DB_MEMORY_USAGE:
+  case DB_MIGRATE:
+    break;
+  case DB_MGET:
+  case DB_DEL:
+  case DB_UNLINK:
+  case DB_WATCH:
+    *last = argc - 1;
+    break;
+  case DB_MSET:
+  case DB_MSETNX:
+    *last = argc - 1;
+    *step = 2;
+    break;
+  case DB_RENAME:
+    *last = 1;
+    break;
+  case DB_BLPOP:
+  case DB_BRPOP:
+    *last = argc - 2;
+    break;
+  case DB_ZINTERSTORE:
+  case DB_ZUNIONSTORE:
+    // The destination, then `numkeys` sources after the count.
+    *last = node && node->next ? 1 + get_uint_arg(node->next) : 0;
+    break;
+  default:
+    return false;
+  }
+  return true;
 }
 
-void db_config_persistence_filepath(const char *_persistence_filepath)
+// Whether the argument at `index`, in the range of core_request_key_range, is a key
+static inline db_bool_t core_request_is_key_at(DBRequest *request, DBListNode *node, db_uint_t index, db_uint_t step)
 {
-  free(persistence_filepath);
-  persistence_filepath = dbutil_strdup(_persistence_filepath);
+  if (index % step || !dbobj_is_string(node->data) || !node->data->value.string)
+    return false;
+  return !((request->action == DB_ZINTERSTORE || request->action == DB_ZUNIONSTORE) && index == 1);
 }
 
-DBReply *db_handle_request(DBRequest *request)
+static db_bool_t core_request_spans_shards(DBRequest *request)
 {
-  DBReply *reply = create_reply();
+  db_uint_t last, step, index = 0, first;
+  DBListNode *node = request->args ? request->args->head : NULL;
 
-  if (!is_running)
+  if (shards_length == 1 || !request->key.string || !core_request_key_range(request, &last, &step))
+    return false;
+  first = core_route_key(&request->key);
+  for (; node && index <= last; node = node->next, ++index)
   {
-    reply_error(reply, DB_ERR_DB_IS_CLOSED);
-    return reply;
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    DBKey key = ht_key(node->data->value.string);
+    if (core_route_key(&key) != first)
+      return true;
   }
+  return false;
+}
 
-  DBTask *task = (DBTask *)malloc(sizeof(DBTask));
-  if (!task)
-    EXIT_ON_MEMORY_ERROR();
+static db_bool_t core_request_slot(DBRequest *request, db_uint_t *slot)
+{
+  db_uint_t last, step, index = 0;
+  DBListNode *node = request->args ? request->args->head : NULL;
 
-  task->created_at = clock();
-  task->request = request;
-  task->reply = reply;
-  task->next = NULL;
+  *slot = CLUSTER_SLOTS;
+  if (!core_request_key_range(request, &last, &step))
+    return true;
 
-  if (!task_queue_head)
+  for (; node && index <= last; node = node->next, ++index)
   {
-    task_queue_head = task;
-    task_queue_tail = task;
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    db_uint_t key_slot = cluster_keyslot(node->data->value.string);
+    if (*slot != CLUSTER_SLOTS && *slot != key_slot)
+      return false;
+    *slot = key_slot;
   }
-  else
+  return true;
+}
+
+static db_bool_t core_cluster_check(DBRequest *request, DBReply *reply)
+{
+  char error[320], address[280];
+  cluster_slot_state_t state;
+  db_uint_t slot;
+
+  if (!cluster_is_enabled() || request->is_from_primary)
+    return true;
+  if (!core_request_slot(request, &slot))
   {
-    task_queue_tail->next = task;
-    task_queue_tail = task;
+    reply_error(reply, DB_ERR_CROSSSLOT);
+    return false;
   }
+  if (slot == CLUSTER_SLOTS)
+    return true;
 
-  return reply;
+  uint16_t owner = cluster_slot_owner(slot);
+  uint16_t peer = cluster_slot_peer(slot, &state);
+  if (owner == CLUSTER_NODE_MYSELF)
+  {
+    // A key a migrating slot doesn't have here any more, or never had, is on its new owner by now.
+    DBShard *key_shard = &shards[core_route_key(&request->key)];
+    if (state != CLUSTER_SLOT_MIGRATING || request->action == DB_MIGRATE ||
+        hget_key(key_shard->main_ht, &request->key, key_shard->expr_ht))
+      return true;
+    cluster_node_address(peer, address, sizeof(address));
+    snprintf(error, sizeof(error), "ASK %llu %s", (unsigned long long)slot, address);
+    reply_error(reply, error);
+    return false;
+  }
+  if (state == CLUSTER_SLOT_IMPORTING && request->is_asking)
+    return true;
+  if (owner == CLUSTER_NODE_NONE)
+  {
+    reply_error(reply, DB_ERR_CLUSTERDOWN);
+    return false;
+  }
+  cluster_node_address(owner, address, sizeof(address));
+  snprintf(error, sizeof(error), "MOVED %llu %s", (unsigned long long)slot, address);
+  reply_error(reply, error);
+  return false;
 }
 
-static int core_worker()
+static void core_feed_aof(DBShard *_shard, DBRequest *request, DBReply *reply)
 {
-  clock_t t0;
-  DBRequest *request;
-  DBReply *reply;
-  // Calculate the sleep increment to reach 1 second over 5 minutes, in nanoseconds.
-  const long sleep_increment_ns = NANOSECONDS_PER_SECOND / (5 * 60 * 1000);
-  clock_t idle_start_time = 0;
-  long sleep_duration_ns = 0;
-  db_bool_t has_request = false;
-  DBHashEntry *curr_check_entry = NULL;
+  char deadline[24];
+  DBHashEntry *entry;
 
-  while (is_running)
+  if (!core_is_logging() || !core_request_is_write(request) || !reply->data || reply->data->type == DB_TYPE_ERROR)
+    return;
+
+  if (request->action == DB_EXPIRE || request->action == DB_EXPIREAT || request->action == DB_PEXPIRE || request->action == DB_PEXPIREAT)
   {
-    if (!core_trylock_is_success())
-      continue;
+    // A relative TTL would restart every time the log is replayed.
+    entry = hget_key(main_ht, &request->key, NULL);
+    if (!entry || !entry->expire_at_ms)
+      return;
+    sprintf(deadline, "%llu", (unsigned long long)entry->expire_at_ms);
+    aof_buffer_begin(&_shard->aof_buffer, 3);
+    aof_buffer_append_arg(&_shard->aof_buffer, db_action_name(DB_PEXPIREAT));
+    aof_buffer_append_arg(&_shard->aof_buffer, entry->key);
+    aof_buffer_append_arg(&_shard->aof_buffer, deadline);
+  }
+  else if (request->action == DB_MIGRATE)
+  {
+    // The key is on another node now; only its removal from this one happened here.
+    if (!dbobj_is_string(reply->data) || strcmp(reply->data->value.string, OK) != 0)
+      return;
+    aof_buffer_begin(&_shard->aof_buffer, 2);
+    aof_buffer_append_arg(&_shard->aof_buffer, db_action_name(DB_DEL));
+    aof_buffer_append_arg(&_shard->aof_buffer, request->key.string);
+  }
+  else if (request->action == DB_BLPOP || request->action == DB_BRPOP)
+  {
+    // Replayed, a pop that blocked would never return; it is logged as the pop it turned into.
+    if (!dbobj_is_list(reply->data) || !reply->data->value.list->head)
+      return;
+    aof_buffer_begin(&_shard->aof_buffer, 2);
+    aof_buffer_append_arg(&_shard->aof_buffer, db_action_name(request->action == DB_BLPOP ? DB_LPOP : DB_RPOP));
+    aof_buffer_append_arg(&_shard->aof_buffer, reply->data->value.list->head->data->value.string);
+  }
+  else
+    aof_buffer_append_request(&_shard->aof_buffer, db_action_name(request->action), request->args);
 
-    has_request = (db_bool_t)task_queue_head;
+  if (_shard->aof_buffer.length >= AOF_BUFFER_FLUSH_SIZE)
+    core_flush_aof(_shard);
+}
 
-    if (has_request)
-    {
-      if (task_queue_head->request->action != DB_INFO_DATASET_MEMORY)
-      {
-        idle_start_time = 0;
-        sleep_duration_ns = 0;
-      }
-      do
-      {
-        request = task_queue_head->request;
-        reply = task_queue_head->reply;
-        switch (request->action)
-        {
-        case DB_GET:
-          db_get(request, reply);
-          break;
-        case DB_SET:
-          db_set(request, reply);
-          break;
-        case DB_RENAME:
-          db_rename(request, reply);
-          break;
-        case DB_DEL:
-          db_del(request, reply);
-          break;
-        case DB_LPUSH:
-          db_lpush(request, reply);
-          break;
-        case DB_LPOP:
-          db_lpop(request, reply);
-          break;
-        case DB_RPUSH:
-          db_rpush(request, reply);
-          break;
-        case DB_RPOP:
-          db_rpop(request, reply);
-          break;
-        case DB_LLEN:
-          db_llen(request, reply);
-          break;
-        case DB_LRANGE:
-          db_lrange(request, reply);
-          break;
-        case DB_HGET:
-          db_hget(request, reply);
-          break;
-        case DB_HSET:
-          db_hset(request, reply);
-          break;
-        case DB_HDEL:
-          db_hdel(request, reply);
-          break;
-        case DB_EXPIRE:
-          db_expire(request, reply);
-          break;
-        case DB_KEYS:
-          db_keys(request, reply);
-          break;
-        case DB_FLUSHALL:
-          db_flushall(request, reply);
-          break;
-        // TODO: Returns the memory usage of the current database dataset
-        // case DB_INFO_DATASET_MEMORY:
-        //   db_get_dataset_memory_usage(request, reply);
-        //   break;
-        case DB_SAVE:
-          db_save(request, reply);
-          break;
-        case DB_SHUTDOWN:
-          db_shutdown(request, reply);
-          break;
-        default:
-          reply_error(reply, DB_ERR_UNKNOWN_COMMAND);
-          break;
-        }
-        reply->done = true;
-        free(task_queue_head);
-        task_queue_head = task_queue_head->next;
-        if (!task_queue_head)
-          task_queue_tail = NULL;
-      } while (task_queue_head);
-    }
+static db_bool_t core_is_logging()
+{
+  return aof || repl_backlog_is_active();
+}
 
-    // maintain expires ht
-    if (expr_check_index >= expr_ht->size0)
-      expr_check_index = 0;
-    ht_maintain_expires(main_ht, expr_ht, ++expr_check_index);
-    core_unlock();
+static void core_flush_aof(DBShard *_shard)
+{
+  if (_shard->aof_buffer.length && repl_backlog_is_active())
+    repl_feed(_shard->aof_buffer.data, _shard->aof_buffer.length);
+  if (aof)
+    aof_write(aof, &_shard->aof_buffer);
+  else
+    _shard->aof_buffer.length = 0;
+}
 
-    if (!has_request)
-    {
-      if (!idle_start_time)
-      {
-        idle_start_time = clock();
-      }
-      // If the idle time exceeds 100ms,
-      // a progressively increasing sleep period begins.
-      if ((clock() - idle_start_time) * 1000 / CLOCKS_PER_SEC > 100)
-      {
-        if (sleep_duration_ns < NANOSECONDS_PER_SECOND)
-          sleep_duration_ns += sleep_increment_ns;
-        thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = sleep_duration_ns}, NULL);
-      }
-    }
-  }
+static void core_flush_aof_all()
+{
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    core_flush_aof(&shards[i]);
+}
 
-  return 0;
+// Bytes a value holds beyond what the keyspace counts for it
+static inline size_t core_value_contents(const DBObj *value)
+{
+  return dbobj_memory_usage(value) - dbobj_shallow_memory_usage(value);
 }
 
-static const char const *core_retrieve_string(const char *key)
+static size_t core_shard_memory(DBShard *_shard)
 {
-  if (!key)
-    return NULL;
+  // What expiry deleted since the last look is only known to the keyspace until now.
+  _shard->value_contents -= _shard->main_ht->expired_contents;
+  _shard->main_ht->expired_contents = 0;
+  return _shard->main_ht->memory + _shard->expr_ht->memory + _shard->value_contents;
+}
 
-  DBHashEntry *entry = hget(main_ht, key, expr_ht);
+// Counts the contents of every value again, after the dataset was loaded behind the shards' back
+static void core_recount_contents()
+{
+  DBHashEntry *entry;
+  DBHash *ht;
 
-  if (entry && entry->data->type == DB_TYPE_STRING)
+  for (db_uint_t i = 0; i < shards_length; ++i)
   {
-    return entry->data->value.string;
+    ht = shards[i].main_ht;
+    ht->expired_contents = 0;
+    shards[i].value_contents = 0;
+    for (db_uint_t t = 0; t < 2; ++t)
+      for (db_uint_t b = 0; b < (t ? ht->size1 : ht->size0); ++b)
+        for (entry = (t ? ht->buckets1 : ht->buckets0)[b]; entry; entry = entry->next)
+          shards[i].value_contents += core_value_contents(entry->data);
   }
-
-  return NULL;
 }
 
-static DBList *core_retrieve_list(const char *key, const db_bool_t create_new_if_not_found)
+typedef struct DBAccountedKey
 {
-  if (!key)
-    return NULL;
+  DBHashEntry *entry;
+  DBShard *shard;
+} DBAccountedKey;
 
-  DBHashEntry *entry = hget(main_ht, key, expr_ht);
+static int core_compare_accounted_keys(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)((const DBAccountedKey *)a)->entry, y = (uintptr_t)((const DBAccountedKey *)b)->entry;
+  return x < y ? -1 : x > y;
+}
 
-  if (entry)
+// The contents of the values are taken out of the count before the write and put back after, so
+// the count follows whatever it did to them without knowing what that was. A key named twice
+// counts once, and a key past its deadline counts as gone, since the keyspace reports it when it
+// deletes it.
+static void core_account_keys(DBRequest *request, db_bool_t is_after)
+{
+  DBAccountedKey stack_keys[8], *keys = stack_keys;
+  DBListNode *node = request->args ? request->args->head : NULL;
+  db_uint_t last, step, index = 0, length = 0;
+  uint64_t now = ht_clock_ms();
+
+  if (!core_request_key_range(request, &last, &step))
+    return;
+  if (last / step + 1 > sizeof(stack_keys) / sizeof(stack_keys[0]))
   {
-    return entry->data->type == DB_TYPE_LIST ? entry->data->value.list : NULL;
+    keys = (DBAccountedKey *)malloc((last / step + 1) * sizeof(DBAccountedKey));
+    if (!keys)
+      EXIT_ON_MEMORY_ERROR();
   }
 
-  if (create_new_if_not_found)
+  for (; node && index <= last; node = node->next, ++index)
   {
-    DBList *list = create_dblist();
-    hset(main_ht, dbutil_strdup(key), dbobj_create_list(list), expr_ht);
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    DBKey key = index ? ht_key(node->data->value.string) : request->key;
+    DBShard *key_shard = &shards[core_route_key(&key)];
+    DBHashEntry *entry = ht_find_key(key_shard->main_ht, &key);
+    if (entry && (!entry->expire_at_ms || entry->expire_at_ms > now))
+      keys[length++] = (DBAccountedKey){entry, key_shard};
+  }
 
-    return list;
+  if (length > 1)
+    qsort(keys, length, sizeof(DBAccountedKey), core_compare_accounted_keys);
+  for (db_uint_t i = 0; i < length; ++i)
+  {
+    if (i && keys[i].entry == keys[i - 1].entry)
+      continue;
+    if (is_after)
+      keys[i].shard->value_contents += core_value_contents(keys[i].entry->data);
+    else
+      keys[i].shard->value_contents -= core_value_contents(keys[i].entry->data);
   }
 
-  return NULL;
+  if (keys != stack_keys)
+    free(keys);
 }
 
-void db_get(DBRequest *request, DBReply *reply)
+static void core_touch_keys(DBRequest *request)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  DBListNode *node = request->args ? request->args->head : NULL;
+  db_uint_t last, step, index = 0;
 
-  if (!key || curr_arg_node)
+  if (!atomic_load_explicit(&watch_is_used, memory_order_relaxed))
+    return;
+  // A write that names no key, FLUSHALL, may have changed any of them.
+  if (!core_request_key_range(request, &last, &step))
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    for (db_uint_t i = 0; i < shards_length; ++i)
+      for (db_uint_t slot = 0; slot < CORE_WATCH_SLOTS; ++slot)
+        ++shards[i].watch_versions[slot];
     return;
   }
 
-  const char const *value = core_retrieve_string(key);
-
-  if (value)
-  {
-    // Return the string value
-    reply_data(reply, dbobj_create_string_with_dup(value));
-  }
-  else
+  for (; node && index <= last; node = node->next, ++index)
   {
-    // Not found
-    reply_data(reply, dbobj_create_null());
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    DBKey key = index ? ht_key(node->data->value.string) : request->key;
+    ++shards[core_route_key(&key)].watch_versions[key.hash & (CORE_WATCH_SLOTS - 1)];
   }
 }
 
-void db_set(DBRequest *request, DBReply *reply)
+// A read counts the bytes of its reply, a write those of its arguments after the key. The key
+// stands for the others of a command that names several, and a reply left for later counts
+// nothing unless it is streamed, since a blocked pop is answered by another command.
+static void core_sample_key(DBRequest *request, DBReply *reply, db_bool_t is_write)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *value = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  DBHotKeys *hotkeys = shards[core_route_key(&request->key)].hotkeys;
+  uint64_t read_bytes = 0, write_bytes = 0;
 
-  if (!key || !value || curr_arg_node)
-  {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+  if (!hotkeys_should_sample(hotkeys))
     return;
+  if (is_write && request->args && request->args->head)
+    for (DBListNode *node = request->args->head->next; node; node = node->next)
+      write_bytes += dbobj_payload_size(node->data);
+  else if (!is_write && reply && (!reply_is_deferred || reply->is_streamed))
+    read_bytes = reply_payload_size(reply);
+  hotkeys_record(hotkeys, &request->key, read_bytes, write_bytes);
+}
+
+// A list or sorted set with the same elements as `value`
+static DBObj *core_copy_value(const DBObj *value)
+{
+  if (value->type == DB_TYPE_LIST)
+  {
+    DBQuickList *list = ql_create();
+    DBQuickListIter iter;
+    db_uint_t length;
+    const char *element;
+    ql_iter_init(value->value.quicklist, &iter);
+    while ((element = ql_iter_next(&iter, &length)))
+      ql_rpush(list, element);
+    return dbobj_create_quicklist(list);
   }
 
-  hset(main_ht, key, dbobj_create_string_with_dup(value), expr_ht);
-  reply_data(reply, dbobj_create_string_with_dup(OK));
+  // The members come in score order, as zset_create_sorted takes them.
+  db_uint_t length = zcard(value->value.zset), i = 0;
+  // One more for the end of the iteration
+  DBZSetPair *pairs = (DBZSetPair *)malloc((length + 1) * sizeof(DBZSetPair));
+  DBZSetIter iter;
+  if (!pairs)
+    EXIT_ON_MEMORY_ERROR();
+  zset_iter_init(value->value.zset, &iter);
+  for (; (pairs[i].member = zset_iter_next(&iter, &pairs[i].score)); ++i)
+    pairs[i].length = (db_uint_t)strlen(pairs[i].member);
+  DBObj *copy = dbobj_create_zset(zset_create_sorted(pairs, length));
+  free(pairs);
+  return copy;
 }
 
-void db_rename(DBRequest *request, DBReply *reply)
+static void core_unshare_entry(DBShard *_shard, DBHashEntry *entry)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *old_key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *new_key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  if (!entry || (entry->data->type != DB_TYPE_LIST && entry->data->type != DB_TYPE_ZSET) || !dbobj_is_shared(entry->data))
+    return;
+  DBObj *copy = core_copy_value(entry->data);
+  // The stream keeps the value it holds, which is freed when it lets go.
+  _shard->main_ht->memory += dbobj_shallow_memory_usage(copy) - dbobj_shallow_memory_usage(entry->data);
+  free_dbobj(entry->data);
+  entry->data = copy;
+}
 
-  if (!old_key || !new_key || curr_arg_node)
+static void core_unshare_keys(DBRequest *request)
+{
+  DBListNode *node = request->args ? request->args->head : NULL;
+  db_uint_t last, step, index = 0;
+
+  if (!atomic_load_explicit(&live_streams, memory_order_relaxed))
+    return;
+  switch (request->action)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+  // Drop or move the value without changing it.
+  case DB_DEL:
+  case DB_UNLINK:
+  case DB_RENAME:
+  case DB_EXPIRE:
+  case DB_EXPIREAT:
+  case DB_PEXPIRE:
+  case DB_PEXPIREAT:
+  case DB_FLUSHALL:
+  case DB_MIGRATE:
     return;
+  default:
+    break;
   }
+  if (!core_request_key_range(request, &last, &step))
+    return;
 
-  if (!ht_rename(main_ht, old_key, new_key, expr_ht))
+  for (; node && index <= last; node = node->next, ++index)
   {
-    reply_error(reply, DB_ERR_NONEXISTENT_KEY);
-    return;
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    DBKey key = index ? ht_key(node->data->value.string) : request->key;
+    DBShard *key_shard = &shards[core_route_key(&key)];
+    core_unshare_entry(key_shard, ht_find_key(key_shard->main_ht, &key));
   }
-
-  reply_data(reply, dbobj_create_string_with_dup(OK));
 }
 
-void db_del(DBRequest *request, DBReply *reply)
+// Points the key of an EXEC at the first key its transaction names, so a transaction on a
+// single shard is queued on that one
+static void core_route_transaction(DBRequest *request)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  DBTransaction *transaction = request->transaction;
+
+  for (db_uint_t i = 0; i < transaction->length; ++i)
+    if (transaction->requests[i]->key.string)
+    {
+      request->key = transaction->requests[i]->key;
+      return;
+    }
+  if (transaction->watched_length)
+    request->key = ht_key(transaction->watched[0].key);
+}
+
+static db_bool_t core_transaction_is_local(DBRequest *request)
+{
+  DBTransaction *transaction = request->transaction;
+  db_uint_t shard_index = core_route_key(&request->key);
+
+  if (!transaction)
+    return true;
+  // A command without a key is served the same by any shard.
+  for (db_uint_t i = 0; i < transaction->length; ++i)
+  {
+    DBRequest *queued = transaction->requests[i];
+    if (core_request_is_global(queued) || (queued->key.string && core_route_key(&queued->key) != shard_index))
+      return false;
+  }
+  for (db_uint_t i = 0; i < transaction->watched_length; ++i)
+  {
+    DBKey key = ht_key(transaction->watched[i].key);
+    if (core_route_key(&key) != shard_index)
+      return false;
+  }
+  return true;
+}
+
+// Whether a write may leave the dataset bigger than it found it, so it is refused under
+// noeviction, or when nothing is left to evict
+static db_bool_t core_request_may_grow(DBRequest *request)
+{
+  switch (request->action)
+  {
+  case DB_SET:
+  case DB_MSET:
+  case DB_MSETNX:
+  case DB_INCR:
+  case DB_DECR:
+  case DB_INCRBY:
+  case DB_DECRBY:
+  case DB_INCRBYFLOAT:
+  case DB_APPEND:
+  case DB_SETRANGE:
+  case DB_LPUSH:
+  case DB_RPUSH:
+  case DB_LSET:
+  case DB_LINSERT:
+  case DB_HSET:
+  case DB_HINCRBY:
+  case DB_ZADD:
+  case DB_ZINTERSTORE:
+  case DB_ZUNIONSTORE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Deletes a key to make room, and logs it, so replicas and the replayed log lose it as well
+static void core_evict_entry(DBShard *_shard, DBHashEntry *entry)
+{
+  DBKey key = {.string = entry->key, .length = entry->key_length, .hash = entry->hash};
+
+  if (core_is_logging())
+  {
+    aof_buffer_begin(&_shard->aof_buffer, 2);
+    aof_buffer_append_arg(&_shard->aof_buffer, db_action_name(DB_DEL));
+    aof_buffer_append_arg(&_shard->aof_buffer, entry->key);
+  }
+  _shard->value_contents -= core_value_contents(entry->data);
+  if (atomic_load_explicit(&watch_is_used, memory_order_relaxed))
+    ++_shard->watch_versions[key.hash & (CORE_WATCH_SLOTS - 1)];
+  hdel_key(_shard->main_ht, &key, _shard->expr_ht);
+  ++_shard->evicted_keys;
+}
+
+// Evicts keys of a shard until its data takes at most `limit` bytes; returns false if the policy
+// finds nothing more to evict first. Under volatile-ttl the victim is exact, the top of the timer
+// heap; under LRU and LFU it is the worst of EVICT_SAMPLES entries sampled at random.
+static db_bool_t core_evict(DBShard *_shard, size_t limit)
+{
+  db_maxmemory_policy_t policy = evict_policy();
+  DBHashEntry *samples[EVICT_SAMPLES], *victim;
+  DBTimerHeap *timers = &_shard->expr_ht->timers;
+  uint64_t score, best = 0;
+
+  while (core_shard_memory(_shard) > limit)
+  {
+    victim = NULL;
+    if (policy == DB_MAXMEMORY_VOLATILE_TTL)
+      victim = timers->length ? timers->entries[0] : NULL;
+    else if (policy != DB_MAXMEMORY_NOEVICTION)
+    {
+      db_uint_t length = ht_sample(_shard->main_ht, samples, EVICT_SAMPLES);
+      for (db_uint_t i = 0; i < length; ++i)
+      {
+        score = evict_score(samples[i]->access);
+        if (!victim || score > best)
+        {
+          victim = samples[i];
+          best = score;
+        }
+      }
+    }
+    if (!victim)
+      return false;
+    core_evict_entry(_shard, victim);
+  }
+  return true;
+}
+
+// Every shard gets an equal part of maxmemory, so a worker only ever looks at its own. A replica
+// evicts nothing by itself: its primary sends the deletes it made.
+static db_bool_t core_make_room(DBShard *_shard, DBRequest *request, DBReply *reply)
+{
+  size_t limit = atomic_load_explicit(&maxmemory, memory_order_relaxed);
+  db_bool_t fits = true;
+
+  if (!limit || request->is_from_primary || !core_request_is_write(request))
+    return true;
+
+  limit /= shards_length;
+  if (shards_length > 1 && core_request_is_global(request))
+    for (db_uint_t i = 0; i < shards_length; ++i)
+      fits = core_evict(&shards[i], limit) && fits;
+  else
+    fits = core_evict(_shard, limit);
+
+  if (fits || !core_request_may_grow(request))
+    return true;
+  reply_error(reply, DB_ERR_OOM);
+  return false;
+}
+
+static void core_replay_command(DBRequest *request, void *context)
+{
+  DBReply *reply = create_reply();
+  if (!core_request_is_global(request))
+    core_select_shard(&shards[core_route_key(&request->key)]);
+  core_fault_in(request);
+  core_dispatch(request, reply);
+  free_reply(reply);
+}
+
+static char *core_filepath_with_suffix(const char *filepath, const char *suffix)
+{
+  size_t filepath_length = strlen(filepath);
+  size_t suffix_length = strlen(suffix);
+  char *result = (char *)malloc(filepath_length + suffix_length + 1);
+  if (!result)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(result, filepath, filepath_length);
+  memcpy(result + filepath_length, suffix, suffix_length + 1);
+  return result;
+}
+
+static void core_load_entry(char *key, DBObj *value, uint64_t expire_at_ms, void *context)
+{
+  // Expired keys would only be deleted again on first access.
+  if (expire_at_ms && expire_at_ms <= ht_clock_ms())
+  {
+    free(key);
+    free_dbobj(value);
+    return;
+  }
+
+  DBKey handle = ht_key(key);
+  core_select_shard(&shards[core_route_key(&handle)]);
+  hset_key(main_ht, &handle, value, expr_ht);
+  if (expire_at_ms)
+    ht_expire_key(main_ht, &handle, expire_at_ms, expr_ht);
+  free(key);
+}
+
+static void core_map_record(const char *key, db_uint_t key_length, const uint8_t *record, void *context)
+{
+  // Keys with a deadline are loaded as usual, so the expire cycle finds them in the deadlines.
+  uint64_t expire_at_ms = snapshot_map_expire_at(record);
+  if (expire_at_ms)
+  {
+    if (expire_at_ms > ht_clock_ms())
+      core_load_entry(dbutil_strndup(key, key_length), snapshot_map_decode(record), expire_at_ms, NULL);
+    return;
+  }
+
+  DBKey handle = {.string = key, .length = key_length, .hash = murmurhash2(key, key_length)};
+  DBShard *key_shard = &shards[core_route_key(&handle)];
+  if (!key_shard->mapped)
+    key_shard->mapped = mapped_index_create();
+  mapped_index_insert(key_shard->mapped, key, key_length, record);
+}
+
+static void core_unmap_snapshot()
+{
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    mapped_index_free(shards[i].mapped);
+    shards[i].mapped = NULL;
+  }
+  // Concurrent readers never read the mapping itself, it can go at once.
+  snapshot_unmap(atomic_exchange(&mapped_snapshot, NULL));
+}
+
+// Decodes a key of the mapped snapshot into the keyspace of its shard, whose contents count it
+static void core_fault_in_key(DBShard *_shard, const DBKey *key, const uint8_t *record)
+{
+  DBObj *value = snapshot_map_decode(record);
+  hset_key(_shard->main_ht, key, value, _shard->expr_ht);
+  _shard->value_contents += core_value_contents(value);
+}
+
+// Moves every key of the mapped snapshot to the keyspace, for the commands that walk all of it
+static void core_fault_in_all()
+{
+  DBMappedIndexEntry *entry;
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    DBMappedIndex *index = shards[i].mapped;
+    for (int t = 0; index && t < 2; ++t)
+      for (db_uint_t b = 0; b < index->sizes[t]; ++b)
+        for (entry = index->buckets[t][b]; entry; entry = entry->next)
+        {
+          // Keys in the mapping have no NUL after them.
+          char *key = dbutil_strndup(entry->key, entry->key_length);
+          DBKey handle = {.string = key, .length = entry->key_length, .hash = entry->hash};
+          core_fault_in_key(&shards[i], &handle, entry->value);
+          free(key);
+        }
+  }
+  core_unmap_snapshot();
+}
+
+static void core_fault_in(DBRequest *request)
+{
+  DBListNode *node = request->args ? request->args->head : NULL;
+  db_uint_t last, step, index = 0;
+  const uint8_t *record;
+
+  if (!atomic_load_explicit(&mapped_snapshot, memory_order_relaxed))
+    return;
+  switch (request->action)
+  {
+  // Served straight from the mapping.
+  case DB_GET:
+  case DB_LRANGE:
+  case DB_ZRANGE:
+    return;
+  // Walk or copy the whole keyspace; each runs holding every shard.
+  case DB_SAVE:
+  case DB_BGSAVE:
+  case DB_BGREWRITEAOF:
+  case DB_KEYS:
+  case DB_SCAN:
+  case DB_PSYNC:
+  case DB_CLUSTER_COUNTKEYSINSLOT:
+  case DB_CLUSTER_GETKEYSINSLOT:
+  case DB_SHUTDOWN:
+    core_fault_in_all();
+    return;
+  default:
+    break;
+  }
+
+  if (!core_request_key_range(request, &last, &step))
+    return;
+  for (; node && index <= last; node = node->next, ++index)
+  {
+    if (!core_request_is_key_at(request, node, index, step))
+      continue;
+    DBKey key = index ? ht_key(node->data->value.string) : request->key;
+    DBShard *key_shard = &shards[core_route_key(&key)];
+    if (mapped_index_remove(key_shard->mapped, key.string, &record))
+      core_fault_in_key(key_shard, &key, record);
+  }
+}
+
+// Record of the mapped snapshot a key of the selected shard is served from, NULL if it has none;
+// a key is never both there and in the keyspace
+static const uint8_t *core_mapped_record(const DBKey *key)
+{
+  DBMappedIndexEntry *entry = shard && key->string ? mapped_index_find(shard->mapped, key) : NULL;
+  return entry ? entry->value : NULL;
+}
+
+static void core_reserve_tables(uint64_t key_count, uint64_t expires_count, void *context)
+{
+  // Keys spread evenly over the shards, leave a little room for the unlucky ones.
+  uint64_t keys_per_shard = key_count / shards_length + key_count / (shards_length * 16) + 1;
+  uint64_t expires_per_shard = expires_count / shards_length + expires_count / (shards_length * 16) + 1;
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    ht_reserve(shards[i].main_ht, keys_per_shard < DB_UINT_MAX ? (db_uint_t)keys_per_shard : DB_UINT_MAX);
+    if (expires_count)
+      ht_reserve(shards[i].expr_ht, expires_per_shard < DB_UINT_MAX ? (db_uint_t)expires_per_shard : DB_UINT_MAX);
+  }
+}
+
+static void core_load_chunk(SnapshotEntry *entries, db_uint_t length, void *context)
+{
+  uint64_t now = ht_clock_ms();
+  db_uint_t *routes = (db_uint_t *)malloc(length * sizeof(db_uint_t));
+  db_uint_t seconds;
+  DBHashEntry *entry;
+  DBKey handle;
+  if (!routes)
+    EXIT_ON_MEMORY_ERROR();
+
+  for (db_uint_t i = 0; i < length; ++i)
+  {
+    // Expired keys would only be deleted again on first access.
+    if (entries[i].expire_at_ms && entries[i].expire_at_ms <= now)
+    {
+      free(entries[i].key);
+      free_dbobj(entries[i].value);
+      entries[i].key = NULL;
+      continue;
+    }
+    handle = ht_key(entries[i].key);
+    routes[i] = core_route_key(&handle);
+  }
+
+  for (db_uint_t s = 0; s < shards_length; ++s)
+  {
+    DBShard *_shard = &shards[s];
+    db_bool_t is_locked = false;
+    for (db_uint_t i = 0; i < length; ++i)
+    {
+      if (!entries[i].key || routes[i] != s)
+        continue;
+      if (!is_locked)
+        mtx_lock(&_shard->lock), is_locked = true;
+      // A snapshot is written from hash tables, so none of its keys repeat.
+      entry = ht_bulk_insert(_shard->main_ht, entries[i].key, entries[i].value);
+      if (entries[i].expire_at_ms)
+      {
+        seconds = entries[i].expire_at_ms / 1000 < DB_UINT_MAX ? (db_uint_t)(entries[i].expire_at_ms / 1000) : DB_UINT_MAX;
+        ht_bulk_insert(_shard->expr_ht, dbutil_strdup(entry->key), dbobj_create_uint(seconds));
+        entry->expire_at_ms = entries[i].expire_at_ms;
+        ht_timer_track(_shard->expr_ht, entry);
+      }
+    }
+    if (is_locked)
+      mtx_unlock(&_shard->lock);
+  }
+
+  free(routes);
+}
+
+static DBObj *core_obj_from_json(cJSON *json, db_type_t type)
+{
+  cJSON *item;
+  double score;
+
+  switch (type)
+  {
+  case DB_TYPE_STRING:
+    return cJSON_IsString(json) ? dbobj_create_stored_string(cJSON_GetStringValue(json)) : NULL;
+  case DB_TYPE_LIST:
+  {
+    if (!cJSON_IsArray(json))
+      return NULL;
+    DBQuickList *list = ql_create();
+    cJSON_ArrayForEach(item, json)
+    {
+      if (cJSON_IsString(item))
+        ql_rpush(list, cJSON_GetStringValue(item));
+    }
+    return dbobj_create_quicklist(list);
+  }
+  case DB_TYPE_HASH:
+  {
+    if (!cJSON_IsObject(json))
+      return NULL;
+    DBObj *hash = hashobj_create();
+    cJSON_ArrayForEach(item, json)
+    {
+      if (item->string && cJSON_IsString(item))
+        hashobj_set(hash, item->string, cJSON_GetStringValue(item));
+    }
+    return hash;
+  }
+  case DB_TYPE_ZSET:
+  {
+    if (!cJSON_IsObject(json))
+      return NULL;
+    DBZSet *zset = zset_create();
+    DBZSetPair *pairs = (DBZSetPair *)malloc((cJSON_GetArraySize(json) + 1) * sizeof(DBZSetPair));
+    if (!pairs)
+      EXIT_ON_MEMORY_ERROR();
+    db_uint_t length = 0;
+    cJSON_ArrayForEach(item, json)
+    {
+      if (!item->string)
+        continue;
+      if (cJSON_IsNumber(item))
+        score = cJSON_GetNumberValue(item);
+      else if (cJSON_IsString(item))
+        score = strtod(cJSON_GetStringValue(item), NULL);
+      else
+        continue;
+      pairs[length++] = (DBZSetPair){.member = item->string, .length = strlen(item->string), .score = score};
+    }
+    zadd_bulk(zset, pairs, length);
+    free(pairs);
+    return dbobj_create_zset(zset);
+  }
+  default:
+    return NULL;
+  }
+}
+
+static db_bool_t core_load_json(const char *filepath)
+{
+  FILE *file = fopen(filepath, "r");
+  if (!file)
+    return false;
+
+  // Only one key is parsed at a time, so the file never has to fit in memory whole, and into an
+  // arena that is rewound for the next one instead of freeing every node.
+  cJSON_Stream *stream = cJSON_StreamNewFromFile(file);
+  cJSON_Arena *arena = cJSON_ArenaNew(0);
+  if (!arena)
+    EXIT_ON_MEMORY_ERROR();
+  cJSON_Arena *previous_arena = cJSON_ArenaUse(arena);
+  cJSON *cjson_cursor, *type_item, *deadline_item;
+  const char *type_name;
+  db_type_t type;
+  uint64_t expire_at_ms;
+  DBObj *value;
+
+  while ((cjson_cursor = cJSON_StreamNextMember(stream)))
+  {
+    expire_at_ms = 0;
+    value = NULL;
+
+    if (cJSON_IsString(cjson_cursor))
+      value = core_obj_from_json(cjson_cursor, DB_TYPE_STRING);
+    else if (cJSON_IsArray(cjson_cursor))
+      value = core_obj_from_json(cjson_cursor, DB_TYPE_LIST);
+    else if (cJSON_IsObject(cjson_cursor))
+    {
+      // Anything but a plain string or list is wrapped with its type and deadline.
+      type_item = cJSON_GetObjectItemCaseSensitive(cjson_cursor, "type");
+      type_name = cJSON_IsString(type_item) ? cJSON_GetStringValue(type_item) : "";
+      type = strcmp(type_name, "string") == 0 ? DB_TYPE_STRING
+             : strcmp(type_name, "list") == 0 ? DB_TYPE_LIST
+             : strcmp(type_name, "hash") == 0 ? DB_TYPE_HASH
+             : strcmp(type_name, "zset") == 0 ? DB_TYPE_ZSET
+                                               : DB_TYPE_NULL;
+      value = core_obj_from_json(cJSON_GetObjectItemCaseSensitive(cjson_cursor, "value"), type);
+      deadline_item = cJSON_GetObjectItemCaseSensitive(cjson_cursor, "expire_at_ms");
+      if (cJSON_IsNumber(deadline_item) && cJSON_GetNumberValue(deadline_item) > 0)
+        expire_at_ms = (uint64_t)cJSON_GetNumberValue(deadline_item);
+    }
+
+    if (value)
+      core_load_entry(dbutil_strdup(cjson_cursor->string), value, expire_at_ms, NULL);
+
+    cJSON_ArenaReset(arena);
+  }
+  cJSON_ArenaUse(previous_arena);
+  cJSON_ArenaDelete(arena);
+
+  if (cJSON_StreamFailed(stream))
+  {
+    // Never serve half a dataset, as with a snapshot that fails to load.
+    fprintf(stderr, "Failed to load %s, starting with an empty dataset.\n", filepath);
+    db_flushall(NULL, NULL);
+  }
+  cJSON_StreamDelete(stream);
+  fclose(file);
+  return true;
+}
+
+void db_start()
+{
+  if (is_running)
+    return;
+
+  srand(time(NULL));
+
+  core_join_workers();
+  core_init_shards();
+
+  is_running = true;
+
+  db_flushall(NULL, NULL);
+
+  db_config_hash_seed(hash_seed);
+  if (!persistence_filepath)
+    db_config_persistence_filepath(persistence_format == DB_PERSISTENCE_JSON ? DEFAULT_PERSISTENCE_FILE : DEFAULT_SNAPSHOT_FILE);
+
+  // load data
+  SnapshotMap *map = mapped_load_enabled ? snapshot_map(persistence_filepath, core_map_record, NULL) : NULL;
+  if (map)
+    atomic_store(&mapped_snapshot, map);
+  else if (snapshot_is_snapshot_file(persistence_filepath))
+  {
+    // Whatever a mapping that failed part way indexed goes, and the file is read as usual.
+    if (mapped_load_enabled)
+      db_flushall(NULL, NULL);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    db_uint_t threads = cpus < 1 ? 1 : cpus < CORE_SNAPSHOT_LOAD_THREADS ? (db_uint_t)cpus : CORE_SNAPSHOT_LOAD_THREADS;
+    if (!snapshot_load_parallel(persistence_filepath, threads, core_reserve_tables, core_load_chunk, NULL))
+    {
+      // Never serve half a snapshot.
+      fprintf(stderr, "Failed to load snapshot %s, starting with an empty dataset.\n", persistence_filepath);
+      db_flushall(NULL, NULL);
+    }
+  }
+  else if (!core_load_json(persistence_filepath) && strcmp(persistence_filepath, DEFAULT_SNAPSHOT_FILE) == 0)
+  {
+    // Pick up the dataset of a version that only wrote JSON, the next save converts it.
+    core_load_json(DEFAULT_PERSISTENCE_FILE);
+  }
+
+  if (aof_enabled)
+  {
+    if (!aof_filepath)
+      db_config_aof_filepath(DEFAULT_AOF_FILE);
+    char *rotated_filepath = core_filepath_with_suffix(aof_filepath, AOF_ROTATED_SUFFIX);
+    char *rewrite_filepath = core_filepath_with_suffix(aof_filepath, AOF_REWRITE_SUFFIX);
+
+    // A rewrite that was cut off is incomplete, the log it was replacing is still in place.
+    remove(rewrite_filepath);
+    // The log rotated away by a save that never finished comes before the current one.
+    db_bool_t has_rotated = aof_load(rotated_filepath, core_replay_command, NULL);
+    aof_load(aof_filepath, core_replay_command, NULL);
+
+    aof = aof_open(aof_filepath, aof_fsync);
+    if (has_rotated)
+      aof_absorb(aof, rotated_filepath);
+
+    free(rotated_filepath);
+    free(rewrite_filepath);
+  }
+  core_recount_contents();
+
+  core_select_shard(NULL);
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    thrd_create(&shards[i].worker_thread, core_worker, &shards[i]);
+    shards[i].has_worker = true;
+  }
+}
+
+db_bool_t db_is_running()
+{
+  return is_running;
+}
+
+void db_config_hash_seed(db_uint_t _hash_seed)
+{
+  hash_seed = _hash_seed ? _hash_seed : (db_uint_t)time(NULL);
+}
+
+void db_config_shard_count(db_uint_t _shard_count)
+{
+  // Keys are routed by hash, so the count can't change under a running database.
+  if (is_running)
+    return;
+  shard_count = _shard_count ? _shard_count : 1;
+}
+
+void db_config_persistence_filepath(const char *_persistence_filepath)
+{
+  free(persistence_filepath);
+  persistence_filepath = dbutil_strdup(_persistence_filepath);
+}
+
+void db_config_aof_enabled(db_bool_t _aof_enabled)
+{
+  aof_enabled = _aof_enabled;
+}
+
+void db_config_aof_filepath(const char *_aof_filepath)
+{
+  // The open log keeps its own copy of the path until the database stops.
+  free(aof_filepath);
+  aof_filepath = dbutil_strdup(_aof_filepath);
+}
+
+void db_config_aof_fsync(db_aof_fsync_t _aof_fsync)
+{
+  aof_fsync = _aof_fsync;
+}
+
+void db_config_persistence_format(db_persistence_format_t _persistence_format)
+{
+  persistence_format = _persistence_format;
+}
+
+void db_config_queue_capacity(db_uint_t _queue_capacity)
+{
+  queue_capacity = _queue_capacity ? _queue_capacity : DEFAULT_TASK_QUEUE_CAPACITY;
+}
+
+void db_config_queue_policy(db_queue_policy_t _queue_policy)
+{
+  queue_policy = _queue_policy;
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    if (shards[i].task_queue)
+      shards[i].task_queue->policy = _queue_policy;
+}
+
+void db_config_list_block_size(db_uint_t _list_block_size)
+{
+  ql_block_size = _list_block_size ? _list_block_size : QL_DEFAULT_BLOCK_SIZE;
+}
+
+void db_config_zset_packed(db_uint_t _max_members, db_uint_t _max_length)
+{
+  zset_packed_max_members = _max_members;
+  zset_packed_max_length = _max_length;
+}
+
+void db_config_hash_packed(db_uint_t _max_fields, db_uint_t _max_length)
+{
+  hash_packed_max_fields = _max_fields;
+  hash_packed_max_length = _max_length;
+}
+
+void db_config_worker_idle(db_uint_t _busy_poll_us, db_bool_t _pin_workers)
+{
+  atomic_store(&busy_poll_us, _busy_poll_us);
+  pin_workers = _pin_workers;
+}
+
+void db_config_mapped_load(db_bool_t _mapped_load_enabled)
+{
+  mapped_load_enabled = _mapped_load_enabled;
+}
+
+void db_config_key_index(db_bool_t _key_index_enabled)
+{
+  key_index_enabled = _key_index_enabled;
+}
+
+void db_config_slowlog(db_int_t _threshold_us, db_uint_t _max_length)
+{
+  slowlog_config(_threshold_us, _max_length);
+}
+
+void db_config_cluster_enabled(db_bool_t _cluster_enabled)
+{
+  cluster_config_enabled(_cluster_enabled);
+}
+
+void db_config_concurrent_reads(db_bool_t _concurrent_reads_enabled)
+{
+  if (_concurrent_reads_enabled == concurrent_reads_enabled)
+    return;
+
+  // Readers only get in once every table is ready for them, and are out before any stops being.
+  if (!_concurrent_reads_enabled)
+  {
+    atomic_store(&concurrent_reads_enabled, false);
+    epoch_synchronize();
+  }
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    mtx_lock(&shards[i].lock);
+    ht_config_concurrent_reads(shards[i].main_ht, _concurrent_reads_enabled);
+    mtx_unlock(&shards[i].lock);
+  }
+  if (_concurrent_reads_enabled)
+    atomic_store(&concurrent_reads_enabled, true);
+}
+
+void db_config_maxmemory(size_t _maxmemory, db_maxmemory_policy_t policy)
+{
+  evict_config_policy(policy);
+  atomic_store(&maxmemory, _maxmemory);
+}
+
+void db_config_pages_mode(db_pages_mode_t mode)
+{
+  pages_config_mode(mode);
+}
+
+// Serves a GET on the calling thread, see db_config_concurrent_reads; returns false if the shard
+// has to serve it
+static db_bool_t core_read_concurrent(DBRequest *request, DBReply *reply)
+{
+  DBObj *value;
+
+  // Redirects are worked out by the shard, along with everything else a cluster node checks.
+  if (request->action != DB_GET || !atomic_load_explicit(&concurrent_reads_enabled, memory_order_relaxed) ||
+      cluster_is_enabled())
+    return false;
+  if (!ht_read_concurrent(shards[core_route_key(&request->key)].main_ht, &request->key, &value))
+    return false;
+  // A key missing from the keyspace may still be in the mapped snapshot, which the shard reads.
+  if (!value && atomic_load_explicit(&mapped_snapshot, memory_order_relaxed))
+    return false;
+
+  // A key of another type reads as null, as db_get has it.
+  if (value && value->type != DB_TYPE_STRING)
+  {
+    free_dbobj(value);
+    value = NULL;
+  }
+  reply_data(reply, value ? value : dbobj_shared_null());
+  atomic_fetch_add_explicit(&concurrent_reads_served, 1, memory_order_relaxed);
+  return true;
+}
+
+DBReply *db_handle_request(DBRequest *request)
+{
+  DBReply *reply = create_reply();
+
+  if (!is_running)
+  {
+    reply_error(reply, DB_ERR_DB_IS_CLOSED);
+    return reply_done(reply);
+  }
+
+  // A request the handler would turn down never takes a slot in the queue.
+  if (!db_action_accepts(request->action, request->args ? request->args->length : 0))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return reply_done(reply);
+  }
+
+  // The state of MULTI and WATCH is kept by the pipeline of the client.
+  if (request->action == DB_MULTI || request->action == DB_EXEC || request->action == DB_DISCARD ||
+      request->action == DB_WATCH || request->action == DB_UNWATCH)
+  {
+    reply_error(reply, DB_ERR_TRANSACTION_NEEDS_PIPELINE);
+    return reply_done(reply);
+  }
+
+  if (core_read_concurrent(request, reply))
+    return reply_done(reply);
+
+  if (shards_length > 1 && core_request_is_global(request))
+  {
+    core_submit_global(request, reply);
+    return reply;
+  }
+
+  DBTask task = {.created_at = latency_now_ns(), .request = request, .reply = reply, .context = NULL, .batch = NULL};
+
+  if (!queue_push(shards[core_route_key(&request->key)].task_queue, &task))
+  {
+    reply_error(reply, DB_ERR_QUEUE_FULL);
+    return reply_done(reply);
+  }
+
+  return reply;
+}
+
+static void core_batch_append(DBBatch **batch, DBRequest *request, DBReply *reply)
+{
+  if (!*batch)
+  {
+    *batch = (DBBatch *)calloc(1, sizeof(DBBatch));
+    if (!*batch)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  if ((*batch)->length == (*batch)->capacity)
+  {
+    (*batch)->capacity = (*batch)->capacity ? (*batch)->capacity * 2 : 16;
+    (*batch)->requests = (DBRequest **)realloc((*batch)->requests, (*batch)->capacity * sizeof(DBRequest *));
+    (*batch)->replies = (DBReply **)realloc((*batch)->replies, (*batch)->capacity * sizeof(DBReply *));
+    if (!(*batch)->requests || !(*batch)->replies)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  (*batch)->requests[(*batch)->length] = request;
+  (*batch)->replies[(*batch)->length] = reply;
+  ++(*batch)->length;
+}
+
+static void core_batch_free(DBBatch *batch)
+{
+  if (!batch)
+    return;
+  free(batch->requests);
+  free(batch->replies);
+  free(batch);
+}
+
+static void core_submit_batches(DBBatch **batches)
+{
+  DBTask task = {.created_at = latency_now_ns(), .request = NULL, .reply = NULL, .context = NULL};
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    if (!batches[i])
+      continue;
+    task.batch = batches[i];
+    if (!queue_push(shards[i].task_queue, &task))
+    {
+      for (db_uint_t j = 0; j < batches[i]->length; ++j)
+        reply_done(reply_error(batches[i]->replies[j], DB_ERR_QUEUE_FULL));
+      core_batch_free(batches[i]);
+    }
+    batches[i] = NULL;
+  }
+}
+
+// Answers MULTI, DISCARD and UNWATCH, and the commands sent after MULTI, which are queued
+// rather than submitted; WATCH is submitted on its own and waited for, as what comes after it has
+// to see the versions it takes. Readies EXEC to take the transaction to the core. Returns whether
+// the request is taken care of
+static db_bool_t core_handle_transaction(DBPipeline *pipeline, db_uint_t index, DBBatch **batches, db_bool_t *has_barrier)
+{
+  DBRequest *request = pipeline->requests[index];
+  DBReply *reply = pipeline->replies[index];
+  DBTransaction *transaction = pipeline->transaction;
+  db_bool_t is_queuing = transaction && transaction->is_queuing;
+  db_uint_t argc = request->args ? request->args->length : 0;
+
+  switch (request->action)
+  {
+  case DB_MULTI:
+    if (is_queuing)
+    {
+      reply_done(reply_error(reply, DB_ERR_MULTI_NESTED));
+      return true;
+    }
+    if (!transaction)
+      transaction = pipeline->transaction = transaction_create();
+    transaction->is_queuing = true;
+    reply_done(reply_data(reply, dbobj_shared_ok()));
+    return true;
+  case DB_DISCARD:
+    if (!is_queuing)
+    {
+      reply_done(reply_error(reply, DB_ERR_DISCARD_WITHOUT_MULTI));
+      return true;
+    }
+    transaction_discard(transaction);
+    transaction_unwatch(transaction);
+    reply_done(reply_data(reply, dbobj_shared_ok()));
+    return true;
+  case DB_UNWATCH:
+    // Queued after MULTI, where EXEC forgets the watched keys anyway.
+    if (is_queuing)
+      break;
+    if (transaction)
+      transaction_unwatch(transaction);
+    reply_done(reply_data(reply, dbobj_shared_ok()));
+    return true;
+  case DB_WATCH:
+    if (is_queuing)
+    {
+      reply_done(reply_error(reply, DB_ERR_WATCH_INSIDE_MULTI));
+      return true;
+    }
+    if (!db_action_accepts(request->action, argc))
+      return false;
+    for (DBListNode *node = request->args->head; node; node = node->next)
+      if (!get_string_arg(node))
+        return false;
+    if (!transaction)
+      transaction = pipeline->transaction = transaction_create();
+    for (DBListNode *node = request->args->head; node; node = node->next)
+      transaction_watch(transaction, get_string_arg(node));
+    request->transaction = transaction;
+
+    core_submit_batches(batches);
+    if (shards_length > 1 && core_request_is_global(request))
+      core_submit_global(request, reply);
+    else
+    {
+      core_batch_append(&batches[core_route_key(&request->key)], request, reply);
+      core_submit_batches(batches);
+    }
+    reply_wait(reply);
+    if (dbobj_is_error(reply->data))
+      while (argc--)
+        free(transaction->watched[--transaction->watched_length].key);
+    *has_barrier = true;
+    return true;
+  case DB_EXEC:
+    if (!is_queuing)
+    {
+      reply_done(reply_error(reply, DB_ERR_EXEC_WITHOUT_MULTI));
+      return true;
+    }
+    if (transaction->is_aborted)
+    {
+      transaction_discard(transaction);
+      transaction_unwatch(transaction);
+      reply_done(reply_error(reply, DB_ERR_EXECABORT));
+      return true;
+    }
+    // The request owns the transaction from here, the next MULTI or WATCH starts another one.
+    transaction->is_queuing = false;
+    request->transaction = transaction;
+    pipeline->transaction = NULL;
+    core_route_transaction(request);
+    return false;
+  default:
+    break;
+  }
+
+  if (!is_queuing)
+    return false;
+  // A command EXEC would refuse makes it discard the whole transaction, as in Redis.
+  if (!db_action_accepts(request->action, argc))
+  {
+    transaction->is_aborted = true;
+    reply_done(reply_error(reply, DB_ERR_ARG_ERROR));
+    return true;
+  }
+  transaction_queue(transaction, request);
+  // The pipeline keeps a bare MULTI in its place, whose reply is a status as well.
+  pipeline->requests[index] = create_request(DB_MULTI);
+  reply_done(reply_data(reply, dbobj_create_string_with_dup(QUEUED)));
+  return true;
+}
+
+void db_handle_pipeline(DBPipeline *pipeline)
+{
+  DBRequest *request;
+  DBReply *reply;
+  // Set once a barrier is queued, which every later request has to stay behind
+  db_bool_t has_barrier = false;
+
+  for (db_uint_t i = 0; i < pipeline->length; ++i)
+    pipeline->replies[i] = create_reply();
+
+  if (!is_running)
+  {
+    for (db_uint_t i = 0; i < pipeline->length; ++i)
+      reply_done(reply_error(pipeline->replies[i], DB_ERR_DB_IS_CLOSED));
+    return;
+  }
+
+  DBBatch **batches = (DBBatch **)calloc(shards_length, sizeof(DBBatch *));
+  if (!batches)
+    EXIT_ON_MEMORY_ERROR();
+
+  for (db_uint_t i = 0; i < pipeline->length; ++i)
+  {
+    if (core_handle_transaction(pipeline, i, batches, &has_barrier))
+      continue;
+    request = pipeline->requests[i];
+    reply = pipeline->replies[i];
+    if (!db_action_accepts(request->action, request->args ? request->args->length : 0))
+    {
+      reply_done(reply_error(reply, DB_ERR_ARG_ERROR));
+      continue;
+    }
+    if (shards_length > 1 && core_request_is_global(request))
+    {
+      // Queue what came before first, so every shard still sees the pipeline in order.
+      core_submit_batches(batches);
+      core_submit_global(request, reply);
+      has_barrier = true;
+      continue;
+    }
+    db_uint_t shard_index = core_route_key(&request->key);
+    // A read may only pass the queue if nothing of the pipeline waits in it on the same shard.
+    if (!has_barrier && !batches[shard_index] && core_read_concurrent(request, reply))
+    {
+      reply_done(reply);
+      continue;
+    }
+    core_batch_append(&batches[shard_index], request, reply);
+  }
+  core_submit_batches(batches);
+
+  free(batches);
+}
+
+static void core_submit_global(DBRequest *request, DBReply *reply)
+{
+  DBBarrier *barrier = (DBBarrier *)calloc(1, sizeof(DBBarrier));
+  if (!barrier)
+    EXIT_ON_MEMORY_ERROR();
+  mtx_init(&barrier->lock, mtx_plain);
+  cnd_init(&barrier->cond);
+
+  DBTask task = {.created_at = latency_now_ns(), .request = request, .reply = reply, .context = barrier, .batch = NULL};
+
+  call_once(&barrier_submit_lock_once, barrier_submit_lock_init);
+  // A barrier is never rejected, a half queued barrier would stall the shards that got it.
+  mtx_lock(&barrier_submit_lock);
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    queue_push_blocking(shards[i].task_queue, &task);
+  mtx_unlock(&barrier_submit_lock);
+}
+
+static void core_run_barrier(DBShard *_shard, DBTask *task)
+{
+  DBBarrier *barrier = (DBBarrier *)task->context;
+  db_bool_t is_last;
+
+  mtx_lock(&barrier->lock);
+  is_last = ++barrier->arrived == shards_length;
+
+  if (is_last)
+  {
+    mtx_unlock(&barrier->lock);
+
+    // Every other worker is parked on this barrier, take their shards.
+    for (db_uint_t i = 0; i < shards_length; ++i)
+      if (&shards[i] != _shard)
+        mtx_lock(&shards[i].lock);
+    if (is_running)
+    {
+      // Whatever the shards served before the barrier goes to the log ahead of it.
+      core_flush_aof_all();
+      core_dispatch_timed(_shard, task->request, task->reply, task->created_at, latency_now_ns());
+      core_feed_aof(_shard, task->request, task->reply);
+      for (db_uint_t i = 0; i < shards_length; ++i)
+        core_serve_blocked(&shards[i]);
+      core_flush_aof_all();
+    }
+    else
+      reply_error(task->reply, DB_ERR_DB_IS_CLOSED);
+    for (db_uint_t i = 0; i < shards_length; ++i)
+      if (&shards[i] != _shard)
+        mtx_unlock(&shards[i].lock);
+    core_select_shard(_shard);
+    if (!core_take_deferred_reply())
+      reply_done(task->reply);
+
+    mtx_lock(&barrier->lock);
+    barrier->done = true;
+    cnd_broadcast(&barrier->cond);
+  }
+  else if (is_running)
+  {
+    while (!barrier->done)
+      cnd_wait(&barrier->cond, &barrier->lock);
+  }
+
+  // A worker draining a stopped shard doesn't wait, the last one to arrive answers the request.
+  is_last = ++barrier->released == shards_length;
+  mtx_unlock(&barrier->lock);
+
+  if (is_last)
+  {
+    cnd_destroy(&barrier->cond);
+    mtx_destroy(&barrier->lock);
+    free(barrier);
+  }
+}
+
+// Runs a request that was queued at `created_at` and taken up at `started_at`, records how long
+// it waited and ran in the stats of `_shard` and the slow log; returns when it finished
+static uint64_t core_dispatch_timed(DBShard *_shard, DBRequest *request, DBReply *reply, uint64_t created_at, uint64_t started_at)
+{
+  // A replica only changes along with its primary, or it would stop being a copy of it.
+  if (core_request_is_write(request) && !request->is_from_primary && repl_is_replica())
+    reply_error(reply, DB_ERR_READONLY);
+  else if (core_cluster_check(request, reply) && core_make_room(_shard, request, reply))
+  {
+    core_fault_in(request);
+    db_bool_t is_write = core_request_is_write(request);
+    if (is_write)
+    {
+      core_unshare_keys(request);
+      core_account_keys(request, false);
+    }
+    core_dispatch(request, reply);
+    if (is_write)
+    {
+      core_account_keys(request, true);
+      core_touch_keys(request);
+    }
+    if (request->key.string)
+      core_sample_key(request, reply, is_write);
+  }
+  uint64_t finished_at = latency_now_ns();
+
+  DBCommandStats **stats = &_shard->command_stats[request->action];
+  if (!*stats)
+  {
+    *stats = (DBCommandStats *)calloc(1, sizeof(DBCommandStats));
+    if (!*stats)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  latency_record(&(*stats)->queue, started_at > created_at ? started_at - created_at : 0);
+  latency_record(&(*stats)->exec, finished_at - started_at);
+  slowlog_record(request, finished_at - started_at);
+  if (TRACE_IS_ON())
+    trace_record(TRACE_DISPATCH, started_at, request->action);
+  return finished_at;
+}
+
+static void core_dispatch(DBRequest *request, DBReply *reply)
+{
+  switch (request->action)
+  {
+  case DB_PING:
+    db_ping(request, reply);
+    break;
+  case DB_GET:
+    db_get(request, reply);
+    break;
+  case DB_SET:
+    db_set(request, reply);
+    break;
+  case DB_MGET:
+    db_mget(request, reply);
+    break;
+  case DB_MSET:
+    db_mset(request, reply);
+    break;
+  case DB_MSETNX:
+    db_msetnx(request, reply);
+    break;
+  case DB_INCR:
+    db_incr(request, reply);
+    break;
+  case DB_DECR:
+    db_decr(request, reply);
+    break;
+  case DB_INCRBY:
+    db_incrby(request, reply);
+    break;
+  case DB_DECRBY:
+    db_decrby(request, reply);
+    break;
+  case DB_INCRBYFLOAT:
+    db_incrbyfloat(request, reply);
+    break;
+  case DB_APPEND:
+    db_append(request, reply);
+    break;
+  case DB_STRLEN:
+    db_strlen(request, reply);
+    break;
+  case DB_GETRANGE:
+    db_getrange(request, reply);
+    break;
+  case DB_SETRANGE:
+    db_setrange(request, reply);
+    break;
+  case DB_EXEC:
+    db_exec(request, reply);
+    break;
+  case DB_UNWATCH:
+    // Only ever run queued in a transaction, whose watched keys EXEC checked already.
+    reply_data(reply, dbobj_shared_ok());
+    break;
+  case DB_WATCH:
+    db_watch(request, reply);
+    break;
+  case DB_RENAME:
+    db_rename(request, reply);
+    break;
+  case DB_DEL:
+    db_del(request, reply);
+    break;
+  case DB_UNLINK:
+    db_unlink(request, reply);
+    break;
+  case DB_LPUSH:
+    db_lpush(request, reply);
+    break;
+  case DB_LPOP:
+    db_lpop(request, reply);
+    break;
+  case DB_RPUSH:
+    db_rpush(request, reply);
+    break;
+  case DB_RPOP:
+    db_rpop(request, reply);
+    break;
+  case DB_BLPOP:
+    db_blpop(request, reply);
+    break;
+  case DB_BRPOP:
+    db_brpop(request, reply);
+    break;
+  case DB_LLEN:
+    db_llen(request, reply);
+    break;
+  case DB_LRANGE:
+    db_lrange(request, reply);
+    break;
+  case DB_LINDEX:
+    db_lindex(request, reply);
+    break;
+  case DB_LSET:
+    db_lset(request, reply);
+    break;
+  case DB_LINSERT:
+    db_linsert(request, reply);
+    break;
+  case DB_HGET:
+    db_hget(request, reply);
+    break;
+  case DB_HSET:
+    db_hset(request, reply);
+    break;
+  case DB_HDEL:
+    db_hdel(request, reply);
+    break;
+  case DB_HMGET:
+    db_hmget(request, reply);
+    break;
+  case DB_HGETALL:
+    db_hgetall(request, reply);
+    break;
+  case DB_HINCRBY:
+    db_hincrby(request, reply);
+    break;
+  case DB_HSCAN:
+    db_hscan(request, reply);
+    break;
+  case DB_EXPIRE:
+    db_expire(request, reply);
+    break;
+  case DB_EXPIREAT:
+    db_expireat(request, reply);
+    break;
+  case DB_PEXPIRE:
+    db_pexpire(request, reply);
+    break;
+  case DB_PEXPIREAT:
+    db_pexpireat(request, reply);
+    break;
+  case DB_TTL:
+    db_ttl(request, reply);
+    break;
+  case DB_PTTL:
+    db_pttl(request, reply);
+    break;
+  case DB_ZADD:
+    db_zadd(request, reply);
+    break;
+  case DB_ZSCORE:
+    db_zscore(request, reply);
+    break;
+  case DB_ZCARD:
+    db_zcard(request, reply);
+    break;
+  case DB_ZCOUNT:
+    db_zcount(request, reply);
+    break;
+  case DB_ZRANGE:
+    db_zrange(request, reply);
+    break;
+  case DB_ZRANGEBYSCORE:
+    db_zrangebyscore(request, reply);
+    break;
+  case DB_ZRANK:
+    db_zrank(request, reply);
+    break;
+  case DB_ZREVRANGE:
+    db_zrevrange(request, reply);
+    break;
+  case DB_ZREVRANK:
+    db_zrevrank(request, reply);
+    break;
+  case DB_ZREM:
+    db_zrem(request, reply);
+    break;
+  case DB_ZREMRANGEBYSCORE:
+    db_zremrangebyscore(request, reply);
+    break;
+  case DB_ZSCAN:
+    db_zscan(request, reply);
+    break;
+  case DB_ZINTERSTORE:
+    db_zinterstore(request, reply);
+    break;
+  case DB_ZUNIONSTORE:
+    db_zunionstore(request, reply);
+    break;
+  case DB_KEYS:
+    db_keys(request, reply);
+    break;
+  case DB_SCAN:
+    db_scan(request, reply);
+    break;
+  case DB_FLUSHALL:
+    db_flushall(request, reply);
+    break;
+  case DB_INFO_DATASET_MEMORY:
+    db_info_dataset_memory(request, reply);
+    break;
+  case DB_MEMORY_USAGE:
+    db_memory_usage(request, reply);
+    break;
+  case DB_MEMORY_STATS:
+    db_memory_stats(request, reply);
+    break;
+  case DB_SAVE:
+    db_save(request, reply);
+    break;
+  case DB_BGSAVE:
+    db_bgsave(request, reply);
+    break;
+  case DB_LASTSAVE:
+    db_lastsave(request, reply);
+    break;
+  case DB_BGREWRITEAOF:
+    db_bgrewriteaof(request, reply);
+    break;
+  case DB_INFO_PERSISTENCE:
+    db_info_persistence(request, reply);
+    break;
+  case DB_INFO_STATS:
+    db_info_stats(request, reply);
+    break;
+  case DB_INFO_COMMANDSTATS:
+    db_info_commandstats(request, reply);
+    break;
+  case DB_SLOWLOG_GET:
+    db_slowlog_get(request, reply);
+    break;
+  case DB_SLOWLOG_LEN:
+    db_slowlog_len(request, reply);
+    break;
+  case DB_SLOWLOG_RESET:
+    db_slowlog_reset(request, reply);
+    break;
+  case DB_HOTKEYS_GET:
+    db_hotkeys_get(request, reply);
+    break;
+  case DB_HOTKEYS_BYTES:
+    db_hotkeys_bytes(request, reply);
+    break;
+  case DB_HOTKEYS_RESET:
+    db_hotkeys_reset(request, reply);
+    break;
+  case DB_TRACE_START:
+    db_trace_start(request, reply);
+    break;
+  case DB_TRACE_STOP:
+    db_trace_stop(request, reply);
+    break;
+  case DB_TRACE_GET:
+    db_trace_get(request, reply);
+    break;
+  case DB_REPLICAOF:
+    db_replicaof(request, reply);
+    break;
+  case DB_PSYNC:
+    db_psync(request, reply);
+    break;
+  case DB_REPLICA_LOAD:
+    db_replica_load(request, reply);
+    break;
+  case DB_INFO_REPLICATION:
+    db_info_replication(request, reply);
+    break;
+  case DB_CLUSTER_KEYSLOT:
+    db_cluster_keyslot(request, reply);
+    break;
+  case DB_CLUSTER_ADDSLOTS:
+    db_cluster_addslots(request, reply);
+    break;
+  case DB_CLUSTER_SETSLOT:
+    db_cluster_setslot(request, reply);
+    break;
+  case DB_CLUSTER_SLOTS:
+    db_cluster_slots(request, reply);
+    break;
+  case DB_CLUSTER_COUNTKEYSINSLOT:
+    db_cluster_countkeysinslot(request, reply);
+    break;
+  case DB_CLUSTER_GETKEYSINSLOT:
+    db_cluster_getkeysinslot(request, reply);
+    break;
+  case DB_ASKING:
+    db_asking(request, reply);
+    break;
+  case DB_MIGRATE:
+    db_migrate(request, reply);
+    break;
+  case DB_SHUTDOWN:
+    db_shutdown(request, reply);
+    break;
+  default:
+    reply_error(reply, DB_ERR_UNKNOWN_COMMAND);
+    break;
+  }
+}
+
+static uint64_t core_now_us()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void core_expire_cycle(DBShard *_shard)
+{
+  _shard->expire_is_behind = false;
+  if (!(expr_ht->count0 + expr_ht->count1))
+    return;
+
+  uint64_t started_at = core_now_us();
+  uint64_t elapsed_us;
+  db_uint_t expired;
+  db_bool_t has_more;
+
+  // The timer heap hands out due keys only, so a short batch means none are left.
+  do
+  {
+    expired = ht_expire_due(main_ht, expr_ht, CORE_EXPIRE_BATCH);
+    _shard->expired_keys += expired;
+    has_more = expired == CORE_EXPIRE_BATCH;
+    elapsed_us = core_now_us() - started_at;
+  } while (has_more && elapsed_us < CORE_EXPIRE_CYCLE_BUDGET_US);
+
+  _shard->expire_cycle_us += elapsed_us;
+  if (has_more)
+  {
+    _shard->expire_is_behind = true;
+    ++_shard->expire_time_cap_reached;
+  }
+}
+
+static db_bool_t core_rehash_idle(DBShard *_shard)
+{
+  mtx_lock(&_shard->lock);
+  if (_shard->main_ht->rehashing_index == -1 && _shard->expr_ht->rehashing_index == -1)
+  {
+    mtx_unlock(&_shard->lock);
+    return false;
+  }
+
+  uint64_t started_at = core_now_us();
+  // Whatever of the budget the main table leaves goes to the expires table.
+  ht_rehash_for(_shard->main_ht, CORE_REHASH_IDLE_BUDGET_US * 1000);
+  uint64_t elapsed_us = core_now_us() - started_at;
+  if (elapsed_us < CORE_REHASH_IDLE_BUDGET_US)
+    ht_rehash_for(_shard->expr_ht, (CORE_REHASH_IDLE_BUDGET_US - elapsed_us) * 1000);
+  _shard->rehash_idle_us += core_now_us() - started_at;
+  mtx_unlock(&_shard->lock);
+  return true;
+}
+
+static void core_maintain_shard(DBShard *_shard)
+{
+  ht_update_clock();
+  core_expire_cycle(_shard);
+  epoch_reclaim();
+  blocking_expire(_shard->blocking, ht_clock_ms());
+
+  if (_shard->index == 0)
+    core_poll_bgsave(false);
+}
+
+// Asks for the bucket slot of the key of the request CORE_PREFETCH_DISTANCE ahead of `index` in a
+// batch, and for the first entry of the bucket of the one half as far, whose slot was asked for
+// earlier, so they are in the cache by the time their turn comes
+static inline void core_prefetch_ahead(DBShard *_shard, DBBatch *batch, db_uint_t index)
+{
+  DBRequest **requests = batch->requests;
+  db_uint_t length = batch->length;
+
+  if (length < 2)
+    return;
+  if (!index)
+    for (db_uint_t i = 0; i < CORE_PREFETCH_DISTANCE && i < length; ++i)
+      if (requests[i]->key.string)
+        ht_prefetch_bucket(_shard->main_ht, &requests[i]->key);
+  if (index + CORE_PREFETCH_DISTANCE < length && requests[index + CORE_PREFETCH_DISTANCE]->key.string)
+    ht_prefetch_bucket(_shard->main_ht, &requests[index + CORE_PREFETCH_DISTANCE]->key);
+  if (index + CORE_PREFETCH_DISTANCE / 2 < length && requests[index + CORE_PREFETCH_DISTANCE / 2]->key.string)
+    ht_prefetch_entry(_shard->main_ht, &requests[index + CORE_PREFETCH_DISTANCE / 2]->key);
+}
+
+static inline void core_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+static db_bool_t core_busy_poll(DBShard *_shard, DBTask *task)
+{
+  db_uint_t window_us = atomic_load_explicit(&busy_poll_us, memory_order_relaxed);
+  if (!window_us)
+    return false;
+
+  uint64_t started_at = latency_now_ns(), now = started_at;
+  db_bool_t is_found = false;
+  for (db_uint_t spins = 1; !(is_found = queue_pop(_shard->task_queue, task)) && now - started_at < (uint64_t)window_us * 1000 && is_running; ++spins)
+  {
+    // Yielding now and then lets the producer run when there are fewer CPUs than threads.
+    if (spins % CORE_BUSY_POLL_YIELD_SPINS == 0)
+      thrd_yield();
+    else
+      core_cpu_relax();
+    now = latency_now_ns();
+  }
+  _shard->busy_poll_ns += latency_now_ns() - started_at;
+  _shard->busy_poll_hits += is_found;
+  return is_found;
+}
+
+static void core_pin_worker(db_uint_t index)
+{
+  unsigned long allowed[CORE_CPU_MASK_WORDS] = {0}, pinned[CORE_CPU_MASK_WORDS] = {0};
+  const db_uint_t word_bits = sizeof(unsigned long) * 8;
+  db_uint_t count = 0;
+
+  // The raw calls need no CPU_SET macros, which only come with _GNU_SOURCE.
+  if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) <= 0)
+    return;
+  for (db_uint_t word = 0; word < CORE_CPU_MASK_WORDS; ++word)
+    count += __builtin_popcountl(allowed[word]);
+  if (!count)
+    return;
+
+  db_uint_t skip = index % count;
+  for (db_uint_t cpu = 0; cpu < CORE_CPU_MASK_WORDS * word_bits; ++cpu)
+    if (allowed[cpu / word_bits] >> (cpu % word_bits) & 1 && skip-- == 0)
+    {
+      pinned[cpu / word_bits] = 1UL << (cpu % word_bits);
+      syscall(SYS_sched_setaffinity, 0, sizeof(pinned), pinned);
+      return;
+    }
+}
+
+static int core_worker(void *arg)
+{
+  DBShard *_shard = (DBShard *)arg;
+  DBTaskQueue *task_queue = _shard->task_queue;
+  DBTask task;
+
+  core_select_shard(_shard);
+  is_worker = true;
+  if (pin_workers)
+    core_pin_worker(_shard->index);
+
+  while (is_running)
+  {
+    if (!queue_pop(task_queue, &task))
+    {
+      // A resize in progress soaks up the idle time, a budget at a time, between looks at the queue.
+      if (core_rehash_idle(_shard))
+        continue;
+      if (!core_busy_poll(_shard, &task))
+      {
+        // Park until a producer pushes a task, waking up periodically for maintenance.
+        queue_wait(task_queue, _shard->expire_is_behind ? CORE_EXPIRE_BEHIND_TIMEOUT_NS : CORE_IDLE_TIMEOUT_NS);
+        ++_shard->parks;
+        if (!queue_pop(task_queue, &task))
+        {
+          mtx_lock(&_shard->lock);
+          core_maintain_shard(_shard);
+          mtx_unlock(&_shard->lock);
+          continue;
+        }
+        latency_record(&_shard->wakeup, latency_now_ns() - task.created_at);
+      }
+    }
+
+    mtx_lock(&_shard->lock);
+    // Commands popped together run against one reading of the clock.
+    ht_update_clock();
+    do
+    {
+      if (task.context)
+      {
+        // The other shards are locked by whoever runs the barrier, so give ours up while waiting.
+        mtx_unlock(&_shard->lock);
+        core_run_barrier(_shard, &task);
+        mtx_lock(&_shard->lock);
+        continue;
+      }
+      if (task.batch)
+      {
+        // Each request of the batch starts when the one before it finished.
+        uint64_t now = latency_now_ns();
+        for (db_uint_t i = 0; i < task.batch->length; ++i)
+        {
+          core_prefetch_ahead(_shard, task.batch, i);
+          // Requests pipelined behind a SHUTDOWN are answered like queued ones.
+          if (is_running)
+          {
+            now = core_dispatch_timed(_shard, task.batch->requests[i], task.batch->replies[i], task.created_at, now);
+            core_feed_aof(_shard, task.batch->requests[i], task.batch->replies[i]);
+            core_serve_blocked(_shard);
+            // A blocked client is answered by whoever serves it, not with the batch.
+            if (core_take_deferred_reply())
+              task.batch->replies[i] = NULL;
+          }
+          else
+            reply_error(task.batch->replies[i], DB_ERR_DB_IS_CLOSED);
+        }
+        // The whole batch shares one write and one fsync.
+        if (aof && aof->policy == DB_AOF_FSYNC_ALWAYS)
+          core_flush_aof(_shard);
+        for (db_uint_t i = 0; i < task.batch->length; ++i)
+          reply_done(task.batch->replies[i]);
+        core_batch_free(task.batch);
+        continue;
+      }
+      if (task.stream)
+      {
+        core_stream_continue(_shard, (DBStream *)task.stream);
+        continue;
+      }
+      core_dispatch_timed(_shard, task.request, task.reply, task.created_at, latency_now_ns());
+      core_feed_aof(_shard, task.request, task.reply);
+      core_serve_blocked(_shard);
+      if (aof && aof->policy == DB_AOF_FSYNC_ALWAYS)
+        core_flush_aof(_shard);
+      if (!core_take_deferred_reply())
+        reply_done(task.reply);
+    } while (is_running && queue_pop(task_queue, &task));
+
+    // Everything served since the queue was found non-empty goes out in one write.
+    core_flush_aof(_shard);
+    core_maintain_shard(_shard);
+    mtx_unlock(&_shard->lock);
+  }
+
+  // Tasks queued behind a SHUTDOWN will never be served, release their waiters.
+  while (queue_pop(task_queue, &task))
+  {
+    if (task.context)
+      core_run_barrier(_shard, &task);
+    else if (task.batch)
+    {
+      for (db_uint_t i = 0; i < task.batch->length; ++i)
+        reply_done(reply_error(task.batch->replies[i], DB_ERR_DB_IS_CLOSED));
+      core_batch_free(task.batch);
+    }
+    // A stream began before the SHUTDOWN, so it is answered in full.
+    else if (task.stream)
+      core_stream_finish((DBStream *)task.stream);
+    else
+      reply_done(reply_error(task.reply, DB_ERR_DB_IS_CLOSED));
+  }
+
+  return 0;
+}
+
+// Answers a blocked pop from the list at `key` of the selected shard, see blocking_serve_fn
+static db_bool_t core_serve_blocked_pop(const char *key, DBBlockedPop *pop, void *context)
+{
+  DBShard *_shard = (DBShard *)context;
+  DBKey handle = ht_key(key);
+  DBQuickList *list = core_retrieve_list(&handle, false);
+
+  if (!list || !list->length)
+    return false;
+  if (!blocking_claim(pop))
+    return true;
+  if (atomic_load(&pop->reply->is_cancelled))
+  {
+    reply_done(pop->reply);
+    return true;
+  }
+
+  DBHashEntry *entry = ht_find_key(main_ht, &handle);
+  core_unshare_entry(_shard, entry);
+  list = entry->data->value.quicklist;
+  DBObj *value = entry->data;
+  DBList *pair = create_dblist();
+  _shard->value_contents -= core_value_contents(value);
+  rpush(pair, create_dblistnode_with_string((char *)key));
+  rpush(pair, create_dblistnode(pop->is_left ? ql_lpop(list) : ql_rpop(list)));
+  _shard->value_contents += core_value_contents(value);
+  if (atomic_load_explicit(&watch_is_used, memory_order_relaxed))
+    ++_shard->watch_versions[handle.hash & (CORE_WATCH_SLOTS - 1)];
+  reply_data(pop->reply, dbobj_create_list(pair));
+  // Logged as the pop it was, after the push that made it possible.
+  if (core_is_logging())
+  {
+    aof_buffer_begin(&_shard->aof_buffer, 2);
+    aof_buffer_append_arg(&_shard->aof_buffer, db_action_name(pop->is_left ? DB_LPOP : DB_RPOP));
+    aof_buffer_append_arg(&_shard->aof_buffer, key);
+  }
+  reply_done(pop->reply);
+  return true;
+}
+
+static void core_serve_blocked(DBShard *_shard)
+{
+  if (!_shard->blocking->ready)
+    return;
+  DBShard *selected = shard;
+  core_select_shard(_shard);
+  blocking_serve(_shard->blocking, core_serve_blocked_pop, _shard);
+  core_select_shard(selected);
+}
+
+// Whether the command just dispatched left its reply to be answered later, which clears the mark
+static db_bool_t core_take_deferred_reply()
+{
+  db_bool_t is_deferred = reply_is_deferred;
+  reply_is_deferred = false;
+  return is_deferred;
+}
+
+// The stored string object, which a reply shares rather than copies
+static DBObj *core_retrieve_string(const DBKey *key)
+{
+  if (!key->string)
+    return NULL;
+
+  DBHashEntry *entry = hget_key(main_ht, key, expr_ht);
+
+  if (entry && entry->data->type == DB_TYPE_STRING)
+  {
+    return entry->data;
+  }
+
+  return NULL;
+}
+
+static DBQuickList *core_retrieve_list(const DBKey *key, const db_bool_t create_new_if_not_found)
+{
+  if (!key->string)
+    return NULL;
+
+  DBHashEntry *entry = hget_key(main_ht, key, expr_ht);
+
+  if (entry)
+  {
+    return entry->data->type == DB_TYPE_LIST ? entry->data->value.quicklist : NULL;
+  }
+
+  if (create_new_if_not_found)
+  {
+    DBQuickList *list = ql_create();
+    hset_key(main_ht, key, dbobj_create_quicklist(list), expr_ht);
+
+    return list;
+  }
+
+  return NULL;
+}
+
+static DBZSet *core_retrieve_zset(const DBKey *key, const db_bool_t create_new_if_not_found, db_bool_t *wrong_type)
+{
+  *wrong_type = false;
+
+  if (!key->string)
+    return NULL;
+
+  DBHashEntry *entry = hget_key(main_ht, key, expr_ht);
+
+  if (entry)
+  {
+    if (entry->data->type == DB_TYPE_ZSET)
+      return entry->data->value.zset;
+    *wrong_type = true;
+    return NULL;
+  }
+
+  if (create_new_if_not_found)
+  {
+    DBZSet *zset = zset_create();
+    hset_key(main_ht, key, dbobj_create_zset(zset), expr_ht);
+
+    return zset;
+  }
+
+  return NULL;
+}
+
+void db_ping(DBRequest *request, DBReply *reply)
+{
+  char *message = get_string_arg(get_arg_head_node(request));
+  reply_data(reply, dbobj_create_string_with_dup(message ? message : "PONG"));
+}
+
+void db_get(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBObj *value = core_retrieve_string(&request->key);
+  const uint8_t *record = value ? NULL : core_mapped_record(&request->key);
+
+  if (value)
+  {
+    // Return the string value
+    reply_data(reply, dbobj_share(value));
+  }
+  else if (record && snapshot_map_type(record) == SNAPSHOT_TYPE_STRING)
+  {
+    // Copied out of the mapped page; the key stays in the mapping.
+    SnapshotMapIter iter;
+    db_uint_t length;
+    snapshot_map_iter_init(record, &iter);
+    const char *string = snapshot_map_iter_next(&iter, &length, NULL);
+    reply_data(reply, dbobj_create_string_from_bytes(string, length));
+  }
+  else
+  {
+    // Not found
+    reply_data(reply, dbobj_shared_null());
+  }
+}
+
+void db_set(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *value = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !value || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  hset_key(main_ht, &request->key, dbobj_create_stored_string(value), expr_ht);
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_rename(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *old_key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *new_key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!old_key || !new_key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBKey new_handle = ht_key(new_key);
+  db_uint_t new_shard_index = core_route_key(&new_handle);
+  core_select_shard(&shards[core_route_key(&request->key)]);
+
+  if (shard->index == new_shard_index)
+  {
+    if (!ht_rename(main_ht, old_key, new_key, expr_ht))
+    {
+      reply_error(reply, DB_ERR_NONEXISTENT_KEY);
+      return;
+    }
+  }
+  else
+  {
+    // The keys live on different shards, move the value over.
+    DBHashEntry *entry = ht_remove_key(main_ht, &request->key, expr_ht);
+    if (!entry)
+    {
+      reply_error(reply, DB_ERR_NONEXISTENT_KEY);
+      return;
+    }
+    core_select_shard(&shards[new_shard_index]);
+    hset_key(main_ht, &new_handle, ht_extract_entry(entry), expr_ht);
+  }
+  // A list may have been moved under a key somebody waits on.
+  blocking_signal(shards[new_shard_index].blocking, &new_handle);
+
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_del(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_uint_t deleted_count = 0;
+  DBKey handle = request->key;
+
+  while (key)
+  {
+    core_select_shard(&shards[core_route_key(&handle)]);
+    if (hdel_key(main_ht, &handle, expr_ht))
+      ++deleted_count;
+    key = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    handle = ht_key(key);
+  }
+
+  reply_data(reply, dbobj_shared_uint(deleted_count));
+}
+
+void db_unlink(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_uint_t deleted_count = 0;
+  DBKey handle = request->key;
+
+  while (key)
+  {
+    core_select_shard(&shards[core_route_key(&handle)]);
+    DBHashEntry *entry = ht_remove_key(main_ht, &handle, expr_ht);
+    if (entry)
+    {
+      // Only the entry is freed here; the value goes to the lazy free thread if it is large.
+      lazyfree_obj(ht_extract_entry(entry));
+      ++deleted_count;
+    }
+    key = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    handle = ht_key(key);
+  }
+
+  reply_data(reply, dbobj_shared_uint(deleted_count));
+}
+
+// Looks up to HT_BATCH_MAX keys up in the shards they belong to, the keys of each shard together
+// with hget_keys
+static void core_lookup_keys(const DBKey *keys, db_uint_t count, DBHashEntry **entries)
+{
+  DBKey shard_keys[HT_BATCH_MAX];
+  DBHashEntry *shard_entries[HT_BATCH_MAX];
+  db_uint_t shard_indexes[HT_BATCH_MAX], positions[HT_BATCH_MAX];
+  db_bool_t is_done[HT_BATCH_MAX] = {false};
+
+  if (shards_length == 1)
+  {
+    hget_keys(shards[0].main_ht, keys, count, entries, shards[0].expr_ht);
+    return;
+  }
+
+  for (db_uint_t i = 0; i < count; ++i)
+    shard_indexes[i] = core_route_key(&keys[i]);
+  for (db_uint_t i = 0; i < count; ++i)
+  {
+    if (is_done[i])
+      continue;
+    db_uint_t length = 0;
+    for (db_uint_t j = i; j < count; ++j)
+      if (!is_done[j] && shard_indexes[j] == shard_indexes[i])
+      {
+        is_done[j] = true;
+        positions[length] = j;
+        shard_keys[length++] = keys[j];
+      }
+    DBShard *key_shard = &shards[shard_indexes[i]];
+    hget_keys(key_shard->main_ht, shard_keys, length, shard_entries, key_shard->expr_ht);
+    for (db_uint_t j = 0; j < length; ++j)
+      entries[positions[j]] = shard_entries[j];
+  }
+}
+
+void db_mget(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
 
   if (!key)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBList *values = create_dblist();
+  DBKey keys[HT_BATCH_MAX];
+  DBHashEntry *entries[HT_BATCH_MAX];
+  db_uint_t count;
+
+  // A batch of keys at a time, so their cache misses overlap.
+  while (curr_arg_node)
+  {
+    for (count = 0; curr_arg_node && count < HT_BATCH_MAX; curr_arg_node = curr_arg_node->next, ++count)
+      keys[count] = curr_arg_node == request->args->head ? request->key : ht_key(get_string_arg(curr_arg_node));
+    core_lookup_keys(keys, count, entries);
+    for (db_uint_t i = 0; i < count; ++i)
+    {
+      DBObj *value = entries[i] && entries[i]->data->type == DB_TYPE_STRING ? entries[i]->data : NULL;
+      rpush(values, create_dblistnode(value ? dbobj_share(value) : dbobj_shared_null()));
+    }
+  }
+
+  reply_data(reply, dbobj_create_list(values));
+}
+
+// Checks that MSET and MSETNX got whole key/value pairs
+static db_bool_t core_mset_args_are_pairs(DBRequest *request)
+{
+  db_uint_t length = request->args ? request->args->length : 0;
+  if (!length || length % 2)
+    return false;
+  for (DBListNode *node = request->args->head; node; node = node->next)
+    if (!get_string_arg(node))
+      return false;
+  return true;
+}
+
+static void core_mset(DBRequest *request)
+{
+  DBKey handle = request->key;
+
+  for (DBListNode *node = request->args->head; node; node = node->next->next)
+  {
+    core_select_shard(&shards[core_route_key(&handle)]);
+    hset_key(main_ht, &handle, dbobj_create_stored_string(node->next->data->value.string), expr_ht);
+    handle = ht_key(node->next->next ? node->next->next->data->value.string : NULL);
+  }
+}
+
+void db_mset(DBRequest *request, DBReply *reply)
+{
+  if (!core_mset_args_are_pairs(request))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  core_mset(request);
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_msetnx(DBRequest *request, DBReply *reply)
+{
+  if (!core_mset_args_are_pairs(request))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  for (DBListNode *node = request->args->head; node; node = node->next->next)
+  {
+    DBKey handle = ht_key(node->data->value.string);
+    core_select_shard(&shards[core_route_key(&handle)]);
+    if (hget_key(main_ht, &handle, expr_ht))
+    {
+      reply_data(reply, dbobj_shared_int(0));
+      return;
+    }
+  }
+
+  core_mset(request);
+  reply_data(reply, dbobj_shared_int(1));
+}
+
+// Adds `increment` to the integer the key holds, taken as 0 if it doesn't exist
+static void core_incrby(DBRequest *request, DBReply *reply, int64_t increment)
+{
+  int64_t number = 0;
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (entry && !dbobj_is_string(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+  // Integers were parsed when they were stored, so the parse is only for strings that aren't any;
+  // a rope is far too long to be one.
+  if (entry && !dbobj_string_as_int64(entry->data, &number) &&
+      (entry->data->encoding == DB_ENCODING_ROPE || !dbobj_parse_int64(entry->data->value.string, &number)))
+  {
+    reply_error(reply, DB_ERR_NOT_INTEGER);
+    return;
+  }
+  // Integer replies are db_int_t wide, so that is the range the value is kept in.
+  if (__builtin_add_overflow(number, increment, &number) || number < INT32_MIN || number > INT32_MAX)
+  {
+    reply_error(reply, DB_ERR_INCR_OVERFLOW);
+    return;
+  }
+
+  // A counter nobody else holds is rewritten where it is, unless GET may be reading it on another thread.
+  if (!entry || atomic_load_explicit(&concurrent_reads_enabled, memory_order_relaxed) || !dbobj_set_integer(entry->data, number))
+    hset_key(main_ht, &request->key, dbobj_create_integer(number), expr_ht);
+  reply_data(reply, dbobj_shared_int((db_int_t)number));
+}
+
+// Reads the increment of INCRBY and DECRBY, negated for DECRBY; replies with an error if there is none
+static db_bool_t core_incrby_arg(DBRequest *request, DBReply *reply, db_bool_t negate, int64_t *increment)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *increment_string = get_string_arg(curr_arg_node);
+
+  if (!key || !increment_string || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return false;
+  }
+  if (!dbobj_parse_int64(increment_string, increment) || (negate && *increment == INT64_MIN))
+  {
+    reply_error(reply, DB_ERR_NOT_INTEGER);
+    return false;
+  }
+  if (negate)
+    *increment = -*increment;
+  return true;
+}
+
+void db_incr(DBRequest *request, DBReply *reply)
+{
+  if (!get_string_arg(get_arg_head_node(request)))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  core_incrby(request, reply, 1);
+}
+
+void db_decr(DBRequest *request, DBReply *reply)
+{
+  if (!get_string_arg(get_arg_head_node(request)))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  core_incrby(request, reply, -1);
+}
+
+void db_incrby(DBRequest *request, DBReply *reply)
+{
+  int64_t increment;
+  if (core_incrby_arg(request, reply, false, &increment))
+    core_incrby(request, reply, increment);
+}
+
+void db_decrby(DBRequest *request, DBReply *reply)
+{
+  int64_t increment;
+  if (core_incrby_arg(request, reply, true, &increment))
+    core_incrby(request, reply, increment);
+}
+
+// Reads a whole string as a finite double
+static db_bool_t core_parse_double(const char *value, db_double_t *result)
+{
+  char *end;
+  if (!value || !*value || isspace((unsigned char)*value))
+    return false;
+  *result = strtod(value, &end);
+  return !*end && isfinite(*result);
+}
+
+void db_incrbyfloat(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *increment_string = get_string_arg(curr_arg_node);
+  db_double_t increment, number = 0;
+
+  if (!key || !increment_string || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  if (!core_parse_double(increment_string, &increment))
+  {
+    reply_error(reply, DB_ERR_NOT_FLOAT);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+  if (entry && !dbobj_is_string(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+  if (entry && (entry->data->encoding == DB_ENCODING_ROPE || !core_parse_double(entry->data->value.string, &number)))
+  {
+    reply_error(reply, DB_ERR_NOT_FLOAT);
+    return;
+  }
+  number += increment;
+  if (!isfinite(number))
+  {
+    reply_error(reply, DB_ERR_INCR_NOT_FINITE);
+    return;
+  }
+
+  // The fewest digits that read back as the same number, so 0.1 + 0.2 stays short where it can.
+  char value[32];
+  for (int precision = 15; precision <= 17; ++precision)
+  {
+    sprintf(value, "%.*g", precision, number);
+    if (strtod(value, NULL) == number)
+      break;
+  }
+  hset_key(main_ht, &request->key, dbobj_create_stored_string(value), expr_ht);
+  reply_data(reply, dbobj_create_string_with_dup(value));
+}
+
+// The string the key holds, NULL if it doesn't exist; replies with an error if it holds another type
+static DBObj *core_string_entry(DBRequest *request, DBReply *reply, db_bool_t *wrong_type)
+{
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+  *wrong_type = entry && !dbobj_is_string(entry->data);
+  if (*wrong_type)
+    reply_error(reply, DB_ERR_WRONGTYPE);
+  return entry && !*wrong_type ? entry->data : NULL;
+}
+
+// The rope of `value` to change where it is. A reply still holding the value, or a GET reading it
+// on another thread, keeps it as it is: a copy sharing its chunks takes its place instead, and only
+// the chunks written to are copied.
+static DBRope *core_writable_rope(DBRequest *request, DBObj *value)
+{
+  if (!dbobj_is_shared(value) && !atomic_load_explicit(&concurrent_reads_enabled, memory_order_relaxed))
+    return value->value.rope;
+  DBObj *copy = dbobj_create_rope(rope_copy(value->value.rope));
+  hset_key(main_ht, &request->key, copy, expr_ht);
+  return copy->value.rope;
+}
+
+// Writes `length` bytes at `offset` of the string the key holds, `value` if it exists, zero bytes
+// filling any gap; the result is stored as a rope once it is long enough for one
+static void core_write_string(DBRequest *request, DBObj *value, size_t offset, const char *bytes, size_t length)
+{
+  if (value && value->encoding == DB_ENCODING_ROPE)
+  {
+    rope_write(core_writable_rope(request, value), offset, bytes, length);
+    return;
+  }
+
+  size_t old_length = value ? dbobj_string_length(value) : 0;
+  size_t new_length = offset + length > old_length ? offset + length : old_length;
+  if (new_length >= ROPE_MIN_LENGTH)
+  {
+    DBRope *rope = rope_create();
+    rope_append(rope, value ? value->value.string : NULL, old_length);
+    rope_write(rope, offset, bytes, length);
+    hset_key(main_ht, &request->key, dbobj_create_rope(rope), expr_ht);
+    return;
+  }
+
+  char *string = (char *)malloc(new_length + 1);
+  if (!string)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(string, value ? value->value.string : "", old_length);
+  if (offset > old_length)
+    memset(string + old_length, 0, offset - old_length);
+  memcpy(string + offset, bytes, length);
+  string[new_length] = '\0';
+  hset_key(main_ht, &request->key, dbobj_try_share_integer(dbobj_create_string(string)), expr_ht);
+}
+
+void db_append(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *bytes = get_string_arg(curr_arg_node);
+  db_bool_t wrong_type;
+
+  if (!key || !bytes || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBObj *value = core_string_entry(request, reply, &wrong_type);
+  if (wrong_type)
+    return;
+  size_t length = value ? dbobj_string_length(value) : 0, added = strlen(bytes);
+  if (length + added > SNAPSHOT_MAX_STRING_LENGTH)
+  {
+    reply_error(reply, DB_ERR_STRING_TOO_LONG);
+    return;
+  }
+
+  core_write_string(request, value, length, bytes, added);
+  reply_data(reply, dbobj_shared_uint((db_uint_t)(length + added)));
+}
+
+void db_strlen(DBRequest *request, DBReply *reply)
+{
+  db_bool_t wrong_type;
+
+  if (!get_string_arg(get_arg_head_node(request)))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBObj *value = core_string_entry(request, reply, &wrong_type);
+  if (!wrong_type)
+    reply_data(reply, dbobj_shared_uint(value ? (db_uint_t)dbobj_string_length(value) : 0));
+}
+
+void db_getrange(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *start_string = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *end_string = get_string_arg(curr_arg_node);
+  int64_t start, end;
+  db_bool_t wrong_type;
+
+  if (!key || !start_string || !end_string || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  if (!dbobj_parse_int64(start_string, &start) || !dbobj_parse_int64(end_string, &end))
+  {
+    reply_error(reply, DB_ERR_NOT_INTEGER);
+    return;
+  }
+
+  DBObj *value = core_string_entry(request, reply, &wrong_type);
+  if (wrong_type)
+    return;
+
+  // Negative indexes count from the end, and the range is clipped to the string, as Redis has it.
+  int64_t length = value ? (int64_t)dbobj_string_length(value) : 0;
+  if (start < 0)
+    start = start < -length ? 0 : length + start;
+  if (end < 0)
+    end = end < -length ? 0 : length + end;
+  if (end >= length)
+    end = length - 1;
+  if (!length || start > end)
+  {
+    reply_data(reply, dbobj_create_string_with_dup(""));
+    return;
+  }
+
+  size_t count = (size_t)(end - start + 1);
+  if (value->encoding != DB_ENCODING_ROPE)
+    reply_data(reply, dbobj_create_string_from_bytes(value->value.string + start, count));
+  else if (count >= ROPE_MIN_LENGTH)
+    reply_data(reply, dbobj_create_rope(rope_slice(value->value.rope, (size_t)start, count)));
+  else
+  {
+    char *string = (char *)malloc(count + 1);
+    if (!string)
+      EXIT_ON_MEMORY_ERROR();
+    rope_read(value->value.rope, (size_t)start, count, string);
+    string[count] = '\0';
+    reply_data(reply, dbobj_create_string(string));
+  }
+}
+
+void db_setrange(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *offset_string = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *bytes = get_string_arg(curr_arg_node);
+  int64_t offset;
+  db_bool_t wrong_type;
+
+  if (!key || !offset_string || !bytes || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  if (!dbobj_parse_int64(offset_string, &offset) || offset < 0)
+  {
+    reply_error(reply, DB_ERR_INDEX_OUT_OF_RANGE);
+    return;
+  }
+
+  DBObj *value = core_string_entry(request, reply, &wrong_type);
+  if (wrong_type)
+    return;
+  size_t length = value ? dbobj_string_length(value) : 0, written = strlen(bytes);
+  if (written && (uint64_t)offset + written > SNAPSHOT_MAX_STRING_LENGTH)
+  {
+    reply_error(reply, DB_ERR_STRING_TOO_LONG);
+    return;
+  }
+
+  // Nothing to write leaves the key as it is, or missing.
+  if (written)
+  {
+    core_write_string(request, value, (size_t)offset, bytes, written);
+    length = (size_t)offset + written > length ? (size_t)offset + written : length;
+  }
+  reply_data(reply, dbobj_shared_uint((db_uint_t)length));
+}
+
+void db_exec(DBRequest *request, DBReply *reply)
+{
+  DBTransaction *transaction = request->transaction;
+  DBShard *selected = shard;
+  uint64_t now = ht_clock_ms();
+
+  if (!transaction)
+  {
+    reply_error(reply, DB_ERR_EXEC_WITHOUT_MULTI);
+    return;
+  }
+
+  // Nothing runs if a watched key changed, and the reply is null, as Redis has it.
+  for (db_uint_t i = 0; i < transaction->watched_length; ++i)
+  {
+    DBWatchedKey *watched = &transaction->watched[i];
+    DBKey key = ht_key(watched->key);
+    if (shards[core_route_key(&key)].watch_versions[key.hash & (CORE_WATCH_SLOTS - 1)] != watched->version ||
+        (watched->expire_at_ms && watched->expire_at_ms <= now))
+    {
+      reply_data(reply, dbobj_shared_null());
+      return;
+    }
+  }
+
+  DBList *replies = create_dblist();
+  is_in_transaction = true;
+  for (db_uint_t i = 0; i < transaction->length; ++i)
+  {
+    DBRequest *queued = transaction->requests[i];
+    DBShard *queued_shard = queued->key.string ? &shards[core_route_key(&queued->key)] : selected;
+    // Answered into the list of the EXEC, from its arena.
+    DBReply queued_reply = {.data = NULL, .notify_fd = -1, .arena = reply->arena};
+    uint64_t started_at = latency_now_ns();
+
+    core_select_shard(queued_shard);
+    core_dispatch_timed(queued_shard, queued, &queued_reply, started_at, started_at);
+    // One log buffer keeps the commands in the order they ran, whatever shards they were on.
+    core_feed_aof(selected, queued, &queued_reply);
+    reply->arena = queued_reply.arena;
+    rpush(replies, create_dblistnode(queued_reply.data ? queued_reply.data : dbobj_shared_null()));
+  }
+  is_in_transaction = false;
+  core_select_shard(selected);
+  reply_data(reply, dbobj_create_list(replies));
+}
+
+void db_watch(DBRequest *request, DBReply *reply)
+{
+  DBTransaction *transaction = request->transaction;
+  db_uint_t argc = request->args ? request->args->length : 0;
+  uint64_t now = ht_clock_ms();
+
+  if (!transaction || transaction->watched_length < argc)
+  {
+    reply_error(reply, DB_ERR_TRANSACTION_NEEDS_PIPELINE);
+    return;
+  }
+
+  // From now on writes keep the versions, on this shard at the latest before its next write.
+  atomic_store(&watch_is_used, true);
+  // The pipeline added the keys last, in the order of the arguments.
+  for (DBWatchedKey *watched = transaction->watched + transaction->watched_length - argc;
+       watched < transaction->watched + transaction->watched_length; ++watched)
+  {
+    DBKey key = ht_key(watched->key);
+    DBShard *key_shard = &shards[core_route_key(&key)];
+    DBHashEntry *entry = ht_find_key(key_shard->main_ht, &key);
+    watched->version = key_shard->watch_versions[key.hash & (CORE_WATCH_SLOTS - 1)];
+    // A key past its deadline is already gone.
+    watched->expire_at_ms = entry && entry->expire_at_ms > now ? entry->expire_at_ms : 0;
+  }
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_lpush(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *member = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !member)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, true);
+
+  if (!list)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  while (member)
+  {
+    ql_lpush(list, member);
+    member = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  }
+  blocking_signal(shard->blocking, &request->key);
+
+  reply_data(reply, dbobj_shared_uint(list->length));
+}
+
+void db_lpop(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 1;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !count || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, false);
+
+  if (!list)
+  {
+    reply_data(reply, dbobj_shared_null());
+    return;
+  }
+
+  if (count == 1)
+  {
+    DBObj *value = ql_lpop(list);
+    reply_data(reply, value ? value : dbobj_shared_null());
+  }
+  else if (count)
+  {
+    reply_data(reply, dbobj_create_list(ql_lpop_n(list, count)));
+  }
+}
+
+void db_rpush(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *member = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !member)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, true);
+
+  if (!list)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  while (member)
+  {
+    ql_rpush(list, member);
+    member = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  }
+  blocking_signal(shard->blocking, &request->key);
+
+  reply_data(reply, dbobj_shared_uint(list->length));
+}
+
+void db_rpop(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 1;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !count || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, false);
+
+  if (!list)
+  {
+    reply_data(reply, dbobj_shared_null());
+    return;
+  }
+
+  if (count == 1)
+  {
+    DBObj *value = ql_rpop(list);
+    reply_data(reply, value ? value : dbobj_shared_null());
+  }
+  else if (count)
+  {
+    reply_data(reply, dbobj_create_list(ql_rpop_n(list, count)));
+  }
+}
+
+static void core_blocking_pop(DBRequest *request, DBReply *reply, db_bool_t is_left)
+{
+  DBListNode *head = get_arg_head_node(request);
+  DBListNode *timeout_node = request->args ? request->args->tail : NULL;
+  DBListNode *node;
+
+  if (!head || head == timeout_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  db_double_t timeout = get_double_arg(timeout_node);
+  if (!dbobj_is_double(timeout_node->data) || !(timeout >= 0) || timeout > CORE_BLOCKING_MAX_TIMEOUT_SECONDS)
+  {
+    reply_error(reply, DB_ERR_TIMEOUT_OUT_OF_RANGE);
+    return;
+  }
+
+  // The first key, in the order given, that holds elements is popped at once.
+  for (node = head; node != timeout_node; node = node->next)
+  {
+    char *key = get_string_arg(node);
+    DBKey handle = ht_key(key);
+    if (!key)
+    {
+      reply_error(reply, DB_ERR_ARG_ERROR);
+      return;
+    }
+    core_select_shard(&shards[core_route_key(&handle)]);
+    DBHashEntry *entry = hget_key(main_ht, &handle, expr_ht);
+    if (entry && entry->data->type != DB_TYPE_LIST)
+    {
+      reply_error(reply, DB_ERR_WRONGTYPE);
+      return;
+    }
+    if (entry && entry->data->value.quicklist->length)
+    {
+      DBQuickList *list = entry->data->value.quicklist;
+      DBList *pair = create_dblist();
+      rpush(pair, create_dblistnode_with_string(key));
+      rpush(pair, create_dblistnode(is_left ? ql_lpop(list) : ql_rpop(list)));
+      reply_data(reply, dbobj_create_list(pair));
+      return;
+    }
+  }
+
+  // Nothing could push while a transaction runs, so it gets the answer of a timeout right away.
+  if (is_in_transaction)
+  {
+    reply_data(reply, dbobj_shared_null());
+    return;
+  }
+
+  uint64_t deadline_ms = timeout > 0 ? ht_clock_ms() + (uint64_t)(timeout * 1000) : 0;
+  DBBlockedPop *pop = blocking_pop_create(reply, is_left, deadline_ms);
+  for (node = head; node != timeout_node; node = node->next)
+  {
+    DBKey handle = ht_key(node->data->value.string);
+    core_select_shard(&shards[core_route_key(&handle)]);
+    blocking_add(shard->blocking, &handle, pop);
+  }
+  reply_is_deferred = true;
+}
+
+void db_blpop(DBRequest *request, DBReply *reply)
+{
+  core_blocking_pop(request, reply, true);
+}
+
+void db_brpop(DBRequest *request, DBReply *reply)
+{
+  core_blocking_pop(request, reply, false);
+}
+
+void db_llen(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  const DBQuickList *list = core_retrieve_list(&request->key, false);
+
+  reply_data(reply, dbobj_shared_uint(list ? list->length : 0));
+}
+
+// ql_lrange over a list of the mapped snapshot, read in place; a value of another type reads as
+// no list at all, as with core_retrieve_list
+static DBList *core_mapped_lrange(const uint8_t *record, db_uint_t start, db_uint_t stop)
+{
+  SnapshotMapIter iter;
+  db_uint_t length;
+
+  if (snapshot_map_type(record) != SNAPSHOT_TYPE_LIST)
+    return create_dblist();
+  db_uint_t count = snapshot_map_iter_init(record, &iter);
+  if (stop == DB_UINT_MAX || stop > count - 1)
+    stop = count - 1;
+  if (start > stop || start >= count)
+    return NULL;
+
+  DBList *list = create_dblist();
+  for (db_uint_t index = 0; index <= stop; ++index)
+  {
+    const char *element = snapshot_map_iter_next(&iter, &length, NULL);
+    if (index >= start)
+      rpush(list, create_dblistnode(dbobj_create_string_from_bytes(element, length)));
+  }
+  return list;
+}
+
+// Pushes up to CORE_STREAM_CHUNK elements of the stream to its reply; returns whether they were the last
+static db_bool_t core_stream_chunk(DBStream *stream)
+{
+  db_uint_t stop = stream->stop - stream->next < CORE_STREAM_CHUNK ? stream->stop : stream->next + CORE_STREAM_CHUNK - 1;
+  DBList *chunk;
+
+  if (stream->value->type == DB_TYPE_LIST)
+  {
+    db_uint_t length;
+    chunk = create_dblist();
+    for (db_uint_t index = stream->next; index <= stop; ++index)
+    {
+      const char *element = ql_iter_next(&stream->iter, &length);
+      rpush(chunk, create_dblistnode(dbobj_create_string_from_bytes(element, length)));
+    }
+  }
+  else if (stream->reverse)
+    chunk = zrevrange(stream->value->value.zset, stream->next, stop, stream->withscores, NULL);
+  else
+    chunk = zrange(stream->value->value.zset, stream->next, stop, stream->withscores, NULL);
+
+  reply_stream_push(stream->reply, chunk);
+  stream->next = stop + 1;
+  return stop == stream->stop;
+}
+
+static void core_stream_end(DBStream *stream)
+{
+  reply_done(stream->reply);
+  free_dbobj(stream->value);
+  free(stream);
+  atomic_fetch_sub(&live_streams, 1);
+}
+
+static db_bool_t core_stream_start(DBReply *reply, DBObj *value, db_uint_t start, db_uint_t stop, db_bool_t withscores, db_bool_t reverse)
+{
+  // A queued EXEC answers in one list, and only a worker can queue the rest.
+  if (!is_worker || is_in_transaction || stop - start + 1 < CORE_STREAM_MIN_LENGTH)
+    return false;
+
+  DBStream *stream = (DBStream *)malloc(sizeof(DBStream));
+  if (!stream)
+    EXIT_ON_MEMORY_ERROR();
+  *stream = (DBStream){.reply = reply, .value = dbobj_share(value), .next = start, .stop = stop, .withscores = withscores, .reverse = reverse};
+  atomic_fetch_add(&live_streams, 1);
+  if (value->type == DB_TYPE_LIST)
+    ql_iter_init_at(value->value.quicklist, start, &stream->iter);
+
+  reply_stream_begin(reply, (stop - start + 1) * (withscores ? 2 : 1));
+  core_stream_chunk(stream);
+  DBTask task = {.created_at = latency_now_ns(), .stream = stream};
+  if (queue_push(shard->task_queue, &task))
+  {
+    reply_is_deferred = true;
+    return true;
+  }
+  // With the queue full, the rest goes out right away.
+  while (!core_stream_chunk(stream))
+    ;
+  free_dbobj(stream->value);
+  free(stream);
+  atomic_fetch_sub(&live_streams, 1);
+  return true;
+}
+
+static void core_stream_continue(DBShard *_shard, DBStream *stream)
+{
+  DBTask task = {.stream = stream};
+  while (!core_stream_chunk(stream))
+  {
+    task.created_at = latency_now_ns();
+    if (queue_push(_shard->task_queue, &task))
+      return;
+  }
+  core_stream_end(stream);
+}
+
+static void core_stream_finish(DBStream *stream)
+{
+  while (!core_stream_chunk(stream))
+    ;
+  core_stream_end(stream);
+}
+
+void db_lrange(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t start = curr_arg_node ? get_uint_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t stop = curr_arg_node ? get_uint_arg(curr_arg_node) : DB_UINT_MAX;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  const uint8_t *record = core_mapped_record(&request->key);
+  DBQuickList *list = record ? NULL : core_retrieve_list(&request->key, false);
+  // Clipped as ql_lrange clips it
+  db_uint_t last = list && (stop == DB_UINT_MAX || stop > list->length - 1) ? list->length - 1 : stop;
+  if (list && list->length && start <= last && core_stream_start(reply, ht_find_key(main_ht, &request->key)->data, start, last, false, false))
+    return;
+  DBList *range = record ? core_mapped_lrange(record, start, stop) : ql_lrange(list, start, stop);
+
+  if (!range)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, dbobj_create_list(range));
+}
+
+// Resolves an index that may count from the end; returns false if it is out of range
+static db_bool_t core_list_position(const DBQuickList *list, db_int_t index, db_uint_t *position)
+{
+  int64_t resolved = index < 0 ? (int64_t)list->length + index : index;
+  if (resolved < 0 || resolved >= list->length)
+    return false;
+  *position = (db_uint_t)resolved;
+  return true;
+}
+
+void db_lindex(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t has_index = curr_arg_node != NULL;
+  db_int_t index = has_index ? get_int_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !has_index || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, false);
+  db_uint_t position;
+
+  if (!list && hget_key(main_ht, &request->key, expr_ht))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  if (!list || !core_list_position(list, index, &position))
+  {
+    reply_data(reply, dbobj_shared_null());
+    return;
+  }
+
+  reply_data(reply, ql_lindex(list, position));
+}
+
+void db_lset(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t has_index = curr_arg_node != NULL;
+  db_int_t index = has_index ? get_int_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *value = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !has_index || !value || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, false);
+  db_uint_t position;
+
+  if (!list)
+  {
+    reply_error(reply, hget_key(main_ht, &request->key, expr_ht) ? DB_ERR_WRONGTYPE : DB_ERR_NONEXISTENT_KEY);
+    return;
+  }
+
+  if (!core_list_position(list, index, &position))
+  {
+    reply_error(reply, DB_ERR_INDEX_OUT_OF_RANGE);
+    return;
+  }
+
+  ql_lset(list, position, value);
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_linsert(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *where = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *pivot = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *value = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t before = where && strcmp(where, "BEFORE") == 0;
+
+  if (!key || !where || (!before && strcmp(where, "AFTER") != 0) || !pivot || !value || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBQuickList *list = core_retrieve_list(&request->key, false);
+
+  if (!list)
+  {
+    if (hget_key(main_ht, &request->key, expr_ht))
+      reply_error(reply, DB_ERR_WRONGTYPE);
+    else
+      reply_data(reply, dbobj_shared_int(0));
+    return;
+  }
+
+  reply_data(reply, dbobj_shared_int(ql_linsert(list, pivot, value, before) ? (db_int_t)list->length : -1));
+}
+
+void db_hget(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *field = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !field || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (!entry)
+  {
+    reply_data(reply, dbobj_shared_null());
+    return;
+  }
+
+  if (!dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, hashobj_get_reply(entry->data, field));
+}
+
+void db_hset(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *field = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *value = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !field || !value)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBObj *hash = NULL;
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (entry && !dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  if (!entry)
+  {
+    hash = hashobj_create();
+    hset_key(main_ht, &request->key, hash, expr_ht);
+  }
+  else
+  {
+    hash = entry->data;
+  }
+
+  db_uint_t set_count = 0;
+
+  while (field && value)
+  {
+    if (hashobj_set(hash, field, value))
+      ++set_count;
+    field = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    value = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  }
+
+  reply_data(reply, dbobj_shared_uint(set_count));
+}
+
+void db_hdel(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *field = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !field)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (!entry)
+  {
+    reply_data(reply, dbobj_shared_uint(0));
+    return;
+  }
+
+  if (!dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  db_uint_t deleted_count = 0;
+
+  while (field)
+  {
+    if (hashobj_del(entry->data, field))
+      ++deleted_count;
+    field = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  }
+
+  reply_data(reply, dbobj_shared_uint(deleted_count));
+}
+
+void db_hmget(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (entry && !dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  DBList *values = create_dblist();
+  for (; curr_arg_node; curr_arg_node = curr_arg_node->next)
+  {
+    char *field = get_string_arg(curr_arg_node);
+    rpush(values, create_dblistnode(entry && field ? hashobj_get_reply(entry->data, field) : dbobj_shared_null()));
+  }
+
+  reply_data(reply, dbobj_create_list(values));
+}
+
+void db_hgetall(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (entry && !dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  DBList *pairs = create_dblist();
+  if (entry)
+  {
+    DBHashObjIter iter;
+    const char *field, *value;
+    hashobj_iter_init(entry->data, &iter);
+    while ((field = hashobj_iter_next(&iter, &value)))
+    {
+      rpush(pairs, create_dblistnode_with_string((char *)field));
+      rpush(pairs, create_dblistnode_with_string((char *)value));
+    }
+  }
+
+  reply_data(reply, dbobj_create_list(pairs));
+}
+
+void db_hincrby(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *field = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *increment_string = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  int64_t increment, number = 0;
+
+  if (!key || !field || !increment_string || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  if (!dbobj_parse_int64(increment_string, &increment))
+  {
+    reply_error(reply, DB_ERR_NOT_INTEGER);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+
+  if (entry && !dbobj_is_hash(entry->data))
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  const char *current = entry ? hashobj_get(entry->data, field) : NULL;
+  if (current && !dbobj_parse_int64(current, &number))
+  {
+    reply_error(reply, DB_ERR_NOT_INTEGER);
+    return;
+  }
+  // Integer replies are db_int_t wide, so that is the range the value is kept in.
+  if (__builtin_add_overflow(number, increment, &number) || number < INT32_MIN || number > INT32_MAX)
+  {
+    reply_error(reply, DB_ERR_INCR_OVERFLOW);
+    return;
+  }
+
+  DBObj *hash = entry ? entry->data : NULL;
+  if (!hash)
+  {
+    hash = hashobj_create();
+    hset_key(main_ht, &request->key, hash, expr_ht);
+  }
+
+  char value[32];
+  sprintf(value, "%lld", (long long)number);
+  hashobj_set(hash, field, value);
+  reply_data(reply, dbobj_shared_int((db_int_t)number));
+}
+
+void db_expire(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t expire_seconds = curr_arg_node ? get_uint_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  if (ht_expire_key(main_ht, &request->key, ht_clock_ms() + (uint64_t)expire_seconds * 1000, expr_ht))
+  {
+    reply_data(reply, dbobj_shared_int(1));
+  }
+  else
+  {
+    reply_data(reply, dbobj_shared_int(0));
+  }
+}
+
+void db_expireat(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t deadline = curr_arg_node ? get_uint_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  if (ht_expire_key(main_ht, &request->key, (uint64_t)deadline * 1000, expr_ht))
+  {
+    reply_data(reply, dbobj_shared_int(1));
+  }
+  else
+  {
+    reply_data(reply, dbobj_shared_int(0));
+  }
+}
+
+void db_pexpire(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  uint64_t expire_ms = curr_arg_node ? get_uint64_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  reply_data(reply, dbobj_shared_int(ht_expire_key(main_ht, &request->key, ht_clock_ms() + expire_ms, expr_ht) ? 1 : 0));
+}
+
+void db_pexpireat(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  uint64_t deadline_ms = curr_arg_node ? get_uint64_arg(curr_arg_node) : 0;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  reply_data(reply, dbobj_shared_int(ht_expire_key(main_ht, &request->key, deadline_ms, expr_ht) ? 1 : 0));
+}
+
+// Milliseconds a key has left, or -1/-2 as TTL and PTTL reply them
+static int64_t core_remaining_ms(DBRequest *request)
+{
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+  uint64_t now = ht_clock_ms();
+
+  if (!entry)
+    return -2;
+  if (!entry->expire_at_ms)
+    return -1;
+  // The lookup deletes a key that is due, so this only guards against the clock moving on.
+  return entry->expire_at_ms > now ? (int64_t)(entry->expire_at_ms - now) : 0;
+}
+
+static void core_reply_ttl(DBRequest *request, DBReply *reply, db_bool_t in_ms)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+
+  if (!key || curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  int64_t remaining = core_remaining_ms(request);
+  if (remaining > 0 && !in_ms)
+    remaining = (remaining + 500) / 1000;
+  reply_data(reply, dbobj_shared_int(remaining < INT32_MAX ? (db_int_t)remaining : INT32_MAX));
+}
+
+void db_ttl(DBRequest *request, DBReply *reply)
+{
+  core_reply_ttl(request, reply, false);
+}
+
+void db_pttl(DBRequest *request, DBReply *reply)
+{
+  core_reply_ttl(request, reply, true);
+}
+
+void db_zadd(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !curr_arg_node || !curr_arg_node->next)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, true, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  // the pairs borrow the members from the request
+  DBZSetPair *pairs = (DBZSetPair *)malloc((request->args->length / 2) * sizeof(DBZSetPair));
+  if (!pairs)
+    EXIT_ON_MEMORY_ERROR();
+  db_uint_t length = 0;
+  db_double_t score;
+  char *member;
+
+  while (curr_arg_node && curr_arg_node->next)
+  {
+    score = get_double_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node->next;
+    member = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node->next;
+    if (member)
+      pairs[length++] = (DBZSetPair){.member = member, .length = strlen(member), .score = score};
+  }
+
+  db_uint_t added_count = zadd_bulk(zset, pairs, length);
+  free(pairs);
+  reply_data(reply, dbobj_shared_uint(added_count));
+}
+
+void db_zscore(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *member = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !member || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, zscore(zset, member));
+}
+
+void db_zcard(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, dbobj_shared_uint(zcard(zset)));
+}
+
+void db_zcount(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t included_min, included_max;
+  db_double_t min = get_score_bound_arg(curr_arg_node, &included_min);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_double_t max = get_score_bound_arg(curr_arg_node, &included_max);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || isnan(min) || isnan(max) || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, dbobj_shared_uint(zset ? zcount(zset, min, included_min, max, included_max) : 0));
+}
+
+// ZRANGE over a sorted set of the mapped snapshot, whose members lie in score order
+static void core_reply_mapped_zrange(DBReply *reply, const uint8_t *record, db_int_t start, db_int_t stop, db_bool_t withscores)
+{
+  SnapshotMapIter iter;
+  db_uint_t length;
+  db_double_t score;
+
+  if (snapshot_map_type(record) != SNAPSHOT_TYPE_ZSET)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+  db_int_t card = (db_int_t)snapshot_map_iter_init(record, &iter);
+  if (start < 0)
+    start = start + card < 0 ? 0 : start + card;
+  if (stop < 0)
+    stop += card;
+  if (stop >= card)
+    stop = card - 1;
+
+  DBArena *arena = reply_arena(reply);
+  DBList *list = create_dblist_in(arena);
+  for (db_int_t index = 0; index <= stop; ++index)
+  {
+    const char *member = snapshot_map_iter_next(&iter, &length, &score);
+    if (index < start)
+      continue;
+    rpush(list, create_dblistnode_in(arena, dbobj_create_string_in(arena, member, length)));
+    if (withscores)
+      rpush(list, create_dblistnode_in(arena, dbobj_create_double_in(arena, score)));
+  }
+  reply_data(reply, dbobj_create_list_in(arena, list));
+}
+
+static void core_reply_zrange(DBRequest *request, DBReply *reply, db_bool_t reverse)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_int_t start = get_int_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_int_t stop = curr_arg_node ? get_int_arg(curr_arg_node) : -1;
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *option = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t withscores = option && strcmp(option, "WITHSCORES") == 0;
+
+  if (!key || (option && !withscores) || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  // ZREVRANGE moves the key out of the mapping instead, see core_fault_in.
+  const uint8_t *record = reverse ? NULL : core_mapped_record(&request->key);
+  if (record)
+  {
+    core_reply_mapped_zrange(reply, record, start, stop, withscores);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  // Negative indexes count from the end of the set.
+  db_int_t card = (db_int_t)zcard(zset);
+  if (start < 0)
+    start = start + card < 0 ? 0 : start + card;
+  if (stop < 0)
+    stop += card;
+
+  if (!zset || stop < start)
+  {
+    reply_data(reply, dbobj_create_list(create_dblist()));
+    return;
+  }
+  if (start < card && core_stream_start(reply, ht_find_key(main_ht, &request->key)->data, start, stop >= card ? card - 1 : stop, withscores, reverse))
+    return;
+
+  // Every member and score is allocated from the reply, which frees them together.
+  DBArena *arena = reply_arena(reply);
+  DBList *list = reverse ? zrevrange(zset, start, stop, withscores, arena) : zrange(zset, start, stop, withscores, arena);
+  reply_data(reply, dbobj_create_list_in(arena, list));
+}
+
+void db_zrange(DBRequest *request, DBReply *reply)
+{
+  core_reply_zrange(request, reply, false);
+}
+
+void db_zrevrange(DBRequest *request, DBReply *reply)
+{
+  core_reply_zrange(request, reply, true);
+}
+
+void db_zrangebyscore(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t included_min, included_max;
+  db_double_t min = get_score_bound_arg(curr_arg_node, &included_min);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_double_t max = get_score_bound_arg(curr_arg_node, &included_max);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *option = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t withscores = option && strcmp(option, "WITHSCORES") == 0;
+
+  if (!key || isnan(min) || isnan(max) || (option && !withscores) || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  DBArena *arena = reply_arena(reply);
+  DBList *list = zset ? zrangebyscore(zset, min, included_min, max, included_max, withscores, arena) : NULL;
+
+  reply_data(reply, dbobj_create_list_in(arena, list ? list : create_dblist_in(arena)));
+}
+
+static void core_reply_zrank(DBRequest *request, DBReply *reply, db_bool_t reverse)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *member = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *option = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t withscore = option && strcmp(option, "WITHSCORE") == 0;
+
+  if (!key || !member || (option && !withscore) || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  reply_data(reply, reverse ? zrevrank(zset, member, withscore) : zrank(zset, member, withscore));
+}
+
+void db_zrank(DBRequest *request, DBReply *reply)
+{
+  core_reply_zrank(request, reply, false);
+}
+
+void db_zrevrank(DBRequest *request, DBReply *reply)
+{
+  core_reply_zrank(request, reply, true);
+}
+
+void db_zrem(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *member = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || !member)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  db_uint_t removed_count = 0;
+
+  while (zset && member)
+  {
+    removed_count += zrem(zset, member);
+    member = get_string_arg(curr_arg_node);
+    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  }
+
+  // Empty sets are never stored.
+  if (zset && !zcard(zset))
+    hdel_key(main_ht, &request->key, expr_ht);
+
+  reply_data(reply, dbobj_shared_uint(removed_count));
+}
+
+void db_zremrangebyscore(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_bool_t included_min, included_max;
+  db_double_t min = get_score_bound_arg(curr_arg_node, &included_min);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_double_t max = get_score_bound_arg(curr_arg_node, &included_max);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!key || isnan(min) || isnan(max) || curr_arg_node)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  db_bool_t wrong_type;
+  DBZSet *zset = core_retrieve_zset(&request->key, false, &wrong_type);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  db_uint_t removed_count = zset ? zremrangebyscore(zset, min, included_min, max, included_max) : 0;
+
+  if (zset && !zcard(zset))
+    hdel_key(main_ht, &request->key, expr_ht);
+
+  reply_data(reply, dbobj_shared_uint(removed_count));
+}
+
+// Shared by ZINTERSTORE and ZUNIONSTORE: `destination numkeys key [key ...] [WEIGHTS weight [weight ...]] [AGGREGATE SUM|MIN|MAX]`
+// The source sets may live on any shard, the request runs while every shard is held.
+static void db_zstore(DBRequest *request, DBReply *reply, db_bool_t is_inter)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *destination = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t numkeys = get_uint_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+
+  if (!destination || !numkeys)
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+
+  DBListNode *key_node = curr_arg_node;
+  for (db_uint_t i = 0; i < numkeys; ++i)
+  {
+    if (!get_string_arg(curr_arg_node))
+    {
+      reply_error(reply, DB_ERR_ARG_ERROR);
+      return;
+    }
+    curr_arg_node = curr_arg_node->next;
+  }
+
+  DBListNode *weight_node = NULL;
+  db_aggregate_t aggregate = DB_AGG_SUM;
+  char *option;
+
+  while ((option = get_string_arg(curr_arg_node)))
+  {
+    curr_arg_node = curr_arg_node->next;
+    if (strcmp(option, "WEIGHTS") == 0 && !weight_node)
+    {
+      weight_node = curr_arg_node;
+      for (db_uint_t i = 0; i < numkeys; ++i)
+      {
+        if (!curr_arg_node)
+          return (void)reply_error(reply, DB_ERR_SYNTAX_ERROR);
+        get_double_arg(curr_arg_node);
+        curr_arg_node = curr_arg_node->next;
+      }
+    }
+    else if (strcmp(option, "AGGREGATE") == 0 && (option = get_string_arg(curr_arg_node)))
+    {
+      curr_arg_node = curr_arg_node->next;
+      if (strcmp(option, "SUM") == 0)
+        aggregate = DB_AGG_SUM;
+      else if (strcmp(option, "MIN") == 0)
+        aggregate = DB_AGG_MIN;
+      else if (strcmp(option, "MAX") == 0)
+        aggregate = DB_AGG_MAX;
+      else
+        return (void)reply_error(reply, DB_ERR_SYNTAX_ERROR);
+    }
+    else
+    {
+      reply_error(reply, DB_ERR_SYNTAX_ERROR);
+      return;
+    }
+  }
+
+  // Borrow the source sets, the wrappers are detached again before they are freed.
+  DBList *zsets = create_dblist();
+  DBList *weights = create_dblist();
+  DBListNode *zset_node;
+  db_bool_t wrong_type = false;
+  db_bool_t has_missing = false;
+  DBZSet *zset;
+  DBKey handle;
+
+  for (db_uint_t i = 0; i < numkeys && !wrong_type; ++i)
+  {
+    handle = ht_key(get_string_arg(key_node));
+    core_select_shard(&shards[core_route_key(&handle)]);
+    zset = core_retrieve_zset(&handle, false, &wrong_type);
+    if (zset)
+    {
+      rpush(zsets, create_dblistnode(dbobj_create_zset(zset)));
+      rpush(weights, create_dblistnode(dbobj_create_double(weight_node ? get_double_arg(weight_node) : 1)));
+    }
+    else
+    {
+      has_missing = true;
+    }
+    key_node = key_node->next;
+    weight_node = weight_node ? weight_node->next : NULL;
+  }
+
+  DBObj *result = NULL;
+
+  if (!wrong_type && zsets->length && !(is_inter && has_missing))
+    result = is_inter ? zinterstore(zsets, weights, aggregate) : zunionstore(zsets, weights, aggregate);
+
+  for (zset_node = zsets->head; zset_node; zset_node = zset_node->next)
+    zset_node->data->value.zset = NULL;
+  free_dblist(zsets);
+  free_dblist(weights);
+
+  if (wrong_type)
+  {
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  if (result && !dbobj_is_zset(result))
+  {
+    reply_data(reply, result);
+    return;
+  }
+
+  db_uint_t count = result ? zcard(result->value.zset) : 0;
+
+  handle = ht_key(destination);
+  core_select_shard(&shards[core_route_key(&handle)]);
+  if (count)
+    hset_key(main_ht, &handle, result, expr_ht);
+  else
+  {
+    hdel_key(main_ht, &handle, expr_ht);
+    free_dbobj(result);
+  }
+
+  reply_data(reply, dbobj_shared_uint(count));
+}
+
+void db_zinterstore(DBRequest *request, DBReply *reply)
+{
+  db_zstore(request, reply, true);
+}
+
+void db_zunionstore(DBRequest *request, DBReply *reply)
+{
+  db_zstore(request, reply, false);
+}
+
+void db_keys(DBRequest *request, DBReply *reply)
+{
+  char *pattern = get_string_arg(get_arg_head_node(request));
+  DBArena *arena = reply_arena(reply);
+  DBList *keys = create_dblist_in(arena);
+  DBList *shard_keys;
+  DBListNode *node;
+
+  // The lists of the shards are in the arena too, and left there once emptied.
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    core_select_shard(&shards[i]);
+    shard_keys = pattern ? ht_keys_matching(main_ht, pattern, arena) : ht_keys(main_ht, expr_ht, arena);
+    while ((node = lpop(shard_keys)))
+      rpush(keys, node);
+  }
+
+  reply_data(reply, dbobj_create_list_in(arena, keys));
+}
+
+// Results of a SCAN, HSCAN or ZSCAN call being gathered
+typedef struct CoreScan
+{
+  DBList *results;
+  // The MATCH pattern, NULL if there is none
+  DBGlob *glob;
+  db_uint_t found;
+  // Type of the values of the table, which HSCAN and ZSCAN reply with after each key
+  db_type_t type;
+} CoreScan;
+
+static void core_scan_visit(DBHashEntry *entry, void *arg)
+{
+  CoreScan *scan = (CoreScan *)arg;
+  if (scan->glob && !glob_match(scan->glob, entry->key, entry->key_length))
+    return;
+  rpush(scan->results, create_dblistnode_with_string(entry->key));
+  if (scan->type == DB_TYPE_STRING)
+    rpush(scan->results, dbobj_is_string(entry->data) ? create_dblistnode_with_string(entry->data->value.string) : create_dblistnode(dbobj_shared_null()));
+  ++scan->found;
+}
+
+static void core_scan_zset_visit(DBZSetDictEntry *entry, void *arg)
+{
+  CoreScan *scan = (CoreScan *)arg;
+  if (scan->glob && !glob_match(scan->glob, entry->key, entry->key_length))
+    return;
+  rpush(scan->results, create_dblistnode_with_string((char *)entry->key));
+  rpush(scan->results, create_dblistnode(dbobj_create_double(entry->value->score)));
+  ++scan->found;
+}
+
+// Reads MATCH, compiled for core_reply_scan to free, and COUNT from the arguments after the
+// cursor; returns false on a syntax error, leaving no pattern
+static db_bool_t core_scan_options(DBListNode *curr_arg_node, DBGlob **glob, db_uint_t *count)
+{
+  char *option;
+  *glob = NULL;
+  *count = CORE_SCAN_DEFAULT_COUNT;
+
+  while ((option = get_string_arg(curr_arg_node)))
+  {
+    curr_arg_node = curr_arg_node->next;
+    if (strcmp(option, "MATCH") == 0 && get_string_arg(curr_arg_node))
+    {
+      glob_free(*glob);
+      *glob = glob_compile(get_string_arg(curr_arg_node));
+    }
+    else if (strcmp(option, "COUNT") == 0 && get_uint_arg(curr_arg_node))
+      *count = get_uint_arg(curr_arg_node);
+    else
+    {
+      glob_free(*glob);
+      *glob = NULL;
+      return false;
+    }
+    curr_arg_node = curr_arg_node->next;
+  }
+  return true;
+}
+
+// Scans `ht` from `cursor` until `count` results are found, the buckets allowed for them are
+// visited, or the scan is done; returns the cursor to continue from
+static db_uint_t core_scan_table(DBHash *ht, db_uint_t cursor, db_uint_t count, CoreScan *scan)
+{
+  uint64_t buckets = (uint64_t)count * CORE_SCAN_MAX_BUCKETS_PER_RESULT;
+  do
+  {
+    cursor = ht_scan(ht, cursor, core_scan_visit, scan);
+  } while (cursor && scan->found < count && --buckets);
+  return cursor;
+}
+
+// Puts the cursor in front of the results and replies with them
+static void core_reply_scan(DBReply *reply, uint64_t cursor, CoreScan *scan)
+{
+  char cursor_string[24];
+  sprintf(cursor_string, "%llu", (unsigned long long)cursor);
+  lpush(scan->results, create_dblistnode_with_string(cursor_string));
+  reply_data(reply, dbobj_create_list(scan->results));
+  glob_free(scan->glob);
+}
+
+void db_scan(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  if (!get_string_arg(curr_arg_node))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  uint64_t cursor = get_uint64_arg(curr_arg_node);
+  CoreScan scan = {.type = DB_TYPE_NULL};
+  db_uint_t count;
+  if (!core_scan_options(curr_arg_node->next, &scan.glob, &count))
+  {
+    reply_error(reply, DB_ERR_SYNTAX_ERROR);
+    return;
+  }
+
+  // a cursor of another shard count starts over in a valid place rather than past the end
+  db_uint_t shard_index = cursor % shards_length;
+  db_uint_t bucket_cursor = (db_uint_t)(cursor / shards_length);
+  scan.results = create_dblist();
+  while (scan.found < count)
+  {
+    core_select_shard(&shards[shard_index]);
+    bucket_cursor = core_scan_table(main_ht, bucket_cursor, count - scan.found, &scan);
+    if (bucket_cursor)
+      break;
+    if (++shard_index == shards_length)
+    {
+      shard_index = 0;
+      break;
+    }
+  }
+
+  core_reply_scan(reply, (uint64_t)bucket_cursor * shards_length + shard_index, &scan);
+}
+
+// HSCAN and ZSCAN; `is_zset` picks the type of the value at the key
+static void core_reply_value_scan(DBRequest *request, DBReply *reply, db_bool_t is_zset)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  char *key = get_string_arg(curr_arg_node);
+  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  if (!key || !get_string_arg(curr_arg_node))
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  uint64_t cursor = get_uint64_arg(curr_arg_node);
+  CoreScan scan = {.type = is_zset ? DB_TYPE_ZSET : DB_TYPE_STRING};
+  db_uint_t count;
+  if (!core_scan_options(curr_arg_node->next, &scan.glob, &count))
+  {
+    reply_error(reply, DB_ERR_SYNTAX_ERROR);
+    return;
+  }
+
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+  if (entry && (is_zset ? !dbobj_is_zset(entry->data) : !dbobj_is_hash(entry->data)))
+  {
+    glob_free(scan.glob);
+    reply_error(reply, DB_ERR_WRONGTYPE);
+    return;
+  }
+
+  scan.results = create_dblist();
+  if (!entry)
+  {
+    core_reply_scan(reply, 0, &scan);
+    return;
+  }
+
+  DBZSet *zset = is_zset ? entry->data->value.zset : NULL;
+  if (zset && !zset->dict)
+  {
+    DBZSetIter iter;
+    const char *member;
+    db_double_t score;
+    zset_iter_init(zset, &iter);
+    while ((member = zset_iter_next(&iter, &score)))
+    {
+      if (scan.glob && !glob_match(scan.glob, member, strlen(member)))
+        continue;
+      rpush(scan.results, create_dblistnode_with_string((char *)member));
+      rpush(scan.results, create_dblistnode(dbobj_create_double(score)));
+    }
+    core_reply_scan(reply, 0, &scan);
+    return;
+  }
+
+  if (!zset && entry->data->encoding == DB_ENCODING_HASH_PACKED)
+  {
+    DBHashObjIter iter;
+    const char *field, *value;
+    hashobj_iter_init(entry->data, &iter);
+    while ((field = hashobj_iter_next(&iter, &value)))
+    {
+      if (scan.glob && !glob_match(scan.glob, field, strlen(field)))
+        continue;
+      rpush(scan.results, create_dblistnode_with_string((char *)field));
+      rpush(scan.results, create_dblistnode_with_string((char *)value));
+    }
+    core_reply_scan(reply, 0, &scan);
+    return;
+  }
+
+  if (zset)
+  {
+    // as core_scan_table does, for the dict of the set
+    db_uint_t bucket_cursor = (db_uint_t)cursor;
+    uint64_t buckets = (uint64_t)count * CORE_SCAN_MAX_BUCKETS_PER_RESULT;
+    do
+    {
+      bucket_cursor = zdict_scan(zset->dict, bucket_cursor, core_scan_zset_visit, &scan);
+    } while (bucket_cursor && scan.found < count && --buckets);
+    core_reply_scan(reply, bucket_cursor, &scan);
+    return;
+  }
+  core_reply_scan(reply, core_scan_table(entry->data->value.hash, (db_uint_t)cursor, count, &scan), &scan);
+}
+
+void db_hscan(DBRequest *request, DBReply *reply)
+{
+  core_reply_value_scan(request, reply, false);
+}
+
+void db_zscan(DBRequest *request, DBReply *reply)
+{
+  core_reply_value_scan(request, reply, true);
+}
+
+void db_shutdown(DBRequest *request, DBReply *reply)
+{
+  if (!is_running)
+  {
+    reply_error(reply, DB_ERR_DB_IS_CLOSED);
+    return;
+  }
+
+  // The workers leave their loops once the current batch is done and are joined by the next db_start.
+  is_running = false;
+
+  // The final save below supersedes whatever the child was writing.
+  core_stop_bgsave();
+
+  // Replicas sync again from scratch with whatever serves them next.
+  repl_unfollow();
+  repl_reset();
+
+  db_save(request, reply);
+
+  // Every shard is held here, and the workers check the log only while holding theirs.
+  aof_close(aof);
+  aof = NULL;
+
+  // The timer heap of an expiry table points into its keyspace, so they go together.
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    ht_reset(shards[i].main_ht);
+    ht_reset(shards[i].expr_ht);
+    blocking_free(shards[i].blocking, DB_ERR_DB_IS_CLOSED);
+    shards[i].blocking = blocking_create();
+  }
+  // What the tables retired goes now, once the readers still in them are done.
+  epoch_synchronize();
+  epoch_reclaim();
+
+  reply_data(reply, dbobj_shared_ok());
+}
+
+static cJSON *core_json_from_obj(DBObj *obj)
+{
+  cJSON *json;
+  DBQuickListIter iter;
+  const char *string;
+  DBHashObjIter hash_iter;
+  const char *field;
+  DBZSetIter zset_iter;
+  const char *member;
+  db_double_t member_score;
+
+  switch (obj->type)
+  {
+  case DB_TYPE_STRING:
+    if (obj->encoding == DB_ENCODING_ROPE)
+    {
+      char *flat = rope_flatten(obj->value.rope);
+      json = cJSON_CreateString(flat);
+      free(flat);
+      return json;
+    }
+    return cJSON_CreateString(obj->value.string);
+  case DB_TYPE_LIST:
+    json = cJSON_CreateArray();
+    ql_iter_init(obj->value.quicklist, &iter);
+    while ((string = ql_iter_next(&iter, NULL)))
+      cJSON_AddItemToArray(json, cJSON_CreateString(string));
+    return json;
+  case DB_TYPE_HASH:
+    json = cJSON_CreateObject();
+    hashobj_iter_init(obj, &hash_iter);
+    while ((field = hashobj_iter_next(&hash_iter, &string)))
+      cJSON_AddItemToObject(json, field, cJSON_CreateString(string));
+    return json;
+  case DB_TYPE_ZSET:
+    json = cJSON_CreateObject();
+    zset_iter_init(obj->value.zset, &zset_iter);
+    while ((member = zset_iter_next(&zset_iter, &member_score)))
+    {
+      if (isfinite(member_score))
+        cJSON_AddItemToObject(json, member, cJSON_CreateNumber(member_score));
+      else
+        cJSON_AddItemToObject(json, member, cJSON_CreateString(isnan(member_score) ? "nan" : member_score > 0 ? "inf" : "-inf"));
+    }
+    return json;
+  default:
+    return NULL;
+  }
+}
+
+static void core_save_buckets(cJSON *root, DBHashEntry **buckets, db_uint_t size)
+{
+  DBHashEntry *entry;
+  cJSON *value, *wrapper;
+  const char *type_name;
+
+  if (!buckets)
+    return;
+
+  for (db_uint_t i = 0; i < size; ++i)
+  {
+    for (entry = buckets[i]; entry; entry = entry->next)
+    {
+      value = core_json_from_obj(entry->data);
+      if (!value)
+        continue;
+
+      if (!entry->expire_at_ms && (entry->data->type == DB_TYPE_STRING || entry->data->type == DB_TYPE_LIST))
+      {
+        // Plain strings and lists keep the layout older versions wrote.
+        cJSON_AddItemToObject(root, entry->key, value);
+        continue;
+      }
+
+      type_name = entry->data->type == DB_TYPE_STRING ? "string"
+                  : entry->data->type == DB_TYPE_LIST ? "list"
+                  : entry->data->type == DB_TYPE_HASH ? "hash"
+                                                      : "zset";
+      wrapper = cJSON_CreateObject();
+      cJSON_AddStringToObject(wrapper, "type", type_name);
+      cJSON_AddItemToObject(wrapper, "value", value);
+      if (entry->expire_at_ms)
+        cJSON_AddNumberToObject(wrapper, "expire_at_ms", (double)entry->expire_at_ms);
+      cJSON_AddItemToObject(root, entry->key, wrapper);
+    }
+  }
+}
+
+static db_bool_t core_save_json(const char *filepath)
+{
+  FILE *file = fopen(filepath, "w");
+  if (!file)
+  {
+    perror("Failed to open file while saving.");
+    return false;
+  }
+
+  // The tree is thrown away as soon as it is printed, so it is built in an arena and freed whole.
+  cJSON_Arena *arena = cJSON_ArenaNew(0);
+  if (!arena)
+    EXIT_ON_MEMORY_ERROR();
+  cJSON_Arena *previous_arena = cJSON_ArenaUse(arena);
+  cJSON *root = cJSON_CreateObject();
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    core_save_buckets(root, shards[i].main_ht->buckets0, shards[i].main_ht->size0);
+    core_save_buckets(root, shards[i].main_ht->buckets1, shards[i].main_ht->size1);
+  }
+  cJSON_ArenaUse(previous_arena);
+
+  char *json_string = cJSON_PrintUnformatted(root);
+
+  if (!json_string)
+    EXIT_ON_MEMORY_ERROR();
+
+  fputs(json_string, file);
+  fclose(file);
+  free(json_string);
+  cJSON_ArenaDelete(arena);
+
+  return true;
+}
+
+static db_bool_t core_save_snapshot(const char *filepath, SnapshotProgress *progress)
+{
+  DBHash **tables = (DBHash **)malloc(2 * shards_length * sizeof(DBHash *));
+  if (!tables)
+    EXIT_ON_MEMORY_ERROR();
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    tables[i] = shards[i].main_ht;
+    tables[shards_length + i] = shards[i].expr_ht;
+  }
+
+  db_bool_t is_success = snapshot_save(filepath, tables, tables + shards_length, shards_length, progress);
+
+  free(tables);
+  return is_success;
+}
+
+void db_save(DBRequest *request, DBReply *reply)
+{
+  if (!persistence_filepath)
+  {
+    reply_data(reply, dbobj_shared_bool(false));
     return;
   }
 
-  db_uint_t deleted_count = 0;
+  // Both would write the same temporary file.
+  core_poll_bgsave(false);
+  if (bgsave_child != -1)
+  {
+    reply_error(reply, DB_ERR_BGSAVE_IN_PROGRESS);
+    return;
+  }
 
-  while (key)
+  // The log must not hold anything served before the save once it is emptied below.
+  core_flush_aof_all();
+
+  db_bool_t is_success = persistence_format == DB_PERSISTENCE_JSON
+                             ? core_save_json(persistence_filepath)
+                             : core_save_snapshot(persistence_filepath, NULL);
+
+  if (!is_success)
   {
-    if (hdel(main_ht, key, expr_ht))
-      ++deleted_count;
-    key = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    reply_data(reply, dbobj_shared_bool(false));
+    return;
   }
 
-  reply_data(reply, dbobj_create_uint(deleted_count));
+  aof_truncate(aof);
+  last_save_at = time(NULL);
+  reply_data(reply, dbobj_shared_ok());
 }
 
-void db_lpush(DBRequest *request, DBReply *reply)
+static void core_poll_bgsave(db_bool_t wait)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *member = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  int status;
 
-  if (!key || !member)
+  if (bgsave_child == -1)
+    return;
+
+  pid_t pid = waitpid(bgsave_child, &status, wait ? 0 : WNOHANG);
+  if (pid == 0)
+    return;
+
+  db_bool_t is_success = pid == bgsave_child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  bgsave_child = -1;
+
+  if (bgsave_is_rewrite)
+    last_bgrewrite_is_success = is_success;
+  else
+    last_bgsave_is_success = is_success;
+  if (is_success && !bgsave_is_rewrite)
+    last_save_at = time(NULL);
+
+  if (!aof)
+    return;
+
+  // The log was rotated when the child forked, so the current one holds exactly what came after.
+  char *rotated_filepath = core_filepath_with_suffix(aof->filepath, AOF_ROTATED_SUFFIX);
+  char *rewrite_filepath = core_filepath_with_suffix(aof->filepath, AOF_REWRITE_SUFFIX);
+  if (!is_success)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    // Nothing captured the rotated log, put it back in front.
+    aof_absorb(aof, rotated_filepath);
+    remove(rewrite_filepath);
+  }
+  else if (bgsave_is_rewrite && !aof_absorb(aof, rewrite_filepath))
+  {
+    last_bgrewrite_is_success = false;
+    aof_absorb(aof, rotated_filepath);
+    remove(rewrite_filepath);
+  }
+  else
+    remove(rotated_filepath);
+  free(rotated_filepath);
+  free(rewrite_filepath);
+}
+
+static void core_stop_bgsave()
+{
+  if (bgsave_child == -1)
+    return;
+
+  kill(bgsave_child, SIGKILL);
+  core_poll_bgsave(true);
+
+  // The child never got to rename its file into place.
+  char *temp_filepath = core_filepath_with_suffix(persistence_filepath, ".tmp");
+  remove(temp_filepath);
+  free(temp_filepath);
+}
+
+void db_bgsave(DBRequest *request, DBReply *reply)
+{
+  core_poll_bgsave(false);
+  if (bgsave_child != -1)
+  {
+    reply_error(reply, DB_ERR_BGSAVE_IN_PROGRESS);
+    return;
+  }
+
+  if (!persistence_filepath)
+  {
+    reply_data(reply, dbobj_shared_bool(false));
+    return;
+  }
+
+  if (!bgsave_progress)
+  {
+    bgsave_progress = (SnapshotProgress *)mmap(NULL, sizeof(SnapshotProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (bgsave_progress == MAP_FAILED)
+    {
+      bgsave_progress = NULL;
+      EXIT_ON_MEMORY_ERROR();
+    }
+  }
+
+  atomic_store(&bgsave_progress->saved_keys, 0);
+  bgsave_progress->total_keys = 0;
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    bgsave_progress->total_keys += shards[i].main_ht->count0 + shards[i].main_ht->count1;
+
+  if (!core_rotate_aof())
+  {
+    reply_error(reply, DB_ERR_BGSAVE_FAILED);
+    return;
+  }
+
+  // Every shard is held here, so the child gets a copy-on-write image of one point in time.
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    db_bool_t is_success = persistence_format == DB_PERSISTENCE_JSON
+                               ? core_save_json(persistence_filepath)
+                               : core_save_snapshot(persistence_filepath, bgsave_progress);
+    _exit(is_success ? 0 : 1);
+  }
+
+  if (pid < 0)
+  {
+    perror("Failed to fork for background save.");
+    core_unrotate_aof();
+    reply_error(reply, DB_ERR_BGSAVE_FAILED);
+    return;
+  }
+
+  bgsave_child = pid;
+  bgsave_is_rewrite = false;
+  bgsave_started_at = time(NULL);
+  reply_data(reply, dbobj_create_string_with_dup("Background saving started"));
+}
+
+static void core_rewrite_table_entry(DBAofBuffer *buffer, const char *key, DBObj *obj)
+{
+  DBQuickListIter iter;
+  DBHashObjIter hash_iter;
+  const char *field, *value;
+  DBZSetIter zset_iter;
+  const char *member;
+  db_double_t member_score;
+  db_uint_t remaining, argc, i;
+  char score[32];
+
+  switch (obj->type)
+  {
+  case DB_TYPE_STRING:
+    if (obj->encoding == DB_ENCODING_ROPE)
+    {
+      // A chunk per command, so the rope is never joined into one string
+      for (i = 0; i < obj->value.rope->length; ++i)
+      {
+        aof_buffer_begin(buffer, 3);
+        aof_buffer_append_arg(buffer, db_action_name(i ? DB_APPEND : DB_SET));
+        aof_buffer_append_arg(buffer, key);
+        aof_buffer_append_bytes(buffer, obj->value.rope->chunks[i]->data, obj->value.rope->chunks[i]->length);
+      }
+      break;
+    }
+    aof_buffer_begin(buffer, 3);
+    aof_buffer_append_arg(buffer, db_action_name(DB_SET));
+    aof_buffer_append_arg(buffer, key);
+    aof_buffer_append_arg(buffer, obj->value.string);
+    break;
+  case DB_TYPE_LIST:
+    ql_iter_init(obj->value.quicklist, &iter);
+    for (remaining = obj->value.quicklist->length; remaining; remaining -= argc)
+    {
+      argc = remaining < AOF_REWRITE_ITEMS_PER_COMMAND ? remaining : AOF_REWRITE_ITEMS_PER_COMMAND;
+      aof_buffer_begin(buffer, 2 + argc);
+      aof_buffer_append_arg(buffer, db_action_name(DB_RPUSH));
+      aof_buffer_append_arg(buffer, key);
+      for (i = 0; i < argc; ++i)
+        aof_buffer_append_arg(buffer, ql_iter_next(&iter, NULL));
+    }
+    break;
+  case DB_TYPE_HASH:
+    hashobj_iter_init(obj, &hash_iter);
+    for (remaining = hashobj_length(obj); remaining; remaining -= argc)
+    {
+      argc = remaining < AOF_REWRITE_ITEMS_PER_COMMAND ? remaining : AOF_REWRITE_ITEMS_PER_COMMAND;
+      aof_buffer_begin(buffer, 2 + 2 * argc);
+      aof_buffer_append_arg(buffer, db_action_name(DB_HSET));
+      aof_buffer_append_arg(buffer, key);
+      for (i = 0; i < argc && (field = hashobj_iter_next(&hash_iter, &value)); ++i)
+      {
+        aof_buffer_append_arg(buffer, field);
+        aof_buffer_append_arg(buffer, value);
+      }
+    }
+    break;
+  case DB_TYPE_ZSET:
+    zset_iter_init(obj->value.zset, &zset_iter);
+    for (remaining = zcard(obj->value.zset); remaining; remaining -= argc)
+    {
+      argc = remaining < AOF_REWRITE_ITEMS_PER_COMMAND ? remaining : AOF_REWRITE_ITEMS_PER_COMMAND;
+      aof_buffer_begin(buffer, 2 + 2 * argc);
+      aof_buffer_append_arg(buffer, db_action_name(DB_ZADD));
+      aof_buffer_append_arg(buffer, key);
+      for (i = 0; i < argc && (member = zset_iter_next(&zset_iter, &member_score)); ++i)
+      {
+        sprintf(score, "%.17g", member_score);
+        aof_buffer_append_arg(buffer, score);
+        aof_buffer_append_arg(buffer, member);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static db_bool_t core_rewrite_aof(const char *filepath)
+{
+  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  DBAofBuffer buffer = {0};
+  DBHashEntry *entry;
+  db_bool_t is_success = true;
+  char deadline_string[24];
+
+  // Replayed on top of the snapshot, so the rewritten log starts from nothing.
+  aof_buffer_begin(&buffer, 1);
+  aof_buffer_append_arg(&buffer, db_action_name(DB_FLUSHALL));
+
+  for (db_uint_t s = 0; s < shards_length && is_success; ++s)
+  {
+    DBHash *ht = shards[s].main_ht;
+    for (int table = 0; table < 2; ++table)
+    {
+      DBHashEntry **buckets = table ? ht->buckets1 : ht->buckets0;
+      db_uint_t size = table ? ht->size1 : ht->size0;
+      for (db_uint_t i = 0; buckets && i < size && is_success; ++i)
+        for (entry = buckets[i]; entry; entry = entry->next)
+        {
+          core_rewrite_table_entry(&buffer, entry->key, entry->data);
+          if (entry->expire_at_ms)
+          {
+            sprintf(deadline_string, "%llu", (unsigned long long)entry->expire_at_ms);
+            aof_buffer_begin(&buffer, 3);
+            aof_buffer_append_arg(&buffer, db_action_name(DB_PEXPIREAT));
+            aof_buffer_append_arg(&buffer, entry->key);
+            aof_buffer_append_arg(&buffer, deadline_string);
+          }
+          if (buffer.length >= AOF_BUFFER_FLUSH_SIZE)
+            is_success = aof_buffer_write_fd(&buffer, fd);
+        }
+    }
+  }
+
+  is_success = is_success && aof_buffer_write_fd(&buffer, fd) && fsync(fd) == 0;
+  aof_buffer_free(&buffer);
+  close(fd);
+  return is_success;
+}
+
+static db_bool_t core_rotate_aof()
+{
+  if (!aof)
+    return true;
+
+  core_flush_aof_all();
+  char *rotated_filepath = core_filepath_with_suffix(aof->filepath, AOF_ROTATED_SUFFIX);
+  db_bool_t is_success = aof_rotate(aof, rotated_filepath);
+  free(rotated_filepath);
+  return is_success;
+}
+
+static void core_unrotate_aof()
+{
+  if (!aof)
+    return;
+
+  char *rotated_filepath = core_filepath_with_suffix(aof->filepath, AOF_ROTATED_SUFFIX);
+  aof_absorb(aof, rotated_filepath);
+  free(rotated_filepath);
+}
+
+void db_bgrewriteaof(DBRequest *request, DBReply *reply)
+{
+  core_poll_bgsave(false);
+  if (bgsave_child != -1)
+  {
+    reply_error(reply, DB_ERR_BGSAVE_IN_PROGRESS);
+    return;
+  }
+
+  if (!aof)
+  {
+    reply_error(reply, DB_ERR_AOF_DISABLED);
+    return;
+  }
+
+  if (!core_rotate_aof())
+  {
+    reply_error(reply, DB_ERR_BGSAVE_FAILED);
+    return;
+  }
+
+  char *rewrite_filepath = core_filepath_with_suffix(aof->filepath, AOF_REWRITE_SUFFIX);
+
+  // Same as BGSAVE: the child sees the dataset as of the rotation.
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(core_rewrite_aof(rewrite_filepath) ? 0 : 1);
+
+  free(rewrite_filepath);
+
+  if (pid < 0)
+  {
+    perror("Failed to fork for append-only log rewrite.");
+    core_unrotate_aof();
+    reply_error(reply, DB_ERR_BGSAVE_FAILED);
     return;
   }
 
-  DBList *list = core_retrieve_list(key, true);
+  bgsave_child = pid;
+  bgsave_is_rewrite = true;
+  bgsave_started_at = time(NULL);
+  reply_data(reply, dbobj_create_string_with_dup("Background append only file rewriting started"));
+}
+
+void db_lastsave(DBRequest *request, DBReply *reply)
+{
+  core_poll_bgsave(false);
+  reply_data(reply, dbobj_shared_uint((db_uint_t)last_save_at));
+}
+
+void db_info_persistence(DBRequest *request, DBReply *reply)
+{
+  char line[64];
+  DBList *lines = create_dblist();
+  db_bool_t in_progress;
+  uint64_t mapped_keys = 0;
+
+  core_poll_bgsave(false);
+  in_progress = bgsave_child != -1 && !bgsave_is_rewrite;
+
+  sprintf(line, "bgsave_in_progress:%d", in_progress);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "bgsave_saved_keys:%llu", in_progress ? atomic_load(&bgsave_progress->saved_keys) : 0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "bgsave_total_keys:%llu", in_progress ? bgsave_progress->total_keys : 0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "bgsave_current_time_sec:%ld", in_progress ? (long)(time(NULL) - bgsave_started_at) : -1L);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "last_save_time:%ld", (long)last_save_at);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "last_bgsave_status:%s", last_bgsave_is_success ? "ok" : "err");
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "aof_enabled:%d", aof != NULL);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "aof_rewrite_in_progress:%d", bgsave_child != -1 && bgsave_is_rewrite);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "aof_last_bgrewrite_status:%s", last_bgrewrite_is_success ? "ok" : "err");
+  rpush(lines, create_dblistnode_with_string(line));
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    mapped_keys += shards[i].mapped ? mapped_index_count(shards[i].mapped) : 0;
+  sprintf(line, "mapped_keys:%llu", (unsigned long long)mapped_keys);
+  rpush(lines, create_dblistnode_with_string(line));
+
+  reply_data(reply, dbobj_create_list(lines));
+}
+
+void db_info_stats(DBRequest *request, DBReply *reply)
+{
+  char line[64];
+  DBList *lines = create_dblist();
+  uint64_t expired_keys = 0, expire_cycle_us = 0, expire_time_cap_reached = 0, rehash_idle_us = 0, evicted_keys = 0;
+  uint64_t rehashing_tables = 0, rehash_buckets_left = 0, rehash_buckets_total = 0;
+  uint64_t busy_poll_hits = 0, parks = 0, busy_poll_ns = 0, hotkeys_samples = 0;
+  DBLatencyHistogram wakeup = {0};
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    busy_poll_hits += shards[i].busy_poll_hits;
+    parks += shards[i].parks;
+    busy_poll_ns += shards[i].busy_poll_ns;
+    latency_merge(&wakeup, &shards[i].wakeup);
+    hotkeys_samples += shards[i].hotkeys->samples;
+    expired_keys += shards[i].expired_keys;
+    expire_cycle_us += shards[i].expire_cycle_us;
+    expire_time_cap_reached += shards[i].expire_time_cap_reached;
+    rehash_idle_us += shards[i].rehash_idle_us;
+    evicted_keys += shards[i].evicted_keys;
+    for (db_uint_t t = 0; t < 2; ++t)
+    {
+      DBHash *ht = t ? shards[i].expr_ht : shards[i].main_ht;
+      if (ht->rehashing_index == -1)
+        continue;
+      // Buckets of the old table are moved from the last one down.
+      ++rehashing_tables;
+      rehash_buckets_left += (uint64_t)ht->rehashing_index + 1;
+      rehash_buckets_total += ht->size0;
+    }
+  }
+
+  sprintf(line, "expired_keys:%llu", (unsigned long long)expired_keys);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "expire_cycle_cpu_microseconds:%llu", (unsigned long long)expire_cycle_us);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "expired_time_cap_reached_count:%llu", (unsigned long long)expire_time_cap_reached);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "evicted_keys:%llu", (unsigned long long)evicted_keys);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "rehashing_tables:%llu", (unsigned long long)rehashing_tables);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "rehash_buckets_left:%llu", (unsigned long long)rehash_buckets_left);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "rehash_progress_percent:%.2f",
+          rehash_buckets_total ? 100.0 * (rehash_buckets_total - rehash_buckets_left) / rehash_buckets_total : 100.0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "rehash_idle_cpu_microseconds:%llu", (unsigned long long)rehash_idle_us);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_parks:%llu", (unsigned long long)parks);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_busy_poll_hits:%llu", (unsigned long long)busy_poll_hits);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_busy_poll_cpu_microseconds:%llu", (unsigned long long)(busy_poll_ns / 1000));
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_wakeups:%llu", (unsigned long long)wakeup.count);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_wakeup_p50_usec:%.3f", latency_percentile(&wakeup, 50) / 1000.0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_wakeup_p99_usec:%.3f", latency_percentile(&wakeup, 99) / 1000.0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "worker_wakeup_max_usec:%.3f", wakeup.max_ns / 1000.0);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "hotkeys_samples:%llu", (unsigned long long)hotkeys_samples);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "lazyfree_pending_objects:%llu", (unsigned long long)lazyfree_pending());
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "lazyfreed_objects:%llu", (unsigned long long)lazyfree_freed());
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "blocked_clients:%llu", (unsigned long long)blocking_clients());
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "concurrent_reads:%llu", (unsigned long long)atomic_load(&concurrent_reads_served));
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "epoch_retired_pending:%llu", (unsigned long long)epoch_pending());
+  rpush(lines, create_dblistnode_with_string(line));
+
+  reply_data(reply, dbobj_create_list(lines));
+}
+
+void db_info_commandstats(DBRequest *request, DBReply *reply)
+{
+  DBList *lines = create_dblist();
+  DBCommandStats stats;
+  char name[64], line[384];
+
+  for (db_uint_t action = 0; action < DB_ACTION_COUNT; ++action)
+  {
+    memset(&stats, 0, sizeof(stats));
+    for (db_uint_t i = 0; i < shards_length; ++i)
+      if (shards[i].command_stats[action])
+      {
+        latency_merge(&stats.queue, &shards[i].command_stats[action]->queue);
+        latency_merge(&stats.exec, &shards[i].command_stats[action]->exec);
+      }
+    if (!stats.exec.count)
+      continue;
+
+    // Named the way Redis names them, in lower case
+    size_t length = 0;
+    for (const char *c = db_action_name(action); *c && length < sizeof(name) - 1; ++c)
+      name[length++] = (char)tolower((unsigned char)*c);
+    name[length] = '\0';
+    snprintf(line, sizeof(line),
+             "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f,queue_usec_per_call=%.2f,"
+             "p50=%.3f,p99=%.3f,p99.9=%.3f,max=%.3f,queue_p50=%.3f,queue_p99=%.3f",
+             name, (unsigned long long)stats.exec.count, (unsigned long long)(stats.exec.total_ns / 1000),
+             stats.exec.total_ns / 1000.0 / stats.exec.count, stats.queue.total_ns / 1000.0 / stats.queue.count,
+             latency_percentile(&stats.exec, 50) / 1000.0, latency_percentile(&stats.exec, 99) / 1000.0,
+             latency_percentile(&stats.exec, 99.9) / 1000.0, stats.exec.max_ns / 1000.0,
+             latency_percentile(&stats.queue, 50) / 1000.0, latency_percentile(&stats.queue, 99) / 1000.0);
+    rpush(lines, create_dblistnode_with_string(line));
+  }
+
+  reply_data(reply, dbobj_create_list(lines));
+}
+
+void db_slowlog_get(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 10;
+  reply_data(reply, dbobj_create_list(slowlog_get(count)));
+}
+
+void db_slowlog_len(DBRequest *request, DBReply *reply)
+{
+  reply_data(reply, dbobj_shared_uint(slowlog_length()));
+}
+
+void db_slowlog_reset(DBRequest *request, DBReply *reply)
+{
+  slowlog_reset();
+  reply_data(reply, dbobj_shared_ok());
+}
+
+typedef struct DBRankedKey
+{
+  const DBHotKey *key;
+  const DBHotKeys *hotkeys;
+  uint64_t rank;
+} DBRankedKey;
+
+static int core_compare_ranked_keys(const void *a, const void *b)
+{
+  uint64_t x = ((const DBRankedKey *)a)->rank, y = ((const DBRankedKey *)b)->rank;
+  return x > y ? -1 : x < y;
+}
+
+// Replies with the tracked keys of every shard, the `count` ranked first by accesses or bytes,
+// each with its estimates and the bytes read and written since it was tracked. A key is
+// tracked by the shard it belongs to only, so the lists of the shards never share one.
+static void core_reply_hotkeys(DBRequest *request, DBReply *reply, db_bool_t by_bytes)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 10, length = 0;
+  DBRankedKey *ranked = (DBRankedKey *)malloc(HOTKEYS_TOP_K * shards_length * sizeof(DBRankedKey));
+  if (!ranked)
+    EXIT_ON_MEMORY_ERROR();
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
+  {
+    const DBHotKeys *hotkeys = shards[i].hotkeys;
+    const DBHotKey *keys = by_bytes ? hotkeys->largest : hotkeys->hottest;
+    for (db_uint_t k = 0; k < (by_bytes ? hotkeys->largest_length : hotkeys->hottest_length); ++k)
+      ranked[length++] = (DBRankedKey){&keys[k], hotkeys, keys[k].estimate};
+  }
+  qsort(ranked, length, sizeof(DBRankedKey), core_compare_ranked_keys);
+
+  DBList *entries = create_dblist();
+  for (db_uint_t i = 0; i < length && i < count; ++i)
+  {
+    const DBHotKey *key = ranked[i].key;
+    DBList *fields = create_dblist();
+    rpush(fields, create_dblistnode(dbobj_create_string_from_bytes(key->key, key->length)));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)hotkeys_accesses(ranked[i].hotkeys, key->hash))));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)(key->read_bytes * HOTKEYS_SAMPLE_RATE))));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)(key->write_bytes * HOTKEYS_SAMPLE_RATE))));
+    rpush(entries, create_dblistnode(dbobj_create_list(fields)));
+  }
+  free(ranked);
+  reply_data(reply, dbobj_create_list(entries));
+}
+
+void db_hotkeys_get(DBRequest *request, DBReply *reply)
+{
+  core_reply_hotkeys(request, reply, false);
+}
+
+void db_hotkeys_bytes(DBRequest *request, DBReply *reply)
+{
+  core_reply_hotkeys(request, reply, true);
+}
+
+void db_hotkeys_reset(DBRequest *request, DBReply *reply)
+{
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    hotkeys_reset(shards[i].hotkeys);
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_trace_start(DBRequest *request, DBReply *reply)
+{
+  trace_start();
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_trace_stop(DBRequest *request, DBReply *reply)
+{
+  trace_stop();
+  reply_data(reply, dbobj_shared_ok());
+}
+
+void db_trace_get(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 128;
+  DBTraceEvent *events = (DBTraceEvent *)malloc((count ? count : 1) * sizeof(DBTraceEvent));
+  if (!events)
+    EXIT_ON_MEMORY_ERROR();
+  DBList *lines = create_dblist();
+  char line[128];
 
-  if (!list)
+  count = trace_collect(events, count);
+  for (db_uint_t i = 0; i < count; ++i)
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
-    return;
+    snprintf(line, sizeof(line), "%llu %s %llu %llu %u",
+             (unsigned long long)events[i].started_at, trace_event_name(events[i].event),
+             (unsigned long long)events[i].duration_ns, (unsigned long long)events[i].arg, events[i].thread);
+    rpush(lines, create_dblistnode_with_string(line));
   }
+  free(events);
 
-  while (member)
-  {
-    lpush(list, create_dblistnode_with_string(member));
-    member = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  }
+  reply_data(reply, dbobj_create_list(lines));
+}
+
+// Loads a full sync through the shards, called by the link thread of a replica
+static db_bool_t core_replica_load(const char *filepath, void *context)
+{
+  DBRequest *request = create_request(DB_REPLICA_LOAD);
+  add_request_arg(request, dbobj_create_string_with_dup(filepath));
+  request->is_from_primary = true;
+  DBReply *reply = reply_wait(db_handle_request(request));
+  db_bool_t is_loaded = reply->data && reply->data->type != DB_TYPE_ERROR;
+  free_reply(reply);
+  free_request(request);
+  return is_loaded;
+}
 
-  reply_data(reply, dbobj_create_uint(list->length));
+// Applies a record streamed by the primary, called by the link thread of a replica
+static void core_replica_apply(DBRequest *request, void *context)
+{
+  request->is_from_primary = true;
+  free_reply(reply_wait(db_handle_request(request)));
 }
 
-void db_lpop(DBRequest *request, DBReply *reply)
+void db_replicaof(DBRequest *request, DBReply *reply)
 {
   DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 1;
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *host = get_string_arg(curr_arg_node);
+  char *port_arg = get_string_arg(curr_arg_node->next);
+  char *port_end = NULL;
 
-  if (!key || !count || curr_arg_node)
+  if (host && port_arg && strcmp(host, "NO") == 0 && strcmp(port_arg, "ONE") == 0)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    repl_unfollow();
+    reply_data(reply, dbobj_shared_ok());
     return;
   }
 
-  DBList *list = core_retrieve_list(key, false);
-
-  if (!list)
+  unsigned long port = port_arg ? strtoul(port_arg, &port_end, 10) : 0;
+  if (!host || !*host || !port || port > 65535 || *port_end)
   {
-    reply_data(reply, dbobj_create_null());
+    reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
 
-  if (count == 1)
-  {
-    reply_data(reply, dbobj_create_string(extract_dblistnode_string(lpop(list))));
-  }
-  else if (count)
-  {
-    reply_data(reply, dbobj_create_list(lpop_n(list, count)));
-  }
+  char *snapshot_filepath = core_filepath_with_suffix(persistence_filepath ? persistence_filepath : DEFAULT_SNAPSHOT_FILE, REPL_SYNC_SUFFIX);
+  repl_follow(host, (db_uint_t)port, snapshot_filepath, core_replica_load, core_replica_apply, NULL);
+  free(snapshot_filepath);
+  reply_data(reply, dbobj_shared_ok());
 }
 
-void db_rpush(DBRequest *request, DBReply *reply)
+void db_psync(DBRequest *request, DBReply *reply)
 {
+  static db_uint_t syncs = 0;
   DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *member = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *id_arg = get_string_arg(curr_arg_node);
+  char *offset_arg = get_string_arg(curr_arg_node->next);
+  char id[REPL_ID_LENGTH + 1], offset[24], suffix[32];
 
-  if (!key || !member)
+  if (!id_arg || !offset_arg)
   {
     reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
 
-  DBList *list = core_retrieve_list(key, true);
+  // Records served before the backlog came to be are in no snapshot taken after them, and in no
+  // stream either, so they go out first.
+  core_flush_aof_all();
+  repl_backlog_activate();
+  repl_id(id);
 
-  if (!list)
+  DBList *fields = create_dblist();
+  if (isdigit((unsigned char)*offset_arg) && repl_can_continue(id_arg, get_uint64_arg(curr_arg_node->next)))
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
+    sprintf(offset, "%llu", (unsigned long long)get_uint64_arg(curr_arg_node->next));
+    rpush(fields, create_dblistnode_with_string("CONTINUE"));
+    rpush(fields, create_dblistnode_with_string(id));
+    rpush(fields, create_dblistnode_with_string(offset));
+    reply_data(reply, dbobj_create_list(fields));
     return;
   }
 
-  while (member)
+  // Every shard is held, so the snapshot is exactly the dataset at this offset.
+  sprintf(offset, "%llu", (unsigned long long)repl_offset());
+  sprintf(suffix, "%s-%llu", REPL_SYNC_SUFFIX, (unsigned long long)syncs++);
+  char *snapshot_filepath = core_filepath_with_suffix(persistence_filepath ? persistence_filepath : DEFAULT_SNAPSHOT_FILE, suffix);
+  if (!core_save_snapshot(snapshot_filepath, NULL))
   {
-    rpush(list, create_dblistnode_with_string(member));
-    member = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    free(snapshot_filepath);
+    free_dblist(fields);
+    reply_error(reply, DB_ERR_SYNC_FAILED);
+    return;
   }
-
-  reply_data(reply, dbobj_create_uint(list->length));
+  rpush(fields, create_dblistnode_with_string("FULLRESYNC"));
+  rpush(fields, create_dblistnode_with_string(id));
+  rpush(fields, create_dblistnode_with_string(offset));
+  rpush(fields, create_dblistnode_with_string(snapshot_filepath));
+  free(snapshot_filepath);
+  reply_data(reply, dbobj_create_list(fields));
 }
 
-void db_rpop(DBRequest *request, DBReply *reply)
+void db_replica_load(DBRequest *request, DBReply *reply)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  db_uint_t count = curr_arg_node ? get_uint_arg(curr_arg_node) : 1;
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-
-  if (!key || !count || curr_arg_node)
+  if (!request->is_from_primary)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    reply_error(reply, DB_ERR_UNKNOWN_COMMAND);
     return;
   }
 
-  DBList *list = core_retrieve_list(key, false);
-
-  if (!list)
+  DBShard *selected = shard;
+  char *filepath = get_string_arg(get_arg_head_node(request));
+  db_flushall(NULL, NULL);
+  db_bool_t is_success = filepath && snapshot_load(filepath, core_load_entry, NULL);
+  core_select_shard(selected);
+  if (!is_success)
   {
-    reply_data(reply, dbobj_create_null());
+    // Half a dataset is worse than none, the link syncs again from scratch.
+    db_flushall(NULL, NULL);
+    reply_error(reply, DB_ERR_SYNC_FAILED);
     return;
   }
+  core_recount_contents();
 
-  if (count == 1)
-  {
-    reply_data(reply, dbobj_create_string(extract_dblistnode_string(rpop(list))));
-  }
-  else if (count)
+  // Whatever the log held describes the dataset just replaced.
+  if (aof)
+    db_save(request, reply);
+  else
+    reply_data(reply, dbobj_shared_ok());
+}
+
+void db_info_replication(DBRequest *request, DBReply *reply)
+{
+  char line[320];
+  char host[256] = "";
+  char id[REPL_ID_LENGTH + 1];
+  db_uint_t port = 0;
+  DBList *lines = create_dblist();
+  db_bool_t is_replica = repl_is_replica();
+
+  sprintf(line, "role:%s", is_replica ? "replica" : "primary");
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "connected_replicas:%llu", (unsigned long long)repl_connected_replicas());
+  rpush(lines, create_dblistnode_with_string(line));
+  repl_id(id);
+  sprintf(line, "replid:%s", id);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "repl_offset:%llu", (unsigned long long)repl_offset());
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "repl_backlog_active:%d", repl_backlog_is_active());
+  rpush(lines, create_dblistnode_with_string(line));
+  if (is_replica)
   {
-    reply_data(reply, dbobj_create_list(rpop_n(list, count)));
+    db_bool_t is_up = repl_link_status(host, sizeof(host), &port);
+    sprintf(line, "primary_host:%s", host);
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "primary_port:%llu", (unsigned long long)port);
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "primary_link_status:%s", is_up ? "up" : "down");
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "replica_offset:%llu", (unsigned long long)repl_replica_offset());
+    rpush(lines, create_dblistnode_with_string(line));
   }
+
+  reply_data(reply, dbobj_create_list(lines));
 }
 
-void db_llen(DBRequest *request, DBReply *reply)
+// Reads a slot number; false if the argument isn't one
+static db_bool_t core_slot_arg(DBListNode *node, db_uint_t *slot)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char *arg = get_string_arg(node), *end = NULL;
+  unsigned long value = arg && isdigit((unsigned char)*arg) ? strtoul(arg, &end, 10) : CLUSTER_SLOTS;
+  if (value >= CLUSTER_SLOTS || *end)
+    return false;
+  *slot = (db_uint_t)value;
+  return true;
+}
 
-  if (!key || curr_arg_node)
+// Reads a host and a port into the index of their node; CLUSTER_NODE_NONE if they aren't valid
+static uint16_t core_node_arg(DBListNode *node)
+{
+  char *host = get_string_arg(node);
+  char *port_arg = node ? get_string_arg(node->next) : NULL;
+  char *port_end = NULL;
+  unsigned long port = port_arg && isdigit((unsigned char)*port_arg) ? strtoul(port_arg, &port_end, 10) : 0;
+  if (!host || !*host || !port || port > 65535 || *port_end)
+    return CLUSTER_NODE_NONE;
+  return cluster_node(host, (db_uint_t)port);
+}
+
+void db_cluster_keyslot(DBRequest *request, DBReply *reply)
+{
+  char *key = get_string_arg(get_arg_head_node(request));
+  if (!key)
   {
     reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
-
-  const DBList const *list = core_retrieve_list(key, false);
-
-  reply_data(reply, dbobj_create_uint(list ? list->length : 0));
+  reply_data(reply, dbobj_shared_uint(cluster_keyslot(key)));
 }
 
-void db_lrange(DBRequest *request, DBReply *reply)
+void db_cluster_addslots(DBRequest *request, DBReply *reply)
 {
   DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  db_uint_t start = curr_arg_node ? get_uint_arg(curr_arg_node) : 0;
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  db_uint_t stop = curr_arg_node ? get_uint_arg(curr_arg_node) : DB_UINT_MAX;
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t first = 0, last = 0;
 
-  if (!key || curr_arg_node)
+  if (!cluster_is_enabled())
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    reply_error(reply, DB_ERR_CLUSTER_DISABLED);
     return;
   }
-
-  DBList *list = core_retrieve_list(key, false);
-
-  list = lrange(list, start, stop);
-
-  if (!list)
+  db_bool_t is_valid = core_slot_arg(curr_arg_node, &first);
+  last = first;
+  if (is_valid && curr_arg_node->next)
+    is_valid = core_slot_arg(curr_arg_node->next, &last);
+  if (!is_valid || last < first)
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
+    reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
-
-  reply_data(reply, dbobj_create_list(list));
+  // All of them or none.
+  for (db_uint_t slot = first; slot <= last; ++slot)
+    if (cluster_slot_owner(slot) != CLUSTER_NODE_NONE && cluster_slot_owner(slot) != CLUSTER_NODE_MYSELF)
+    {
+      reply_error(reply, DB_ERR_SLOT_BUSY);
+      return;
+    }
+  for (db_uint_t slot = first; slot <= last; ++slot)
+    cluster_set_slot_owner(slot, CLUSTER_NODE_MYSELF);
+  reply_data(reply, dbobj_shared_ok());
 }
 
-void db_hget(DBRequest *request, DBReply *reply)
+void db_cluster_setslot(DBRequest *request, DBReply *reply)
 {
   DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *field = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  db_uint_t argc = request->args->length, slot;
+  char *mode = get_string_arg(curr_arg_node->next);
+  uint16_t node = argc == 4 ? core_node_arg(curr_arg_node->next->next) : CLUSTER_NODE_MYSELF;
 
-  if (!key || !field || curr_arg_node)
+  if (!cluster_is_enabled())
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
+    reply_error(reply, DB_ERR_CLUSTER_DISABLED);
     return;
   }
-
-  DBHashEntry *entry = hget(main_ht, key, expr_ht);
-
-  if (!entry)
+  if (!core_slot_arg(curr_arg_node, &slot) || !mode || argc == 3 || node == CLUSTER_NODE_NONE)
   {
-    reply_data(reply, dbobj_create_null());
+    reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
 
-  if (!dbobj_is_hash(entry->data))
+  if (strcmp(mode, "NODE") == 0)
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
-    return;
+    cluster_set_slot_owner(slot, node);
+    cluster_set_slot_state(slot, CLUSTER_SLOT_STABLE, CLUSTER_NODE_NONE);
   }
-
-  DBHashEntry *field_entry = hget(entry->data->value.hash, field, NULL);
-
-  if (!field_entry || !dbobj_is_string(field_entry->data))
-    reply_data(reply, dbobj_create_null());
+  else if (strcmp(mode, "STABLE") == 0 && argc == 2)
+    cluster_set_slot_state(slot, CLUSTER_SLOT_STABLE, CLUSTER_NODE_NONE);
+  else if (strcmp(mode, "MIGRATING") == 0 && argc == 4 && cluster_slot_owner(slot) == CLUSTER_NODE_MYSELF)
+    cluster_set_slot_state(slot, CLUSTER_SLOT_MIGRATING, node);
+  else if (strcmp(mode, "IMPORTING") == 0 && argc == 4 && cluster_slot_owner(slot) != CLUSTER_NODE_MYSELF)
+    cluster_set_slot_state(slot, CLUSTER_SLOT_IMPORTING, node);
   else
-    reply_data(reply, dbobj_create_string_with_dup(field_entry->data->value.string));
+  {
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
+  }
+  reply_data(reply, dbobj_shared_ok());
 }
 
-void db_hset(DBRequest *request, DBReply *reply)
+void db_cluster_slots(DBRequest *request, DBReply *reply)
 {
-  DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *field = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *value = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+  char line[320], address[280];
+  DBList *lines = create_dblist();
 
-  if (!key || !field || !value)
+  for (db_uint_t first = 0, last; first < CLUSTER_SLOTS; first = last + 1)
   {
-    reply_error(reply, DB_ERR_ARG_ERROR);
-    return;
+    uint16_t owner = cluster_slot_owner(first);
+    for (last = first; last + 1 < CLUSTER_SLOTS && cluster_slot_owner(last + 1) == owner; ++last)
+      ;
+    if (owner == CLUSTER_NODE_NONE)
+      continue;
+    cluster_node_address(owner, address, sizeof(address));
+    sprintf(line, "%llu %llu %s", (unsigned long long)first, (unsigned long long)last, address);
+    rpush(lines, create_dblistnode_with_string(line));
   }
 
-  DBHash *hash = NULL;
-  DBHashEntry *entry = hget(main_ht, key, expr_ht);
+  reply_data(reply, dbobj_create_list(lines));
+}
 
-  if (!entry)
+// Walks the live keys of every shard in a slot, adding up to `limit` of them to `keys` if it is
+// given; returns how many it found
+static db_uint_t core_keys_in_slot(db_uint_t slot, db_uint_t limit, DBList *keys)
+{
+  uint64_t now = ht_clock_ms();
+  db_uint_t found = 0;
+
+  for (db_uint_t s = 0; s < shards_length; ++s)
   {
-    hash = ht_create();
-    hset(main_ht, dbutil_strdup(key), dbobj_create_hash(hash), expr_ht);
+    DBHash *ht = shards[s].main_ht;
+    for (int table = 0; table < 2; ++table)
+    {
+      DBHashEntry **buckets = table ? ht->buckets1 : ht->buckets0;
+      db_uint_t size = table ? ht->size1 : ht->size0;
+      for (db_uint_t i = 0; buckets && i < size && found < limit; ++i)
+        for (DBHashEntry *entry = buckets[i]; entry && found < limit; entry = entry->next)
+        {
+          if ((entry->expire_at_ms && entry->expire_at_ms <= now) || cluster_keyslot(entry->key) != slot)
+            continue;
+          if (keys)
+            rpush(keys, create_dblistnode_with_string(entry->key));
+          ++found;
+        }
+    }
   }
-  else
+  return found;
+}
+
+void db_cluster_countkeysinslot(DBRequest *request, DBReply *reply)
+{
+  db_uint_t slot;
+  if (!core_slot_arg(get_arg_head_node(request), &slot))
   {
-    hash = entry->data->value.hash;
+    reply_error(reply, DB_ERR_ARG_ERROR);
+    return;
   }
+  reply_data(reply, dbobj_shared_uint(core_keys_in_slot(slot, DB_UINT_MAX, NULL)));
+}
 
-  if (entry && !dbobj_is_hash(entry->data))
+void db_cluster_getkeysinslot(DBRequest *request, DBReply *reply)
+{
+  DBListNode *curr_arg_node = get_arg_head_node(request);
+  db_uint_t slot;
+  if (!core_slot_arg(curr_arg_node, &slot))
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
+    reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
+  DBList *keys = create_dblist();
+  core_keys_in_slot(slot, get_uint_arg(curr_arg_node->next), keys);
+  reply_data(reply, dbobj_create_list(keys));
+}
 
-  db_uint_t set_count = 0;
-
-  while (field && value)
+void db_asking(DBRequest *request, DBReply *reply)
+{
+  if (!cluster_is_enabled())
   {
-    if (hset(hash, dbutil_strdup(field), dbobj_create_string_with_dup(value), NULL))
-      ++set_count;
-    field = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-    value = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    reply_error(reply, DB_ERR_CLUSTER_DISABLED);
+    return;
   }
-
-  reply_data(reply, dbobj_create_uint(set_count));
+  reply_data(reply, dbobj_shared_ok());
 }
 
-void db_hdel(DBRequest *request, DBReply *reply)
+void db_migrate(DBRequest *request, DBReply *reply)
 {
   DBListNode *curr_arg_node = get_arg_head_node(request);
-  char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  char *field = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-
-  if (!key || !field)
+  char *host = get_string_arg(curr_arg_node->next);
+  char *port_arg = get_string_arg(curr_arg_node->next->next);
+  char *port_end = NULL;
+  unsigned long port = port_arg && isdigit((unsigned char)*port_arg) ? strtoul(port_arg, &port_end, 10) : 0;
+  db_uint_t timeout_ms = curr_arg_node->next->next->next ? get_uint_arg(curr_arg_node->next->next->next) : CLUSTER_MIGRATE_DEFAULT_TIMEOUT_MS;
+  char deadline[24];
+
+  if (!host || !*host || !port || port > 65535 || *port_end || !timeout_ms)
   {
     reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
 
-  DBHashEntry *entry = hget(main_ht, key, expr_ht);
-
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
   if (!entry)
   {
-    reply_data(reply, dbobj_create_uint(0));
+    reply_data(reply, dbobj_create_string_with_dup("NOKEY"));
     return;
   }
 
-  if (!dbobj_is_hash(entry->data))
+  // The key travels as the commands that rebuild it, the same the log is rewritten with.
+  DBAofBuffer records = {0};
+  core_rewrite_table_entry(&records, entry->key, entry->data);
+  if (entry->expire_at_ms)
   {
-    reply_error(reply, DB_ERR_WRONGTYPE);
+    sprintf(deadline, "%llu", (unsigned long long)entry->expire_at_ms);
+    aof_buffer_begin(&records, 3);
+    aof_buffer_append_arg(&records, db_action_name(DB_PEXPIREAT));
+    aof_buffer_append_arg(&records, entry->key);
+    aof_buffer_append_arg(&records, deadline);
+  }
+  db_bool_t is_success = cluster_migrate(host, (db_uint_t)port, entry->key, &records, timeout_ms);
+  aof_buffer_free(&records);
+  if (!is_success)
+  {
+    reply_error(reply, DB_ERR_MIGRATE_FAILED);
     return;
   }
 
-  db_uint_t deleted_count = 0;
+  hdel_key(main_ht, &request->key, expr_ht);
+  reply_data(reply, dbobj_shared_ok());
+}
 
-  while (field)
+void db_info_dataset_memory(DBRequest *request, DBReply *reply)
+{
+  // Indexed by db_type_t, only the value types are filled in
+  size_t type_keys[DB_TYPE_HASH + 1] = {0};
+  size_t type_bytes[DB_TYPE_HASH + 1] = {0};
+  size_t keyspace_bytes = 0, expires_bytes = 0, total_bytes, used_bytes = 0;
+  DBHashEntry *entry;
+  DBHash *ht;
+  char line[64];
+
+  for (db_uint_t i = 0; i < shards_length; ++i)
   {
-    if (hdel(entry->data->value.hash, field, NULL))
-      ++deleted_count;
-    field = get_string_arg(curr_arg_node);
-    curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
+    ht = shards[i].main_ht;
+    // Every value counts its own bytes, so this visits each key once and none of the elements.
+    keyspace_bytes += ht->memory;
+    for (db_uint_t t = 0; t < 2; ++t)
+      for (db_uint_t b = 0; b < (t ? ht->size1 : ht->size0); ++b)
+        for (entry = (t ? ht->buckets1 : ht->buckets0)[b]; entry; entry = entry->next)
+        {
+          keyspace_bytes -= dbobj_shallow_memory_usage(entry->data);
+          ++type_keys[entry->data->type];
+          type_bytes[entry->data->type] += dbobj_memory_usage(entry->data);
+        }
+    expires_bytes += shards[i].expr_ht->memory;
+    used_bytes += core_shard_memory(&shards[i]);
   }
 
-  reply_data(reply, dbobj_create_uint(deleted_count));
+  total_bytes = keyspace_bytes + expires_bytes;
+  DBList *lines = create_dblist();
+  const db_type_t types[] = {DB_TYPE_STRING, DB_TYPE_LIST, DB_TYPE_HASH, DB_TYPE_ZSET};
+  const char *const type_names[] = {"strings", "lists", "hashes", "zsets"};
+  for (db_uint_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+  {
+    total_bytes += type_bytes[types[i]];
+    sprintf(line, "dataset_%s_keys:%zu", type_names[i], type_keys[types[i]]);
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "dataset_%s_bytes:%zu", type_names[i], type_bytes[types[i]]);
+    rpush(lines, create_dblistnode_with_string(line));
+  }
+  sprintf(line, "dataset_keyspace_bytes:%zu", keyspace_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "dataset_expires_bytes:%zu", expires_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "dataset_total_bytes:%zu", total_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  // Kept as the dataset changes, the figure maxmemory is held to; the same as the total counted above
+  sprintf(line, "used_memory:%zu", used_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "maxmemory:%zu", atomic_load(&maxmemory));
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "maxmemory_policy:%s", evict_policy_name(evict_policy()));
+  rpush(lines, create_dblistnode_with_string(line));
+
+  reply_data(reply, dbobj_create_list(lines));
 }
 
-void db_expire(DBRequest *request, DBReply *reply)
+void db_memory_usage(DBRequest *request, DBReply *reply)
 {
   DBListNode *curr_arg_node = get_arg_head_node(request);
   char *key = get_string_arg(curr_arg_node);
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
-  db_uint_t expire_seconds = curr_arg_node ? get_uint_arg(curr_arg_node) : 0;
-  curr_arg_node = curr_arg_node ? curr_arg_node->next : NULL;
 
-  if (!key || curr_arg_node)
+  if (!key || curr_arg_node->next)
   {
     reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
 
-  if (ht_has(main_ht, key, expr_ht))
-  {
-    hset(expr_ht, key, dbobj_create_uint((db_uint_t)time(NULL) + expire_seconds), NULL);
-    reply_data(reply, dbobj_create_int(1));
-  }
-  else
+  DBHashEntry *entry = hget_key(main_ht, &request->key, expr_ht);
+  if (!entry)
   {
-    reply_data(reply, dbobj_create_int(0));
+    reply_data(reply, dbobj_shared_null());
+    return;
   }
-}
 
-void db_keys(DBRequest *request, DBReply *reply)
-{
-  reply_data(reply, dbobj_create_list(ht_keys(main_ht, expr_ht)));
+  size_t memory = ht_entry_overhead(entry) + dbobj_memory_usage(entry->data);
+  DBHashEntry *deadline = entry->expire_at_ms ? hget_key(expr_ht, &request->key, NULL) : NULL;
+  if (deadline)
+    memory += ht_entry_overhead(deadline) + dbobj_shallow_memory_usage(deadline->data);
+
+  reply_data(reply, dbobj_shared_uint(memory < DB_UINT_MAX ? (db_uint_t)memory : DB_UINT_MAX));
 }
 
-void db_shutdown(DBRequest *request, DBReply *reply)
+void db_memory_stats(DBRequest *request, DBReply *reply)
 {
-  if (!is_running)
+  char line[80];
+  DBList *lines = create_dblist();
+  SlabStats stats;
+  uint64_t in_use;
+  size_t reserved_bytes = 0, used_bytes = 0;
+
+  for (db_uint_t i = 0; i < SLAB_CLASSES; ++i)
   {
-    reply_error(reply, DB_ERR_DB_IS_CLOSED);
-    return;
+    slab_stats(i, &stats);
+    if (!stats.allocations)
+      continue;
+    // Counters published by other threads at different times may cross for a moment.
+    in_use = stats.allocations > stats.frees ? stats.allocations - stats.frees : 0;
+    reserved_bytes += stats.reserved_bytes;
+    used_bytes += in_use * stats.slot_size;
+    sprintf(line, "slab_%zu_allocations:%llu", stats.slot_size, (unsigned long long)stats.allocations);
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "slab_%zu_in_use:%llu", stats.slot_size, (unsigned long long)in_use);
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "slab_%zu_free:%llu", stats.slot_size, (unsigned long long)(stats.slots > in_use ? stats.slots - in_use : 0));
+    rpush(lines, create_dblistnode_with_string(line));
+    sprintf(line, "slab_%zu_reserved_bytes:%zu", stats.slot_size, stats.reserved_bytes);
+    rpush(lines, create_dblistnode_with_string(line));
   }
 
-  is_running = false;
-  thrd_join(core_worker_thread, NULL);
-
-  db_save(request, reply);
-
-  ht_reset(main_ht);
+  sprintf(line, "slab_reserved_bytes:%zu", reserved_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  sprintf(line, "slab_used_bytes:%zu", used_bytes);
+  rpush(lines, create_dblistnode_with_string(line));
+  // Reserved over used bytes: 1 when every slot is taken, larger as freed slots pile up
+  sprintf(line, "slab_fragmentation_ratio:%.2f", used_bytes ? (double)reserved_bytes / used_bytes : 0.0);
+  rpush(lines, create_dblistnode_with_string(line));
 
-  reply_data(reply, dbobj_create_string_with_dup(OK));
+  reply_data(reply, dbobj_create_list(lines));
 }
 
-void db_save(DBRequest *request, DBReply *reply)
+void db_flushall(DBRequest *request, DBReply *reply)
 {
-  if (!persistence_filepath)
-  {
-    reply_data(reply, dbobj_create_bool(false));
-    return;
-  }
-
-  cJSON *root = cJSON_CreateObject();
-  DBHashEntry *entry;
-  DBListNode *dllnode;
-  cJSON *cjson_list;
+  DBListNode *curr_arg_node = request ? get_arg_head_node(request) : NULL;
+  char *mode = get_string_arg(curr_arg_node);
+  db_bool_t is_async = mode && strcmp(mode, "ASYNC") == 0;
 
-  FILE *file = fopen(persistence_filepath, "w");
-  if (!file)
+  if (mode && !is_async && strcmp(mode, "SYNC") != 0)
   {
-    perror("Failed to open file while saving.");
-    reply_data(reply, dbobj_create_bool(false));
+    reply_error(reply, DB_ERR_ARG_ERROR);
     return;
   }
-
-  if (main_ht->buckets0)
+  if (reply)
   {
-    for (db_uint_t i = 0; i < main_ht->size0; ++i)
-    {
-      entry = main_ht->buckets0[i];
-      while (entry)
-      {
-        switch (entry->data->type)
-        {
-        case DB_TYPE_STRING:
-          cJSON_AddItemToObject(root, entry->key, cJSON_CreateString(entry->data->value.string));
-          break;
-        case DB_TYPE_LIST:
-          cjson_list = cJSON_CreateArray();
-          dllnode = entry->data->value.list->head;
-          while (dllnode)
-          {
-            if (dbobj_is_string(dllnode->data))
-              cJSON_AddItemToArray(cjson_list, cJSON_CreateString(dllnode->data->value.string));
-            dllnode = dllnode->next;
-          }
-          cJSON_AddItemToObject(root, entry->key, cjson_list);
-          cjson_list = NULL;
-          dllnode = NULL;
-          break;
-        default:
-          break;
-        }
-        entry = entry->next;
-      }
-    }
+    reply_data(reply, dbobj_shared_ok());
   }
 
-  if (main_ht->buckets1)
+  for (db_uint_t i = 0; i < shards_length; ++i)
   {
-    for (db_uint_t i = 0; i < main_ht->size1; ++i)
+    if (is_async)
     {
-      entry = main_ht->buckets1[i];
-      while (entry)
-      {
-        switch (entry->data->type)
-        {
-        case DB_TYPE_STRING:
-          cJSON_AddItemToObject(root, entry->key, cJSON_CreateString(entry->data->value.string));
-          break;
-        case DB_TYPE_LIST:
-          cjson_list = cJSON_CreateArray();
-          dllnode = entry->data->value.list->head;
-          while (dllnode)
-          {
-            if (dbobj_is_string(dllnode->data))
-              cJSON_AddItemToArray(cjson_list, cJSON_CreateString(dllnode->data->value.string));
-            dllnode = dllnode->next;
-          }
-          cJSON_AddItemToObject(root, entry->key, cjson_list);
-          cjson_list = NULL;
-          dllnode = NULL;
-          break;
-        default:
-          break;
-        }
-        entry = entry->next;
-      }
+      // The shard keeps its tables, now empty, so nothing that points at them has to follow.
+      lazyfree_hash(ht_detach(shards[i].expr_ht));
+      lazyfree_hash(ht_detach(shards[i].main_ht));
+      continue;
     }
+    ht_reset(shards[i].main_ht);
+    ht_reset(shards[i].expr_ht);
   }
-
-  char *json_string = cJSON_PrintUnformatted(root);
-
-  if (!json_string)
-    EXIT_ON_MEMORY_ERROR();
-
-  fputs(json_string, file);
-  fclose(file);
-  free(json_string);
-  cJSON_Delete(root);
-
-  reply_data(reply, dbobj_create_string_with_dup(OK));
-}
-
-void db_flushall(DBRequest *request, DBReply *reply)
-{
-  if (reply)
-  {
-    reply_data(reply, dbobj_create_string_with_dup(OK));
-  }
-
-  ht_reset(main_ht);
+  for (db_uint_t i = 0; i < shards_length; ++i)
+    shards[i].value_contents = 0;
+  core_unmap_snapshot();
 }
@@ -4,8 +4,52 @@
 #include "types.h"
 
 #define DEFAULT_PERSISTENCE_FILE "db.json"
+#define DEFAULT_SNAPSHOT_FILE "db.snapshot"
+#define DEFAULT_AOF_FILE "db.aof"
 
-#define NANOSECONDS_PER_SECOND 1000000000L
+// How long the core worker parks on an empty task queue before running periodic maintenance
+#define CORE_IDLE_TIMEOUT_NS (100 * 1000000L)
+
+// Keys the active expire cycle deletes between two looks at the clock
+#define CORE_EXPIRE_BATCH 64
+// Time one expire cycle of a shard may run for
+#define CORE_EXPIRE_CYCLE_BUDGET_US 1000
+// How long an idle worker parks when its last cycle ran out of time with due keys left
+#define CORE_EXPIRE_BEHIND_TIMEOUT_NS (1 * 1000000L)
+
+// Time an idle worker spends moving the resizes of its tables along before it looks at the task
+// queue again
+#define CORE_REHASH_IDLE_BUDGET_US 1000
+
+// Looks at the queue a busy-polling worker takes between two yields of its CPU
+#define CORE_BUSY_POLL_YIELD_SPINS 64
+
+// Elements from which a LRANGE or ZRANGE is answered a chunk at a time, and the elements of a
+// chunk; the requests queued on the shard run between two chunks, see core_stream_start
+#define CORE_STREAM_MIN_LENGTH 8192
+#define CORE_STREAM_CHUNK 1024
+
+// Words of the CPU masks a worker pins itself with, enough for 1024 CPUs
+#define CORE_CPU_MASK_WORDS 16
+
+// Upper bound on the threads decoding a snapshot at startup, which never exceeds the online CPUs
+#define CORE_SNAPSHOT_LOAD_THREADS 8
+
+// Results SCAN, HSCAN and ZSCAN gather when not given a COUNT
+#define CORE_SCAN_DEFAULT_COUNT 10
+// Buckets one call may visit per result asked for, so a sparse table can't hold the shard for long
+#define CORE_SCAN_MAX_BUCKETS_PER_RESULT 10
+
+// Requests ahead of the one running that a worker prefetches the keys of, see core_prefetch_ahead
+#define CORE_PREFETCH_DISTANCE 4
+
+// Slots of the versions WATCH compares in each shard; keys hashing to the same slot share one, so a
+// write to one of them makes EXEC fail for a watcher of another, which is rare and safe
+#define CORE_WATCH_SLOTS 1024
+
+// Longest BLPOP and BRPOP timeout, in seconds; blocked clients are timed out by the periodic
+// maintenance of their shards, so the timeout is only as fine as CORE_IDLE_TIMEOUT_NS
+#define CORE_BLOCKING_MAX_TIMEOUT_SECONDS (365.0 * 24 * 3600)
 
 int core_lock();
 int core_unlock();
@@ -18,10 +62,96 @@ db_bool_t db_is_running();
 
 void db_config_hash_seed(db_uint_t _hash_seed);
 
+// Sets how many shards the keyspace is split into, each served by its own worker thread;
+// takes effect on the next db_start
+void db_config_shard_count(db_uint_t _shard_count);
+
 void db_config_persistence_filepath(const char *_persistence_filepath);
 
+// Sets the format written by SAVE and SHUTDOWN; either format is recognised when loading
+void db_config_persistence_format(db_persistence_format_t _persistence_format);
+
+// Enables the append-only log, replayed over the loaded snapshot; takes effect on the next db_start
+void db_config_aof_enabled(db_bool_t _aof_enabled);
+
+void db_config_aof_filepath(const char *_aof_filepath);
+
+// Sets how often the append-only log is synced; takes effect on the next db_start
+void db_config_aof_fsync(db_aof_fsync_t _aof_fsync);
+
+// Sets the number of task slots; takes effect on the next db_start
+void db_config_queue_capacity(db_uint_t _queue_capacity);
+
+// Sets what producers do when the task queue is full
+void db_config_queue_policy(db_queue_policy_t _queue_policy);
+
+// Sets the bytes of elements packed in each block of a list, 0 for the default; applies to lists
+// created from now on, see quicklist.h
+void db_config_list_block_size(db_uint_t _list_block_size);
+
+// Sets how many members, each at most how many bytes long, a sorted set holds in the packed
+// encoding; 0 members keeps every set in a skiplist. Applies to sets growing from now on, see zset.h
+void db_config_zset_packed(db_uint_t _max_members, db_uint_t _max_length);
+
+// Sets how many fields, each field and value at most how many bytes long, a hash holds in the
+// packed encoding; 0 fields keeps every hash in a table. Applies to hashes created from now on,
+// see hashobj.h
+void db_config_hash_packed(db_uint_t _max_fields, db_uint_t _max_length);
+
+// Sets whether each shard indexes its keys by prefix, which lets KEYS with a pattern that starts
+// with literal bytes skip the keys without them, for the memory of a radix tree over every key;
+// off by default. Takes effect on the next db_start
+void db_config_key_index(db_bool_t _key_index_enabled);
+
+// Sets whether db_start maps a binary snapshot read-only instead of loading it, so a server, a
+// replica warming up from its primary's file, starts without decoding the dataset and every
+// process serving the same file shares its pages. GET, LRANGE and ZRANGE read keys in the mapping
+// where they lie; any other command naming a key copies it into the keyspace first, and commands
+// that walk every key, SAVE, KEYS, SCAN and the like, copy them all and drop the mapping, as does
+// FLUSHALL. Keys with a deadline are loaded as usual. Falls back to loading for a snapshot older
+// than version 3 or one that fails its checks; off by default. Takes effect on the next db_start
+void db_config_mapped_load(db_bool_t _mapped_load_enabled);
+
+// Has an idle worker poll its queue for up to `_busy_poll_us` microseconds before it parks, which
+// spares a request that comes soon after the last the wake-up, at the cost of a CPU spinning, and
+// pins the worker of shard i to the i-th CPU the process may run on, modulo their count, if
+// `_pin_workers` is set. Defaults to no polling and no pinning; polling takes effect at once,
+// pinning on the next db_start
+void db_config_worker_idle(db_uint_t _busy_poll_us, db_bool_t _pin_workers);
+
+// Logs commands that run for at least `_threshold_us` microseconds, keeping the last `_max_length`;
+// a negative threshold turns the log off. Defaults to 10ms and 128 entries, see latency.h
+void db_config_slowlog(db_int_t _threshold_us, db_uint_t _max_length);
+
+// Sets whether keyed commands are only served for the hash slots this node owns, see cluster.h;
+// off by default. Takes effect at once
+void db_config_cluster_enabled(db_bool_t _cluster_enabled);
+
+// Sets whether GET is served on the thread submitting it, straight from the shard's table while
+// the shard worker keeps writing it, instead of waiting its turn in the queue; see
+// ht_read_concurrent. A GET served so may be answered before commands on other keys submitted
+// ahead of it. Off by default; takes effect at once
+void db_config_concurrent_reads(db_bool_t _concurrent_reads_enabled);
+
+// Caps the bytes the dataset may take, as the tables and values count them, 0 for no cap, the
+// default; each shard holds to an equal part. Before a write, a shard over its part deletes keys
+// chosen by `policy` until it fits, see evict.h, and a write that could only add to it fails with
+// DB_ERR_OOM when nothing is left to delete. Takes effect with the next write
+void db_config_maxmemory(size_t _maxmemory, db_maxmemory_policy_t policy);
+
+// Sets where the bucket arrays of the tables and the chunks of the slab pools come from, see
+// pages.h. DB_PAGES_DEFAULT, calloc, by default; takes effect for arrays allocated from then on,
+// which is every one a table grows into
+void db_config_pages_mode(db_pages_mode_t mode);
+
 DBReply *db_handle_request(DBRequest *request);
 
+// Creates the replies of every request in the pipeline and queues them with one task per shard
+void db_handle_pipeline(DBPipeline *pipeline);
+
+// Replies with PONG, or with the argument if there is one
+void db_ping(DBRequest *request, DBReply *reply);
+
 // Retrieves a string from the database by key; returns NULL if not found or type mismatch
 void db_get(DBRequest *request, DBReply *reply);
 
@@ -30,6 +160,49 @@ void db_get(DBRequest *request, DBReply *reply);
 // Returns true if successful, false if type mismatch
 void db_set(DBRequest *request, DBReply *reply);
 
+// MGET key [key ...], replied to with the string at each key, null where there is none or it
+// holds another type
+void db_mget(DBRequest *request, DBReply *reply);
+
+// MSET key value [key value ...]; sets every pair at once
+void db_mset(DBRequest *request, DBReply *reply);
+
+// MSETNX key value [key value ...]; sets every pair only if none of the keys exists, replied to
+// with 1 if it did and 0 otherwise
+void db_msetnx(DBRequest *request, DBReply *reply);
+
+// INCR key, DECR key, INCRBY key increment and DECRBY key decrement; the key is created at 0, its
+// value must be an integer and stays within the range of db_int_t. Replied to with the new value
+void db_incr(DBRequest *request, DBReply *reply);
+void db_decr(DBRequest *request, DBReply *reply);
+void db_incrby(DBRequest *request, DBReply *reply);
+void db_decrby(DBRequest *request, DBReply *reply);
+
+// INCRBYFLOAT key increment, replied to with the new value in the shortest form that reads back the same
+void db_incrbyfloat(DBRequest *request, DBReply *reply);
+
+// APPEND key value, replied to with the new length; a string that grows to ROPE_MIN_LENGTH
+// becomes a rope, which later appends extend without copying what it holds
+void db_append(DBRequest *request, DBReply *reply);
+
+// STRLEN key, 0 if the key doesn't exist
+void db_strlen(DBRequest *request, DBReply *reply);
+
+// GETRANGE key start end, with negative indexes counting from the end; only the chunks of a rope
+// the range spans are read
+void db_getrange(DBRequest *request, DBReply *reply);
+
+// SETRANGE key offset value, replied to with the new length; zero bytes fill the gap past the end
+void db_setrange(DBRequest *request, DBReply *reply);
+
+// EXEC, given the transaction of the client by its pipeline, see transaction.h: runs the queued
+// commands one after the other and replies with the list of their replies, or with null, running
+// nothing, if a watched key changed since WATCH
+void db_exec(DBRequest *request, DBReply *reply);
+
+// WATCH key [key ...], filling in the versions of the keys the pipeline added to its transaction
+void db_watch(DBRequest *request, DBReply *reply);
+
 // Renames an existing key to a new key in the database
 // Removes the old entry and inserts the new one with the updated key
 // Returns true if successful, false if type mismatch
@@ -38,6 +211,9 @@ void db_rename(DBRequest *request, DBReply *reply);
 // Deletes an entry by key; Returns the number of successfully deleted keys
 void db_del(DBRequest *request, DBReply *reply);
 
+// Deletes like DEL, but hands large values to the lazy free thread instead of freeing them
+void db_unlink(DBRequest *request, DBReply *reply);
+
 // Pushes elements to the front of a list; last parameter must be NULL
 void db_lpush(DBRequest *request, DBReply *reply);
 
@@ -50,6 +226,13 @@ void db_rpush(DBRequest *request, DBReply *reply);
 // Pops elements from the end of a list
 void db_rpop(DBRequest *request, DBReply *reply);
 
+// Pops the head of the first non-empty list among the keys, or waits up to the timeout, the last
+// argument in seconds and 0 for ever, for one to be pushed to; replies with the key and the element
+void db_blpop(DBRequest *request, DBReply *reply);
+
+// Pops the tail, as BLPOP pops the head
+void db_brpop(DBRequest *request, DBReply *reply);
+
 // Returns the number of nodes in a list
 void db_llen(DBRequest *request, DBReply *reply);
 
@@ -57,23 +240,209 @@ void db_llen(DBRequest *request, DBReply *reply);
 // The `stop` index is inclusive, and if `stop` is -1, the entire list is returned
 void db_lrange(DBRequest *request, DBReply *reply);
 
+// Returns the element at an index, or null if it is out of range; negative indexes count from the end
+void db_lindex(DBRequest *request, DBReply *reply);
+
+// Replaces the element at an index; negative indexes count from the end
+void db_lset(DBRequest *request, DBReply *reply);
+
+// Inserts an element BEFORE or AFTER the first one equal to a pivot; Returns the new length,
+// -1 if the pivot isn't found and 0 if the key doesn't exist
+void db_linsert(DBRequest *request, DBReply *reply);
+
 void db_hget(DBRequest *request, DBReply *reply);
 
 void db_hset(DBRequest *request, DBReply *reply);
 
 void db_hdel(DBRequest *request, DBReply *reply);
 
+// HMGET key field [field ...], replied to with the value of each field, null where there is none
+void db_hmget(DBRequest *request, DBReply *reply);
+
+// HGETALL key, replied to with each field followed by its value
+void db_hgetall(DBRequest *request, DBReply *reply);
+
+// HINCRBY key field increment; the field is created at 0, its value must be an integer and stays
+// within the range of db_int_t
+void db_hincrby(DBRequest *request, DBReply *reply);
+
+// HSCAN key cursor [MATCH pattern] [COUNT count], replied to like SCAN with each field followed by
+// its value
+void db_hscan(DBRequest *request, DBReply *reply);
+
 void db_expire(DBRequest *request, DBReply *reply);
 
+// Sets the expiry of a key to an absolute unix time
+void db_expireat(DBRequest *request, DBReply *reply);
+
+// Same as EXPIRE with a time to live in milliseconds
+void db_pexpire(DBRequest *request, DBReply *reply);
+
+// Sets the expiry of a key to an absolute unix time in milliseconds; this is how the append-only
+// log records every kind of EXPIRE
+void db_pexpireat(DBRequest *request, DBReply *reply);
+
+// Returns the seconds a key has left, -1 if it has no deadline and -2 if it doesn't exist
+void db_ttl(DBRequest *request, DBReply *reply);
+
+// Same as TTL in milliseconds
+void db_pttl(DBRequest *request, DBReply *reply);
+
+// Adds members with their scores to a sorted set; Returns the number of new members
+void db_zadd(DBRequest *request, DBReply *reply);
+
+void db_zscore(DBRequest *request, DBReply *reply);
+
+void db_zcard(DBRequest *request, DBReply *reply);
+
+// Counts the members within a score range; a bound prefixed with `(` is exclusive
+void db_zcount(DBRequest *request, DBReply *reply);
+
+// Returns the members within a range of ranks; negative ranks count from the end
+void db_zrange(DBRequest *request, DBReply *reply);
+
+void db_zrangebyscore(DBRequest *request, DBReply *reply);
+
+void db_zrank(DBRequest *request, DBReply *reply);
+
+// Same as ZRANGE with ranks counted from the highest score
+void db_zrevrange(DBRequest *request, DBReply *reply);
+
+// Same as ZRANK with ranks counted from the highest score
+void db_zrevrank(DBRequest *request, DBReply *reply);
+
+void db_zrem(DBRequest *request, DBReply *reply);
+
+void db_zremrangebyscore(DBRequest *request, DBReply *reply);
+
+// ZSCAN key cursor [MATCH pattern] [COUNT count], replied to like SCAN with each member followed
+// by its score; sets small enough to be packed are replied to whole, with a cursor of 0
+void db_zscan(DBRequest *request, DBReply *reply);
+
+// Stores the intersection of sorted sets in the destination key; Returns its cardinality
+void db_zinterstore(DBRequest *request, DBReply *reply);
+
+// Stores the union of sorted sets in the destination key; Returns its cardinality
+void db_zunionstore(DBRequest *request, DBReply *reply);
+
+// KEYS [pattern]: every live key, or those matching the pattern, see ht_keys_matching
 void db_keys(DBRequest *request, DBReply *reply);
 
+// SCAN cursor [MATCH pattern] [COUNT count]: replies with a list of the cursor to continue from,
+// "0" once every key was seen, and then the keys found. COUNT is how many results to gather
+// before stopping, CORE_SCAN_DEFAULT_COUNT by default; the shards are walked one after the other, and a cursor is the
+// bucket cursor of ht_scan times the number of shards plus the shard it is in
+void db_scan(DBRequest *request, DBReply *reply);
+
 // Stops the database and saves data to a specified file
 void db_shutdown(DBRequest *request, DBReply *reply);
 
 // Saves the current state of the database to persistent storage
 void db_save(DBRequest *request, DBReply *reply);
 
-// Deletes all item from all databases.
+// Forks a child that writes a point-in-time snapshot while the workers keep serving requests
+void db_bgsave(DBRequest *request, DBReply *reply);
+
+// Forks a child that rewrites the append-only log as the shortest commands recreating the dataset
+void db_bgrewriteaof(DBRequest *request, DBReply *reply);
+
+// Returns the unix time of the last successful save
+void db_lastsave(DBRequest *request, DBReply *reply);
+
+// Returns `field:value` lines about the last and the running save
+void db_info_persistence(DBRequest *request, DBReply *reply);
+
+// Returns `field:value` lines with the keys removed by the active expire cycle and the time it took
+void db_info_stats(DBRequest *request, DBReply *reply);
+
+// Returns a `cmdstat_<name>:...` line for every command served since the start, with its calls,
+// time spent running and waiting in the queue, and percentiles of both in microseconds
+void db_info_commandstats(DBRequest *request, DBReply *reply);
+
+// Returns the newest entries of the slow log, 10 unless a count is given, see latency.h
+void db_slowlog_get(DBRequest *request, DBReply *reply);
+
+// Returns the number of entries in the slow log
+void db_slowlog_len(DBRequest *request, DBReply *reply);
+
+// Empties the slow log
+void db_slowlog_reset(DBRequest *request, DBReply *reply);
+
+// Returns the hottest keys, 10 unless a count is given, by sampled accesses or by bytes read and
+// written, see hotkeys.h; each entry is the key, its estimated accesses and the bytes its
+// commands read and wrote since it was tracked
+void db_hotkeys_get(DBRequest *request, DBReply *reply);
+void db_hotkeys_bytes(DBRequest *request, DBReply *reply);
+
+// Forgets the sampled accesses of every shard
+void db_hotkeys_reset(DBRequest *request, DBReply *reply);
+
+// Turns the tracepoints on, dropping what they recorded before, or off, see trace.h
+void db_trace_start(DBRequest *request, DBReply *reply);
+void db_trace_stop(DBRequest *request, DBReply *reply);
+
+// Returns the newest traced spans, 128 unless a count is given, oldest first, each a line of its
+// start in monotonic nanoseconds, event, duration in nanoseconds, argument and thread
+void db_trace_get(DBRequest *request, DBReply *reply);
+
+// REPLICAOF host port: replicates the primary at host:port from now on, dropping the dataset for
+// its full sync and refusing writes from anyone else; REPLICAOF NO ONE makes the server a primary
+// again, keeping what it has. See repl.h
+void db_replicaof(DBRequest *request, DBReply *reply);
+
+// PSYNC replid offset: sent by a replica, "?" and -1 the first time. Replies with a list of
+// "CONTINUE", the replication id and the offset to stream from, or with "FULLRESYNC", the id, the
+// offset and a snapshot of the dataset taken at it; the network layer hands the connection over
+// to a sender, see repl_attach_replica
+void db_psync(DBRequest *request, DBReply *reply);
+
+// Replaces the dataset with a full sync saved at the given path; only a replica's own link sends it
+void db_replica_load(DBRequest *request, DBReply *reply);
+
+// CLUSTER_KEYSLOT key: the hash slot of the key, whether or not cluster mode is on
+void db_cluster_keyslot(DBRequest *request, DBReply *reply);
+
+// CLUSTER_ADDSLOTS first [last]: this node owns the slots from `first` to `last`, which nobody else
+// may own yet
+void db_cluster_addslots(DBRequest *request, DBReply *reply);
+
+// CLUSTER_SETSLOT slot NODE [host port] | MIGRATING host port | IMPORTING host port | STABLE: gives
+// the slot to another node, or this one without an address, which also ends a migration; or marks
+// it moving to or from another node, or not moving any more
+void db_cluster_setslot(DBRequest *request, DBReply *reply);
+
+// Returns a `first last host:port` line for every run of slots with one owner, "myself" for this node
+void db_cluster_slots(DBRequest *request, DBReply *reply);
+
+// CLUSTER_COUNTKEYSINSLOT slot and CLUSTER_GETKEYSINSLOT slot count: the keys this node holds in a
+// slot, for moving them out; both walk the whole keyspace
+void db_cluster_countkeysinslot(DBRequest *request, DBReply *reply);
+void db_cluster_getkeysinslot(DBRequest *request, DBReply *reply);
+
+// Lets the next command of the connection at a slot this node imports; the network layer marks it
+void db_asking(DBRequest *request, DBReply *reply);
+
+// MIGRATE key host port [timeout_ms]: copies the key to the node at host:port, replacing what it
+// had there, and deletes it here once the node took it; replies NOKEY if there is no such key.
+// The key comes first, unlike in Redis, so the command goes to the shard of the key
+void db_migrate(DBRequest *request, DBReply *reply);
+
+// Returns `field:value` lines with the role of the server, its replicas or the primary it follows,
+// and the replication offsets
+void db_info_replication(DBRequest *request, DBReply *reply);
+
+// Returns `field:value` lines with the bytes allocated for each type of value, the keyspace and the deadlines
+void db_info_dataset_memory(DBRequest *request, DBReply *reply);
+
+// Returns the bytes allocated for a key, its value and its deadline, or null if the key doesn't exist
+void db_memory_usage(DBRequest *request, DBReply *reply);
+
+// Returns `field:value` lines with the allocations, reserved bytes and fragmentation of each slab
+// size class in use, see slab.h
+void db_memory_stats(DBRequest *request, DBReply *reply);
+
+// Deletes all item from all databases. With ASYNC the tables are detached and freed by the lazy
+// free thread, so the shards are empty as soon as the reply is out
 void db_flushall(DBRequest *request, DBReply *reply);
 
 #endif
@@ -84,6 +84,7 @@ then using the CJSON_API_VISIBILITY flag to "export" the same symbols the way CJ
 #define CJSON_VERSION_PATCH 18
 
 #include <stddef.h>
+#include <stdio.h>
 
 /* cJSON Types: */
 #define cJSON_Invalid (0)
@@ -143,6 +144,23 @@ CJSON_PUBLIC(const char*) cJSON_Version(void);
 /* Supply malloc, realloc and free functions to cJSON */
 CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* Arenas: while an arena is in use by a thread, every node that thread creates, by parsing or by
+ * the Create functions, is bump allocated from it, and so is every string later given to such a
+ * node. cJSON_Delete leaves arena nodes alone and cJSON_ArenaDelete frees them all at once, so a big
+ * tree costs a few large allocations instead of one per node and string. Heap nodes added to an
+ * arena tree are not freed with it. Print buffers still come from the hooks. */
+typedef struct cJSON_Arena cJSON_Arena;
+/* block_size is how much is taken from the hooks at a time, 0 for a default of 64 KiB. */
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaNew(size_t block_size);
+/* Makes the calling thread create nodes in arena, or with the hooks again when it is NULL; returns
+ * the arena the thread used before. */
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaUse(cJSON_Arena *arena);
+/* Frees every node of the arena but keeps a block, for building the next tree in. */
+CJSON_PUBLIC(void) cJSON_ArenaReset(cJSON_Arena *arena);
+/* Bytes taken from the hooks. */
+CJSON_PUBLIC(size_t) cJSON_ArenaSize(const cJSON_Arena *arena);
+CJSON_PUBLIC(void) cJSON_ArenaDelete(cJSON_Arena *arena);
+
 /* Memory Management: the caller is always responsible to free the results from all variants of cJSON_Parse (with cJSON_Delete) and cJSON_Print (with stdlib free, cJSON_Hooks.free_fn, or cJSON_free as appropriate). The exception is cJSON_PrintPreallocated, where the caller has full responsibility of the buffer. */
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value);
@@ -152,6 +170,22 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_len
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated);
 
+/* Streaming: reads the members of a top-level object one at a time, so a large document is loaded
+ * in memory proportional to its largest member instead of to the whole input. */
+typedef struct cJSON_Stream cJSON_Stream;
+/* Fills buffer with up to size bytes of input; returns how many, 0 at the end of the input. */
+typedef size_t (*cJSON_StreamReadFn)(void *context, char *buffer, size_t size);
+/* Reads from a callback, for input that arrives in chunks. */
+CJSON_PUBLIC(cJSON_Stream *) cJSON_StreamNew(cJSON_StreamReadFn read_fn, void *context);
+/* Reads from an open file, which the caller closes after cJSON_StreamDelete. */
+CJSON_PUBLIC(cJSON_Stream *) cJSON_StreamNewFromFile(FILE *file);
+/* Returns the next member of the object, its key in ->string, to be freed with cJSON_Delete; NULL
+ * once the object is closed, or when the input isn't a valid object, see cJSON_StreamFailed. */
+CJSON_PUBLIC(cJSON *) cJSON_StreamNextMember(cJSON_Stream *stream);
+/* Whether reading stopped at invalid or cut off input rather than at the end of the object. */
+CJSON_PUBLIC(cJSON_bool) cJSON_StreamFailed(const cJSON_Stream *stream);
+CJSON_PUBLIC(void) cJSON_StreamDelete(cJSON_Stream *stream);
+
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. */
@@ -0,0 +1,155 @@
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "utils.h"
+#include "slab.h"
+#include "epoch.h"
+
+typedef struct EpochRetired
+{
+  void *pointer;
+  epoch_free_fn free_fn;
+  // Epoch the pointer was retired in; readers that entered later never saw it
+  uint64_t epoch;
+  struct EpochRetired *next;
+} EpochRetired;
+
+// Starts at 1, so 0 in a reader slot means the slot's thread reads nothing
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic uint64_t reader_epochs[EPOCH_MAX_READERS];
+static _Atomic db_bool_t reader_slots_taken[EPOCH_MAX_READERS];
+
+// Pushed onto by any thread, taken whole by whoever reclaims
+static _Atomic(EpochRetired *) retired = NULL;
+static _Atomic db_uint_t pending = 0;
+
+// Slot of the calling thread, -1 until it first enters; given back when the thread exits
+static thread_local int reader_slot = -1;
+static tss_t reader_slot_key;
+static once_flag reader_slot_once = ONCE_FLAG_INIT;
+
+static void epoch_release_slot(void *slot)
+{
+  atomic_store(&reader_slots_taken[(intptr_t)slot - 1], false);
+}
+
+static void epoch_init()
+{
+  if (tss_create(&reader_slot_key, epoch_release_slot) != thrd_success)
+    EXIT_ON_ERROR("Failed to create the epoch reader key");
+}
+
+static db_bool_t epoch_take_slot()
+{
+  call_once(&reader_slot_once, epoch_init);
+  for (int i = 0; i < EPOCH_MAX_READERS; ++i)
+  {
+    db_bool_t expected = false;
+    if (!atomic_load_explicit(&reader_slots_taken[i], memory_order_relaxed) &&
+        atomic_compare_exchange_strong(&reader_slots_taken[i], &expected, true))
+    {
+      reader_slot = i;
+      tss_set(reader_slot_key, (void *)(intptr_t)(i + 1));
+      return true;
+    }
+  }
+  return false;
+}
+
+db_bool_t epoch_enter()
+{
+  if (reader_slot < 0 && !epoch_take_slot())
+    return false;
+
+  // Until the epoch stops moving under it, a reclaimer may have looked at the slot before it was set.
+  uint64_t epoch;
+  do
+  {
+    epoch = atomic_load(&global_epoch);
+    atomic_store(&reader_epochs[reader_slot], epoch);
+  } while (atomic_load(&global_epoch) != epoch);
+  return true;
+}
+
+void epoch_exit()
+{
+  atomic_store_explicit(&reader_epochs[reader_slot], 0, memory_order_release);
+}
+
+void epoch_retire(void *pointer, epoch_free_fn free_fn)
+{
+  if (!pointer)
+    return;
+
+  EpochRetired *node = (EpochRetired *)slab_alloc(sizeof(EpochRetired));
+  node->pointer = pointer;
+  node->free_fn = free_fn;
+  // The stores that unlinked the pointer have to be visible before the epoch is read, or a reader
+  // of the next epoch could still find it.
+  atomic_thread_fence(memory_order_seq_cst);
+  node->epoch = atomic_load(&global_epoch);
+  node->next = atomic_load_explicit(&retired, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&retired, &node->next, node, memory_order_release, memory_order_relaxed))
+    ;
+  atomic_fetch_add_explicit(&pending, 1, memory_order_relaxed);
+}
+
+// The oldest epoch a reader is in, `now` if nobody reads
+static uint64_t epoch_oldest_reader(uint64_t now)
+{
+  uint64_t oldest = now, epoch;
+  for (int i = 0; i < EPOCH_MAX_READERS; ++i)
+  {
+    epoch = atomic_load(&reader_epochs[i]);
+    if (epoch && epoch < oldest)
+      oldest = epoch;
+  }
+  return oldest;
+}
+
+void epoch_reclaim()
+{
+  if (!atomic_load_explicit(&retired, memory_order_relaxed))
+    return;
+
+  uint64_t oldest = epoch_oldest_reader(atomic_fetch_add(&global_epoch, 1) + 1);
+  EpochRetired *node = atomic_exchange_explicit(&retired, NULL, memory_order_acquire);
+  EpochRetired *next, *kept = NULL, *kept_tail = NULL;
+
+  for (; node; node = next)
+  {
+    next = node->next;
+    if (node->epoch < oldest)
+    {
+      node->free_fn(node->pointer);
+      slab_free(node, sizeof(EpochRetired));
+      atomic_fetch_sub_explicit(&pending, 1, memory_order_relaxed);
+      continue;
+    }
+    node->next = kept;
+    kept = node;
+    if (!kept_tail)
+      kept_tail = node;
+  }
+
+  // What readers may still see goes back for the next round.
+  if (!kept)
+    return;
+  kept_tail->next = atomic_load_explicit(&retired, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&retired, &kept_tail->next, kept, memory_order_release, memory_order_relaxed))
+    ;
+}
+
+void epoch_synchronize()
+{
+  uint64_t target = atomic_fetch_add(&global_epoch, 1) + 1;
+  uint64_t epoch;
+  for (int i = 0; i < EPOCH_MAX_READERS; ++i)
+    while ((epoch = atomic_load(&reader_epochs[i])) && epoch < target)
+      thrd_yield();
+}
+
+db_uint_t epoch_pending()
+{
+  return atomic_load_explicit(&pending, memory_order_relaxed);
+}
@@ -0,0 +1,40 @@
+#ifndef DB_EPOCH_H
+#define DB_EPOCH_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Epoch-based reclamation, for memory read by threads that take no lock while its owner changes
+// it. A reader marks itself with the global epoch for as long as it holds pointers into the shared
+// structure; a writer that unlinks something hands it to epoch_retire instead of freeing it, tagged
+// with the epoch it was unlinked in. epoch_reclaim moves the epoch on and frees what was retired
+// before the oldest epoch a reader is still in, so nobody frees memory a reader may be looking at
+// and nobody waits for a reader to do so.
+
+// Threads that can be inside an epoch at once; a thread past this many reads through the lock
+#define EPOCH_MAX_READERS 256
+
+typedef void (*epoch_free_fn)(void *pointer);
+
+// Marks the calling thread as reading; false if every reader slot is taken by other threads.
+// Readers don't nest
+db_bool_t epoch_enter();
+
+void epoch_exit();
+
+// Frees `pointer` with `free_fn` once no reader that may have seen it is left; callable from any
+// thread
+void epoch_retire(void *pointer, epoch_free_fn free_fn);
+
+// Moves the epoch on and frees whatever no reader can see any more; called now and then by the
+// threads that retire
+void epoch_reclaim();
+
+// Waits until every reader that entered before the call has left
+void epoch_synchronize();
+
+// Retired pointers not freed yet
+db_uint_t epoch_pending();
+
+#endif
@@ -0,0 +1,111 @@
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "hash.h"
+#include "latency.h"
+#include "evict.h"
+
+static _Atomic db_maxmemory_policy_t policy = DB_MAXMEMORY_NOEVICTION;
+
+// xorshift64*, seeded on first use from the address of the state and the clock
+static thread_local uint64_t random_state = 0;
+
+static const char *policy_names[] = {
+    [DB_MAXMEMORY_NOEVICTION] = "noeviction",
+    [DB_MAXMEMORY_ALLKEYS_LRU] = "allkeys-lru",
+    [DB_MAXMEMORY_ALLKEYS_LFU] = "allkeys-lfu",
+    [DB_MAXMEMORY_VOLATILE_TTL] = "volatile-ttl",
+};
+
+void evict_config_policy(db_maxmemory_policy_t _policy)
+{
+  atomic_store(&policy, _policy);
+}
+
+db_maxmemory_policy_t evict_policy()
+{
+  return atomic_load_explicit(&policy, memory_order_relaxed);
+}
+
+const char *evict_policy_name(db_maxmemory_policy_t _policy)
+{
+  return policy_names[_policy];
+}
+
+db_bool_t evict_policy_from_name(const char *name, db_maxmemory_policy_t *_policy)
+{
+  for (size_t i = 0; name && i < sizeof(policy_names) / sizeof(policy_names[0]); ++i)
+    if (strcmp(name, policy_names[i]) == 0)
+    {
+      *_policy = (db_maxmemory_policy_t)i;
+      return true;
+    }
+  return false;
+}
+
+uint64_t evict_random()
+{
+  if (!random_state)
+    random_state = ((uint64_t)(uintptr_t)&random_state ^ latency_now_ns()) | 1;
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint32_t evict_lru_clock()
+{
+  return (uint32_t)(ht_clock_ms() / EVICT_LRU_CLOCK_RESOLUTION_MS) & EVICT_ACCESS_MAX;
+}
+
+static inline uint32_t evict_lfu_minutes()
+{
+  return (uint32_t)(ht_clock_ms() / 60000) & 0xFFFF;
+}
+
+// The counter of LFU access bits, less what it lost since the key was last used
+static uint32_t evict_lfu_decayed(uint32_t access)
+{
+  uint32_t counter = access & 0xFF;
+  uint32_t periods = ((evict_lfu_minutes() - (access >> 8)) & 0xFFFF) / EVICT_LFU_DECAY_MINUTES;
+  return periods < counter ? counter - periods : 0;
+}
+
+static uint32_t evict_lfu_increment(uint32_t counter)
+{
+  if (counter == 0xFF)
+    return counter;
+  double base = counter > EVICT_LFU_INIT ? counter - EVICT_LFU_INIT : 0;
+  double probability = 1.0 / (base * EVICT_LFU_LOG_FACTOR + 1);
+  return (double)(evict_random() >> 11) / (double)(1ULL << 53) < probability ? counter + 1 : counter;
+}
+
+uint32_t evict_access_init()
+{
+  if (evict_policy() == DB_MAXMEMORY_ALLKEYS_LFU)
+    return evict_lfu_minutes() << 8 | EVICT_LFU_INIT;
+  return evict_lru_clock();
+}
+
+uint32_t evict_access_touch(uint32_t access)
+{
+  switch (evict_policy())
+  {
+  case DB_MAXMEMORY_ALLKEYS_LFU:
+    return evict_lfu_minutes() << 8 | evict_lfu_increment(evict_lfu_decayed(access));
+  case DB_MAXMEMORY_ALLKEYS_LRU:
+    return evict_lru_clock();
+  default:
+    // Nobody looks at the bits, they are kept from before the policy changed.
+    return access;
+  }
+}
+
+uint64_t evict_score(uint32_t access)
+{
+  if (evict_policy() == DB_MAXMEMORY_ALLKEYS_LFU)
+    return 0xFF - evict_lfu_decayed(access);
+  // Idle time, the clock having wrapped at most once since.
+  return (evict_lru_clock() - access) & EVICT_ACCESS_MAX;
+}
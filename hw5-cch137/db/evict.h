@@ -0,0 +1,50 @@
+#ifndef DB_EVICT_H
+#define DB_EVICT_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Access history for eviction. Every keyspace entry keeps 24 bits of it, updated when the key is
+// looked up; the LRU and LFU policies then delete the worst of EVICT_SAMPLES entries sampled at
+// random instead of keeping the keys in order, which is close enough at a fraction of the cost, as
+// in Redis.
+// Under LRU the bits are the time of the last access in EVICT_LRU_CLOCK_RESOLUTION_MS units, which
+// wraps after about 19 days. Under LFU the high 16 bits are the minute of the last access and the
+// low 8 a logarithmic counter: an access increments it with probability
+// 1 / ((counter - EVICT_LFU_INIT) * EVICT_LFU_LOG_FACTOR + 1), and it loses one for every
+// EVICT_LFU_DECAY_MINUTES the key isn't used, so keys that were popular once don't stay forever.
+
+// Entries sampled for each key evicted
+#define EVICT_SAMPLES 5
+#define EVICT_LRU_CLOCK_RESOLUTION_MS 100
+#define EVICT_ACCESS_MAX 0xFFFFFF
+// Counter of a new key, so it isn't the first to go before it had a chance to be read
+#define EVICT_LFU_INIT 5
+#define EVICT_LFU_LOG_FACTOR 10
+#define EVICT_LFU_DECAY_MINUTES 1
+
+void evict_config_policy(db_maxmemory_policy_t policy);
+
+db_maxmemory_policy_t evict_policy();
+
+// Name of a policy as Redis spells it, "allkeys-lru" and so on
+const char *evict_policy_name(db_maxmemory_policy_t policy);
+
+// False for a name evict_policy_name never gives
+db_bool_t evict_policy_from_name(const char *name, db_maxmemory_policy_t *policy);
+
+// Access bits of a key just created
+uint32_t evict_access_init();
+
+// Access bits of a key being used, given the ones it had
+uint32_t evict_access_touch(uint32_t access);
+
+// How good a victim a key with these access bits is under the LRU or LFU policy, the higher the
+// better
+uint64_t evict_score(uint32_t access);
+
+// Random number from a generator of the calling thread, for sampling
+uint64_t evict_random();
+
+#endif
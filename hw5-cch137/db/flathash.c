@@ -0,0 +1,331 @@
+#include <string.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "hash.h"
+#include "flathash.h"
+
+#define FHT_LSBS 0x0101010101010101ULL
+#define FHT_MSBS 0x8080808080808080ULL
+
+static inline db_bool_t fht_is_rehashing(DBFlatHash *ht)
+{
+  return ht->rehashing_index != -1;
+}
+
+static inline uint64_t fht_load_group(const uint8_t *ctrl)
+{
+  uint64_t group;
+  memcpy(&group, ctrl, sizeof(group));
+  return group;
+}
+
+// Sets the high bit of every byte equal to `tag`. A byte right above a match may be flagged too,
+// which only costs a comparison of the cached hash
+static inline uint64_t fht_match_tag(uint64_t group, uint8_t tag)
+{
+  uint64_t x = group ^ (FHT_LSBS * tag);
+  return (x - FHT_LSBS) & ~x & FHT_MSBS;
+}
+
+static inline uint64_t fht_match_empty(uint64_t group)
+{
+  // EMPTY is the only control byte with the high bit set and bit 1 clear.
+  return group & ~(group << 6) & FHT_MSBS;
+}
+
+static inline uint64_t fht_match_empty_or_deleted(uint64_t group)
+{
+  // EMPTY and DELETED are the only control bytes with the high bit set and bit 0 clear.
+  return group & ~(group << 7) & FHT_MSBS;
+}
+
+// Index within the group of the lowest flagged byte
+static inline db_uint_t fht_first_match(uint64_t match)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_clzll(match) >> 3;
+#else
+  return __builtin_ctzll(match) >> 3;
+#endif
+}
+
+static inline uint8_t fht_tag(db_uint_t hash)
+{
+  return hash & 0x7F;
+}
+
+static inline db_uint_t fht_capacity(DBFlatHashTable *table)
+{
+  return table->groups * FHT_GROUP_WIDTH;
+}
+
+// A table is full once 7/8 of its slots are full or deleted
+static inline db_bool_t fht_is_full(DBFlatHashTable *table)
+{
+  return (uint64_t)table->used * 8 >= (uint64_t)fht_capacity(table) * 7;
+}
+
+static void fht_table_init(DBFlatHash *ht, DBFlatHashTable *table, db_uint_t groups)
+{
+  table->groups = groups;
+  table->count = 0;
+  table->used = 0;
+  table->ctrl = (uint8_t *)malloc(groups * FHT_GROUP_WIDTH);
+  table->slots = (DBFlatHashSlot *)malloc(groups * FHT_GROUP_WIDTH * sizeof(DBFlatHashSlot));
+  if (!table->ctrl || !table->slots)
+    EXIT_ON_MEMORY_ERROR();
+  memset(table->ctrl, FHT_CTRL_EMPTY, groups * FHT_GROUP_WIDTH);
+  ht->memory += dbutil_alloc_size(table->ctrl) + dbutil_alloc_size(table->slots);
+}
+
+static void fht_table_release(DBFlatHash *ht, DBFlatHashTable *table)
+{
+  ht->memory -= dbutil_alloc_size(table->ctrl) + dbutil_alloc_size(table->slots);
+  free(table->ctrl);
+  free(table->slots);
+  table->ctrl = NULL;
+  table->slots = NULL;
+  table->groups = 0;
+  table->count = 0;
+  table->used = 0;
+}
+
+static DBFlatHashSlot *fht_table_find(DBFlatHashTable *table, db_uint_t hash, const char *key, db_uint_t key_length)
+{
+  if (!table->groups)
+    return NULL;
+
+  db_uint_t mask = table->groups - 1;
+  db_uint_t group = (hash >> 7) & mask;
+  uint8_t tag = fht_tag(hash);
+  uint64_t ctrl, match;
+  DBFlatHashSlot *slot;
+
+  // Triangular probing visits every group of a power-of-two table.
+  for (db_uint_t step = 1; step <= table->groups; ++step)
+  {
+    ctrl = fht_load_group(table->ctrl + group * FHT_GROUP_WIDTH);
+    for (match = fht_match_tag(ctrl, tag); match; match &= match - 1)
+    {
+      slot = &table->slots[group * FHT_GROUP_WIDTH + fht_first_match(match)];
+      if (slot->hash == hash && slot->key_length == key_length && memcmp(slot->key, key, key_length) == 0)
+        return slot;
+    }
+    if (fht_match_empty(ctrl))
+      return NULL;
+    group = (group + step) & mask;
+  }
+
+  return NULL;
+}
+
+// Takes the first free slot on the probe sequence of `hash`; the key must not be in the table
+static DBFlatHashSlot *fht_table_claim(DBFlatHashTable *table, db_uint_t hash)
+{
+  db_uint_t mask = table->groups - 1;
+  db_uint_t group = (hash >> 7) & mask;
+  db_uint_t index;
+  uint64_t match;
+
+  // A table never fills up, so the probe always ends.
+  for (db_uint_t step = 1;; ++step)
+  {
+    match = fht_match_empty_or_deleted(fht_load_group(table->ctrl + group * FHT_GROUP_WIDTH));
+    if (match)
+    {
+      index = group * FHT_GROUP_WIDTH + fht_first_match(match);
+      if (table->ctrl[index] == FHT_CTRL_EMPTY)
+        ++table->used;
+      table->ctrl[index] = fht_tag(hash);
+      ++table->count;
+      return &table->slots[index];
+    }
+    group = (group + step) & mask;
+  }
+}
+
+// Smallest table that holds `count` keys at half of the maximum load
+static db_uint_t fht_groups_for(db_uint_t count)
+{
+  db_uint_t groups = FHT_INITIAL_GROUPS;
+  while ((uint64_t)groups * FHT_GROUP_WIDTH * 7 < (uint64_t)count * 16)
+    groups *= 2;
+  return groups;
+}
+
+static void fht_start_rehash(DBFlatHash *ht)
+{
+  DBFlatHashTable *table = &ht->tables[0];
+  db_uint_t groups = fht_groups_for(table->count);
+
+  // Each operation moves one group, so at most that many keys are added or deleted in
+  // tables[1] before the rehash ends; it must not fill up in the meantime.
+  while ((uint64_t)(table->count + table->groups) * 8 > (uint64_t)groups * FHT_GROUP_WIDTH * 7)
+    groups *= 2;
+
+  fht_table_init(ht, &ht->tables[1], groups);
+  ht->rehashing_index = table->groups - 1;
+}
+
+// Moves one group of tables[0] to tables[1]; the moved slots become DELETED so probes
+// for keys further along still pass them
+static void fht_rehash_step(DBFlatHash *ht)
+{
+  DBFlatHashTable *from = &ht->tables[0];
+  DBFlatHashTable *to = &ht->tables[1];
+  db_uint_t index = ht->rehashing_index * FHT_GROUP_WIDTH;
+
+  for (db_uint_t i = index; i < index + FHT_GROUP_WIDTH; ++i)
+  {
+    if (from->ctrl[i] & 0x80)
+      continue;
+    *fht_table_claim(to, from->slots[i].hash) = from->slots[i];
+    from->ctrl[i] = FHT_CTRL_DELETED;
+    --from->count;
+  }
+
+  if (--ht->rehashing_index == -1)
+  {
+    fht_table_release(ht, from);
+    ht->tables[0] = *to;
+    to->ctrl = NULL;
+    to->slots = NULL;
+    to->groups = 0;
+    to->count = 0;
+    to->used = 0;
+  }
+}
+
+// Executed during each operation to keep the load within bounds
+static void fht_maintenance(DBFlatHash *ht)
+{
+  DBFlatHashTable *table = &ht->tables[0];
+
+  if (fht_is_rehashing(ht))
+    fht_rehash_step(ht);
+  else if (fht_is_full(table))
+    // When most used slots are deleted ones, this rebuilds the table at the same size.
+    fht_start_rehash(ht);
+  else if (table->groups > FHT_INITIAL_GROUPS && (uint64_t)table->count * 10 < fht_capacity(table))
+    fht_start_rehash(ht);
+}
+
+static DBFlatHashSlot *fht_find(DBFlatHash *ht, const char *key, db_uint_t hash, db_uint_t key_length, DBFlatHashTable **table)
+{
+  DBFlatHashSlot *slot;
+
+  for (int i = fht_is_rehashing(ht) ? 1 : 0; i >= 0; --i)
+  {
+    slot = fht_table_find(&ht->tables[i], hash, key, key_length);
+    if (slot)
+    {
+      if (table)
+        *table = &ht->tables[i];
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+DBFlatHash *fht_create()
+{
+  DBFlatHash *ht = (DBFlatHash *)calloc(1, sizeof(DBFlatHash));
+  if (!ht)
+    EXIT_ON_MEMORY_ERROR();
+  ht->rehashing_index = -1;
+  ht->memory = dbutil_alloc_size(ht);
+  fht_table_init(ht, &ht->tables[0], FHT_INITIAL_GROUPS);
+  return ht;
+}
+
+void fht_free(DBFlatHash *ht)
+{
+  if (!ht)
+    return;
+
+  DBFlatHashTable *table;
+  for (int t = 0; t < 2; ++t)
+  {
+    table = &ht->tables[t];
+    for (db_uint_t i = 0; i < fht_capacity(table); ++i)
+    {
+      if (table->ctrl[i] & 0x80)
+        continue;
+      free(table->slots[i].key);
+      free_dbobj(table->slots[i].value);
+    }
+    free(table->ctrl);
+    free(table->slots);
+  }
+  free(ht);
+}
+
+db_uint_t fht_count(DBFlatHash *ht)
+{
+  return ht ? ht->tables[0].count + ht->tables[1].count : 0;
+}
+
+DBObj *fht_get(DBFlatHash *ht, const char *key)
+{
+  if (!ht || !key)
+    return NULL;
+
+  fht_maintenance(ht);
+
+  db_uint_t key_length = strlen(key);
+  DBFlatHashSlot *slot = fht_find(ht, key, murmurhash2(key, key_length), key_length, NULL);
+  return slot ? slot->value : NULL;
+}
+
+void fht_set(DBFlatHash *ht, const char *key, DBObj *value)
+{
+  if (!ht || !key || !value)
+    return;
+
+  fht_maintenance(ht);
+
+  db_uint_t key_length = strlen(key);
+  db_uint_t hash = murmurhash2(key, key_length);
+  DBFlatHashSlot *slot = fht_find(ht, key, hash, key_length, NULL);
+
+  if (slot)
+  {
+    ht->memory -= dbobj_shallow_memory_usage(slot->value);
+    free_dbobj(slot->value);
+    slot->value = value;
+    ht->memory += dbobj_shallow_memory_usage(value);
+    return;
+  }
+
+  // The maintenance above leaves room for one more key in the table that takes it.
+  slot = fht_table_claim(&ht->tables[fht_is_rehashing(ht) ? 1 : 0], hash);
+  slot->hash = hash;
+  slot->key_length = key_length;
+  slot->key = dbutil_strdup(key);
+  slot->value = value;
+  ht->memory += dbutil_alloc_size(slot->key) + dbobj_shallow_memory_usage(value);
+}
+
+db_bool_t fht_delete(DBFlatHash *ht, const char *key)
+{
+  if (!ht || !key)
+    return false;
+
+  fht_maintenance(ht);
+
+  db_uint_t key_length = strlen(key);
+  DBFlatHashTable *table;
+  DBFlatHashSlot *slot = fht_find(ht, key, murmurhash2(key, key_length), key_length, &table);
+
+  if (!slot)
+    return false;
+
+  ht->memory -= dbutil_alloc_size(slot->key) + dbobj_shallow_memory_usage(slot->value);
+  free(slot->key);
+  free_dbobj(slot->value);
+  table->ctrl[slot - table->slots] = FHT_CTRL_DELETED;
+  --table->count;
+  return true;
+}
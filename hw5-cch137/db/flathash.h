@@ -0,0 +1,68 @@
+#ifndef DB_FLATHASH_H
+#define DB_FLATHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+// Open-addressing alternative to DBHash. Slots are stored inline in one array and probed a
+// group at a time: every slot has a control byte holding 7 bits of its hash, or EMPTY/DELETED,
+// so a whole group is compared with a few word operations. A slot keeps the full hash and the
+// key length next to the key pointer, so most mismatches never touch the key's memory.
+
+// Slots per group; the control bytes of a group are read as one 64-bit word
+#define FHT_GROUP_WIDTH 8
+#define FHT_INITIAL_GROUPS 2
+// Control byte of a slot that was never used, which ends a probe
+#define FHT_CTRL_EMPTY 0x80
+// Control byte of a removed slot, which a probe must step over
+#define FHT_CTRL_DELETED 0xFE
+
+typedef struct DBFlatHashSlot
+{
+  db_uint_t hash;
+  db_uint_t key_length;
+  char *key;
+  DBObj *value;
+} DBFlatHashSlot;
+
+typedef struct DBFlatHashTable
+{
+  uint8_t *ctrl;
+  DBFlatHashSlot *slots;
+  // A power of two, 0 for a table that is not allocated
+  db_uint_t groups;
+  db_uint_t count;
+  // Full and deleted slots, which both lengthen probes
+  db_uint_t used;
+} DBFlatHashTable;
+
+typedef struct DBFlatHash
+{
+  // Same rehashing scheme as DBHash: tables[1] is the rehash table, lookups search it first,
+  // new keys only go to it, and every operation moves one group of tables[0] over.
+  DBFlatHashTable tables[2];
+  // -1 indicates no rehashing; otherwise, it's the next group of tables[0] to move
+  db_int_t rehashing_index;
+  // Bytes allocated for the table arrays, the keys and the values, not counting the contents of containers
+  size_t memory;
+} DBFlatHash;
+
+DBFlatHash *fht_create();
+
+// Frees the table with every key and value in it
+void fht_free(DBFlatHash *ht);
+
+db_uint_t fht_count(DBFlatHash *ht);
+
+// Returns the value of a key, NULL if it doesn't exist
+DBObj *fht_get(DBFlatHash *ht, const char *key);
+
+// Sets a key, copying it and taking ownership of the value; a previous value is freed
+void fht_set(DBFlatHash *ht, const char *key, DBObj *value);
+
+// Removes a key and frees its value; returns false if it doesn't exist
+db_bool_t fht_delete(DBFlatHash *ht, const char *key);
+
+#endif
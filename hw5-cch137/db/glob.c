@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "utils.h"
+#include "glob.h"
+
+// Closes the segment of the bytes from `start` to `end`
+static void glob_add_segment(DBGlob *glob, db_uint_t start, db_uint_t end)
+{
+  DBGlobSegment *segment = &glob->segments[glob->length++];
+  segment->bytes = glob->bytes + start;
+  segment->is_any = glob->is_any + start;
+  segment->length = end - start;
+  segment->has_any = false;
+  segment->has_literal = false;
+  for (db_uint_t i = 0; i < segment->length; ++i)
+  {
+    if (segment->is_any[i])
+    {
+      segment->has_any = true;
+      continue;
+    }
+    if (!segment->has_literal)
+      segment->first_literal = i;
+    segment->last_literal = i;
+    segment->has_literal = true;
+  }
+  glob->min_length += segment->length;
+}
+
+DBGlob *glob_compile(const char *pattern)
+{
+  size_t pattern_length = strlen(pattern);
+  DBGlob *glob = (DBGlob *)malloc(sizeof(DBGlob));
+  if (!glob)
+    EXIT_ON_MEMORY_ERROR();
+  // A segment per star and one more at most, and no more bytes than the pattern
+  glob->segments = (DBGlobSegment *)malloc((pattern_length + 1) * sizeof(DBGlobSegment));
+  glob->bytes = (char *)malloc(pattern_length + 1);
+  glob->is_any = (uint8_t *)malloc(pattern_length + 1);
+  if (!glob->segments || !glob->bytes || !glob->is_any)
+    EXIT_ON_MEMORY_ERROR();
+  glob->length = 0;
+  glob->has_star = false;
+  glob->min_length = 0;
+
+  db_uint_t length = 0, start = 0;
+  for (const char *p = pattern; *p; ++p)
+  {
+    if (*p == '*')
+    {
+      // Stars in a row are one star.
+      if (!glob->has_star || length > start)
+        glob_add_segment(glob, start, length);
+      glob->has_star = true;
+      start = length;
+      continue;
+    }
+    // A backslash that ends the pattern is a literal one.
+    db_bool_t is_escaped = *p == '\\' && p[1];
+    if (is_escaped)
+      ++p;
+    glob->is_any[length] = !is_escaped && *p == '?';
+    glob->bytes[length++] = *p;
+  }
+  glob_add_segment(glob, start, length);
+  return glob;
+}
+
+void glob_free(DBGlob *glob)
+{
+  if (!glob)
+    return;
+  free(glob->segments);
+  free(glob->bytes);
+  free(glob->is_any);
+  free(glob);
+}
+
+static inline db_bool_t glob_segment_fits(const DBGlobSegment *segment, const char *at)
+{
+  if (!segment->has_any)
+    return memcmp(at, segment->bytes, segment->length) == 0;
+  for (db_uint_t i = 0; i < segment->length; ++i)
+    if (!segment->is_any[i] && at[i] != segment->bytes[i])
+      return false;
+  return true;
+}
+
+// First place from `start` where the segment fits and ends by `end`, NULL if there is none
+static const char *glob_find(const DBGlobSegment *segment, const char *start, const char *end)
+{
+  if ((size_t)(end - start) < segment->length)
+    return NULL;
+  if (!segment->has_literal)
+    return start;
+
+  const char *last_start = end - segment->length;
+  db_uint_t first = segment->first_literal, last = segment->last_literal;
+#if defined(__SSE2__)
+  // Both loads stay within the key: the 16th place is at most `last_start`, and neither byte
+  // tested is past the end of the segment.
+  const __m128i first_byte = _mm_set1_epi8(segment->bytes[first]);
+  const __m128i last_byte = _mm_set1_epi8(segment->bytes[last]);
+  for (; last_start - start >= 15; start += 16)
+  {
+    __m128i first_block = _mm_loadu_si128((const __m128i *)(start + first));
+    __m128i last_block = _mm_loadu_si128((const __m128i *)(start + last));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first_block, first_byte),
+                                                              _mm_cmpeq_epi8(last_block, last_byte)));
+    for (; mask; mask &= mask - 1)
+    {
+      const char *candidate = start + __builtin_ctz(mask);
+      if (glob_segment_fits(segment, candidate))
+        return candidate;
+    }
+  }
+#endif
+  while (start <= last_start)
+  {
+    const char *found = (const char *)memchr(start + first, segment->bytes[first], (size_t)(last_start - start) + 1);
+    if (!found)
+      return NULL;
+    start = found - first;
+    if (glob_segment_fits(segment, start))
+      return start;
+    ++start;
+  }
+  return NULL;
+}
+
+db_bool_t glob_match(const DBGlob *glob, const char *key, db_uint_t length)
+{
+  const DBGlobSegment *head = &glob->segments[0];
+  if (!glob->has_star)
+    return length == head->length && glob_segment_fits(head, key);
+
+  // The start and end of the key don't overlap once it is long enough for every segment.
+  const DBGlobSegment *tail = &glob->segments[glob->length - 1];
+  if (length < glob->min_length || !glob_segment_fits(head, key) || !glob_segment_fits(tail, key + length - tail->length))
+    return false;
+
+  const char *position = key + head->length, *end = key + length - tail->length;
+  for (db_uint_t i = 1; i + 1 < glob->length; ++i)
+  {
+    if (!(position = glob_find(&glob->segments[i], position, end)))
+      return false;
+    position += glob->segments[i].length;
+  }
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef DB_GLOB_H
+#define DB_GLOB_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Patterns of KEYS and SCAN MATCH, compiled once for the many keys they are tried on. The syntax
+// is that of dbutil_match_keys: '*' matches any bytes, '?' any one byte, and '\' makes the byte
+// after it literal. A pattern is cut at its stars into segments of literal bytes and '?'. The
+// first segment has to start the key and the last one end it, which turns most keys away in
+// constant time. The segments between are found left to right, each at the first place it fits,
+// which is enough with no wildcard but '?' in a segment. With SSE2 the search tests 16 places at
+// a time on two literal bytes of the segment, the first and the last, and compares only the
+// places where both fit, as memmem implementations do.
+
+typedef struct DBGlobSegment
+{
+  // Bytes of the segment with its escapes resolved; a '?' leaves a byte set in `is_any`
+  const char *bytes;
+  const uint8_t *is_any;
+  db_uint_t length;
+  db_bool_t has_any;
+  // Offsets of the first and last literal bytes, which the search tests; a segment of nothing
+  // but '?' has none and fits anywhere
+  db_uint_t first_literal;
+  db_uint_t last_literal;
+  db_bool_t has_literal;
+} DBGlobSegment;
+
+typedef struct DBGlob
+{
+  // Without a star, the only segment is the whole key; with one, the first and last segments are
+  // the start and end of the key, either of them possibly empty, and the others are never empty
+  DBGlobSegment *segments;
+  db_uint_t length;
+  db_bool_t has_star;
+  // Bytes every matching key has at least, the segments together
+  db_uint_t min_length;
+  char *bytes;
+  uint8_t *is_any;
+} DBGlob;
+
+DBGlob *glob_compile(const char *pattern);
+
+void glob_free(DBGlob *glob);
+
+// Whether the `length` bytes of the key match the pattern, as dbutil_match_keys would have it
+db_bool_t glob_match(const DBGlob *glob, const char *key, db_uint_t length);
+
+#endif
@@ -1,9 +1,18 @@
 #include <time.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "utils.h"
 #include "list.h"
 #include "hash.h"
+#include "slab.h"
+#include "pages.h"
+#include "radix.h"
+#include "glob.h"
+#include "trace.h"
+#include "epoch.h"
+#include "evict.h"
 
 db_uint_t hash_seed = 0;
 
@@ -12,22 +21,193 @@ static inline db_bool_t ht_is_rehashing(DBHash *ht)
   return ht->rehashing_index != -1;
 }
 
-// Computes the MurmurHash2 hash of a key
-static db_uint_t murmurhash2(const void *key, db_uint_t len);
+// Brackets a change to a table read concurrently; readers that see `seq` odd, or changed by the
+// time they are done, read again. Changes don't nest
+static inline void ht_write_begin(DBHash *ht)
+{
+  if (ht->concurrent_reads)
+    atomic_fetch_add(&ht->seq, 1);
+}
+
+static inline void ht_write_end(DBHash *ht)
+{
+  if (ht->concurrent_reads)
+    atomic_fetch_add(&ht->seq, 1);
+}
 
+// Bucket arrays of a table read concurrently are freed once its readers are done with them.
+static void ht_free_buckets(DBHash *ht, DBHashEntry **buckets)
+{
+  if (ht->concurrent_reads)
+    epoch_retire(buckets, pages_free);
+  else
+    pages_free(buckets);
+}
+
+// Computes the MurmurHash2 hash of a key
 // Executed during each low-level operation and periodic task to maintain the hash table size
 static void _ht_maintenance(DBHash *ht);
-// Checks if rehashing is needed and performs a rehash step if required
-// Returns true if additional rehash steps are required
-static db_bool_t _ht_rehash_step(DBHash *ht);
+// Moves up to `buckets` non-empty buckets of a running rehash, visiting at most
+// HT_REHASH_EMPTY_VISITS empty ones for each; returns true if the rehash isn't done
+static db_bool_t _ht_rehash(DBHash *ht, db_uint_t buckets);
+// Rehash step of a single operation
+static inline db_bool_t _ht_rehash_step(DBHash *ht)
+{
+  return _ht_rehash(ht, HT_REHASH_STEP_BUCKETS);
+}
 
 static void _ht_resize_table(DBHash *ht, int ht_index, db_uint_t new_size);
 
 static void _ht_clear(DBHash *ht);
 
-static DBHashEntry *_ht_create_entry(char *key);
+// Keys up to this length share the allocation of their entry
+#define HT_EMBEDDED_KEY_MAX (SLAB_MAX_SIZE - sizeof(DBHashEntry) - 1)
+
+// Copies `key` into a new entry, or takes it over if `owns_key` is set and it is too long to embed
+static DBHashEntry *_ht_create_entry(char *key, db_uint_t key_length, db_uint_t hash, DBObj *obj, db_bool_t owns_key);
+
+static DBHashEntry *_ht_find(DBHash *ht, const DBKey *key);
+static DBHashEntry *_ht_get_found(DBHash *ht, const DBKey *key, DBHashEntry *entry, DBHash *expires_ht);
+
+// Last clock reading of the calling thread, 0 until it calls ht_update_clock
+static thread_local uint64_t cached_clock_ms = 0;
+
+static inline db_bool_t ht_entry_has_embedded_key(const DBHashEntry *entry)
+{
+  return entry->key == (const char *)(entry + 1);
+}
+
+// Bytes slab_alloc was asked for
+static inline size_t ht_entry_alloc_size(const DBHashEntry *entry)
+{
+  return sizeof(DBHashEntry) + (ht_entry_has_embedded_key(entry) ? entry->key_length + 1 : 0);
+}
+
+static inline db_bool_t ht_entry_owns_key(const DBHashEntry *entry)
+{
+  return !ht_entry_has_embedded_key(entry) && !entry->borrowed_key;
+}
+
+size_t ht_entry_overhead(const DBHashEntry *entry)
+{
+  return slab_size(ht_entry_alloc_size(entry)) + (ht_entry_owns_key(entry) ? dbutil_alloc_size(entry->key) : 0);
+}
+
+static inline size_t ht_entry_memory_usage(const DBHashEntry *entry)
+{
+  return ht_entry_overhead(entry) + dbobj_shallow_memory_usage(entry->data);
+}
+
+static inline DBKey ht_entry_key(const DBHashEntry *entry)
+{
+  return (DBKey){.string = entry->key, .length = entry->key_length, .hash = entry->hash};
+}
+
+static inline db_bool_t ht_entry_matches(const DBHashEntry *entry, const DBKey *key)
+{
+  return entry->hash == key->hash && entry->key_length == key->length && memcmp(entry->key, key->string, key->length) == 0;
+}
+
+static uint64_t ht_realtime_ms()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void ht_update_clock()
+{
+  uint64_t now = ht_realtime_ms();
+  // Never step back, so a deadline that has passed stays passed.
+  if (now > cached_clock_ms)
+    cached_clock_ms = now;
+}
+
+uint64_t ht_clock_ms()
+{
+  return cached_clock_ms ? cached_clock_ms : ht_realtime_ms();
+}
+
+static inline void ht_timer_place(DBTimerHeap *heap, db_uint_t index, DBHashEntry *entry)
+{
+  heap->entries[index] = entry;
+  entry->expire_index = index;
+}
+
+static void ht_timer_sift_up(DBTimerHeap *heap, db_uint_t index)
+{
+  DBHashEntry *entry = heap->entries[index];
+  db_uint_t parent;
+
+  while (index)
+  {
+    parent = (index - 1) / 2;
+    if (heap->entries[parent]->expire_at_ms <= entry->expire_at_ms)
+      break;
+    ht_timer_place(heap, index, heap->entries[parent]);
+    index = parent;
+  }
+  ht_timer_place(heap, index, entry);
+}
+
+static void ht_timer_sift_down(DBTimerHeap *heap, db_uint_t index)
+{
+  DBHashEntry *entry = heap->entries[index];
+  db_uint_t child;
+
+  while ((child = index * 2 + 1) < heap->length)
+  {
+    if (child + 1 < heap->length && heap->entries[child + 1]->expire_at_ms < heap->entries[child]->expire_at_ms)
+      ++child;
+    if (entry->expire_at_ms <= heap->entries[child]->expire_at_ms)
+      break;
+    ht_timer_place(heap, index, heap->entries[child]);
+    index = child;
+  }
+  ht_timer_place(heap, index, entry);
+}
+
+static void ht_timer_push(DBHash *expires_ht, DBHashEntry *entry)
+{
+  DBTimerHeap *heap = &expires_ht->timers;
+
+  if (heap->length == heap->capacity)
+  {
+    db_uint_t capacity = heap->capacity ? heap->capacity * 2 : HT_INITIAL_SIZE;
+    expires_ht->memory -= dbutil_alloc_size(heap->entries);
+    DBHashEntry **entries = (DBHashEntry **)realloc(heap->entries, capacity * sizeof(DBHashEntry *));
+    if (!entries)
+      EXIT_ON_MEMORY_ERROR();
+    heap->entries = entries;
+    heap->capacity = capacity;
+    expires_ht->memory += dbutil_alloc_size(heap->entries);
+  }
+
+  heap->entries[heap->length] = entry;
+  ht_timer_sift_up(heap, heap->length++);
+}
+
+void ht_timer_track(DBHash *expires_ht, DBHashEntry *entry)
+{
+  if (expires_ht && entry && entry->expire_at_ms)
+    ht_timer_push(expires_ht, entry);
+}
+
+static void ht_timer_remove(DBHash *expires_ht, DBHashEntry *entry)
+{
+  DBTimerHeap *heap = &expires_ht->timers;
+  db_uint_t index = entry->expire_index;
+  DBHashEntry *last = heap->entries[--heap->length];
+
+  if (index == heap->length)
+    return;
+  // The last timer takes the hole and moves whichever way it belongs.
+  ht_timer_place(heap, index, last);
+  ht_timer_sift_up(heap, index);
+  ht_timer_sift_down(heap, last->expire_index);
+}
 
-static db_uint_t murmurhash2(const void *key, db_uint_t len)
+db_uint_t murmurhash2(const void *key, db_uint_t len)
 {
   const db_uint_t m = 0x5bd1e995;
   const int r = 24;
@@ -65,13 +245,17 @@ static void _ht_maintenance(DBHash *ht)
   {
     if (ht->count0 > HT_LOAD_FACTOR_EXPAND * ht->size0)
     {
+      ht_write_begin(ht);
       ht->rehashing_index = ht->size0 - 1;
       _ht_resize_table(ht, 1, ht->size0 * 2);
+      ht_write_end(ht);
     }
     else if (ht->size0 > HT_INITIAL_SIZE && ht->count0 < HT_LOAD_FACTOR_SHRINK * ht->size0)
     {
+      ht_write_begin(ht);
       ht->rehashing_index = ht->size0 - 1;
       _ht_resize_table(ht, 1, ht->size0 / 2);
+      ht_write_end(ht);
     }
   }
   else
@@ -80,45 +264,80 @@ static void _ht_maintenance(DBHash *ht)
   }
 }
 
-static db_bool_t _ht_rehash_step(DBHash *ht)
+static db_bool_t _ht_rehash(DBHash *ht, db_uint_t buckets)
 {
   if (!ht_is_rehashing(ht))
     return false; // Not rehashing
 
+  uint64_t trace_at = TRACE_BEGIN();
+  int32_t bucket = ht->rehashing_index;
+  db_uint_t empty_visits = buckets * HT_REHASH_EMPTY_VISITS;
+  ht_write_begin(ht);
+
   // Move entries from tables[0] to tables[1]
   db_uint_t index;
-  DBHashEntry *curr_entry = ht->buckets0[ht->rehashing_index];
+  DBHashEntry *curr_entry;
   DBHashEntry *next_entry;
 
-  while (curr_entry)
+  while (buckets && ht->rehashing_index != -1)
   {
-    next_entry = curr_entry->next;
-    index = murmurhash2(curr_entry->key, strlen(curr_entry->key)) % ht->size1;
-    curr_entry->next = ht->buckets1[index];
-    ht->buckets1[index] = curr_entry;
-    ++ht->count1;
-    --ht->count0;
-    curr_entry = next_entry;
+    curr_entry = ht->buckets0[ht->rehashing_index];
+    if (!curr_entry)
+    {
+      --ht->rehashing_index;
+      // A sparse table can't make one operation walk its empty buckets for long.
+      if (!--empty_visits)
+        break;
+      continue;
+    }
+    while (curr_entry)
+    {
+      next_entry = curr_entry->next;
+      index = curr_entry->hash % ht->size1;
+      curr_entry->next = ht->buckets1[index];
+      ht->buckets1[index] = curr_entry;
+      ++ht->count1;
+      --ht->count0;
+      curr_entry = next_entry;
+    }
+    ht->buckets0[ht->rehashing_index] = NULL;
+    --ht->rehashing_index;
+    --buckets;
   }
 
-  ht->buckets0[ht->rehashing_index] = NULL;
-  --ht->rehashing_index;
-
   if (ht->rehashing_index == (int32_t)(-1))
   {
     // swap tables
+    ht->memory -= pages_alloc_size(ht->buckets0);
+    ht_free_buckets(ht, ht->buckets0);
     ht->size0 = ht->size1;
     ht->count0 = ht->count1;
     ht->buckets0 = ht->buckets1;
     ht->count1 = 0;
     ht->buckets1 = NULL;
     _ht_resize_table(ht, 1, 0);
+    ht_write_end(ht);
+    TRACE_END(TRACE_REHASH_STEP, trace_at, bucket);
     return false;
   }
 
+  ht_write_end(ht);
+  TRACE_END(TRACE_REHASH_STEP, trace_at, bucket);
   return true;
 }
 
+db_bool_t ht_rehash_for(DBHash *ht, uint64_t budget_ns)
+{
+  if (!ht || !ht_is_rehashing(ht))
+    return false;
+
+  uint64_t deadline = latency_now_ns() + budget_ns;
+  while (_ht_rehash(ht, HT_REHASH_CHUNK_BUCKETS))
+    if (latency_now_ns() >= deadline)
+      return true;
+  return false;
+}
+
 static void _ht_resize_table(DBHash *ht, int ht_index, db_uint_t new_size)
 {
   if (ht_index == 0)
@@ -127,12 +346,14 @@ static void _ht_resize_table(DBHash *ht, int ht_index, db_uint_t new_size)
       EXIT_ON_ERROR("Hash table is not empty");
 
     ht->size0 = new_size;
-    free(ht->buckets0);
+    ht->memory -= pages_alloc_size(ht->buckets0);
+    ht_free_buckets(ht, ht->buckets0);
     if (new_size)
     {
-      ht->buckets0 = (DBHashEntry **)calloc(new_size, sizeof(DBHashEntry *));
+      ht->buckets0 = (DBHashEntry **)pages_alloc(new_size * sizeof(DBHashEntry *));
       if (!ht->buckets0)
         EXIT_ON_MEMORY_ERROR();
+      ht->memory += pages_alloc_size(ht->buckets0);
     }
     else
     {
@@ -145,12 +366,14 @@ static void _ht_resize_table(DBHash *ht, int ht_index, db_uint_t new_size)
       EXIT_ON_ERROR("Hash table is not empty");
 
     ht->size1 = new_size;
-    free(ht->buckets1);
+    ht->memory -= pages_alloc_size(ht->buckets1);
+    ht_free_buckets(ht, ht->buckets1);
     if (new_size)
     {
-      ht->buckets1 = (DBHashEntry **)calloc(new_size, sizeof(DBHashEntry *));
+      ht->buckets1 = (DBHashEntry **)pages_alloc(new_size * sizeof(DBHashEntry *));
       if (!ht->buckets1)
         EXIT_ON_MEMORY_ERROR();
+      ht->memory += pages_alloc_size(ht->buckets1);
     }
   }
 }
@@ -173,11 +396,12 @@ static void _ht_clear(DBHash *ht)
       while (entry)
       {
         next = entry->next;
+        entry->defer_free = ht->concurrent_reads;
         ht_free_entry(entry);
         entry = next;
       }
     }
-    free(ht->buckets0);
+    ht_free_buckets(ht, ht->buckets0);
     ht->count0 = 0;
     ht->size0 = 0;
     ht->buckets0 = NULL;
@@ -193,17 +417,26 @@ static void _ht_clear(DBHash *ht)
       while (entry)
       {
         next = entry->next;
+        entry->defer_free = ht->concurrent_reads;
         ht_free_entry(entry);
         entry = next;
       }
     }
-    free(ht->buckets1);
+    ht_free_buckets(ht, ht->buckets1);
     ht->count1 = 0;
     ht->size1 = 0;
     ht->buckets1 = NULL;
   }
 
+  free(ht->timers.entries);
+  ht->timers.entries = NULL;
+  ht->timers.length = 0;
+  ht->timers.capacity = 0;
+  radix_clear(ht->key_index);
+
   ht->rehashing_index = -1;
+  ht->memory = dbutil_alloc_size(ht);
+  ht->expired_contents = 0;
 }
 
 static DBHashEntry *ht_add(DBHash *ht, DBHashEntry *entry)
@@ -214,37 +447,35 @@ static DBHashEntry *ht_add(DBHash *ht, DBHashEntry *entry)
   _ht_maintenance(ht);
 
   db_uint_t index;
+  if (ht->is_keyspace)
+    entry->access = evict_access_init();
+  ht->memory += ht_entry_memory_usage(entry);
+  if (ht->key_index)
+    radix_insert(ht->key_index, entry->key, entry->key_length);
 
+  ht_write_begin(ht);
   if (ht_is_rehashing(ht))
   {
-    index = murmurhash2(entry->key, strlen(entry->key)) % ht->size1;
+    index = entry->hash % ht->size1;
     entry->next = ht->buckets1[index];
     ht->buckets1[index] = entry;
     ++ht->count1;
-    return entry;
   }
-
-  index = murmurhash2(entry->key, strlen(entry->key)) % ht->size0;
-  entry->next = ht->buckets0[index];
-  ht->buckets0[index] = entry;
-  ++ht->count0;
+  else
+  {
+    index = entry->hash % ht->size0;
+    entry->next = ht->buckets0[index];
+    ht->buckets0[index] = entry;
+    ++ht->count0;
+  }
+  ht_write_end(ht);
   return entry;
 }
 
-static inline db_bool_t ht_entry_is_expire(DBHashEntry *entry, time_t expire)
-{
-  if (!entry || !dbobj_is_uint(entry->data))
-    return false;
-
-  return entry->data->value.uint_value <= (db_int_t)expire;
-}
-
-static db_bool_t ht_is_expire(DBHash *expires_ht, const char *key)
+static inline db_bool_t ht_entry_is_expire(DBHashEntry *entry)
 {
-  if (!expires_ht)
-    return false;
-
-  return ht_entry_is_expire(hget(expires_ht, key, NULL), time(NULL));
+  // Keys without a deadline never read the clock.
+  return entry->expire_at_ms && entry->expire_at_ms <= ht_clock_ms();
 }
 
 DBHash *ht_create()
@@ -255,6 +486,15 @@ DBHash *ht_create()
     EXIT_ON_MEMORY_ERROR();
 
   ht->rehashing_index = -1;
+  ht->memory = dbutil_alloc_size(ht);
+  ht->timers.entries = NULL;
+  ht->timers.length = 0;
+  ht->timers.capacity = 0;
+  ht->key_index = NULL;
+  ht->concurrent_reads = false;
+  atomic_init(&ht->seq, 0);
+  ht->is_keyspace = false;
+  ht->expired_contents = 0;
   ht->count0 = 0;
   ht->buckets0 = NULL;
   _ht_resize_table(ht, 0, HT_INITIAL_SIZE);
@@ -267,52 +507,212 @@ DBHash *ht_create()
 
 void ht_free(DBHash *ht)
 {
+  if (ht && ht->concurrent_reads)
+  {
+    // Readers find the table through its owner, who is letting go of it; those already in it
+    // are waited out, and the entries retired below follow them.
+    ht_write_begin(ht);
+    epoch_synchronize();
+  }
   _ht_clear(ht);
+  if (ht)
+    radix_free(ht->key_index);
   free(ht);
 }
 
+DBHash *ht_detach(DBHash *ht)
+{
+  DBHash *detached = (DBHash *)malloc(sizeof(DBHash));
+  if (!detached)
+    EXIT_ON_MEMORY_ERROR();
+  *detached = *ht;
+  // Whoever frees the detached table waits out the readers still in it, see lazyfree.c.
+  detached->concurrent_reads = false;
+
+  db_bool_t has_key_index = ht->key_index != NULL;
+  ht_write_begin(ht);
+  ht->rehashing_index = -1;
+  ht->memory = dbutil_alloc_size(ht);
+  ht->expired_contents = 0;
+  memset(&ht->timers, 0, sizeof(ht->timers));
+  ht->key_index = has_key_index ? radix_create() : NULL;
+  ht->count0 = 0;
+  ht->buckets0 = NULL;
+  _ht_resize_table(ht, 0, HT_INITIAL_SIZE);
+  ht->count1 = 0;
+  ht->buckets1 = NULL;
+  ht->size1 = 0;
+  ht_write_end(ht);
+  return detached;
+}
+
+db_bool_t ht_free_some(DBHash *ht, db_uint_t buckets)
+{
+  DBHashEntry *entry, *next;
+
+  // Buckets are freed from the end of each table, which shrinks until nothing is left.
+  for (; buckets && (ht->size1 || ht->size0); --buckets)
+  {
+    entry = ht->size1 ? ht->buckets1[--ht->size1] : ht->buckets0[--ht->size0];
+    while (entry)
+    {
+      next = entry->next;
+      ht_free_entry(entry);
+      entry = next;
+    }
+  }
+  if (ht->size1 || ht->size0)
+    return true;
+
+  ht->count0 = ht->count1 = 0;
+  ht_free(ht);
+  return false;
+}
+
 void ht_reset(DBHash *ht)
 {
   if (!ht)
     return;
+  ht_write_begin(ht);
   _ht_clear(ht);
   _ht_resize_table(ht, 0, HT_INITIAL_SIZE);
   _ht_resize_table(ht, 1, 0);
+  ht_write_end(ht);
 }
 
-static DBHashEntry *_ht_create_entry(char *key)
+void ht_reserve(DBHash *ht, db_uint_t count)
 {
-  if (!key)
-    return NULL;
+  if (!ht || ht_is_rehashing(ht) || ht->count0 || ht->count1)
+    return;
 
-  DBHashEntry *entry = (DBHashEntry *)malloc(sizeof(DBHashEntry));
+  db_uint_t size = HT_INITIAL_SIZE;
+  while (size < DB_UINT_MAX / 2 && count > HT_LOAD_FACTOR_EXPAND * size)
+    size *= 2;
+  if (size != ht->size0)
+  {
+    ht_write_begin(ht);
+    _ht_resize_table(ht, 0, size);
+    ht_write_end(ht);
+  }
+}
 
+DBHashEntry *ht_bulk_insert(DBHash *ht, char *key, DBObj *value)
+{
+  DBHashEntry *entry = ht_create_entry(key, value);
   if (!entry)
-    EXIT_ON_MEMORY_ERROR();
+    return NULL;
+
+  // New entries go to the rehash table while a rehash is running.
+  DBHashEntry **buckets = ht_is_rehashing(ht) ? ht->buckets1 : ht->buckets0;
+  db_uint_t index = entry->hash % (ht_is_rehashing(ht) ? ht->size1 : ht->size0);
+  if (ht->is_keyspace)
+    entry->access = evict_access_init();
+  ht_write_begin(ht);
+  entry->next = buckets[index];
+  buckets[index] = entry;
+  ht_write_end(ht);
+  ht->memory += ht_entry_memory_usage(entry);
+  if (ht->key_index)
+    radix_insert(ht->key_index, entry->key, entry->key_length);
+  if (ht_is_rehashing(ht))
+    ++ht->count1;
+  else
+    ++ht->count0;
+  return entry;
+}
+
+static DBHashEntry *_ht_create_entry(char *key, db_uint_t key_length, db_uint_t hash, DBObj *obj, db_bool_t owns_key)
+{
+  DBHashEntry *entry;
+
+  if (key_length <= HT_EMBEDDED_KEY_MAX)
+  {
+    entry = (DBHashEntry *)slab_alloc(sizeof(DBHashEntry) + key_length + 1);
+    entry->key = (char *)(entry + 1);
+    memcpy(entry->key, key, key_length + 1);
+    if (owns_key)
+      free(key);
+  }
+  else
+  {
+    entry = (DBHashEntry *)slab_alloc(sizeof(DBHashEntry));
+    entry->key = owns_key ? key : dbutil_strdup(key);
+  }
 
-  entry->key = key;
   entry->next = NULL;
-  entry->data = NULL;
+  entry->data = obj;
+  entry->hash = hash;
+  entry->key_length = key_length;
+  entry->expire_at_ms = 0;
+  entry->expire_index = 0;
+  entry->access = 0;
+  entry->borrowed_key = false;
+  entry->defer_free = false;
 
   return entry;
 }
 
-void ht_maintain_expires(DBHash *ht, DBHash *expires_ht, db_uint8_t index)
+DBHashEntry *ht_insert_borrowed(DBHash *ht, const char *key, db_uint_t key_length, DBObj *value)
 {
-  if (!ht || !expires_ht || index >= ht->size0)
-    return;
+  if (!ht || !key || !value)
+    return NULL;
 
-  DBHashEntry *entry = ht->buckets0[index];
-  DBHashEntry *next = NULL;
-  time_t now = time(NULL);
+  DBHashEntry *entry = (DBHashEntry *)slab_alloc(sizeof(DBHashEntry));
+  entry->key = (char *)key;
+  entry->next = NULL;
+  entry->data = value;
+  entry->hash = murmurhash2(key, key_length);
+  entry->key_length = key_length;
+  entry->expire_at_ms = 0;
+  entry->expire_index = 0;
+  entry->access = 0;
+  entry->borrowed_key = true;
+  entry->defer_free = false;
+
+  return ht_add(ht, entry);
+}
 
-  while (entry)
+// Deletes a key whose deadline has passed; a keyspace adds up what its value held for the owner
+static void ht_delete_expired(DBHash *ht, DBHashEntry *entry, const DBKey *key, DBHash *expires_ht)
+{
+  if (ht->is_keyspace)
+    ht->expired_contents += dbobj_memory_usage(entry->data) - dbobj_shallow_memory_usage(entry->data);
+  hdel_key(ht, key, expires_ht);
+}
+
+db_uint_t ht_expire_due(DBHash *ht, DBHash *expires_ht, db_uint_t limit)
+{
+  if (!ht || !expires_ht)
+    return 0;
+
+  // The periodic task also moves an idle table's rehash along.
+  _ht_maintenance(expires_ht);
+
+  uint64_t trace_at = TRACE_BEGIN();
+  DBTimerHeap *heap = &expires_ht->timers;
+  uint64_t now = ht_clock_ms();
+  db_uint_t expired = 0;
+  DBHashEntry *entry;
+  DBKey key;
+
+  while (expired < limit && heap->length && heap->entries[0]->expire_at_ms <= now)
   {
-    next = entry->next;
-    if (ht_is_expire(expires_ht, entry->key))
-      hdel(ht, entry->key, expires_ht);
-    entry = next;
+    entry = heap->entries[0];
+    key = ht_entry_key(entry);
+    DBHashEntry *keyspace_entry = ht_find_key(ht, &key);
+    if (keyspace_entry)
+      ht_delete_expired(ht, keyspace_entry, &key, expires_ht);
+    else
+    {
+      // Not in `ht`, which only happens when it was removed without its expiry table.
+      ht_timer_remove(expires_ht, entry);
+      ht_free_entry(ht_remove_key(expires_ht, &key, NULL));
+    }
+    ++expired;
   }
+
+  TRACE_END(TRACE_EXPIRE_CYCLE, trace_at, expired);
+  return expired;
 }
 
 DBHashEntry *ht_create_entry(char *key, DBObj *obj)
@@ -320,16 +720,23 @@ DBHashEntry *ht_create_entry(char *key, DBObj *obj)
   if (!key || !obj)
     return NULL;
 
-  DBHashEntry *entry = (DBHashEntry *)malloc(sizeof(DBHashEntry));
+  db_uint_t key_length = strlen(key);
+  return _ht_create_entry(key, key_length, murmurhash2(key, key_length), obj, true);
+}
 
-  if (!entry)
-    EXIT_ON_MEMORY_ERROR();
+static void ht_reclaim_entry(void *pointer)
+{
+  DBHashEntry *entry = (DBHashEntry *)pointer;
 
-  entry->key = key;
-  entry->next = NULL;
-  entry->data = obj;
+  if (ht_entry_owns_key(entry))
+    free(entry->key);
+  free_dbobj(entry->data);
+  slab_free(entry, ht_entry_alloc_size(entry));
+}
 
-  return entry;
+static void ht_reclaim_obj(void *pointer)
+{
+  free_dbobj((DBObj *)pointer);
 }
 
 DBObj *ht_extract_entry(DBHashEntry *entry)
@@ -338,10 +745,18 @@ DBObj *ht_extract_entry(DBHashEntry *entry)
     return NULL;
 
   DBObj *data = entry->data;
-  entry->data = NULL;
 
-  free(entry->key);
-  free(entry);
+  // A reader may be about to take its own reference, so the entry keeps the table's until then.
+  if (entry->defer_free)
+  {
+    epoch_retire(entry, ht_reclaim_entry);
+    return dbobj_share(data);
+  }
+
+  entry->data = NULL;
+  if (ht_entry_owns_key(entry))
+    free(entry->key);
+  slab_free(entry, ht_entry_alloc_size(entry));
 
   return data;
 }
@@ -351,43 +766,129 @@ db_bool_t ht_free_entry(DBHashEntry *entry)
   if (!entry)
     return false;
 
-  free(entry->key);
-  free_dbobj(entry->data);
-  free(entry);
+  if (entry->defer_free)
+    epoch_retire(entry, ht_reclaim_entry);
+  else
+    ht_reclaim_entry(entry);
 
   return true;
 }
 
-DBHashEntry *hget(DBHash *ht, const char *key, DBHash *expires_ht)
+DBKey ht_key(const char *key)
 {
-  if (!ht || !key)
+  db_uint_t length = key ? strlen(key) : 0;
+  return (DBKey){.string = key, .length = length, .hash = key ? murmurhash2(key, length) : 0};
+}
+
+DBHashEntry *hget_key(DBHash *ht, const DBKey *key, DBHash *expires_ht)
+{
+  if (!ht || !key || !key->string)
     return NULL;
 
-  if (ht_is_expire(expires_ht, key))
+  uint64_t trace_at = TRACE_BEGIN();
+  _ht_maintenance(ht);
+
+  DBHashEntry *entry = _ht_get_found(ht, key, _ht_find(ht, key), expires_ht);
+
+  TRACE_END(TRACE_HGET, trace_at, key->hash);
+  return entry;
+}
+
+// What a lookup of `key` returns once it found `entry`: NULL if it has expired, which deletes it
+static DBHashEntry *_ht_get_found(DBHash *ht, const DBKey *key, DBHashEntry *entry, DBHash *expires_ht)
+{
+  // Without its expiry table, a keyspace lookup sees the entry as it is.
+  if (entry && expires_ht && ht_entry_is_expire(entry))
   {
-    hdel(ht, key, expires_ht);
+    ht_delete_expired(ht, entry, key, expires_ht);
     return NULL;
   }
+  if (entry && ht->is_keyspace)
+    entry->access = evict_access_touch(entry->access);
+  return entry;
+}
 
-  _ht_maintenance(ht);
+void ht_prefetch_bucket(const DBHash *ht, const DBKey *key)
+{
+  if (ht_is_rehashing((DBHash *)ht))
+    __builtin_prefetch(&ht->buckets1[key->hash % ht->size1]);
+  __builtin_prefetch(&ht->buckets0[key->hash % ht->size0]);
+}
+
+void ht_prefetch_entry(const DBHash *ht, const DBKey *key)
+{
+  if (ht_is_rehashing((DBHash *)ht))
+    __builtin_prefetch(ht->buckets1[key->hash % ht->size1]);
+  __builtin_prefetch(ht->buckets0[key->hash % ht->size0]);
+}
+
+// The key of the first entry of the bucket, when the entry was prefetched and its hash matches;
+// a short key shares the allocation of its entry but may start on the next cache line
+static inline void _ht_prefetch_first_key(DBHashEntry *entry, const DBKey *key)
+{
+  if (entry && entry->hash == key->hash)
+    __builtin_prefetch(entry->key);
+}
+
+db_uint_t hget_keys(DBHash *ht, const DBKey *keys, db_uint_t count, DBHashEntry **entries, DBHash *expires_ht)
+{
+  db_uint_t found = 0, end;
+
+  if (!ht)
+  {
+    for (db_uint_t i = 0; i < count; ++i)
+      entries[i] = NULL;
+    return 0;
+  }
+
+  for (db_uint_t start = 0; start < count; start = end)
+  {
+    end = count - start > HT_BATCH_MAX ? start + HT_BATCH_MAX : count;
+    _ht_maintenance(ht);
+
+    // Each pass touches what the one before it asked for, by when most of it has arrived.
+    for (db_uint_t i = start; i < end; ++i)
+      if (keys[i].string)
+        ht_prefetch_bucket(ht, &keys[i]);
+    for (db_uint_t i = start; i < end; ++i)
+      if (keys[i].string)
+        ht_prefetch_entry(ht, &keys[i]);
+    for (db_uint_t i = start; i < end; ++i)
+      if (keys[i].string)
+      {
+        if (ht_is_rehashing(ht))
+          _ht_prefetch_first_key(ht->buckets1[keys[i].hash % ht->size1], &keys[i]);
+        _ht_prefetch_first_key(ht->buckets0[keys[i].hash % ht->size0], &keys[i]);
+      }
+
+    for (db_uint_t i = start; i < end; ++i)
+    {
+      entries[i] = keys[i].string ? _ht_get_found(ht, &keys[i], _ht_find(ht, &keys[i]), expires_ht) : NULL;
+      found += entries[i] != NULL;
+    }
+  }
+  return found;
+}
 
+static DBHashEntry *_ht_find(DBHash *ht, const DBKey *key)
+{
   DBHashEntry *entry;
 
   if (ht_is_rehashing(ht))
   {
-    entry = ht->buckets1[murmurhash2(key, strlen(key)) % ht->size1];
+    entry = ht->buckets1[key->hash % ht->size1];
     while (entry)
     {
-      if (strcmp(entry->key, key) == 0)
+      if (ht_entry_matches(entry, key))
         return entry;
       entry = entry->next;
     }
   }
 
-  entry = ht->buckets0[murmurhash2(key, strlen(key)) % ht->size0];
+  entry = ht->buckets0[key->hash % ht->size0];
   while (entry)
   {
-    if (strcmp(entry->key, key) == 0)
+    if (ht_entry_matches(entry, key))
       return entry;
     entry = entry->next;
   }
@@ -395,38 +896,166 @@ DBHashEntry *hget(DBHash *ht, const char *key, DBHash *expires_ht)
   return NULL;
 }
 
-db_bool_t hset(DBHash *ht, const char *key, DBObj *value, DBHash *expires_ht)
+DBHashEntry *ht_find_key(const DBHash *ht, const DBKey *key)
 {
-  if (!ht || !key || !value)
+  if (!ht || !key || !key->string)
+    return NULL;
+  return _ht_find((DBHash *)ht, key);
+}
+
+// Whether nothing changed the table since a reader saw `seq`, which it read before
+static inline db_bool_t ht_read_is_consistent(DBHash *ht, db_uint_t seq)
+{
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&ht->seq, memory_order_relaxed) == seq;
+}
+
+// Looks for a key in the bucket arrays the table had at `seq`; sets `is_torn` and gives up as soon
+// as it finds the table changed, since the chain it follows may have been moved meanwhile
+static DBHashEntry *_ht_find_concurrent(DBHash *ht, const DBKey *key, db_uint_t seq, db_bool_t *is_torn)
+{
+  db_bool_t is_rehashing = ht_is_rehashing(ht);
+  DBHashEntry **buckets[2] = {ht->buckets1, ht->buckets0};
+  db_uint_t sizes[2] = {ht->size1, ht->size0};
+  DBHashEntry *entry;
+
+  // The arrays and their sizes go together only if nothing moved them while they were read.
+  *is_torn = !ht_read_is_consistent(ht, seq);
+  for (int table = is_rehashing ? 0 : 1; table < 2 && !*is_torn; ++table)
+    for (entry = buckets[table][key->hash % sizes[table]]; entry; entry = entry->next)
+    {
+      if ((*is_torn = !ht_read_is_consistent(ht, seq)))
+        break;
+      if (ht_entry_matches(entry, key))
+        return entry;
+    }
+  return NULL;
+}
+
+db_bool_t ht_read_concurrent(DBHash *ht, const DBKey *key, DBObj **value)
+{
+  if (!ht || !key || !key->string || !epoch_enter())
     return false;
 
-  DBHashEntry *entry = hget(ht, key, expires_ht);
+  db_bool_t is_torn = true;
+  db_uint_t seq;
+  DBHashEntry *entry;
+  DBObj *data = NULL;
+  uint64_t expire_at_ms = 0;
 
-  if (entry)
+  for (db_uint_t attempt = 0; attempt < HT_READ_ATTEMPTS && is_torn; ++attempt)
   {
-    free_dbobj(entry->data);
-    entry->data = value;
-    return true;
+    seq = atomic_load_explicit(&ht->seq, memory_order_acquire);
+    if (seq & 1)
+      continue;
+    entry = _ht_find_concurrent(ht, key, seq, &is_torn);
+    if (is_torn)
+      continue;
+    if (entry)
+    {
+      data = entry->data;
+      expire_at_ms = entry->expire_at_ms;
+      is_torn = !ht_read_is_consistent(ht, seq);
+    }
+    else
+      data = NULL;
   }
-  else
+
+  // Deleting a key whose deadline passed is left to the owner, who looks it up again.
+  if (is_torn || (expire_at_ms && expire_at_ms <= ht_clock_ms()))
   {
-    ht_add(ht, ht_create_entry(dbutil_strdup(key), value));
-    return true;
+    epoch_exit();
+    return false;
   }
+  // The table still holds its reference, which it only drops once this reader is gone.
+  *value = data ? dbobj_share(data) : NULL;
+  epoch_exit();
+  return true;
 }
 
-DBHashEntry *ht_remove(DBHash *ht, const char *key, DBHash *expires_ht)
+void ht_config_concurrent_reads(DBHash *ht, db_bool_t enabled)
 {
-  if (!ht || !key)
-    return NULL;
+  if (ht)
+    ht->concurrent_reads = enabled;
+}
+
+void ht_config_keyspace(DBHash *ht, db_bool_t is_keyspace)
+{
+  if (ht)
+    ht->is_keyspace = is_keyspace;
+}
 
-  ht_free_entry(ht_remove(expires_ht, key, NULL));
+db_uint_t ht_sample(DBHash *ht, DBHashEntry **entries, db_uint_t count)
+{
+  db_uint_t found = 0, size0 = ht->size0, size = size0 + (ht->buckets1 ? ht->size1 : 0);
+  DBHashEntry *entry;
 
-  if (ht_is_expire(expires_ht, key))
+  if (!size || !(ht->count0 + ht->count1))
+    return 0;
+  for (db_uint_t tries = count * HT_SAMPLE_TRIES; found < count && tries; --tries)
   {
-    ht_free_entry(ht_remove(ht, key, NULL));
-    return NULL;
+    db_uint_t index = (db_uint_t)(evict_random() % size);
+    entry = index < size0 ? ht->buckets0[index] : ht->buckets1[index - size0];
+    for (; entry && found < count; entry = entry->next)
+      entries[found++] = entry;
+  }
+  return found;
+}
+
+DBHashEntry *hget(DBHash *ht, const char *key, DBHash *expires_ht)
+{
+  DBKey handle = ht_key(key);
+  return hget_key(ht, &handle, expires_ht);
+}
+
+db_bool_t hset_key(DBHash *ht, const DBKey *key, DBObj *value, DBHash *expires_ht)
+{
+  if (!ht || !key || !key->string || !value)
+    return false;
+
+  uint64_t trace_at = TRACE_BEGIN();
+  DBHashEntry *entry = hget_key(ht, key, expires_ht);
+
+  if (entry)
+  {
+    ht->memory -= dbobj_shallow_memory_usage(entry->data);
+    ht_write_begin(ht);
+    if (ht->concurrent_reads)
+      epoch_retire(entry->data, ht_reclaim_obj);
+    else
+      free_dbobj(entry->data);
+    entry->data = value;
+    ht_write_end(ht);
+    ht->memory += dbobj_shallow_memory_usage(value);
   }
+  else
+    ht_add(ht, _ht_create_entry((char *)key->string, key->length, key->hash, value, false));
+
+  TRACE_END(TRACE_HSET, trace_at, key->hash);
+  return true;
+}
+
+db_bool_t hset(DBHash *ht, const char *key, DBObj *value, DBHash *expires_ht)
+{
+  DBKey handle = ht_key(key);
+  return hset_key(ht, &handle, value, expires_ht);
+}
+
+// Whether or not it expired, the deadline goes together with a removed key
+static DBHashEntry *_ht_drop_expire(DBHashEntry *entry, const DBKey *key, DBHash *expires_ht)
+{
+  if (!entry->expire_at_ms || !expires_ht)
+    return entry;
+  ht_timer_remove(expires_ht, entry);
+  ht_free_entry(ht_remove_key(expires_ht, key, NULL));
+  entry->expire_at_ms = 0;
+  return entry;
+}
+
+DBHashEntry *ht_remove_key(DBHash *ht, const DBKey *key, DBHash *expires_ht)
+{
+  if (!ht || !key || !key->string)
+    return NULL;
 
   _ht_maintenance(ht);
 
@@ -435,37 +1064,49 @@ DBHashEntry *ht_remove(DBHash *ht, const char *key, DBHash *expires_ht)
 
   if (ht_is_rehashing(ht))
   {
-    index = murmurhash2(key, strlen(key)) % ht->size1;
+    index = key->hash % ht->size1;
     curr_entry = ht->buckets1[index];
     while (curr_entry)
     {
-      if (strcmp(curr_entry->key, key) == 0)
+      if (ht_entry_matches(curr_entry, key))
       {
+        ht_write_begin(ht);
         if (prev_entry)
           prev_entry->next = curr_entry->next;
         else
           ht->buckets1[index] = curr_entry->next;
+        ht_write_end(ht);
+        curr_entry->defer_free = ht->concurrent_reads;
         --ht->count1;
-        return curr_entry;
+        ht->memory -= ht_entry_memory_usage(curr_entry);
+        if (ht->key_index)
+          radix_remove(ht->key_index, curr_entry->key, curr_entry->key_length);
+        return _ht_drop_expire(curr_entry, key, expires_ht);
       }
       prev_entry = curr_entry;
       curr_entry = curr_entry->next;
     }
   }
 
-  index = murmurhash2(key, strlen(key)) % ht->size0;
+  index = key->hash % ht->size0;
   curr_entry = ht->buckets0[index];
   prev_entry = NULL;
   while (curr_entry)
   {
-    if (strcmp(curr_entry->key, key) == 0)
+    if (ht_entry_matches(curr_entry, key))
     {
+      ht_write_begin(ht);
       if (prev_entry)
         prev_entry->next = curr_entry->next;
       else
         ht->buckets0[index] = curr_entry->next;
+      ht_write_end(ht);
+      curr_entry->defer_free = ht->concurrent_reads;
       --ht->count0;
-      return curr_entry;
+      ht->memory -= ht_entry_memory_usage(curr_entry);
+      if (ht->key_index)
+        radix_remove(ht->key_index, curr_entry->key, curr_entry->key_length);
+      return _ht_drop_expire(curr_entry, key, expires_ht);
     }
     prev_entry = curr_entry;
     curr_entry = curr_entry->next;
@@ -474,11 +1115,28 @@ DBHashEntry *ht_remove(DBHash *ht, const char *key, DBHash *expires_ht)
   return NULL;
 }
 
-db_bool_t hdel(DBHash *ht, const char *key, DBHash *expires_ht)
+DBHashEntry *ht_remove(DBHash *ht, const char *key, DBHash *expires_ht)
+{
+  DBKey handle = ht_key(key);
+  return ht_remove_key(ht, &handle, expires_ht);
+}
+
+db_bool_t hdel_key(DBHash *ht, const DBKey *key, DBHash *expires_ht)
 {
-  if (!ht || !key)
+  if (!ht || !key || !key->string)
     return false;
-  return ht_free_entry(ht_remove(ht, key, expires_ht));
+  return ht_free_entry(ht_remove_key(ht, key, expires_ht));
+}
+
+db_bool_t hdel(DBHash *ht, const char *key, DBHash *expires_ht)
+{
+  DBKey handle = ht_key(key);
+  return hdel_key(ht, &handle, expires_ht);
+}
+
+db_bool_t ht_has_key(DBHash *ht, const DBKey *key, DBHash *expires_ht)
+{
+  return hget_key(ht, key, expires_ht) ? true : false;
 }
 
 db_bool_t ht_has(DBHash *ht, const char *key, DBHash *expires_ht)
@@ -486,6 +1144,40 @@ db_bool_t ht_has(DBHash *ht, const char *key, DBHash *expires_ht)
   return hget(ht, key, expires_ht) ? true : false;
 }
 
+void ht_expire_entry(DBHashEntry *entry, uint64_t deadline_ms, DBHash *expires_ht)
+{
+  DBTimerHeap *heap = &expires_ht->timers;
+  DBKey key = ht_entry_key(entry);
+  uint64_t seconds = deadline_ms / 1000;
+  db_bool_t is_timed = entry->expire_at_ms != 0;
+
+  // 0 means no deadline, and a deadline of 1 has passed all the same.
+  entry->expire_at_ms = deadline_ms ? deadline_ms : 1;
+  if (is_timed)
+  {
+    ht_timer_sift_up(heap, entry->expire_index);
+    ht_timer_sift_down(heap, entry->expire_index);
+  }
+  else
+    ht_timer_push(expires_ht, entry);
+
+  hset_key(expires_ht, &key, dbobj_create_uint(seconds < DB_UINT_MAX ? (db_uint_t)seconds : DB_UINT_MAX), NULL);
+}
+
+db_bool_t ht_expire_key(DBHash *ht, const DBKey *key, uint64_t deadline_ms, DBHash *expires_ht)
+{
+  if (!expires_ht)
+    return false;
+
+  DBHashEntry *entry = hget_key(ht, key, expires_ht);
+
+  if (!entry)
+    return false;
+
+  ht_expire_entry(entry, deadline_ms, expires_ht);
+  return true;
+}
+
 db_bool_t ht_rename(DBHash *ht, const char *old_key, const char *new_key, DBHash *expires_ht)
 {
   if (!ht || !old_key || !new_key)
@@ -496,22 +1188,27 @@ db_bool_t ht_rename(DBHash *ht, const char *old_key, const char *new_key, DBHash
   if (!entry)
     return false;
 
-  free(entry->key);
-  entry->key = dbutil_strdup(new_key);
-  ht_add(ht, entry);
+  // The key may live in the entry's own allocation, so the value moves to a new entry.
+  DBKey handle = ht_key(new_key);
+  ht_add(ht, _ht_create_entry((char *)handle.string, handle.length, handle.hash, ht_extract_entry(entry), false));
 
   return true;
 }
 
-DBList *ht_keys(DBHash *ht, DBHash *expires_ht)
+// Appends a copy of a key to a reply
+static void ht_push_key(DBArena *arena, DBList *list, const DBHashEntry *entry)
+{
+  rpush(list, create_dblistnode_in(arena, dbobj_create_string_in(arena, entry->key, entry->key_length)));
+}
+
+DBList *ht_keys(DBHash *ht, DBHash *expires_ht, DBArena *arena)
 {
   if (!ht)
     return NULL;
 
   DBHashEntry *entry;
   db_uint_t bucket_index;
-  DBList *key_list = create_dblist();
-  time_t now = time(NULL);
+  DBList *key_list = create_dblist_in(arena);
 
   if (ht->buckets0)
   {
@@ -520,8 +1217,8 @@ DBList *ht_keys(DBHash *ht, DBHash *expires_ht)
       entry = ht->buckets0[bucket_index];
       while (entry)
       {
-        if (!ht_is_expire(expires_ht, entry->key))
-          rpush(key_list, create_dblistnode_with_string(entry->key));
+        if (!ht_entry_is_expire(entry))
+          ht_push_key(arena, key_list, entry);
         entry = entry->next;
       }
     }
@@ -534,12 +1231,138 @@ DBList *ht_keys(DBHash *ht, DBHash *expires_ht)
       entry = ht->buckets1[bucket_index];
       while (entry)
       {
-        if (!ht_is_expire(expires_ht, entry->key))
-          rpush(key_list, create_dblistnode_with_string(entry->key));
+        if (!ht_entry_is_expire(entry))
+          ht_push_key(arena, key_list, entry);
         entry = entry->next;
       }
     }
   }
 
   return key_list;
-}
\ No newline at end of file
+}
+
+static db_uint_t ht_reverse_bits(db_uint_t value)
+{
+  value = (value >> 1 & 0x55555555) | (value & 0x55555555) << 1;
+  value = (value >> 2 & 0x33333333) | (value & 0x33333333) << 2;
+  value = (value >> 4 & 0x0F0F0F0F) | (value & 0x0F0F0F0F) << 4;
+  value = (value >> 8 & 0x00FF00FF) | (value & 0x00FF00FF) << 8;
+  return value >> 16 | value << 16;
+}
+
+static void ht_scan_bucket(DBHashEntry *entry, void (*visit)(DBHashEntry *entry, void *arg), void *arg)
+{
+  DBHashEntry *next;
+  for (; entry; entry = next)
+  {
+    next = entry->next;
+    if (!ht_entry_is_expire(entry))
+      visit(entry, arg);
+  }
+}
+
+db_uint_t ht_scan_next(db_uint_t cursor, db_uint_t mask)
+{
+  return ht_reverse_bits(ht_reverse_bits(cursor | ~mask) + 1);
+}
+
+db_uint_t ht_scan(DBHash *ht, db_uint_t cursor, void (*visit)(DBHashEntry *entry, void *arg), void *arg)
+{
+  if (!ht || !ht->size0)
+    return 0;
+
+  // sizes are powers of two, so a bucket index is the low bits of the hash
+  if (!ht_is_rehashing(ht))
+  {
+    db_uint_t mask = ht->size0 - 1;
+    ht_scan_bucket(ht->buckets0[cursor & mask], visit, arg);
+    return ht_scan_next(cursor, mask);
+  }
+
+  DBHashEntry **small = ht->buckets0, **large = ht->buckets1;
+  db_uint_t small_mask = ht->size0 - 1, large_mask = ht->size1 - 1;
+  if (ht->size0 > ht->size1)
+  {
+    small = ht->buckets1, large = ht->buckets0;
+    small_mask = ht->size1 - 1, large_mask = ht->size0 - 1;
+  }
+
+  ht_scan_bucket(small[cursor & small_mask], visit, arg);
+  // the buckets of the larger table whose low bits are those of the smaller one
+  do
+  {
+    ht_scan_bucket(large[cursor & large_mask], visit, arg);
+    cursor = ht_scan_next(cursor, large_mask);
+  } while (cursor & (small_mask ^ large_mask));
+  return cursor;
+}
+
+void ht_config_key_index(DBHash *ht, db_bool_t enabled)
+{
+  if (!ht || enabled == (ht->key_index != NULL))
+    return;
+  if (!enabled)
+  {
+    radix_free(ht->key_index);
+    ht->key_index = NULL;
+    return;
+  }
+
+  ht->key_index = radix_create();
+  DBHashEntry **tables[] = {ht->buckets0, ht->buckets1};
+  db_uint_t sizes[] = {ht->size0, ht->size1};
+  for (int table = 0; table < 2; ++table)
+    for (db_uint_t i = 0; tables[table] && i < sizes[table]; ++i)
+      for (DBHashEntry *entry = tables[table][i]; entry; entry = entry->next)
+        radix_insert(ht->key_index, entry->key, entry->key_length);
+}
+
+// Keys gathered by ht_keys_matching
+typedef struct HTKeysMatching
+{
+  DBHash *ht;
+  const DBGlob *glob;
+  DBList *keys;
+  DBArena *arena;
+} HTKeysMatching;
+
+static void ht_keys_matching_visit(DBHashEntry *entry, void *arg)
+{
+  HTKeysMatching *matching = (HTKeysMatching *)arg;
+  if (glob_match(matching->glob, entry->key, entry->key_length))
+    ht_push_key(matching->arena, matching->keys, entry);
+}
+
+// Visits a key under the prefix in the index, which knows nothing about deadlines
+static void ht_keys_matching_visit_indexed(const char *key, db_uint_t length, void *arg)
+{
+  HTKeysMatching *matching = (HTKeysMatching *)arg;
+  if (!glob_match(matching->glob, key, length))
+    return;
+  DBKey handle = {.string = key, .length = length, .hash = murmurhash2(key, length)};
+  DBHashEntry *entry = _ht_find(matching->ht, &handle);
+  if (entry && !ht_entry_is_expire(entry))
+    ht_push_key(matching->arena, matching->keys, entry);
+}
+
+DBList *ht_keys_matching(DBHash *ht, const char *pattern, DBArena *arena)
+{
+  if (!ht || !pattern)
+    return NULL;
+
+  DBGlob *glob = glob_compile(pattern);
+  HTKeysMatching matching = {.ht = ht, .glob = glob, .keys = create_dblist_in(arena), .arena = arena};
+  db_uint_t prefix_length = dbutil_pattern_prefix_length(pattern);
+  if (ht->key_index && prefix_length)
+    radix_walk_prefix(ht->key_index, pattern, prefix_length, ht_keys_matching_visit_indexed, &matching);
+  else
+  {
+    db_uint_t cursor = 0;
+    do
+    {
+      cursor = ht_scan(ht, cursor, ht_keys_matching_visit, &matching);
+    } while (cursor);
+  }
+  glob_free(glob);
+  return matching.keys;
+}
@@ -7,9 +7,32 @@
 // Load factor threshold for shrinking the hash table
 #define HT_LOAD_FACTOR_SHRINK 0.1
 
+// Non-empty buckets a rehash moves along with each operation on the table, and empty buckets it
+// may pass over for each before the operation gives up
+#define HT_REHASH_STEP_BUCKETS 4
+#define HT_REHASH_EMPTY_VISITS 10
+// Non-empty buckets ht_rehash_for moves between readings of the clock
+#define HT_REHASH_CHUNK_BUCKETS 128
+// Times ht_read_concurrent looks a key up while the owner keeps changing the table before giving up
+#define HT_READ_ATTEMPTS 4
+// Keys hget_keys looks up together; more would let the first prefetches be evicted before they are used
+#define HT_BATCH_MAX 32
+// Buckets ht_sample picks, for each entry asked for, before it settles for fewer
+#define HT_SAMPLE_TRIES 10
+
 // Seed for the hash function, affecting hash distribution
 extern db_uint_t hash_seed;
 
+// Reads the clock into the cache of the calling thread; the core worker does so once per dispatch
+// cycle, so every command of a batch sees the same time
+void ht_update_clock();
+
+// Unix time in milliseconds as last read by ht_update_clock, or read now on a thread that never does
+uint64_t ht_clock_ms();
+
+// Hashes a key with `hash_seed`; also routes keys to shards
+db_uint_t murmurhash2(const void *key, db_uint_t len);
+
 // Creates a new hash table context
 DBHash *ht_create();
 
@@ -18,7 +41,32 @@ void ht_free(DBHash *ht);
 
 void ht_reset(DBHash *ht);
 
-void ht_maintain_expires(DBHash *ht, DBHash *expires_ht, db_uint8_t index);
+// Moves everything in `ht` to a new table, which is returned, and leaves `ht` empty, without
+// visiting a single entry; `ht` keeps its key index turned on if it was
+DBHash *ht_detach(DBHash *ht);
+
+// Frees the entries of up to `buckets` buckets of a table nobody else holds, and the table itself
+// once they are all gone; returns true while entries are left
+db_bool_t ht_free_some(DBHash *ht, db_uint_t buckets);
+
+// Deletes up to `limit` keys of `ht` whose deadline has passed, soonest first, taking them from the
+// timer heap of `expires_ht`; the cost is proportional to what expires. Returns how many expired
+db_uint_t ht_expire_due(DBHash *ht, DBHash *expires_ht, db_uint_t limit);
+
+// Moves a running rehash along for up to `budget_ns` nanoseconds, so a table nobody touches still
+// finishes its resize; returns true if the rehash isn't done yet
+db_bool_t ht_rehash_for(DBHash *ht, uint64_t budget_ns);
+
+// Sizes an empty table so `count` entries fit without rehashing; does nothing if it isn't empty
+void ht_reserve(DBHash *ht, db_uint_t count);
+
+// Inserts a key known to be absent and takes ownership of it, skipping the lookup and the
+// incremental rehashing; meant for filling a table reserved with ht_reserve
+DBHashEntry *ht_bulk_insert(DBHash *ht, char *key, DBObj *value);
+
+// Inserts a key known to be absent without copying it; the key has to outlive the entry, which
+// never frees it. Lets a value hold the only copy of its own key, as sorted set elements do
+DBHashEntry *ht_insert_borrowed(DBHash *ht, const char *key, db_uint_t key_length, DBObj *value);
 
 DBHashEntry *ht_create_entry(char *key, DBObj *obj);
 
@@ -26,18 +74,95 @@ DBObj *ht_extract_entry(DBHashEntry *entry);
 
 db_bool_t ht_free_entry(DBHashEntry *entry);
 
+// Bytes allocated for an entry and its key, not counting its value
+size_t ht_entry_overhead(const DBHashEntry *entry);
+
+// Hashes a key once for the *_key functions below; the handle borrows `key`
+DBKey ht_key(const char *key);
+
 // Retrieves an entry by key; returns NULL if not found
 DBHashEntry *hget(DBHash *ht, const char *key, DBHash *expires_ht);
+DBHashEntry *hget_key(DBHash *ht, const DBKey *key, DBHash *expires_ht);
+
+// Looks `count` keys up as hget_key does each, filling `entries` in the same order, and returns how
+// many were found. Up to HT_BATCH_MAX keys at a time, it prefetches the bucket of every key, then
+// the first entry of every bucket, then the key of every entry whose hash matches, before it
+// compares any, so the cache misses of the keys overlap instead of following one another
+db_uint_t hget_keys(DBHash *ht, const DBKey *keys, db_uint_t count, DBHashEntry **entries, DBHash *expires_ht);
+
+// The first two steps of hget_keys for a single key, for a caller that looks keys up one at a time
+// but knows them ahead, like a worker going through a batch: the bucket slot of the key, then,
+// once that has arrived, the first entry of the bucket
+void ht_prefetch_bucket(const DBHash *ht, const DBKey *key);
+void ht_prefetch_entry(const DBHash *ht, const DBKey *key);
+
+// Looks a key up without moving a rehash along or expiring it, so several threads can read a
+// table nobody writes to at the same time
+DBHashEntry *ht_find_key(const DBHash *ht, const DBKey *key);
+
+// Looks a key up from any thread while the thread owning the table may be changing it, which
+// needs ht_config_concurrent_reads. Fills in `value` with a reference of the caller's own, or NULL
+// if the key doesn't exist, and returns true; returns false if the owner has to look instead,
+// because the table kept changing or the key has expired, which only the owner deletes
+db_bool_t ht_read_concurrent(DBHash *ht, const DBKey *key, DBObj **value);
+
+// Turns on reads by ht_read_concurrent, after which whatever the table unlinks is freed through
+// epoch_retire; the owner sets it while no reader can reach the table, and waits out the readers
+// with epoch_synchronize before turning it off
+void ht_config_concurrent_reads(DBHash *ht, db_bool_t enabled);
+
+// Marks the table as the keyspace of a shard: lookups with hget_key keep the access bits of its
+// entries up to date for eviction, and what expiry deletes is counted in `expired_contents`
+void ht_config_keyspace(DBHash *ht, db_bool_t is_keyspace);
+
+// Fills `entries` with up to `count` entries of the table, whole buckets at a time from buckets
+// picked at random; a sparse table may give fewer. Returns how many it found
+db_uint_t ht_sample(DBHash *ht, DBHashEntry **entries, db_uint_t count);
 
 db_bool_t hset(DBHash *ht, const char *key, DBObj *value, DBHash *expires_ht);
+db_bool_t hset_key(DBHash *ht, const DBKey *key, DBObj *value, DBHash *expires_ht);
 
 // Removes an entry by key; returns NULL if not found
 DBHashEntry *ht_remove(DBHash *ht, const char *key, DBHash *expires_ht);
+DBHashEntry *ht_remove_key(DBHash *ht, const DBKey *key, DBHash *expires_ht);
 
 db_bool_t hdel(DBHash *ht, const char *key, DBHash *expires_ht);
+db_bool_t hdel_key(DBHash *ht, const DBKey *key, DBHash *expires_ht);
 
 db_bool_t ht_has(DBHash *ht, const char *key, DBHash *expires_ht);
+db_bool_t ht_has_key(DBHash *ht, const DBKey *key, DBHash *expires_ht);
+
+// Sets the deadline of an existing key, in unix milliseconds; the entry keeps it and takes a place
+// in the timer heap of `expires_ht`, which also maps the key to the deadline in whole seconds.
+// Returns false if the key doesn't exist
+db_bool_t ht_expire_key(DBHash *ht, const DBKey *key, uint64_t deadline_ms, DBHash *expires_ht);
+void ht_expire_entry(DBHashEntry *entry, uint64_t deadline_ms, DBHash *expires_ht);
+
+// Puts an entry whose `expire_at_ms` is already set in the timer heap of `expires_ht`, without
+// touching the table itself; for loaders that fill both tables with ht_bulk_insert
+void ht_timer_track(DBHash *expires_ht, DBHashEntry *entry);
 
 db_bool_t ht_rename(DBHash *ht, const char *old_key, const char *new_key, DBHash *expires_ht);
 
-DBList *ht_keys(DBHash *ht, DBHash *expires_ht);
+// The live keys of the table, in a list allocated from `arena` when it isn't NULL, see arena.h
+DBList *ht_keys(DBHash *ht, DBHash *expires_ht, DBArena *arena);
+
+// Turns the key index of the table on, filling it with the keys already there, or off
+void ht_config_key_index(DBHash *ht, db_bool_t enabled);
+
+// The live keys matching `pattern`, see dbutil_match_keys. With the key index on and a pattern
+// that starts with literal bytes, only the keys under that prefix in the index are looked at;
+// otherwise every key of the table is. Allocated from `arena` as ht_keys is
+DBList *ht_keys_matching(DBHash *ht, const char *pattern, DBArena *arena);
+
+// Hands the live entries of the buckets `cursor` stands for to `visit` and returns the cursor of
+// the next ones, 0 once the scan is done; a scan starts at 0. The cursor counts up with its bits
+// reversed, so the buckets already visited are the same whether the table has grown or shrunk
+// since, and an entry that stays in the table for the whole scan is handed over at least once,
+// maybe twice across a resize. While a rehash runs, a bucket of the smaller table is visited
+// with every bucket of the larger one its entries can move to.
+db_uint_t ht_scan(DBHash *ht, db_uint_t cursor, void (*visit)(DBHashEntry *entry, void *arg), void *arg);
+
+// Cursor of the buckets after those of `cursor` in a table of `mask` + 1 buckets: the bits under
+// `mask` incremented from the highest one down
+db_uint_t ht_scan_next(db_uint_t cursor, db_uint_t mask);
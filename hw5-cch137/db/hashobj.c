@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "hash.h"
+#include "hashobj.h"
+
+db_uint_t hash_packed_max_fields = HASH_PACKED_MAX_FIELDS;
+db_uint_t hash_packed_max_length = HASH_PACKED_MAX_LENGTH;
+
+static inline db_bool_t hashobj_is_packed(const DBObj *obj)
+{
+  return obj->encoding == DB_ENCODING_HASH_PACKED;
+}
+
+// Offset of the field in the pairs, or -1
+static db_int_t hashobj_packed_find(const DBPackedHash *packed, const char *field)
+{
+  const char *pair = packed->data;
+  const char *end = packed->data + packed->used;
+
+  while (pair < end)
+  {
+    size_t field_length = strlen(pair);
+    if (strcmp(pair, field) == 0)
+      return (db_int_t)(pair - packed->data);
+    pair += field_length + 1;
+    pair += strlen(pair) + 1;
+  }
+  return -1;
+}
+
+// Makes room for `used` bytes of pairs, growing by half again so a run of HSETs reallocates rarely
+static DBPackedHash *hashobj_packed_reserve(DBPackedHash *packed, db_uint_t used)
+{
+  if (packed && used <= packed->capacity)
+    return packed;
+  db_uint_t capacity = packed ? packed->capacity + packed->capacity / 2 : 0;
+  if (capacity < used)
+    capacity = used;
+  DBPackedHash *grown = (DBPackedHash *)realloc(packed, sizeof(DBPackedHash) + capacity);
+  if (!grown)
+    EXIT_ON_MEMORY_ERROR();
+  if (!packed)
+    grown->length = grown->used = 0;
+  grown->capacity = capacity;
+  return grown;
+}
+
+// Moves the pairs into a table, which the value keeps from now on
+static void hashobj_convert(DBObj *obj)
+{
+  DBPackedHash *packed = obj->value.packed_hash;
+  DBHash *ht = ht_create();
+  const char *pair = packed->data;
+
+  ht_reserve(ht, packed->length + 1);
+  for (db_uint_t i = 0; i < packed->length; ++i)
+  {
+    const char *value = pair + strlen(pair) + 1;
+    hset(ht, pair, dbobj_create_string_with_dup(value), NULL);
+    pair = value + strlen(value) + 1;
+  }
+  free(packed);
+  obj->value.hash = ht;
+  obj->encoding = DB_ENCODING_HASHTABLE;
+}
+
+DBObj *hashobj_create()
+{
+  if (!hash_packed_max_fields)
+    return dbobj_create_hash(ht_create());
+  return dbobj_create_packed_hash(hashobj_packed_reserve(NULL, 0));
+}
+
+db_uint_t hashobj_length(const DBObj *obj)
+{
+  if (hashobj_is_packed(obj))
+    return obj->value.packed_hash->length;
+  return obj->value.hash->count0 + obj->value.hash->count1;
+}
+
+const char *hashobj_get(const DBObj *obj, const char *field)
+{
+  if (hashobj_is_packed(obj))
+  {
+    db_int_t offset = hashobj_packed_find(obj->value.packed_hash, field);
+    if (offset < 0)
+      return NULL;
+    const char *found = obj->value.packed_hash->data + offset;
+    return found + strlen(found) + 1;
+  }
+  DBKey handle = ht_key(field);
+  DBHashEntry *entry = ht_find_key(obj->value.hash, &handle);
+  return entry && dbobj_is_string(entry->data) ? entry->data->value.string : NULL;
+}
+
+DBObj *hashobj_get_reply(const DBObj *obj, const char *field)
+{
+  if (hashobj_is_packed(obj))
+  {
+    const char *value = hashobj_get(obj, field);
+    return value ? dbobj_create_string_with_dup(value) : dbobj_shared_null();
+  }
+  DBHashEntry *entry = hget(obj->value.hash, field, NULL);
+  return entry && dbobj_is_string(entry->data) ? dbobj_share(entry->data) : dbobj_shared_null();
+}
+
+db_bool_t hashobj_set(DBObj *obj, const char *field, const char *value)
+{
+  size_t field_length = strlen(field), value_length = strlen(value);
+
+  if (hashobj_is_packed(obj))
+  {
+    DBPackedHash *packed = obj->value.packed_hash;
+    db_int_t offset = hashobj_packed_find(packed, field);
+    db_bool_t fits = field_length <= hash_packed_max_length && value_length <= hash_packed_max_length;
+    if (fits && (offset >= 0 || packed->length < hash_packed_max_fields))
+    {
+      if (offset >= 0)
+      {
+        // The old value makes way for the new one, and the pairs after it move by the difference.
+        char *old_value = packed->data + offset + field_length + 1;
+        size_t old_length = strlen(old_value);
+        char *tail = old_value + old_length + 1;
+        size_t tail_length = (size_t)(packed->data + packed->used - tail);
+        db_uint_t used = packed->used - old_length + value_length;
+        packed = hashobj_packed_reserve(packed, used);
+        old_value = packed->data + offset + field_length + 1;
+        memmove(old_value + value_length + 1, old_value + old_length + 1, tail_length);
+        memcpy(old_value, value, value_length + 1);
+        packed->used = used;
+        obj->value.packed_hash = packed;
+        return false;
+      }
+      packed = hashobj_packed_reserve(packed, packed->used + field_length + value_length + 2);
+      memcpy(packed->data + packed->used, field, field_length + 1);
+      memcpy(packed->data + packed->used + field_length + 1, value, value_length + 1);
+      packed->used += field_length + value_length + 2;
+      ++packed->length;
+      obj->value.packed_hash = packed;
+      return true;
+    }
+    hashobj_convert(obj);
+  }
+  return hset(obj->value.hash, field, dbobj_create_string_with_dup(value), NULL);
+}
+
+db_bool_t hashobj_del(DBObj *obj, const char *field)
+{
+  if (!hashobj_is_packed(obj))
+    return hdel(obj->value.hash, field, NULL);
+
+  DBPackedHash *packed = obj->value.packed_hash;
+  db_int_t offset = hashobj_packed_find(packed, field);
+  if (offset < 0)
+    return false;
+  char *pair = packed->data + offset;
+  char *value = pair + strlen(pair) + 1;
+  char *next = value + strlen(value) + 1;
+  memmove(pair, next, (size_t)(packed->data + packed->used - next));
+  packed->used -= (db_uint_t)(next - pair);
+  --packed->length;
+  return true;
+}
+
+size_t hashobj_memory_usage(const DBObj *obj)
+{
+  if (hashobj_is_packed(obj))
+    return dbutil_alloc_size(obj->value.packed_hash);
+  return obj->value.hash ? obj->value.hash->memory : 0;
+}
+
+void hashobj_iter_init(const DBObj *obj, DBHashObjIter *iter)
+{
+  iter->obj = obj;
+  iter->offset = 0;
+  iter->table = 0;
+  iter->bucket = 0;
+  iter->entry = NULL;
+}
+
+const char *hashobj_iter_next(DBHashObjIter *iter, const char **value)
+{
+  if (hashobj_is_packed(iter->obj))
+  {
+    const DBPackedHash *packed = iter->obj->value.packed_hash;
+    if (iter->offset >= packed->used)
+      return NULL;
+    const char *field = packed->data + iter->offset;
+    const char *field_value = field + strlen(field) + 1;
+    iter->offset = (db_uint_t)(field_value + strlen(field_value) + 1 - packed->data);
+    if (value)
+      *value = field_value;
+    return field;
+  }
+
+  const DBHash *ht = iter->obj->value.hash;
+  for (;;)
+  {
+    if (iter->entry)
+      iter->entry = iter->entry->next;
+    while (!iter->entry)
+    {
+      DBHashEntry **buckets = iter->table ? ht->buckets1 : ht->buckets0;
+      db_uint_t size = iter->table ? ht->size1 : ht->size0;
+      if (buckets && iter->bucket < size)
+        iter->entry = buckets[iter->bucket++];
+      else if (iter->table++ == 0)
+        iter->bucket = 0;
+      else
+        return NULL;
+    }
+    if (dbobj_is_string(iter->entry->data))
+    {
+      if (value)
+        *value = iter->entry->data->value.string;
+      return iter->entry->key;
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef DB_HASHOBJ_H
+#define DB_HASHOBJ_H
+
+#include "types.h"
+
+// Hash values of the keyspace. Hashes of up to this many fields, none of them or their values
+// longer than HASH_PACKED_MAX_LENGTH bytes, are kept as their field/value pairs in one allocation
+// instead of a DBHash with an entry per field; a hash that outgrows either limit is converted once
+// and stays a table, where large values can be handed to replies without being copied
+#define HASH_PACKED_MAX_FIELDS 128
+#define HASH_PACKED_MAX_LENGTH 64
+
+// Limits applied from now on, see db_config_hash_packed
+extern db_uint_t hash_packed_max_fields;
+extern db_uint_t hash_packed_max_length;
+
+// Position of the next field read by hashobj_iter_next
+typedef struct DBHashObjIter
+{
+  const DBObj *obj;
+  db_uint_t offset;
+  db_uint_t table;
+  db_uint_t bucket;
+  const DBHashEntry *entry;
+} DBHashObjIter;
+
+// Creates an empty hash value, packed unless packing is turned off
+DBObj *hashobj_create();
+
+db_uint_t hashobj_length(const DBObj *obj);
+
+// The value of a field, owned by the hash and valid until it changes; NULL if there is no such field
+const char *hashobj_get(const DBObj *obj, const char *field);
+
+// The value of a field as a reply object, shared with the hash when it is stored as one; a null
+// object if there is no such field
+DBObj *hashobj_get_reply(const DBObj *obj, const char *field);
+
+// Sets a field, copying both strings; returns true if the field is new
+db_bool_t hashobj_set(DBObj *obj, const char *field, const char *value);
+
+// Removes a field; returns false if there was no such field
+db_bool_t hashobj_del(DBObj *obj, const char *field);
+
+// Bytes the encoding takes past the object itself
+size_t hashobj_memory_usage(const DBObj *obj);
+
+void hashobj_iter_init(const DBObj *obj, DBHashObjIter *iter);
+
+// Returns the next field and sets its value, or NULL at the end; fields of a table whose value
+// isn't a string are passed over. Both strings stay owned by the hash
+const char *hashobj_iter_next(DBHashObjIter *iter, const char **value);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "hotkeys.h"
+
+// Counter of the key with `hash` in `row`. The hash is stretched to 64 bits and split in two,
+// whose combinations stand for independent hashes, as in Kirsch and Mitzenmacher.
+static inline db_uint_t hotkeys_column(db_uint_t hash, db_uint_t row)
+{
+  uint64_t mixed = (uint64_t)hash * 0x9E3779B97F4A7C15ULL;
+  uint32_t first = (uint32_t)(mixed >> 32), second = (uint32_t)mixed | 1;
+  return (first + row * second) & (HOTKEYS_SKETCH_WIDTH - 1);
+}
+
+static void hotkeys_clear(DBHotKey *keys, db_uint_t length)
+{
+  for (db_uint_t i = 0; i < length; ++i)
+    free(keys[i].key);
+}
+
+DBHotKeys *hotkeys_create()
+{
+  DBHotKeys *hotkeys = (DBHotKeys *)calloc(1, sizeof(DBHotKeys));
+  if (!hotkeys)
+    EXIT_ON_MEMORY_ERROR();
+  hotkeys->countdown = 1;
+  return hotkeys;
+}
+
+void hotkeys_free(DBHotKeys *hotkeys)
+{
+  if (!hotkeys)
+    return;
+  hotkeys_clear(hotkeys->hottest, hotkeys->hottest_length);
+  hotkeys_clear(hotkeys->largest, hotkeys->largest_length);
+  free(hotkeys);
+}
+
+void hotkeys_reset(DBHotKeys *hotkeys)
+{
+  hotkeys_clear(hotkeys->hottest, hotkeys->hottest_length);
+  hotkeys_clear(hotkeys->largest, hotkeys->largest_length);
+  memset(hotkeys, 0, sizeof(DBHotKeys));
+  hotkeys->countdown = 1;
+}
+
+// Halves every counter and estimate
+static void hotkeys_age(DBHotKeys *hotkeys)
+{
+  for (db_uint_t row = 0; row < HOTKEYS_SKETCH_DEPTH; ++row)
+    for (db_uint_t column = 0; column < HOTKEYS_SKETCH_WIDTH; ++column)
+    {
+      hotkeys->accesses[row][column] >>= 1;
+      hotkeys->bytes[row][column] >>= 1;
+    }
+  for (db_uint_t i = 0; i < hotkeys->hottest_length; ++i)
+    hotkeys->hottest[i].estimate >>= 1;
+  for (db_uint_t i = 0; i < hotkeys->largest_length; ++i)
+    hotkeys->largest[i].estimate >>= 1;
+}
+
+// Keeps the key among the top ones of `keys` if its estimate is one of the largest
+static void hotkeys_rank(DBHotKey *keys, db_uint_t *length, const DBKey *key, uint64_t estimate,
+                         uint64_t read_bytes, uint64_t write_bytes)
+{
+  DBHotKey *least = NULL;
+  for (db_uint_t i = 0; i < *length; ++i)
+  {
+    DBHotKey *tracked = &keys[i];
+    if (tracked->hash == key->hash && tracked->length == key->length && memcmp(tracked->key, key->string, key->length) == 0)
+    {
+      tracked->estimate = estimate;
+      tracked->read_bytes += read_bytes;
+      tracked->write_bytes += write_bytes;
+      return;
+    }
+    if (!least || tracked->estimate < least->estimate)
+      least = tracked;
+  }
+
+  if (*length < HOTKEYS_TOP_K)
+    least = &keys[(*length)++];
+  else if (estimate > least->estimate)
+    free(least->key);
+  else
+    return;
+
+  least->key = (char *)malloc(key->length + 1);
+  if (!least->key)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(least->key, key->string, key->length);
+  least->key[key->length] = '\0';
+  least->length = key->length;
+  least->hash = key->hash;
+  least->estimate = estimate;
+  least->read_bytes = read_bytes;
+  least->write_bytes = write_bytes;
+}
+
+void hotkeys_record(DBHotKeys *hotkeys, const DBKey *key, uint64_t read_bytes, uint64_t write_bytes)
+{
+  uint64_t accesses = UINT64_MAX, bytes = UINT64_MAX, moved = read_bytes + write_bytes;
+
+  // Conservative update: only the counters at the minimum grow, which tightens the estimates.
+  db_uint_t columns[HOTKEYS_SKETCH_DEPTH];
+  for (db_uint_t row = 0; row < HOTKEYS_SKETCH_DEPTH; ++row)
+  {
+    columns[row] = hotkeys_column(key->hash, row);
+    if (hotkeys->accesses[row][columns[row]] < accesses)
+      accesses = hotkeys->accesses[row][columns[row]];
+    if (hotkeys->bytes[row][columns[row]] < bytes)
+      bytes = hotkeys->bytes[row][columns[row]];
+  }
+  ++accesses;
+  bytes += moved;
+  for (db_uint_t row = 0; row < HOTKEYS_SKETCH_DEPTH; ++row)
+  {
+    if (hotkeys->accesses[row][columns[row]] < accesses)
+      hotkeys->accesses[row][columns[row]] = (uint32_t)accesses;
+    if (hotkeys->bytes[row][columns[row]] < bytes)
+      hotkeys->bytes[row][columns[row]] = bytes;
+  }
+
+  hotkeys_rank(hotkeys->hottest, &hotkeys->hottest_length, key, accesses, read_bytes, write_bytes);
+  if (moved)
+    hotkeys_rank(hotkeys->largest, &hotkeys->largest_length, key, bytes, read_bytes, write_bytes);
+
+  if (++hotkeys->samples % HOTKEYS_AGE_SAMPLES == 0)
+    hotkeys_age(hotkeys);
+}
+
+uint64_t hotkeys_accesses(const DBHotKeys *hotkeys, db_uint_t hash)
+{
+  uint64_t accesses = UINT64_MAX;
+  for (db_uint_t row = 0; row < HOTKEYS_SKETCH_DEPTH; ++row)
+  {
+    uint32_t counter = hotkeys->accesses[row][hotkeys_column(hash, row)];
+    if (counter < accesses)
+      accesses = counter;
+  }
+  return accesses * HOTKEYS_SAMPLE_RATE;
+}
+
+uint64_t hotkeys_bytes(const DBHotKeys *hotkeys, db_uint_t hash)
+{
+  uint64_t bytes = UINT64_MAX;
+  for (db_uint_t row = 0; row < HOTKEYS_SKETCH_DEPTH; ++row)
+  {
+    uint64_t counter = hotkeys->bytes[row][hotkeys_column(hash, row)];
+    if (counter < bytes)
+      bytes = counter;
+  }
+  return bytes * HOTKEYS_SAMPLE_RATE;
+}
@@ -0,0 +1,78 @@
+#ifndef DB_HOTKEYS_H
+#define DB_HOTKEYS_H
+
+#include <stdint.h>
+
+#include "types.h"
+#include "evict.h"
+
+// Which keys of a shard take its worker's time, kept cheap enough to stay on. About one keyed
+// command in HOTKEYS_SAMPLE_RATE is sampled, at random so no pattern of requests hides a key.
+// Its key is counted in two Count-Min sketches, of accesses and of bytes read and written, each
+// HOTKEYS_SKETCH_DEPTH rows of HOTKEYS_SKETCH_WIDTH counters indexed by the hash the request
+// already carries. A sketch never underestimates, and overestimates by a small share of the
+// samples at most, with high probability. Keys whose estimate beats the least of those tracked
+// take its place in the top HOTKEYS_TOP_K by accesses, the hottest, or by bytes, the largest;
+// a tracked key also counts what its sampled commands read and wrote since it was tracked.
+// Every HOTKEYS_AGE_SAMPLES samples the counters are halved, so keys that cooled down give way.
+//
+// A shard's tracker is only touched by whoever holds the shard, like the rest of it.
+
+#define HOTKEYS_SAMPLE_RATE 8
+#define HOTKEYS_SKETCH_DEPTH 4
+// A power of two
+#define HOTKEYS_SKETCH_WIDTH 1024
+#define HOTKEYS_TOP_K 16
+#define HOTKEYS_AGE_SAMPLES (1u << 16)
+
+typedef struct DBHotKey
+{
+  char *key;
+  db_uint_t length;
+  db_uint_t hash;
+  // What the key is ranked by, from the sketch of its list when it was last sampled
+  uint64_t estimate;
+  // Bytes the sampled commands on the key read and wrote since it was tracked
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+} DBHotKey;
+
+typedef struct DBHotKeys
+{
+  uint32_t accesses[HOTKEYS_SKETCH_DEPTH][HOTKEYS_SKETCH_WIDTH];
+  uint64_t bytes[HOTKEYS_SKETCH_DEPTH][HOTKEYS_SKETCH_WIDTH];
+  DBHotKey hottest[HOTKEYS_TOP_K];
+  db_uint_t hottest_length;
+  DBHotKey largest[HOTKEYS_TOP_K];
+  db_uint_t largest_length;
+  // Keyed commands left before the next sample
+  db_uint_t countdown;
+  uint64_t samples;
+} DBHotKeys;
+
+DBHotKeys *hotkeys_create();
+
+void hotkeys_free(DBHotKeys *hotkeys);
+
+// Forgets every key and count
+void hotkeys_reset(DBHotKeys *hotkeys);
+
+// Whether the keyed command being served is sampled; one decrement for most of them
+static inline db_bool_t hotkeys_should_sample(DBHotKeys *hotkeys)
+{
+  if (--hotkeys->countdown)
+    return false;
+  // Uniform over 1 to twice the rate, less one, so the rate holds on average.
+  hotkeys->countdown = 1 + (db_uint_t)(evict_random() % (2 * HOTKEYS_SAMPLE_RATE - 1));
+  return true;
+}
+
+// Counts a sampled command on `key` that read and wrote so many bytes
+void hotkeys_record(DBHotKeys *hotkeys, const DBKey *key, uint64_t read_bytes, uint64_t write_bytes);
+
+// Estimates of the commands on the key with `hash` and of the bytes they moved, scaled by the
+// sample rate to stand for every command
+uint64_t hotkeys_accesses(const DBHotKeys *hotkeys, db_uint_t hash);
+uint64_t hotkeys_bytes(const DBHotKeys *hotkeys, db_uint_t hash);
+
+#endif
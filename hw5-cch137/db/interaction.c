@@ -1,11 +1,204 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "obj.h"
 #include "list.h"
+#include "rope.h"
+#include "hash.h"
+#include "arena.h"
+#include "transaction.h"
 #include "interaction.h"
 
+// Name of a command and how many arguments it takes; a max_args of -1 takes any number of them
+typedef struct DBCommandSpec
+{
+  const char *name;
+  db_uint_t min_args;
+  db_int_t max_args;
+} DBCommandSpec;
+
+static const DBCommandSpec command_specs[] = {
+    [DB_SAVE] = {"SAVE", 0, 0},
+    [DB_BGSAVE] = {"BGSAVE", 0, 0},
+    [DB_LASTSAVE] = {"LASTSAVE", 0, 0},
+    [DB_BGREWRITEAOF] = {"BGREWRITEAOF", 0, 0},
+    [DB_START] = {"START", 0, -1},
+    [DB_PING] = {"PING", 0, 1},
+    [DB_SET] = {"SET", 2, 2},
+    [DB_GET] = {"GET", 1, 1},
+    [DB_MGET] = {"MGET", 1, -1},
+    [DB_MSET] = {"MSET", 2, -1},
+    [DB_MSETNX] = {"MSETNX", 2, -1},
+    [DB_INCR] = {"INCR", 1, 1},
+    [DB_DECR] = {"DECR", 1, 1},
+    [DB_INCRBY] = {"INCRBY", 2, 2},
+    [DB_DECRBY] = {"DECRBY", 2, 2},
+    [DB_INCRBYFLOAT] = {"INCRBYFLOAT", 2, 2},
+    [DB_APPEND] = {"APPEND", 2, 2},
+    [DB_STRLEN] = {"STRLEN", 1, 1},
+    [DB_GETRANGE] = {"GETRANGE", 3, 3},
+    [DB_SETRANGE] = {"SETRANGE", 3, 3},
+    [DB_MULTI] = {"MULTI", 0, 0},
+    [DB_EXEC] = {"EXEC", 0, 0},
+    [DB_DISCARD] = {"DISCARD", 0, 0},
+    [DB_WATCH] = {"WATCH", 1, -1},
+    [DB_UNWATCH] = {"UNWATCH", 0, 0},
+    [DB_RENAME] = {"RENAME", 2, 2},
+    [DB_DEL] = {"DEL", 1, -1},
+    [DB_UNLINK] = {"UNLINK", 1, -1},
+    [DB_LPUSH] = {"LPUSH", 2, -1},
+    [DB_LPOP] = {"LPOP", 1, 2},
+    [DB_RPUSH] = {"RPUSH", 2, -1},
+    [DB_RPOP] = {"RPOP", 1, 2},
+    [DB_BLPOP] = {"BLPOP", 2, -1},
+    [DB_BRPOP] = {"BRPOP", 2, -1},
+    [DB_LLEN] = {"LLEN", 1, 1},
+    [DB_LRANGE] = {"LRANGE", 1, 3},
+    [DB_LINDEX] = {"LINDEX", 2, 2},
+    [DB_LSET] = {"LSET", 3, 3},
+    [DB_LINSERT] = {"LINSERT", 4, 4},
+    [DB_HGET] = {"HGET", 2, 2},
+    [DB_HSET] = {"HSET", 3, -1},
+    [DB_HDEL] = {"HDEL", 2, -1},
+    [DB_HMGET] = {"HMGET", 2, -1},
+    [DB_HGETALL] = {"HGETALL", 1, 1},
+    [DB_HINCRBY] = {"HINCRBY", 3, 3},
+    [DB_HSCAN] = {"HSCAN", 2, -1},
+    [DB_EXPIRE] = {"EXPIRE", 1, 2},
+    [DB_EXPIREAT] = {"EXPIREAT", 1, 2},
+    [DB_PEXPIRE] = {"PEXPIRE", 1, 2},
+    [DB_PEXPIREAT] = {"PEXPIREAT", 1, 2},
+    [DB_TTL] = {"TTL", 1, 1},
+    [DB_PTTL] = {"PTTL", 1, 1},
+    [DB_ZSCORE] = {"ZSCORE", 2, 2},
+    [DB_ZADD] = {"ZADD", 3, -1},
+    [DB_ZCARD] = {"ZCARD", 1, 1},
+    [DB_ZCOUNT] = {"ZCOUNT", 3, 3},
+    [DB_ZINTERSTORE] = {"ZINTERSTORE", 3, -1},
+    [DB_ZUNIONSTORE] = {"ZUNIONSTORE", 3, -1},
+    [DB_ZRANGE] = {"ZRANGE", 1, 4},
+    [DB_ZRANGEBYSCORE] = {"ZRANGEBYSCORE", 3, 4},
+    [DB_ZRANK] = {"ZRANK", 2, 3},
+    [DB_ZREVRANGE] = {"ZREVRANGE", 1, 4},
+    [DB_ZREVRANK] = {"ZREVRANK", 2, 3},
+    [DB_ZREM] = {"ZREM", 2, -1},
+    [DB_ZREMRANGEBYSCORE] = {"ZREMRANGEBYSCORE", 3, 3},
+    [DB_ZSCAN] = {"ZSCAN", 2, -1},
+    [DB_KEYS] = {"KEYS", 0, 1},
+    [DB_SCAN] = {"SCAN", 1, -1},
+    [DB_FLUSHALL] = {"FLUSHALL", 0, 1},
+    [DB_INFO_DATASET_MEMORY] = {"INFO_DATASET_MEMORY", 0, 0},
+    [DB_MEMORY_USAGE] = {"MEMORY_USAGE", 1, 1},
+    [DB_MEMORY_STATS] = {"MEMORY_STATS", 0, 0},
+    [DB_INFO_PERSISTENCE] = {"INFO_PERSISTENCE", 0, 0},
+    [DB_INFO_STATS] = {"INFO_STATS", 0, 0},
+    [DB_INFO_COMMANDSTATS] = {"INFO_COMMANDSTATS", 0, 0},
+    [DB_INFO_REPLICATION] = {"INFO_REPLICATION", 0, 0},
+    [DB_SLOWLOG_GET] = {"SLOWLOG_GET", 0, 1},
+    [DB_SLOWLOG_LEN] = {"SLOWLOG_LEN", 0, 0},
+    [DB_SLOWLOG_RESET] = {"SLOWLOG_RESET", 0, 0},
+    [DB_HOTKEYS_GET] = {"HOTKEYS_GET", 0, 1},
+    [DB_HOTKEYS_BYTES] = {"HOTKEYS_BYTES", 0, 1},
+    [DB_HOTKEYS_RESET] = {"HOTKEYS_RESET", 0, 0},
+    [DB_TRACE_START] = {"TRACE_START", 0, 0},
+    [DB_TRACE_STOP] = {"TRACE_STOP", 0, 0},
+    [DB_TRACE_GET] = {"TRACE_GET", 0, 1},
+    [DB_REPLICAOF] = {"REPLICAOF", 2, 2},
+    [DB_PSYNC] = {"PSYNC", 2, 2},
+    [DB_REPLICA_LOAD] = {"REPLICA_LOAD", 1, 1},
+    [DB_CLUSTER_KEYSLOT] = {"CLUSTER_KEYSLOT", 1, 1},
+    [DB_CLUSTER_ADDSLOTS] = {"CLUSTER_ADDSLOTS", 1, 2},
+    [DB_CLUSTER_SETSLOT] = {"CLUSTER_SETSLOT", 2, 4},
+    [DB_CLUSTER_SLOTS] = {"CLUSTER_SLOTS", 0, 0},
+    [DB_CLUSTER_COUNTKEYSINSLOT] = {"CLUSTER_COUNTKEYSINSLOT", 1, 1},
+    [DB_CLUSTER_GETKEYSINSLOT] = {"CLUSTER_GETKEYSINSLOT", 2, 2},
+    [DB_ASKING] = {"ASKING", 0, 0},
+    [DB_MIGRATE] = {"MIGRATE", 3, 4},
+    [DB_SHUTDOWN] = {"SHUTDOWN", 0, 0},
+};
+
+#define COMMAND_SPECS_LENGTH (sizeof(command_specs) / sizeof(command_specs[0]))
+
+// Slots of the command lookup table, a power of two large enough for a collision-free seed to
+// turn up within a few tries
+#define COMMAND_SLOTS 1024
+
+// Perfect hash of the command names: every name hashes to a slot of its own under
+// `command_seed`, so a lookup is one hash and one comparison. Filled in once, on first use
+static db_uint8_t command_slots[COMMAND_SLOTS];
+static db_uint_t command_seed = 0;
+static once_flag command_slots_once = ONCE_FLAG_INIT;
+
+// FNV-1a over the bytes with the case bit cleared, so a name hashes the same in any case
+static db_uint_t command_hash(const char *name, size_t length, db_uint_t seed)
+{
+  db_uint_t hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < length; ++i)
+    hash = (hash ^ ((unsigned char)name[i] & ~0x20u)) * 16777619u;
+  return hash;
+}
+
+static void command_slots_init()
+{
+  db_bool_t has_collision = true;
+  size_t slot;
+
+  while (has_collision)
+  {
+    ++command_seed;
+    has_collision = false;
+    memset(command_slots, 0, sizeof(command_slots));
+    for (size_t i = 0; i < COMMAND_SPECS_LENGTH && !has_collision; ++i)
+    {
+      if (!command_specs[i].name)
+        continue;
+      slot = command_hash(command_specs[i].name, strlen(command_specs[i].name), command_seed) & (COMMAND_SLOTS - 1);
+      has_collision = command_slots[slot] != DB_UNKNOWN_COMMAND;
+      command_slots[slot] = (db_uint8_t)i;
+    }
+  }
+}
+
+const char *db_action_name(db_action_t action)
+{
+  if (action <= DB_UNKNOWN_COMMAND || action >= COMMAND_SPECS_LENGTH)
+    return NULL;
+  return command_specs[action].name;
+}
+
+db_action_t db_action_from_name(const char *name)
+{
+  return name ? db_action_from_slice(name, strlen(name)) : DB_UNKNOWN_COMMAND;
+}
+
+db_action_t db_action_from_slice(const char *name, size_t length)
+{
+  call_once(&command_slots_once, command_slots_init);
+
+  db_action_t action = (db_action_t)command_slots[command_hash(name, length, command_seed) & (COMMAND_SLOTS - 1)];
+  const char *candidate = command_specs[action].name;
+  if (action == DB_UNKNOWN_COMMAND || strlen(candidate) != length)
+    return DB_UNKNOWN_COMMAND;
+  for (size_t i = 0; i < length; ++i)
+    if (toupper((unsigned char)name[i]) != candidate[i])
+      return DB_UNKNOWN_COMMAND;
+  return action;
+}
+
+db_bool_t db_action_accepts(db_action_t action, db_uint_t argc)
+{
+  if (action <= DB_UNKNOWN_COMMAND || action >= COMMAND_SPECS_LENGTH)
+    return true;
+  return argc >= command_specs[action].min_args && (command_specs[action].max_args < 0 || argc <= (db_uint_t)command_specs[action].max_args);
+}
+
 DBRequest *create_request(db_action_t action)
 {
   DBRequest *request = (DBRequest *)malloc(sizeof(DBRequest));
@@ -13,6 +206,10 @@ DBRequest *create_request(db_action_t action)
     EXIT_ON_MEMORY_ERROR();
   request->action = action;
   request->args = NULL;
+  request->key = ht_key(NULL);
+  request->is_from_primary = false;
+  request->is_asking = false;
+  request->transaction = NULL;
   return request;
 };
 
@@ -23,6 +220,13 @@ DBReply *create_reply()
     EXIT_ON_MEMORY_ERROR();
   reply->done = false;
   reply->data = NULL;
+  reply->notify_fd = -1;
+  atomic_init(&reply->is_cancelled, false);
+  reply->arena = NULL;
+  reply->is_streamed = false;
+  reply->stream_length = 0;
+  if (mtx_init(&reply->done_lock, mtx_plain) != thrd_success || cnd_init(&reply->done_cond) != thrd_success)
+    EXIT_ON_MEMORY_ERROR();
   return reply;
 };
 
@@ -32,28 +236,30 @@ void add_request_arg(DBRequest *request, DBObj *arg)
     return;
   if (!request->args)
     request->args = create_dblist();
-  DBListNode *node = create_dblistnode(arg);
-  if (arg)
-  {
-    join_dblistnodes(request->args->tail, node);
-    if (!request->args->head)
-      request->args->head = node;
-    request->args->tail = node;
-    request->args->length++;
-    rpush;
-  }
+  if (!arg)
+    return;
+  // The first argument is the key of every keyed command, hash it while it is still in cache.
+  if (!request->args->length && dbobj_is_string(arg))
+    request->key = ht_key(arg->value.string);
+  rpush(request->args, create_dblistnode(arg));
 };
 
 DBRequest *reset_request(DBRequest *request, db_action_t action)
 {
   if (!request)
     return NULL;
+  if (request->action == DB_EXEC)
+    transaction_free(request->transaction);
   request->action = action;
   if (request->args)
   {
     free_dblist(request->args);
     request->args = NULL;
   }
+  request->key = ht_key(NULL);
+  request->is_from_primary = false;
+  request->is_asking = false;
+  request->transaction = NULL;
   return request;
 };
 
@@ -63,6 +269,9 @@ void free_request(DBRequest *request)
     return;
 
   free_dblist(request->args);
+  // WATCH only borrows the transaction of its pipeline.
+  if (request->action == DB_EXEC)
+    transaction_free(request->transaction);
   free(request);
 };
 
@@ -72,9 +281,78 @@ void free_reply(DBReply *reply)
     return;
 
   free_dbobj(reply->data);
+  arena_free(reply->arena);
+  cnd_destroy(&reply->done_cond);
+  mtx_destroy(&reply->done_lock);
   free(reply);
 }
 
+DBArena *reply_arena(DBReply *reply)
+{
+  if (!reply->arena)
+    reply->arena = arena_create();
+  return reply->arena;
+}
+
+DBPipeline *create_pipeline()
+{
+  DBPipeline *pipeline = (DBPipeline *)malloc(sizeof(DBPipeline));
+  if (!pipeline)
+    EXIT_ON_MEMORY_ERROR();
+  pipeline->requests = NULL;
+  pipeline->replies = NULL;
+  pipeline->length = 0;
+  pipeline->capacity = 0;
+  pipeline->transaction = NULL;
+  return pipeline;
+}
+
+void add_pipeline_request(DBPipeline *pipeline, DBRequest *request)
+{
+  if (!pipeline || !request)
+    return;
+  if (pipeline->length == pipeline->capacity)
+  {
+    db_uint_t capacity = pipeline->capacity ? pipeline->capacity * 2 : 16;
+    DBRequest **requests = (DBRequest **)realloc(pipeline->requests, capacity * sizeof(DBRequest *));
+    if (!requests)
+      EXIT_ON_MEMORY_ERROR();
+    pipeline->requests = requests;
+    DBReply **replies = (DBReply **)realloc(pipeline->replies, capacity * sizeof(DBReply *));
+    if (!replies)
+      EXIT_ON_MEMORY_ERROR();
+    pipeline->replies = replies;
+    pipeline->capacity = capacity;
+  }
+  pipeline->requests[pipeline->length] = request;
+  pipeline->replies[pipeline->length] = NULL;
+  ++pipeline->length;
+}
+
+DBPipeline *reset_pipeline(DBPipeline *pipeline)
+{
+  if (!pipeline)
+    return NULL;
+  for (db_uint_t i = 0; i < pipeline->length; ++i)
+  {
+    free_request(pipeline->requests[i]);
+    free_reply(pipeline->replies[i]);
+  }
+  pipeline->length = 0;
+  return pipeline;
+}
+
+void free_pipeline(DBPipeline *pipeline)
+{
+  if (!pipeline)
+    return;
+  reset_pipeline(pipeline);
+  transaction_free(pipeline->transaction);
+  free(pipeline->requests);
+  free(pipeline->replies);
+  free(pipeline);
+}
+
 DBObj *print_dbobj(DBObj *obj)
 {
   if (!obj)
@@ -100,8 +378,14 @@ DBObj *print_dbobj(DBObj *obj)
   case DB_TYPE_UINT:
     printf("(uint) %lu\n", obj->value.uint_value);
     break;
+  case DB_TYPE_DOUBLE:
+    printf("(double) %lf\n", obj->value.double_value);
+    break;
   case DB_TYPE_STRING:
-    printf("\"%s\"\n", obj->value.string ? obj->value.string : "");
+    if (obj->encoding == DB_ENCODING_ROPE)
+      printf("(rope) length: %zu\n", obj->value.rope->size);
+    else
+      printf("\"%s\"\n", obj->value.string ? obj->value.string : "");
     break;
   case DB_TYPE_LIST:
     printf("(list) length: %u\n", obj->value.list ? obj->value.list->length : 0);
@@ -177,6 +461,110 @@ DBReply *reply_data(DBReply *reply, DBObj *data)
   return reply;
 }
 
+DBReply *reply_done(DBReply *reply)
+{
+  if (!reply)
+    return NULL;
+  uint64_t one = 1;
+  mtx_lock(&reply->done_lock);
+  reply->done = true;
+  cnd_broadcast(&reply->done_cond);
+  // The waiter may free the reply once the lock is let go; the descriptor is written under it.
+  if (reply->notify_fd >= 0 && write(reply->notify_fd, &one, sizeof(one)) < 0)
+    reply->notify_fd = -1;
+  mtx_unlock(&reply->done_lock);
+  return reply;
+}
+
+db_bool_t reply_is_done(DBReply *reply)
+{
+  if (!reply)
+    return true;
+  mtx_lock(&reply->done_lock);
+  db_bool_t done = reply->done;
+  mtx_unlock(&reply->done_lock);
+  return done;
+}
+
+void reply_set_notify_fd(DBReply *reply, int fd)
+{
+  if (!reply)
+    return;
+  mtx_lock(&reply->done_lock);
+  reply->notify_fd = fd;
+  mtx_unlock(&reply->done_lock);
+}
+
+DBReply *reply_wait(DBReply *reply)
+{
+  if (!reply)
+    return NULL;
+  mtx_lock(&reply->done_lock);
+  while (!reply->done)
+    cnd_wait(&reply->done_cond, &reply->done_lock);
+  mtx_unlock(&reply->done_lock);
+  return reply;
+}
+
+void reply_stream_begin(DBReply *reply, db_uint_t length)
+{
+  mtx_lock(&reply->done_lock);
+  if (reply->data)
+    free_dbobj(reply->data);
+  reply->data = dbobj_create_list(create_dblist());
+  reply->stream_length = length;
+  reply->is_streamed = true;
+  cnd_broadcast(&reply->done_cond);
+  mtx_unlock(&reply->done_lock);
+}
+
+void reply_stream_push(DBReply *reply, DBList *chunk)
+{
+  DBListNode *node;
+  mtx_lock(&reply->done_lock);
+  while ((node = lpop(chunk)))
+    rpush(reply->data->value.list, node);
+  cnd_broadcast(&reply->done_cond);
+  mtx_unlock(&reply->done_lock);
+  free_dblist(chunk);
+}
+
+db_bool_t reply_wait_streamed(DBReply *reply)
+{
+  if (!reply)
+    return false;
+  mtx_lock(&reply->done_lock);
+  while (!reply->done && !reply->is_streamed)
+    cnd_wait(&reply->done_cond, &reply->done_lock);
+  db_bool_t is_streamed = reply->is_streamed;
+  mtx_unlock(&reply->done_lock);
+  return is_streamed;
+}
+
+DBList *reply_stream_take(DBReply *reply)
+{
+  DBListNode *node;
+  mtx_lock(&reply->done_lock);
+  while (!reply->done && !reply->data->value.list->length)
+    cnd_wait(&reply->done_cond, &reply->done_lock);
+  DBList *taken = reply->data->value.list->length ? create_dblist() : NULL;
+  while (taken && (node = lpop(reply->data->value.list)))
+    rpush(taken, node);
+  mtx_unlock(&reply->done_lock);
+  return taken;
+}
+
+size_t reply_payload_size(DBReply *reply)
+{
+  if (!reply || !reply->is_streamed)
+    return reply ? dbobj_payload_size(reply->data) : 0;
+  mtx_lock(&reply->done_lock);
+  db_uint_t length = reply->data->value.list->length;
+  size_t size = dbobj_payload_size(reply->data);
+  mtx_unlock(&reply->done_lock);
+  return length ? size * reply->stream_length / length : 0;
+}
+
 char *get_string_arg(DBListNode *curr_node)
 {
   if (!curr_node || !curr_node->data || !dbobj_is_string(curr_node->data))
@@ -195,6 +583,18 @@ db_uint_t get_uint_arg(DBListNode *curr_node)
   return 0;
 }
 
+uint64_t get_uint64_arg(DBListNode *curr_node)
+{
+  if (!curr_node || !curr_node->data)
+    return 0;
+  // Millisecond times don't fit a db_uint_t, so the argument is parsed without converting it.
+  if (dbobj_is_string(curr_node->data) && curr_node->data->value.string)
+    return (uint64_t)strtoull(curr_node->data->value.string, NULL, 10);
+  if (dbobj_is_uint(curr_node->data))
+    return curr_node->data->value.uint_value;
+  return 0;
+}
+
 db_int_t get_int_arg(DBListNode *curr_node)
 {
   if (!curr_node || !curr_node->data)
@@ -206,17 +606,50 @@ db_int_t get_int_arg(DBListNode *curr_node)
   return 0;
 }
 
+db_double_t get_double_arg(DBListNode *curr_node)
+{
+  if (!curr_node || !curr_node->data)
+    return 0;
+  if (dbobj_is_string(curr_node->data))
+    arg_string_to_double(curr_node->data);
+  if (dbobj_is_double(curr_node->data))
+    return curr_node->data->value.double_value;
+  return 0;
+}
+
+db_double_t get_score_bound_arg(DBListNode *curr_node, db_bool_t *included)
+{
+  *included = true;
+  if (!curr_node || !curr_node->data)
+    return NAN;
+  if (dbobj_is_double(curr_node->data))
+    return curr_node->data->value.double_value;
+  if (!dbobj_is_string(curr_node->data) || !curr_node->data->value.string)
+    return NAN;
+
+  char *s = curr_node->data->value.string;
+  char *end;
+  if (*s == '(')
+    *included = false, ++s;
+  db_double_t score = strtod(s, &end);
+  return end == s || *end ? NAN : score;
+}
+
 DBObj *arg_string_to_uint(DBObj *obj)
 {
   if (!obj || obj->type != DB_TYPE_STRING)
     return obj;
 
   char *s = obj->value.string;
+  int64_t number;
   if (s)
   {
+    // Numeric strings were parsed when they were stored.
+    obj->value.uint_value = dbobj_string_as_int64(obj, &number) ? (db_uint_t)number : (db_uint_t)strtoul(s, NULL, 10);
     obj->type = DB_TYPE_UINT;
-    obj->value.uint_value = (db_uint_t)strtoul(s, NULL, 10),
-    free(s);
+    // Embedded bytes go with the object.
+    if (obj->encoding == DB_ENCODING_RAW)
+      free(s);
   }
 
   return obj;
@@ -228,11 +661,32 @@ DBObj *arg_string_to_int(DBObj *obj)
     return obj;
 
   char *s = obj->value.string;
+  int64_t number;
   if (s)
   {
+    // Numeric strings were parsed when they were stored.
+    obj->value.int_value = dbobj_string_as_int64(obj, &number) ? (db_int_t)number : (db_int_t)strtol(s, NULL, 10);
     obj->type = DB_TYPE_INT;
-    obj->value.int_value = (db_int_t)strtol(s, NULL, 10),
-    free(s);
+    // Embedded bytes go with the object.
+    if (obj->encoding == DB_ENCODING_RAW)
+      free(s);
+  }
+
+  return obj;
+}
+
+DBObj *arg_string_to_double(DBObj *obj)
+{
+  if (!obj || obj->type != DB_TYPE_STRING)
+    return obj;
+
+  char *s = obj->value.string;
+  if (s)
+  {
+    obj->type = DB_TYPE_DOUBLE;
+    obj->value.double_value = (db_double_t)strtod(s, NULL);
+    if (obj->encoding == DB_ENCODING_RAW)
+      free(s);
   }
 
   return obj;
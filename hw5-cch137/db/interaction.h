@@ -2,9 +2,22 @@
 #define DB_INTERACTION_H
 
 #define OK "OK"
+#define QUEUED "QUEUED"
 
 #include "types.h"
 
+// Returns the upper-case command name of an action, NULL for DB_UNKNOWN_COMMAND
+const char *db_action_name(db_action_t action);
+
+// Looks up a command name in any case; returns DB_UNKNOWN_COMMAND if there is none
+db_action_t db_action_from_name(const char *name);
+
+// Same as db_action_from_name for the `length` bytes at `name`, which need no NUL
+db_action_t db_action_from_slice(const char *name, size_t length);
+
+// Whether the command takes `argc` arguments; requests that don't are answered without being queued
+db_bool_t db_action_accepts(db_action_t action, db_uint_t argc);
+
 DBRequest *create_request(db_action_t action);
 
 DBReply *create_reply();
@@ -17,6 +30,20 @@ void free_request(DBRequest *request);
 
 void free_reply(DBReply *reply);
 
+// Arena the command answering the reply allocates its reply from, created on first use and freed
+// with the reply, see arena.h
+DBArena *reply_arena(DBReply *reply);
+
+DBPipeline *create_pipeline();
+
+// Appends a request to the pipeline, which takes ownership of it
+void add_pipeline_request(DBPipeline *pipeline, DBRequest *request);
+
+// Frees the requests and replies so the pipeline can be filled again
+DBPipeline *reset_pipeline(DBPipeline *pipeline);
+
+void free_pipeline(DBPipeline *pipeline);
+
 DBObj *print_dbobj(DBObj *obj);
 
 DBReply *print_reply(DBReply *reply);
@@ -25,12 +52,49 @@ DBReply *reply_error(DBReply *reply, const char *message);
 
 DBReply *reply_data(DBReply *reply, DBObj *data);
 
+// Marks the reply as done and wakes up every thread waiting on it
+DBReply *reply_done(DBReply *reply);
+
+// Blocks the calling thread until the reply is marked as done
+DBReply *reply_wait(DBReply *reply);
+
+// Whether the reply is marked as done, without waiting
+db_bool_t reply_is_done(DBReply *reply);
+
+// Answers the reply with a list of `length` elements that is filled a chunk at a time, so a reader
+// can send out the first elements while the shard reads the next: reply_stream_push appends a
+// chunk, whose list it frees, and reply_done ends the list. A waiter of reply_wait still finds
+// the whole list in `data` once the reply is done
+void reply_stream_begin(DBReply *reply, db_uint_t length);
+void reply_stream_push(DBReply *reply, DBList *chunk);
+
+// Blocks until the reply is done or its stream began; returns whether it is streamed
+db_bool_t reply_wait_streamed(DBReply *reply);
+
+// Takes the elements of a streamed reply pushed since the last call, waiting for more if there are
+// none yet; returns NULL once the reply is done and every element was taken
+DBList *reply_stream_take(DBReply *reply);
+
+// Bytes of data the reply carries, see dbobj_payload_size; for a streamed reply, what its
+// elements not taken yet carry on average, times its length
+size_t reply_payload_size(DBReply *reply);
+
+// Makes reply_done write an 8-byte count to `fd`, an eventfd, or stop doing so when it is -1
+void reply_set_notify_fd(DBReply *reply, int fd);
+
 char *get_string_arg(DBListNode *curr_node);
 db_uint_t get_uint_arg(DBListNode *curr_node);
+uint64_t get_uint64_arg(DBListNode *curr_node);
 db_int_t get_int_arg(DBListNode *curr_node);
+db_double_t get_double_arg(DBListNode *curr_node);
+
+// Reads a score range bound: `(` makes it exclusive, and `-inf`/`+inf` are accepted; returns NAN if invalid
+db_double_t get_score_bound_arg(DBListNode *curr_node, db_bool_t *included);
 
 DBObj *arg_string_to_uint(DBObj *obj);
 
 DBObj *arg_string_to_int(DBObj *obj);
 
+DBObj *arg_string_to_double(DBObj *obj);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "list.h"
+#include "interaction.h"
+#include "latency.h"
+
+#define LATENCY_SUB_COUNT (1u << LATENCY_SUB_BITS)
+
+typedef struct SlowlogEntry
+{
+  uint64_t id;
+  time_t started_at;
+  uint64_t duration_us;
+  db_uint_t argc;
+  char **argv;
+} SlowlogEntry;
+
+// Entries sit in a ring of `slowlog_capacity`, the newest at `slowlog_head - 1`; guarded by
+// `slowlog_lock`, except the threshold, which every command reads
+static _Atomic db_int_t slowlog_threshold_us = SLOWLOG_DEFAULT_THRESHOLD_US;
+static db_uint_t slowlog_max_length = SLOWLOG_DEFAULT_MAX_LENGTH;
+static SlowlogEntry *slowlog_entries = NULL;
+static db_uint_t slowlog_capacity = 0;
+static db_uint_t slowlog_head = 0;
+static db_uint_t slowlog_length_ = 0;
+static uint64_t slowlog_next_id = 0;
+static mtx_t slowlog_lock;
+static once_flag slowlog_lock_once = ONCE_FLAG_INIT;
+
+uint64_t latency_now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static db_uint_t latency_bucket(uint64_t ns)
+{
+  if (ns < LATENCY_SUB_COUNT)
+    return (db_uint_t)ns;
+  if (ns >> LATENCY_MAX_BITS)
+    return LATENCY_BUCKETS - 1;
+  int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+  return (db_uint_t)(((shift + 1) << LATENCY_SUB_BITS) + ((ns >> shift) & (LATENCY_SUB_COUNT - 1)));
+}
+
+// Highest value that lands in `bucket`
+static uint64_t latency_bucket_max(db_uint_t bucket)
+{
+  if (bucket < LATENCY_SUB_COUNT)
+    return bucket;
+  int shift = (int)(bucket >> LATENCY_SUB_BITS) - 1;
+  return ((uint64_t)(LATENCY_SUB_COUNT + (bucket & (LATENCY_SUB_COUNT - 1))) << shift) + ((1ull << shift) - 1);
+}
+
+void latency_record(DBLatencyHistogram *histogram, uint64_t ns)
+{
+  ++histogram->buckets[latency_bucket(ns)];
+  ++histogram->count;
+  histogram->total_ns += ns;
+  if (ns > histogram->max_ns)
+    histogram->max_ns = ns;
+}
+
+void latency_merge(DBLatencyHistogram *into, const DBLatencyHistogram *from)
+{
+  for (db_uint_t i = 0; i < LATENCY_BUCKETS; ++i)
+    into->buckets[i] += from->buckets[i];
+  into->count += from->count;
+  into->total_ns += from->total_ns;
+  if (from->max_ns > into->max_ns)
+    into->max_ns = from->max_ns;
+}
+
+uint64_t latency_percentile(const DBLatencyHistogram *histogram, double percentile)
+{
+  if (!histogram->count)
+    return 0;
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+  uint64_t seen = 0;
+  if (rank < 1)
+    rank = 1;
+  for (db_uint_t i = 0; i < LATENCY_BUCKETS; ++i)
+  {
+    seen += histogram->buckets[i];
+    if (seen >= rank)
+    {
+      // The bucket bound can overshoot what was actually recorded.
+      uint64_t value = latency_bucket_max(i);
+      return value < histogram->max_ns ? value : histogram->max_ns;
+    }
+  }
+  return histogram->max_ns;
+}
+
+static void slowlog_lock_init()
+{
+  mtx_init(&slowlog_lock, mtx_plain);
+}
+
+static void slowlog_free_entry(SlowlogEntry *entry)
+{
+  for (db_uint_t i = 0; i < entry->argc; ++i)
+    free(entry->argv[i]);
+  free(entry->argv);
+  entry->argv = NULL;
+  entry->argc = 0;
+}
+
+// Drops every entry; the caller holds `slowlog_lock`
+static void slowlog_clear()
+{
+  for (db_uint_t i = 0; i < slowlog_capacity; ++i)
+    slowlog_free_entry(&slowlog_entries[i]);
+  slowlog_head = 0;
+  slowlog_length_ = 0;
+}
+
+void slowlog_config(db_int_t threshold_us, db_uint_t max_length)
+{
+  call_once(&slowlog_lock_once, slowlog_lock_init);
+  atomic_store(&slowlog_threshold_us, threshold_us);
+  mtx_lock(&slowlog_lock);
+  if (max_length != slowlog_max_length)
+  {
+    slowlog_clear();
+    free(slowlog_entries);
+    slowlog_entries = NULL;
+    slowlog_capacity = 0;
+    slowlog_max_length = max_length;
+  }
+  mtx_unlock(&slowlog_lock);
+}
+
+// Copies an argument as text, cut at SLOWLOG_MAX_ARG_LENGTH bytes; handlers may have parsed it
+// into a number in place
+static char *slowlog_format_arg(DBObj *arg)
+{
+  char buffer[SLOWLOG_MAX_ARG_LENGTH + 32];
+  const char *text = buffer;
+  size_t length;
+
+  if (!arg)
+    text = "";
+  else if (dbobj_is_string(arg))
+    text = arg->value.string;
+  else if (dbobj_is_int(arg))
+    snprintf(buffer, sizeof(buffer), "%lld", (long long)arg->value.int_value);
+  else if (dbobj_is_uint(arg))
+    snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)arg->value.uint_value);
+  else if (dbobj_is_double(arg))
+    snprintf(buffer, sizeof(buffer), "%.17g", (double)arg->value.double_value);
+  else
+    text = "";
+
+  length = strlen(text);
+  if (length <= SLOWLOG_MAX_ARG_LENGTH)
+    return dbutil_strdup(text);
+  // Room for the suffix with the 20 digits of the largest size_t
+  size_t size = SLOWLOG_MAX_ARG_LENGTH + sizeof("... ( more bytes)") + 20;
+  char *cut = (char *)malloc(size);
+  if (!cut)
+    EXIT_ON_MEMORY_ERROR();
+  snprintf(cut, size, "%.*s... (%zu more bytes)", SLOWLOG_MAX_ARG_LENGTH, text, length - SLOWLOG_MAX_ARG_LENGTH);
+  return cut;
+}
+
+void slowlog_record(DBRequest *request, uint64_t duration_ns)
+{
+  db_int_t threshold_us = atomic_load_explicit(&slowlog_threshold_us, memory_order_relaxed);
+  if (threshold_us < 0 || duration_ns < (uint64_t)threshold_us * 1000)
+    return;
+
+  // Arguments are copied before the lock is taken, the request is still the caller's.
+  db_uint_t args_length = request->args ? request->args->length : 0;
+  db_uint_t argc = 1 + (args_length < SLOWLOG_MAX_ARGC - 1 ? args_length : SLOWLOG_MAX_ARGC - 1);
+  char **argv = (char **)malloc(argc * sizeof(char *));
+  if (!argv)
+    EXIT_ON_MEMORY_ERROR();
+  argv[0] = dbutil_strdup(db_action_name(request->action));
+  DBListNode *node = request->args ? request->args->head : NULL;
+  for (db_uint_t i = 1; i < argc; ++i, node = node->next)
+    argv[i] = slowlog_format_arg(node->data);
+  if (argc == SLOWLOG_MAX_ARGC && args_length > SLOWLOG_MAX_ARGC - 1)
+  {
+    // The last slot tells how many arguments were left out, as Redis does.
+    char more[64];
+    free(argv[argc - 1]);
+    snprintf(more, sizeof(more), "... (%llu more arguments)", (unsigned long long)(args_length - (SLOWLOG_MAX_ARGC - 2)));
+    argv[argc - 1] = dbutil_strdup(more);
+  }
+
+  call_once(&slowlog_lock_once, slowlog_lock_init);
+  mtx_lock(&slowlog_lock);
+  if (!slowlog_max_length)
+  {
+    mtx_unlock(&slowlog_lock);
+    for (db_uint_t i = 0; i < argc; ++i)
+      free(argv[i]);
+    free(argv);
+    return;
+  }
+  if (!slowlog_entries)
+  {
+    slowlog_entries = (SlowlogEntry *)calloc(slowlog_max_length, sizeof(SlowlogEntry));
+    if (!slowlog_entries)
+      EXIT_ON_MEMORY_ERROR();
+    slowlog_capacity = slowlog_max_length;
+  }
+  SlowlogEntry *entry = &slowlog_entries[slowlog_head];
+  slowlog_free_entry(entry);
+  entry->id = slowlog_next_id++;
+  entry->started_at = time(NULL) - (time_t)(duration_ns / 1000000000ull);
+  entry->duration_us = duration_ns / 1000;
+  entry->argc = argc;
+  entry->argv = argv;
+  slowlog_head = (slowlog_head + 1) % slowlog_capacity;
+  if (slowlog_length_ < slowlog_capacity)
+    ++slowlog_length_;
+  mtx_unlock(&slowlog_lock);
+}
+
+DBList *slowlog_get(db_uint_t count)
+{
+  DBList *entries = create_dblist();
+
+  call_once(&slowlog_lock_once, slowlog_lock_init);
+  mtx_lock(&slowlog_lock);
+  if (count > slowlog_length_)
+    count = slowlog_length_;
+  for (db_uint_t i = 0; i < count; ++i)
+  {
+    SlowlogEntry *entry = &slowlog_entries[(slowlog_head + slowlog_capacity - 1 - i) % slowlog_capacity];
+    DBList *fields = create_dblist();
+    DBList *args = create_dblist();
+    for (db_uint_t j = 0; j < entry->argc; ++j)
+      rpush(args, create_dblistnode(dbobj_create_string_with_dup(entry->argv[j])));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)entry->id)));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)entry->started_at)));
+    rpush(fields, create_dblistnode(dbobj_create_uint((db_uint_t)entry->duration_us)));
+    rpush(fields, create_dblistnode(dbobj_create_list(args)));
+    rpush(entries, create_dblistnode(dbobj_create_list(fields)));
+  }
+  mtx_unlock(&slowlog_lock);
+
+  return entries;
+}
+
+db_uint_t slowlog_length()
+{
+  call_once(&slowlog_lock_once, slowlog_lock_init);
+  mtx_lock(&slowlog_lock);
+  db_uint_t length = slowlog_length_;
+  mtx_unlock(&slowlog_lock);
+  return length;
+}
+
+void slowlog_reset()
+{
+  call_once(&slowlog_lock_once, slowlog_lock_init);
+  mtx_lock(&slowlog_lock);
+  slowlog_clear();
+  mtx_unlock(&slowlog_lock);
+}
@@ -0,0 +1,67 @@
+#ifndef DB_LATENCY_H
+#define DB_LATENCY_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Latency histograms in the style of HdrHistogram: values below 2^LATENCY_SUB_BITS nanoseconds
+// get a bucket each, and every power of two above is split into 2^LATENCY_SUB_BITS buckets, so a
+// recorded value is off by at most 1/2^LATENCY_SUB_BITS of itself
+#define LATENCY_SUB_BITS 4
+// Values from 2^LATENCY_MAX_BITS nanoseconds, about 18 minutes, land in the last bucket
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+// Defaults of the slow log, the same as Redis: commands that run for 10ms or more, and the last
+// 128 of them
+#define SLOWLOG_DEFAULT_THRESHOLD_US 10000
+#define SLOWLOG_DEFAULT_MAX_LENGTH 128
+// Arguments kept of a logged command, and bytes kept of each
+#define SLOWLOG_MAX_ARGC 32
+#define SLOWLOG_MAX_ARG_LENGTH 128
+
+typedef struct DBLatencyHistogram
+{
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LATENCY_BUCKETS];
+} DBLatencyHistogram;
+
+// What one shard has seen of one command: the time its requests waited in the queue and the
+// time they ran
+typedef struct DBCommandStats
+{
+  DBLatencyHistogram queue;
+  DBLatencyHistogram exec;
+} DBCommandStats;
+
+// Wall-clock time that never goes backwards, in nanoseconds
+uint64_t latency_now_ns();
+
+void latency_record(DBLatencyHistogram *histogram, uint64_t ns);
+
+// Adds the counts of `from` to `into`
+void latency_merge(DBLatencyHistogram *into, const DBLatencyHistogram *from);
+
+// Highest value, in nanoseconds, that `percentile` (0 to 100) percent of the recorded values
+// are at or below, up to the bucket width; 0 when nothing was recorded
+uint64_t latency_percentile(const DBLatencyHistogram *histogram, double percentile);
+
+// Logs commands that run for `threshold_us` microseconds or more, keeping the last `max_length`
+// of them; a negative threshold turns the log off and 0 logs every command
+void slowlog_config(db_int_t threshold_us, db_uint_t max_length);
+
+// Logs `request` if `duration_ns` is over the threshold; safe to call from any thread
+void slowlog_record(DBRequest *request, uint64_t duration_ns);
+
+// The newest `count` entries, newest first, each a list of its id, start time in Unix seconds,
+// duration in microseconds and arguments with the command name first
+DBList *slowlog_get(db_uint_t count);
+
+db_uint_t slowlog_length();
+
+void slowlog_reset();
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "hash.h"
+#include "quicklist.h"
+#include "rope.h"
+#include "zset.h"
+#include "epoch.h"
+#include "lazyfree.h"
+
+typedef struct LazyfreeJob
+{
+  DBObj *obj;
+  DBHash *ht;
+  struct LazyfreeJob *next;
+} LazyfreeJob;
+
+// Jobs in the order they were queued, guarded by `lazyfree_lock`; the thread starts with the first
+static LazyfreeJob *jobs_head = NULL;
+static LazyfreeJob *jobs_tail = NULL;
+static mtx_t lazyfree_lock;
+static cnd_t jobs_cond;
+static cnd_t drained_cond;
+static once_flag lazyfree_once = ONCE_FLAG_INIT;
+static _Atomic db_uint_t pending = 0;
+static _Atomic db_uint_t freed = 0;
+
+// Allocations freeing a value walks through
+static db_uint_t lazyfree_effort(DBObj *obj)
+{
+  switch (obj->type)
+  {
+  case DB_TYPE_STRING:
+    return obj->encoding == DB_ENCODING_ROPE ? obj->value.rope->length : 1;
+  case DB_TYPE_LIST:
+    if (obj->encoding == DB_ENCODING_QUICKLIST)
+      return obj->value.quicklist ? obj->value.quicklist->block_count : 0;
+    return obj->value.list ? obj->value.list->length : 0;
+  case DB_TYPE_ZSET:
+    return obj->value.zset && obj->value.zset->encoding != DB_ENCODING_ZSET_PACKED ? zcard(obj->value.zset) : 1;
+  case DB_TYPE_HASH:
+    if (obj->encoding == DB_ENCODING_HASH_PACKED)
+      return 1;
+    return obj->value.hash ? obj->value.hash->count0 + obj->value.hash->count1 : 0;
+  default:
+    return 1;
+  }
+}
+
+static int lazyfree_worker(void *arg)
+{
+  (void)arg;
+  LazyfreeJob *job;
+
+  for (;;)
+  {
+    mtx_lock(&lazyfree_lock);
+    while (!jobs_head)
+      cnd_wait(&jobs_cond, &lazyfree_lock);
+    job = jobs_head;
+    jobs_head = job->next;
+    if (!jobs_head)
+      jobs_tail = NULL;
+    mtx_unlock(&lazyfree_lock);
+
+    if (job->obj)
+      free_dbobj(job->obj);
+    // A keyspace detached from under concurrent readers is theirs until they are done with it.
+    // Yielding between chunks keeps a huge keyspace from hogging a core the workers need.
+    else
+    {
+      epoch_synchronize();
+      while (ht_free_some(job->ht, LAZYFREE_CHUNK_BUCKETS))
+        thrd_yield();
+    }
+    free(job);
+
+    mtx_lock(&lazyfree_lock);
+    atomic_fetch_add(&freed, 1);
+    if (atomic_fetch_sub(&pending, 1) == 1)
+      cnd_broadcast(&drained_cond);
+    mtx_unlock(&lazyfree_lock);
+  }
+  return 0;
+}
+
+static void lazyfree_init()
+{
+  thrd_t thread;
+  mtx_init(&lazyfree_lock, mtx_plain);
+  cnd_init(&jobs_cond);
+  cnd_init(&drained_cond);
+  if (thrd_create(&thread, lazyfree_worker, NULL) != thrd_success)
+    EXIT_ON_ERROR("Failed to start the lazy free thread");
+  thrd_detach(thread);
+}
+
+static void lazyfree_queue(DBObj *obj, DBHash *ht)
+{
+  LazyfreeJob *job = (LazyfreeJob *)malloc(sizeof(LazyfreeJob));
+  if (!job)
+    EXIT_ON_MEMORY_ERROR();
+  job->obj = obj;
+  job->ht = ht;
+  job->next = NULL;
+
+  call_once(&lazyfree_once, lazyfree_init);
+  mtx_lock(&lazyfree_lock);
+  if (jobs_tail)
+    jobs_tail->next = job;
+  else
+    jobs_head = job;
+  jobs_tail = job;
+  atomic_fetch_add(&pending, 1);
+  cnd_signal(&jobs_cond);
+  mtx_unlock(&lazyfree_lock);
+}
+
+void lazyfree_obj(DBObj *obj)
+{
+  if (!obj)
+    return;
+  // A value someone else still holds only loses a reference.
+  if (dbobj_is_shared(obj) || lazyfree_effort(obj) < LAZYFREE_MIN_EFFORT)
+    free_dbobj(obj);
+  else
+    lazyfree_queue(obj, NULL);
+}
+
+void lazyfree_hash(DBHash *ht)
+{
+  if (ht)
+    lazyfree_queue(NULL, ht);
+}
+
+db_uint_t lazyfree_pending()
+{
+  return atomic_load(&pending);
+}
+
+db_uint_t lazyfree_freed()
+{
+  return atomic_load(&freed);
+}
+
+void lazyfree_drain()
+{
+  if (!atomic_load(&pending))
+    return;
+  mtx_lock(&lazyfree_lock);
+  while (atomic_load(&pending))
+    cnd_wait(&drained_cond, &lazyfree_lock);
+  mtx_unlock(&lazyfree_lock);
+}
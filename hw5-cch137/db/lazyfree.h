@@ -0,0 +1,30 @@
+#ifndef DB_LAZYFREE_H
+#define DB_LAZYFREE_H
+
+#include "types.h"
+
+// Frees deleted values and flushed keyspaces on a background thread, so UNLINK and FLUSHALL ASYNC
+// cost a shard worker no more than unhooking them. Values too small to be worth the handoff are
+// freed on the spot; the thread frees detached tables a chunk of buckets at a time.
+
+// Values made of fewer allocations than this are freed by the caller, as Redis does
+#define LAZYFREE_MIN_EFFORT 64
+// Buckets of a detached table freed between two looks at the queue
+#define LAZYFREE_CHUNK_BUCKETS 1024
+
+// Frees a value nobody else refers to, now if it is small and on the background thread otherwise
+void lazyfree_obj(DBObj *obj);
+
+// Hands a table detached with ht_detach, its entries and their values, to the background thread
+void lazyfree_hash(DBHash *ht);
+
+// Values and tables queued and not freed yet
+db_uint_t lazyfree_pending();
+
+// Values and tables the background thread has freed
+db_uint_t lazyfree_freed();
+
+// Waits until the background thread has freed everything queued so far
+void lazyfree_drain();
+
+#endif
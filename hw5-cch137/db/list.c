@@ -1,12 +1,17 @@
 #include "utils.h"
 #include "obj.h"
 #include "list.h"
+#include "slab.h"
+#include "arena.h"
+
+static size_t dblistnode_memory_usage(const DBListNode *node)
+{
+  return slab_size(sizeof(DBListNode)) + dbobj_shallow_memory_usage(node->data);
+}
 
 DBListNode *create_dblistnode(DBObj *data)
 {
-  DBListNode *node = malloc(sizeof(DBListNode));
-  if (!node)
-    EXIT_ON_MEMORY_ERROR();
+  DBListNode *node = (DBListNode *)slab_alloc(sizeof(DBListNode));
   node->data = data;
   node->prev = NULL;
   node->next = NULL;
@@ -15,7 +20,7 @@ DBListNode *create_dblistnode(DBObj *data)
 
 DBListNode *create_dblistnode_with_string(char *data)
 {
-  return create_dblistnode(dbobj_create_string(dbutil_strdup(data)));
+  return create_dblistnode(dbobj_create_string_with_dup(data));
 }
 
 DBList *create_dblist()
@@ -26,6 +31,30 @@ DBList *create_dblist()
   list->head = NULL;
   list->tail = NULL;
   list->length = 0;
+  list->memory = dbutil_alloc_size(list);
+  return list;
+}
+
+DBListNode *create_dblistnode_in(DBArena *arena, DBObj *data)
+{
+  if (!arena)
+    return create_dblistnode(data);
+  DBListNode *node = (DBListNode *)arena_alloc(arena, sizeof(DBListNode));
+  node->data = data;
+  node->prev = NULL;
+  node->next = NULL;
+  return node;
+}
+
+DBList *create_dblist_in(DBArena *arena)
+{
+  if (!arena)
+    return create_dblist();
+  DBList *list = (DBList *)arena_alloc(arena, sizeof(DBList));
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->memory = 0;
   return list;
 }
 
@@ -36,7 +65,7 @@ void free_dblistnode(DBListNode *node)
   break_dblistnodes(node, node->next);
   break_dblistnodes(node->prev, node);
   free_dbobj(node->data);
-  free(node);
+  slab_free(node, sizeof(DBListNode));
 }
 
 char *extract_dblistnode_string(DBListNode *node)
@@ -67,6 +96,7 @@ void clear_dblist(DBList *list)
 
   list->tail = NULL;
   list->length = 0;
+  list->memory = dbutil_alloc_size(list);
 }
 
 void free_dblist(DBList *list)
@@ -103,6 +133,7 @@ db_uint_t lpush(DBList *list, DBListNode *node)
     join_dblistnodes(node, list->head);
     list->head = node;
     list->length++;
+    list->memory += dblistnode_memory_usage(node);
     node = node->prev;
   }
 
@@ -129,6 +160,7 @@ DBListNode *lpop(DBList *list)
   list->head = removed_node->next;
   break_dblistnodes(removed_node, list->head);
   --list->length;
+  list->memory -= dblistnode_memory_usage(removed_node);
 
   if (!list->head)
   {
@@ -172,6 +204,7 @@ db_uint_t rpush(DBList *list, DBListNode *node)
     join_dblistnodes(list->tail, node);
     list->tail = node;
     list->length++;
+    list->memory += dblistnode_memory_usage(node);
     node = node->next;
   }
 
@@ -193,6 +226,7 @@ DBListNode *rpop(DBList *list)
   list->tail = removed_node->prev;
   break_dblistnodes(list->tail, removed_node);
   --list->length;
+  list->memory -= dblistnode_memory_usage(removed_node);
 
   if (!list->tail)
   {
@@ -264,6 +298,7 @@ DBList *lrange(const DBList const *list, db_uint_t start, db_uint_t stop)
     while (index >= start && curr_node)
     {
       new_node = create_dblistnode_with_string(curr_node->data->value.string);
+      reply_list->memory += dblistnode_memory_usage(new_node);
       join_dblistnodes(new_node, last_new_node);
       last_new_node = new_node;
       if (!reply_list->tail)
@@ -285,6 +320,7 @@ DBList *lrange(const DBList const *list, db_uint_t start, db_uint_t stop)
     while (index <= stop && curr_node)
     {
       new_node = create_dblistnode_with_string(curr_node->data->value.string);
+      reply_list->memory += dblistnode_memory_usage(new_node);
       join_dblistnodes(last_new_node, new_node);
       last_new_node = new_node;
       if (!reply_list->head)
@@ -15,6 +15,11 @@ DBListNode *create_dblistnode_with_string(char *data);
 // Initializes a new, empty doubly linked list
 DBList *create_dblist();
 
+// Variants allocated from a reply arena, see arena.h, or the functions above when `arena` is NULL.
+// Nodes of an arena go with it, so they are never freed on their own, and neither is the list
+DBListNode *create_dblistnode_in(DBArena *arena, DBObj *data);
+DBList *create_dblist_in(DBArena *arena);
+
 // Frees a list node
 void free_dblistnode(DBListNode *node);
 
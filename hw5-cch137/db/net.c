@@ -0,0 +1,1114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "list.h"
+#include "rope.h"
+#include "interaction.h"
+#include "core.h"
+#include "uring.h"
+#include "repl.h"
+#include "transaction.h"
+#include "net.h"
+
+static _Atomic db_bool_t is_stopping = false;
+// Threads serving connections next to the loop thread, see net_config_io_threads
+static db_uint_t io_thread_count = 0;
+// Eventfd of the running loop, written by the shards as they answer blocked clients
+static int notify_fd = -1;
+
+static void net_set_nonblocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static NetConn *net_conn_create(int fd)
+{
+  NetConn *conn = (NetConn *)calloc(1, sizeof(NetConn));
+  if (!conn)
+    EXIT_ON_MEMORY_ERROR();
+  conn->fd = fd;
+  conn->pipeline = create_pipeline();
+  return conn;
+}
+
+static void net_conn_free(NetConn *conn)
+{
+  close(conn->fd);
+  free_pipeline(conn->pipeline);
+  free(conn->in);
+  free(conn->out);
+  free(conn->segments);
+  free(conn);
+}
+
+static void net_conn_watch(int epoll_fd, NetConn *conn, db_bool_t is_writing)
+{
+  struct epoll_event event = {.events = is_writing ? EPOLLOUT : EPOLLIN, .data.ptr = conn};
+  if (conn->is_writing == is_writing)
+    return;
+  conn->is_writing = is_writing;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+static NetSegment *net_push_segment(NetConn *conn)
+{
+  if (conn->segments_length == conn->segments_capacity)
+  {
+    conn->segments_capacity = conn->segments_capacity ? conn->segments_capacity * 2 : 16;
+    conn->segments = (NetSegment *)realloc(conn->segments, conn->segments_capacity * sizeof(NetSegment));
+    if (!conn->segments)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  return &conn->segments[conn->segments_length++];
+}
+
+// Copies bytes into the output buffer, growing the last segment when it ends there
+static void net_append(NetConn *conn, const char *bytes, size_t length)
+{
+  if (conn->out_length + length > conn->out_capacity)
+  {
+    size_t capacity = conn->out_capacity ? conn->out_capacity : 4096;
+    while (capacity < conn->out_length + length)
+      capacity *= 2;
+    conn->out = (char *)realloc(conn->out, capacity);
+    if (!conn->out)
+      EXIT_ON_MEMORY_ERROR();
+    conn->out_capacity = capacity;
+  }
+
+  NetSegment *last = conn->segments_length ? &conn->segments[conn->segments_length - 1] : NULL;
+  if (last && !last->base && last->offset + last->length == conn->out_length)
+    last->length += length;
+  else
+    *net_push_segment(conn) = (NetSegment){.base = NULL, .offset = conn->out_length, .length = length};
+
+  memcpy(conn->out + conn->out_length, bytes, length);
+  conn->out_length += length;
+}
+
+// Writes bytes from where they are; they must outlive the pipeline they belong to
+static void net_append_reference(NetConn *conn, const char *bytes, size_t length)
+{
+  *net_push_segment(conn) = (NetSegment){.base = bytes, .offset = 0, .length = length};
+}
+
+static void net_append_bulk(NetConn *conn, const char *string, size_t length)
+{
+  char header[32];
+  net_append(conn, header, sprintf(header, "$%zu\r\n", length));
+  if (length >= NET_ZERO_COPY_MIN)
+    net_append_reference(conn, string, length);
+  else
+    net_append(conn, string, length);
+  net_append(conn, "\r\n", 2);
+}
+
+// Writes the chunks from the rope, whose reply holds it, so none of them is copied or joined
+static void net_append_rope(NetConn *conn, const DBRope *rope)
+{
+  char header[32];
+  net_append(conn, header, sprintf(header, "$%zu\r\n", rope->size));
+  for (db_uint_t i = 0; i < rope->length; ++i)
+    if (rope->chunks[i]->length >= NET_ZERO_COPY_MIN)
+      net_append_reference(conn, rope->chunks[i]->data, rope->chunks[i]->length);
+    else
+      net_append(conn, rope->chunks[i]->data, rope->chunks[i]->length);
+  net_append(conn, "\r\n", 2);
+}
+
+// Commands that reply with a status rather than a bulk string when they succeed
+static db_bool_t net_reply_is_status(DBRequest *request)
+{
+  switch (request->action)
+  {
+  case DB_SET:
+  case DB_MSET:
+  case DB_RENAME:
+  case DB_LSET:
+  case DB_MULTI:
+  case DB_DISCARD:
+  case DB_WATCH:
+  case DB_UNWATCH:
+  case DB_SAVE:
+  case DB_BGSAVE:
+  case DB_BGREWRITEAOF:
+  case DB_FLUSHALL:
+  case DB_SLOWLOG_RESET:
+  case DB_HOTKEYS_RESET:
+  case DB_TRACE_START:
+  case DB_TRACE_STOP:
+  case DB_SHUTDOWN:
+    return true;
+  case DB_PING:
+    return !request->args || !request->args->length;
+  default:
+    return false;
+  }
+}
+
+static void net_encode(NetConn *conn, DBObj *obj, db_bool_t is_status)
+{
+  char header[48];
+  const char *string;
+
+  switch (obj ? obj->type : DB_TYPE_NULL)
+  {
+  case DB_TYPE_NULL:
+    net_append(conn, "$-1\r\n", 5);
+    break;
+  case DB_TYPE_ERROR:
+    string = obj->value.message ? obj->value.message : "ERR";
+    net_append(conn, "-", 1);
+    net_append(conn, string, strlen(string));
+    net_append(conn, "\r\n", 2);
+    break;
+  case DB_TYPE_BOOL:
+    net_append(conn, obj->value.bool_value ? ":1\r\n" : ":0\r\n", 4);
+    break;
+  case DB_TYPE_INT:
+    net_append(conn, header, sprintf(header, ":%d\r\n", obj->value.int_value));
+    break;
+  case DB_TYPE_UINT:
+    net_append(conn, header, sprintf(header, ":%u\r\n", obj->value.uint_value));
+    break;
+  case DB_TYPE_DOUBLE:
+    // Scores go out as bulk strings, the way Redis sends them
+    net_append_bulk(conn, header, sprintf(header, "%.17g", obj->value.double_value));
+    break;
+  case DB_TYPE_STRING:
+    if (obj->encoding == DB_ENCODING_ROPE)
+    {
+      net_append_rope(conn, obj->value.rope);
+      break;
+    }
+    string = obj->value.string ? obj->value.string : "";
+    if (is_status)
+    {
+      net_append(conn, "+", 1);
+      net_append(conn, string, strlen(string));
+      net_append(conn, "\r\n", 2);
+    }
+    else
+      net_append_bulk(conn, string, strlen(string));
+    break;
+  case DB_TYPE_LIST:
+    if (obj->encoding == DB_ENCODING_QUICKLIST || !obj->value.list)
+    {
+      net_append(conn, "*0\r\n", 4);
+      break;
+    }
+    net_append(conn, header, sprintf(header, "*%u\r\n", obj->value.list->length));
+    for (DBListNode *node = obj->value.list->head; node; node = node->next)
+      net_encode(conn, node->data, false);
+    break;
+  default:
+    string = "-ERR reply type not supported\r\n";
+    net_append(conn, string, strlen(string));
+    break;
+  }
+}
+
+// Encodes the reply to a request; each reply EXEC gathered goes out as its own command's would
+static void net_encode_reply(NetConn *conn, DBRequest *request, DBObj *data)
+{
+  char header[16];
+  DBTransaction *transaction = request->transaction;
+
+  if (request->action != DB_EXEC || !transaction || !dbobj_is_list(data) || data->encoding == DB_ENCODING_QUICKLIST ||
+      data->value.list->length != transaction->length)
+  {
+    net_encode(conn, data, net_reply_is_status(request));
+    return;
+  }
+  net_append(conn, header, sprintf(header, "*%u\r\n", data->value.list->length));
+  db_uint_t i = 0;
+  for (DBListNode *node = data->value.list->head; node; node = node->next, ++i)
+    net_encode_reply(conn, transaction->requests[i], node->data);
+}
+
+// Reads a decimal length between `start` and `end`; returns -1 if it is not one
+static long long net_parse_length(const char *start, const char *end)
+{
+  long long value = 0;
+  db_bool_t is_negative = start < end && *start == '-';
+  if (is_negative)
+    ++start;
+  if (start == end || end - start > 18)
+    return -1;
+  for (; start < end; ++start)
+  {
+    if (*start < '0' || *start > '9')
+      return -1;
+    value = value * 10 + (*start - '0');
+  }
+  // "*-1" is a null multibulk, read as an empty one
+  return is_negative ? 0 : value;
+}
+
+// Builds a request from the arguments of a command, the first being its name; QUIT is answered
+// by the connection itself and yields NULL
+static DBRequest *net_create_request(NetConn *conn, const char **argv, const size_t *lengths, db_uint_t argc)
+{
+  if (lengths[0] == 4 && strncasecmp(argv[0], "QUIT", 4) == 0)
+  {
+    conn->is_closing = true;
+    conn->farewell = "+OK\r\n";
+    return NULL;
+  }
+  DBRequest *request = create_request(db_action_from_slice(argv[0], lengths[0]));
+  for (db_uint_t i = 1; i < argc; ++i)
+    add_request_arg(request, dbobj_create_string_from_bytes(argv[i], lengths[i]));
+  return request;
+}
+
+// Parses the multibulk at `position`. Returns 1 and moves `position` past it when it is complete,
+// with `request` set unless it was empty or QUIT; 0 if more bytes are needed; -1 on a protocol error
+static int net_parse_multibulk(NetConn *conn, size_t *position, DBRequest **request)
+{
+  const char *p = conn->in + *position;
+  const char *end = conn->in + conn->in_length;
+  const char *line_end = memchr(p, '\r', end - p);
+  long long argc, length;
+
+  if (!line_end || line_end + 1 >= end)
+    return end - p > 32 ? -1 : 0;
+  argc = net_parse_length(p + 1, line_end);
+  if (argc < 0 || argc > NET_MAX_MULTIBULK_LENGTH || line_end[1] != '\n')
+    return -1;
+  p = line_end + 2;
+
+  const char **argv = (const char **)malloc((argc ? argc : 1) * sizeof(char *));
+  size_t *lengths = (size_t *)malloc((argc ? argc : 1) * sizeof(size_t));
+  if (!argv || !lengths)
+    EXIT_ON_MEMORY_ERROR();
+
+  int result = 1;
+  for (long long i = 0; i < argc && result == 1; ++i)
+  {
+    line_end = p < end ? memchr(p, '\r', end - p) : NULL;
+    if (!line_end || line_end + 1 >= end)
+    {
+      result = p < end && *p != '$' ? -1 : end - p > 32 ? -1 : 0;
+      break;
+    }
+    length = *p == '$' ? net_parse_length(p + 1, line_end) : -1;
+    if (length < 0 || length > NET_MAX_BULK_LENGTH || line_end[1] != '\n')
+    {
+      result = -1;
+      break;
+    }
+    p = line_end + 2;
+    if ((size_t)(end - p) < (size_t)length + 2)
+    {
+      result = 0;
+      break;
+    }
+    argv[i] = p;
+    lengths[i] = (size_t)length;
+    p += length + 2;
+  }
+
+  *request = NULL;
+  if (result == 1)
+  {
+    if (argc)
+      *request = net_create_request(conn, argv, lengths, (db_uint_t)argc);
+    *position = p - conn->in;
+  }
+  free(argv);
+  free(lengths);
+  return result;
+}
+
+// Same as net_parse_multibulk for a line of space separated arguments
+static int net_parse_inline(NetConn *conn, size_t *position, DBRequest **request)
+{
+  const char *p = conn->in + *position;
+  const char *end = conn->in + conn->in_length;
+  const char *line_end = memchr(p, '\n', end - p);
+  const char *argv[64];
+  size_t lengths[64];
+  db_uint_t argc = 0;
+
+  if (!line_end)
+    return end - p > NET_MAX_INLINE_LENGTH ? -1 : 0;
+  *position = line_end + 1 - conn->in;
+  if (line_end > p && line_end[-1] == '\r')
+    --line_end;
+
+  while (p < line_end && argc < sizeof(argv) / sizeof(argv[0]))
+  {
+    while (p < line_end && (*p == ' ' || *p == '\t'))
+      ++p;
+    if (p == line_end)
+      break;
+    argv[argc] = p;
+    while (p < line_end && *p != ' ' && *p != '\t')
+      ++p;
+    lengths[argc] = p - argv[argc];
+    ++argc;
+  }
+
+  *request = argc ? net_create_request(conn, argv, lengths, argc) : NULL;
+  return 1;
+}
+
+// Moves every complete command of the input buffer into the pipeline of the connection
+static void net_parse_input(NetConn *conn)
+{
+  size_t position = 0;
+  DBRequest *request;
+  int result = 1;
+
+  while (position < conn->in_length && !conn->is_closing && result == 1)
+  {
+    result = conn->in[position] == '*' ? net_parse_multibulk(conn, &position, &request) : net_parse_inline(conn, &position, &request);
+    if (result == 1 && request)
+      add_pipeline_request(conn->pipeline, request);
+  }
+
+  if (result < 0)
+  {
+    // Whatever was parsed before the error is still answered.
+    conn->is_closing = true;
+    conn->farewell = "-ERR Protocol error\r\n";
+    conn->in_length = 0;
+    return;
+  }
+
+  memmove(conn->in, conn->in + position, conn->in_length - position);
+  conn->in_length -= position;
+}
+
+// Makes room for at least NET_READ_CHUNK more bytes of input
+static void net_reserve(NetConn *conn)
+{
+  if (conn->in_capacity - conn->in_length >= NET_READ_CHUNK)
+    return;
+  conn->in_capacity = conn->in_capacity ? conn->in_capacity * 2 : 2 * NET_READ_CHUNK;
+  conn->in = (char *)realloc(conn->in, conn->in_capacity);
+  if (!conn->in)
+    EXIT_ON_MEMORY_ERROR();
+}
+
+// Reads what the socket has, up to NET_MAX_READ_PER_EVENT; returns false once the peer is gone
+static db_bool_t net_read(NetConn *conn)
+{
+  size_t total = 0;
+  ssize_t n;
+
+  while (total < NET_MAX_READ_PER_EVENT)
+  {
+    net_reserve(conn);
+    n = read(conn->fd, conn->in + conn->in_length, conn->in_capacity - conn->in_length);
+    if (n > 0)
+    {
+      conn->in_length += n;
+      total += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  return true;
+}
+
+// Reads every connection in the `next_ready` chain with one submission, one chunk each; the
+// sockets stay readable for the next epoll_wait if they hold more
+static void net_read_batch(DBUring *ring, NetConn *ready)
+{
+  unsigned queued = 0;
+  uint64_t user_data;
+  int32_t result;
+  NetConn *conn;
+
+  for (conn = ready; conn; conn = conn->next_ready)
+  {
+    net_reserve(conn);
+    if (uring_prep_recv(ring, conn->fd, conn->in + conn->in_length, conn->in_capacity - conn->in_length, (uintptr_t)conn))
+      ++queued;
+    else if (!net_read(conn))
+      conn->is_closing = true;
+  }
+  if (!queued || !uring_submit(ring, queued))
+    return;
+
+  while (queued-- && uring_complete(ring, true, &user_data, &result))
+  {
+    conn = (NetConn *)(uintptr_t)user_data;
+    if (result > 0)
+      conn->in_length += result;
+    else if (result != -EAGAIN && result != -EINTR)
+      conn->is_closing = true;
+  }
+}
+
+// Points `iov` at the replies not written yet; returns how many buffers it used
+static int net_flush_iov(NetConn *conn, struct iovec *iov)
+{
+  int iov_length = 0;
+  NetSegment *segment;
+
+  for (db_uint_t i = conn->segment_index; i < conn->segments_length && iov_length < NET_MAX_IOV; ++i)
+  {
+    segment = &conn->segments[i];
+    iov[iov_length].iov_base = (char *)(segment->base ? segment->base : conn->out + segment->offset);
+    iov[iov_length].iov_len = segment->length;
+    if (i == conn->segment_index)
+    {
+      iov[iov_length].iov_base = (char *)iov[iov_length].iov_base + conn->segment_offset;
+      iov[iov_length].iov_len -= conn->segment_offset;
+    }
+    ++iov_length;
+  }
+  return iov_length;
+}
+
+// Moves past `written` bytes of the replies
+static void net_flush_advance(NetConn *conn, size_t written)
+{
+  NetSegment *segment;
+
+  while (written && conn->segment_index < conn->segments_length)
+  {
+    segment = &conn->segments[conn->segment_index];
+    if (written < segment->length - conn->segment_offset)
+    {
+      conn->segment_offset += written;
+      break;
+    }
+    written -= segment->length - conn->segment_offset;
+    conn->segment_offset = 0;
+    ++conn->segment_index;
+  }
+}
+
+// Takes a failed write: the replies are dropped and the connection closes
+static void net_flush_fail(NetConn *conn)
+{
+  conn->is_closing = true;
+  conn->segment_index = conn->segments_length;
+}
+
+// Releases the replies once all of them are written; returns whether they were
+static db_bool_t net_flush_done(NetConn *conn)
+{
+  if (conn->segment_index < conn->segments_length)
+    return false;
+
+  // The replies the segments pointed into can go now.
+  reset_pipeline(conn->pipeline);
+  conn->segments_length = 0;
+  conn->segment_index = 0;
+  conn->segment_offset = 0;
+  conn->out_length = 0;
+  return true;
+}
+
+// Writes as much of the encoded replies as the socket takes; returns true once all of them are out
+static db_bool_t net_flush(NetConn *conn)
+{
+  struct iovec iov[NET_MAX_IOV];
+  ssize_t n;
+
+  while (conn->segment_index < conn->segments_length)
+  {
+    n = writev(conn->fd, iov, net_flush_iov(conn, iov));
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        net_flush_fail(conn);
+      break;
+    }
+    net_flush_advance(conn, (size_t)n);
+  }
+
+  return net_flush_done(conn);
+}
+
+// Writes what the socket takes of the replies encoded so far, all but their last byte, so the
+// replies are still released by the flush that follows once every one is encoded
+static void net_flush_some(NetConn *conn)
+{
+  struct iovec iov[NET_MAX_IOV];
+  ssize_t n;
+
+  for (;;)
+  {
+    int iov_length = net_flush_iov(conn, iov);
+    if (iov_length && conn->segment_index + iov_length == conn->segments_length && !--iov[iov_length - 1].iov_len)
+      --iov_length;
+    if (!iov_length)
+      return;
+    n = writev(conn->fd, iov, iov_length);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        net_flush_fail(conn);
+      return;
+    }
+    net_flush_advance(conn, (size_t)n);
+  }
+}
+
+// Writes the replies of every connection in the `next_ready` chain with one submission, one
+// writev each; `iovs` holds NET_MAX_IOV buffers per connection
+static void net_flush_batch(DBUring *ring, NetConn *ready, struct iovec (*iovs)[NET_MAX_IOV])
+{
+  unsigned queued = 0;
+  uint64_t user_data;
+  int32_t result;
+  NetConn *conn;
+
+  for (conn = ready; conn; conn = conn->next_ready)
+  {
+    if (!conn->segments_length)
+      continue;
+    if (uring_prep_writev(ring, conn->fd, iovs[queued], net_flush_iov(conn, iovs[queued]), (uintptr_t)conn))
+      ++queued;
+    else
+      net_flush(conn);
+  }
+  if (!queued || !uring_submit(ring, queued))
+    return;
+
+  while (queued-- && uring_complete(ring, true, &user_data, &result))
+  {
+    conn = (NetConn *)(uintptr_t)user_data;
+    if (result >= 0)
+      net_flush_advance(conn, (size_t)result);
+    else if (result != -EAGAIN && result != -EINTR)
+      net_flush_fail(conn);
+  }
+}
+
+static db_bool_t net_request_is_blocking(DBRequest *request)
+{
+  return request->action == DB_BLPOP || request->action == DB_BRPOP;
+}
+
+// Hands the connection of a replica whose PSYNC was answered over to a sender, which streams to
+// it from then on; returns whether it did, the connection then closes without writing anything.
+// A PSYNC pipelined with other commands is answered with an error instead
+static db_bool_t net_attach_replica(NetConn *conn)
+{
+  DBListNode *node;
+  const char *id, *offset, *snapshot_filepath;
+  int fd;
+
+  for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+  {
+    DBObj *data = conn->pipeline->replies[i]->data;
+    if (conn->pipeline->requests[i]->action != DB_PSYNC || !dbobj_is_list(data) || data->value.list->length < 3)
+      continue;
+    // The reply is the kind of sync, the replication id, the offset and the snapshot if any.
+    node = data->value.list->head->next;
+    id = node->data->value.string;
+    offset = node->next->data->value.string;
+    snapshot_filepath = node->next->next ? node->next->next->data->value.string : NULL;
+    fd = conn->pipeline->length == 1 && !conn->segments_length ? dup(conn->fd) : -1;
+    if (fd >= 0)
+    {
+      repl_attach_replica(fd, id, strtoull(offset, NULL, 10), snapshot_filepath);
+      conn->is_closing = true;
+      conn->is_submitted = false;
+      reset_pipeline(conn->pipeline);
+      return true;
+    }
+    if (snapshot_filepath)
+      remove(snapshot_filepath);
+    reply_error(conn->pipeline->replies[i], conn->pipeline->length == 1 ? DB_ERR_SYNC_FAILED : DB_ERR_PSYNC_NOT_ALONE);
+  }
+  return false;
+}
+
+// Encodes a streamed reply as its chunks come and writes each out while the shard reads the next;
+// the elements are copied, as every chunk is freed once encoded
+static void net_encode_stream(NetConn *conn, DBReply *reply)
+{
+  char header[32];
+  DBList *chunk;
+
+  net_append(conn, header, sprintf(header, "*%u\r\n", reply->stream_length));
+  while ((chunk = reply_stream_take(reply)))
+  {
+    for (DBListNode *node = chunk->head; node; node = node->next)
+      if (dbobj_is_string(node->data))
+      {
+        size_t length = strlen(node->data->value.string);
+        net_append(conn, header, sprintf(header, "$%zu\r\n", length));
+        net_append(conn, node->data->value.string, length);
+        net_append(conn, "\r\n", 2);
+      }
+      else
+        net_encode(conn, node->data, false);
+    free_dblist(chunk);
+    net_flush_some(conn);
+  }
+}
+
+// Waits for the pipeline of a connection and encodes its replies; if a blocking command of it is
+// not answered yet, marks the connection blocked instead. A streamed reply is only waited for
+// until it starts, see net_encode_stream
+static void net_finish(NetConn *conn)
+{
+  if (conn->is_submitted)
+  {
+    for (db_uint_t i = conn->pipeline->length; i-- > 0;)
+      if (!net_request_is_blocking(conn->pipeline->requests[i]))
+        reply_wait_streamed(conn->pipeline->replies[i]);
+    conn->is_blocked = false;
+    for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+      if (net_request_is_blocking(conn->pipeline->requests[i]) && !reply_is_done(conn->pipeline->replies[i]))
+      {
+        conn->is_blocked = true;
+        return;
+      }
+    if (net_attach_replica(conn))
+      return;
+    for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+      if (conn->pipeline->replies[i]->is_streamed)
+        net_encode_stream(conn, conn->pipeline->replies[i]);
+      else
+        net_encode_reply(conn, conn->pipeline->requests[i], conn->pipeline->replies[i]->data);
+    conn->is_submitted = false;
+  }
+  if (conn->farewell)
+  {
+    net_append(conn, conn->farewell, strlen(conn->farewell));
+    conn->farewell = NULL;
+  }
+}
+
+int net_connect(const char *host, db_uint_t port)
+{
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *addresses, *address;
+  char service[16];
+  int fd = -1, yes = 1;
+
+  snprintf(service, sizeof(service), "%u", (unsigned)port);
+  if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    return -1;
+  for (address = addresses; address && fd < 0; address = address->ai_next)
+  {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd >= 0)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  return fd;
+}
+
+static int net_listen(db_uint_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons((uint16_t)port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+
+  if (fd < 0)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  net_set_nonblocking(fd);
+  return fd;
+}
+
+static void net_accept(int epoll_fd, int listen_fd, NetConn **conns)
+{
+  int fd, yes = 1;
+  NetConn *conn;
+  struct epoll_event event = {.events = EPOLLIN};
+
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+  {
+    net_set_nonblocking(fd);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    conn = net_conn_create(fd);
+    event.data.ptr = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+      net_conn_free(conn);
+      continue;
+    }
+    conn->next = *conns;
+    if (*conns)
+      (*conns)->prev = conn;
+    *conns = conn;
+  }
+}
+
+// Stops watching a blocked connection for anything but the peer going away
+static void net_conn_block(int epoll_fd, NetConn *conn)
+{
+  struct epoll_event event = {.events = EPOLLRDHUP, .data.ptr = conn};
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+// Tells the shards a blocked client went away, so its blocking commands are answered without
+// taking anything; the connection is closed once they are
+static void net_conn_cancel(int epoll_fd, NetConn *conn)
+{
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  conn->is_cancelled = true;
+  for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+    if (net_request_is_blocking(conn->pipeline->requests[i]))
+      atomic_store(&conn->pipeline->replies[i]->is_cancelled, true);
+}
+
+static void net_close(int epoll_fd, NetConn *conn, NetConn **conns)
+{
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    *conns = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  net_conn_free(conn);
+}
+
+// Reads, parses and submits the commands of every connection in the `next_ready` chain, then
+// waits for them and starts writing the replies; `iovs` is scratch for net_flush_batch
+static void net_serve_ready(int epoll_fd, NetConn *ready, struct iovec (*iovs)[NET_MAX_IOV])
+{
+  // Reads and writes go out as one submission each when the thread has a ring.
+  DBUring *ring = iovs ? uring_thread() : NULL;
+  NetConn *conn;
+
+  if (!ready)
+    return;
+  if (ring)
+    net_read_batch(ring, ready);
+  for (conn = ready; conn; conn = conn->next_ready)
+  {
+    if (!ring && !net_read(conn))
+      conn->is_closing = true;
+    net_parse_input(conn);
+    if (conn->pipeline->length)
+    {
+      // ASKING only lets the command right after it through.
+      for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+      {
+        conn->pipeline->requests[i]->is_asking = conn->is_asking;
+        conn->is_asking = conn->pipeline->requests[i]->action == DB_ASKING;
+      }
+      db_handle_pipeline(conn->pipeline);
+      conn->is_submitted = true;
+      // Set before net_finish looks at them, so whatever answers them later wakes the loop.
+      for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+        if (net_request_is_blocking(conn->pipeline->requests[i]))
+          reply_set_notify_fd(conn->pipeline->replies[i], notify_fd);
+    }
+  }
+
+  // The shards serve the pipelines of every connection at once while the first is awaited.
+  for (conn = ready; conn; conn = conn->next_ready)
+    net_finish(conn);
+  if (ring)
+    net_flush_batch(ring, ready, iovs);
+
+  // No more commands are read from a client until it has taken its replies.
+  for (conn = ready; conn; conn = conn->next_ready)
+    if (conn->is_blocked)
+      net_conn_block(epoll_fd, conn);
+    else if (conn->segments_length)
+      net_conn_watch(epoll_fd, conn, !(ring ? net_flush_done(conn) : net_flush(conn)));
+}
+
+// Writes the replies of the blocked connections that have all their replies, and reads from them
+// again; run by the loop thread when the eventfd fires
+static void net_wake_blocked(int epoll_fd, NetConn **conns)
+{
+  struct epoll_event event = {.events = EPOLLIN};
+  NetConn *conn, *next;
+
+  for (conn = *conns; conn; conn = next)
+  {
+    next = conn->next;
+    if (!conn->is_blocked)
+      continue;
+    net_finish(conn);
+    if (conn->is_blocked)
+      continue;
+    if (conn->is_cancelled)
+    {
+      net_close(epoll_fd, conn, conns);
+      continue;
+    }
+    event.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    net_conn_watch(epoll_fd, conn, !net_flush(conn));
+    if (conn->is_closing && !conn->is_writing)
+      net_close(epoll_fd, conn, conns);
+  }
+}
+
+static struct iovec (*net_create_iovs())[NET_MAX_IOV]
+{
+  if (!uring_thread())
+    return NULL;
+  struct iovec(*iovs)[NET_MAX_IOV] = malloc(NET_MAX_EVENTS * sizeof(*iovs));
+  if (!iovs)
+    EXIT_ON_MEMORY_ERROR();
+  return iovs;
+}
+
+static int net_io_worker(void *arg)
+{
+  NetIOThread *io = (NetIOThread *)arg;
+  NetIOPool *pool = io->pool;
+  struct iovec(*iovs)[NET_MAX_IOV] = net_create_iovs();
+  db_uint_t generation = 0;
+
+  mtx_lock(&pool->lock);
+  for (;;)
+  {
+    while (pool->generation == generation && !pool->is_stopping)
+      cnd_wait(&pool->start_cond, &pool->lock);
+    if (pool->is_stopping)
+      break;
+    generation = pool->generation;
+    mtx_unlock(&pool->lock);
+
+    net_serve_ready(pool->epoll_fd, io->ready, iovs);
+
+    mtx_lock(&pool->lock);
+    if (--pool->pending == 0)
+      cnd_signal(&pool->done_cond);
+  }
+  mtx_unlock(&pool->lock);
+
+  free(iovs);
+  return 0;
+}
+
+static void net_pool_start(NetIOPool *pool, int epoll_fd)
+{
+  pool->epoll_fd = epoll_fd;
+  pool->length = io_thread_count;
+  pool->generation = 0;
+  pool->pending = 0;
+  pool->is_stopping = false;
+  pool->threads = NULL;
+  if (!pool->length)
+    return;
+
+  pool->threads = (NetIOThread *)calloc(pool->length, sizeof(NetIOThread));
+  if (!pool->threads)
+    EXIT_ON_MEMORY_ERROR();
+  mtx_init(&pool->lock, mtx_plain);
+  cnd_init(&pool->start_cond);
+  cnd_init(&pool->done_cond);
+  for (db_uint_t i = 0; i < pool->length; ++i)
+  {
+    pool->threads[i].pool = pool;
+    thrd_create(&pool->threads[i].thread, net_io_worker, &pool->threads[i]);
+  }
+}
+
+static void net_pool_stop(NetIOPool *pool)
+{
+  if (!pool->length)
+    return;
+
+  mtx_lock(&pool->lock);
+  pool->is_stopping = true;
+  cnd_broadcast(&pool->start_cond);
+  mtx_unlock(&pool->lock);
+  for (db_uint_t i = 0; i < pool->length; ++i)
+    thrd_join(pool->threads[i].thread, NULL);
+  cnd_destroy(&pool->done_cond);
+  cnd_destroy(&pool->start_cond);
+  mtx_destroy(&pool->lock);
+  free(pool->threads);
+}
+
+// Deals the connections out round-robin to the I/O threads and the calling thread, which serve
+// their share at the same time; returns once all of them are done
+static void net_pool_serve(NetIOPool *pool, NetConn *ready, struct iovec (*iovs)[NET_MAX_IOV])
+{
+  if (!pool->length || !ready || !ready->next_ready)
+  {
+    net_serve_ready(pool->epoll_fd, ready, iovs);
+    pool->ready = ready;
+    return;
+  }
+
+  NetConn *own = NULL, *conn, *next;
+  db_uint_t slot = 0;
+  for (db_uint_t i = 0; i < pool->length; ++i)
+    pool->threads[i].ready = NULL;
+  for (conn = ready; conn; conn = next, slot = (slot + 1) % (pool->length + 1))
+  {
+    next = conn->next_ready;
+    NetConn **list = slot == pool->length ? &own : &pool->threads[slot].ready;
+    conn->next_ready = *list;
+    *list = conn;
+  }
+
+  mtx_lock(&pool->lock);
+  pool->pending = pool->length;
+  ++pool->generation;
+  cnd_broadcast(&pool->start_cond);
+  mtx_unlock(&pool->lock);
+
+  net_serve_ready(pool->epoll_fd, own, iovs);
+
+  mtx_lock(&pool->lock);
+  while (pool->pending)
+    cnd_wait(&pool->done_cond, &pool->lock);
+  mtx_unlock(&pool->lock);
+
+  // Chain the shares back together for the caller.
+  for (db_uint_t i = 0; i < pool->length; ++i)
+    for (conn = pool->threads[i].ready; conn; conn = next)
+    {
+      next = conn->next_ready;
+      conn->next_ready = own;
+      own = conn;
+    }
+  pool->ready = own;
+}
+
+db_bool_t net_serve(db_uint_t port)
+{
+  int listen_fd = net_listen(port);
+  if (listen_fd < 0)
+  {
+    perror("Failed to listen for clients.");
+    return false;
+  }
+
+  int epoll_fd = epoll_create1(0);
+  struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+  struct epoll_event notify_event = {.events = EPOLLIN, .data.ptr = &notify_fd};
+  struct epoll_event events[NET_MAX_EVENTS];
+  NetConn *conns = NULL;
+  NetConn *ready, *conn;
+  NetIOPool pool;
+  struct iovec(*iovs)[NET_MAX_IOV] = net_create_iovs();
+  int n;
+  uint64_t notified;
+  db_bool_t is_notified;
+
+  notify_fd = eventfd(0, EFD_NONBLOCK);
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event);
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, notify_fd, &notify_event);
+  atomic_store(&is_stopping, false);
+  net_pool_start(&pool, epoll_fd);
+
+  while (!atomic_load(&is_stopping) && db_is_running())
+  {
+    n = epoll_wait(epoll_fd, events, NET_MAX_EVENTS, NET_POLL_TIMEOUT_MS);
+    ready = NULL;
+    is_notified = false;
+
+    for (int i = 0; i < n; ++i)
+    {
+      conn = (NetConn *)events[i].data.ptr;
+      if (!conn)
+      {
+        net_accept(epoll_fd, listen_fd, &conns);
+        continue;
+      }
+      if (events[i].data.ptr == &notify_fd)
+      {
+        is_notified = read(notify_fd, &notified, sizeof(notified)) == sizeof(notified);
+        continue;
+      }
+      if (conn->is_blocked)
+      {
+        // Nothing else is watched while blocked.
+        net_conn_cancel(epoll_fd, conn);
+        continue;
+      }
+
+      if (conn->is_writing)
+      {
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+          net_close(epoll_fd, conn, &conns);
+        else if (net_flush(conn) && conn->is_closing)
+          net_close(epoll_fd, conn, &conns);
+        else if (!conn->segments_length)
+          // Commands that arrived while the replies were going out are in the socket still.
+          net_conn_watch(epoll_fd, conn, false);
+        continue;
+      }
+
+      conn->next_ready = ready;
+      ready = conn;
+    }
+
+    net_pool_serve(&pool, ready, iovs);
+    ready = pool.ready;
+
+    while ((conn = ready))
+    {
+      ready = conn->next_ready;
+      if (conn->is_closing && !conn->is_writing && !conn->is_blocked)
+        net_close(epoll_fd, conn, &conns);
+    }
+
+    if (is_notified)
+      net_wake_blocked(epoll_fd, &conns);
+  }
+
+  net_pool_stop(&pool);
+  // The shards answer cancelled clients at their next maintenance, or at shutdown, and must be done
+  // with the replies before they are freed.
+  for (conn = conns; conn; conn = conn->next)
+    if (conn->is_blocked)
+    {
+      net_conn_cancel(epoll_fd, conn);
+      for (db_uint_t i = 0; i < conn->pipeline->length; ++i)
+        reply_wait(conn->pipeline->replies[i]);
+    }
+  while (conns)
+    net_close(epoll_fd, conns, &conns);
+  close(notify_fd);
+  notify_fd = -1;
+  close(epoll_fd);
+  close(listen_fd);
+  free(iovs);
+  return true;
+}
+
+void net_config_io_threads(db_uint_t _io_thread_count)
+{
+  io_thread_count = _io_thread_count;
+}
+
+void net_stop()
+{
+  atomic_store(&is_stopping, true);
+}
@@ -0,0 +1,134 @@
+#ifndef DB_NET_H
+#define DB_NET_H
+
+#include <stddef.h>
+#include <threads.h>
+
+#include "types.h"
+
+// TCP server speaking RESP2, so redis-benchmark and Redis client libraries can talk to the database.
+// One thread runs an epoll loop over non-blocking sockets: every connection reads into a buffer of
+// its own, the complete commands in it are parsed into one pipeline, and the pipelines of every
+// ready connection are submitted before any of them is awaited, so the shards serve them together.
+// Replies go out with writev; large strings are written straight from the reply objects.
+// Optional I/O threads share the reading, parsing and encoding of each loop iteration.
+// Inline commands, space separated on one line, are accepted too.
+// A client blocked in BLPOP or BRPOP is set aside, neither read from nor waited on, until the shard
+// that answers it wakes the loop through an eventfd.
+
+// Same port as Redis
+#define NET_DEFAULT_PORT 6379
+
+// Bytes read from a socket per call
+#define NET_READ_CHUNK (16 * 1024)
+// A connection stops reading for the current loop iteration after this many bytes, so one busy
+// client can't hold up the others
+#define NET_MAX_READ_PER_EVENT (1024 * 1024)
+// Events taken from epoll at a time
+#define NET_MAX_EVENTS 256
+// How long the loop waits for events before checking whether it should stop
+#define NET_POLL_TIMEOUT_MS 100
+
+// Longest bulk string, element count of a multibulk and inline line accepted from a client
+#define NET_MAX_BULK_LENGTH (512 * 1024 * 1024)
+#define NET_MAX_MULTIBULK_LENGTH (1024 * 1024)
+#define NET_MAX_INLINE_LENGTH (64 * 1024)
+
+// Strings at least this long are written from the reply itself instead of being copied
+#define NET_ZERO_COPY_MIN 1024
+// Buffers handed to one writev call
+#define NET_MAX_IOV 64
+
+// Run of reply bytes waiting to be written: `length` bytes at `base`, or at `offset` in the output
+// buffer of the connection when `base` is NULL, since that buffer moves as it grows
+typedef struct NetSegment
+{
+  const char *base;
+  size_t offset;
+  size_t length;
+} NetSegment;
+
+typedef struct NetConn
+{
+  int fd;
+  // Bytes read and not parsed yet
+  char *in;
+  size_t in_length;
+  size_t in_capacity;
+  // Commands parsed from the last read; their replies are referenced by `segments` until written
+  DBPipeline *pipeline;
+  db_bool_t is_submitted;
+  // Encoded replies: small ones copied into `out`, large strings pointing into `pipeline`
+  char *out;
+  size_t out_length;
+  size_t out_capacity;
+  NetSegment *segments;
+  db_uint_t segments_length;
+  db_uint_t segments_capacity;
+  // First segment not fully written, and the bytes of it that were
+  db_uint_t segment_index;
+  size_t segment_offset;
+  // Set by QUIT, a protocol error or the peer going away; the connection closes once flushed
+  db_bool_t is_closing;
+  // Written after the replies of the commands parsed before QUIT or a protocol error
+  const char *farewell;
+  // Whether the connection waits for EPOLLOUT rather than EPOLLIN
+  db_bool_t is_writing;
+  // Waiting for a BLPOP or BRPOP of `pipeline`; meanwhile epoll only reports the peer going away
+  db_bool_t is_blocked;
+  // The peer went away while blocked; closed without a write once the shards are done with it
+  db_bool_t is_cancelled;
+  // The last command parsed was ASKING, which carries over to the first of the next pipeline
+  db_bool_t is_asking;
+  // Chain of the connections read in one loop iteration
+  struct NetConn *next_ready;
+  // Every open connection, so they can be closed when the server stops
+  struct NetConn *prev;
+  struct NetConn *next;
+} NetConn;
+
+typedef struct NetIOPool NetIOPool;
+
+typedef struct NetIOThread
+{
+  thrd_t thread;
+  NetIOPool *pool;
+  // Connections handed to the thread in the current loop iteration
+  NetConn *ready;
+} NetIOThread;
+
+// I/O threads of a running server; every loop iteration deals the readable connections out to
+// them, and each thread reads, parses, submits and writes the replies of its share
+struct NetIOPool
+{
+  int epoll_fd;
+  NetIOThread *threads;
+  db_uint_t length;
+  mtx_t lock;
+  cnd_t start_cond;
+  cnd_t done_cond;
+  // Bumped to start an iteration; `pending` counts the threads that haven't finished it
+  db_uint_t generation;
+  db_uint_t pending;
+  db_bool_t is_stopping;
+  // Every connection of the iteration once it is done
+  NetConn *ready;
+};
+
+// Sets how many I/O threads parse commands and encode replies next to the loop thread, so the
+// shard workers only run the commands; 0, the default, does everything on the loop thread.
+// Takes effect on the next net_serve
+void net_config_io_threads(db_uint_t _io_thread_count);
+
+// Serves clients on `port` until net_stop is called or the database shuts down; returns false if
+// the port can't be listened on
+db_bool_t net_serve(db_uint_t port);
+
+// Makes net_serve return within NET_POLL_TIMEOUT_MS; connections still open are closed
+void net_stop();
+
+// Opens a blocking TCP connection to another server, for replication and migration; -1 if none of
+// the addresses of `host` takes it
+int net_connect(const char *host, db_uint_t port);
+
+#endif
@@ -1,10 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
 #include "types.h"
 #include "utils.h"
 #include "list.h"
+#include "quicklist.h"
+#include "rope.h"
+#include "hash.h"
 #include "zset.h"
+#include "hashobj.h"
+#include "slab.h"
+#include "arena.h"
+#include "obj.h"
 
 static DBObj *_dbobj_create(db_type_t type);
+static DBObj *_dbobj_create_embedded_string(const char *value, size_t length);
 static void *_dbobj_extract_pointer(DBObj *obj);
+static DBObj *_dbobj_copy_out(const DBObj *obj);
+
+// A shared integer string laid out as _dbobj_create_embedded_string does it: the number right
+// after the object, then its digits
+typedef struct DBObjSharedInteger
+{
+  DBObj obj;
+  int64_t number;
+  char digits[8];
+} DBObjSharedInteger;
+
+static char shared_ok_string[] = "OK";
+static DBObj shared_ok, shared_null, shared_bools[2];
+static DBObj shared_uints[DBOBJ_SHARED_INTEGERS], shared_ints[DBOBJ_SHARED_INTEGERS];
+static DBObjSharedInteger shared_integers[DBOBJ_SHARED_INTEGERS];
+static once_flag shared_once = ONCE_FLAG_INIT;
 
 db_bool_t dbobj_is_null(DBObj *obj)
 {
@@ -46,10 +75,6 @@ db_bool_t dbobj_is_hash(DBObj *obj)
 {
   return obj && obj->type == DB_TYPE_HASH;
 };
-db_bool_t _dbobj_is_zsetele(DBObj *obj)
-{
-  return obj && obj->type == DB_TYPE_ZSETELE;
-};
 
 DBObj *dbobj_create_null()
 {
@@ -93,6 +118,14 @@ DBObj *dbobj_create_double(db_double_t value)
 
 DBObj *dbobj_create_string(char *value)
 {
+  size_t length = value ? strlen(value) : 0;
+  if (value && length <= DBOBJ_EMBEDDED_STRING_MAX)
+  {
+    DBObj *obj = _dbobj_create_embedded_string(value, length);
+    free(value);
+    return obj;
+  }
+
   DBObj *obj = _dbobj_create(DB_TYPE_STRING);
   obj->value.string = value;
   return obj;
@@ -100,11 +133,30 @@ DBObj *dbobj_create_string(char *value)
 
 DBObj *dbobj_create_string_with_dup(const char *value)
 {
+  size_t length = value ? strlen(value) : 0;
+  if (value && length <= DBOBJ_EMBEDDED_STRING_MAX)
+    return _dbobj_create_embedded_string(value, length);
+
   DBObj *obj = _dbobj_create(DB_TYPE_STRING);
   obj->value.string = dbutil_strdup(value);
   return obj;
 }
 
+DBObj *dbobj_create_string_from_bytes(const char *value, size_t length)
+{
+  if (length <= DBOBJ_EMBEDDED_STRING_MAX)
+    return _dbobj_create_embedded_string(value, length);
+
+  char *string = (char *)malloc(length + 1);
+  if (!string)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(string, value, length);
+  string[length] = '\0';
+  DBObj *obj = _dbobj_create(DB_TYPE_STRING);
+  obj->value.string = string;
+  return obj;
+}
+
 DBObj *dbobj_create_list(DBList *value)
 {
   DBObj *obj = _dbobj_create(DB_TYPE_LIST);
@@ -112,6 +164,22 @@ DBObj *dbobj_create_list(DBList *value)
   return obj;
 }
 
+DBObj *dbobj_create_quicklist(DBQuickList *value)
+{
+  DBObj *obj = _dbobj_create(DB_TYPE_LIST);
+  obj->encoding = DB_ENCODING_QUICKLIST;
+  obj->value.quicklist = value;
+  return obj;
+}
+
+DBObj *dbobj_create_rope(DBRope *value)
+{
+  DBObj *obj = _dbobj_create(DB_TYPE_STRING);
+  obj->encoding = DB_ENCODING_ROPE;
+  obj->value.rope = value;
+  return obj;
+}
+
 DBObj *dbobj_create_zset(DBZSet *value)
 {
   DBObj *obj = _dbobj_create(DB_TYPE_ZSET);
@@ -122,42 +190,333 @@ DBObj *dbobj_create_zset(DBZSet *value)
 DBObj *dbobj_create_hash(DBHash *value)
 {
   DBObj *obj = _dbobj_create(DB_TYPE_HASH);
+  obj->encoding = DB_ENCODING_HASHTABLE;
   obj->value.hash = value;
   return obj;
 }
 
-DBObj *_dbobj_create_zsetele(DBZSetElement *value)
+DBObj *dbobj_create_packed_hash(DBPackedHash *value)
+{
+  DBObj *obj = _dbobj_create(DB_TYPE_HASH);
+  obj->encoding = DB_ENCODING_HASH_PACKED;
+  obj->value.packed_hash = value;
+  return obj;
+}
+
+static DBObj *_dbobj_create_in(DBArena *arena, db_type_t type, size_t embedded_size)
+{
+  DBObj *obj = (DBObj *)arena_alloc(arena, sizeof(DBObj) + embedded_size);
+  obj->type = type;
+  obj->encoding = DB_ENCODING_RAW;
+  obj->embedded_size = 0;
+  atomic_init(&obj->refcount, 0);
+  return obj;
+}
+
+DBObj *dbobj_create_null_in(DBArena *arena)
+{
+  return arena ? _dbobj_create_in(arena, DB_TYPE_NULL, 0) : dbobj_create_null();
+}
+
+DBObj *dbobj_create_int_in(DBArena *arena, db_int_t value)
+{
+  if (!arena)
+    return dbobj_create_int(value);
+  DBObj *obj = _dbobj_create_in(arena, DB_TYPE_INT, 0);
+  obj->value.int_value = value;
+  return obj;
+}
+
+DBObj *dbobj_create_uint_in(DBArena *arena, db_uint_t value)
+{
+  if (!arena)
+    return dbobj_create_uint(value);
+  DBObj *obj = _dbobj_create_in(arena, DB_TYPE_UINT, 0);
+  obj->value.uint_value = value;
+  return obj;
+}
+
+DBObj *dbobj_create_double_in(DBArena *arena, db_double_t value)
+{
+  if (!arena)
+    return dbobj_create_double(value);
+  DBObj *obj = _dbobj_create_in(arena, DB_TYPE_DOUBLE, 0);
+  obj->value.double_value = value;
+  return obj;
+}
+
+DBObj *dbobj_create_string_in(DBArena *arena, const char *value, size_t length)
+{
+  if (!arena)
+    return dbobj_create_string_from_bytes(value, length);
+  // Embedded whatever its length, so nothing takes the string for its own.
+  DBObj *obj = _dbobj_create_in(arena, DB_TYPE_STRING, length + 1);
+  obj->encoding = DB_ENCODING_EMBSTR;
+  obj->value.string = (char *)(obj + 1);
+  memcpy(obj->value.string, value, length);
+  obj->value.string[length] = '\0';
+  return obj;
+}
+
+DBObj *dbobj_create_list_in(DBArena *arena, DBList *value)
+{
+  if (!arena)
+    return dbobj_create_list(value);
+  DBObj *obj = _dbobj_create_in(arena, DB_TYPE_LIST, 0);
+  obj->value.list = value;
+  return obj;
+}
+
+db_bool_t dbobj_is_in_arena(const DBObj *obj)
+{
+  return obj && !atomic_load_explicit(&((DBObj *)obj)->refcount, memory_order_relaxed);
+}
+
+static void _dbobj_init_shared(DBObj *obj, db_type_t type, db_encoding_t encoding)
+{
+  obj->type = type;
+  obj->encoding = encoding;
+  obj->embedded_size = 0;
+  atomic_init(&obj->refcount, DBOBJ_REFCOUNT_IMMORTAL);
+}
+
+static void _dbobj_create_shared()
+{
+  _dbobj_init_shared(&shared_ok, DB_TYPE_STRING, DB_ENCODING_EMBSTR);
+  shared_ok.value.string = shared_ok_string;
+  _dbobj_init_shared(&shared_null, DB_TYPE_NULL, DB_ENCODING_RAW);
+  for (int i = 0; i < 2; ++i)
+  {
+    _dbobj_init_shared(&shared_bools[i], DB_TYPE_BOOL, DB_ENCODING_RAW);
+    shared_bools[i].value.bool_value = i;
+  }
+  for (int i = 0; i < DBOBJ_SHARED_INTEGERS; ++i)
+  {
+    _dbobj_init_shared(&shared_uints[i], DB_TYPE_UINT, DB_ENCODING_RAW);
+    shared_uints[i].value.uint_value = i;
+    _dbobj_init_shared(&shared_ints[i], DB_TYPE_INT, DB_ENCODING_RAW);
+    shared_ints[i].value.int_value = i;
+    DBObjSharedInteger *integer = &shared_integers[i];
+    int length = snprintf(integer->digits, sizeof(integer->digits), "%d", i);
+    _dbobj_init_shared(&integer->obj, DB_TYPE_STRING, DB_ENCODING_INT);
+    integer->obj.embedded_size = (db_uint8_t)(sizeof(int64_t) + length + 1);
+    integer->obj.value.string = integer->digits;
+    integer->number = i;
+  }
+}
+
+DBObj *dbobj_shared_ok()
+{
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_ok;
+}
+
+DBObj *dbobj_shared_null()
+{
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_null;
+}
+
+DBObj *dbobj_shared_bool(db_bool_t value)
+{
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_bools[value ? 1 : 0];
+}
+
+DBObj *dbobj_shared_uint(db_uint_t value)
+{
+  if (value >= DBOBJ_SHARED_INTEGERS)
+    return dbobj_create_uint(value);
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_uints[value];
+}
+
+DBObj *dbobj_shared_int(db_int_t value)
+{
+  if (value < 0 || value >= DBOBJ_SHARED_INTEGERS)
+    return dbobj_create_int(value);
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_ints[value];
+}
+
+DBObj *dbobj_shared_integer(int64_t value)
+{
+  if (value < 0 || value >= DBOBJ_SHARED_INTEGERS)
+    return NULL;
+  call_once(&shared_once, _dbobj_create_shared);
+  return &shared_integers[value].obj;
+}
+
+DBObj *dbobj_try_share_integer(DBObj *obj)
+{
+  int64_t number;
+  DBObj *shared;
+  if (!dbobj_string_as_int64(obj, &number) || !(shared = dbobj_shared_integer(number)))
+    return obj;
+  free_dbobj(obj);
+  return shared;
+}
+
+DBObj *dbobj_create_stored_string(const char *value)
+{
+  int64_t number;
+  size_t length = strlen(value);
+  if (length >= ROPE_MIN_LENGTH)
+    return dbobj_create_rope(rope_create_from(value, length));
+  DBObj *shared = dbobj_parse_int64(value, &number) ? dbobj_shared_integer(number) : NULL;
+  return shared ? shared : dbobj_create_string_with_dup(value);
+}
+
+// Bytes after an integer object made by dbobj_create_integer: the number, then up to 20 digits
+// with the sign and the NUL
+#define DBOBJ_INTEGER_EMBEDDED_SIZE (sizeof(int64_t) + 21)
+
+DBObj *dbobj_create_integer(int64_t value)
+{
+  DBObj *shared = dbobj_shared_integer(value);
+  if (shared)
+    return shared;
+
+  DBObj *obj = (DBObj *)slab_alloc(sizeof(DBObj) + DBOBJ_INTEGER_EMBEDDED_SIZE);
+  obj->type = DB_TYPE_STRING;
+  obj->encoding = DB_ENCODING_INT;
+  obj->embedded_size = DBOBJ_INTEGER_EMBEDDED_SIZE;
+  atomic_init(&obj->refcount, 1);
+  obj->value.string = (char *)(obj + 1) + sizeof(int64_t);
+  memcpy(obj + 1, &value, sizeof(value));
+  sprintf(obj->value.string, "%lld", (long long)value);
+  return obj;
+}
+
+db_bool_t dbobj_set_integer(DBObj *obj, int64_t value)
+{
+  char digits[24];
+  int length = sprintf(digits, "%lld", (long long)value);
+  if (!obj || obj->type != DB_TYPE_STRING || obj->encoding != DB_ENCODING_INT ||
+      atomic_load_explicit(&obj->refcount, memory_order_acquire) != 1 ||
+      sizeof(int64_t) + length + 1 > obj->embedded_size)
+    return false;
+  memcpy(obj + 1, &value, sizeof(value));
+  memcpy(obj->value.string, digits, length + 1);
+  return true;
+}
+
+DBObj *dbobj_share(DBObj *obj)
 {
-  DBObj *obj = _dbobj_create(DB_TYPE_ZSETELE);
-  obj->value._zsetele = value;
+  if (atomic_load_explicit(&obj->refcount, memory_order_relaxed) != DBOBJ_REFCOUNT_IMMORTAL)
+    atomic_fetch_add_explicit(&obj->refcount, 1, memory_order_relaxed);
   return obj;
 }
 
+db_bool_t dbobj_is_shared(const DBObj *obj)
+{
+  return atomic_load_explicit(&((DBObj *)obj)->refcount, memory_order_acquire) > 1;
+}
+
 void free_dbobj(DBObj *obj)
 {
   if (!obj)
     return;
+  db_uint_t refcount = atomic_load_explicit(&obj->refcount, memory_order_acquire);
+  // A sole holder skips the locked decrement, since nobody else can share the object meanwhile;
+  // an object of an arena goes with it, and a shared one stays
+  if (!refcount || refcount == DBOBJ_REFCOUNT_IMMORTAL ||
+      (refcount != 1 && atomic_fetch_sub_explicit(&obj->refcount, 1, memory_order_acq_rel) != 1))
+    return;
   switch (obj->type)
   {
   case DB_TYPE_STRING:
-    free(obj->value.string);
+    if (obj->encoding == DB_ENCODING_RAW)
+      free(obj->value.string);
+    else if (obj->encoding == DB_ENCODING_ROPE)
+      rope_free(obj->value.rope);
     break;
   case DB_TYPE_LIST:
-    free_dblist(obj->value.list);
+    if (obj->encoding == DB_ENCODING_QUICKLIST)
+      ql_free(obj->value.quicklist);
+    else
+      free_dblist(obj->value.list);
     break;
   case DB_TYPE_ZSET:
     free_dbzset(obj->value.zset);
     break;
   case DB_TYPE_HASH:
-    // free_dbhash(obj->value.hash);
-    break;
-  case DB_TYPE_ZSETELE:
-    // skip, this will process in zset module
+    if (obj->encoding == DB_ENCODING_HASH_PACKED)
+      free(obj->value.packed_hash);
+    else
+      ht_free(obj->value.hash);
     break;
   default:
     break;
   }
-  free(obj);
+  slab_free(obj, sizeof(DBObj) + obj->embedded_size);
+}
+
+size_t dbobj_shallow_memory_usage(const DBObj *obj)
+{
+  if (!obj)
+    return 0;
+  switch (obj->type)
+  {
+  case DB_TYPE_ERROR:
+    return slab_size(sizeof(DBObj) + obj->embedded_size) + dbutil_alloc_size(obj->value.message);
+  case DB_TYPE_STRING:
+    if (obj->encoding != DB_ENCODING_RAW)
+      return slab_size(sizeof(DBObj) + obj->embedded_size);
+    return slab_size(sizeof(DBObj)) + dbutil_alloc_size(obj->value.string);
+  default:
+    return slab_size(sizeof(DBObj) + obj->embedded_size);
+  }
+}
+
+size_t dbobj_memory_usage(const DBObj *obj)
+{
+  size_t memory = dbobj_shallow_memory_usage(obj);
+  if (!obj)
+    return 0;
+  switch (obj->type)
+  {
+  case DB_TYPE_STRING:
+    return memory + (obj->encoding == DB_ENCODING_ROPE ? obj->value.rope->memory : 0);
+  case DB_TYPE_LIST:
+    if (obj->encoding == DB_ENCODING_QUICKLIST)
+      return memory + (obj->value.quicklist ? obj->value.quicklist->memory : 0);
+    return memory + (obj->value.list ? obj->value.list->memory : 0);
+  case DB_TYPE_HASH:
+    return memory + hashobj_memory_usage(obj);
+  case DB_TYPE_ZSET:
+    return memory + (obj->value.zset ? obj->value.zset->memory + (obj->value.zset->dict ? obj->value.zset->dict->memory : 0) : 0);
+  default:
+    return memory;
+  }
+}
+
+size_t dbobj_string_length(const DBObj *obj)
+{
+  if (obj->encoding == DB_ENCODING_ROPE)
+    return obj->value.rope->size;
+  return obj->value.string ? strlen(obj->value.string) : 0;
+}
+
+size_t dbobj_payload_size(const DBObj *obj)
+{
+  size_t size = 0;
+  switch (obj ? obj->type : DB_TYPE_NULL)
+  {
+  case DB_TYPE_NULL:
+    return 0;
+  case DB_TYPE_ERROR:
+  case DB_TYPE_STRING:
+    return dbobj_string_length(obj);
+  case DB_TYPE_LIST:
+    if (obj->encoding == DB_ENCODING_QUICKLIST || !obj->value.list)
+      return 0;
+    for (DBListNode *node = obj->value.list->head; node; node = node->next)
+      size += dbobj_payload_size(node->data);
+    return size;
+  default:
+    return sizeof(obj->value);
+  }
 }
 
 void *dbobj_extract_null(DBObj *obj)
@@ -167,6 +526,8 @@ void *dbobj_extract_null(DBObj *obj)
 }
 char *dbobj_extract_error(DBObj *obj)
 {
+  if (dbobj_is_error(obj) && dbobj_is_in_arena(obj))
+    return dbutil_strdup(obj->value.message);
   return dbobj_is_error(obj) ? _dbobj_extract_pointer(obj) : NULL;
 }
 db_bool_t dbobj_extract_bool(DBObj *obj)
@@ -189,7 +550,8 @@ db_uint_t dbobj_extract_uint(DBObj *obj)
 }
 db_double_t dbobj_extract_double(DBObj *obj)
 {
-  db_double_t value = obj->value.double_value;
+  // A missing score (nil) counts as 0, e.g. when aggregating into a new member
+  db_double_t value = dbobj_is_double(obj) ? obj->value.double_value : 0;
   free_dbobj(obj);
   return value;
 }
@@ -197,14 +559,32 @@ char *dbobj_extract_string(DBObj *obj)
 {
   if (!dbobj_is_string(obj))
     return free_dbobj(obj), NULL;
-  char *string = obj->value.string;
-  obj->value.string = NULL;
+  // Other holders still read the string of a shared object
+  db_bool_t steal = obj->encoding == DB_ENCODING_RAW && !dbobj_is_shared(obj);
+  char *string = obj->encoding == DB_ENCODING_ROPE ? rope_flatten(obj->value.rope)
+                 : steal                           ? obj->value.string
+                                                   : dbutil_strdup(obj->value.string);
+  if (steal)
+    obj->value.string = NULL;
   return free_dbobj(obj), string;
 }
 DBList *dbobj_extract_list(DBObj *obj)
 {
   if (!dbobj_is_list(obj))
     return free_dbobj(obj), NULL;
+  if (dbobj_is_in_arena(obj))
+  {
+    DBList *copy = create_dblist();
+    for (DBListNode *node = obj->value.list ? obj->value.list->head : NULL; node; node = node->next)
+      rpush(copy, create_dblistnode(_dbobj_copy_out(node->data)));
+    return copy;
+  }
+  if (obj->encoding == DB_ENCODING_QUICKLIST)
+  {
+    // Unpacked into nodes; an empty list has no range to copy.
+    DBList *copy = obj->value.quicklist->length ? ql_lrange(obj->value.quicklist, 0, DB_UINT_MAX) : create_dblist();
+    return free_dbobj(obj), copy;
+  }
   DBList *list = obj->value.list;
   obj->value.list = NULL;
   return free_dbobj(obj), list;
@@ -219,30 +599,111 @@ DBZSet *dbobj_extract_zset(DBObj *obj)
 }
 DBHash *dbobj_extract_hash(DBObj *obj)
 {
-  if (!dbobj_is_hash(obj))
+  if (!dbobj_is_hash(obj) || obj->encoding == DB_ENCODING_HASH_PACKED)
     return free_dbobj(obj), NULL;
   DBHash *hash = obj->value.hash;
   obj->value.hash = NULL;
   return free_dbobj(obj), hash;
 }
-DBZSetElement *_dbobj_extract_zsetele(DBObj *obj)
-{
-  if (!_dbobj_is_zsetele(obj))
-    return free_dbobj(obj), NULL;
-  DBZSetElement *zsetele = obj->value._zsetele;
-  obj->value._zsetele = NULL;
-  return free_dbobj(obj), zsetele;
-}
 
 static DBObj *_dbobj_create(db_type_t type)
 {
-  DBObj *obj = malloc(sizeof(DBObj));
-  if (!obj)
-    EXIT_ON_MEMORY_ERROR();
+  DBObj *obj = (DBObj *)slab_alloc(sizeof(DBObj));
   obj->type = type;
+  obj->encoding = DB_ENCODING_RAW;
+  obj->embedded_size = 0;
+  atomic_init(&obj->refcount, 1);
   return obj;
 }
 
+// Whether the `length` bytes at `value` are the canonical decimal form of an int64_t: no sign but
+// a leading '-', no leading zeros and no "-0", so printing the number gives the string back
+static db_bool_t _dbobj_parse_int64(const char *value, size_t length, int64_t *result)
+{
+  db_bool_t is_negative = length && value[0] == '-';
+  const char *digits = is_negative ? value + 1 : value;
+  size_t digits_length = length - (digits - value);
+  // Accumulated as a negative number, which reaches INT64_MIN
+  int64_t number = 0;
+
+  if (!digits_length || digits_length > 19 || (digits[0] == '0' && (digits_length > 1 || is_negative)))
+    return false;
+  for (size_t i = 0; i < digits_length; ++i)
+  {
+    if (digits[i] < '0' || digits[i] > '9' || number < (INT64_MIN + (digits[i] - '0')) / 10)
+      return false;
+    number = number * 10 - (digits[i] - '0');
+  }
+  if (!is_negative && number == INT64_MIN)
+    return false;
+  *result = is_negative ? number : -number;
+  return true;
+}
+
+static DBObj *_dbobj_create_embedded_string(const char *value, size_t length)
+{
+  int64_t number;
+  db_bool_t is_int = _dbobj_parse_int64(value, length, &number);
+  size_t embedded_size = (is_int ? sizeof(int64_t) : 0) + length + 1;
+  DBObj *obj = (DBObj *)slab_alloc(sizeof(DBObj) + embedded_size);
+  char *bytes = (char *)(obj + 1);
+
+  obj->type = DB_TYPE_STRING;
+  obj->encoding = is_int ? DB_ENCODING_INT : DB_ENCODING_EMBSTR;
+  obj->embedded_size = (db_uint8_t)embedded_size;
+  atomic_init(&obj->refcount, 1);
+  if (is_int)
+  {
+    memcpy(bytes, &number, sizeof(number));
+    bytes += sizeof(number);
+  }
+  memcpy(bytes, value, length);
+  bytes[length] = '\0';
+  obj->value.string = bytes;
+  return obj;
+}
+
+db_bool_t dbobj_parse_int64(const char *value, int64_t *result)
+{
+  return value && _dbobj_parse_int64(value, strlen(value), result);
+}
+
+db_bool_t dbobj_string_as_int64(const DBObj *obj, int64_t *value)
+{
+  if (!obj || obj->type != DB_TYPE_STRING || obj->encoding != DB_ENCODING_INT)
+    return false;
+  memcpy(value, obj + 1, sizeof(*value));
+  return true;
+}
+
+// Copies an object of an arena, and what it holds, to objects of their own
+static DBObj *_dbobj_copy_out(const DBObj *obj)
+{
+  if (!obj)
+    return NULL;
+  switch (obj->type)
+  {
+  case DB_TYPE_ERROR:
+    return dbobj_create_error(dbutil_strdup(obj->value.message));
+  case DB_TYPE_BOOL:
+    return dbobj_create_bool(obj->value.bool_value);
+  case DB_TYPE_INT:
+    return dbobj_create_int(obj->value.int_value);
+  case DB_TYPE_UINT:
+    return dbobj_create_uint(obj->value.uint_value);
+  case DB_TYPE_DOUBLE:
+    return dbobj_create_double(obj->value.double_value);
+  case DB_TYPE_STRING:
+    if (obj->encoding == DB_ENCODING_ROPE)
+      return dbobj_create_string(rope_flatten(obj->value.rope));
+    return dbobj_create_string_with_dup(obj->value.string);
+  case DB_TYPE_LIST:
+    return dbobj_create_list(dbobj_extract_list((DBObj *)obj));
+  default:
+    return dbobj_create_null();
+  }
+}
+
 static void *_dbobj_extract_pointer(DBObj *obj)
 {
   void *pointer = obj->value._pointer;
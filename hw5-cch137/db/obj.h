@@ -3,6 +3,13 @@
 
 #include "types.h"
 
+// Longest string stored in the same allocation as its object, which keeps both in 64 bytes
+#define DBOBJ_EMBEDDED_STRING_MAX 47
+// Integers from 0 up to this one excluded have shared objects, see dbobj_shared_integer
+#define DBOBJ_SHARED_INTEGERS 10000
+// Refcount of a shared object, which is never freed
+#define DBOBJ_REFCOUNT_IMMORTAL UINT32_MAX
+
 db_bool_t dbobj_is_null(DBObj *obj);
 db_bool_t dbobj_is_error(DBObj *obj);
 db_bool_t dbobj_is_bool(DBObj *obj);
@@ -13,7 +20,6 @@ db_bool_t dbobj_is_string(DBObj *obj);
 db_bool_t dbobj_is_list(DBObj *obj);
 db_bool_t dbobj_is_zset(DBObj *obj);
 db_bool_t dbobj_is_hash(DBObj *obj);
-db_bool_t _dbobj_is_zsetele(DBObj *obj);
 
 DBObj *dbobj_create_null();
 DBObj *dbobj_create_error(char *message);
@@ -21,24 +27,97 @@ DBObj *dbobj_create_bool(db_bool_t value);
 DBObj *dbobj_create_int(db_int_t value);
 DBObj *dbobj_create_uint(db_uint_t value);
 DBObj *dbobj_create_double(db_double_t value);
+// Takes ownership of `value`; a string that fits is copied into the object and `value` is freed
 DBObj *dbobj_create_string(char *value);
 DBObj *dbobj_create_string_with_dup(const char *value);
+// Copies the `length` bytes at `value`, which need no NUL
+DBObj *dbobj_create_string_from_bytes(const char *value, size_t length);
 DBObj *dbobj_create_list(DBList *value);
+// Creates a list value with DB_ENCODING_QUICKLIST
+DBObj *dbobj_create_quicklist(DBQuickList *value);
+// Creates a string value with DB_ENCODING_ROPE, which owns `value`
+DBObj *dbobj_create_rope(DBRope *value);
 DBObj *dbobj_create_zset(DBZSet *value);
+// Creates a hash value with DB_ENCODING_HASHTABLE
 DBObj *dbobj_create_hash(DBHash *value);
-DBObj *_dbobj_create_zsetele(DBZSetElement *value);
+// Creates a hash value with DB_ENCODING_HASH_PACKED, see hashobj.h
+DBObj *dbobj_create_packed_hash(DBPackedHash *value);
+
+// Variants that allocate the object from a reply arena, see arena.h, or are the functions above
+// when `arena` is NULL. A string is copied in after the object; a list has to be in the arena too,
+// and so does every value in it
+DBObj *dbobj_create_null_in(DBArena *arena);
+DBObj *dbobj_create_int_in(DBArena *arena, db_int_t value);
+DBObj *dbobj_create_uint_in(DBArena *arena, db_uint_t value);
+DBObj *dbobj_create_double_in(DBArena *arena, db_double_t value);
+DBObj *dbobj_create_string_in(DBArena *arena, const char *value, size_t length);
+DBObj *dbobj_create_list_in(DBArena *arena, DBList *value);
+
+// Whether the object was allocated from a reply arena. The extract functions copy what they
+// return out of such an object, and it must not be shared
+db_bool_t dbobj_is_in_arena(const DBObj *obj);
+
+// Objects made once and never freed, which any number of replies and keys can hold: dbobj_share
+// and free_dbobj leave them alone, and dbobj_is_shared is always true for them
+DBObj *dbobj_shared_ok();
+DBObj *dbobj_shared_null();
+DBObj *dbobj_shared_bool(db_bool_t value);
+// The shared uint or int when the value is below DBOBJ_SHARED_INTEGERS, a new object otherwise
+DBObj *dbobj_shared_uint(db_uint_t value);
+DBObj *dbobj_shared_int(db_int_t value);
+// The integer as a string in DB_ENCODING_INT, which a key can hold like any other string; NULL
+// when it is negative or not below DBOBJ_SHARED_INTEGERS
+DBObj *dbobj_shared_integer(int64_t value);
+// Frees a string that holds a shared integer and returns the shared one instead; returns any other
+// object as it is. For values about to be stored, so keys of small counters take no memory of their own
+DBObj *dbobj_try_share_integer(DBObj *obj);
+// Same as dbobj_create_string_with_dup for a value about to be stored, without allocating a shared integer first;
+// strings of ROPE_MIN_LENGTH bytes and more are stored as ropes
+DBObj *dbobj_create_stored_string(const char *value);
+// The integer as a string in DB_ENCODING_INT to be stored: the shared one when there is one,
+// otherwise an object with room for the digits of any int64_t, which dbobj_set_integer can rewrite
+DBObj *dbobj_create_integer(int64_t value);
+// Rewrites a string in DB_ENCODING_INT in place, as INCR does to a counter; returns false, leaving
+// it alone, if it has another holder or the digits don't fit
+db_bool_t dbobj_set_integer(DBObj *obj, int64_t value);
 
+// Adds a holder to the object and returns it, so a reply can hand out a stored string without
+// copying it. Strings are shared with replies, and lists and sorted sets with the streams reading
+// them: writers replace strings rather than change them, and one that would change any of them in
+// place must copy it first while dbobj_is_shared says it has other holders
+DBObj *dbobj_share(DBObj *obj);
+db_bool_t dbobj_is_shared(const DBObj *obj);
+
+// Lets go of the object, which is freed with what it holds once it has no other holder
 void free_dbobj(DBObj *obj);
+
+// Parses `value` if it is the canonical decimal form of an int64_t, the form INCR-style commands accept
+db_bool_t dbobj_parse_int64(const char *value, int64_t *result);
+
+// Reads a string stored with DB_ENCODING_INT as its number; returns false for any other object
+db_bool_t dbobj_string_as_int64(const DBObj *obj, int64_t *value);
+
+// Bytes allocated for the object and the string it holds, not counting the contents of a list, hash or sorted set
+size_t dbobj_shallow_memory_usage(const DBObj *obj);
+// Bytes allocated for the object and everything it holds; constant time, containers count their own bytes
+size_t dbobj_memory_usage(const DBObj *obj);
+// Bytes of data a reply or argument carries: those of a string, the size of a number, and what
+// the elements of a plain list add up to; walks the list
+size_t dbobj_payload_size(const DBObj *obj);
+// Bytes of a string value, whatever its encoding
+size_t dbobj_string_length(const DBObj *obj);
 void *dbobj_extract_null(DBObj *obj);
 char *dbobj_extract_error(DBObj *obj);
 db_bool_t dbobj_extract_bool(DBObj *obj);
 db_int_t dbobj_extract_int(DBObj *obj);
 db_uint_t dbobj_extract_uint(DBObj *obj);
 db_double_t dbobj_extract_double(DBObj *obj);
+// Returns the string of the object and frees it; an embedded or shared string is copied out
 char *dbobj_extract_string(DBObj *obj);
+// A DB_ENCODING_QUICKLIST list, or one in an arena, is copied out into a DBList
 DBList *dbobj_extract_list(DBObj *obj);
 DBZSet *dbobj_extract_zset(DBObj *obj);
+// NULL for a packed hash
 DBHash *dbobj_extract_hash(DBObj *obj);
-DBZSetElement *_dbobj_extract_zsetele(DBObj *obj);
 
 #endif
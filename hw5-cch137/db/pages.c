@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+#include "pages.h"
+
+// Before every block; a multiple of the alignment of malloc, and a cache line for mapped blocks
+#define PAGES_HEADER 64
+// Policy of mbind that allocates on the given nodes while they have memory, see set_mempolicy(2)
+#define PAGES_MPOL_PREFERRED 1
+
+typedef struct PagesHeader
+{
+  // Bytes mapped, header included; 0 for a block of calloc
+  size_t length;
+} PagesHeader;
+
+static _Atomic db_pages_mode_t mode = DB_PAGES_DEFAULT;
+
+void pages_config_mode(db_pages_mode_t _mode)
+{
+  atomic_store(&mode, _mode);
+}
+
+db_pages_mode_t pages_mode()
+{
+  return atomic_load_explicit(&mode, memory_order_relaxed);
+}
+
+static inline PagesHeader *pages_header(const void *pointer)
+{
+  return (PagesHeader *)((char *)pointer - PAGES_HEADER);
+}
+
+// Prefers the node of the calling thread for the pages of a mapping not touched yet. Failing is
+// harmless, the kernel then places pages where they are first touched, so errors are ignored.
+static void pages_bind_local(void *mapping, size_t length)
+{
+#if defined(SYS_getcpu) && defined(SYS_mbind)
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 64)
+    return;
+  unsigned long nodemask = 1UL << node;
+  syscall(SYS_mbind, mapping, length, PAGES_MPOL_PREFERRED, &nodemask, (unsigned long)node + 2, 0);
+#else
+  (void)mapping;
+  (void)length;
+#endif
+}
+
+static void *pages_map(size_t length, db_pages_mode_t _mode)
+{
+  void *mapping = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // Reserved huge pages run out; the block then makes do with transparent ones.
+  if (_mode == DB_PAGES_HUGETLB)
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (mapping == MAP_FAILED)
+  {
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+      return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, length, MADV_HUGEPAGE);
+#endif
+  }
+  pages_bind_local(mapping, length);
+  return mapping;
+}
+
+void *pages_alloc(size_t size)
+{
+  db_pages_mode_t _mode = pages_mode();
+  PagesHeader *header = NULL;
+
+  if (_mode != DB_PAGES_DEFAULT && size + PAGES_HEADER >= PAGES_MIN_SIZE)
+  {
+    size_t length = (size + PAGES_HEADER + PAGES_HUGE_SIZE - 1) & ~(size_t)(PAGES_HUGE_SIZE - 1);
+    if ((header = (PagesHeader *)pages_map(length, _mode)))
+      header->length = length;
+  }
+  // calloc leaves the pages of a large block to the kernel to zero when they are first touched.
+  if (!header && !(header = (PagesHeader *)calloc(1, PAGES_HEADER + size)))
+    EXIT_ON_MEMORY_ERROR();
+  return (char *)header + PAGES_HEADER;
+}
+
+void pages_free(void *pointer)
+{
+  if (!pointer)
+    return;
+  PagesHeader *header = pages_header(pointer);
+  if (header->length)
+    munmap(header, header->length);
+  else
+    free(header);
+}
+
+size_t pages_alloc_size(const void *pointer)
+{
+  if (!pointer)
+    return 0;
+  PagesHeader *header = pages_header(pointer);
+  return header->length ? header->length : dbutil_alloc_size(header);
+}
@@ -0,0 +1,38 @@
+#ifndef DB_PAGES_H
+#define DB_PAGES_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+// Allocations large enough for the TLB to matter: the bucket arrays of DBHash and the regions slab
+// chunks are carved from. In the default mode they come from calloc like anything else. In the
+// other modes a block of at least PAGES_MIN_SIZE is mapped on its own, backed by huge pages, and
+// bound to the NUMA node of the thread allocating it, which is the shard worker for the tables of
+// its shard, so a 64M-bucket table costs a few hundred TLB entries instead of a hundred thousand
+// and its pages stay next to the only core that writes them. Binding prefers the node rather than
+// requiring it, so a full node spills over instead of failing.
+//
+// Blocks are freed with pages_free whichever way they were allocated, so one function pointer
+// does for epoch_retire.
+
+// Smallest block mapped on its own; smaller ones are left to calloc in every mode
+#define PAGES_MIN_SIZE (1024 * 1024)
+// Size of a huge page, which mappings are rounded up to
+#define PAGES_HUGE_SIZE (2 * 1024 * 1024)
+
+// Takes effect for blocks allocated after the call
+void pages_config_mode(db_pages_mode_t mode);
+
+db_pages_mode_t pages_mode();
+
+// Allocates `size` zeroed bytes, aligned as malloc does; exits if out of memory
+void *pages_alloc(size_t size);
+
+// Frees a block of pages_alloc; does nothing for NULL
+void pages_free(void *pointer);
+
+// Bytes a block of pages_alloc takes, the whole mapping for a mapped one; 0 for NULL
+size_t pages_alloc_size(const void *pointer);
+
+#endif
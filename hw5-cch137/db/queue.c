@@ -0,0 +1,202 @@
+#include <stdlib.h>
+
+#include "utils.h"
+#include "queue.h"
+
+static db_uint_t queue_round_capacity(db_uint_t capacity);
+
+// Claims a slot and publishes the task without waking the consumer
+static db_bool_t queue_claim(DBTaskQueue *queue, const DBTask *task);
+
+// Wakes the consumer if it went to sleep before it could see a published task
+static void queue_notify_consumer(DBTaskQueue *queue);
+
+static db_uint_t queue_round_capacity(db_uint_t capacity)
+{
+  db_uint_t rounded = 2;
+  while (rounded < capacity && rounded < (DB_UINT_MAX >> 1) + 1)
+    rounded <<= 1;
+  return rounded;
+}
+
+DBTaskQueue *queue_create(db_uint_t capacity, db_queue_policy_t policy)
+{
+  DBTaskQueue *queue = (DBTaskQueue *)malloc(sizeof(DBTaskQueue));
+  if (!queue)
+    EXIT_ON_MEMORY_ERROR();
+
+  queue->capacity = queue_round_capacity(capacity ? capacity : DEFAULT_TASK_QUEUE_CAPACITY);
+  queue->mask = queue->capacity - 1;
+  queue->policy = policy;
+  queue->slots = (DBTaskSlot *)malloc(queue->capacity * sizeof(DBTaskSlot));
+  if (!queue->slots)
+    EXIT_ON_MEMORY_ERROR();
+
+  // Slot i is free for the producer claiming position i.
+  for (db_uint_t i = 0; i < queue->capacity; ++i)
+    atomic_init(&queue->slots[i].sequence, i);
+
+  atomic_init(&queue->enqueue_pos, 0);
+  queue->dequeue_pos = 0;
+  atomic_init(&queue->consumer_parked, false);
+  atomic_init(&queue->blocked_producers, 0);
+  mtx_init(&queue->park_lock, mtx_plain);
+  cnd_init(&queue->not_empty);
+  cnd_init(&queue->not_full);
+
+  return queue;
+}
+
+void queue_free(DBTaskQueue *queue)
+{
+  if (!queue)
+    return;
+  cnd_destroy(&queue->not_full);
+  cnd_destroy(&queue->not_empty);
+  mtx_destroy(&queue->park_lock);
+  free(queue->slots);
+  free(queue);
+}
+
+static db_bool_t queue_claim(DBTaskQueue *queue, const DBTask *task)
+{
+  DBTaskSlot *slot;
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  size_t sequence;
+  intptr_t diff;
+
+  while (true)
+  {
+    slot = &queue->slots[pos & queue->mask];
+    sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0)
+    {
+      // The slot is free, try to claim this position.
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      // The consumer has not released this slot yet, the ring is full.
+      return false;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  slot->task = *task;
+  // Publish the task to the consumer.
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+  return true;
+}
+
+static void queue_notify_consumer(DBTaskQueue *queue)
+{
+  // Order the publish before reading the flag, pairs with the re-check in `queue_wait`.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&queue->consumer_parked))
+    queue_wake(queue);
+}
+
+db_bool_t queue_try_push(DBTaskQueue *queue, const DBTask *task)
+{
+  if (!queue_claim(queue, task))
+    return false;
+  queue_notify_consumer(queue);
+  return true;
+}
+
+db_bool_t queue_push(DBTaskQueue *queue, const DBTask *task)
+{
+  if (!queue || !task)
+    return false;
+
+  if (queue_try_push(queue, task))
+    return true;
+
+  if (queue->policy == DB_QUEUE_REJECT)
+    return false;
+
+  return queue_push_blocking(queue, task);
+}
+
+db_bool_t queue_push_blocking(DBTaskQueue *queue, const DBTask *task)
+{
+  if (!queue || !task)
+    return false;
+
+  if (queue_try_push(queue, task))
+    return true;
+
+  mtx_lock(&queue->park_lock);
+  atomic_fetch_add(&queue->blocked_producers, 1);
+  while (!queue_claim(queue, task))
+    cnd_wait(&queue->not_full, &queue->park_lock);
+  atomic_fetch_sub(&queue->blocked_producers, 1);
+  mtx_unlock(&queue->park_lock);
+
+  queue_notify_consumer(queue);
+  return true;
+}
+
+db_bool_t queue_pop(DBTaskQueue *queue, DBTask *task)
+{
+  DBTaskSlot *slot = &queue->slots[queue->dequeue_pos & queue->mask];
+  size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+  if ((intptr_t)sequence - (intptr_t)(queue->dequeue_pos + 1) < 0)
+    return false;
+
+  *task = slot->task;
+  // Hand the slot back to the producer that will claim it one lap later.
+  atomic_store_explicit(&slot->sequence, queue->dequeue_pos + queue->capacity, memory_order_release);
+  ++queue->dequeue_pos;
+
+  // Blocked producers only ever wait on a full ring, so there are always enough pending tasks
+  // to reach the next half-ring boundary; waking them there avoids a thundering herd per pop.
+  atomic_thread_fence(memory_order_seq_cst);
+  if ((queue->dequeue_pos & (queue->capacity / 2 - 1)) == 0 && atomic_load(&queue->blocked_producers))
+  {
+    mtx_lock(&queue->park_lock);
+    cnd_broadcast(&queue->not_full);
+    mtx_unlock(&queue->park_lock);
+  }
+
+  return true;
+}
+
+void queue_wait(DBTaskQueue *queue, long timeout_ns)
+{
+  struct timespec deadline;
+
+  timespec_get(&deadline, TIME_UTC);
+  deadline.tv_nsec += timeout_ns;
+  deadline.tv_sec += deadline.tv_nsec / NANOSECONDS_PER_SECOND;
+  deadline.tv_nsec %= NANOSECONDS_PER_SECOND;
+
+  mtx_lock(&queue->park_lock);
+  atomic_store(&queue->consumer_parked, true);
+  // A producer that published before seeing the flag is caught by this re-check.
+  if (queue_is_empty(queue))
+    cnd_timedwait(&queue->not_empty, &queue->park_lock, &deadline);
+  atomic_store(&queue->consumer_parked, false);
+  mtx_unlock(&queue->park_lock);
+}
+
+void queue_wake(DBTaskQueue *queue)
+{
+  mtx_lock(&queue->park_lock);
+  cnd_signal(&queue->not_empty);
+  mtx_unlock(&queue->park_lock);
+}
+
+db_bool_t queue_is_empty(DBTaskQueue *queue)
+{
+  DBTaskSlot *slot = &queue->slots[queue->dequeue_pos & queue->mask];
+  size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+  return (intptr_t)sequence - (intptr_t)(queue->dequeue_pos + 1) < 0;
+}
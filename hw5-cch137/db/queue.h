@@ -0,0 +1,87 @@
+#ifndef DB_QUEUE_H
+#define DB_QUEUE_H
+
+#include <time.h>
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Default number of preallocated task slots in the core task queue
+#define DEFAULT_TASK_QUEUE_CAPACITY 1024
+
+// Requests of a pipeline that go to the same shard, served one after the other in a single lock hold
+typedef struct DBBatch
+{
+  DBRequest **requests;
+  DBReply **replies;
+  db_uint_t length;
+  db_uint_t capacity;
+} DBBatch;
+
+typedef struct DBTask
+{
+  // latency_now_ns() when the task was queued
+  uint64_t created_at;
+  DBRequest *request;
+  DBReply *reply;
+  // Owned by the core, set for requests that are queued on several shards
+  void *context;
+  // Set instead of `request` and `reply` when the task carries a whole batch
+  DBBatch *batch;
+  // Owned by the core, set instead of `request` when the task answers the next chunk of a
+  // streamed reply
+  void *stream;
+} DBTask;
+
+typedef struct DBTaskSlot
+{
+  // Slot sequence number, see `queue_push` and `queue_pop` for the protocol
+  atomic_size_t sequence;
+  DBTask task;
+} DBTaskSlot;
+
+// Bounded multi-producer/single-consumer ring buffer of preallocated task slots.
+// Producers claim slots with a CAS on `enqueue_pos` and never take a lock on the fast path,
+// `park_lock` is only used to put the consumer or a blocked producer to sleep.
+typedef struct DBTaskQueue
+{
+  db_uint_t capacity;
+  db_uint_t mask;
+  db_queue_policy_t policy;
+  DBTaskSlot *slots;
+  atomic_size_t enqueue_pos;
+  // Only touched by the consumer
+  size_t dequeue_pos;
+  atomic_bool consumer_parked;
+  atomic_uint blocked_producers;
+  mtx_t park_lock;
+  cnd_t not_empty;
+  cnd_t not_full;
+} DBTaskQueue;
+
+// Creates a task queue; the capacity is rounded up to a power of two
+DBTaskQueue *queue_create(db_uint_t capacity, db_queue_policy_t policy);
+
+void queue_free(DBTaskQueue *queue);
+
+// Appends a task, applying the queue policy when it is full; returns false if the task was rejected
+db_bool_t queue_push(DBTaskQueue *queue, const DBTask *task);
+
+// Appends a task, waiting for a free slot whatever the queue policy is
+db_bool_t queue_push_blocking(DBTaskQueue *queue, const DBTask *task);
+
+// Appends a task without ever blocking; returns false if the queue is full
+db_bool_t queue_try_push(DBTaskQueue *queue, const DBTask *task);
+
+// Removes the oldest task; returns false if the queue is empty. Must only be called by the consumer.
+db_bool_t queue_pop(DBTaskQueue *queue, DBTask *task);
+
+// Parks the consumer until a task is pushed or the timeout expires
+void queue_wait(DBTaskQueue *queue, long timeout_ns);
+
+// Wakes up the consumer if it is parked in `queue_wait`
+void queue_wake(DBTaskQueue *queue);
+
+db_bool_t queue_is_empty(DBTaskQueue *queue);
+
+#endif
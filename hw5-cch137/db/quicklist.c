@@ -0,0 +1,691 @@
+#include <string.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "list.h"
+#include "quicklist.h"
+
+db_uint_t ql_block_size = QL_DEFAULT_BLOCK_SIZE;
+
+static inline db_uint_t ql_varint_size(db_uint_t value)
+{
+  db_uint_t size = 1;
+  while (value >= 0x80)
+  {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+// Bytes an element of `length` takes in a block
+static inline db_uint_t ql_element_size(db_uint_t length)
+{
+  db_uint_t forward = ql_varint_size(length) + length + 1;
+  return forward + ql_varint_size(forward);
+}
+
+static void ql_write_element(char *p, const char *string, db_uint_t length)
+{
+  uint8_t *out = (uint8_t *)p;
+  db_uint_t value = length;
+
+  while (value >= 0x80)
+  {
+    *out++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  memcpy(out, string, length);
+  out += length;
+  *out++ = '\0';
+
+  // The last byte holds the lowest bits, and the high bit of a byte says another one precedes it.
+  db_uint_t forward = (db_uint_t)(out - (uint8_t *)p);
+  db_uint_t n = ql_varint_size(forward);
+  for (db_uint_t i = 0; i < n; ++i)
+    out[n - 1 - i] = ((forward >> (7 * i)) & 0x7F) | (i + 1 < n ? 0x80 : 0);
+}
+
+// Returns the string of the element at `p` and sets the bytes the element takes; `length` may be NULL
+static const char *ql_read_element(const char *p, db_uint_t *length, db_uint_t *size)
+{
+  const uint8_t *in = (const uint8_t *)p;
+  db_uint_t value = 0, shift = 0;
+
+  do
+  {
+    value |= (db_uint_t)(*in & 0x7F) << shift;
+    shift += 7;
+  } while (*in++ & 0x80);
+
+  if (length)
+    *length = value;
+  db_uint_t forward = (db_uint_t)(in - (const uint8_t *)p) + value + 1;
+  *size = forward + ql_varint_size(forward);
+  return (const char *)in;
+}
+
+// Offset in `data` of the element that ends at `end`
+static db_uint_t ql_element_before(const char *data, db_uint_t end)
+{
+  const uint8_t *in = (const uint8_t *)data + end - 1;
+  db_uint_t forward = *in & 0x7F, shift = 0;
+
+  while (*in & 0x80)
+  {
+    --in;
+    shift += 7;
+    forward |= (db_uint_t)(*in & 0x7F) << shift;
+  }
+
+  return (db_uint_t)(in - (const uint8_t *)data) - forward;
+}
+
+// Capacity a block needs to hold `needed` bytes, doubling from its current one
+static db_uint_t ql_grown_capacity(const DBQuickList *list, const DBQuickListBlock *block, db_uint_t needed)
+{
+  db_uint_t capacity = block && block->capacity > QL_MIN_BLOCK_CAPACITY ? block->capacity : QL_MIN_BLOCK_CAPACITY;
+  while (capacity < needed && capacity < list->block_size)
+    capacity *= 2;
+  if (capacity > list->block_size)
+    capacity = list->block_size;
+  return capacity < needed ? needed : capacity;
+}
+
+static void ql_index_reserve(DBQuickList *list, db_uint_t capacity)
+{
+  if (capacity <= list->index_capacity)
+    return;
+
+  db_uint_t new_capacity = list->index_capacity ? list->index_capacity * 2 : 8;
+  if (new_capacity < capacity)
+    new_capacity = capacity;
+  size_t memory = dbutil_alloc_size(list->index) + dbutil_alloc_size(list->index_starts);
+  list->index = (DBQuickListBlock **)realloc(list->index, new_capacity * sizeof(DBQuickListBlock *));
+  list->index_starts = (db_uint_t *)realloc(list->index_starts, new_capacity * sizeof(db_uint_t));
+  if (!list->index || !list->index_starts)
+    EXIT_ON_MEMORY_ERROR();
+  list->index_capacity = new_capacity;
+  list->memory += dbutil_alloc_size(list->index) + dbutil_alloc_size(list->index_starts) - memory;
+}
+
+static void ql_index_build(DBQuickList *list)
+{
+  db_uint_t i = 0, start = 0;
+
+  ql_index_reserve(list, list->block_count);
+  for (DBQuickListBlock *block = list->head; block; block = block->next, ++i)
+  {
+    list->index[i] = block;
+    list->index_starts[i] = start;
+    start += block->count;
+  }
+  list->index_length = i;
+  list->index_shift = 0;
+}
+
+// Position of the first element of the block `index[i]`
+static inline db_uint_t ql_index_start(const DBQuickList *list, db_uint_t i)
+{
+  return i ? (db_uint_t)(list->index_starts[i] + list->index_shift) : 0;
+}
+
+// Links a new empty block between `prev` and `next`, either of which may be NULL
+static DBQuickListBlock *ql_block_insert(DBQuickList *list, DBQuickListBlock *prev, DBQuickListBlock *next, db_uint_t needed)
+{
+  db_uint_t capacity = ql_grown_capacity(list, NULL, needed);
+  DBQuickListBlock *block = (DBQuickListBlock *)malloc(sizeof(DBQuickListBlock) + capacity);
+  if (!block)
+    EXIT_ON_MEMORY_ERROR();
+
+  block->prev = prev;
+  block->next = next;
+  block->count = 0;
+  block->start = 0;
+  block->used = 0;
+  block->capacity = capacity;
+  if (prev)
+    prev->next = block;
+  else
+    list->head = block;
+  if (next)
+    next->prev = block;
+  else
+    list->tail = block;
+
+  // A new tail starts at the current length: it is only ever created for an element pushed there.
+  if (list->index_length && prev && !next)
+  {
+    ql_index_reserve(list, list->index_length + 1);
+    list->index[list->index_length] = block;
+    list->index_starts[list->index_length++] = (db_uint_t)(list->length - list->index_shift);
+  }
+  else
+  {
+    list->index_length = 0;
+  }
+
+  ++list->block_count;
+  list->memory += dbutil_alloc_size(block);
+  return block;
+}
+
+static void ql_block_remove(DBQuickList *list, DBQuickListBlock *block)
+{
+  if (list->index_length && block->prev && !block->next)
+    --list->index_length;
+  else
+    list->index_length = 0;
+
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    list->head = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  else
+    list->tail = block->prev;
+
+  --list->block_count;
+  list->memory -= dbutil_alloc_size(block);
+  free(block);
+
+  // A drained list gives its block table back as well.
+  if (!list->head && list->index_capacity)
+  {
+    list->memory -= dbutil_alloc_size(list->index) + dbutil_alloc_size(list->index_starts);
+    free(list->index);
+    free(list->index_starts);
+    list->index = NULL;
+    list->index_starts = NULL;
+    list->index_capacity = 0;
+  }
+}
+
+// Reallocates a block, which may move it, and relinks its neighbours
+static DBQuickListBlock *ql_block_resize(DBQuickList *list, DBQuickListBlock *block, db_uint_t capacity)
+{
+  size_t memory = dbutil_alloc_size(block);
+  block = (DBQuickListBlock *)realloc(block, sizeof(DBQuickListBlock) + capacity);
+  if (!block)
+    EXIT_ON_MEMORY_ERROR();
+
+  block->capacity = capacity;
+  if (block->prev)
+    block->prev->next = block;
+  else
+    list->head = block;
+  if (block->next)
+    block->next->prev = block;
+  else
+    list->tail = block;
+
+  if (list->index_length && !block->prev)
+    list->index[0] = block;
+  else if (list->index_length && !block->next)
+    list->index[list->index_length - 1] = block;
+  else
+    list->index_length = 0;
+
+  list->memory += dbutil_alloc_size(block) - memory;
+  return block;
+}
+
+// Moves the elements of a block to `start`
+static inline void ql_block_shift(DBQuickListBlock *block, db_uint_t start)
+{
+  memmove(block->data + start, block->data + block->start, block->used);
+  block->start = start;
+}
+
+// Makes room for `size` bytes before the first element of a block
+static DBQuickListBlock *ql_reserve_front(DBQuickList *list, DBQuickListBlock *block, db_uint_t size)
+{
+  if (block->start >= size)
+    return block;
+  if (block->used + size > block->capacity)
+    block = ql_block_resize(list, block, ql_grown_capacity(list, block, block->used + size));
+
+  // Half of the free space stays behind the elements, so pushes alternating between the ends
+  // don't move the block back and forth every time.
+  db_uint_t free_bytes = block->capacity - block->used;
+  ql_block_shift(block, free_bytes / 2 > size ? free_bytes / 2 : size);
+  return block;
+}
+
+// Makes room for `size` bytes after the last element of a block
+static DBQuickListBlock *ql_reserve_back(DBQuickList *list, DBQuickListBlock *block, db_uint_t size)
+{
+  if (block->start + block->used + size <= block->capacity)
+    return block;
+  if (block->used + size > block->capacity)
+    block = ql_block_resize(list, block, ql_grown_capacity(list, block, block->used + size));
+
+  db_uint_t free_bytes = block->capacity - block->used;
+  ql_block_shift(block, free_bytes / 2 < free_bytes - size ? free_bytes / 2 : free_bytes - size);
+  return block;
+}
+
+DBQuickList *ql_create()
+{
+  DBQuickList *list = (DBQuickList *)malloc(sizeof(DBQuickList));
+  if (!list)
+    EXIT_ON_MEMORY_ERROR();
+  list->head = NULL;
+  list->tail = NULL;
+  list->length = 0;
+  list->block_count = 0;
+  list->block_size = ql_block_size ? ql_block_size : QL_DEFAULT_BLOCK_SIZE;
+  list->index = NULL;
+  list->index_starts = NULL;
+  list->index_length = 0;
+  list->index_capacity = 0;
+  list->index_shift = 0;
+  list->memory = dbutil_alloc_size(list);
+  return list;
+}
+
+void ql_free(DBQuickList *list)
+{
+  if (!list)
+    return;
+
+  DBQuickListBlock *block = list->head, *next;
+  while (block)
+  {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  free(list->index);
+  free(list->index_starts);
+  free(list);
+}
+
+db_uint_t ql_lpush(DBQuickList *list, const char *string)
+{
+  if (!list || !string)
+    return 0;
+
+  db_uint_t length = (db_uint_t)strlen(string);
+  db_uint_t size = ql_element_size(length);
+  DBQuickListBlock *block = list->head;
+
+  if (!block || block->used + size > list->block_size)
+  {
+    block = ql_block_insert(list, NULL, list->head, size);
+    block->start = block->capacity;
+  }
+  else
+  {
+    block = ql_reserve_front(list, block, size);
+  }
+
+  block->start -= size;
+  ql_write_element(block->data + block->start, string, length);
+  block->used += size;
+  ++block->count;
+  ++list->index_shift;
+  return ++list->length;
+}
+
+db_uint_t ql_rpush(DBQuickList *list, const char *string)
+{
+  if (!list || !string)
+    return 0;
+
+  db_uint_t length = (db_uint_t)strlen(string);
+  db_uint_t size = ql_element_size(length);
+  DBQuickListBlock *block = list->tail;
+
+  if (!block || block->used + size > list->block_size)
+    block = ql_block_insert(list, list->tail, NULL, size);
+  else
+    block = ql_reserve_back(list, block, size);
+
+  ql_write_element(block->data + block->start + block->used, string, length);
+  block->used += size;
+  ++block->count;
+  return ++list->length;
+}
+
+DBObj *ql_lpop(DBQuickList *list)
+{
+  if (!list || !list->head)
+    return NULL;
+
+  DBQuickListBlock *block = list->head;
+  db_uint_t size;
+  DBObj *value = dbobj_create_string_with_dup(ql_read_element(block->data + block->start, NULL, &size));
+
+  block->start += size;
+  block->used -= size;
+  --list->length;
+  --list->index_shift;
+  if (!--block->count)
+    ql_block_remove(list, block);
+  return value;
+}
+
+DBObj *ql_rpop(DBQuickList *list)
+{
+  if (!list || !list->tail)
+    return NULL;
+
+  DBQuickListBlock *block = list->tail;
+  char *data = block->data + block->start;
+  db_uint_t offset = ql_element_before(data, block->used), size;
+  DBObj *value = dbobj_create_string_with_dup(ql_read_element(data + offset, NULL, &size));
+
+  block->used = offset;
+  --list->length;
+  if (!--block->count)
+    ql_block_remove(list, block);
+  return value;
+}
+
+DBList *ql_lpop_n(DBQuickList *list, db_uint_t count)
+{
+  if (!list || !list->head || !count)
+    return NULL;
+
+  DBList *reply_list = create_dblist();
+  DBObj *value;
+
+  while (count-- && (value = ql_lpop(list)))
+    rpush(reply_list, create_dblistnode(value));
+
+  return reply_list;
+}
+
+DBList *ql_rpop_n(DBQuickList *list, db_uint_t count)
+{
+  if (!list || !list->tail || !count)
+    return NULL;
+
+  DBList *reply_list = create_dblist();
+  DBObj *value;
+
+  while (count-- && (value = ql_rpop(list)))
+    rpush(reply_list, create_dblistnode(value));
+
+  return reply_list;
+}
+
+// Returns the block holding `position`, which must be in range, and sets the position of its
+// first element
+static DBQuickListBlock *ql_locate(DBQuickList *list, db_uint_t position, db_uint_t *first)
+{
+  DBQuickListBlock *block;
+  db_uint_t start, steps;
+
+  if (position < list->length / 2)
+  {
+    for (block = list->head, start = 0, steps = 0; steps < QL_INDEX_WALK_BLOCKS; block = block->next, ++steps)
+    {
+      if (position < start + block->count)
+        return *first = start, block;
+      start += block->count;
+    }
+  }
+  else
+  {
+    for (block = list->tail, start = list->length - block->count, steps = 0;; ++steps)
+    {
+      if (position >= start)
+        return *first = start, block;
+      if (steps + 1 == QL_INDEX_WALK_BLOCKS)
+        break;
+      block = block->prev;
+      start -= block->count;
+    }
+  }
+
+  if (!list->index_length)
+    ql_index_build(list);
+
+  // The last block starting at or before the position
+  db_uint_t low = 0, high = list->index_length - 1, middle;
+  while (low < high)
+  {
+    middle = low + (high - low + 1) / 2;
+    if (ql_index_start(list, middle) <= position)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+  *first = ql_index_start(list, low);
+  return list->index[low];
+}
+
+// Offset in the data of a block of its element `i`, walking from the nearer end of the block
+static db_uint_t ql_block_offset(const DBQuickListBlock *block, db_uint_t i)
+{
+  db_uint_t offset, size;
+
+  if (i < block->count / 2)
+  {
+    for (offset = block->start; i; --i)
+    {
+      ql_read_element(block->data + offset, NULL, &size);
+      offset += size;
+    }
+    return offset;
+  }
+
+  offset = block->used;
+  for (db_uint_t k = block->count; k > i; --k)
+    offset = ql_element_before(block->data + block->start, offset);
+  return block->start + offset;
+}
+
+// Replaces the `old_size` bytes at `offset` in a block with a new element, growing the block as
+// needed; the caller keeps the counts
+static DBQuickListBlock *ql_block_splice(DBQuickList *list, DBQuickListBlock *block, db_uint_t offset, db_uint_t old_size, const char *string, db_uint_t length)
+{
+  db_uint_t size = ql_element_size(length);
+  db_uint_t needed = block->used - old_size + size;
+  db_uint_t relative = offset - block->start;
+
+  if (needed > block->capacity)
+    block = ql_block_resize(list, block, ql_grown_capacity(list, block, needed));
+  if (block->start + needed > block->capacity)
+    ql_block_shift(block, 0);
+
+  offset = block->start + relative;
+  memmove(block->data + offset + size, block->data + offset + old_size, block->used - relative - old_size);
+  ql_write_element(block->data + offset, string, length);
+  block->used = needed;
+  return block;
+}
+
+// Moves the elements of a block from `offset` on to a new block right after it
+static void ql_block_split(DBQuickList *list, DBQuickListBlock *block, db_uint_t offset)
+{
+  db_uint_t moved = block->start + block->used - offset, count = 0, size;
+
+  for (db_uint_t i = offset; i < block->start + block->used; i += size, ++count)
+    ql_read_element(block->data + i, NULL, &size);
+
+  DBQuickListBlock *next = ql_block_insert(list, block, block->next, moved);
+  memcpy(next->data, block->data + offset, moved);
+  next->used = moved;
+  next->count = count;
+  block->used -= moved;
+  block->count -= count;
+}
+
+// Inserts an element before the one at `offset` of a block, or after its last one if `offset` is
+// its end; a full block passes the element to a neighbour or splits
+static void ql_insert_at(DBQuickList *list, DBQuickListBlock *block, db_uint_t offset, const char *string, db_uint_t length)
+{
+  db_uint_t size = ql_element_size(length);
+  DBQuickListBlock *next;
+
+  if (block->used + size <= list->block_size)
+  {
+    block = ql_block_splice(list, block, offset, 0, string, length);
+    ++block->count;
+  }
+  else if (offset == block->start + block->used)
+  {
+    next = block->next;
+    if (next && next->used + size <= list->block_size)
+    {
+      next = ql_reserve_front(list, next, size);
+      next->start -= size;
+    }
+    else
+    {
+      next = ql_block_insert(list, block, block->next, size);
+    }
+    ql_write_element(next->data + next->start, string, length);
+    next->used += size;
+    ++next->count;
+  }
+  else if (offset == block->start && block->prev)
+  {
+    ql_insert_at(list, block->prev, block->prev->start + block->prev->used, string, length);
+    return;
+  }
+  else if (offset == block->start)
+  {
+    next = ql_block_insert(list, NULL, block, size);
+    ql_write_element(next->data, string, length);
+    next->used = size;
+    next->count = 1;
+  }
+  else
+  {
+    ql_block_split(list, block, offset);
+    ql_insert_at(list, block, block->start + block->used, string, length);
+    return;
+  }
+
+  ++list->length;
+}
+
+DBList *ql_lrange(DBQuickList *list, db_uint_t start, db_uint_t stop)
+{
+  if (!list)
+    return create_dblist();
+
+  if (stop == DB_UINT_MAX || stop > list->length - 1)
+    stop = list->length - 1;
+
+  if (start > stop || start >= list->length)
+    return NULL;
+
+  DBList *reply_list = create_dblist();
+  db_uint_t first, size;
+  const DBQuickListBlock *block = ql_locate(list, start, &first);
+  db_uint_t offset = ql_block_offset(block, start - first);
+
+  for (db_uint_t index = start; index <= stop; ++index)
+  {
+    if (offset == block->start + block->used)
+    {
+      block = block->next;
+      offset = block->start;
+    }
+    rpush(reply_list, create_dblistnode_with_string((char *)ql_read_element(block->data + offset, NULL, &size)));
+    offset += size;
+  }
+
+  return reply_list;
+}
+
+DBObj *ql_lindex(DBQuickList *list, db_uint_t position)
+{
+  if (!list || position >= list->length)
+    return NULL;
+
+  db_uint_t first, size;
+  DBQuickListBlock *block = ql_locate(list, position, &first);
+  return dbobj_create_string_with_dup(ql_read_element(block->data + ql_block_offset(block, position - first), NULL, &size));
+}
+
+db_bool_t ql_lset(DBQuickList *list, db_uint_t position, const char *string)
+{
+  if (!list || !string || position >= list->length)
+    return false;
+
+  db_uint_t first, old_size;
+  DBQuickListBlock *block = ql_locate(list, position, &first);
+  db_uint_t offset = ql_block_offset(block, position - first);
+  db_uint_t length = (db_uint_t)strlen(string);
+  ql_read_element(block->data + offset, NULL, &old_size);
+
+  if (block->count == 1 || block->used - old_size + ql_element_size(length) <= list->block_size)
+  {
+    // The counts stay the same, so does the block table.
+    ql_block_splice(list, block, offset, old_size, string, length);
+    return true;
+  }
+
+  // Too big for the block with the others around it: take the old one out and insert anew.
+  memmove(block->data + offset, block->data + offset + old_size, block->start + block->used - offset - old_size);
+  block->used -= old_size;
+  --block->count;
+  --list->length;
+  ql_insert_at(list, block, offset, string, length);
+  list->index_length = 0;
+  return true;
+}
+
+db_bool_t ql_linsert(DBQuickList *list, const char *pivot, const char *string, db_bool_t before)
+{
+  if (!list || !pivot || !string)
+    return false;
+
+  db_uint_t offset, size;
+  for (DBQuickListBlock *block = list->head; block; block = block->next)
+  {
+    for (offset = block->start; offset < block->start + block->used; offset += size)
+    {
+      if (strcmp(ql_read_element(block->data + offset, NULL, &size), pivot) != 0)
+        continue;
+      ql_insert_at(list, block, before ? offset : offset + size, string, (db_uint_t)strlen(string));
+      list->index_length = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ql_iter_init(const DBQuickList *list, DBQuickListIter *iter)
+{
+  iter->block = list ? list->head : NULL;
+  iter->offset = iter->block ? iter->block->start : 0;
+}
+
+void ql_iter_init_at(DBQuickList *list, db_uint_t position, DBQuickListIter *iter)
+{
+  if (!list || position >= list->length)
+  {
+    iter->block = NULL;
+    iter->offset = 0;
+    return;
+  }
+  db_uint_t first;
+  iter->block = ql_locate(list, position, &first);
+  iter->offset = ql_block_offset(iter->block, position - first);
+}
+
+const char *ql_iter_next(DBQuickListIter *iter, db_uint_t *length)
+{
+  while (iter->block && iter->offset >= iter->block->start + iter->block->used)
+  {
+    iter->block = iter->block->next;
+    iter->offset = iter->block ? iter->block->start : 0;
+  }
+  if (!iter->block)
+    return NULL;
+
+  db_uint_t size;
+  const char *string = ql_read_element(iter->block->data + iter->offset, length, &size);
+  iter->offset += size;
+  return string;
+}
@@ -0,0 +1,119 @@
+#ifndef DB_QUICKLIST_H
+#define DB_QUICKLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+// Representation of list values. Instead of a node, an object and a string per element, the
+// elements are packed back to back in a chain of blocks of bounded size, so pushing and popping
+// at either end only touches the block at that end and reading a range is a sequential scan.
+//
+// A position is reached by walking blocks from the nearer end when it lies within a few blocks of
+// it, otherwise by a binary search of a table of the blocks and the positions they start at. The
+// table is built on demand and survives pushes and pops at both ends; changes in the middle of
+// the list mark it stale until the next deep lookup rebuilds it.
+//
+// An element is its length as a varint, its bytes with a terminating NUL, so they can be handed
+// out as C strings, and the size of those two again as a varint stored backwards, which lets the
+// tail of a block be walked in reverse as well.
+
+// Bytes a block grows to before the next element starts a new one; an element larger than this
+// gets a block of its own
+#define QL_DEFAULT_BLOCK_SIZE 8192
+// Smallest allocation of a block; it then doubles as needed up to the block size
+#define QL_MIN_BLOCK_CAPACITY 64
+// Blocks walked from either end before a lookup goes to the block table
+#define QL_INDEX_WALK_BLOCKS 4
+
+// Block size given to lists created from now on, see db_config_list_block_size
+extern db_uint_t ql_block_size;
+
+typedef struct DBQuickListBlock
+{
+  struct DBQuickListBlock *prev;
+  struct DBQuickListBlock *next;
+  db_uint_t count;
+  // The elements take `used` bytes of `data` from `start`; the bytes before are left free by
+  // pops from the head, so the next pushes there don't move the rest of the block
+  db_uint_t start;
+  db_uint_t used;
+  db_uint_t capacity;
+  char data[];
+} DBQuickListBlock;
+
+typedef struct DBQuickList
+{
+  DBQuickListBlock *head;
+  DBQuickListBlock *tail;
+  db_uint_t length;
+  db_uint_t block_count;
+  db_uint_t block_size;
+  // Block table, valid while `index_length` isn't 0: `index_starts[i]` plus `index_shift` is the
+  // position of the first element of `index[i]` for every block but the head, and the shift
+  // counts the elements pushed to the head block less those popped from it since the build
+  DBQuickListBlock **index;
+  db_uint_t *index_starts;
+  db_uint_t index_length;
+  db_uint_t index_capacity;
+  int64_t index_shift;
+  // Bytes allocated for the list, its blocks and its block table, kept up to date by quicklist.c
+  size_t memory;
+} DBQuickList;
+
+// Position of the next element read by ql_iter_next
+typedef struct DBQuickListIter
+{
+  const DBQuickListBlock *block;
+  db_uint_t offset;
+} DBQuickListIter;
+
+// Creates an empty list with blocks of `ql_block_size`
+DBQuickList *ql_create();
+
+void ql_free(DBQuickList *list);
+
+// Copies a string to the front of the list; returns the new length
+db_uint_t ql_lpush(DBQuickList *list, const char *string);
+
+// Copies a string to the end of the list; returns the new length
+db_uint_t ql_rpush(DBQuickList *list, const char *string);
+
+// Removes the first element and returns it as a string object, NULL if the list is empty
+DBObj *ql_lpop(DBQuickList *list);
+
+// Removes the last element and returns it as a string object, NULL if the list is empty
+DBObj *ql_rpop(DBQuickList *list);
+
+// Removes up to `count` elements from the front, in order; NULL if nothing was removed
+DBList *ql_lpop_n(DBQuickList *list, db_uint_t count);
+
+// Removes up to `count` elements from the end, the last one first; NULL if nothing was removed
+DBList *ql_rpop_n(DBQuickList *list, db_uint_t count);
+
+// Copies the elements from `start` to `stop` inclusive into a new list, same bounds as lrange
+DBList *ql_lrange(DBQuickList *list, db_uint_t start, db_uint_t stop);
+
+// Returns a copy of the element at `position` as a string object, NULL if it is out of range
+DBObj *ql_lindex(DBQuickList *list, db_uint_t position);
+
+// Replaces the element at `position` with a copy of `string`; returns false if it is out of range
+db_bool_t ql_lset(DBQuickList *list, db_uint_t position, const char *string);
+
+// Inserts a copy of `string` before or after the first element equal to `pivot`; returns false
+// if there is none
+db_bool_t ql_linsert(DBQuickList *list, const char *pivot, const char *string, db_bool_t before);
+
+// Starts an iteration over the elements from the head
+void ql_iter_init(const DBQuickList *list, DBQuickListIter *iter);
+
+// Starts an iteration at the element at `position`, found as ql_lindex finds it; one past the end
+// iterates over nothing
+void ql_iter_init_at(DBQuickList *list, db_uint_t position, DBQuickListIter *iter);
+
+// Returns the next element and sets its length, or NULL at the end; the string stays owned by
+// the list and is valid until the list changes
+const char *ql_iter_next(DBQuickListIter *iter, db_uint_t *length);
+
+#endif
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+#include "radix.h"
+
+// A node with room for a label of `label_length` bytes, which the caller fills in
+static DBRadixNode *radix_node_alloc(DBRadixTree *tree, db_uint_t label_length)
+{
+  DBRadixNode *node = (DBRadixNode *)malloc(sizeof(DBRadixNode) + label_length);
+  if (!node)
+    EXIT_ON_MEMORY_ERROR();
+  node->children = NULL;
+  node->children_length = 0;
+  node->label_length = label_length;
+  node->is_key = false;
+  tree->memory += dbutil_alloc_size(node);
+  return node;
+}
+
+static DBRadixNode *radix_node_create(DBRadixTree *tree, const char *label, db_uint_t label_length)
+{
+  DBRadixNode *node = radix_node_alloc(tree, label_length);
+  memcpy(node->label, label, label_length);
+  return node;
+}
+
+// Frees the node and its array of children, but not the children
+static void radix_node_free(DBRadixTree *tree, DBRadixNode *node)
+{
+  tree->memory -= dbutil_alloc_size(node->children) + dbutil_alloc_size(node);
+  free(node->children);
+  free(node);
+}
+
+static void radix_node_free_all(DBRadixTree *tree, DBRadixNode *node)
+{
+  for (db_uint_t i = 0; i < node->children_length; ++i)
+    radix_node_free_all(tree, node->children[i]);
+  radix_node_free(tree, node);
+}
+
+// Position of the child whose label starts with `byte`, or where it would go
+static db_uint_t radix_child_position(const DBRadixNode *node, unsigned char byte, db_bool_t *found)
+{
+  db_uint_t low = 0, high = node->children_length, middle;
+  unsigned char first;
+  while (low < high)
+  {
+    middle = low + (high - low) / 2;
+    first = (unsigned char)node->children[middle]->label[0];
+    if (first == byte)
+    {
+      *found = true;
+      return middle;
+    }
+    if (first < byte)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  *found = false;
+  return low;
+}
+
+static void radix_insert_child(DBRadixTree *tree, DBRadixNode *node, db_uint_t position, DBRadixNode *child)
+{
+  tree->memory -= dbutil_alloc_size(node->children);
+  DBRadixNode **children = (DBRadixNode **)realloc(node->children, (node->children_length + 1) * sizeof(DBRadixNode *));
+  if (!children)
+    EXIT_ON_MEMORY_ERROR();
+  memmove(children + position + 1, children + position, (node->children_length - position) * sizeof(DBRadixNode *));
+  children[position] = child;
+  node->children = children;
+  ++node->children_length;
+  tree->memory += dbutil_alloc_size(node->children);
+}
+
+static void radix_remove_child(DBRadixTree *tree, DBRadixNode *node, db_uint_t position)
+{
+  memmove(node->children + position, node->children + position + 1, (node->children_length - position - 1) * sizeof(DBRadixNode *));
+  --node->children_length;
+  tree->memory -= dbutil_alloc_size(node->children);
+  if (!node->children_length)
+  {
+    free(node->children);
+    node->children = NULL;
+    return;
+  }
+  DBRadixNode **children = (DBRadixNode **)realloc(node->children, node->children_length * sizeof(DBRadixNode *));
+  if (children)
+    node->children = children;
+  tree->memory += dbutil_alloc_size(node->children);
+}
+
+static db_uint_t radix_common_length(const char *a, db_uint_t a_length, const char *b, db_uint_t b_length)
+{
+  db_uint_t length = a_length < b_length ? a_length : b_length, i = 0;
+  while (i < length && a[i] == b[i])
+    ++i;
+  return i;
+}
+
+// Cuts the label of the child at `position` after `length` bytes; returns the node that takes its
+// place with the first part, whose only child has the rest and what the child had below it
+static DBRadixNode *radix_split(DBRadixTree *tree, DBRadixNode *node, db_uint_t position, db_uint_t length)
+{
+  DBRadixNode *child = node->children[position];
+  DBRadixNode *head = radix_node_create(tree, child->label, length);
+  DBRadixNode *tail = radix_node_create(tree, child->label + length, child->label_length - length);
+  tail->children = child->children;
+  tail->children_length = child->children_length;
+  tail->is_key = child->is_key;
+  child->children = NULL;
+  radix_node_free(tree, child);
+  radix_insert_child(tree, head, 0, tail);
+  node->children[position] = head;
+  return head;
+}
+
+// Joins a node that is no key and has one child with that child; returns the node replacing both
+static DBRadixNode *radix_merge(DBRadixTree *tree, DBRadixNode *node)
+{
+  DBRadixNode *child = node->children[0];
+  DBRadixNode *merged = radix_node_alloc(tree, node->label_length + child->label_length);
+  memcpy(merged->label, node->label, node->label_length);
+  memcpy(merged->label + node->label_length, child->label, child->label_length);
+  merged->children = child->children;
+  merged->children_length = child->children_length;
+  merged->is_key = child->is_key;
+  child->children = NULL;
+  radix_node_free(tree, child);
+  radix_node_free(tree, node);
+  return merged;
+}
+
+DBRadixTree *radix_create()
+{
+  DBRadixTree *tree = (DBRadixTree *)malloc(sizeof(DBRadixTree));
+  if (!tree)
+    EXIT_ON_MEMORY_ERROR();
+  tree->count = 0;
+  tree->memory = dbutil_alloc_size(tree);
+  tree->root = radix_node_alloc(tree, 0);
+  return tree;
+}
+
+void radix_free(DBRadixTree *tree)
+{
+  if (!tree)
+    return;
+  radix_node_free_all(tree, tree->root);
+  free(tree);
+}
+
+void radix_clear(DBRadixTree *tree)
+{
+  if (!tree)
+    return;
+  radix_node_free_all(tree, tree->root);
+  tree->count = 0;
+  tree->root = radix_node_alloc(tree, 0);
+}
+
+db_bool_t radix_insert(DBRadixTree *tree, const char *key, db_uint_t length)
+{
+  DBRadixNode *node = tree->root, *child;
+  db_uint_t position, common, offset = 0;
+  db_bool_t found;
+
+  while (offset < length)
+  {
+    position = radix_child_position(node, (unsigned char)key[offset], &found);
+    if (!found)
+    {
+      child = radix_node_create(tree, key + offset, length - offset);
+      child->is_key = true;
+      radix_insert_child(tree, node, position, child);
+      ++tree->count;
+      return true;
+    }
+    child = node->children[position];
+    common = radix_common_length(child->label, child->label_length, key + offset, length - offset);
+    if (common < child->label_length)
+      child = radix_split(tree, node, position, common);
+    node = child;
+    offset += common;
+  }
+
+  if (node->is_key)
+    return false;
+  node->is_key = true;
+  ++tree->count;
+  return true;
+}
+
+// Removes the key, whose bytes up to `key` are the path to `node`, from below the child at
+// `position`, then drops the child or merges it with its own child if it is left useless
+static db_bool_t radix_remove_below(DBRadixTree *tree, DBRadixNode *node, db_uint_t position, const char *key, db_uint_t length)
+{
+  DBRadixNode *child = node->children[position];
+  db_uint_t common = radix_common_length(child->label, child->label_length, key, length);
+  if (common < child->label_length)
+    return false;
+  key += common;
+  length -= common;
+
+  db_bool_t removed, found;
+  if (!length)
+  {
+    removed = child->is_key;
+    child->is_key = false;
+  }
+  else
+  {
+    db_uint_t next = radix_child_position(child, (unsigned char)key[0], &found);
+    removed = found && radix_remove_below(tree, child, next, key, length);
+  }
+  if (!removed || child->is_key)
+    return removed;
+
+  if (!child->children_length)
+  {
+    radix_node_free(tree, child);
+    radix_remove_child(tree, node, position);
+  }
+  else if (child->children_length == 1)
+    node->children[position] = radix_merge(tree, child);
+  return true;
+}
+
+db_bool_t radix_remove(DBRadixTree *tree, const char *key, db_uint_t length)
+{
+  db_bool_t removed, found;
+  if (!length)
+  {
+    removed = tree->root->is_key;
+    tree->root->is_key = false;
+  }
+  else
+  {
+    db_uint_t position = radix_child_position(tree->root, (unsigned char)key[0], &found);
+    removed = found && radix_remove_below(tree, tree->root, position, key, length);
+  }
+  if (removed)
+    --tree->count;
+  return removed;
+}
+
+// The path to the node being walked, with room for its NUL
+typedef struct RadixWalk
+{
+  char *buffer;
+  db_uint_t length;
+  db_uint_t capacity;
+  void (*visit)(const char *key, db_uint_t length, void *arg);
+  void *arg;
+} RadixWalk;
+
+static void radix_walk_append(RadixWalk *walk, const char *bytes, db_uint_t length)
+{
+  if (walk->length + length + 1 > walk->capacity)
+  {
+    while (walk->length + length + 1 > walk->capacity)
+      walk->capacity = walk->capacity ? walk->capacity * 2 : 64;
+    char *buffer = (char *)realloc(walk->buffer, walk->capacity);
+    if (!buffer)
+      EXIT_ON_MEMORY_ERROR();
+    walk->buffer = buffer;
+  }
+  memcpy(walk->buffer + walk->length, bytes, length);
+  walk->length += length;
+}
+
+static void radix_walk_node(RadixWalk *walk, const DBRadixNode *node)
+{
+  db_uint_t length = walk->length;
+  radix_walk_append(walk, node->label, node->label_length);
+  if (node->is_key)
+  {
+    walk->buffer[walk->length] = '\0';
+    walk->visit(walk->buffer, walk->length, walk->arg);
+  }
+  for (db_uint_t i = 0; i < node->children_length; ++i)
+    radix_walk_node(walk, node->children[i]);
+  walk->length = length;
+}
+
+void radix_walk_prefix(const DBRadixTree *tree, const char *prefix, db_uint_t length, void (*visit)(const char *key, db_uint_t length, void *arg), void *arg)
+{
+  RadixWalk walk = {.buffer = NULL, .length = 0, .capacity = 0, .visit = visit, .arg = arg};
+  const DBRadixNode *node = tree->root, *child;
+  db_uint_t position, common, offset = 0;
+  db_bool_t found;
+
+  // down to the first node whose path covers the prefix, below which every key starts with it
+  while (offset < length)
+  {
+    position = radix_child_position(node, (unsigned char)prefix[offset], &found);
+    if (!found)
+      break;
+    child = node->children[position];
+    common = radix_common_length(child->label, child->label_length, prefix + offset, length - offset);
+    if (common == length - offset)
+    {
+      radix_walk_node(&walk, child);
+      break;
+    }
+    if (common < child->label_length)
+      break;
+    radix_walk_append(&walk, child->label, child->label_length);
+    node = child;
+    offset += common;
+  }
+  if (!length)
+    radix_walk_node(&walk, node);
+  free(walk.buffer);
+}
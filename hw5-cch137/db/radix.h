@@ -0,0 +1,47 @@
+#ifndef DB_RADIX_H
+#define DB_RADIX_H
+
+#include "types.h"
+
+// Set of keys kept in a compressed prefix tree: each node holds the bytes on the edge leading to
+// it, and its children are sorted by their first byte, so the keys under a node are visited in
+// byte order and all the keys starting with a prefix are found by walking down to it once.
+// Keys are NUL-terminated; the tree keeps its own copies of the bytes that tell them apart.
+
+typedef struct DBRadixNode
+{
+  struct DBRadixNode **children;
+  db_uint_t children_length;
+  db_uint_t label_length;
+  // Whether the bytes up to and including the label are a key of the set
+  db_bool_t is_key;
+  char label[];
+} DBRadixNode;
+
+typedef struct DBRadixTree
+{
+  // Has an empty label so every key is below it
+  DBRadixNode *root;
+  db_uint_t count;
+  // Bytes allocated for the tree and its nodes
+  size_t memory;
+} DBRadixTree;
+
+DBRadixTree *radix_create();
+
+void radix_free(DBRadixTree *tree);
+
+// Removes every key
+void radix_clear(DBRadixTree *tree);
+
+// Returns false if the key was already there
+db_bool_t radix_insert(DBRadixTree *tree, const char *key, db_uint_t length);
+
+// Returns false if the key wasn't there; nodes left without a reason to be split are merged back
+db_bool_t radix_remove(DBRadixTree *tree, const char *key, db_uint_t length);
+
+// Calls `visit` with every key starting with the `length` bytes of `prefix`, in byte order. The
+// key passed is NUL-terminated and only valid during the call, which must not change the tree
+void radix_walk_prefix(const DBRadixTree *tree, const char *prefix, db_uint_t length, void (*visit)(const char *key, db_uint_t length, void *arg), void *arg);
+
+#endif
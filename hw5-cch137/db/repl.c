@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "utils.h"
+#include "interaction.h"
+#include "net.h"
+#include "repl.h"
+
+// Longest status line a primary answers PSYNC with
+#define REPL_MAX_LINE_LENGTH 256
+
+// Thread streaming the backlog to one replica
+typedef struct ReplSender
+{
+  int fd;
+  // Next byte of the stream the replica needs
+  uint64_t offset;
+  char id[REPL_ID_LENGTH + 1];
+  char *snapshot_filepath;
+  struct ReplSender *next;
+} ReplSender;
+
+// The primary a replica follows; freed by its link thread once told to stop
+typedef struct ReplLink
+{
+  char *host;
+  db_uint_t port;
+  char *snapshot_filepath;
+  repl_load_handler_t load;
+  aof_command_handler_t apply;
+  void *context;
+  // Socket of the current connection, -1 between connections; guarded by `repl_lock`
+  int fd;
+  db_bool_t is_stopping;
+  // Connected and streaming
+  db_bool_t is_up;
+} ReplLink;
+
+// Everything below is guarded by `repl_lock`, but for the atomics
+static mtx_t repl_lock;
+static cnd_t repl_cond;
+static once_flag repl_lock_once = ONCE_FLAG_INIT;
+
+// Ring of the last REPL_BACKLOG_SIZE bytes of records; the byte at stream offset `o` sits at
+// `o % REPL_BACKLOG_SIZE`, for `backlog_start <= o < master_offset`
+static char *backlog = NULL;
+static uint64_t backlog_start = 0;
+static uint64_t master_offset = 0;
+static char replication_id[REPL_ID_LENGTH + 1] = "";
+static _Atomic db_bool_t backlog_is_active = false;
+static ReplSender *senders = NULL;
+static db_uint_t senders_length = 0;
+static db_bool_t senders_are_stopping = false;
+
+static ReplLink *primary_link = NULL;
+// Whether `primary_link` is set, read by every write a shard serves
+static _Atomic db_bool_t is_replica = false;
+// What the replica has of its primary's stream, "?" before the first full sync
+static char primary_id[REPL_ID_LENGTH + 1] = "?";
+static _Atomic uint64_t replica_offset = 0;
+
+static void repl_lock_init()
+{
+  mtx_init(&repl_lock, mtx_plain);
+  cnd_init(&repl_cond);
+}
+
+static void repl_lock_acquire()
+{
+  call_once(&repl_lock_once, repl_lock_init);
+  mtx_lock(&repl_lock);
+}
+
+void repl_backlog_activate()
+{
+  repl_lock_acquire();
+  if (!backlog)
+  {
+    backlog = (char *)malloc(REPL_BACKLOG_SIZE);
+    if (!backlog)
+      EXIT_ON_MEMORY_ERROR();
+    backlog_start = master_offset;
+  }
+  if (!replication_id[0])
+    for (int i = 0; i < REPL_ID_LENGTH; ++i)
+      replication_id[i] = "0123456789abcdef"[rand() % 16];
+  atomic_store(&backlog_is_active, true);
+  mtx_unlock(&repl_lock);
+}
+
+db_bool_t repl_backlog_is_active()
+{
+  return atomic_load_explicit(&backlog_is_active, memory_order_relaxed);
+}
+
+void repl_feed(const char *data, size_t length)
+{
+  repl_lock_acquire();
+  if (!backlog || !length)
+  {
+    mtx_unlock(&repl_lock);
+    return;
+  }
+  // Only the tail of an oversized write can stay in the ring.
+  if (length > REPL_BACKLOG_SIZE)
+  {
+    master_offset += length - REPL_BACKLOG_SIZE;
+    data += length - REPL_BACKLOG_SIZE;
+    length = REPL_BACKLOG_SIZE;
+  }
+  size_t position = (size_t)(master_offset % REPL_BACKLOG_SIZE);
+  size_t first = REPL_BACKLOG_SIZE - position < length ? REPL_BACKLOG_SIZE - position : length;
+  memcpy(backlog + position, data, first);
+  memcpy(backlog, data + first, length - first);
+  master_offset += length;
+  if (master_offset - backlog_start > REPL_BACKLOG_SIZE)
+    backlog_start = master_offset - REPL_BACKLOG_SIZE;
+  cnd_broadcast(&repl_cond);
+  mtx_unlock(&repl_lock);
+}
+
+uint64_t repl_offset()
+{
+  repl_lock_acquire();
+  uint64_t offset = master_offset;
+  mtx_unlock(&repl_lock);
+  return offset;
+}
+
+void repl_id(char *id)
+{
+  repl_lock_acquire();
+  memcpy(id, replication_id, REPL_ID_LENGTH + 1);
+  mtx_unlock(&repl_lock);
+}
+
+db_bool_t repl_can_continue(const char *id, uint64_t offset)
+{
+  repl_lock_acquire();
+  db_bool_t can_continue = backlog && replication_id[0] && strcmp(id, replication_id) == 0 &&
+                           offset >= backlog_start && offset <= master_offset;
+  mtx_unlock(&repl_lock);
+  return can_continue;
+}
+
+static db_bool_t repl_send_all(int fd, const char *data, size_t length)
+{
+  while (length)
+  {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+static db_bool_t repl_send_snapshot(ReplSender *sender, char *buffer)
+{
+  char header[REPL_MAX_LINE_LENGTH];
+  struct stat status;
+  ssize_t n = 0;
+  int fd = open(sender->snapshot_filepath, O_RDONLY);
+
+  // Nobody else ever opens the file.
+  remove(sender->snapshot_filepath);
+  if (fd < 0 || fstat(fd, &status) != 0)
+  {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  snprintf(header, sizeof(header), "+FULLRESYNC %s %llu\r\n$%lld\r\n", sender->id,
+           (unsigned long long)sender->offset, (long long)status.st_size);
+  db_bool_t is_ok = repl_send_all(sender->fd, header, strlen(header));
+  while (is_ok && (n = read(fd, buffer, REPL_SEND_CHUNK)) > 0)
+    is_ok = repl_send_all(sender->fd, buffer, (size_t)n);
+  close(fd);
+  return is_ok && n == 0;
+}
+
+static int repl_sender(void *arg)
+{
+  ReplSender *sender = (ReplSender *)arg;
+  char line[REPL_MAX_LINE_LENGTH];
+  char *buffer = (char *)malloc(REPL_SEND_CHUNK);
+  if (!buffer)
+    EXIT_ON_MEMORY_ERROR();
+
+  db_bool_t is_ok;
+  if (sender->snapshot_filepath)
+    is_ok = repl_send_snapshot(sender, buffer);
+  else
+  {
+    snprintf(line, sizeof(line), "+CONTINUE %s\r\n", sender->id);
+    is_ok = repl_send_all(sender->fd, line, strlen(line));
+  }
+
+  while (is_ok)
+  {
+    repl_lock_acquire();
+    while (!senders_are_stopping && sender->offset == master_offset)
+      cnd_wait(&repl_cond, &repl_lock);
+    // A replica the backlog has moved past needs a full sync, which it asks for once disconnected.
+    if (senders_are_stopping || sender->offset < backlog_start)
+    {
+      mtx_unlock(&repl_lock);
+      break;
+    }
+    size_t length = master_offset - sender->offset < REPL_SEND_CHUNK ? (size_t)(master_offset - sender->offset) : REPL_SEND_CHUNK;
+    size_t position = (size_t)(sender->offset % REPL_BACKLOG_SIZE);
+    size_t first = REPL_BACKLOG_SIZE - position < length ? REPL_BACKLOG_SIZE - position : length;
+    memcpy(buffer, backlog + position, first);
+    memcpy(buffer + first, backlog, length - first);
+    mtx_unlock(&repl_lock);
+
+    is_ok = repl_send_all(sender->fd, buffer, length);
+    sender->offset += length;
+  }
+
+  repl_lock_acquire();
+  for (ReplSender **link = &senders; *link; link = &(*link)->next)
+    if (*link == sender)
+    {
+      *link = sender->next;
+      break;
+    }
+  --senders_length;
+  close(sender->fd);
+  cnd_broadcast(&repl_cond);
+  mtx_unlock(&repl_lock);
+
+  free(sender->snapshot_filepath);
+  free(sender);
+  free(buffer);
+  return 0;
+}
+
+void repl_attach_replica(int fd, const char *id, uint64_t offset, const char *snapshot_filepath)
+{
+  ReplSender *sender = (ReplSender *)malloc(sizeof(ReplSender));
+  thrd_t thread;
+  if (!sender)
+    EXIT_ON_MEMORY_ERROR();
+
+  // The socket comes from the event loop; the sender blocks on it instead.
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  sender->fd = fd;
+  sender->offset = offset;
+  snprintf(sender->id, sizeof(sender->id), "%s", id);
+  sender->snapshot_filepath = snapshot_filepath ? dbutil_strdup(snapshot_filepath) : NULL;
+
+  repl_lock_acquire();
+  sender->next = senders;
+  senders = sender;
+  ++senders_length;
+  mtx_unlock(&repl_lock);
+
+  if (thrd_create(&thread, repl_sender, sender) != thrd_success)
+    EXIT_ON_MEMORY_ERROR();
+  thrd_detach(thread);
+}
+
+db_uint_t repl_connected_replicas()
+{
+  repl_lock_acquire();
+  db_uint_t length = senders_length;
+  mtx_unlock(&repl_lock);
+  return length;
+}
+
+void repl_reset()
+{
+  repl_lock_acquire();
+  senders_are_stopping = true;
+  // A sender may be stuck writing to a replica that stopped reading.
+  for (ReplSender *sender = senders; sender; sender = sender->next)
+    shutdown(sender->fd, SHUT_RDWR);
+  cnd_broadcast(&repl_cond);
+  while (senders_length)
+    cnd_wait(&repl_cond, &repl_lock);
+  senders_are_stopping = false;
+  free(backlog);
+  backlog = NULL;
+  backlog_start = master_offset = 0;
+  replication_id[0] = '\0';
+  atomic_store(&backlog_is_active, false);
+  mtx_unlock(&repl_lock);
+}
+
+// Reads up to and including a newline, which is replaced by the end of the string
+static db_bool_t repl_read_line(int fd, char *line, size_t size)
+{
+  size_t length = 0;
+  while (length + 1 < size)
+  {
+    ssize_t n = read(fd, line + length, 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    if (line[length] == '\n')
+    {
+      line[length > 0 && line[length - 1] == '\r' ? length - 1 : length] = '\0';
+      return true;
+    }
+    ++length;
+  }
+  return false;
+}
+
+// Receives a snapshot of `length` bytes into the link's file
+static db_bool_t repl_receive_snapshot(ReplLink *link, int fd, long long length)
+{
+  char *buffer = (char *)malloc(REPL_SEND_CHUNK);
+  int file_fd = open(link->snapshot_filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  db_bool_t is_ok = file_fd >= 0;
+  if (!buffer)
+    EXIT_ON_MEMORY_ERROR();
+
+  while (is_ok && length > 0)
+  {
+    ssize_t n = read(fd, buffer, length < REPL_SEND_CHUNK ? (size_t)length : REPL_SEND_CHUNK);
+    if (n < 0 && errno == EINTR)
+      continue;
+    is_ok = n > 0 && write(file_fd, buffer, (size_t)n) == n;
+    length -= n;
+  }
+  if (file_fd >= 0)
+    close(file_fd);
+  free(buffer);
+  return is_ok;
+}
+
+// Asks for the stream from where the replica stopped, taking a full sync if the primary can't
+// continue it
+static db_bool_t repl_handshake(ReplLink *link, int fd)
+{
+  char line[REPL_MAX_LINE_LENGTH], id[REPL_ID_LENGTH + 1], offset[24];
+  unsigned long long full_offset;
+  long long length;
+
+  repl_lock_acquire();
+  memcpy(id, primary_id, sizeof(id));
+  mtx_unlock(&repl_lock);
+  if (strcmp(id, "?") == 0)
+    strcpy(offset, "-1");
+  else
+    snprintf(offset, sizeof(offset), "%llu", (unsigned long long)atomic_load(&replica_offset));
+  snprintf(line, sizeof(line), "*3\r\n$5\r\nPSYNC\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n", strlen(id), id, strlen(offset), offset);
+  if (!repl_send_all(fd, line, strlen(line)) || !repl_read_line(fd, line, sizeof(line)))
+    return false;
+
+  if (strncmp(line, "+CONTINUE ", 10) == 0)
+    return strcmp(line + 10, id) == 0;
+  if (sscanf(line, "+FULLRESYNC %40s %llu", id, &full_offset) != 2 || strlen(id) != REPL_ID_LENGTH ||
+      !repl_read_line(fd, line, sizeof(line)) || sscanf(line, "$%lld", &length) != 1 || length < 0 ||
+      !repl_receive_snapshot(link, fd, length))
+    return false;
+
+  db_bool_t is_loaded = link->load(link->snapshot_filepath, link->context);
+  remove(link->snapshot_filepath);
+  if (!is_loaded)
+    return false;
+  repl_lock_acquire();
+  memcpy(primary_id, id, sizeof(id));
+  atomic_store(&replica_offset, (uint64_t)full_offset);
+  mtx_unlock(&repl_lock);
+  return true;
+}
+
+// Publishes the socket of the link, so repl_unfollow can cut it, and whether it streams; false if
+// the link is stopping
+static db_bool_t repl_link_set_fd(ReplLink *link, int fd, db_bool_t is_up)
+{
+  repl_lock_acquire();
+  db_bool_t is_stopping = link->is_stopping;
+  link->fd = is_stopping ? -1 : fd;
+  link->is_up = !is_stopping && is_up;
+  mtx_unlock(&repl_lock);
+  return !is_stopping;
+}
+
+static int repl_link_thread(void *arg)
+{
+  ReplLink *link = (ReplLink *)arg;
+
+  while (repl_link_set_fd(link, -1, false))
+  {
+    int fd = net_connect(link->host, link->port);
+    if (fd >= 0)
+    {
+      if (repl_link_set_fd(link, fd, false) && repl_handshake(link, fd) && repl_link_set_fd(link, fd, true))
+        aof_replay_fd(fd, link->apply, link->context, &replica_offset);
+      repl_link_set_fd(link, -1, false);
+      close(fd);
+    }
+    for (int waited = 0; waited < REPL_RETRY_MS && repl_link_set_fd(link, -1, false); waited += 10)
+      thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  }
+
+  free(link->host);
+  free(link->snapshot_filepath);
+  free(link);
+  return 0;
+}
+
+// Tells the link thread to stop and cuts its connection; the caller holds `repl_lock`
+static void repl_link_stop()
+{
+  if (!primary_link)
+    return;
+  primary_link->is_stopping = true;
+  if (primary_link->fd >= 0)
+    shutdown(primary_link->fd, SHUT_RDWR);
+  primary_link = NULL;
+  atomic_store(&is_replica, false);
+}
+
+void repl_follow(const char *host, db_uint_t port, const char *snapshot_filepath, repl_load_handler_t load,
+                 aof_command_handler_t apply, void *context)
+{
+  ReplLink *link = (ReplLink *)calloc(1, sizeof(ReplLink));
+  thrd_t thread;
+  if (!link)
+    EXIT_ON_MEMORY_ERROR();
+  link->host = dbutil_strdup(host);
+  link->port = port;
+  link->snapshot_filepath = dbutil_strdup(snapshot_filepath);
+  link->load = load;
+  link->apply = apply;
+  link->context = context;
+  link->fd = -1;
+
+  repl_lock_acquire();
+  repl_link_stop();
+  primary_link = link;
+  atomic_store(&is_replica, true);
+  mtx_unlock(&repl_lock);
+
+  if (thrd_create(&thread, repl_link_thread, link) != thrd_success)
+    EXIT_ON_MEMORY_ERROR();
+  thrd_detach(thread);
+}
+
+void repl_unfollow()
+{
+  repl_lock_acquire();
+  repl_link_stop();
+  mtx_unlock(&repl_lock);
+}
+
+db_bool_t repl_is_replica()
+{
+  return atomic_load_explicit(&is_replica, memory_order_relaxed);
+}
+
+db_bool_t repl_link_status(char *host, size_t host_size, db_uint_t *port)
+{
+  repl_lock_acquire();
+  if (host && host_size)
+    snprintf(host, host_size, "%s", primary_link ? primary_link->host : "");
+  if (port)
+    *port = primary_link ? primary_link->port : 0;
+  db_bool_t is_up = primary_link && primary_link->is_up;
+  mtx_unlock(&repl_lock);
+  return is_up;
+}
+
+uint64_t repl_replica_offset()
+{
+  return atomic_load(&replica_offset);
+}
@@ -0,0 +1,77 @@
+#ifndef DB_REPL_H
+#define DB_REPL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "aof.h"
+
+// Primary/replica replication over the network port. A replica sends PSYNC with the replication id
+// and offset it has. If the primary still holds every record after that offset in its backlog, a
+// ring of the log records it served lately, it answers "+CONTINUE <id>" and streams from there;
+// otherwise "+FULLRESYNC <id> <offset>", then the dataset as a binary snapshot in one bulk string,
+// then the records from that offset on. Records are those of the append-only log and the offset
+// counts their bytes since the id was made, so a replica that loses its link for a moment picks up
+// where it stopped. Replicas only take writes from their primary and serve reads themselves.
+
+// Bytes of records the primary keeps for replicas that reconnect
+#define REPL_BACKLOG_SIZE (1024 * 1024)
+// Hex digits of a replication id
+#define REPL_ID_LENGTH 40
+// Bytes a sender writes to its replica at a time
+#define REPL_SEND_CHUNK (64 * 1024)
+// Appended to the persistence file path for the snapshots of full syncs, on both ends
+#define REPL_SYNC_SUFFIX ".sync"
+// How long a replica waits before connecting again after losing its primary
+#define REPL_RETRY_MS 1000
+
+// Loads a full sync received into `filepath`, replacing the dataset; returns whether it did
+typedef db_bool_t (*repl_load_handler_t)(const char *filepath, void *context);
+
+// Starts keeping a backlog, making up a replication id the first time
+void repl_backlog_activate();
+
+db_bool_t repl_backlog_is_active();
+
+// Appends served records to the backlog and wakes the senders; called by whoever writes a shard's
+// log buffer, so the records of one command stay together
+void repl_feed(const char *data, size_t length);
+
+// Offset just past the last record fed
+uint64_t repl_offset();
+
+// Copies the replication id, REPL_ID_LENGTH digits and a NUL, into `id`
+void repl_id(char *id);
+
+// Whether a replica at `offset` of the replication `id` can be served from the backlog
+db_bool_t repl_can_continue(const char *id, uint64_t offset);
+
+// Hands the socket of a replica to a sender thread, which owns it from then on. With a snapshot,
+// which the sender removes once it has it open, this is a full sync; the stream starts at `offset`
+void repl_attach_replica(int fd, const char *id, uint64_t offset, const char *snapshot_filepath);
+
+db_uint_t repl_connected_replicas();
+
+// Disconnects every replica, waiting for their senders to finish, and forgets the backlog and the
+// replication id, for a dataset that starts over
+void repl_reset();
+
+// Replicates the primary at `host`:`port` on a thread of its own, receiving full syncs into
+// `snapshot_filepath`, until repl_unfollow; replaces any primary followed before
+void repl_follow(const char *host, db_uint_t port, const char *snapshot_filepath, repl_load_handler_t load,
+                 aof_command_handler_t apply, void *context);
+
+// Stops replicating without waiting for the link thread, which may be applying a record
+void repl_unfollow();
+
+db_bool_t repl_is_replica();
+
+// Whether the replica is connected and streaming; fills in the primary it follows if `host`, of
+// `host_size` bytes, is given
+db_bool_t repl_link_status(char *host, size_t host_size, db_uint_t *port);
+
+// Offset of the primary's stream the replica has applied up to
+uint64_t repl_replica_offset();
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "rope.h"
+
+static DBRopeChunk *rope_chunk_create()
+{
+  DBRopeChunk *chunk = (DBRopeChunk *)malloc(sizeof(DBRopeChunk));
+  if (!chunk)
+    EXIT_ON_MEMORY_ERROR();
+  atomic_init(&chunk->refcount, 1);
+  chunk->length = 0;
+  return chunk;
+}
+
+static void rope_chunk_release(DBRopeChunk *chunk)
+{
+  // A sole holder skips the locked decrement, as free_dbobj does.
+  if (atomic_load_explicit(&chunk->refcount, memory_order_acquire) == 1 ||
+      atomic_fetch_sub_explicit(&chunk->refcount, 1, memory_order_acq_rel) == 1)
+    free(chunk);
+}
+
+// Makes room in the table for `length` chunks
+static void rope_reserve(DBRope *rope, db_uint_t length)
+{
+  if (length <= rope->capacity)
+    return;
+  db_uint_t capacity = rope->capacity ? rope->capacity : 4;
+  while (capacity < length)
+    capacity *= 2;
+  rope->memory -= dbutil_alloc_size(rope->chunks);
+  rope->chunks = (DBRopeChunk **)realloc(rope->chunks, capacity * sizeof(DBRopeChunk *));
+  if (!rope->chunks)
+    EXIT_ON_MEMORY_ERROR();
+  rope->memory += dbutil_alloc_size(rope->chunks);
+  rope->capacity = capacity;
+}
+
+// The chunk at `index`, copied first if another rope holds it too
+static DBRopeChunk *rope_writable_chunk(DBRope *rope, db_uint_t index)
+{
+  DBRopeChunk *chunk = rope->chunks[index];
+  if (atomic_load_explicit(&chunk->refcount, memory_order_acquire) == 1)
+    return chunk;
+  DBRopeChunk *copy = rope_chunk_create();
+  memcpy(copy->data, chunk->data, chunk->length);
+  copy->length = chunk->length;
+  rope_chunk_release(chunk);
+  return rope->chunks[index] = copy;
+}
+
+DBRope *rope_create()
+{
+  DBRope *rope = (DBRope *)malloc(sizeof(DBRope));
+  if (!rope)
+    EXIT_ON_MEMORY_ERROR();
+  rope->chunks = NULL;
+  rope->length = 0;
+  rope->capacity = 0;
+  rope->size = 0;
+  rope->memory = dbutil_alloc_size(rope);
+  return rope;
+}
+
+DBRope *rope_create_from(const char *bytes, size_t length)
+{
+  DBRope *rope = rope_create();
+  rope_append(rope, bytes, length);
+  return rope;
+}
+
+DBRope *rope_copy(const DBRope *rope)
+{
+  DBRope *copy = rope_create();
+  rope_reserve(copy, rope->length);
+  for (db_uint_t i = 0; i < rope->length; ++i)
+  {
+    atomic_fetch_add_explicit(&rope->chunks[i]->refcount, 1, memory_order_relaxed);
+    copy->chunks[i] = rope->chunks[i];
+    copy->memory += dbutil_alloc_size(rope->chunks[i]);
+  }
+  copy->length = rope->length;
+  copy->size = rope->size;
+  return copy;
+}
+
+void rope_free(DBRope *rope)
+{
+  if (!rope)
+    return;
+  for (db_uint_t i = 0; i < rope->length; ++i)
+    rope_chunk_release(rope->chunks[i]);
+  free(rope->chunks);
+  free(rope);
+}
+
+void rope_append(DBRope *rope, const char *bytes, size_t length)
+{
+  rope_write(rope, rope->size, bytes, length);
+}
+
+void rope_write(DBRope *rope, size_t offset, const char *bytes, size_t length)
+{
+  size_t end = offset + length;
+  if (!length)
+    return;
+
+  // Chunks up to the new end, the last one filled up to where it ends or zeros start
+  if (end > rope->size)
+  {
+    db_uint_t length_needed = (db_uint_t)((end + ROPE_CHUNK_SIZE - 1) / ROPE_CHUNK_SIZE);
+    rope_reserve(rope, length_needed);
+    size_t fill = rope->length < length_needed ? ROPE_CHUNK_SIZE : end - (size_t)(rope->length - 1) * ROPE_CHUNK_SIZE;
+    if (rope->length && rope->chunks[rope->length - 1]->length < fill)
+    {
+      DBRopeChunk *last = rope_writable_chunk(rope, rope->length - 1);
+      memset(last->data + last->length, 0, fill - last->length);
+      last->length = (db_uint_t)fill;
+    }
+    for (; rope->length < length_needed; ++rope->length)
+    {
+      DBRopeChunk *chunk = rope_chunk_create();
+      chunk->length = rope->length + 1 < length_needed ? ROPE_CHUNK_SIZE : (db_uint_t)(end - (size_t)rope->length * ROPE_CHUNK_SIZE);
+      // The bytes about to be written need no zeros.
+      if ((size_t)rope->length * ROPE_CHUNK_SIZE < offset)
+        memset(chunk->data, 0, chunk->length);
+      rope->chunks[rope->length] = chunk;
+      rope->memory += dbutil_alloc_size(chunk);
+    }
+    rope->size = end;
+  }
+
+  for (db_uint_t index = (db_uint_t)(offset / ROPE_CHUNK_SIZE); length; ++index)
+  {
+    size_t start = offset % ROPE_CHUNK_SIZE;
+    size_t count = ROPE_CHUNK_SIZE - start < length ? ROPE_CHUNK_SIZE - start : length;
+    memcpy(rope_writable_chunk(rope, index)->data + start, bytes, count);
+    bytes += count;
+    offset += count;
+    length -= count;
+  }
+}
+
+void rope_read(const DBRope *rope, size_t offset, size_t length, char *out)
+{
+  for (db_uint_t index = (db_uint_t)(offset / ROPE_CHUNK_SIZE); length; ++index)
+  {
+    size_t start = offset % ROPE_CHUNK_SIZE;
+    size_t count = ROPE_CHUNK_SIZE - start < length ? ROPE_CHUNK_SIZE - start : length;
+    memcpy(out, rope->chunks[index]->data + start, count);
+    out += count;
+    offset += count;
+    length -= count;
+  }
+}
+
+DBRope *rope_slice(const DBRope *rope, size_t offset, size_t length)
+{
+  DBRope *slice = rope_create();
+  db_uint_t index = (db_uint_t)(offset / ROPE_CHUNK_SIZE);
+
+  // From the start of a chunk, the whole chunks of the range are shared rather than copied.
+  if (offset % ROPE_CHUNK_SIZE == 0)
+  {
+    db_uint_t whole = (db_uint_t)(length / ROPE_CHUNK_SIZE);
+    rope_reserve(slice, whole + 1);
+    for (; slice->length < whole; ++slice->length, ++index)
+    {
+      atomic_fetch_add_explicit(&rope->chunks[index]->refcount, 1, memory_order_relaxed);
+      slice->chunks[slice->length] = rope->chunks[index];
+      slice->memory += dbutil_alloc_size(rope->chunks[index]);
+    }
+    slice->size = (size_t)whole * ROPE_CHUNK_SIZE;
+    offset += slice->size;
+    length -= slice->size;
+  }
+
+  for (; length; ++index)
+  {
+    size_t start = offset % ROPE_CHUNK_SIZE;
+    size_t count = ROPE_CHUNK_SIZE - start < length ? ROPE_CHUNK_SIZE - start : length;
+    rope_append(slice, rope->chunks[index]->data + start, count);
+    offset += count;
+    length -= count;
+  }
+  return slice;
+}
+
+char *rope_flatten(const DBRope *rope)
+{
+  char *string = (char *)malloc(rope->size + 1);
+  if (!string)
+    EXIT_ON_MEMORY_ERROR();
+  rope_read(rope, 0, rope->size, string);
+  string[rope->size] = '\0';
+  return string;
+}
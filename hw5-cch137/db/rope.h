@@ -0,0 +1,70 @@
+#ifndef DB_ROPE_H
+#define DB_ROPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Representation of large string values. Instead of one block the size of the whole value, the
+// bytes are cut into chunks of ROPE_CHUNK_SIZE, every one of them full but the last, so the chunk
+// holding a byte is found by a division and reading, overwriting or appending a range only touches
+// the chunks it spans. Replies send the chunks as they are, see net_encode, instead of a copy.
+//
+// Chunks are shared: rope_copy takes a new reference to each chunk instead of copying it, and a
+// chunk held by several ropes is copied by the first one that writes to it. That is how a write
+// leaves the value a reply still holds as it was, for the price of a table of pointers and of the
+// chunks it changes.
+//
+// The bytes may hold NULs, a rope knows its size; a string taken out of one with rope_flatten ends
+// at the first of them like every other string of the database.
+
+#define ROPE_CHUNK_SIZE (16 * 1024)
+// Strings of this many bytes and more are stored as ropes
+#define ROPE_MIN_LENGTH (64 * 1024)
+
+typedef struct DBRopeChunk
+{
+  // Ropes holding the chunk
+  _Atomic db_uint_t refcount;
+  db_uint_t length;
+  char data[ROPE_CHUNK_SIZE];
+} DBRopeChunk;
+
+struct DBRope
+{
+  DBRopeChunk **chunks;
+  db_uint_t length;
+  db_uint_t capacity;
+  // Bytes of the string
+  size_t size;
+  // Bytes allocated for the rope, its table and its chunks, shared ones included
+  size_t memory;
+};
+
+DBRope *rope_create();
+
+DBRope *rope_create_from(const char *bytes, size_t length);
+
+// A rope with the same bytes, which shares the chunks of `rope` until either writes to them
+DBRope *rope_copy(const DBRope *rope);
+
+void rope_free(DBRope *rope);
+
+void rope_append(DBRope *rope, const char *bytes, size_t length);
+
+// Writes `length` bytes at `offset`, past the end if need be; the gap up to `offset` reads as
+// zero bytes
+void rope_write(DBRope *rope, size_t offset, const char *bytes, size_t length);
+
+// Copies `length` bytes from `offset`, which must be within the rope, to `out`
+void rope_read(const DBRope *rope, size_t offset, size_t length, char *out);
+
+// A new rope with `length` bytes from `offset`, which must be within the rope
+DBRope *rope_slice(const DBRope *rope, size_t offset, size_t length);
+
+// The bytes of the rope in a block of their own, NUL-terminated, which the caller frees
+char *rope_flatten(const DBRope *rope);
+
+#endif
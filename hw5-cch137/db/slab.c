@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <threads.h>
+
+#include "utils.h"
+#include "pages.h"
+#include "slab.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define SLAB_USE_MALLOC 1
+#endif
+
+// Chunks start with a link to the previous one, padded so the slots after it stay aligned
+#define SLAB_CHUNK_HEADER 16
+
+// Shared state of a size class, guarded by `lock`
+typedef struct SlabPool
+{
+  mtx_t lock;
+  // Free slots, linked through their first word
+  void *free_list;
+  void *chunks;
+  // Rest of the huge page region chunks are being cut from, outside the default pages mode
+  char *region;
+  size_t region_left;
+  uint64_t chunk_count;
+  uint64_t slots;
+  uint64_t allocations;
+  uint64_t frees;
+} SlabPool;
+
+// Free slots of a size class owned by one thread
+typedef struct SlabCache
+{
+  void *head;
+  db_uint_t length;
+  // Not published to the pool yet
+  uint64_t allocations;
+  uint64_t frees;
+} SlabCache;
+
+static SlabPool pools[SLAB_CLASSES];
+static once_flag pools_once = ONCE_FLAG_INIT;
+static thread_local SlabCache caches[SLAB_CLASSES];
+// Set once the caches of the thread are given back when it exits, see slab_release_caches
+static thread_local db_bool_t caches_registered = false;
+static tss_t caches_key;
+
+static void slab_release_caches(void *thread_caches);
+
+static void slab_init_pools()
+{
+  for (db_uint_t i = 0; i < SLAB_CLASSES; ++i)
+    mtx_init(&pools[i].lock, mtx_plain);
+  if (tss_create(&caches_key, slab_release_caches) != thrd_success)
+    EXIT_ON_ERROR("Failed to create the slab cache key");
+}
+
+static inline db_uint_t slab_class(size_t size)
+{
+  return size ? (db_uint_t)((size - 1) / SLAB_GRANULARITY) : 0;
+}
+
+static inline void *slab_pop(void **list)
+{
+  void *slot = *list;
+  *list = *(void **)slot;
+  return slot;
+}
+
+static inline void slab_push(void **list, void *slot)
+{
+  *(void **)slot = *list;
+  *list = slot;
+}
+
+// Must be called with the pool locked
+static void slab_publish(SlabPool *pool, SlabCache *cache)
+{
+  pool->allocations += cache->allocations;
+  pool->frees += cache->frees;
+  cache->allocations = 0;
+  cache->frees = 0;
+}
+
+// Publishes the counters of an exiting thread and gives its slots back to the pools
+static void slab_release_caches(void *thread_caches)
+{
+  SlabCache *cache = (SlabCache *)thread_caches;
+  for (db_uint_t index = 0; index < SLAB_CLASSES; ++index, ++cache)
+  {
+    SlabPool *pool = &pools[index];
+    mtx_lock(&pool->lock);
+    slab_publish(pool, cache);
+    while (cache->head)
+      slab_push(&pool->free_list, slab_pop(&cache->head));
+    cache->length = 0;
+    mtx_unlock(&pool->lock);
+  }
+}
+
+// The cache of the calling thread for a size class, which the thread gives back when it exits
+static inline SlabCache *slab_cache(db_uint_t index)
+{
+  if (!caches_registered)
+  {
+    call_once(&pools_once, slab_init_pools);
+    tss_set(caches_key, caches);
+    caches_registered = true;
+  }
+  return &caches[index];
+}
+
+// Splits a new chunk into free slots of the pool; must be called with the pool locked
+static void slab_grow(SlabPool *pool, size_t slot_size)
+{
+  char *chunk;
+  if (pages_mode() != DB_PAGES_DEFAULT)
+  {
+    if (pool->region_left < SLAB_CHUNK_SIZE)
+    {
+      pool->region = (char *)pages_alloc(SLAB_REGION_SIZE);
+      pool->region_left = SLAB_REGION_SIZE;
+    }
+    chunk = pool->region;
+    pool->region += SLAB_CHUNK_SIZE;
+    pool->region_left -= SLAB_CHUNK_SIZE;
+  }
+  else if (!(chunk = (char *)malloc(SLAB_CHUNK_SIZE)))
+    EXIT_ON_MEMORY_ERROR();
+  *(void **)chunk = pool->chunks;
+  pool->chunks = chunk;
+  ++pool->chunk_count;
+
+  db_uint_t count = (SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER) / slot_size;
+  // Pushed back to front, so the first slots handed out are the first in memory.
+  for (db_uint_t i = count; i > 0; --i)
+    slab_push(&pool->free_list, chunk + SLAB_CHUNK_HEADER + (i - 1) * slot_size);
+  pool->slots += count;
+}
+
+// Fills an empty cache with a batch of slots from the pool
+static void slab_refill(db_uint_t index)
+{
+  SlabPool *pool = &pools[index];
+  SlabCache *cache = slab_cache(index);
+
+  call_once(&pools_once, slab_init_pools);
+  mtx_lock(&pool->lock);
+  slab_publish(pool, cache);
+  if (!pool->free_list)
+    slab_grow(pool, (index + 1) * SLAB_GRANULARITY);
+  while (pool->free_list && cache->length < SLAB_CACHE_BATCH)
+  {
+    slab_push(&cache->head, slab_pop(&pool->free_list));
+    ++cache->length;
+  }
+  mtx_unlock(&pool->lock);
+}
+
+// Gives a batch of slots of a full cache back to the pool
+static void slab_flush(db_uint_t index)
+{
+  SlabPool *pool = &pools[index];
+  SlabCache *cache = slab_cache(index);
+
+  call_once(&pools_once, slab_init_pools);
+  mtx_lock(&pool->lock);
+  slab_publish(pool, cache);
+  for (db_uint_t i = 0; i < SLAB_CACHE_BATCH && cache->head; ++i)
+  {
+    slab_push(&pool->free_list, slab_pop(&cache->head));
+    --cache->length;
+  }
+  mtx_unlock(&pool->lock);
+}
+
+void *slab_alloc(size_t size)
+{
+  void *pointer;
+
+  if (size > SLAB_MAX_SIZE)
+  {
+    if (!(pointer = malloc(size)))
+      EXIT_ON_MEMORY_ERROR();
+    return pointer;
+  }
+
+  db_uint_t index = slab_class(size);
+  SlabCache *cache = slab_cache(index);
+
+#ifdef SLAB_USE_MALLOC
+  if (!(pointer = malloc(slab_size(size))))
+    EXIT_ON_MEMORY_ERROR();
+  if (++cache->allocations >= SLAB_CACHE_BATCH)
+    slab_flush(index);
+  return pointer;
+#else
+  if (!cache->head)
+    slab_refill(index);
+  ++cache->allocations;
+  --cache->length;
+  return slab_pop(&cache->head);
+#endif
+}
+
+void slab_free(void *pointer, size_t size)
+{
+  if (!pointer)
+    return;
+
+  if (size > SLAB_MAX_SIZE)
+  {
+    free(pointer);
+    return;
+  }
+
+  db_uint_t index = slab_class(size);
+  SlabCache *cache = slab_cache(index);
+
+#ifdef SLAB_USE_MALLOC
+  free(pointer);
+  if (++cache->frees >= SLAB_CACHE_BATCH)
+    slab_flush(index);
+#else
+  slab_push(&cache->head, pointer);
+  ++cache->frees;
+  if (++cache->length >= SLAB_CACHE_BATCH * 2)
+    slab_flush(index);
+#endif
+}
+
+size_t slab_size(size_t size)
+{
+  if (size > SLAB_MAX_SIZE)
+    return size;
+  return (slab_class(size) + 1) * SLAB_GRANULARITY;
+}
+
+void slab_stats(db_uint_t index, SlabStats *stats)
+{
+  SlabPool *pool = &pools[index];
+
+  call_once(&pools_once, slab_init_pools);
+  // The counters of the calling thread are as good as published.
+  mtx_lock(&pool->lock);
+  slab_publish(pool, &caches[index]);
+  stats->slot_size = (index + 1) * SLAB_GRANULARITY;
+  stats->allocations = pool->allocations;
+  stats->frees = pool->frees;
+#ifdef SLAB_USE_MALLOC
+  // Every live block is its own allocation, reserved exactly.
+  stats->chunks = 0;
+  stats->slots = pool->allocations > pool->frees ? pool->allocations - pool->frees : 0;
+  stats->reserved_bytes = stats->slots * stats->slot_size;
+#else
+  stats->chunks = pool->chunk_count;
+  stats->slots = pool->slots;
+  stats->reserved_bytes = pool->chunk_count * SLAB_CHUNK_SIZE;
+#endif
+  mtx_unlock(&pool->lock);
+}
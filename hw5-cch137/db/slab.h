@@ -0,0 +1,59 @@
+#ifndef DB_SLAB_H
+#define DB_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+// Pools for the small fixed-size structs every command allocates: values, list nodes and hash
+// entries. Each size class carves its slots out of large chunks, and every thread keeps its own
+// free list per class, so an allocation is a pop and a free is a push without taking a lock.
+// A thread only goes to the shared pool of a class for a batch of slots at a time, and gives the
+// slots and counts it still holds back when it exits. Slots can be freed on any thread; chunks are
+// kept for the life of the process. Outside the default mode of
+// pages.h, chunks are cut from huge page regions instead of taken from malloc one by one.
+//
+// Sanitizer builds hand every slot to malloc instead, so use-after-free stays detectable; sizes
+// are reported the same way, and every live block counts as one reserved slot.
+
+// Slot sizes go up in steps of this many bytes, which is also the alignment of a slot
+#define SLAB_GRANULARITY 8
+// Largest size served by a pool; bigger requests go to malloc
+#define SLAB_MAX_SIZE 128
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULARITY)
+// Bytes taken from malloc whenever a class runs out of slots
+#define SLAB_CHUNK_SIZE (64 * 1024)
+// Bytes chunks are cut from at once when pages.h maps large blocks on huge pages: as many chunks
+// as fit in a huge page along with the header of pages_alloc
+#define SLAB_REGION_SIZE (31 * SLAB_CHUNK_SIZE)
+// Slots moved between a thread and the shared pool at once; a thread holds at most twice this many
+#define SLAB_CACHE_BATCH 64
+
+typedef struct SlabStats
+{
+  size_t slot_size;
+  // Counted by each thread and published whenever it trades a batch with the pool, so they lag
+  // by at most a couple of batches per thread
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t chunks;
+  // Slots carved out of the chunks so far
+  uint64_t slots;
+  // Bytes taken from malloc for the chunks
+  size_t reserved_bytes;
+} SlabStats;
+
+// Allocates `size` bytes from the pool of its class; exits if out of memory
+void *slab_alloc(size_t size);
+
+// Returns a block of slab_alloc to its pool; `size` must be the one it was allocated with
+void slab_free(void *pointer, size_t size);
+
+// Bytes a block of `size` takes, which memory accounting counts instead of malloc_usable_size
+size_t slab_size(size_t size);
+
+// Copies the counters of the class `index`, 0 being the smallest slot size
+void slab_stats(db_uint_t index, SlabStats *stats);
+
+#endif
@@ -0,0 +1,1062 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <threads.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "list.h"
+#include "quicklist.h"
+#include "rope.h"
+#include "hash.h"
+#include "hashobj.h"
+#include "zset.h"
+#include "uring.h"
+#include "snapshot.h"
+
+// Smallest record: type, key length and an empty string value
+#define SNAPSHOT_MIN_RECORD_LENGTH 9
+// Magic, version and the two counts
+#define SNAPSHOT_HEADER_LENGTH 21
+
+typedef struct SnapshotWriter
+{
+  int fd;
+  // With a ring, one buffer is written out while the next is filled
+  DBUring *ring;
+  uint8_t buffers[2][SNAPSHOT_BUFFER_SIZE];
+  uint8_t *buffer;
+  size_t length;
+  // Bytes of the write in flight, and where the next write goes
+  size_t in_flight;
+  int64_t offset;
+  uint32_t crc;
+  db_bool_t failed;
+  SnapshotProgress *progress;
+  unsigned long long saved_keys;
+  // Deadlines of the table being written, NULL if it has none
+  DBHash *expires;
+  // Records are collected here while `is_in_chunk` is set, then framed as a chunk once it is full
+  uint8_t *chunk;
+  size_t chunk_length;
+  size_t chunk_capacity;
+  db_uint_t chunk_records;
+  db_bool_t is_in_chunk;
+} SnapshotWriter;
+
+// Reads a file through `buffer`, or a chunk already held in `buffer` when `file` is NULL
+typedef struct SnapshotReader
+{
+  FILE *file;
+  uint8_t *buffer;
+  size_t position;
+  size_t length;
+  uint32_t crc;
+  db_bool_t failed;
+} SnapshotReader;
+
+typedef struct SnapshotChunk
+{
+  uint8_t *data;
+  size_t length;
+  db_uint_t records;
+  struct SnapshotChunk *next;
+} SnapshotChunk;
+
+// Chunks handed from the reading thread to the decoding threads
+typedef struct SnapshotDecoderPool
+{
+  mtx_t lock;
+  // Signalled whenever a chunk is queued or taken, and when the pool closes
+  cnd_t cond;
+  SnapshotChunk *head;
+  SnapshotChunk *tail;
+  db_uint_t pending;
+  db_uint_t max_pending;
+  db_bool_t is_closing;
+  db_bool_t failed;
+  snapshot_chunk_handler_t handler;
+  void *context;
+} SnapshotDecoderPool;
+
+// Lets snapshot_load hand its entries to a per-entry handler
+typedef struct SnapshotEntryAdapter
+{
+  snapshot_entry_handler_t handler;
+  void *context;
+} SnapshotEntryAdapter;
+
+static uint32_t crc32_table[256];
+static db_bool_t crc32_table_ready = false;
+
+// Computes the standard CRC-32 (IEEE 802.3) table on first use
+static void crc32_init();
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+
+static void crc32_init()
+{
+  if (crc32_table_ready)
+    return;
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    crc32_table[i] = c;
+  }
+  crc32_table_ready = true;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+  crc = ~crc;
+  while (length--)
+    crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void writer_wait(SnapshotWriter *writer)
+{
+  int32_t result;
+  if (!writer->in_flight)
+    return;
+  if (!uring_complete(writer->ring, true, NULL, &result) || result != (int32_t)writer->in_flight)
+    writer->failed = true;
+  writer->in_flight = 0;
+}
+
+static void writer_flush(SnapshotWriter *writer)
+{
+  if (!writer->length)
+    return;
+
+  if (!writer->ring)
+  {
+    if (!uring_write_all(writer->fd, writer->buffer, writer->length, false))
+      writer->failed = true;
+    writer->length = 0;
+    return;
+  }
+
+  writer_wait(writer);
+  if (uring_prep_write(writer->ring, writer->fd, writer->buffer, writer->length, writer->offset, false, 0) &&
+      uring_submit(writer->ring, 0))
+  {
+    writer->in_flight = writer->length;
+    writer->buffer = writer->buffer == writer->buffers[0] ? writer->buffers[1] : writer->buffers[0];
+  }
+  else
+    writer->failed = true;
+  writer->offset += writer->length;
+  writer->length = 0;
+}
+
+static void writer_append_chunk(SnapshotWriter *writer, const uint8_t *bytes, size_t length)
+{
+  if (writer->chunk_length + length > writer->chunk_capacity)
+  {
+    size_t capacity = writer->chunk_capacity ? writer->chunk_capacity : SNAPSHOT_CHUNK_SIZE;
+    while (capacity < writer->chunk_length + length)
+      capacity *= 2;
+    uint8_t *chunk = (uint8_t *)realloc(writer->chunk, capacity);
+    if (!chunk)
+      EXIT_ON_MEMORY_ERROR();
+    writer->chunk = chunk;
+    writer->chunk_capacity = capacity;
+  }
+  memcpy(writer->chunk + writer->chunk_length, bytes, length);
+  writer->chunk_length += length;
+}
+
+static void writer_write(SnapshotWriter *writer, const void *data, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  size_t chunk;
+
+  if (writer->is_in_chunk)
+  {
+    writer_append_chunk(writer, bytes, length);
+    return;
+  }
+
+  writer->crc = crc32_update(writer->crc, bytes, length);
+  while (length)
+  {
+    if (writer->length == SNAPSHOT_BUFFER_SIZE)
+      writer_flush(writer);
+    chunk = SNAPSHOT_BUFFER_SIZE - writer->length;
+    chunk = chunk < length ? chunk : length;
+    memcpy(writer->buffer + writer->length, bytes, chunk);
+    writer->length += chunk;
+    bytes += chunk, length -= chunk;
+  }
+}
+
+static void writer_write_u8(SnapshotWriter *writer, uint8_t value)
+{
+  writer_write(writer, &value, 1);
+}
+
+static void writer_write_u32(SnapshotWriter *writer, uint32_t value)
+{
+  uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+  writer_write(writer, bytes, 4);
+}
+
+static void writer_write_u64(SnapshotWriter *writer, uint64_t value)
+{
+  writer_write_u32(writer, (uint32_t)value);
+  writer_write_u32(writer, (uint32_t)(value >> 32));
+}
+
+static void writer_write_string(SnapshotWriter *writer, const char *string)
+{
+  size_t length = string ? strlen(string) : 0;
+  writer_write_u32(writer, (uint32_t)length);
+  writer_write(writer, string, length);
+}
+
+// Same framing as a string, written a chunk at a time
+static void writer_write_rope(SnapshotWriter *writer, const DBRope *rope)
+{
+  writer_write_u32(writer, (uint32_t)rope->size);
+  for (db_uint_t i = 0; i < rope->length; ++i)
+    writer_write(writer, rope->chunks[i]->data, rope->chunks[i]->length);
+}
+
+static void writer_write_double(SnapshotWriter *writer, db_double_t value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  writer_write_u64(writer, bits);
+}
+
+// Frames the collected records as a chunk and writes it to the file
+static void writer_close_chunk(SnapshotWriter *writer)
+{
+  if (!writer->chunk_records)
+    return;
+  if (writer->chunk_length > SNAPSHOT_MAX_CHUNK_LENGTH)
+    writer->failed = true;
+
+  writer->is_in_chunk = false;
+  writer_write_u8(writer, SNAPSHOT_OPCODE_CHUNK);
+  writer_write_u32(writer, writer->chunk_records);
+  writer_write_u32(writer, (uint32_t)writer->chunk_length);
+  writer_write(writer, writer->chunk, writer->chunk_length);
+  writer->is_in_chunk = true;
+  writer->chunk_length = 0;
+  writer->chunk_records = 0;
+}
+
+// Calls `write_entry` for every entry of both tables of a hash while it is rehashing
+static void writer_write_table_entries(SnapshotWriter *writer, DBHash *ht, void (*write_entry)(SnapshotWriter *, DBHashEntry *))
+{
+  DBHashEntry *entry;
+
+  for (db_uint_t i = 0; ht->buckets0 && i < ht->size0; ++i)
+    for (entry = ht->buckets0[i]; entry; entry = entry->next)
+      write_entry(writer, entry);
+
+  for (db_uint_t i = 0; ht->buckets1 && i < ht->size1; ++i)
+    for (entry = ht->buckets1[i]; entry; entry = entry->next)
+      write_entry(writer, entry);
+}
+
+static void writer_write_entry(SnapshotWriter *writer, DBHashEntry *entry)
+{
+  DBObj *obj = entry->data;
+  DBQuickListIter iter;
+  const char *string;
+  DBHashObjIter hash_iter;
+  const char *field;
+  DBZSetIter zset_iter;
+  const char *member;
+  db_double_t score;
+
+  // The entry keeps the deadline at full precision; the expiry table only counts it.
+  if (writer->expires && entry->expire_at_ms)
+  {
+    writer_write_u8(writer, SNAPSHOT_OPCODE_EXPIRETIME_MS);
+    writer_write_u64(writer, entry->expire_at_ms);
+  }
+
+  switch (obj->type)
+  {
+  case DB_TYPE_STRING:
+    writer_write_u8(writer, SNAPSHOT_TYPE_STRING);
+    writer_write_string(writer, entry->key);
+    if (obj->encoding == DB_ENCODING_ROPE)
+      writer_write_rope(writer, obj->value.rope);
+    else
+      writer_write_string(writer, obj->value.string);
+    break;
+  case DB_TYPE_LIST:
+    writer_write_u8(writer, SNAPSHOT_TYPE_LIST);
+    writer_write_string(writer, entry->key);
+    writer_write_u32(writer, obj->value.quicklist->length);
+    ql_iter_init(obj->value.quicklist, &iter);
+    while ((string = ql_iter_next(&iter, NULL)))
+      writer_write_string(writer, string);
+    break;
+  case DB_TYPE_HASH:
+    writer_write_u8(writer, SNAPSHOT_TYPE_HASH);
+    writer_write_string(writer, entry->key);
+    writer_write_u32(writer, hashobj_length(obj));
+    hashobj_iter_init(obj, &hash_iter);
+    while ((field = hashobj_iter_next(&hash_iter, &string)))
+    {
+      writer_write_string(writer, field);
+      writer_write_string(writer, string);
+    }
+    break;
+  case DB_TYPE_ZSET:
+    writer_write_u8(writer, SNAPSHOT_TYPE_ZSET);
+    writer_write_string(writer, entry->key);
+    writer_write_u32(writer, zcard(obj->value.zset));
+    zset_iter_init(obj->value.zset, &zset_iter);
+    while ((member = zset_iter_next(&zset_iter, &score)))
+    {
+      writer_write_string(writer, member);
+      writer_write_double(writer, score);
+    }
+    break;
+  default:
+    break;
+  }
+
+  ++writer->chunk_records;
+  if (writer->chunk_length >= SNAPSHOT_CHUNK_SIZE)
+    writer_close_chunk(writer);
+
+  if (writer->progress)
+    atomic_store_explicit(&writer->progress->saved_keys, ++writer->saved_keys, memory_order_relaxed);
+}
+
+db_bool_t snapshot_save(const char *filepath, DBHash **tables, DBHash **expires_tables, db_uint_t tables_length, SnapshotProgress *progress)
+{
+  if (!filepath)
+    return false;
+
+  crc32_init();
+
+  size_t filepath_length = strlen(filepath);
+  char *temp_filepath = (char *)malloc(filepath_length + 5);
+  if (!temp_filepath)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(temp_filepath, filepath, filepath_length);
+  memcpy(temp_filepath + filepath_length, ".tmp", 5);
+
+  SnapshotWriter *writer = (SnapshotWriter *)malloc(sizeof(SnapshotWriter));
+  if (!writer)
+    EXIT_ON_MEMORY_ERROR();
+  writer->buffer = writer->buffers[0];
+  writer->length = 0;
+  writer->in_flight = 0;
+  writer->offset = 0;
+  writer->ring = uring_thread();
+  writer->crc = 0;
+  writer->failed = false;
+  writer->progress = progress;
+  writer->saved_keys = 0;
+  writer->expires = NULL;
+  writer->chunk = NULL;
+  writer->chunk_length = 0;
+  writer->chunk_capacity = 0;
+  writer->chunk_records = 0;
+  writer->is_in_chunk = false;
+  writer->fd = open(temp_filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (writer->fd < 0)
+  {
+    perror("Failed to open file while saving.");
+    free(writer);
+    free(temp_filepath);
+    return false;
+  }
+
+  uint64_t key_count = 0, expires_count = 0;
+  for (db_uint_t i = 0; i < tables_length; ++i)
+  {
+    key_count += tables[i]->count0 + tables[i]->count1;
+    if (expires_tables && expires_tables[i])
+      expires_count += expires_tables[i]->count0 + expires_tables[i]->count1;
+  }
+
+  writer_write(writer, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+  writer_write_u8(writer, SNAPSHOT_VERSION);
+  writer_write_u64(writer, key_count);
+  writer_write_u64(writer, expires_count);
+
+  writer->is_in_chunk = true;
+  for (db_uint_t i = 0; i < tables_length; ++i)
+  {
+    writer->expires = expires_tables ? expires_tables[i] : NULL;
+    writer_write_table_entries(writer, tables[i], writer_write_entry);
+  }
+  writer_close_chunk(writer);
+  writer->is_in_chunk = false;
+  writer_write_u8(writer, SNAPSHOT_OPCODE_EOF);
+
+  uint32_t crc = writer->crc;
+  uint8_t crc_bytes[4] = {crc, crc >> 8, crc >> 16, crc >> 24};
+  writer_write(writer, crc_bytes, 4);
+  writer_flush(writer);
+  writer_wait(writer);
+
+  db_bool_t is_success = !writer->failed;
+  if (close(writer->fd) != 0)
+    is_success = false;
+
+  // Only replace the previous snapshot once the new one is complete.
+  if (is_success && rename(temp_filepath, filepath) != 0)
+    is_success = false;
+  if (!is_success)
+  {
+    perror("Failed to write snapshot.");
+    remove(temp_filepath);
+  }
+
+  free(writer->chunk);
+  free(writer);
+  free(temp_filepath);
+  return is_success;
+}
+
+static void reader_read(SnapshotReader *reader, void *data, size_t length)
+{
+  uint8_t *bytes = (uint8_t *)data;
+  size_t chunk;
+
+  while (length && !reader->failed)
+  {
+    if (reader->position == reader->length)
+    {
+      reader->length = reader->file ? fread(reader->buffer, 1, SNAPSHOT_BUFFER_SIZE, reader->file) : 0;
+      reader->position = 0;
+      if (!reader->length)
+      {
+        reader->failed = true;
+        break;
+      }
+    }
+    chunk = reader->length - reader->position;
+    chunk = chunk < length ? chunk : length;
+    memcpy(bytes, reader->buffer + reader->position, chunk);
+    // The bytes of a chunk in memory were checksummed as they were read from the file.
+    if (reader->file)
+      reader->crc = crc32_update(reader->crc, bytes, chunk);
+    reader->position += chunk;
+    bytes += chunk, length -= chunk;
+  }
+
+  // Leave the destination zeroed so a failed read never yields garbage lengths.
+  if (length)
+    memset(bytes, 0, length);
+}
+
+static uint8_t reader_read_u8(SnapshotReader *reader)
+{
+  uint8_t value;
+  reader_read(reader, &value, 1);
+  return value;
+}
+
+static uint32_t reader_read_u32(SnapshotReader *reader)
+{
+  uint8_t bytes[4];
+  reader_read(reader, bytes, 4);
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t reader_read_u64(SnapshotReader *reader)
+{
+  uint64_t low = reader_read_u32(reader);
+  return low | (uint64_t)reader_read_u32(reader) << 32;
+}
+
+static db_double_t reader_read_double(SnapshotReader *reader)
+{
+  uint64_t bits = reader_read_u64(reader);
+  db_double_t value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static char *reader_read_string(SnapshotReader *reader)
+{
+  uint32_t length = reader_read_u32(reader);
+  if (reader->failed || length > SNAPSHOT_MAX_STRING_LENGTH)
+  {
+    reader->failed = true;
+    return NULL;
+  }
+
+  char *string = (char *)malloc(length + 1);
+  if (!string)
+    EXIT_ON_MEMORY_ERROR();
+  reader_read(reader, string, length);
+  string[length] = '\0';
+  return string;
+}
+
+// A string value, read into a rope a chunk at a time when it is long enough to be stored as one
+static DBObj *reader_read_string_value(SnapshotReader *reader)
+{
+  uint32_t length = reader_read_u32(reader);
+  if (reader->failed || length > SNAPSHOT_MAX_STRING_LENGTH)
+  {
+    reader->failed = true;
+    return NULL;
+  }
+  if (length < ROPE_MIN_LENGTH)
+  {
+    char *string = (char *)malloc(length + 1);
+    if (!string)
+      EXIT_ON_MEMORY_ERROR();
+    reader_read(reader, string, length);
+    string[length] = '\0';
+    return dbobj_try_share_integer(dbobj_create_string(string));
+  }
+
+  DBRope *rope = rope_create();
+  char piece[ROPE_CHUNK_SIZE];
+  for (size_t left = length, count; left && !reader->failed; left -= count)
+  {
+    count = left < ROPE_CHUNK_SIZE ? left : ROPE_CHUNK_SIZE;
+    reader_read(reader, piece, count);
+    rope_append(rope, piece, count);
+  }
+  return dbobj_create_rope(rope);
+}
+
+static DBObj *reader_read_value(SnapshotReader *reader, uint8_t type)
+{
+  db_uint_t count;
+  char *field, *value;
+
+  switch (type)
+  {
+  case SNAPSHOT_TYPE_STRING:
+    return reader_read_string_value(reader);
+  case SNAPSHOT_TYPE_LIST:
+  {
+    DBQuickList *list = ql_create();
+    count = reader_read_u32(reader);
+    for (db_uint_t i = 0; i < count && !reader->failed; ++i)
+    {
+      value = reader_read_string(reader);
+      ql_rpush(list, value);
+      free(value);
+    }
+    return dbobj_create_quicklist(list);
+  }
+  case SNAPSHOT_TYPE_HASH:
+  {
+    DBObj *hash = hashobj_create();
+    count = reader_read_u32(reader);
+    for (db_uint_t i = 0; i < count && !reader->failed; ++i)
+    {
+      field = reader_read_string(reader);
+      value = reader_read_string(reader);
+      if (field && value)
+        hashobj_set(hash, field, value);
+      free(value);
+      free(field);
+    }
+    return hash;
+  }
+  case SNAPSHOT_TYPE_ZSET:
+  {
+    // the members are read first and built into the set at once; the array grows as they come,
+    // since a corrupted count could be anything
+    DBZSet *zset = zset_create();
+    db_double_t score;
+    count = reader_read_u32(reader);
+    db_uint_t length = 0, capacity = 64;
+    DBZSetPair *pairs = (DBZSetPair *)malloc(capacity * sizeof(DBZSetPair));
+    if (!pairs)
+      EXIT_ON_MEMORY_ERROR();
+    for (db_uint_t i = 0; i < count && !reader->failed; ++i)
+    {
+      field = reader_read_string(reader);
+      score = reader_read_double(reader);
+      if (!field)
+        continue;
+      if (length == capacity)
+      {
+        capacity *= 2;
+        DBZSetPair *new_pairs = (DBZSetPair *)realloc(pairs, capacity * sizeof(DBZSetPair));
+        if (!new_pairs)
+          EXIT_ON_MEMORY_ERROR();
+        pairs = new_pairs;
+      }
+      pairs[length++] = (DBZSetPair){.member = field, .length = strlen(field), .score = score};
+    }
+    zadd_bulk(zset, pairs, length);
+    for (db_uint_t i = 0; i < length; ++i)
+      free((char *)pairs[i].member);
+    free(pairs);
+    return dbobj_create_zset(zset);
+  }
+  default:
+    reader->failed = true;
+    return NULL;
+  }
+}
+
+// Reads the record that starts with the opcode `type`; returns false, owning nothing, if it is corrupted
+static db_bool_t reader_read_entry(SnapshotReader *reader, uint8_t type, SnapshotEntry *entry)
+{
+  entry->expire_at_ms = 0;
+  if (type == SNAPSHOT_OPCODE_EXPIRETIME_MS)
+  {
+    entry->expire_at_ms = reader_read_u64(reader);
+    type = reader_read_u8(reader);
+  }
+  entry->key = reader_read_string(reader);
+  entry->value = reader->failed ? NULL : reader_read_value(reader, type);
+  if (reader->failed)
+  {
+    free(entry->key);
+    free_dbobj(entry->value);
+    return false;
+  }
+  return true;
+}
+
+// Decodes every record of a chunk and hands them over at once; returns false if the chunk is corrupted
+static db_bool_t snapshot_decode_chunk(SnapshotChunk *chunk, snapshot_chunk_handler_t handler, void *context)
+{
+  SnapshotReader reader = {NULL, chunk->data, 0, chunk->length, 0, false};
+  SnapshotEntry *entries = (SnapshotEntry *)malloc((chunk->records ? chunk->records : 1) * sizeof(SnapshotEntry));
+  if (!entries)
+    EXIT_ON_MEMORY_ERROR();
+
+  db_uint_t length = 0;
+  while (length < chunk->records && reader_read_entry(&reader, reader_read_u8(&reader), &entries[length]))
+    ++length;
+
+  if (length)
+    handler(entries, length, context);
+  free(entries);
+  return length == chunk->records && reader.position == reader.length;
+}
+
+static void snapshot_free_chunk(SnapshotChunk *chunk)
+{
+  free(chunk->data);
+  free(chunk);
+}
+
+static int snapshot_decoder_worker(void *arg)
+{
+  SnapshotDecoderPool *pool = (SnapshotDecoderPool *)arg;
+  SnapshotChunk *chunk;
+  db_bool_t is_success;
+
+  while (true)
+  {
+    mtx_lock(&pool->lock);
+    while (!pool->head && !pool->is_closing)
+      cnd_wait(&pool->cond, &pool->lock);
+    chunk = pool->head;
+    if (chunk)
+    {
+      pool->head = chunk->next;
+      if (!pool->head)
+        pool->tail = NULL;
+      --pool->pending;
+      cnd_broadcast(&pool->cond);
+    }
+    mtx_unlock(&pool->lock);
+
+    if (!chunk)
+      return 0;
+
+    is_success = snapshot_decode_chunk(chunk, pool->handler, pool->context);
+    snapshot_free_chunk(chunk);
+    if (!is_success)
+    {
+      mtx_lock(&pool->lock);
+      pool->failed = true;
+      mtx_unlock(&pool->lock);
+    }
+  }
+}
+
+// Queues a chunk for the decoders, waiting while too many of them are read ahead
+static void snapshot_decoder_push(SnapshotDecoderPool *pool, SnapshotChunk *chunk)
+{
+  mtx_lock(&pool->lock);
+  while (pool->pending >= pool->max_pending)
+    cnd_wait(&pool->cond, &pool->lock);
+  if (pool->tail)
+    pool->tail->next = chunk;
+  else
+    pool->head = chunk;
+  pool->tail = chunk;
+  ++pool->pending;
+  cnd_broadcast(&pool->cond);
+  mtx_unlock(&pool->lock);
+}
+
+db_bool_t snapshot_is_snapshot_file(const char *filepath)
+{
+  char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+  FILE *file = filepath ? fopen(filepath, "rb") : NULL;
+
+  if (!file)
+    return false;
+
+  db_bool_t is_snapshot = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+  return is_snapshot;
+}
+
+db_bool_t snapshot_load_parallel(const char *filepath, db_uint_t threads, snapshot_reserve_handler_t reserve_handler,
+                                 snapshot_chunk_handler_t chunk_handler, void *context)
+{
+  if (!filepath || !chunk_handler)
+    return false;
+
+  crc32_init();
+
+  SnapshotReader *reader = (SnapshotReader *)malloc(sizeof(SnapshotReader));
+  if (!reader)
+    EXIT_ON_MEMORY_ERROR();
+  reader->position = 0;
+  reader->length = 0;
+  reader->crc = 0;
+  reader->failed = false;
+  reader->file = fopen(filepath, "rb");
+  if (!reader->file)
+  {
+    free(reader);
+    return false;
+  }
+  reader->buffer = (uint8_t *)malloc(SNAPSHOT_BUFFER_SIZE);
+  if (!reader->buffer)
+    EXIT_ON_MEMORY_ERROR();
+
+  char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+  reader_read(reader, magic, sizeof(magic));
+  uint8_t version = reader_read_u8(reader);
+  if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || version < SNAPSHOT_MIN_VERSION || version > SNAPSHOT_VERSION)
+    reader->failed = true;
+
+  uint64_t key_count = 0, expires_count = 0;
+  if (!reader->failed && version >= SNAPSHOT_CHUNKED_VERSION)
+  {
+    key_count = reader_read_u64(reader);
+    expires_count = reader_read_u64(reader);
+  }
+  if (!reader->failed && reserve_handler)
+  {
+    // The counts are only verified by the checksum at the end, never presize beyond what the file could hold.
+    struct stat file_stat;
+    uint64_t max_count = fstat(fileno(reader->file), &file_stat) == 0 ? (uint64_t)file_stat.st_size / SNAPSHOT_MIN_RECORD_LENGTH : 0;
+    reserve_handler(key_count < max_count ? key_count : max_count, expires_count < max_count ? expires_count : max_count, context);
+  }
+
+  SnapshotDecoderPool pool;
+  pool.head = NULL;
+  pool.tail = NULL;
+  pool.pending = 0;
+  pool.max_pending = threads * SNAPSHOT_CHUNKS_IN_FLIGHT_PER_THREAD;
+  pool.is_closing = false;
+  pool.failed = false;
+  pool.handler = chunk_handler;
+  pool.context = context;
+
+  thrd_t *decoders = NULL;
+  db_uint_t decoders_length = 0;
+  if (threads > 1)
+  {
+    mtx_init(&pool.lock, mtx_plain);
+    cnd_init(&pool.cond);
+    decoders = (thrd_t *)malloc(threads * sizeof(thrd_t));
+    if (!decoders)
+      EXIT_ON_MEMORY_ERROR();
+    while (decoders_length < threads && thrd_create(&decoders[decoders_length], snapshot_decoder_worker, &pool) == thrd_success)
+      ++decoders_length;
+  }
+
+  uint8_t type;
+  SnapshotEntry entry;
+  SnapshotChunk *chunk;
+  db_bool_t is_inline_success = true;
+
+  while (!reader->failed && is_inline_success)
+  {
+    type = reader_read_u8(reader);
+    if (type == SNAPSHOT_OPCODE_EOF)
+      break;
+
+    if (type != SNAPSHOT_OPCODE_CHUNK)
+    {
+      // Records of snapshots older than version 3 are not framed in chunks.
+      if (version >= SNAPSHOT_CHUNKED_VERSION || !reader_read_entry(reader, type, &entry))
+        reader->failed = true;
+      else
+        chunk_handler(&entry, 1, context);
+      continue;
+    }
+
+    uint32_t records = reader_read_u32(reader);
+    uint32_t length = reader_read_u32(reader);
+    if (reader->failed || length > SNAPSHOT_MAX_CHUNK_LENGTH || records > length / SNAPSHOT_MIN_RECORD_LENGTH)
+    {
+      reader->failed = true;
+      break;
+    }
+    chunk = (SnapshotChunk *)malloc(sizeof(SnapshotChunk));
+    if (!chunk)
+      EXIT_ON_MEMORY_ERROR();
+    chunk->data = (uint8_t *)malloc(length ? length : 1);
+    if (!chunk->data)
+      EXIT_ON_MEMORY_ERROR();
+    chunk->length = length;
+    chunk->records = records;
+    chunk->next = NULL;
+    reader_read(reader, chunk->data, length);
+    if (reader->failed)
+      snapshot_free_chunk(chunk);
+    else if (decoders_length)
+      snapshot_decoder_push(&pool, chunk);
+    else
+    {
+      is_inline_success = snapshot_decode_chunk(chunk, chunk_handler, context);
+      snapshot_free_chunk(chunk);
+    }
+  }
+
+  uint32_t expected_crc = reader->crc;
+  db_bool_t is_success = !reader->failed && is_inline_success && reader_read_u32(reader) == expected_crc && !reader->failed;
+
+  if (threads > 1)
+  {
+    mtx_lock(&pool.lock);
+    pool.is_closing = true;
+    cnd_broadcast(&pool.cond);
+    mtx_unlock(&pool.lock);
+    for (db_uint_t i = 0; i < decoders_length; ++i)
+      thrd_join(decoders[i], NULL);
+    is_success = is_success && !pool.failed;
+    cnd_destroy(&pool.cond);
+    mtx_destroy(&pool.lock);
+    free(decoders);
+  }
+
+  fclose(reader->file);
+  free(reader->buffer);
+  free(reader);
+  return is_success;
+}
+
+static void snapshot_adapt_chunk(SnapshotEntry *entries, db_uint_t length, void *context)
+{
+  SnapshotEntryAdapter *adapter = (SnapshotEntryAdapter *)context;
+
+  for (db_uint_t i = 0; i < length; ++i)
+    adapter->handler(entries[i].key, entries[i].value, entries[i].expire_at_ms, adapter->context);
+}
+
+db_bool_t snapshot_load(const char *filepath, snapshot_entry_handler_t handler, void *context)
+{
+  if (!handler)
+    return false;
+
+  SnapshotEntryAdapter adapter = {handler, context};
+  return snapshot_load_parallel(filepath, 1, NULL, snapshot_adapt_chunk, &adapter);
+}
+
+static inline uint32_t map_read_u32(const uint8_t *bytes)
+{
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static inline uint64_t map_read_u64(const uint8_t *bytes)
+{
+  return map_read_u32(bytes) | (uint64_t)map_read_u32(bytes + 4) << 32;
+}
+
+// Steps over a string that must end by `end`; NULL if it doesn't
+static const uint8_t *map_skip_string(const uint8_t *position, const uint8_t *end)
+{
+  if (end - position < 4)
+    return NULL;
+  uint32_t length = map_read_u32(position);
+  if (length > SNAPSHOT_MAX_STRING_LENGTH || (size_t)(end - position - 4) < length)
+    return NULL;
+  return position + 4 + length;
+}
+
+// Steps over a value that must end by `end`; NULL if it doesn't or its type is unknown
+static const uint8_t *map_skip_value(uint8_t type, const uint8_t *position, const uint8_t *end)
+{
+  if (type == SNAPSHOT_TYPE_STRING)
+    return map_skip_string(position, end);
+  if (type > SNAPSHOT_TYPE_ZSET || end - position < 4)
+    return NULL;
+
+  uint32_t count = map_read_u32(position);
+  position += 4;
+  for (uint32_t i = 0; i < count && position; ++i)
+  {
+    position = map_skip_string(position, end);
+    if (position && type == SNAPSHOT_TYPE_HASH)
+      position = map_skip_string(position, end);
+    else if (position && type == SNAPSHOT_TYPE_ZSET)
+      position = end - position < 8 ? NULL : position + 8;
+  }
+  return position;
+}
+
+// Checks the framing of every chunk and record, handing the records over as it goes
+static db_bool_t snapshot_map_walk(const SnapshotMap *map, snapshot_record_handler_t handler, void *context)
+{
+  const uint8_t *position = map->data + SNAPSHOT_HEADER_LENGTH;
+  const uint8_t *end = map->data + map->length;
+  if (memcmp(map->data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1) != 0 || map->data[4] != SNAPSHOT_CHUNKED_VERSION)
+    return false;
+
+  while (position < end && *position == SNAPSHOT_OPCODE_CHUNK)
+  {
+    if (end - position < 9)
+      return false;
+    uint32_t records = map_read_u32(position + 1);
+    uint32_t payload = map_read_u32(position + 5);
+    position += 9;
+    if (payload > SNAPSHOT_MAX_CHUNK_LENGTH || (size_t)(end - position) < payload)
+      return false;
+
+    const uint8_t *chunk_end = position + payload;
+    for (uint32_t i = 0; i < records; ++i)
+    {
+      const uint8_t *record = position;
+      if (position < chunk_end && *position == SNAPSHOT_OPCODE_EXPIRETIME_MS)
+        position += 9;
+      if (chunk_end - position < 5)
+        return false;
+      uint8_t type = *position++;
+      const uint8_t *key = position + 4;
+      position = map_skip_string(position, chunk_end);
+      if (!position || !(position = map_skip_value(type, position, chunk_end)))
+        return false;
+      handler((const char *)key, map_read_u32(key - 4), record, context);
+    }
+    if (position != chunk_end)
+      return false;
+  }
+  return end - position == 5 && *position == SNAPSHOT_OPCODE_EOF;
+}
+
+SnapshotMap *snapshot_map(const char *filepath, snapshot_record_handler_t handler, void *context)
+{
+  struct stat st;
+  int fd = filepath && handler ? open(filepath, O_RDONLY) : -1;
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_HEADER_LENGTH + 5)
+  {
+    close(fd);
+    return NULL;
+  }
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  SnapshotMap *map = (SnapshotMap *)malloc(sizeof(SnapshotMap));
+  if (!map)
+    EXIT_ON_MEMORY_ERROR();
+  map->data = (const uint8_t *)data;
+  map->length = (size_t)st.st_size;
+
+  // The records are walked front to back once, then only the values asked for are read.
+  madvise(data, map->length, MADV_SEQUENTIAL);
+  db_bool_t is_valid = snapshot_map_walk(map, handler, context);
+  madvise(data, map->length, MADV_RANDOM);
+  if (!is_valid)
+  {
+    snapshot_unmap(map);
+    return NULL;
+  }
+  return map;
+}
+
+void snapshot_unmap(SnapshotMap *map)
+{
+  if (!map)
+    return;
+  munmap((void *)map->data, map->length);
+  free(map);
+}
+
+uint64_t snapshot_map_expire_at(const uint8_t *record)
+{
+  return *record == SNAPSHOT_OPCODE_EXPIRETIME_MS ? map_read_u64(record + 1) : 0;
+}
+
+uint8_t snapshot_map_type(const uint8_t *record)
+{
+  return *record == SNAPSHOT_OPCODE_EXPIRETIME_MS ? record[9] : record[0];
+}
+
+// Where the value of a record starts, past its key
+static const uint8_t *map_value(const uint8_t *record)
+{
+  if (*record == SNAPSHOT_OPCODE_EXPIRETIME_MS)
+    record += 9;
+  return record + 5 + map_read_u32(record + 1);
+}
+
+DBObj *snapshot_map_decode(const uint8_t *record)
+{
+  // snapshot_map checked that the value ends within its chunk, so it is read without bounds.
+  SnapshotReader reader = {NULL, (uint8_t *)map_value(record), 0, SIZE_MAX, 0, false};
+  return reader_read_value(&reader, snapshot_map_type(record));
+}
+
+db_uint_t snapshot_map_iter_init(const uint8_t *record, SnapshotMapIter *iter)
+{
+  const uint8_t *value = map_value(record);
+  iter->type = snapshot_map_type(record);
+  if (iter->type == SNAPSHOT_TYPE_STRING)
+  {
+    iter->position = value;
+    iter->remaining = 1;
+  }
+  else
+  {
+    iter->position = value + 4;
+    iter->remaining = (db_uint_t)map_read_u32(value) * (iter->type == SNAPSHOT_TYPE_HASH ? 2 : 1);
+  }
+  return iter->remaining;
+}
+
+const char *snapshot_map_iter_next(SnapshotMapIter *iter, db_uint_t *length, db_double_t *score)
+{
+  if (!iter->remaining)
+    return NULL;
+  --iter->remaining;
+  *length = map_read_u32(iter->position);
+  const char *string = (const char *)iter->position + 4;
+  iter->position += 4 + *length;
+  if (iter->type == SNAPSHOT_TYPE_ZSET)
+  {
+    if (score)
+    {
+      uint64_t bits = map_read_u64(iter->position);
+      memcpy(score, &bits, sizeof(*score));
+    }
+    iter->position += 8;
+  }
+  return string;
+}
@@ -0,0 +1,141 @@
+#ifndef DB_SNAPSHOT_H
+#define DB_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "types.h"
+
+// Binary snapshot layout, every integer is little-endian:
+//   magic "CCDB", version (u8), key count (u64), count of keys with a deadline (u64)
+//   chunks: chunk opcode (u8), record count (u32), payload length (u32), payload of records
+//   record: [expire opcode (u8), unix time in milliseconds (u64)], type (u8), key length (u32), key, value
+//     string: length (u32), bytes
+//     list:   count (u32), count * string
+//     hash:   count (u32), count * (field string, value string)
+//     zset:   count (u32), count * (member string, score as IEEE 754 bits (u64)), in score order
+//   eof opcode (u8), CRC-32 of every byte before it (u32)
+#define SNAPSHOT_MAGIC "CCDB"
+#define SNAPSHOT_VERSION 3
+// Versions 1 and 2 had neither the counts nor chunks, their records follow the version directly;
+// version 1 had no expiry opcode either. Both are still read
+#define SNAPSHOT_MIN_VERSION 1
+#define SNAPSHOT_CHUNKED_VERSION 3
+
+// Size of the buffer between the snapshot and the file; the dataset is never serialized as a whole
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+
+// A chunk is closed once its payload passes this size; a single record bigger than it gets a chunk of its own
+#define SNAPSHOT_CHUNK_SIZE (256 * 1024)
+
+// Longest string a snapshot may hold, anything longer is treated as corruption
+#define SNAPSHOT_MAX_STRING_LENGTH (512 * 1024 * 1024)
+#define SNAPSHOT_MAX_CHUNK_LENGTH (1024 * 1024 * 1024)
+
+// Chunks read ahead of the decoders per decoding thread
+#define SNAPSHOT_CHUNKS_IN_FLIGHT_PER_THREAD 2
+
+typedef enum snapshot_type_t
+{
+  SNAPSHOT_TYPE_STRING = 0,
+  SNAPSHOT_TYPE_LIST = 1,
+  SNAPSHOT_TYPE_HASH = 2,
+  SNAPSHOT_TYPE_ZSET = 3,
+  SNAPSHOT_OPCODE_CHUNK = 0xFB,
+  // Deadline of the record that follows it
+  SNAPSHOT_OPCODE_EXPIRETIME_MS = 0xFC,
+  SNAPSHOT_OPCODE_EOF = 0xFF,
+} snapshot_type_t;
+
+// Progress of a snapshot being written; it may live in memory shared with a forked child
+typedef struct SnapshotProgress
+{
+  atomic_ullong saved_keys;
+  unsigned long long total_keys;
+} SnapshotProgress;
+
+// Receives every loaded entry and takes ownership of the key and the value;
+// `expire_at_ms` is the unix time in milliseconds the key expires at, 0 if it never does
+typedef void (*snapshot_entry_handler_t)(char *key, DBObj *value, uint64_t expire_at_ms, void *context);
+
+typedef struct SnapshotEntry
+{
+  char *key;
+  DBObj *value;
+  uint64_t expire_at_ms;
+} SnapshotEntry;
+
+// Receives the counts of a snapshot before any of its entries, so the tables can be presized;
+// they are capped by what the file size allows, and are 0 for snapshots older than version 3
+typedef void (*snapshot_reserve_handler_t)(uint64_t key_count, uint64_t expires_count, void *context);
+
+// Receives the decoded entries of one chunk and takes ownership of every key and value;
+// called from several decoding threads at once
+typedef void (*snapshot_chunk_handler_t)(SnapshotEntry *entries, db_uint_t length, void *context);
+
+// Writes every entry of the tables to a temporary file, then renames it over `filepath`.
+// `expires_tables[i]` is the expiry table of `tables[i]`, whose entries then keep their deadlines;
+// it and `progress` may be NULL.
+// Returns false if the file could not be written
+db_bool_t snapshot_save(const char *filepath, DBHash **tables, DBHash **expires_tables, db_uint_t tables_length, SnapshotProgress *progress);
+
+// Returns true if the file starts with the snapshot magic
+db_bool_t snapshot_is_snapshot_file(const char *filepath);
+
+// Streams the entries of a snapshot to the handler;
+// returns false if the file is truncated, corrupted or fails the checksum
+db_bool_t snapshot_load(const char *filepath, snapshot_entry_handler_t handler, void *context);
+
+// Reads the chunks of a snapshot on the calling thread and decodes them on `threads` threads,
+// 0 or 1 decodes inline; `reserve_handler` may be NULL. Entries handed over before a failure are
+// not taken back. Returns false if the file is truncated, corrupted or fails the checksum
+db_bool_t snapshot_load_parallel(const char *filepath, db_uint_t threads, snapshot_reserve_handler_t reserve_handler,
+                                 snapshot_chunk_handler_t chunk_handler, void *context);
+
+// A snapshot file mapped read-only, whose values are read where they lie in the page cache, which
+// every process mapping the same file shares; see snapshot_map
+typedef struct SnapshotMap
+{
+  const uint8_t *data;
+  size_t length;
+} SnapshotMap;
+
+// Receives every record of a mapped snapshot: its key, `key_length` bytes that are not
+// NUL-terminated, and where the record starts, for the snapshot_map_* readers below
+typedef void (*snapshot_record_handler_t)(const char *key, db_uint_t key_length, const uint8_t *record, void *context);
+
+// Maps a snapshot of version SNAPSHOT_CHUNKED_VERSION and hands its records to the handler in file
+// order without decoding their values. The checksum is not verified, that would read every page,
+// but every record is checked to lie within its chunk. Returns NULL if the file can't be mapped or
+// is not such a snapshot, or is truncated or corrupted; records handed over before are then stale
+SnapshotMap *snapshot_map(const char *filepath, snapshot_record_handler_t handler, void *context);
+
+// Unmaps the file; records of it must no longer be read
+void snapshot_unmap(SnapshotMap *map);
+
+// Unix time in milliseconds a record expires at, 0 if it never does
+uint64_t snapshot_map_expire_at(const uint8_t *record);
+
+// Type of the value of a record, a snapshot_type_t
+uint8_t snapshot_map_type(const uint8_t *record);
+
+// Decodes the value of a record into a new object, as snapshot_load would have
+DBObj *snapshot_map_decode(const uint8_t *record);
+
+// Reads the strings of a mapped value in place: the string itself, the elements of a list, the
+// fields and values of a hash in turn, or the members of a zset in score order
+typedef struct SnapshotMapIter
+{
+  const uint8_t *position;
+  db_uint_t remaining;
+  uint8_t type;
+} SnapshotMapIter;
+
+// Starts reading the value of a record; returns how many strings it holds
+db_uint_t snapshot_map_iter_init(const uint8_t *record, SnapshotMapIter *iter);
+
+// Next string of the value, `length` bytes that are not NUL-terminated, with its score if the
+// value is a zset and `score` isn't NULL; NULL past the last one
+const char *snapshot_map_iter_next(SnapshotMapIter *iter, db_uint_t *length, db_double_t *score);
+
+#endif
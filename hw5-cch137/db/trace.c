@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "utils.h"
+#include "trace.h"
+
+// Events of one thread. Only the owner writes, and it publishes each event by moving `head`;
+// a ring outlives its thread and is handed to the next thread that records
+typedef struct TraceRing
+{
+  _Atomic uint64_t head;
+  uint32_t thread;
+  db_bool_t is_owned;
+  struct TraceRing *next;
+  DBTraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+_Atomic db_bool_t trace_is_enabled = false;
+
+static const char *const trace_event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_HGET] = "hget",
+    [TRACE_HSET] = "hset",
+    [TRACE_REHASH_STEP] = "rehash_step",
+    [TRACE_EXPIRE_CYCLE] = "expire_cycle",
+    [TRACE_ZSL_INSERT] = "zsl_insert",
+    [TRACE_ZSL_DELETE] = "zsl_delete",
+    [TRACE_DISPATCH] = "dispatch",
+};
+
+// Every ring ever created, guarded by `rings_lock`, which is only taken when a thread records
+// its first event, exits, or the rings are collected
+static TraceRing *rings = NULL;
+static uint32_t rings_length = 0;
+static mtx_t rings_lock;
+static once_flag rings_lock_once = ONCE_FLAG_INIT;
+static tss_t ring_key;
+static thread_local TraceRing *ring = NULL;
+// Events that started before this were recorded before the last trace_start
+static _Atomic uint64_t trace_started_at = 0;
+
+static void trace_release_ring(void *arg)
+{
+  mtx_lock(&rings_lock);
+  ((TraceRing *)arg)->is_owned = false;
+  mtx_unlock(&rings_lock);
+}
+
+static void rings_lock_init()
+{
+  mtx_init(&rings_lock, mtx_plain);
+  tss_create(&ring_key, trace_release_ring);
+}
+
+static TraceRing *trace_acquire_ring()
+{
+  TraceRing *acquired;
+
+  call_once(&rings_lock_once, rings_lock_init);
+  mtx_lock(&rings_lock);
+  for (acquired = rings; acquired && acquired->is_owned; acquired = acquired->next)
+    ;
+  if (!acquired)
+  {
+    acquired = (TraceRing *)calloc(1, sizeof(TraceRing));
+    if (!acquired)
+      EXIT_ON_MEMORY_ERROR();
+    acquired->thread = rings_length++;
+    acquired->next = rings;
+    rings = acquired;
+  }
+  acquired->is_owned = true;
+  mtx_unlock(&rings_lock);
+
+  tss_set(ring_key, acquired);
+  return acquired;
+}
+
+void trace_record(db_trace_event_t event, uint64_t started_at, uint64_t arg)
+{
+  if (!ring)
+    ring = trace_acquire_ring();
+
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  DBTraceEvent *slot = &ring->events[head % TRACE_RING_SIZE];
+  slot->started_at = started_at;
+  slot->duration_ns = latency_now_ns() - started_at;
+  slot->arg = arg;
+  slot->event = event;
+  slot->thread = ring->thread;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_start()
+{
+  atomic_store(&trace_started_at, latency_now_ns());
+  atomic_store(&trace_is_enabled, true);
+}
+
+void trace_stop()
+{
+  atomic_store(&trace_is_enabled, false);
+}
+
+const char *trace_event_name(db_trace_event_t event)
+{
+  return event < TRACE_EVENT_COUNT ? trace_event_names[event] : "unknown";
+}
+
+static int compare_trace_events(const void *a, const void *b)
+{
+  uint64_t x = ((const DBTraceEvent *)a)->started_at;
+  uint64_t y = ((const DBTraceEvent *)b)->started_at;
+  return x < y ? -1 : x > y;
+}
+
+db_uint_t trace_collect(DBTraceEvent *events, db_uint_t capacity)
+{
+  uint64_t since = atomic_load(&trace_started_at);
+  DBTraceEvent *all;
+  db_uint_t length = 0;
+
+  call_once(&rings_lock_once, rings_lock_init);
+  mtx_lock(&rings_lock);
+  all = (DBTraceEvent *)malloc(((size_t)rings_length + 1) * TRACE_RING_SIZE * sizeof(DBTraceEvent));
+  if (!all)
+    EXIT_ON_MEMORY_ERROR();
+  for (TraceRing *curr = rings; curr; curr = curr->next)
+  {
+    uint64_t head = atomic_load_explicit(&curr->head, memory_order_acquire);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    db_uint_t copied = length;
+    for (uint64_t i = first; i < head; ++i)
+      all[length++] = curr->events[i % TRACE_RING_SIZE];
+
+    // The owner may have lapped the copy; whatever it wrote over is dropped.
+    uint64_t overwritten = atomic_load_explicit(&curr->head, memory_order_acquire);
+    overwritten = overwritten > TRACE_RING_SIZE ? overwritten - TRACE_RING_SIZE : 0;
+    if (overwritten > first)
+    {
+      db_uint_t skip = (db_uint_t)(overwritten - first < head - first ? overwritten - first : head - first);
+      memmove(&all[copied], &all[copied + skip], (length - copied - skip) * sizeof(DBTraceEvent));
+      length -= skip;
+    }
+  }
+  mtx_unlock(&rings_lock);
+
+  db_uint_t kept = 0;
+  for (db_uint_t i = 0; i < length; ++i)
+    if (all[i].started_at >= since)
+      all[kept++] = all[i];
+  qsort(all, kept, sizeof(DBTraceEvent), compare_trace_events);
+
+  db_uint_t first = kept > capacity ? kept - capacity : 0;
+  memcpy(events, all + first, (kept - first) * sizeof(DBTraceEvent));
+  free(all);
+  return kept - first;
+}
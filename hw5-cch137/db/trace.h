@@ -0,0 +1,78 @@
+#ifndef DB_TRACE_H
+#define DB_TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "latency.h"
+
+// Tracepoints on the hot paths of the hash tables, the skiplist and the shard workers, so a
+// latency spike can be put down to a rehash step or an expire cycle on a running server.
+// Each traced span is recorded, with when it started, how long it took and one argument, into a
+// ring of the calling thread; the rings are lock-free and read back with trace_collect.
+// Recording is off until trace_start; while it is off a tracepoint costs a relaxed load and a
+// branch. Building with -DDB_NO_TRACE compiles the tracepoints out altogether.
+
+// Events each thread keeps, the oldest are overwritten
+#define TRACE_RING_SIZE 4096
+
+typedef enum
+{
+  // Argument: the key hash
+  TRACE_HGET,
+  TRACE_HSET,
+  // Argument: the first bucket visited
+  TRACE_REHASH_STEP,
+  // Argument: the keys expired
+  TRACE_EXPIRE_CYCLE,
+  // Argument: the members of the set
+  TRACE_ZSL_INSERT,
+  TRACE_ZSL_DELETE,
+  // Argument: the db_action_t run by the shard worker
+  TRACE_DISPATCH,
+  TRACE_EVENT_COUNT
+} db_trace_event_t;
+
+typedef struct DBTraceEvent
+{
+  uint64_t started_at;
+  uint64_t duration_ns;
+  uint64_t arg;
+  uint32_t event;
+  // Order in which the recording threads first recorded an event
+  uint32_t thread;
+} DBTraceEvent;
+
+extern _Atomic db_bool_t trace_is_enabled;
+
+#ifdef DB_NO_TRACE
+#define TRACE_IS_ON() 0
+#else
+#define TRACE_IS_ON() __builtin_expect(atomic_load_explicit(&trace_is_enabled, memory_order_relaxed), 0)
+#endif
+
+// Starts a span, evaluating to its start time, or to 0 while tracing is off
+#define TRACE_BEGIN() (TRACE_IS_ON() ? latency_now_ns() : 0)
+// Ends a span started by TRACE_BEGIN
+#define TRACE_END(event, started_at, arg)          \
+  do                                               \
+  {                                                \
+    if (started_at)                                \
+      trace_record((event), (started_at), (arg));  \
+  } while (0)
+
+// Records a span that started at `started_at` and ends now
+void trace_record(db_trace_event_t event, uint64_t started_at, uint64_t arg);
+
+void trace_start();
+void trace_stop();
+
+// Lowercase name of an event, as TRACE_GET prints it
+const char *trace_event_name(db_trace_event_t event);
+
+// Copies the newest events recorded since the last trace_start, up to `capacity` of them, into
+// `events`, oldest first; returns how many it copied
+db_uint_t trace_collect(DBTraceEvent *events, db_uint_t capacity);
+
+#endif
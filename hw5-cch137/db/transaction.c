@@ -0,0 +1,64 @@
+#include <stdlib.h>
+
+#include "utils.h"
+#include "interaction.h"
+#include "transaction.h"
+
+DBTransaction *transaction_create()
+{
+  DBTransaction *transaction = (DBTransaction *)calloc(1, sizeof(DBTransaction));
+  if (!transaction)
+    EXIT_ON_MEMORY_ERROR();
+  return transaction;
+}
+
+void transaction_queue(DBTransaction *transaction, DBRequest *request)
+{
+  if (transaction->length == transaction->capacity)
+  {
+    transaction->capacity = transaction->capacity ? transaction->capacity * 2 : 8;
+    transaction->requests = (DBRequest **)realloc(transaction->requests, transaction->capacity * sizeof(DBRequest *));
+    if (!transaction->requests)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  transaction->requests[transaction->length++] = request;
+}
+
+void transaction_watch(DBTransaction *transaction, const char *key)
+{
+  if (transaction->watched_length == transaction->watched_capacity)
+  {
+    transaction->watched_capacity = transaction->watched_capacity ? transaction->watched_capacity * 2 : 4;
+    transaction->watched = (DBWatchedKey *)realloc(transaction->watched, transaction->watched_capacity * sizeof(DBWatchedKey));
+    if (!transaction->watched)
+      EXIT_ON_MEMORY_ERROR();
+  }
+  transaction->watched[transaction->watched_length++] = (DBWatchedKey){.key = dbutil_strdup(key), .version = 0, .expire_at_ms = 0};
+}
+
+void transaction_unwatch(DBTransaction *transaction)
+{
+  for (db_uint_t i = 0; i < transaction->watched_length; ++i)
+    free(transaction->watched[i].key);
+  transaction->watched_length = 0;
+}
+
+void transaction_discard(DBTransaction *transaction)
+{
+  for (db_uint_t i = 0; i < transaction->length; ++i)
+    free_request(transaction->requests[i]);
+  transaction->length = 0;
+  transaction->is_queuing = false;
+  transaction->is_aborted = false;
+}
+
+void transaction_free(DBTransaction *transaction)
+{
+  if (!transaction)
+    return;
+  transaction_discard(transaction);
+  transaction_unwatch(transaction);
+  free(transaction->requests);
+  free(transaction->watched);
+  free(transaction);
+}
@@ -0,0 +1,54 @@
+#ifndef DB_TRANSACTION_H
+#define DB_TRANSACTION_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// State of MULTI and WATCH for one client, kept by its pipeline from one submission to the next.
+// Commands sent after MULTI are not submitted but queued here, each answered with QUEUED; EXEC
+// then takes the whole transaction to the core, which runs the queue as one task, with nothing of
+// anyone else's in between, see db_exec. WATCH is optimistic locking: it notes the version the
+// key has in its shard, which every write to it bumps, and EXEC runs nothing if any watched key
+// changed since.
+
+typedef struct DBWatchedKey
+{
+  char *key;
+  // Version of the key when it was watched, filled in by the core, see db_watch
+  uint64_t version;
+  // Deadline the key had then, 0 if none; the key running out of time counts as a change
+  uint64_t expire_at_ms;
+} DBWatchedKey;
+
+typedef struct DBTransaction
+{
+  // Between MULTI and EXEC or DISCARD
+  db_bool_t is_queuing;
+  // A command was refused while queuing, so EXEC only discards
+  db_bool_t is_aborted;
+  DBRequest **requests;
+  db_uint_t length;
+  db_uint_t capacity;
+  DBWatchedKey *watched;
+  db_uint_t watched_length;
+  db_uint_t watched_capacity;
+} DBTransaction;
+
+DBTransaction *transaction_create();
+
+// Queues a request to be run by EXEC; the transaction takes ownership of it
+void transaction_queue(DBTransaction *transaction, DBRequest *request);
+
+// Adds a key to the watched ones, with its version still to be filled in
+void transaction_watch(DBTransaction *transaction, const char *key);
+
+// Forgets every watched key
+void transaction_unwatch(DBTransaction *transaction);
+
+// Frees the queued requests and leaves MULTI; the watched keys stay
+void transaction_discard(DBTransaction *transaction);
+
+void transaction_free(DBTransaction *transaction);
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef DB_TYPEDHASH_H
+#define DB_TYPEDHASH_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+#include "hash.h"
+#include "slab.h"
+#include "pages.h"
+
+// Macro template of hash tables whose values all have one C type. DBHash wraps every value in a
+// DBObj and frees it through the type switch of free_dbobj; a table made here keeps the value in
+// the entry as is and never frees it, and borrows its keys, which must outlive their entries, so
+// an entry is the only allocation a key costs. Tables grow, shrink and rehash incrementally as
+// DBHash does, with its limits, hash function and scan cursors, so a scan can move from one to
+// the other.
+//
+// DB_TYPED_HASH(Name, prefix, value_t) defines the types Name and Name##Entry and these functions,
+// all static inline, so each table is compiled for its own value type:
+//   Name *prefix##_create()
+//   void prefix##_free(Name *ht)                         frees the entries, not what values point to
+//   db_uint_t prefix##_count(const Name *ht)
+//   void prefix##_reserve(Name *ht, db_uint_t count)     sizes an empty table for `count` keys
+//   Name##Entry *prefix##_find(const Name *ht, const DBKey *key)   leaves a rehash alone
+//   value_t *prefix##_get(Name *ht, const char *key)     NULL if the key isn't there
+//   void prefix##_insert(Name *ht, const char *key, db_uint_t length, value_t value)
+//                                                        for a key known to be absent
+//   db_bool_t prefix##_remove(Name *ht, const char *key, value_t *value)
+//                                                        hands the value over; false if not found
+//   db_uint_t prefix##_scan(Name *ht, db_uint_t cursor, void (*visit)(Name##Entry *, void *), void *arg)
+//                                                        as ht_scan does
+#define DB_TYPED_HASH(Name, prefix, value_t)                                                              \
+  typedef struct Name##Entry                                                                              \
+  {                                                                                                       \
+    struct Name##Entry *next;                                                                             \
+    const char *key;                                                                                      \
+    db_uint_t key_length;                                                                                 \
+    db_uint_t hash;                                                                                       \
+    value_t value;                                                                                        \
+  } Name##Entry;                                                                                          \
+                                                                                                          \
+  typedef struct Name                                                                                     \
+  {                                                                                                       \
+    /* [1] is the table of a rehash, the one new keys go to */                                            \
+    Name##Entry **buckets[2];                                                                             \
+    db_uint_t sizes[2];                                                                                   \
+    db_uint_t counts[2];                                                                                  \
+    /* -1 if not rehashing, otherwise the next bucket of [0] to move, counting down */                   \
+    db_int_t rehashing_index;                                                                             \
+    /* Bytes of the table, its bucket arrays and its entries */                                           \
+    size_t memory;                                                                                        \
+  } Name;                                                                                                 \
+                                                                                                          \
+  static inline void prefix##_resize_table(Name *ht, int table, db_uint_t size)                           \
+  {                                                                                                       \
+    ht->memory -= pages_alloc_size(ht->buckets[table]);                                                   \
+    pages_free(ht->buckets[table]);                                                                       \
+    ht->buckets[table] = size ? (Name##Entry **)pages_alloc(size * sizeof(Name##Entry *)) : NULL;         \
+    ht->memory += pages_alloc_size(ht->buckets[table]);                                                   \
+    ht->sizes[table] = size;                                                                              \
+  }                                                                                                       \
+                                                                                                          \
+  static inline Name *prefix##_create()                                                                   \
+  {                                                                                                       \
+    Name *ht = (Name *)calloc(1, sizeof(Name));                                                           \
+    if (!ht)                                                                                              \
+      EXIT_ON_MEMORY_ERROR();                                                                             \
+    ht->rehashing_index = -1;                                                                             \
+    ht->memory = dbutil_alloc_size(ht);                                                                   \
+    prefix##_resize_table(ht, 0, HT_INITIAL_SIZE);                                                        \
+    return ht;                                                                                            \
+  }                                                                                                       \
+                                                                                                          \
+  static inline void prefix##_free(Name *ht)                                                              \
+  {                                                                                                       \
+    if (!ht)                                                                                              \
+      return;                                                                                             \
+    Name##Entry *entry, *next;                                                                            \
+    for (int t = 0; t < 2; ++t)                                                                           \
+    {                                                                                                     \
+      for (db_uint_t i = 0; i < ht->sizes[t]; ++i)                                                        \
+        for (entry = ht->buckets[t][i]; entry; entry = next)                                              \
+        {                                                                                                 \
+          next = entry->next;                                                                             \
+          slab_free(entry, sizeof(Name##Entry));                                                          \
+        }                                                                                                 \
+      pages_free(ht->buckets[t]);                                                                         \
+    }                                                                                                     \
+    free(ht);                                                                                             \
+  }                                                                                                       \
+                                                                                                          \
+  static inline db_uint_t prefix##_count(const Name *ht)                                                  \
+  {                                                                                                       \
+    return ht ? ht->counts[0] + ht->counts[1] : 0;                                                        \
+  }                                                                                                       \
+                                                                                                          \
+  static inline void prefix##_reserve(Name *ht, db_uint_t count)                                          \
+  {                                                                                                       \
+    if (!ht || ht->rehashing_index != -1 || prefix##_count(ht))                                           \
+      return;                                                                                             \
+    db_uint_t size = HT_INITIAL_SIZE;                                                                     \
+    while (size < DB_UINT_MAX / 2 && count > HT_LOAD_FACTOR_EXPAND * size)                                \
+      size *= 2;                                                                                          \
+    if (size != ht->sizes[0])                                                                             \
+      prefix##_resize_table(ht, 0, size);                                                                 \
+  }                                                                                                       \
+                                                                                                          \
+  /* Moves up to `buckets` non-empty buckets of a running rehash, as _ht_rehash does */                   \
+  static inline void prefix##_rehash(Name *ht, db_uint_t buckets)                                         \
+  {                                                                                                       \
+    db_uint_t empty_visits = buckets * HT_REHASH_EMPTY_VISITS;                                            \
+    Name##Entry *entry, *next;                                                                            \
+    while (buckets && ht->rehashing_index != -1)                                                          \
+    {                                                                                                     \
+      entry = ht->buckets[0][ht->rehashing_index];                                                        \
+      if (!entry && !--empty_visits)                                                                      \
+        return;                                                                                           \
+      for (; entry; entry = next)                                                                         \
+      {                                                                                                   \
+        next = entry->next;                                                                               \
+        Name##Entry **bucket = &ht->buckets[1][entry->hash & (ht->sizes[1] - 1)];                         \
+        entry->next = *bucket;                                                                            \
+        *bucket = entry;                                                                                  \
+        --ht->counts[0];                                                                                  \
+        ++ht->counts[1];                                                                                  \
+      }                                                                                                   \
+      if (ht->buckets[0][ht->rehashing_index])                                                            \
+        --buckets;                                                                                        \
+      ht->buckets[0][ht->rehashing_index--] = NULL;                                                       \
+    }                                                                                                     \
+    if (ht->rehashing_index != -1)                                                                        \
+      return;                                                                                             \
+    prefix##_resize_table(ht, 0, 0);                                                                      \
+    ht->buckets[0] = ht->buckets[1];                                                                      \
+    ht->sizes[0] = ht->sizes[1];                                                                          \
+    ht->counts[0] = ht->counts[1];                                                                        \
+    ht->buckets[1] = NULL;                                                                                \
+    ht->sizes[1] = 0;                                                                                     \
+    ht->counts[1] = 0;                                                                                    \
+  }                                                                                                       \
+                                                                                                          \
+  static inline void prefix##_maintenance(Name *ht)                                                       \
+  {                                                                                                       \
+    if (ht->rehashing_index != -1)                                                                        \
+      prefix##_rehash(ht, HT_REHASH_STEP_BUCKETS);                                                        \
+    else if (ht->counts[0] > HT_LOAD_FACTOR_EXPAND * ht->sizes[0])                                        \
+    {                                                                                                     \
+      prefix##_resize_table(ht, 1, ht->sizes[0] * 2);                                                     \
+      ht->rehashing_index = ht->sizes[0] - 1;                                                             \
+    }                                                                                                     \
+    else if (ht->sizes[0] > HT_INITIAL_SIZE && ht->counts[0] < HT_LOAD_FACTOR_SHRINK * ht->sizes[0])      \
+    {                                                                                                     \
+      prefix##_resize_table(ht, 1, ht->sizes[0] / 2);                                                     \
+      ht->rehashing_index = ht->sizes[0] - 1;                                                             \
+    }                                                                                                     \
+  }                                                                                                       \
+                                                                                                          \
+  /* The link pointing to the entry of the key, with the table it is in, or to the NULL ending the     \
+     chain of the key in [0] if it isn't there */                                                         \
+  static inline Name##Entry **prefix##_link(const Name *ht, const DBKey *key, int *table)                 \
+  {                                                                                                       \
+    Name##Entry **link = NULL;                                                                            \
+    for (int t = ht->rehashing_index != -1 ? 1 : 0; t >= 0; --t)                                          \
+    {                                                                                                     \
+      *table = t;                                                                                         \
+      link = &ht->buckets[t][key->hash & (ht->sizes[t] - 1)];                                             \
+      for (; *link; link = &(*link)->next)                                                                \
+        if ((*link)->hash == key->hash && (*link)->key_length == key->length &&                           \
+            memcmp((*link)->key, key->string, key->length) == 0)                                          \
+          return link;                                                                                    \
+    }                                                                                                     \
+    return link;                                                                                          \
+  }                                                                                                       \
+                                                                                                          \
+  static inline Name##Entry *prefix##_find(const Name *ht, const DBKey *key)                              \
+  {                                                                                                       \
+    int table;                                                                                            \
+    return ht && key->string ? *prefix##_link(ht, key, &table) : NULL;                                            \
+  }                                                                                                       \
+                                                                                                          \
+  static inline value_t *prefix##_get(Name *ht, const char *key)                                          \
+  {                                                                                                       \
+    if (!ht || !key)                                                                                      \
+      return NULL;                                                                                        \
+    prefix##_maintenance(ht);                                                                             \
+    DBKey handle = ht_key(key);                                                                           \
+    int table;                                                                                            \
+    Name##Entry *entry = *prefix##_link(ht, &handle, &table);                                             \
+    return entry ? &entry->value : NULL;                                                                  \
+  }                                                                                                       \
+                                                                                                          \
+  static inline void prefix##_insert(Name *ht, const char *key, db_uint_t length, value_t value)          \
+  {                                                                                                       \
+    prefix##_maintenance(ht);                                                                             \
+    int t = ht->rehashing_index != -1 ? 1 : 0;                                                            \
+    Name##Entry *entry = (Name##Entry *)slab_alloc(sizeof(Name##Entry));                                  \
+    entry->key = key;                                                                                     \
+    entry->key_length = length;                                                                           \
+    entry->hash = murmurhash2(key, length);                                                               \
+    entry->value = value;                                                                                 \
+    Name##Entry **bucket = &ht->buckets[t][entry->hash & (ht->sizes[t] - 1)];                             \
+    entry->next = *bucket;                                                                                \
+    *bucket = entry;                                                                                      \
+    ++ht->counts[t];                                                                                      \
+    ht->memory += slab_size(sizeof(Name##Entry));                                                         \
+  }                                                                                                       \
+                                                                                                          \
+  static inline db_bool_t prefix##_remove(Name *ht, const char *key, value_t *value)                      \
+  {                                                                                                       \
+    if (!ht || !key)                                                                                      \
+      return false;                                                                                       \
+    prefix##_maintenance(ht);                                                                             \
+    DBKey handle = ht_key(key);                                                                           \
+    int t;                                                                                                \
+    Name##Entry **link = prefix##_link(ht, &handle, &t), *entry = *link;                                  \
+    if (!entry)                                                                                           \
+      return false;                                                                                       \
+    *link = entry->next;                                                                                  \
+    --ht->counts[t];                                                                                      \
+    *value = entry->value;                                                                                \
+    slab_free(entry, sizeof(Name##Entry));                                                                \
+    ht->memory -= slab_size(sizeof(Name##Entry));                                                         \
+    return true;                                                                                          \
+  }                                                                                                       \
+                                                                                                          \
+  static inline void prefix##_scan_bucket(Name##Entry *entry, void (*visit)(Name##Entry *, void *), void *arg) \
+  {                                                                                                       \
+    Name##Entry *next;                                                                                    \
+    for (; entry; entry = next)                                                                           \
+    {                                                                                                     \
+      next = entry->next;                                                                                 \
+      visit(entry, arg);                                                                                  \
+    }                                                                                                     \
+  }                                                                                                       \
+                                                                                                          \
+  static inline db_uint_t prefix##_scan(Name *ht, db_uint_t cursor, void (*visit)(Name##Entry *, void *), void *arg) \
+  {                                                                                                       \
+    if (!ht || !ht->sizes[0])                                                                             \
+      return 0;                                                                                           \
+    if (ht->rehashing_index == -1)                                                                        \
+    {                                                                                                     \
+      db_uint_t mask = ht->sizes[0] - 1;                                                                  \
+      prefix##_scan_bucket(ht->buckets[0][cursor & mask], visit, arg);                                    \
+      return ht_scan_next(cursor, mask);                                                                  \
+    }                                                                                                     \
+    int small = ht->sizes[0] > ht->sizes[1] ? 1 : 0;                                                      \
+    db_uint_t small_mask = ht->sizes[small] - 1, large_mask = ht->sizes[!small] - 1;                      \
+    prefix##_scan_bucket(ht->buckets[small][cursor & small_mask], visit, arg);                            \
+    do                                                                                                    \
+    {                                                                                                     \
+      prefix##_scan_bucket(ht->buckets[!small][cursor & large_mask], visit, arg);                         \
+      cursor = ht_scan_next(cursor, large_mask);                                                          \
+    } while (cursor & (small_mask ^ large_mask));                                                         \
+    return cursor;                                                                                        \
+  }
+
+#endif
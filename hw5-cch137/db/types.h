@@ -5,13 +5,42 @@
 #include <stdint.h>
 #include <float.h>
 #include <stdbool.h>
+#include <threads.h>
 
 #define DB_ERR_DB_IS_CLOSED "ERR database is closed"
 #define DB_ERR_ARG_ERROR "ERR wrong arguments "
 #define DB_ERR_WRONGTYPE "WRONGTYPE Operation against a key holding the wrong kind of value"
 #define DB_ERR_NONEXISTENT_KEY "ERR no such key"
+#define DB_ERR_INDEX_OUT_OF_RANGE "ERR index out of range"
 #define DB_ERR_SYNTAX_ERROR "ERR syntax error"
 #define DB_ERR_UNKNOWN_COMMAND "ERR unknown command"
+#define DB_ERR_QUEUE_FULL "ERR task queue is full"
+#define DB_ERR_BGSAVE_IN_PROGRESS "ERR background save already in progress"
+#define DB_ERR_BGSAVE_FAILED "ERR background save could not be started"
+#define DB_ERR_AOF_DISABLED "ERR append-only log is disabled"
+#define DB_ERR_NOT_INTEGER "ERR value is not an integer or out of range"
+#define DB_ERR_INCR_OVERFLOW "ERR increment or decrement would overflow"
+#define DB_ERR_NOT_FLOAT "ERR value is not a valid float"
+#define DB_ERR_INCR_NOT_FINITE "ERR increment would produce NaN or Infinity"
+#define DB_ERR_MULTI_NESTED "ERR MULTI calls can not be nested"
+#define DB_ERR_EXEC_WITHOUT_MULTI "ERR EXEC without MULTI"
+#define DB_ERR_DISCARD_WITHOUT_MULTI "ERR DISCARD without MULTI"
+#define DB_ERR_WATCH_INSIDE_MULTI "ERR WATCH inside MULTI is not allowed"
+#define DB_ERR_EXECABORT "EXECABORT Transaction discarded because of previous errors."
+#define DB_ERR_TRANSACTION_NEEDS_PIPELINE "ERR transactions are only kept by pipelines"
+#define DB_ERR_TIMEOUT_OUT_OF_RANGE "ERR timeout is negative or out of range"
+#define DB_ERR_READONLY "READONLY You can't write against a read only replica"
+#define DB_ERR_SYNC_FAILED "ERR full sync could not be taken"
+#define DB_ERR_PSYNC_NOT_ALONE "ERR PSYNC must be the only command of its pipeline"
+#define DB_ERR_CLUSTER_DISABLED "ERR This instance has cluster support disabled"
+#define DB_ERR_CLUSTERDOWN "CLUSTERDOWN Hash slot not served"
+#define DB_ERR_CROSSSLOT "CROSSSLOT Keys in request don't hash to the same slot"
+#define DB_ERR_SLOT_BUSY "ERR Slot is already owned by another node"
+#define DB_ERR_MIGRATE_FAILED "IOERR error or timeout migrating to target instance"
+#define DB_ERR_OOM "OOM command not allowed when used memory > 'maxmemory'"
+#define DB_ERR_STRING_TOO_LONG "ERR string exceeds maximum allowed size (proto-max-bulk-len)"
+
+#define NANOSECONDS_PER_SECOND 1000000000L
 
 typedef enum db_type_t
 {
@@ -24,7 +53,6 @@ typedef enum db_type_t
   DB_TYPE_STRING,
   DB_TYPE_LIST,
   DB_TYPE_ZSET,
-  DB_TYPE_ZSETELE,
   DB_TYPE_HASH
 } db_type_t;
 
@@ -32,21 +60,57 @@ typedef enum db_action_t
 {
   DB_UNKNOWN_COMMAND,
   DB_SAVE,
+  DB_BGSAVE,
+  DB_LASTSAVE,
+  DB_BGREWRITEAOF,
   DB_START,
+  DB_PING,
   DB_SET,
   DB_GET,
+  DB_MGET,
+  DB_MSET,
+  DB_MSETNX,
+  DB_INCR,
+  DB_DECR,
+  DB_INCRBY,
+  DB_DECRBY,
+  DB_INCRBYFLOAT,
+  DB_APPEND,
+  DB_STRLEN,
+  DB_GETRANGE,
+  DB_SETRANGE,
+  DB_MULTI,
+  DB_EXEC,
+  DB_DISCARD,
+  DB_WATCH,
+  DB_UNWATCH,
   DB_RENAME,
   DB_DEL,
+  DB_UNLINK,
   DB_LPUSH,
   DB_LPOP,
   DB_RPUSH,
   DB_RPOP,
+  DB_BLPOP,
+  DB_BRPOP,
   DB_LLEN,
   DB_LRANGE,
+  DB_LINDEX,
+  DB_LSET,
+  DB_LINSERT,
   DB_HGET,
   DB_HSET,
   DB_HDEL,
+  DB_HMGET,
+  DB_HGETALL,
+  DB_HINCRBY,
+  DB_HSCAN,
   DB_EXPIRE,
+  DB_EXPIREAT,
+  DB_PEXPIRE,
+  DB_PEXPIREAT,
+  DB_TTL,
+  DB_PTTL,
   DB_ZSCORE,
   DB_ZADD,
   DB_ZCARD,
@@ -56,14 +120,72 @@ typedef enum db_action_t
   DB_ZRANGE,
   DB_ZRANGEBYSCORE,
   DB_ZRANK,
+  DB_ZREVRANGE,
+  DB_ZREVRANK,
   DB_ZREM,
   DB_ZREMRANGEBYSCORE,
+  DB_ZSCAN,
   DB_KEYS,
+  DB_SCAN,
   DB_FLUSHALL,
   DB_INFO_DATASET_MEMORY,
+  DB_MEMORY_USAGE,
+  DB_MEMORY_STATS,
+  DB_INFO_PERSISTENCE,
+  DB_INFO_STATS,
+  DB_INFO_COMMANDSTATS,
+  DB_INFO_REPLICATION,
+  DB_SLOWLOG_GET,
+  DB_SLOWLOG_LEN,
+  DB_SLOWLOG_RESET,
+  DB_HOTKEYS_GET,
+  DB_HOTKEYS_BYTES,
+  DB_HOTKEYS_RESET,
+  DB_TRACE_START,
+  DB_TRACE_STOP,
+  DB_TRACE_GET,
+  DB_REPLICAOF,
+  DB_PSYNC,
+  // Sent by a replica to itself with a full sync to load; refused from anyone else
+  DB_REPLICA_LOAD,
+  DB_CLUSTER_KEYSLOT,
+  DB_CLUSTER_ADDSLOTS,
+  DB_CLUSTER_SETSLOT,
+  DB_CLUSTER_SLOTS,
+  DB_CLUSTER_COUNTKEYSINSLOT,
+  DB_CLUSTER_GETKEYSINSLOT,
+  DB_ASKING,
+  DB_MIGRATE,
   DB_SHUTDOWN
 } db_action_t;
 
+// SHUTDOWN stays the last action
+#define DB_ACTION_COUNT (DB_SHUTDOWN + 1)
+
+// How a value lays out its contents
+typedef enum db_encoding_t
+{
+  // In a block of their own, owned by the object
+  DB_ENCODING_RAW,
+  // Right after the object, in the same allocation
+  DB_ENCODING_EMBSTR,
+  // Embedded too; the string is the canonical decimal form of an int64_t stored between the
+  // object and its bytes, so it can be read as a number without parsing
+  DB_ENCODING_INT,
+  // A string of ROPE_MIN_LENGTH bytes or more, kept as a DBRope
+  DB_ENCODING_ROPE,
+  // A list kept as a DBQuickList, which is how every list value in the keyspace is stored;
+  // lists in replies and requests stay plain DBLists
+  DB_ENCODING_QUICKLIST,
+  // Sorted sets, in DBZSet::encoding: small ones are a sorted array of DBZSetPackedEntry, the
+  // others a skiplist with a dict from members to elements
+  DB_ENCODING_ZSET_PACKED,
+  DB_ENCODING_SKIPLIST,
+  // Hashes: small ones a DBPackedHash, the others a DBHash with an entry per field
+  DB_ENCODING_HASH_PACKED,
+  DB_ENCODING_HASHTABLE
+} db_encoding_t;
+
 typedef enum db_aggregate_t
 {
   DB_AGG_SUM,
@@ -71,6 +193,59 @@ typedef enum db_aggregate_t
   DB_AGG_MIN
 } db_aggregate_t;
 
+// Policy applied by producers when the core task queue is full
+typedef enum db_queue_policy_t
+{
+  // Producers park until the worker frees a slot
+  DB_QUEUE_BLOCK,
+  // Producers fail immediately; the request is answered with DB_ERR_QUEUE_FULL
+  DB_QUEUE_REJECT
+} db_queue_policy_t;
+
+// What a write does when the dataset has outgrown maxmemory, see evict.h
+typedef enum db_maxmemory_policy_t
+{
+  // Nothing is deleted; a command that may take more memory fails with DB_ERR_OOM
+  DB_MAXMEMORY_NOEVICTION,
+  // Keys are deleted least recently used first
+  DB_MAXMEMORY_ALLKEYS_LRU,
+  // Keys are deleted least frequently used first
+  DB_MAXMEMORY_ALLKEYS_LFU,
+  // Keys with a TTL are deleted nearest deadline first; the others never are
+  DB_MAXMEMORY_VOLATILE_TTL
+} db_maxmemory_policy_t;
+
+// Where pages_alloc takes large blocks from, see pages.h
+typedef enum db_pages_mode_t
+{
+  // calloc, as for everything else
+  DB_PAGES_DEFAULT,
+  // Mappings of their own with madvise(MADV_HUGEPAGE), bound to the node of the allocating thread
+  DB_PAGES_TRANSPARENT,
+  // Mappings of reserved huge pages (MAP_HUGETLB), transparent ones once the reserve is exhausted
+  DB_PAGES_HUGETLB
+} db_pages_mode_t;
+
+// File format written by db_save
+typedef enum db_persistence_format_t
+{
+  // Streamed binary snapshot, see snapshot.h
+  DB_PERSISTENCE_SNAPSHOT,
+  // The whole dataset as one JSON object, meant for exporting
+  DB_PERSISTENCE_JSON
+} db_persistence_format_t;
+
+// When the append-only log is flushed to disk
+typedef enum db_aof_fsync_t
+{
+  // Before the command is answered; nothing acknowledged is ever lost
+  DB_AOF_FSYNC_ALWAYS,
+  // By a background thread once a second; a crash loses at most the last second
+  DB_AOF_FSYNC_EVERYSEC,
+  // Whenever the kernel decides to
+  DB_AOF_FSYNC_NO
+} db_aof_fsync_t;
+
 typedef bool db_bool_t;
 typedef int32_t db_int_t;
 typedef uint32_t db_uint_t;
@@ -82,6 +257,13 @@ typedef uint8_t db_uint8_t;
 #define DB_DBL_N_INF -DBL_MAX
 
 typedef struct DBObj DBObj;
+typedef struct DBQuickList DBQuickList;
+typedef struct DBRope DBRope;
+typedef struct DBRadixTree DBRadixTree;
+typedef struct DBArena DBArena;
+typedef struct DBTransaction DBTransaction;
+// Defined in zset.h, see DB_TYPED_HASH
+typedef struct DBZSetDict DBZSetDict;
 
 typedef struct DBListNode
 {
@@ -95,15 +277,50 @@ typedef struct DBList
   DBListNode *head;
   DBListNode *tail;
   db_uint_t length;
+  // Bytes allocated for the list, its nodes and their values, kept up to date by list.c
+  size_t memory;
 } DBList;
 
 typedef struct DBHashEntry
 {
+  // Points right after the entry when the key is short enough to share its allocation
   char *key;
   struct DBHashEntry *next;
   DBObj *data;
+  // Cached so rehashing never hashes the key again and most mismatches skip the comparison
+  db_uint_t hash;
+  db_uint_t key_length;
+  // Deadline in unix milliseconds, 0 for none, so reading a key without a TTL takes one lookup;
+  // a key with one also has an entry in the expiry table
+  uint64_t expire_at_ms;
+  // Position in the timer heap of the expiry table while `expire_at_ms` is set
+  db_uint_t expire_index;
+  // When, or how often, the key was last used, see evict.h; only kept by keyspace tables
+  uint32_t access : 24;
+  // Set when the key belongs to the value, see ht_insert_borrowed
+  uint32_t borrowed_key : 1;
+  // Set when the entry leaves a table read concurrently, whose readers may still be looking at it,
+  // so freeing it waits for them; see ht_config_concurrent_reads
+  uint32_t defer_free : 1;
 } DBHashEntry;
 
+// Binary min-heap of the keyspace entries that have a deadline, soonest first
+typedef struct DBTimerHeap
+{
+  struct DBHashEntry **entries;
+  db_uint_t length;
+  db_uint_t capacity;
+} DBTimerHeap;
+
+// A key hashed once, when the request carrying it is built; the same handle routes it to a
+// shard and looks it up in both the keyspace and the expiry table
+typedef struct DBKey
+{
+  const char *string;
+  db_uint_t length;
+  db_uint_t hash;
+} DBKey;
+
 typedef struct DBHash
 {
   db_uint_t size0;
@@ -120,28 +337,85 @@ typedef struct DBHash
   // The occurrence of rehashing is determined by periodic tasks; when rehashing starts, rehashing_index will be the last index of the table size
   // Rehashing will be handled during periodic task execution and during db_insert_entry and db_get_entry.
   db_int_t rehashing_index;
+  // Bytes allocated for the table, its buckets, entries and keys, and its values except for the
+  // contents of list, hash and sorted set values, which count their own; kept up to date by hash.c
+  size_t memory;
+  // Only used by expiry tables, where it orders the keyspace entries the table holds deadlines for
+  DBTimerHeap timers;
+  // Every key of the table in byte order, kept along with the table once ht_config_key_index
+  // turns it on; NULL otherwise
+  DBRadixTree *key_index;
+  // Set when threads other than the owner look keys up with ht_read_concurrent; the owner then
+  // makes `seq` odd while it changes the table and hands what it unlinks to epoch_retire
+  db_bool_t concurrent_reads;
+  _Atomic db_uint_t seq;
+  // Set on the keyspace of a shard, see ht_config_keyspace; its entries then keep access bits for
+  // eviction, and the bytes of the contents of the values it deletes on expiry add up in
+  // `expired_contents` until the owner takes them
+  db_bool_t is_keyspace;
+  size_t expired_contents;
 } DBHash;
 
+// One allocation per element: the links, then `level` spans, then the member with its NUL, which
+// the dict of the set uses as its key; see zset_element_member and zset_element_span
 typedef struct DBZSetElement
 {
   db_double_t score;
-  char *member;
-  db_uint8_t level;
   struct DBZSetElement *backward;
-  struct DBZSetElement **forward;
+  db_uint_t member_length;
+  db_uint8_t level;
+  struct DBZSetElement *forward[];
 } DBZSetElement;
 
+// Entry of a packed sorted set, its member being `length` bytes at `offset` after the entries
+typedef struct DBZSetPackedEntry
+{
+  db_double_t score;
+  db_uint_t offset;
+  db_uint_t length;
+} DBZSetPackedEntry;
+
 typedef struct DBZSet
 {
-  DBHash *dict;
+  // A db_encoding_t, DB_ENCODING_ZSET_PACKED until the set outgrows it; the skiplist and the dict
+  // are only allocated after that, and `packed` only before
+  db_uint8_t encoding;
+  // `packed_length` entries sorted by score and member, then the members, each with a NUL
+  char *packed;
+  db_uint_t packed_length;
+  db_uint_t packed_members_size;
+  DBZSetDict *dict;
   db_uint8_t level;
   DBZSetElement **sentinel_forward;
+  // sentinel_span[i] is how many positions sentinel_forward[i] moves ahead, so the rank counted from
+  // 1 of the element it points to, or the card when it is NULL; the elements keep theirs likewise
+  db_uint_t *sentinel_span;
   DBZSetElement *tail;
+  // Bytes allocated for the set, its elements, the sentinel and `packed`, not counting `dict`
+  size_t memory;
 } DBZSet;
 
+// Fields and values of a small hash, each followed by its NUL, field then value, in one allocation
+typedef struct DBPackedHash
+{
+  db_uint_t length;
+  // Bytes of `data` in use, and allocated
+  db_uint_t used;
+  db_uint_t capacity;
+  char data[];
+} DBPackedHash;
+
 typedef struct DBObj
 {
-  db_type_t type;
+  // A db_type_t and a db_encoding_t, which fit in a byte each so the object stays 16 bytes
+  db_uint8_t type;
+  db_uint8_t encoding;
+  // Bytes allocated right after the object, which stay with it if it changes type
+  db_uint8_t embedded_size;
+  // Holders of the object, see dbobj_share; it is freed when the last one lets go. 0 for an object
+  // of a reply arena, which is freed with the arena instead, and DBOBJ_REFCOUNT_IMMORTAL for a
+  // shared one, which never is
+  _Atomic db_uint_t refcount;
   union DBObjValue
   {
     db_bool_t bool_value;
@@ -152,9 +426,11 @@ typedef struct DBObj
     char *message;
     char *string;
     DBList *list;
+    DBQuickList *quicklist;
+    DBRope *rope;
     DBZSet *zset;
-    DBZSetElement *_zsetele;
     DBHash *hash;
+    DBPackedHash *packed_hash;
   } value;
 } DBObj;
 
@@ -162,12 +438,47 @@ typedef struct DBRequest
 {
   db_action_t action;
   DBList *args;
+  // Handle of the first argument, set by add_request_arg; `key.string` is NULL until then
+  DBKey key;
+  // Streamed from the primary this server replicates, the only writes a replica takes
+  db_bool_t is_from_primary;
+  // Sent right after ASKING, so a slot being imported is served, see cluster.h
+  db_bool_t is_asking;
+  // What EXEC runs, which the request owns, or the transaction WATCH fills in; see transaction.h
+  DBTransaction *transaction;
 } DBRequest;
 
 typedef struct DBReply
 {
   db_bool_t done;
   DBObj *data;
+  // Signalled by the core worker once `done` is set, so waiters can park instead of spinning.
+  mtx_t done_lock;
+  cnd_t done_cond;
+  // Written to, when not -1, once `done` is set; lets an event loop learn of a reply that a
+  // blocking command got long after it was submitted
+  int notify_fd;
+  // Set by a client that went away; a blocked command that sees it is answered without popping
+  _Atomic db_bool_t is_cancelled;
+  // Where the command allocated `data` and what it holds, if it did so in one; NULL until
+  // reply_arena is first called, and freed with the reply
+  DBArena *arena;
+  // Set for a list answered a chunk at a time, see reply_stream_begin; the length of the whole
+  // list, of which `data` holds the elements not taken by reply_stream_take yet
+  db_bool_t is_streamed;
+  db_uint_t stream_length;
 } DBReply;
 
+// Requests that are submitted to the core together; replies[i] answers requests[i]
+typedef struct DBPipeline
+{
+  DBRequest **requests;
+  DBReply **replies;
+  db_uint_t length;
+  db_uint_t capacity;
+  // MULTI and WATCH state of the client submitting the pipeline, kept across submissions; NULL
+  // until it first uses them
+  DBTransaction *transaction;
+} DBPipeline;
+
 #endif
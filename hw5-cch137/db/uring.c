@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+#include "utils.h"
+#include "uring.h"
+
+#ifdef DB_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+struct DBUring
+{
+  int fd;
+  // A forked child must not submit into the ring it shares with its parent
+  pid_t pid;
+  // Shared with the kernel: it advances the SQ head and the CQ tail, we advance the others
+  _Atomic unsigned *sq_head;
+  _Atomic unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  _Atomic unsigned *cq_head;
+  _Atomic unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  // Entries filled in but not yet handed to the kernel end here
+  unsigned sqe_tail;
+  void *sq_map;
+  size_t sq_map_length;
+  void *cq_map;
+  size_t cq_map_length;
+  size_t sqes_length;
+};
+
+static once_flag uring_key_once = ONCE_FLAG_INIT;
+static tss_t uring_key;
+// Set once the kernel refuses a ring, so no thread asks again
+static _Atomic db_bool_t is_unavailable = false;
+
+static void uring_free(void *arg)
+{
+  DBUring *ring = (DBUring *)arg;
+  if (!ring)
+    return;
+  munmap(ring->sqes, ring->sqes_length);
+  if (ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_length);
+  munmap(ring->sq_map, ring->sq_map_length);
+  close(ring->fd);
+  free(ring);
+}
+
+static void uring_key_init()
+{
+  tss_create(&uring_key, uring_free);
+}
+
+static DBUring *uring_create(unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+    return NULL;
+
+  DBUring *ring = (DBUring *)calloc(1, sizeof(DBUring));
+  if (!ring)
+    EXIT_ON_MEMORY_ERROR();
+  ring->fd = fd;
+  ring->pid = getpid();
+  ring->sq_map_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP && ring->cq_map_length > ring->sq_map_length)
+    ring->sq_map_length = ring->cq_map_length;
+
+  ring->sq_map = mmap(NULL, ring->sq_map_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED)
+  {
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_map = ring->sq_map;
+  else
+    ring->cq_map = mmap(NULL, ring->cq_map_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+      munmap(ring->cq_map, ring->cq_map_length);
+    munmap(ring->sq_map, ring->sq_map_length);
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+
+  char *sq = (char *)ring->sq_map;
+  char *cq = (char *)ring->cq_map;
+  ring->sq_head = (_Atomic unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->sqe_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+  return ring;
+}
+
+DBUring *uring_thread()
+{
+  if (atomic_load_explicit(&is_unavailable, memory_order_relaxed))
+    return NULL;
+  call_once(&uring_key_once, uring_key_init);
+  DBUring *ring = (DBUring *)tss_get(uring_key);
+  if (ring)
+    return ring->pid == getpid() ? ring : NULL;
+  ring = uring_create(URING_ENTRIES);
+  if (!ring)
+  {
+    atomic_store(&is_unavailable, true);
+    return NULL;
+  }
+  tss_set(uring_key, ring);
+  return ring;
+}
+
+static unsigned uring_space(DBUring *ring)
+{
+  return ring->sq_entries - (ring->sqe_tail - atomic_load_explicit(ring->sq_head, memory_order_acquire));
+}
+
+static struct io_uring_sqe *uring_get_sqe(DBUring *ring, uint8_t opcode, int fd, uint64_t user_data)
+{
+  if (!uring_space(ring))
+    return NULL;
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sq_array[ring->sqe_tail & ring->sq_mask] = ring->sqe_tail & ring->sq_mask;
+  ++ring->sqe_tail;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  return sqe;
+}
+
+db_bool_t uring_prep_recv(DBUring *ring, int fd, void *buffer, size_t length, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_RECV, fd, user_data);
+  if (!sqe)
+    return false;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = (uint32_t)length;
+  return true;
+}
+
+db_bool_t uring_prep_writev(DBUring *ring, int fd, const struct iovec *iov, unsigned iov_length, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_WRITEV, fd, user_data);
+  if (!sqe)
+    return false;
+  sqe->addr = (uint64_t)(uintptr_t)iov;
+  sqe->len = iov_length;
+  // Sockets have no position; -1 keeps the kernel from treating this as a positioned write.
+  sqe->off = (uint64_t)-1;
+  return true;
+}
+
+db_bool_t uring_prep_write(DBUring *ring, int fd, const void *buffer, size_t length, int64_t offset, db_bool_t is_linked, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_WRITE, fd, user_data);
+  if (!sqe)
+    return false;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = (uint32_t)length;
+  sqe->off = (uint64_t)offset;
+  if (is_linked)
+    sqe->flags |= IOSQE_IO_LINK;
+  return true;
+}
+
+db_bool_t uring_prep_fdatasync(DBUring *ring, int fd, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_FSYNC, fd, user_data);
+  if (!sqe)
+    return false;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  return true;
+}
+
+db_bool_t uring_submit(DBUring *ring, unsigned wait_count)
+{
+  atomic_store_explicit(ring->sq_tail, ring->sqe_tail, memory_order_release);
+  for (;;)
+  {
+    // Whatever the kernel hasn't consumed yet, which after an interrupted wait is nothing.
+    unsigned pending = ring->sqe_tail - atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    long n = syscall(__NR_io_uring_enter, ring->fd, pending, wait_count, wait_count ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n >= 0)
+      return true;
+    if (errno != EINTR)
+      return false;
+  }
+}
+
+db_bool_t uring_complete(DBUring *ring, db_bool_t wait, uint64_t *user_data, int32_t *result)
+{
+  unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+  while (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire))
+  {
+    if (!wait)
+      return false;
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+      return false;
+  }
+  struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+  if (user_data)
+    *user_data = cqe->user_data;
+  if (result)
+    *result = cqe->res;
+  atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+  return true;
+}
+
+#else
+
+DBUring *uring_thread()
+{
+  return NULL;
+}
+
+db_bool_t uring_prep_recv(DBUring *ring, int fd, void *buffer, size_t length, uint64_t user_data)
+{
+  return false;
+}
+
+db_bool_t uring_prep_writev(DBUring *ring, int fd, const struct iovec *iov, unsigned iov_length, uint64_t user_data)
+{
+  return false;
+}
+
+db_bool_t uring_prep_write(DBUring *ring, int fd, const void *buffer, size_t length, int64_t offset, db_bool_t is_linked, uint64_t user_data)
+{
+  return false;
+}
+
+db_bool_t uring_prep_fdatasync(DBUring *ring, int fd, uint64_t user_data)
+{
+  return false;
+}
+
+db_bool_t uring_submit(DBUring *ring, unsigned wait_count)
+{
+  return false;
+}
+
+db_bool_t uring_complete(DBUring *ring, db_bool_t wait, uint64_t *user_data, int32_t *result)
+{
+  return false;
+}
+
+#endif
+
+db_bool_t uring_write_all(int fd, const void *buffer, size_t length, db_bool_t sync)
+{
+  const char *data = (const char *)buffer;
+  size_t written = 0;
+  db_bool_t is_synced = false;
+  ssize_t n;
+  DBUring *ring = uring_thread();
+
+  if (ring && length <= UINT32_MAX &&
+      uring_prep_write(ring, fd, data, length, -1, sync, 0) &&
+      (!sync || uring_prep_fdatasync(ring, fd, 1)) &&
+      uring_submit(ring, sync ? 2 : 1))
+  {
+    uint64_t user_data;
+    int32_t result;
+    for (int i = sync ? 2 : 1; i > 0 && uring_complete(ring, true, &user_data, &result); --i)
+    {
+      if (user_data == 0 && result > 0)
+        written = (size_t)result;
+      else if (user_data == 1)
+        is_synced = result == 0;
+    }
+  }
+
+  // A short write cancels the linked sync; the rest goes out the plain way.
+  while (written < length)
+  {
+    n = write(fd, data + written, length - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  return !sync || is_synced || fdatasync(fd) == 0;
+}
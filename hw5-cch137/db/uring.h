@@ -0,0 +1,50 @@
+#ifndef DB_URING_H
+#define DB_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "types.h"
+
+// io_uring backend for the socket and file I/O of the server, driven through the raw system calls.
+// Operations are queued on the ring of the calling thread and submitted together, so a batch of
+// reads, writes and syncs costs one system call instead of one each.
+// Built in on Linux unless compiled with -DDB_NO_IO_URING; when it isn't, or the kernel refuses
+// to create a ring, uring_thread() returns NULL and callers use plain system calls instead.
+#if defined(__linux__) && defined(__has_include) && !defined(DB_NO_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define DB_USE_IO_URING 1
+#endif
+#endif
+
+// Submission slots of a ring, enough for one operation per event the network loop takes at a time
+#define URING_ENTRIES 256
+
+typedef struct DBUring DBUring;
+
+// Ring of the calling thread, created on first use and freed when the thread exits; NULL when
+// io_uring is unavailable
+DBUring *uring_thread();
+
+// Queue an operation tagged with `user_data`, which comes back with its result; return false if
+// the submission queue is full
+db_bool_t uring_prep_recv(DBUring *ring, int fd, void *buffer, size_t length, uint64_t user_data);
+db_bool_t uring_prep_writev(DBUring *ring, int fd, const struct iovec *iov, unsigned iov_length, uint64_t user_data);
+// Writes at `offset`, or at the file position (the end, for O_APPEND files) when it is -1;
+// `is_linked` holds back the next operation until this one completes in full
+db_bool_t uring_prep_write(DBUring *ring, int fd, const void *buffer, size_t length, int64_t offset, db_bool_t is_linked, uint64_t user_data);
+db_bool_t uring_prep_fdatasync(DBUring *ring, int fd, uint64_t user_data);
+
+// Submits the queued operations and waits until `wait_count` of them have completed
+db_bool_t uring_submit(DBUring *ring, unsigned wait_count);
+
+// Takes one completion, waiting for it if `wait` is set; `result` is what the system call would
+// have returned, or -errno
+db_bool_t uring_complete(DBUring *ring, db_bool_t wait, uint64_t *user_data, int32_t *result);
+
+// Writes all of `length` bytes at the file position of `fd`, then syncs the data when `sync` is
+// set; write and sync go out in one submission when a ring is available
+db_bool_t uring_write_all(int fd, const void *buffer, size_t length, db_bool_t sync);
+
+#endif
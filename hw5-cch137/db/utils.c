@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <malloc.h>
 
 #include "utils.h"
 
@@ -70,6 +71,29 @@ char *dbutil_strdup(const char *source)
   return dup;
 }
 
+char *dbutil_strndup(const char *source, size_t length)
+{
+  char *dup = (char *)malloc(length + 1);
+  if (!dup)
+    EXIT_ON_MEMORY_ERROR();
+  memcpy(dup, source, length);
+  dup[length] = '\0';
+  return dup;
+}
+
+size_t dbutil_alloc_size(const void *pointer)
+{
+  return pointer ? malloc_usable_size((void *)pointer) : 0;
+}
+
+db_uint_t dbutil_pattern_prefix_length(const char *pattern)
+{
+  db_uint_t length = 0;
+  while (pattern[length] && pattern[length] != '*' && pattern[length] != '?' && pattern[length] != '\\')
+    ++length;
+  return length;
+}
+
 db_bool_t dbutil_match_keys(const char *source, const char *pattern)
 {
   const char *src_ptr = source;
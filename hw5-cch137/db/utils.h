@@ -17,8 +17,20 @@ char *input_string();
 // Duplicates a string, allocating memory for the new string.
 char *dbutil_strdup(const char *source);
 
+// Copies the `length` bytes at `source`, which need no NUL, into a new NUL-terminated string
+char *dbutil_strndup(const char *source, size_t length);
+
+// Returns the bytes the allocator reserved for a block, which may exceed the size requested; 0 for NULL
+size_t dbutil_alloc_size(const void *pointer);
+
+// Whether `source` matches the glob `pattern`, a byte at a time; KEYS and SCAN compile their
+// pattern once with glob.h instead
 db_bool_t dbutil_match_keys(const char *source, const char *pattern);
 
+// Bytes at the start of a pattern that every key it matches starts with, up to the first '*', '?'
+// or escape
+db_uint_t dbutil_pattern_prefix_length(const char *pattern);
+
 void debug_print(const char *s);
 
 // Don't use this function, please use the marco "EXIT_ON_ERROR()".
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "utils.h"
+#include "obj.h"
+#include "hash.h"
+#include "zset.h"
+#include "zaggregate.h"
+
+// A member of a source set with its weighted score, and a slot of the aggregation buffer, which
+// is empty while `member` is NULL
+typedef struct ZAggSlot
+{
+  const char *member;
+  db_uint_t length;
+  db_uint_t hash;
+  db_double_t score;
+} ZAggSlot;
+
+typedef struct ZAggJob
+{
+  DBZSet **sets;
+  db_double_t *weights;
+  db_uint_t length;
+  // Index of the smallest set, whose members are the candidates of an intersection
+  db_uint_t smallest;
+  db_aggregate_t aggregate;
+  db_bool_t is_inter;
+  db_uint_t partitions;
+} ZAggJob;
+
+typedef struct ZAggPartition
+{
+  const ZAggJob *job;
+  db_uint_t index;
+  // Aggregation buffer of a union; `capacity` is a power of two
+  ZAggSlot *slots;
+  db_uint_t capacity;
+  db_uint_t count;
+  // The members of the partition, sorted once the worker returns
+  DBZSetPair *pairs;
+  db_uint_t length;
+  db_uint_t pairs_capacity;
+} ZAggPartition;
+
+static inline db_double_t zagg_combine(db_aggregate_t aggregate, db_double_t a, db_double_t b)
+{
+  switch (aggregate)
+  {
+  case DB_AGG_MIN:
+    return a < b ? a : b;
+  case DB_AGG_MAX:
+    return a > b ? a : b;
+  default:
+    return a + b;
+  }
+}
+
+// Partitions take the members whose hash falls in their share of the 32-bit range
+static inline db_bool_t zagg_owns(const ZAggPartition *partition, db_uint_t hash)
+{
+  return partition->job->partitions == 1 || (db_uint_t)(((uint64_t)hash * partition->job->partitions) >> 32) == partition->index;
+}
+
+static int zagg_compare_pairs(const void *a, const void *b)
+{
+  const DBZSetPair *x = (const DBZSetPair *)a, *y = (const DBZSetPair *)b;
+  int s_cmp = (x->score > y->score) - (x->score < y->score);
+  return s_cmp ? s_cmp : strcmp(x->member, y->member);
+}
+
+static void zagg_push_pair(ZAggPartition *partition, const ZAggSlot *slot)
+{
+  if (partition->length == partition->pairs_capacity)
+  {
+    partition->pairs_capacity = partition->pairs_capacity ? partition->pairs_capacity * 2 : ZAGG_INITIAL_SLOTS;
+    DBZSetPair *pairs = (DBZSetPair *)realloc(partition->pairs, partition->pairs_capacity * sizeof(DBZSetPair));
+    if (!pairs)
+      EXIT_ON_MEMORY_ERROR();
+    partition->pairs = pairs;
+  }
+  partition->pairs[partition->length++] = (DBZSetPair){.member = slot->member, .length = slot->length, .score = slot->score};
+}
+
+static void zagg_grow(ZAggPartition *partition)
+{
+  ZAggSlot *old_slots = partition->slots;
+  db_uint_t old_capacity = partition->capacity;
+  partition->capacity = old_capacity ? old_capacity * 2 : ZAGG_INITIAL_SLOTS;
+  partition->slots = (ZAggSlot *)calloc(partition->capacity, sizeof(ZAggSlot));
+  if (!partition->slots)
+    EXIT_ON_MEMORY_ERROR();
+
+  db_uint_t mask = partition->capacity - 1, index;
+  for (db_uint_t i = 0; i < old_capacity; ++i)
+  {
+    if (!old_slots[i].member)
+      continue;
+    for (index = old_slots[i].hash & mask; partition->slots[index].member; index = (index + 1) & mask)
+      ;
+    partition->slots[index] = old_slots[i];
+  }
+  free(old_slots);
+}
+
+// Adds a member of one of the sets of a union to the buffer, or its score to the member's
+static void zagg_visit_union(ZAggPartition *partition, const ZAggSlot *member)
+{
+  if ((partition->count + 1) * 10 >= partition->capacity * 7)
+    zagg_grow(partition);
+
+  db_uint_t mask = partition->capacity - 1;
+  ZAggSlot *slot;
+  for (db_uint_t index = member->hash & mask;; index = (index + 1) & mask)
+  {
+    slot = &partition->slots[index];
+    if (!slot->member)
+      break;
+    if (slot->hash == member->hash && slot->length == member->length && memcmp(slot->member, member->member, member->length) == 0)
+    {
+      slot->score = zagg_combine(partition->job->aggregate, slot->score, member->score);
+      return;
+    }
+  }
+  *slot = *member;
+  ++partition->count;
+}
+
+// Keeps a member of the smallest set of an intersection if every other set has it too
+static void zagg_visit_inter(ZAggPartition *partition, const ZAggSlot *member)
+{
+  const ZAggJob *job = partition->job;
+  DBKey key = {.string = member->member, .length = member->length, .hash = member->hash};
+  ZAggSlot result = *member;
+  db_double_t score;
+
+  // the scores are combined in the order of the sets, whichever one is the smallest
+  for (db_uint_t i = 0; i < job->length; ++i)
+  {
+    if (i == job->smallest)
+      score = member->score;
+    else if (zset_score_of(job->sets[i], &key, &score))
+      score *= job->weights[i];
+    else
+      return;
+    result.score = i ? zagg_combine(job->aggregate, result.score, score) : score;
+  }
+  zagg_push_pair(partition, &result);
+}
+
+// Hands every member of `zset` that belongs to the partition to `visit`; skiplist sets are read
+// through their dict, which already holds the hash of every member
+static void zagg_scan(ZAggPartition *partition, const DBZSet *zset, db_double_t weight, void (*visit)(ZAggPartition *, const ZAggSlot *))
+{
+  ZAggSlot member;
+
+  if (!zset->dict)
+  {
+    DBZSetIter iter;
+    zset_iter_init(zset, &iter);
+    while ((member.member = zset_iter_next(&iter, &member.score)))
+    {
+      member.length = strlen(member.member);
+      member.hash = murmurhash2(member.member, member.length);
+      member.score *= weight;
+      if (zagg_owns(partition, member.hash))
+        visit(partition, &member);
+    }
+    return;
+  }
+
+  for (int table = 0; table < 2; ++table)
+  {
+    for (db_uint_t i = 0; i < zset->dict->sizes[table]; ++i)
+    {
+      for (const DBZSetDictEntry *entry = zset->dict->buckets[table][i]; entry; entry = entry->next)
+      {
+        if (!zagg_owns(partition, entry->hash))
+          continue;
+        member = (ZAggSlot){.member = entry->key, .length = entry->key_length, .hash = entry->hash, .score = entry->value->score * weight};
+        visit(partition, &member);
+      }
+    }
+  }
+}
+
+static int zagg_worker(void *arg)
+{
+  ZAggPartition *partition = (ZAggPartition *)arg;
+  const ZAggJob *job = partition->job;
+
+  if (job->is_inter)
+    zagg_scan(partition, job->sets[job->smallest], job->weights[job->smallest], zagg_visit_inter);
+  else
+  {
+    for (db_uint_t i = 0; i < job->length; ++i)
+      zagg_scan(partition, job->sets[i], job->weights[i], zagg_visit_union);
+    for (db_uint_t i = 0; i < partition->capacity; ++i)
+      if (partition->slots[i].member)
+        zagg_push_pair(partition, &partition->slots[i]);
+    free(partition->slots);
+    partition->slots = NULL;
+  }
+
+  qsort(partition->pairs, partition->length, sizeof(DBZSetPair), zagg_compare_pairs);
+  return 0;
+}
+
+// Merges the sorted partitions, whose members are disjoint, into one sorted array
+static DBZSetPair *zagg_merge(ZAggPartition *partitions, db_uint_t count, db_uint_t *length)
+{
+  db_uint_t total = 0, positions[ZAGG_MAX_THREADS] = {0};
+  for (db_uint_t i = 0; i < count; ++i)
+    total += partitions[i].length;
+  DBZSetPair *pairs = (DBZSetPair *)malloc((total ? total : 1) * sizeof(DBZSetPair));
+  if (!pairs)
+    EXIT_ON_MEMORY_ERROR();
+
+  for (db_uint_t n = 0; n < total; ++n)
+  {
+    db_int_t next = -1;
+    for (db_uint_t i = 0; i < count; ++i)
+      if (positions[i] < partitions[i].length &&
+          (next < 0 || zagg_compare_pairs(&partitions[i].pairs[positions[i]], &partitions[next].pairs[positions[next]]) < 0))
+        next = i;
+    pairs[n] = partitions[next].pairs[positions[next]++];
+  }
+  *length = total;
+  return pairs;
+}
+
+static DBObj *zagg_run(DBList *zsets, DBList *weights, db_aggregate_t aggregate, db_bool_t is_inter)
+{
+  if (!zsets)
+    return dbobj_create_error(DB_ERR_WRONGTYPE);
+  for (DBListNode *node = zsets->head; node; node = node->next)
+    if (!dbobj_is_zset(node->data))
+      return dbobj_create_error(DB_ERR_WRONGTYPE);
+  if (is_inter && !zsets->length)
+    return dbobj_create_error(DB_ERR_ARG_ERROR);
+  if (aggregate != DB_AGG_SUM && aggregate != DB_AGG_MIN && aggregate != DB_AGG_MAX)
+    return dbobj_create_error(DB_ERR_SYNTAX_ERROR);
+
+  ZAggJob job = {.length = zsets->length, .smallest = 0, .aggregate = aggregate, .is_inter = is_inter, .partitions = 1};
+  job.sets = (DBZSet **)malloc((job.length ? job.length : 1) * sizeof(DBZSet *));
+  job.weights = (db_double_t *)malloc((job.length ? job.length : 1) * sizeof(db_double_t));
+  if (!job.sets || !job.weights)
+    EXIT_ON_MEMORY_ERROR();
+
+  uint64_t work = 0;
+  DBListNode *node = zsets->head, *weight_node = weights ? weights->head : NULL;
+  for (db_uint_t i = 0; i < job.length; ++i, node = node->next)
+  {
+    job.sets[i] = node->data->value.zset;
+    job.weights[i] = weight_node ? weight_node->data->value.double_value : 1;
+    weight_node = weight_node ? weight_node->next : NULL;
+    if (zcard(job.sets[i]) < zcard(job.sets[job.smallest]))
+      job.smallest = i;
+    work += zcard(job.sets[i]);
+  }
+  // an intersection probes every set for each member of the smallest one
+  if (is_inter)
+    work = (uint64_t)zcard(job.sets[job.smallest]) * job.length;
+
+  if (work >= ZAGG_PARALLEL_MIN_MEMBERS)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    job.partitions = cpus < 1 ? 1 : cpus < ZAGG_MAX_THREADS ? (db_uint_t)cpus : ZAGG_MAX_THREADS;
+  }
+
+  ZAggPartition partitions[ZAGG_MAX_THREADS];
+  thrd_t threads[ZAGG_MAX_THREADS];
+  db_bool_t started[ZAGG_MAX_THREADS] = {false};
+  for (db_uint_t i = 0; i < job.partitions; ++i)
+    partitions[i] = (ZAggPartition){.job = &job, .index = i};
+
+  // the calling thread takes the first partition, and any a thread couldn't be started for
+  for (db_uint_t i = 1; i < job.partitions; ++i)
+    started[i] = thrd_create(&threads[i], zagg_worker, &partitions[i]) == thrd_success;
+  zagg_worker(&partitions[0]);
+  for (db_uint_t i = 1; i < job.partitions; ++i)
+  {
+    if (started[i])
+      thrd_join(threads[i], NULL);
+    else
+      zagg_worker(&partitions[i]);
+  }
+
+  db_uint_t length;
+  DBZSetPair *pairs = zagg_merge(partitions, job.partitions, &length);
+  DBZSet *result = zset_create_sorted(pairs, length);
+
+  free(pairs);
+  for (db_uint_t i = 0; i < job.partitions; ++i)
+    free(partitions[i].pairs);
+  free(job.sets);
+  free(job.weights);
+  return dbobj_create_zset(result);
+}
+
+DBObj *zinterstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate)
+{
+  return zagg_run(zsets, weights, aggregate, true);
+}
+
+DBObj *zunionstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate)
+{
+  return zagg_run(zsets, weights, aggregate, false);
+}
@@ -0,0 +1,29 @@
+#ifndef DB_ZAGGREGATE_H
+#define DB_ZAGGREGATE_H
+
+#include "types.h"
+
+// ZUNIONSTORE and ZINTERSTORE. Members and their weighted scores are gathered into an open
+// addressing buffer of (member, score) slots that borrows the members from the source sets, so
+// aggregating allocates nothing per member. The result is sorted once and handed to
+// zset_create_sorted, which links the destination in one pass instead of a zadd per member.
+//
+// Inputs of ZAGG_PARALLEL_MIN_MEMBERS members or more are split by member hash into one partition
+// per thread; each thread scans every source but only aggregates and sorts its own members, and
+// the sorted partitions are merged at the end. The sources are only read, so they must not change
+// until the call returns.
+
+// Source members, counted over every set, from which the work is spread over threads
+#define ZAGG_PARALLEL_MIN_MEMBERS (1 << 16)
+// Most threads one call uses
+#define ZAGG_MAX_THREADS 8
+// Slots of the aggregation buffer of a partition at first; it doubles when 70% full
+#define ZAGG_INITIAL_SLOTS 64
+
+// Both take a list of sorted set objects and, optionally, a list of double objects with a weight
+// for each; the reply is a new sorted set object, or an error
+DBObj *zinterstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate);
+
+DBObj *zunionstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate);
+
+#endif
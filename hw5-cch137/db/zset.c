@@ -7,65 +7,128 @@
 #include "utils.h"
 #include "hash.h"
 #include "list.h"
+#include "slab.h"
+#include "trace.h"
 #include "zset.h"
 
 #define SKIPLIST_MAXLEVEL 32
 #define SKIPLIST_P 0.25
 
+db_uint_t zset_packed_max_members = ZSET_PACKED_MAX_MEMBERS;
+db_uint_t zset_packed_max_length = ZSET_PACKED_MAX_LENGTH;
+
 static int compare_zset_ele(const DBZSetElement *a, const DBZSetElement *b)
 {
   if (!a)
     return -1;
   if (!b)
     return 1;
-  int s_cmp = a->score - b->score;
+  // only exact ties compare the members
+  int s_cmp = (a->score > b->score) - (a->score < b->score);
   if (s_cmp)
     return s_cmp;
-  return strcmp(a->member, b->member);
+  return strcmp(zset_element_member(a), zset_element_member(b));
 }
 
-static DBZSetElement *lookup_previos_element_in_level(const DBZSet *zset, const db_uint8_t level, const DBZSetElement *element, DBZSetElement *start_ele)
+// Bytes slab_alloc was asked for
+static inline size_t zset_element_alloc_size(const DBZSetElement *element)
 {
-  if (!zset || !element)
-    EXIT_ON_ERROR("Invalid ZSet or ZSetElement");
-  if (zset->level < level)
-    EXIT_ON_ERROR("Invalid ZSet Level");
-  DBZSetElement *current = start_ele ? start_ele : zset->sentinel_forward[level];
-  if (!current || compare_zset_ele(element, current) < 0)
-    return NULL;
-  while (current->forward[level] && compare_zset_ele(element, current->forward[level]) > 0)
-    current = current->forward[level];
-  return current;
+  return sizeof(DBZSetElement) + element->level * (sizeof(DBZSetElement *) + sizeof(db_uint_t)) + element->member_length + 1;
 }
 
-static DBZSetElement *lookup_first_element_with_score(
-    DBZSet *zset,
-    db_double_t score,
-    bool included_score)
+db_uint_t *zset_element_span(const DBZSetElement *element)
 {
-  if (!zset)
-    EXIT_ON_ERROR("Invalid ZSet");
+  return (db_uint_t *)(element->forward + element->level);
+}
+
+char *zset_element_member(const DBZSetElement *element)
+{
+  return (char *)(zset_element_span(element) + element->level);
+}
 
-  if (included_score && zset->sentinel_forward[0]->score == score)
-    return zset->sentinel_forward[0];
+// The sentinel is passed around as NULL, these give the links of either
+static inline DBZSetElement **zset_forward_of(const DBZSet *zset, const DBZSetElement *element)
+{
+  return element ? (DBZSetElement **)element->forward : zset->sentinel_forward;
+}
 
+static inline db_uint_t *zset_span_of(const DBZSet *zset, const DBZSetElement *element)
+{
+  return element ? zset_element_span(element) : zset->sentinel_span;
+}
+
+// Fills `update` with the last element before `element` on every level of the set, NULL for the
+// sentinel, and `rank` with the rank of each of those, 0 for the sentinel
+static void lookup_previous_elements(const DBZSet *zset, const DBZSetElement *element, DBZSetElement **update, db_uint_t *rank)
+{
   DBZSetElement *current = NULL;
+  for (int lvl = zset->level; --lvl >= 0;)
+  {
+    rank[lvl] = lvl == zset->level - 1 ? 0 : rank[lvl + 1];
+    DBZSetElement **forward = zset_forward_of(zset, current);
+    while (forward[lvl] && forward[lvl] != element && compare_zset_ele(forward[lvl], element) < 0)
+    {
+      rank[lvl] += zset_span_of(zset, current)[lvl];
+      current = forward[lvl];
+      forward = current->forward;
+    }
+    update[lvl] = current;
+  }
+}
 
-  for (int lvl = zset->level - 1; lvl >= 0; --lvl)
+// Element at `rank`, counted from 1, or NULL if the set is shorter
+static DBZSetElement *lookup_element_by_rank(const DBZSet *zset, db_uint_t rank)
+{
+  DBZSetElement *current = NULL;
+  db_uint_t traversed = 0;
+  for (int lvl = zset->level; --lvl >= 0;)
   {
-    if (!current && zset->sentinel_forward[lvl] && (included_score ? zset->sentinel_forward[lvl]->score < score : zset->sentinel_forward[lvl]->score <= score))
-      current = zset->sentinel_forward[lvl];
-    while (current && current->forward[lvl] &&
-           (included_score ? current->forward[lvl]->score < score
-                           : current->forward[lvl]->score <= score))
+    while (zset_forward_of(zset, current)[lvl] && traversed + zset_span_of(zset, current)[lvl] <= rank)
     {
-      current = current->forward[lvl];
+      traversed += zset_span_of(zset, current)[lvl];
+      current = zset_forward_of(zset, current)[lvl];
     }
+    if (traversed == rank)
+      return current;
   }
+  return NULL;
+}
+
+// Whether an element with `score` comes before every element a bound at `bound` admits: below it,
+// or on it when the bound is exclusive. The comparisons are combined without branching, so the
+// search pays no mispredictions on scores close to the bound
+static inline db_bool_t score_before_bound(db_double_t score, db_double_t bound, db_bool_t included)
+{
+  return (score < bound) | ((score == bound) & !included);
+}
 
-  return current && current->forward[0] ? current->forward[0] : current;
+// Whether an element with `score` is admitted by a bound at `bound` from above
+static inline db_bool_t score_within_upper_bound(db_double_t score, db_double_t bound, db_bool_t included)
+{
+  return (score < bound) | ((score == bound) & included);
 }
 
+// First element at or above `score`, strictly above if it isn't included; NULL if there is none
+static DBZSetElement *lookup_first_element_with_score(
+    DBZSet *zset,
+    db_double_t score,
+    bool included_score)
+{
+  if (!zset)
+    EXIT_ON_ERROR("Invalid ZSet");
+  if (!zset->level)
+    return NULL;
+
+  DBZSetElement **forward = zset->sentinel_forward;
+  for (int lvl = zset->level; --lvl >= 0;)
+  {
+    while (forward[lvl] && score_before_bound(forward[lvl]->score, score, included_score))
+      forward = forward[lvl]->forward;
+  }
+  return forward[0];
+}
+
+// Last element at or below `score`, strictly below if it isn't included; NULL if there is none
 static DBZSetElement *lookup_last_element_with_score(
     DBZSet *zset,
     db_double_t score,
@@ -73,51 +136,194 @@ static DBZSetElement *lookup_last_element_with_score(
 {
   if (!zset)
     EXIT_ON_ERROR("Invalid ZSet");
+  if (!zset->level)
+    return NULL;
 
   DBZSetElement *current = NULL;
-
-  for (int lvl = zset->level - 1; lvl >= 0; --lvl)
+  DBZSetElement **forward = zset->sentinel_forward;
+  for (int lvl = zset->level; --lvl >= 0;)
   {
-    if (!current && zset->sentinel_forward[lvl] &&
-        (included_score ? zset->sentinel_forward[lvl]->score <= score
-                        : zset->sentinel_forward[lvl]->score < score))
-      current = zset->sentinel_forward[lvl];
-
-    while (current && current->forward[lvl] &&
-           (included_score ? current->forward[lvl]->score <= score
-                           : current->forward[lvl]->score < score))
+    while (forward[lvl] && score_within_upper_bound(forward[lvl]->score, score, included_score))
     {
-      current = current->forward[lvl];
+      current = forward[lvl];
+      forward = current->forward;
     }
   }
   return current;
 }
 
-static DBZSetElement *create_zset_ele(db_double_t score, char *member)
+static inline db_bool_t zset_is_packed(const DBZSet *zset)
+{
+  return zset->encoding == DB_ENCODING_ZSET_PACKED;
+}
+
+static inline DBZSetPackedEntry *zset_packed_entries(const DBZSet *zset)
+{
+  return (DBZSetPackedEntry *)zset->packed;
+}
+
+static inline char *zset_packed_members(const DBZSet *zset)
+{
+  return zset->packed + zset->packed_length * sizeof(DBZSetPackedEntry);
+}
+
+static inline char *zset_packed_member(const DBZSet *zset, db_uint_t index)
+{
+  return zset_packed_members(zset) + zset_packed_entries(zset)[index].offset;
+}
+
+// Index of the entry of `member`, -1 if there is none; lengths are compared before any bytes
+static db_int_t zset_packed_find(const DBZSet *zset, const char *member, db_uint_t length)
+{
+  const DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  const char *members = zset_packed_members(zset);
+  for (db_uint_t i = 0; i < zset->packed_length; ++i)
+    if (entries[i].length == length && memcmp(members + entries[i].offset, member, length) == 0)
+      return i;
+  return -1;
+}
+
+// Index an entry for `score` and `member` goes to, keeping the ordering of the skiplist
+static db_uint_t zset_packed_position(const DBZSet *zset, db_double_t score, const char *member)
+{
+  const DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  db_uint_t low = 0, high = zset->packed_length;
+  while (low < high)
+  {
+    db_uint_t middle = low + (high - low) / 2;
+    int s_cmp = (entries[middle].score > score) - (entries[middle].score < score);
+    if (s_cmp < 0 || (!s_cmp && strcmp(zset_packed_member(zset, middle), member) < 0))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Index of the first entry a lower bound at `score` admits, the length if none
+static db_uint_t zset_packed_lower_bound(const DBZSet *zset, db_double_t score, db_bool_t included)
+{
+  const DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  db_uint_t low = 0, high = zset->packed_length;
+  while (low < high)
+  {
+    db_uint_t middle = low + (high - low) / 2;
+    if (score_before_bound(entries[middle].score, score, included))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Index right after the last entry an upper bound at `score` admits, 0 if none
+static db_uint_t zset_packed_upper_bound(const DBZSet *zset, db_double_t score, db_bool_t included)
+{
+  const DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  db_uint_t low = 0, high = zset->packed_length;
+  while (low < high)
+  {
+    db_uint_t middle = low + (high - low) / 2;
+    if (score_within_upper_bound(entries[middle].score, score, included))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static void zset_packed_resize(DBZSet *zset, size_t size)
+{
+  zset->memory -= dbutil_alloc_size(zset->packed);
+  if (!size)
+  {
+    free(zset->packed);
+    zset->packed = NULL;
+    return;
+  }
+  char *packed = (char *)realloc(zset->packed, size);
+  if (!packed)
+    EXIT_ON_MEMORY_ERROR();
+  zset->packed = packed;
+  zset->memory += dbutil_alloc_size(zset->packed);
+}
+
+// Inserts a member that isn't in the set yet
+static void zset_packed_insert(DBZSet *zset, db_double_t score, const char *member, db_uint_t length)
+{
+  db_uint_t position = zset_packed_position(zset, score, member);
+  size_t entries_size = zset->packed_length * sizeof(DBZSetPackedEntry);
+  zset_packed_resize(zset, entries_size + sizeof(DBZSetPackedEntry) + zset->packed_members_size + length + 1);
+
+  // the members move up to make room for the entry
+  memmove(zset->packed + entries_size + sizeof(DBZSetPackedEntry), zset->packed + entries_size, zset->packed_members_size);
+  DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  memmove(entries + position + 1, entries + position, (zset->packed_length - position) * sizeof(DBZSetPackedEntry));
+  entries[position] = (DBZSetPackedEntry){.score = score, .offset = zset->packed_members_size, .length = length};
+  ++zset->packed_length;
+
+  memcpy(zset_packed_members(zset) + zset->packed_members_size, member, length + 1);
+  zset->packed_members_size += length + 1;
+}
+
+static void zset_packed_delete(DBZSet *zset, db_uint_t index)
+{
+  DBZSetPackedEntry *entries = zset_packed_entries(zset);
+  char *members = zset_packed_members(zset);
+  db_uint_t offset = entries[index].offset, size = entries[index].length + 1;
+
+  memmove(members + offset, members + offset + size, zset->packed_members_size - offset - size);
+  zset->packed_members_size -= size;
+  for (db_uint_t i = 0; i < zset->packed_length; ++i)
+    if (entries[i].offset > offset)
+      entries[i].offset -= size;
+
+  // the members move down into the place of the entry
+  memmove(entries + index, entries + index + 1, (zset->packed_length - index - 1) * sizeof(DBZSetPackedEntry));
+  --zset->packed_length;
+  memmove(zset_packed_members(zset), members, zset->packed_members_size);
+  zset_packed_resize(zset, zset->packed_length * sizeof(DBZSetPackedEntry) + zset->packed_members_size);
+}
+
+static db_uint8_t zset_random_level()
 {
   db_uint8_t level = 1;
   while (level < SKIPLIST_MAXLEVEL && (rand() & 0xFFFF) < (SKIPLIST_P * 0xFFFF))
   {
     ++level;
   }
-  DBZSetElement *new_el = (DBZSetElement *)malloc(sizeof(DBZSetElement));
-  if (!new_el)
-    EXIT_ON_MEMORY_ERROR();
+  return level;
+}
+
+// Level of the element at `rank`, counted from 1, in a set built in order: one more for each time
+// 4 divides the rank, so every 4th element reaches level 2, every 16th level 3, and so on, which
+// is the shape SKIPLIST_P gives on average without its tall outliers
+static db_uint8_t zset_balanced_level(db_uint_t rank)
+{
+  db_uint8_t level = 1 + __builtin_ctz(rank) / 2;
+  return level < SKIPLIST_MAXLEVEL ? level : SKIPLIST_MAXLEVEL;
+}
+
+static DBZSetElement *create_zset_ele(db_double_t score, const char *member, db_uint_t member_length, db_uint8_t level)
+{
+  size_t links_size = level * (sizeof(DBZSetElement *) + sizeof(db_uint_t));
+  DBZSetElement *new_el = (DBZSetElement *)slab_alloc(sizeof(DBZSetElement) + links_size + member_length + 1);
   new_el->score = score;
-  new_el->member = member;
+  new_el->backward = NULL;
+  new_el->member_length = member_length;
   new_el->level = level;
-  new_el->forward = calloc(level, sizeof(DBZSetElement *));
-  if (!new_el->forward)
-    EXIT_ON_MEMORY_ERROR();
+  memset(new_el->forward, 0, links_size);
+  memcpy(zset_element_member(new_el), member, member_length + 1);
   return new_el;
 }
 
-static db_bool_t zset_has_member(DBZSet *zset, const char *member)
+db_bool_t zset_has_member(DBZSet *zset, const char *member)
 {
   if (!zset || !member)
     return false;
-  DBHashEntry *element = hget(zset->dict, member, NULL);
-  return element ? true : false;
+  if (zset_is_packed(zset))
+    return zset_packed_find(zset, member, strlen(member)) >= 0;
+  return zdict_get(zset->dict, member) != NULL;
 }
 
 DBZSet *zset_create()
@@ -125,427 +331,605 @@ DBZSet *zset_create()
   DBZSet *zset = (DBZSet *)malloc(sizeof(DBZSet));
   if (!zset)
     EXIT_ON_MEMORY_ERROR();
-  zset->dict = ht_create();
+  zset->encoding = DB_ENCODING_ZSET_PACKED;
+  zset->packed = NULL;
+  zset->packed_length = 0;
+  zset->packed_members_size = 0;
+  zset->dict = NULL;
   zset->level = 0;
   zset->sentinel_forward = NULL;
+  zset->sentinel_span = NULL;
+  zset->tail = NULL;
+  zset->memory = dbutil_alloc_size(zset);
   return zset;
 }
 
-void free_dbzset(DBZSet *zset)
+// Frees everything the set holds but the DBZSet itself
+static void zset_free_contents(DBZSet *zset)
 {
-  if (!zset)
-    return;
-  DBZSetElement *curr = zset->sentinel_forward[0];
+  free(zset->packed);
+  // the dict borrows its keys from the elements, so it goes first
+  zdict_free(zset->dict);
+  DBZSetElement *curr = zset->sentinel_forward ? zset->sentinel_forward[0] : NULL;
   DBZSetElement *next;
   while (curr)
   {
     next = curr->forward[0];
-    // we don't free member, because it will be free when free dict
-    free(curr->forward);
-    free(curr);
+    slab_free(curr, zset_element_alloc_size(curr));
     curr = next;
   }
   free(zset->sentinel_forward);
-  ht_free(zset->dict);
-  free(zset);
+  free(zset->sentinel_span);
 }
 
-db_uint_t zadd(DBZSet *zset, db_double_t score, const char *member)
+void free_dbzset(DBZSet *zset)
 {
-  if (!member || !zset)
-    return 0;
-
-  zrem(zset, member);
-  char *duplicated_member = dbutil_strdup(member);
-  DBZSetElement *element = create_zset_ele(score, duplicated_member);
-  hset(zset->dict, duplicated_member, _dbobj_create_zsetele(element), NULL);
+  if (!zset)
+    return;
+  zset_free_contents(zset);
+  free(zset);
+}
 
-  // zset up level
-  while (zset->level < element->level)
+// Adds levels to the sentinel up to `level`, each empty and with `span` as its span
+static void zset_grow_levels(DBZSet *zset, db_uint8_t level, db_uint_t span)
+{
+  zset->memory -= dbutil_alloc_size(zset->sentinel_forward) + dbutil_alloc_size(zset->sentinel_span);
+  DBZSetElement **new_sentinel_forward = (DBZSetElement **)realloc(zset->sentinel_forward, level * sizeof(DBZSetElement *));
+  db_uint_t *new_sentinel_span = (db_uint_t *)realloc(zset->sentinel_span, level * sizeof(db_uint_t));
+  if (!new_sentinel_forward || !new_sentinel_span)
+    EXIT_ON_MEMORY_ERROR();
+  zset->sentinel_forward = new_sentinel_forward;
+  zset->sentinel_span = new_sentinel_span;
+  zset->memory += dbutil_alloc_size(zset->sentinel_forward) + dbutil_alloc_size(zset->sentinel_span);
+  for (; zset->level < level; ++zset->level)
   {
-    DBZSetElement **new_sentinel_forward = (DBZSetElement **)realloc(zset->sentinel_forward, (++zset->level) * sizeof(DBZSetElement *));
-    if (!new_sentinel_forward)
-      EXIT_ON_MEMORY_ERROR();
-    zset->sentinel_forward = new_sentinel_forward;
-    zset->sentinel_forward[zset->level - 1] = NULL;
+    zset->sentinel_forward[zset->level] = NULL;
+    zset->sentinel_span[zset->level] = span;
   }
+}
 
-  // insert element
-  DBZSetElement *previous = NULL;
-  for (int lvl = element->level; --lvl >= 0;)
+// Links a member that isn't in the set yet into the skiplist
+static void zset_skiplist_insert(DBZSet *zset, db_double_t score, const char *member)
+{
+  uint64_t trace_at = TRACE_BEGIN();
+  db_uint_t length = zcard(zset);
+  DBZSetElement *element = create_zset_ele(score, member, strlen(member), zset_random_level());
+  zdict_insert(zset->dict, zset_element_member(element), element->member_length, element);
+  zset->memory += slab_size(zset_element_alloc_size(element));
+
+  // zset up level, the new levels of the sentinel skip the whole set
+  if (zset->level < element->level)
+    zset_grow_levels(zset, element->level, length);
+
+  // insert element, splitting the span of the link it goes under on each of its levels
+  DBZSetElement *update[SKIPLIST_MAXLEVEL];
+  db_uint_t rank[SKIPLIST_MAXLEVEL];
+  lookup_previous_elements(zset, element, update, rank);
+  for (int lvl = 0; lvl < zset->level; ++lvl)
   {
-    previous = lookup_previos_element_in_level(zset, lvl, element, previous);
-    if (previous == element)
+    DBZSetElement **forward = zset_forward_of(zset, update[lvl]);
+    db_uint_t *span = zset_span_of(zset, update[lvl]);
+    if (lvl >= element->level)
+    {
+      ++span[lvl];
       continue;
-    if (previous)
-      element->forward[lvl] = previous->forward[lvl],
-      previous->forward[lvl] = element;
-    else
-      element->forward[lvl] = zset->sentinel_forward[lvl],
-      zset->sentinel_forward[lvl] = element;
-    if (lvl == 0)
-      element->backward = previous;
+    }
+    element->forward[lvl] = forward[lvl];
+    forward[lvl] = element;
+    zset_element_span(element)[lvl] = span[lvl] - (rank[0] - rank[lvl]);
+    span[lvl] = rank[0] - rank[lvl] + 1;
   }
+  element->backward = update[0];
   if (element->forward[0])
     element->forward[0]->backward = element;
   else
     zset->tail = element;
-
-  return zcard(zset);
+  TRACE_END(TRACE_ZSL_INSERT, trace_at, length + 1);
 }
 
-DBObj *zscore(DBZSet *zset, const char *member)
+// Moves the members of a packed set into a new skiplist and dict
+static void zset_convert_to_skiplist(DBZSet *zset)
 {
-  if (!zset || !member)
-    return dbobj_create_null();
-  DBHashEntry *entry = hget(zset->dict, member, NULL);
-  if (!entry)
-    return dbobj_create_null();
-  return dbobj_create_double(entry->data->value._zsetele->score);
+  zset->encoding = DB_ENCODING_SKIPLIST;
+  zset->dict = zdict_create();
+  zdict_reserve(zset->dict, zset->packed_length + 1);
+  for (db_uint_t i = 0; i < zset->packed_length; ++i)
+    zset_skiplist_insert(zset, zset_packed_entries(zset)[i].score, zset_packed_member(zset, i));
+  zset->memory -= dbutil_alloc_size(zset->packed);
+  free(zset->packed);
+  zset->packed = NULL;
+  zset->packed_length = 0;
+  zset->packed_members_size = 0;
 }
 
-db_uint_t zcard(DBZSet *zset)
+db_uint_t zadd(DBZSet *zset, db_double_t score, const char *member)
 {
-  if (!zset)
+  if (!member || !zset)
     return 0;
-  return zset->dict->count0 + zset->dict->count1;
+
+  zrem(zset, member);
+  if (zset_is_packed(zset))
+  {
+    db_uint_t length = strlen(member);
+    if (zset->packed_length < zset_packed_max_members && length <= zset_packed_max_length)
+    {
+      zset_packed_insert(zset, score, member, length);
+      return zcard(zset);
+    }
+    zset_convert_to_skiplist(zset);
+  }
+  zset_skiplist_insert(zset, score, member);
+  return zcard(zset);
 }
 
-db_uint_t zcount(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max)
+DBZSet *zset_create_sorted(const DBZSetPair *pairs, db_uint_t length)
 {
-  if (min >= max)
-    return 0;
-  DBZSetElement *curr = lookup_first_element_with_score(zset, min, included_min);
-  DBZSetElement *last = lookup_last_element_with_score(zset, max, included_max);
-  db_uint_t count = 1;
-  while (curr && curr != last)
+  DBZSet *zset = zset_create();
+  db_bool_t packed = length <= zset_packed_max_members;
+  size_t members_size = 0;
+  for (db_uint_t i = 0; i < length && packed; ++i)
   {
-    ++count;
-    curr = curr->forward[0];
+    packed = pairs[i].length <= zset_packed_max_length;
+    members_size += pairs[i].length + 1;
   }
-  return count;
+
+  if (packed)
+  {
+    if (!length)
+      return zset;
+    zset_packed_resize(zset, length * sizeof(DBZSetPackedEntry) + members_size);
+    zset->packed_length = length;
+    DBZSetPackedEntry *entries = zset_packed_entries(zset);
+    char *members = zset_packed_members(zset);
+    for (db_uint_t i = 0; i < length; ++i)
+    {
+      entries[i] = (DBZSetPackedEntry){.score = pairs[i].score, .offset = zset->packed_members_size, .length = pairs[i].length};
+      memcpy(members + zset->packed_members_size, pairs[i].member, pairs[i].length + 1);
+      zset->packed_members_size += pairs[i].length + 1;
+    }
+    return zset;
+  }
+
+  // elements only ever go to the end, so each level links to the last element that reached it
+  zset->encoding = DB_ENCODING_SKIPLIST;
+  zset->dict = zdict_create();
+  zdict_reserve(zset->dict, length);
+  DBZSetElement *last[SKIPLIST_MAXLEVEL];
+  db_uint_t last_rank[SKIPLIST_MAXLEVEL];
+  for (db_uint_t i = 0; i < length; ++i)
+  {
+    DBZSetElement *element = create_zset_ele(pairs[i].score, pairs[i].member, pairs[i].length, zset_balanced_level(i + 1));
+    zdict_insert(zset->dict, zset_element_member(element), element->member_length, element);
+    zset->memory += slab_size(zset_element_alloc_size(element));
+    for (db_uint8_t lvl = zset->level; lvl < element->level; ++lvl)
+    {
+      last[lvl] = NULL;
+      last_rank[lvl] = 0;
+    }
+    if (zset->level < element->level)
+      zset_grow_levels(zset, element->level, 0);
+
+    element->backward = i ? last[0] : NULL;
+    for (int lvl = 0; lvl < element->level; ++lvl)
+    {
+      zset_forward_of(zset, last[lvl])[lvl] = element;
+      zset_span_of(zset, last[lvl])[lvl] = i + 1 - last_rank[lvl];
+      last[lvl] = element;
+      last_rank[lvl] = i + 1;
+    }
+  }
+  for (int lvl = 0; lvl < zset->level; ++lvl)
+    zset_span_of(zset, last[lvl])[lvl] = length - last_rank[lvl];
+  zset->tail = length ? last[0] : NULL;
+  return zset;
 }
 
-DBObj *zinterstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate)
+// A pair handed to zadd_bulk and its position among them, so the last pair of a member wins
+typedef struct ZSetBulkPair
 {
-  if (!zsets)
-    return dbobj_create_error(DB_ERR_WRONGTYPE);
+  DBZSetPair pair;
+  db_uint_t index;
+} ZSetBulkPair;
 
-  DBZSet *smallest_set = NULL;
+static int compare_zset_pairs(const void *a, const void *b)
+{
+  const DBZSetPair *x = (const DBZSetPair *)a, *y = (const DBZSetPair *)b;
+  int s_cmp = (x->score > y->score) - (x->score < y->score);
+  return s_cmp ? s_cmp : strcmp(x->member, y->member);
+}
 
-  DBListNode *curr_zset_node = zsets->head;
-  DBZSet *curr_zset;
-  DBZSetElement *curr_zset_ele;
-  db_double_t curr_zset_ele_score;
+// By member, then from the last pair given to the first
+static int compare_bulk_pairs(const void *a, const void *b)
+{
+  const ZSetBulkPair *x = (const ZSetBulkPair *)a, *y = (const ZSetBulkPair *)b;
+  int m_cmp = strcmp(x->pair.member, y->pair.member);
+  return m_cmp ? m_cmp : (x->index < y->index) - (x->index > y->index);
+}
 
-  DBListNode *curr_weight_node = weights ? weights->head : NULL;
-  db_double_t curr_weight;
+static int compare_bulk_pair_member(const void *member, const void *element)
+{
+  return strcmp((const char *)member, ((const ZSetBulkPair *)element)->pair.member);
+}
 
-  DBObj *new_zset_ele_score_obj;
-  db_double_t new_zset_ele_score;
+db_uint_t zadd_bulk(DBZSet *zset, const DBZSetPair *pairs, db_uint_t length)
+{
+  if (!zset || !length)
+    return 0;
 
-  // find smallest set
-  while (curr_zset_node)
+  db_uint_t card = zcard(zset);
+  if (length < ZSET_BULK_MIN_PAIRS || card / ZSET_BULK_MERGE_RATIO > length)
   {
-    if (!dbobj_is_zset(curr_zset_node->data))
-      return dbobj_create_error(DB_ERR_WRONGTYPE);
-    curr_zset = curr_zset_node->data->value.zset;
-    if (!smallest_set || zcard(smallest_set) > zcard(curr_zset))
-      smallest_set = curr_zset;
-    curr_zset_node = curr_zset_node->next;
+    for (db_uint_t i = 0; i < length; ++i)
+      zadd(zset, pairs[i].score, pairs[i].member);
+    return zcard(zset) - card;
   }
-  if (!smallest_set)
-    return dbobj_create_error(DB_ERR_ARG_ERROR);
 
-  DBZSet *new_zset = zset_create();
-  DBList *members = create_dblist();
-  char *curr_member;
-  bool has_member;
-
-  // makesure all sets has this member
-  curr_zset_ele = smallest_set->sentinel_forward[0];
-  while (curr_zset_ele)
+  // keep the last pair of each member, then order those like the set
+  ZSetBulkPair *by_member = (ZSetBulkPair *)malloc(length * sizeof(ZSetBulkPair));
+  if (!by_member)
+    EXIT_ON_MEMORY_ERROR();
+  for (db_uint_t i = 0; i < length; ++i)
+    by_member[i] = (ZSetBulkPair){.pair = pairs[i], .index = i};
+  qsort(by_member, length, sizeof(ZSetBulkPair), compare_bulk_pairs);
+  db_uint_t unique = 0;
+  for (db_uint_t i = 0; i < length; ++i)
+    if (!unique || strcmp(by_member[unique - 1].pair.member, by_member[i].pair.member) != 0)
+      by_member[unique++] = by_member[i];
+
+  DBZSetPair *incoming = (DBZSetPair *)malloc(unique * sizeof(DBZSetPair));
+  DBZSetPair *merged = (DBZSetPair *)malloc((card + unique) * sizeof(DBZSetPair));
+  if (!incoming || !merged)
+    EXIT_ON_MEMORY_ERROR();
+  for (db_uint_t i = 0; i < unique; ++i)
+    incoming[i] = by_member[i].pair;
+  qsort(incoming, unique, sizeof(DBZSetPair), compare_zset_pairs);
+
+  // members given a new score are left out of the current ones and come in with the others
+  DBZSetIter iter;
+  DBZSetPair current;
+  db_uint_t next = 0, merged_length = 0, replaced = 0;
+  zset_iter_init(zset, &iter);
+  while ((current.member = zset_iter_next(&iter, &current.score)))
   {
-    has_member = true;
-    DBListNode *curr_zset_node = zsets->head;
-    while (curr_zset_node)
+    if (bsearch(current.member, by_member, unique, sizeof(ZSetBulkPair), compare_bulk_pair_member))
     {
-      curr_zset = curr_zset_node->data->value.zset;
-      if (curr_zset != smallest_set && !zset_has_member(curr_zset, curr_zset_ele->member))
-      {
-        has_member = false;
-        break;
-      }
-      curr_zset_node = curr_zset_node->next;
+      ++replaced;
+      continue;
     }
-    if (has_member)
-      rpush(members, create_dblistnode_with_string(dbutil_strdup(curr_zset_ele->member)));
-    curr_zset_ele = curr_zset_ele->forward[0];
+    current.length = strlen(current.member);
+    while (next < unique && compare_zset_pairs(&incoming[next], &current) < 0)
+      merged[merged_length++] = incoming[next++];
+    merged[merged_length++] = current;
   }
+  while (next < unique)
+    merged[merged_length++] = incoming[next++];
+
+  // the new contents copy the members, so the old ones are only freed after
+  DBZSet *result = zset_create_sorted(merged, merged_length);
+  zset_free_contents(zset);
+  *zset = *result;
+  free(result);
+
+  free(merged);
+  free(incoming);
+  free(by_member);
+  return unique - replaced;
+}
 
-  // aggregate
-  curr_member = extract_dblistnode_string(lpop(members));
-  while (curr_member)
+db_bool_t zset_score_of(const DBZSet *zset, const DBKey *member, db_double_t *score)
+{
+  if (zset_is_packed(zset))
   {
-    curr_zset_node = zsets->head;
-    while (curr_zset_node)
-    {
-      curr_zset = curr_zset_node->data->value.zset;
-      curr_weight = curr_weight_node ? curr_weight_node->data->value.double_value : 1;
-
-      new_zset_ele_score_obj = zscore(new_zset, curr_member);
-      curr_zset_ele_score = dbobj_extract_double(zscore(curr_zset, curr_member)) * curr_weight;
-      switch (aggregate)
-      {
-      case DB_AGG_SUM:
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj) + curr_zset_ele_score;
-        break;
-      case DB_AGG_MIN:
-        if (!dbobj_is_double(new_zset_ele_score_obj))
-        {
-          new_zset_ele_score = curr_zset_ele_score;
-          free_dbobj(new_zset_ele_score_obj);
-          break;
-        }
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj);
-        new_zset_ele_score = new_zset_ele_score < curr_zset_ele_score
-                                 ? new_zset_ele_score
-                                 : curr_zset_ele_score;
-        break;
-      case DB_AGG_MAX:
-        if (!dbobj_is_double(new_zset_ele_score_obj))
-        {
-          new_zset_ele_score = curr_zset_ele_score;
-          free_dbobj(new_zset_ele_score_obj);
-          break;
-        }
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj);
-        new_zset_ele_score = new_zset_ele_score > curr_zset_ele_score
-                                 ? new_zset_ele_score
-                                 : curr_zset_ele_score;
-        break;
-      default:
-        free_dbobj(new_zset_ele_score_obj);
-        free_dblist(members);
-        free_dbzset(new_zset);
-        free(curr_member);
-        return dbobj_create_error(DB_ERR_SYNTAX_ERROR);
-      }
-      zadd(new_zset, new_zset_ele_score, curr_member);
-
-      curr_zset_node = curr_zset_node->next;
-      curr_weight_node = curr_weight_node ? curr_weight_node->next : NULL;
-    }
-    free(curr_member);
-    curr_member = extract_dblistnode_string(lpop(members));
+    db_int_t index = zset_packed_find(zset, member->string, member->length);
+    if (index >= 0)
+      *score = zset_packed_entries(zset)[index].score;
+    return index >= 0;
   }
-  free_dblist(members);
-  return dbobj_create_zset(new_zset);
+  DBZSetDictEntry *entry = zdict_find(zset->dict, member);
+  if (entry)
+    *score = entry->value->score;
+  return entry != NULL;
 }
 
-DBObj *zunionstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate)
+DBObj *zscore(DBZSet *zset, const char *member)
 {
-  if (!zsets)
-    return dbobj_create_error(DB_ERR_WRONGTYPE);
+  if (!zset || !member)
+    return dbobj_shared_null();
+  if (zset_is_packed(zset))
+  {
+    db_int_t index = zset_packed_find(zset, member, strlen(member));
+    return index < 0 ? dbobj_shared_null() : dbobj_create_double(zset_packed_entries(zset)[index].score);
+  }
+  DBZSetElement **element = zdict_get(zset->dict, member);
+  if (!element)
+    return dbobj_shared_null();
+  return dbobj_create_double((*element)->score);
+}
 
-  DBZSet *new_zset = zset_create();
+db_uint_t zcard(DBZSet *zset)
+{
+  if (!zset)
+    return 0;
+  if (zset_is_packed(zset))
+    return zset->packed_length;
+  return zdict_count(zset->dict);
+}
 
-  DBListNode *curr_zset_node = zsets->head;
-  DBZSet *curr_zset;
-  DBZSetElement *curr_zset_ele;
-  db_double_t curr_zset_ele_score;
+db_uint_t zcount(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max)
+{
+  if (!zset || min > max)
+    return 0;
+  if (zset_is_packed(zset))
+  {
+    db_uint_t first = zset_packed_lower_bound(zset, min, included_min);
+    db_uint_t end = zset_packed_upper_bound(zset, max, included_max);
+    return end > first ? end - first : 0;
+  }
+  DBZSetElement *first = lookup_first_element_with_score(zset, min, included_min);
+  DBZSetElement *last = lookup_last_element_with_score(zset, max, included_max);
+  if (!first || !last || compare_zset_ele(first, last) > 0)
+    return 0;
 
-  DBListNode *curr_weight_node = weights ? weights->head : NULL;
-  db_double_t curr_weight;
+  // the count is the difference of the ranks of both ends
+  DBZSetElement *update[SKIPLIST_MAXLEVEL];
+  db_uint_t first_rank[SKIPLIST_MAXLEVEL], last_rank[SKIPLIST_MAXLEVEL];
+  lookup_previous_elements(zset, first, update, first_rank);
+  lookup_previous_elements(zset, last, update, last_rank);
+  return last_rank[0] - first_rank[0] + 1;
+}
 
-  DBObj *new_zset_ele_score_obj;
-  db_double_t new_zset_ele_score;
+void zset_iter_init(const DBZSet *zset, DBZSetIter *iter)
+{
+  iter->zset = zset;
+  iter->index = 0;
+  iter->element = zset && !zset_is_packed(zset) && zset->sentinel_forward ? zset->sentinel_forward[0] : NULL;
+}
 
-  while (curr_zset_node)
+const char *zset_iter_next(DBZSetIter *iter, db_double_t *score)
+{
+  if (!iter->zset)
+    return NULL;
+  if (zset_is_packed(iter->zset))
   {
-    if (!dbobj_is_zset(curr_zset_node->data))
-      return free_dbzset(new_zset), dbobj_create_error(DB_ERR_WRONGTYPE);
-    curr_zset = curr_zset_node->data->value.zset;
-    curr_weight = curr_weight_node ? curr_weight_node->data->value.double_value : 1;
-    curr_zset_ele = curr_zset->sentinel_forward[0];
-    while (curr_zset_ele)
-    {
-      new_zset_ele_score_obj = zscore(new_zset, curr_zset_ele->member);
-      curr_zset_ele_score = curr_zset_ele->score * curr_weight;
-      switch (aggregate)
-      {
-      case DB_AGG_SUM:
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj) + curr_zset_ele_score;
-        break;
-      case DB_AGG_MIN:
-        if (!dbobj_is_double(new_zset_ele_score_obj))
-        {
-          new_zset_ele_score = curr_zset_ele_score;
-          free_dbobj(new_zset_ele_score_obj);
-          break;
-        }
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj);
-        new_zset_ele_score = new_zset_ele_score < curr_zset_ele_score
-                                 ? new_zset_ele_score
-                                 : curr_zset_ele_score;
-        break;
-      case DB_AGG_MAX:
-        if (!dbobj_is_double(new_zset_ele_score_obj))
-        {
-          new_zset_ele_score = curr_zset_ele_score;
-          free_dbobj(new_zset_ele_score_obj);
-          break;
-        }
-        new_zset_ele_score = dbobj_extract_double(new_zset_ele_score_obj);
-        new_zset_ele_score = new_zset_ele_score > curr_zset_ele_score
-                                 ? new_zset_ele_score
-                                 : curr_zset_ele_score;
-        break;
-      default:
-        free_dbzset(new_zset);
-        return dbobj_create_error(DB_ERR_SYNTAX_ERROR);
-      }
-      zadd(new_zset, new_zset_ele_score, curr_zset_ele->member);
-      curr_zset_ele = curr_zset_ele->forward[0];
-    }
-    curr_zset_node = curr_zset_node->next;
-    curr_weight_node = curr_weight_node ? curr_weight_node->next : NULL;
+    if (iter->index >= iter->zset->packed_length)
+      return NULL;
+    *score = zset_packed_entries(iter->zset)[iter->index].score;
+    return zset_packed_member(iter->zset, iter->index++);
   }
+  const DBZSetElement *element = iter->element;
+  if (!element)
+    return NULL;
+  iter->element = element->forward[0];
+  *score = element->score;
+  return zset_element_member(element);
+}
 
-  return dbobj_create_zset(new_zset);
+// Appends a copy of a member to a reply, followed by its score if asked for
+static void zset_push_member(DBArena *arena, DBList *list, const char *member, db_double_t score, db_bool_t withscores)
+{
+  rpush(list, create_dblistnode_in(arena, dbobj_create_string_in(arena, member, strlen(member))));
+  if (withscores)
+    rpush(list, create_dblistnode_in(arena, dbobj_create_double_in(arena, score)));
 }
 
-DBList *zrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores)
+DBList *zrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores, DBArena *arena)
 {
   if (!zset)
     return NULL;
-  db_uint_t index = 0;
-  DBZSetElement *curr = zset->sentinel_forward[0];
-  DBList *list = create_dblist();
-  while (curr)
+  DBList *list = create_dblist_in(arena);
+  if (start > stop || start >= zcard(zset))
+    return list;
+  if (zset_is_packed(zset))
   {
-    if (index >= start && index <= stop)
-    {
-      rpush(list, create_dblistnode(dbobj_create_string(dbutil_strdup(curr->member))));
-      if (withscores)
-        rpush(list, create_dblistnode(dbobj_create_double(curr->score)));
-    }
-    ++index;
+    for (db_uint_t index = start; index < zset->packed_length && index <= stop; ++index)
+      zset_push_member(arena, list, zset_packed_member(zset, index), zset_packed_entries(zset)[index].score, withscores);
+    return list;
+  }
+  DBZSetElement *curr = lookup_element_by_rank(zset, start + 1);
+  for (db_uint_t index = start; curr && index <= stop; ++index)
+  {
+    zset_push_member(arena, list, zset_element_member(curr), curr->score, withscores);
     curr = curr->forward[0];
   }
   return list;
 }
 
-DBList *zrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max, db_bool_t withscores)
+DBList *zrevrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores, DBArena *arena)
+{
+  if (!zset)
+    return NULL;
+  DBList *list = create_dblist_in(arena);
+  db_uint_t card = zcard(zset);
+  if (start > stop || start >= card)
+    return list;
+  if (zset_is_packed(zset))
+  {
+    for (db_uint_t index = start; index < card && index <= stop; ++index)
+      zset_push_member(arena, list, zset_packed_member(zset, card - 1 - index), zset_packed_entries(zset)[card - 1 - index].score, withscores);
+    return list;
+  }
+  DBZSetElement *curr = lookup_element_by_rank(zset, card - start);
+  for (db_uint_t index = start; curr && index <= stop; ++index)
+  {
+    zset_push_member(arena, list, zset_element_member(curr), curr->score, withscores);
+    curr = curr->backward;
+  }
+  return list;
+}
+
+DBList *zrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max, db_bool_t withscores, DBArena *arena)
 {
-  if (!zset || min >= max)
+  if (!zset || min > max)
     return NULL;
+  if (zset_is_packed(zset))
+  {
+    DBList *list = create_dblist_in(arena);
+    db_uint_t end = zset_packed_upper_bound(zset, max, included_max);
+    for (db_uint_t index = zset_packed_lower_bound(zset, min, included_min); index < end; ++index)
+      zset_push_member(arena, list, zset_packed_member(zset, index), zset_packed_entries(zset)[index].score, withscores);
+    return list;
+  }
   DBZSetElement *curr = lookup_first_element_with_score(zset, min, included_min);
   DBZSetElement *last = lookup_last_element_with_score(zset, max, included_max);
-  if (last)
+  // walks up to the element after the last one; a range whose first element comes after its
+  // last, such as (x (x, is empty
+  if (!curr || !last || compare_zset_ele(curr, last) > 0)
+    curr = NULL;
+  else
     last = last->forward[0];
-  DBList *list = create_dblist();
+  DBList *list = create_dblist_in(arena);
   while (curr && curr != last)
   {
-    rpush(list, create_dblistnode(dbobj_create_string(dbutil_strdup(curr->member))));
-    if (withscores)
-      rpush(list, create_dblistnode(dbobj_create_double(curr->score)));
+    zset_push_member(arena, list, zset_element_member(curr), curr->score, withscores);
     curr = curr->forward[0];
   }
   return list;
 }
 
-DBObj *zrank(DBZSet *zset, const char *member, const db_bool_t withscores)
+static DBObj *zset_reply_rank(DBZSet *zset, const char *member, const db_bool_t withscores, db_bool_t reverse)
 {
   if (!zset || !member)
-    return dbobj_create_null();
-
-  DBHashEntry *entry = hget(zset->dict, member, NULL);
-
-  if (!entry)
-    return dbobj_create_null();
+    return dbobj_shared_null();
 
-  DBZSetElement *element = entry->data->value._zsetele;
-  DBZSetElement *current = zset->sentinel_forward[0];
-  db_int_t rank = 0;
-
-  while (current != element)
+  db_int_t rank;
+  db_double_t score;
+  if (zset_is_packed(zset))
+  {
+    rank = zset_packed_find(zset, member, strlen(member));
+    if (rank < 0)
+      return dbobj_shared_null();
+    score = zset_packed_entries(zset)[rank].score;
+  }
+  else
   {
-    current = current->forward[0];
-    ++rank;
+    DBZSetElement **found = zdict_get(zset->dict, member);
+
+    if (!found)
+      return dbobj_shared_null();
+
+    // the elements before it on the lowest level are as many as its rank
+    DBZSetElement *element = *found;
+    DBZSetElement *update[SKIPLIST_MAXLEVEL];
+    db_uint_t ranks[SKIPLIST_MAXLEVEL];
+    lookup_previous_elements(zset, element, update, ranks);
+    rank = ranks[0];
+    score = element->score;
   }
+  if (reverse)
+    rank = zcard(zset) - 1 - rank;
 
   if (!withscores)
     return dbobj_create_int(rank);
 
   DBList *list = create_dblist();
   rpush(list, create_dblistnode(dbobj_create_int(rank)));
-  rpush(list, create_dblistnode(dbobj_create_double(element->score)));
+  rpush(list, create_dblistnode(dbobj_create_double(score)));
   return dbobj_create_list(list);
 }
 
+DBObj *zrank(DBZSet *zset, const char *member, const db_bool_t withscores)
+{
+  return zset_reply_rank(zset, member, withscores, false);
+}
+
+DBObj *zrevrank(DBZSet *zset, const char *member, const db_bool_t withscores)
+{
+  return zset_reply_rank(zset, member, withscores, true);
+}
+
 db_uint_t zrem(DBZSet *zset, const char *member)
 {
   if (!zset || !member)
     return 0;
 
-  // remove element from zset dict
-  DBZSetElement *element = _dbobj_extract_zsetele(ht_extract_entry(ht_remove(zset->dict, member, NULL)));
+  if (zset_is_packed(zset))
+  {
+    db_int_t index = zset_packed_find(zset, member, strlen(member));
+    if (index < 0)
+      return 0;
+    zset_packed_delete(zset, index);
+    return 1;
+  }
+
+  uint64_t trace_at = TRACE_BEGIN();
+  // remove element from zset dict, `member` may be the element's own until it is freed below
+  DBZSetElement *element;
 
-  if (!element)
+  if (!zdict_remove(zset->dict, member, &element))
     return 0;
 
-  // rebuild element member, because it freed when extract hash entry
-  element->member = dbutil_strdup(member);
-
-  // remove element from zset skip list
-  DBZSetElement *previous = NULL;
-  if (element->forward[0])
-    element->forward[0]->backward = element->backward;
-  for (int lvl = element->level; --lvl >= 0;)
+  // remove element from zset skip list, the links over it get one position shorter
+  DBZSetElement *update[SKIPLIST_MAXLEVEL];
+  db_uint_t rank[SKIPLIST_MAXLEVEL];
+  lookup_previous_elements(zset, element, update, rank);
+  for (int lvl = 0; lvl < zset->level; ++lvl)
   {
-    previous = lookup_previos_element_in_level(zset, lvl, element, NULL);
-    if (previous && previous != element)
-      previous->forward[lvl] = element->forward[lvl];
-    else if (zset->sentinel_forward[lvl] == element)
-      zset->sentinel_forward[lvl] = element->forward[lvl];
+    DBZSetElement **forward = zset_forward_of(zset, update[lvl]);
+    db_uint_t *span = zset_span_of(zset, update[lvl]);
+    if (forward[lvl] == element)
+    {
+      span[lvl] += zset_element_span(element)[lvl] - 1;
+      forward[lvl] = element->forward[lvl];
+    }
+    else
+      --span[lvl];
   }
+  if (element->forward[0])
+    element->forward[0]->backward = element->backward;
   if (zset->tail == element)
     zset->tail = element->backward;
 
   // zset down level
-  while (zset->level > 1 && zset->sentinel_forward[zset->level - 1] == NULL)
+  db_uint8_t level = zset->level;
+  while (level > 1 && zset->sentinel_forward[level - 1] == NULL)
+    --level;
+  if (level < zset->level)
   {
-    DBZSetElement **new_sentinel_forward = (DBZSetElement **)realloc(zset->sentinel_forward, (--zset->level) * sizeof(DBZSetElement *));
-    if (!new_sentinel_forward)
+    zset->memory -= dbutil_alloc_size(zset->sentinel_forward) + dbutil_alloc_size(zset->sentinel_span);
+    DBZSetElement **new_sentinel_forward = (DBZSetElement **)realloc(zset->sentinel_forward, level * sizeof(DBZSetElement *));
+    db_uint_t *new_sentinel_span = (db_uint_t *)realloc(zset->sentinel_span, level * sizeof(db_uint_t));
+    if (!new_sentinel_forward || !new_sentinel_span)
       EXIT_ON_MEMORY_ERROR();
     zset->sentinel_forward = new_sentinel_forward;
+    zset->sentinel_span = new_sentinel_span;
+    zset->memory += dbutil_alloc_size(zset->sentinel_forward) + dbutil_alloc_size(zset->sentinel_span);
+    zset->level = level;
   }
 
-  // free memories, we don't free the member, because it was freed when extracted DBObj
-  free(element->forward);
-  free(element->member);
-  free(element);
+  zset->memory -= slab_size(zset_element_alloc_size(element));
+  slab_free(element, zset_element_alloc_size(element));
 
+  TRACE_END(TRACE_ZSL_DELETE, trace_at, zcard(zset));
   return 1;
 }
 
 db_uint_t zremrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max)
 {
-  if (!zset || min >= max)
+  if (!zset || min > max)
     return 0;
 
+  if (zset_is_packed(zset))
+  {
+    db_uint_t first = zset_packed_lower_bound(zset, min, included_min);
+    db_uint_t end = zset_packed_upper_bound(zset, max, included_max);
+    for (db_uint_t index = end; index > first; --index)
+      zset_packed_delete(zset, index - 1);
+    return end > first ? end - first : 0;
+  }
+
   DBZSetElement *curr = lookup_first_element_with_score(zset, min, included_min);
   DBZSetElement *next;
   DBZSetElement *last = lookup_last_element_with_score(zset, max, included_max);
-  if (last)
+  if (!curr || !last || compare_zset_ele(curr, last) > 0)
+    curr = NULL;
+  else
     last = last->forward[0];
   db_uint_t count = 0;
   while (curr && curr != last)
   {
     ++count;
     next = curr->forward[0];
-    zrem(zset, curr->member);
+    zrem(zset, zset_element_member(curr));
     curr = next;
   }
   return count;
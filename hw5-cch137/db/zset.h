@@ -2,9 +2,66 @@
 #define DB_ZSET_H
 
 #include "types.h"
+#include "typedhash.h"
 
+// Sets of up to this many members, none longer than ZSET_PACKED_MAX_LENGTH bytes, are kept as a
+// sorted array instead of a skiplist and a dict; a set that outgrows either limit is converted
+// once and stays a skiplist
+#define ZSET_PACKED_MAX_MEMBERS 128
+#define ZSET_PACKED_MAX_LENGTH 64
+
+// Batch sizes from which zadd_bulk rebuilds the set, see there
+#define ZSET_BULK_MIN_PAIRS 16
+#define ZSET_BULK_MERGE_RATIO 4
+
+// Limits applied from now on, see db_config_zset_packed
+extern db_uint_t zset_packed_max_members;
+extern db_uint_t zset_packed_max_length;
+
+// Dict of a skiplist set, from each member to its element, whose member the entry borrows as key
+DB_TYPED_HASH(DBZSetDict, zdict, DBZSetElement *)
+
+// Position of the next member read by zset_iter_next
+typedef struct DBZSetIter
+{
+  const DBZSet *zset;
+  const DBZSetElement *element;
+  db_uint_t index;
+} DBZSetIter;
+
+// A member and its score as handed to zset_create_sorted; `member` is NUL-terminated after
+// `length` bytes
+typedef struct DBZSetPair
+{
+  const char *member;
+  db_uint_t length;
+  db_double_t score;
+} DBZSetPair;
+
+// Creates an empty set in the packed encoding
 DBZSet *zset_create();
 
+// Creates a set holding copies of pairs that are already sorted by score and member and have no
+// member twice, in one pass: each element is linked at the end of its levels, and the levels are
+// evenly spread instead of random
+DBZSet *zset_create_sorted(const DBZSetPair *pairs, db_uint_t length);
+
+// Adds or updates the members of pairs in any order, the last pair of a member winning, and
+// returns how many were not in the set yet. Batches of ZSET_BULK_MIN_PAIRS or more are sorted and
+// merged with the current members into a set rebuilt with zset_create_sorted, unless the set is
+// over ZSET_BULK_MERGE_RATIO times larger than the batch, where a zadd per pair is cheaper
+db_uint_t zadd_bulk(DBZSet *zset, const DBZSetPair *pairs, db_uint_t length);
+
+// Reads the score of a member without changing anything, so several threads can read a set at
+// once; returns false if it isn't in the set
+db_bool_t zset_score_of(const DBZSet *zset, const DBKey *member, db_double_t *score);
+
+// Member of an element, stored right after its links
+char *zset_element_member(const DBZSetElement *element);
+
+// Spans of the links of an element, one per level
+db_uint_t *zset_element_span(const DBZSetElement *element);
+
 void free_dbzset(DBZSet *zset);
 
 db_uint_t zadd(DBZSet *zset, db_double_t score, const char *member);
@@ -13,20 +70,34 @@ DBObj *zscore(DBZSet *zset, const char *member);
 
 db_uint_t zcard(DBZSet *zset);
 
-db_uint_t zcount(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max);
+db_bool_t zset_has_member(DBZSet *zset, const char *member);
 
-DBObj *zinterstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate);
+db_uint_t zcount(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max);
 
-DBObj *zunionstore(DBList *zsets, DBList *weights, db_aggregate_t aggregate);
+// Members from rank `start` to `stop` inclusive, lowest score first; reached through the spans
+// of the skiplist, so only the returned part of the set is walked. The range functions allocate
+// the list from `arena` when it isn't NULL, see arena.h
+DBList *zrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores, DBArena *arena);
 
-DBList *zrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores);
+// Same as zrange with ranks counted from the highest score
+DBList *zrevrange(DBZSet *zset, db_uint_t start, db_uint_t stop, db_bool_t withscores, DBArena *arena);
 
-DBList *zrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max, db_bool_t withscores);
+DBList *zrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max, db_bool_t withscores, DBArena *arena);
 
 DBObj *zrank(DBZSet *zset, const char *member, const db_bool_t withscores);
 
+// Rank of a member counted from the highest score
+DBObj *zrevrank(DBZSet *zset, const char *member, const db_bool_t withscores);
+
 db_uint_t zrem(DBZSet *zset, const char *member);
 
+// Starts an iteration over the members from the lowest score
+void zset_iter_init(const DBZSet *zset, DBZSetIter *iter);
+
+// Returns the next member and sets its score, or NULL at the end; the member stays owned by the
+// set and is valid until the set changes
+const char *zset_iter_next(DBZSetIter *iter, db_double_t *score);
+
 db_uint_t zremrangebyscore(DBZSet *zset, db_double_t min, db_bool_t included_min, db_double_t max, db_bool_t included_max);
 
 #endif
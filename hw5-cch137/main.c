@@ -1,9 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "db/api.h"
+#include "db/net.h"
+#include "db/evict.h"
 
-int main()
+// Usage: ./main [--port port [--io-threads count] [--replicaof host port] [--cluster]
+// [--concurrent-reads] [--maxmemory bytes [--maxmemory-policy policy]] [--hugepages madvise|hugetlb]
+// [--mapped-snapshot] [--busy-poll us] [--pin-workers]], which serves RESP clients on the port
+// instead of reading commands from stdin, as a replica of host:port if given, only for the hash
+// slots it is given with --cluster, answers GET on the I/O threads with --concurrent-reads, evicts
+// keys by the policy, noeviction if not given, to keep the dataset under --maxmemory, puts large
+// tables on huge pages local to their shard with --hugepages, serves the snapshot from a read-only
+// mapping with --mapped-snapshot, has idle workers poll their queues for --busy-poll microseconds
+// before they park, and pins each worker to a CPU with --pin-workers
+int main(int argc, char **argv)
 {
+  size_t maxmemory = 0;
+  db_maxmemory_policy_t maxmemory_policy = DB_MAXMEMORY_NOEVICTION;
+
+  // How the dataset is loaded and where the workers run are settled before the server starts.
+  db_uint_t busy_poll_us = 0;
+  db_bool_t pin_workers = false;
+  for (int i = 3; i < argc; ++i)
+    if (strcmp(argv[i], "--mapped-snapshot") == 0)
+      server_config_mapped_load(true);
+    else if (i + 1 < argc && strcmp(argv[i], "--busy-poll") == 0)
+      busy_poll_us = (db_uint_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--pin-workers") == 0)
+      pin_workers = true;
+  server_config_worker_idle(busy_poll_us, pin_workers);
   dbapi_start_server();
 
+  for (int i = 3; i < argc; ++i)
+    if (i + 1 < argc && strcmp(argv[i], "--io-threads") == 0)
+      server_config_net_io_threads((db_uint_t)atoi(argv[++i]));
+    else if (strcmp(argv[i], "--cluster") == 0)
+      server_config_cluster_enabled(true);
+    else if (strcmp(argv[i], "--concurrent-reads") == 0)
+      server_config_concurrent_reads(true);
+    else if (i + 1 < argc && strcmp(argv[i], "--maxmemory") == 0)
+      maxmemory = strtoull(argv[++i], NULL, 10);
+    else if (i + 1 < argc && strcmp(argv[i], "--maxmemory-policy") == 0)
+      evict_policy_from_name(argv[++i], &maxmemory_policy);
+    else if (i + 1 < argc && strcmp(argv[i], "--hugepages") == 0)
+      server_config_pages_mode(strcmp(argv[++i], "hugetlb") == 0 ? DB_PAGES_HUGETLB : DB_PAGES_TRANSPARENT);
+    else if (i + 2 < argc && strcmp(argv[i], "--replicaof") == 0)
+    {
+      dbapi_replicaof(argv[i + 1], (db_uint_t)atoi(argv[i + 2]));
+      i += 2;
+    }
+  server_config_maxmemory(maxmemory, maxmemory_policy);
+  if (argc > 1 && strcmp(argv[1], "--port") == 0)
+    return dbapi_start_network_server(argc > 2 ? (db_uint_t)atoi(argv[2]) : NET_DEFAULT_PORT) ? 0 : 1;
+
   // test
 
   dbapi_flushall();
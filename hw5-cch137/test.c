@@ -3,13 +3,45 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h> // for free()
+#include <threads.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 #include "db/api.h"
 #include "db/utils.h"
 #include "db/list.h"
+#include "db/quicklist.h"
+#include "db/rope.h"
 #include "db/zset.h"
+#include "db/zaggregate.h"
+#include "db/radix.h"
+#include "db/glob.h"
 #include "db/obj.h"
 #include "db/interaction.h"
+#include "db/queue.h"
+#include "db/hash.h"
+#include "db/hashobj.h"
+#include "db/flathash.h"
+#include "db/slab.h"
+#include "db/pages.h"
+#include "db/arena.h"
+#include "db/snapshot.h"
+#include "db/aof.h"
+#include "db/repl.h"
+#include "db/cluster.h"
+#include "db/core.h"
+#include "db/net.h"
+#include "db/uring.h"
+#include "db/latency.h"
+#include "db/trace.h"
+#include "db/lazyfree.h"
+#include "db/deps/cJSON.h"
 
 #define RESULT_PASS "\033[0;32mPASS\033[0m"
 #define RESULT_FAIL "\033[0;31mFAIL\033[0m"
@@ -52,60 +84,95 @@ static void print_detailed_test_result_str(const char *test_name, bool condition
          test_name, expected, actual ? actual : "(null)");
 }
 
+static const TestCase match_test_cases[] = {
+    {"user:123", "user:*", true},
+    {"user:123", "user:?23", true},
+    {"user:abc", "user:abc", true},
+    {"user:123", "user:1*3", true},
+    {"user:xyz", "user:?yz", true},
+    {"user:123", "user:123", true},
+    {"user:123", "user:12\\3", true},
+    {"user:*23", "user:\\*23", true},
+    {"user:abc", "admin:*", false},
+    {"user:abc", "user:\\?bc", false},
+    {"user:abc", "user:a?c", true},
+    {"user:abc", "user:a*c", true},
+    {"user:abc", "user:*b*", true},
+    {"user:abc", "user:??c", true},
+    {"user:abc", "*", true},
+    {"", "*", true},
+    {"", "?", false},
+    {"", "", true},
+    {"abc", "a\\*c", false},
+    {"a*c", "a\\*c", true},
+    {"abc", "???", true},
+    {"ab", "???", false},
+    {"abcd", "a*d", true},
+    {"abc", "a\\?c", false},
+    {"a?c", "a\\?c", true},
+    {"a*c", "a??c", false},
+    {"abbbbc", "a*b*c", true},
+    {"abbbbc", "a*c*b", false},
+    {"abc", "abc\\", false},
+    {"abc", "abc\\d", false},
+    {"user:??x", "user:??x", true},
+    {"user:?x", "user:??x", false},
+    {"hello", "h*llo", true},
+    {"heeeello", "h*llo", true},
+    {"hey", "h*llo", false},
+};
+
 // 專門用於 test_dbutil_match_keys，模仿原本的列印方式
 static void test_dbutil_match_keys()
 {
-  TestCase test_cases[] = {
-      {"user:123", "user:*", true},
-      {"user:123", "user:?23", true},
-      {"user:abc", "user:abc", true},
-      {"user:123", "user:1*3", true},
-      {"user:xyz", "user:?yz", true},
-      {"user:123", "user:123", true},
-      {"user:123", "user:12\\3", true},
-      {"user:*23", "user:\\*23", true},
-      {"user:abc", "admin:*", false},
-      {"user:abc", "user:\\?bc", false},
-      {"user:abc", "user:a?c", true},
-      {"user:abc", "user:a*c", true},
-      {"user:abc", "user:*b*", true},
-      {"user:abc", "user:??c", true},
-      {"user:abc", "*", true},
-      {"", "*", true},
-      {"", "?", false},
-      {"", "", true},
-      {"abc", "a\\*c", false},
-      {"a*c", "a\\*c", true},
-      {"abc", "???", true},
-      {"ab", "???", false},
-      {"abcd", "a*d", true},
-      {"abc", "a\\?c", false},
-      {"a?c", "a\\?c", true},
-      {"a*c", "a??c", false},
-      {"abbbbc", "a*b*c", true},
-      {"abbbbc", "a*c*b", false},
-      {"abc", "abc\\", false},
-      {"abc", "abc\\d", false},
-      {"user:??x", "user:??x", true},
-      {"user:?x", "user:??x", false},
-      {"hello", "h*llo", true},
-      {"heeeello", "h*llo", true},
-      {"hey", "h*llo", false},
-  };
-  size_t test_count = sizeof(test_cases) / sizeof(TestCase);
+  size_t test_count = sizeof(match_test_cases) / sizeof(TestCase);
 
   for (size_t i = 0; i < test_count; ++i)
   {
-    db_bool_t result = dbutil_match_keys(test_cases[i].source, test_cases[i].pattern);
+    db_bool_t result = dbutil_match_keys(match_test_cases[i].source, match_test_cases[i].pattern);
     printf("[%s] Source: \"%s\", Pattern: \"%s\" (Expected: %s, Got: %s)\n",
-           (result == test_cases[i].expected) ? RESULT_PASS : RESULT_FAIL,
-           test_cases[i].source,
-           test_cases[i].pattern,
-           test_cases[i].expected ? "true" : "false",
+           (result == match_test_cases[i].expected) ? RESULT_PASS : RESULT_FAIL,
+           match_test_cases[i].source,
+           match_test_cases[i].pattern,
+           match_test_cases[i].expected ? "true" : "false",
            result ? "true" : "false");
   }
 }
 
+// Checks the compiled patterns of glob.h against the table, then against dbutil_match_keys on
+// random keys long enough for the vector search
+static void test_glob_match()
+{
+  size_t test_count = sizeof(match_test_cases) / sizeof(TestCase);
+  int mismatches = 0;
+  for (size_t i = 0; i < test_count; ++i)
+  {
+    DBGlob *glob = glob_compile(match_test_cases[i].pattern);
+    if (glob_match(glob, match_test_cases[i].source, strlen(match_test_cases[i].source)) != match_test_cases[i].expected)
+      ++mismatches;
+    glob_free(glob);
+  }
+  print_detailed_test_result_int("test_glob_match: compiled patterns agree with the table", mismatches == 0, 0, mismatches);
+
+  const char key_bytes[] = "aab*?\\", pattern_bytes[] = "aab**??\\";
+  char key[48], pattern[12];
+  srand(62);
+  for (int i = 0; i < 20000; ++i)
+  {
+    int key_length = rand() % (sizeof(key) - 1), pattern_length = rand() % (sizeof(pattern) - 1);
+    for (int j = 0; j < key_length; ++j)
+      key[j] = key_bytes[rand() % (sizeof(key_bytes) - 1)];
+    for (int j = 0; j < pattern_length; ++j)
+      pattern[j] = pattern_bytes[rand() % (sizeof(pattern_bytes) - 1)];
+    key[key_length] = pattern[pattern_length] = '\0';
+    DBGlob *glob = glob_compile(pattern);
+    if (glob_match(glob, key, key_length) != dbutil_match_keys(key, pattern))
+      ++mismatches;
+    glob_free(glob);
+  }
+  print_detailed_test_result_int("test_glob_match: compiled patterns agree with dbutil_match_keys", mismatches == 0, 0, mismatches);
+}
+
 // 以下為 zset 測試，將結果格式化為類似方式
 
 static void zset_test_zadd()
@@ -200,7 +267,7 @@ static void zset_test_zrange()
   zadd(zset, 3, "c");
   zadd(zset, 4, "d");
 
-  DBList *range_list = zrange(zset, 1, 2, false);
+  DBList *range_list = zrange(zset, 1, 2, false, NULL);
   // 預期取出 b, c
   bool correct = false;
   char *expected_str = "{b,c}";
@@ -242,7 +309,7 @@ static void zset_test_zrangebyscore()
   zadd(zset, 3, "c");
   zadd(zset, 4, "d");
 
-  DBList *range_list = zrangebyscore(zset, 2, true, 3, true, false);
+  DBList *range_list = zrangebyscore(zset, 2, true, 3, true, false, NULL);
   // 預期 b, c
   bool correct = false;
   char *expected_str = "{b,c}";
@@ -282,6 +349,268 @@ static void zset_test_zrank()
   free_dbzset(zset);
 }
 
+static void zset_test_spans()
+{
+  DBZSet *zset = zset_create();
+  char member[16];
+  int count = 2000;
+  // scores out of order, then every third member removed again, so the spans go through splits
+  // and merges on every level
+  for (int i = 0; i < count; ++i)
+  {
+    snprintf(member, sizeof(member), "m%d", i);
+    zadd(zset, (i * 7919) % count, member);
+  }
+  for (int i = 0; i < count; i += 3)
+  {
+    snprintf(member, sizeof(member), "m%d", i);
+    zrem(zset, member);
+  }
+  zremrangebyscore(zset, 100, true, 200, false);
+
+  int position = 0, matches = 0;
+  for (DBZSetElement *element = zset->sentinel_forward[0]; element; element = element->forward[0], ++position)
+  {
+    DBObj *rank = zrank(zset, zset_element_member(element), false);
+    DBObj *revrank = zrevrank(zset, zset_element_member(element), false);
+    DBList *range = zrange(zset, position, position, false, NULL);
+    matches += rank->value.int_value == position &&
+               revrank->value.int_value == (db_int_t)zcard(zset) - 1 - position &&
+               range->length == 1 && strcmp(range->head->data->value.string, zset_element_member(element)) == 0;
+    free_dbobj(rank);
+    free_dbobj(revrank);
+    free_dblist(range);
+  }
+  print_detailed_test_result_int("zset_test_spans: rank and range agree with the order", (matches == position && position == (int)zcard(zset)), position, matches);
+
+  db_uint_t total = 0;
+  for (DBZSetElement *element = NULL;;)
+  {
+    DBZSetElement *next = element ? element->forward[zset->level - 1] : zset->sentinel_forward[zset->level - 1];
+    total += element ? zset_element_span(element)[zset->level - 1] : zset->sentinel_span[zset->level - 1];
+    if (!next)
+      break;
+    element = next;
+  }
+  print_detailed_test_result_int("zset_test_spans: top level spans add up to the card", (total == zcard(zset)), zcard(zset), total);
+
+  free_dbzset(zset);
+}
+
+static void zset_test_element_layout()
+{
+  // without packing, so the first member already goes to the skiplist
+  db_uint_t max_members = zset_packed_max_members;
+  zset_packed_max_members = 0;
+  DBZSet *zset = zset_create();
+  zadd(zset, 0, "seed");
+  zrem(zset, "seed");
+  zset_packed_max_members = max_members;
+  size_t empty_memory = zset->memory + zset->dict->memory - dbutil_alloc_size(zset->sentinel_forward) - dbutil_alloc_size(zset->sentinel_span);
+  zadd(zset, 1, "alpha");
+  zadd(zset, 2, "beta");
+  zadd(zset, 3, "alpha");
+
+  DBKey alpha = ht_key("alpha");
+  DBZSetDictEntry *entry = zdict_find(zset->dict, &alpha);
+  DBZSetElement *element = entry ? entry->value : NULL;
+  db_bool_t shared = element && entry->key == zset_element_member(element) && strcmp(entry->key, "alpha") == 0 && element->score == 3;
+  print_detailed_test_result_bool("zset_test_element_layout: dict key is the element's member", shared, true, shared);
+
+  zrem(zset, "alpha");
+  zrem(zset, "beta");
+  // only the lowest level of the sentinel is left
+  size_t memory = zset->memory + zset->dict->memory - dbutil_alloc_size(zset->sentinel_forward) - dbutil_alloc_size(zset->sentinel_span);
+  print_detailed_test_result_int("zset_test_element_layout: memory back to empty", (memory == empty_memory && zset->level == 1), empty_memory, memory);
+
+  free_dbzset(zset);
+}
+
+static void zset_test_dict_count_visit(DBZSetDictEntry *entry, void *arg)
+{
+  ++((db_uint_t *)arg)[atoi(entry->key + 2)];
+}
+
+// The dict of a set is a DB_TYPED_HASH table: it grows, shrinks and scans as DBHash does
+static void zset_test_dict()
+{
+  enum
+  {
+    MEMBERS = 3000
+  };
+  static char names[MEMBERS][16];
+  static DBZSetElement elements[MEMBERS];
+  static db_uint_t visits[MEMBERS];
+  DBZSetDict *dict = zdict_create();
+  for (int i = 0; i < MEMBERS; ++i)
+  {
+    sprintf(names[i], "m:%d", i);
+    elements[i] = (DBZSetElement){.score = i, .member_length = strlen(names[i])};
+    zdict_insert(dict, names[i], elements[i].member_length, &elements[i]);
+  }
+  db_bool_t is_found = zdict_count(dict) == MEMBERS;
+  for (int i = 0; i < MEMBERS; ++i)
+    is_found = is_found && zdict_get(dict, names[i]) && (*zdict_get(dict, names[i]))->score == i;
+  is_found = is_found && !zdict_get(dict, "m:missing");
+  print_detailed_test_result_bool("zset_test_dict: every member is found", is_found, true, is_found);
+
+  // Removing most members shrinks the table, one rehash step at a time as they go.
+  DBZSetElement *element;
+  db_bool_t is_removed = true;
+  for (int i = 0; i < MEMBERS; ++i)
+    if (i % 10)
+      is_removed = is_removed && zdict_remove(dict, names[i], &element) && element == &elements[i];
+  is_removed = is_removed && !zdict_remove(dict, names[1], &element) && zdict_count(dict) == MEMBERS / 10;
+  for (int i = 0; i < MEMBERS; i += 10)
+    is_removed = is_removed && zdict_get(dict, names[i]);
+  print_detailed_test_result_bool("zset_test_dict: removed members are gone and the rest stay", is_removed, true, is_removed);
+
+  db_uint_t cursor = 0;
+  do
+    cursor = zdict_scan(dict, cursor, zset_test_dict_count_visit, visits);
+  while (cursor);
+  db_bool_t is_scanned = true;
+  for (int i = 0; i < MEMBERS; ++i)
+    is_scanned = is_scanned && (i % 10 ? visits[i] == 0 : visits[i] >= 1);
+  print_detailed_test_result_bool("zset_test_dict: a scan visits every member", is_scanned, true, is_scanned);
+  zdict_free(dict);
+}
+
+static void zset_test_packed()
+{
+  DBZSet *zset = zset_create();
+  zadd(zset, 3, "c");
+  zadd(zset, 1, "a");
+  zadd(zset, 2.5, "b");
+  zadd(zset, 2.5, "bb");
+  zadd(zset, 9, "a");
+  zrem(zset, "c");
+  db_bool_t packed = zset->encoding == DB_ENCODING_ZSET_PACKED && !zset->dict;
+  print_detailed_test_result_bool("zset_test_packed: small set stays packed", packed, true, packed);
+
+  DBList *range_list = zrange(zset, 0, 10, false, NULL);
+  const char *expected[] = {"b", "bb", "a"};
+  int matches = 0, i = 0;
+  for (DBListNode *node = range_list->head; node && i < 3; node = node->next, ++i)
+    matches += strcmp(node->data->value.string, expected[i]) == 0;
+  print_detailed_test_result_int("zset_test_packed: ZRANGE in score order", (matches == 3 && range_list->length == 3), 3, matches);
+  free_dblist(range_list);
+
+  DBObj *score = zscore(zset, "a");
+  db_bool_t updated = dbobj_is_double(score) && score->value.double_value == 9;
+  print_detailed_test_result_bool("zset_test_packed: ZADD updates the score", updated, true, updated);
+  free_dbobj(score);
+  DBObj *rank = zrevrank(zset, "bb", false);
+  long got = dbobj_is_int(rank) ? rank->value.int_value : -1;
+  print_detailed_test_result_int("zset_test_packed: ZREVRANK", (got == 1), 1, got);
+  free_dbobj(rank);
+  db_uint_t count = zcount(zset, 2.5, true, 9, false);
+  print_detailed_test_result_int("zset_test_packed: ZCOUNT [2.5,9)", (count == 2), 2, count);
+
+  // going over the member limit converts the set, with the same contents
+  char member[16];
+  for (int n = 0; n < ZSET_PACKED_MAX_MEMBERS; ++n)
+  {
+    snprintf(member, sizeof(member), "m%03d", n);
+    zadd(zset, 100 + n, member);
+  }
+  db_bool_t converted = zset->encoding == DB_ENCODING_SKIPLIST && !zset->packed && zcard(zset) == ZSET_PACKED_MAX_MEMBERS + 3;
+  print_detailed_test_result_bool("zset_test_packed: converted past the member limit", converted, true, converted);
+  range_list = zrevrange(zset, ZSET_PACKED_MAX_MEMBERS, ZSET_PACKED_MAX_MEMBERS + 2, true, NULL);
+  matches = 0, i = 0;
+  for (DBListNode *node = range_list->head; node && i < 3; node = node->next->next, ++i)
+    matches += strcmp(node->data->value.string, expected[2 - i]) == 0;
+  print_detailed_test_result_int("zset_test_packed: members kept their order", (matches == 3), 3, matches);
+  free_dblist(range_list);
+  db_uint_t removed = zremrangebyscore(zset, 100, true, 1000, true);
+  print_detailed_test_result_int("zset_test_packed: ZREMRANGEBYSCORE after converting", (removed == ZSET_PACKED_MAX_MEMBERS && zcard(zset) == 3), ZSET_PACKED_MAX_MEMBERS, removed);
+  free_dbzset(zset);
+
+  // so does a member longer than the length limit
+  char long_member[ZSET_PACKED_MAX_LENGTH + 2];
+  memset(long_member, 'x', sizeof(long_member) - 1);
+  long_member[sizeof(long_member) - 1] = '\0';
+  zset = zset_create();
+  zadd(zset, 1, "short");
+  zadd(zset, 2, long_member);
+  converted = zset->encoding == DB_ENCODING_SKIPLIST && zset_has_member(zset, "short") && zset_has_member(zset, long_member);
+  print_detailed_test_result_bool("zset_test_packed: converted by a long member", converted, true, converted);
+  free_dbzset(zset);
+
+  zset = zset_create();
+  zadd(zset, 1, "a");
+  zadd(zset, 2, "b");
+  removed = zremrangebyscore(zset, 0, true, 5, true);
+  db_bool_t drained = removed == 2 && zcard(zset) == 0 && !zset->packed && zset->memory == dbutil_alloc_size(zset);
+  print_detailed_test_result_bool("zset_test_packed: drained set frees its array", drained, true, drained);
+  free_dbzset(zset);
+}
+
+static void zset_test_zrevrange()
+{
+  DBZSet *zset = zset_create();
+  zadd(zset, 1, "a");
+  zadd(zset, 2, "b");
+  zadd(zset, 3, "c");
+  zadd(zset, 4, "d");
+
+  DBList *range_list = zrevrange(zset, 1, 5, true, NULL);
+  const char *expected[] = {"c", "b", "a"};
+  int matches = 0, i = 0;
+  for (DBListNode *node = range_list->head; node && i < 3; node = node->next->next, ++i)
+    matches += strcmp(node->data->value.string, expected[i]) == 0 && node->next->data->value.double_value == 3 - i;
+  print_detailed_test_result_int("zset_test_zrevrange: [1,5] == {c,3,b,2,a,1}", (matches == 3 && range_list->length == 6), 3, matches);
+  free_dblist(range_list);
+
+  DBObj *rank_obj = zrevrank(zset, "d", false);
+  long got = dbobj_is_int(rank_obj) ? rank_obj->value.int_value : -1;
+  print_detailed_test_result_int("zset_test_zrevrange: reverse rank of 'd' == 0", (got == 0), 0, got);
+  free_dbobj(rank_obj);
+
+  free_dbzset(zset);
+}
+
+static void zset_test_fractional_scores()
+{
+  DBZSet *zset = zset_create();
+  zadd(zset, 0.5, "d");
+  zadd(zset, 0.25, "c");
+  zadd(zset, 0.75, "a");
+  zadd(zset, 0.1, "b");
+  zadd(zset, 0.5, "e");
+
+  // scores less than 1 apart used to compare as ties, ordering these by member
+  DBList *range_list = zrange(zset, 0, 4, false, NULL);
+  const char *expected[] = {"b", "c", "d", "e", "a"};
+  int matches = 0, i = 0;
+  for (DBListNode *node = range_list->head; node && i < 5; node = node->next, ++i)
+    matches += strcmp(node->data->value.string, expected[i]) == 0;
+  print_detailed_test_result_int("zset_test_fractional_scores: ordered by score, then member", (matches == 5), 5, matches);
+  free_dblist(range_list);
+
+  range_list = zrangebyscore(zset, 0.25, false, 0.5, true, false, NULL);
+  long length = range_list ? (long)range_list->length : -1;
+  print_detailed_test_result_int("zset_test_fractional_scores: (0.25,0.5] has d and e", (length == 2), 2, length);
+  free_dblist(range_list);
+
+  db_uint_t count = zcount(zset, 0.5, true, 0.5, true);
+  print_detailed_test_result_int("zset_test_fractional_scores: [0.5,0.5] counts the ties", (count == 2), 2, count);
+  count = zcount(zset, 0.8, true, 2, true);
+  print_detailed_test_result_int("zset_test_fractional_scores: range above the set is empty", (count == 0), 0, count);
+  count = zcount(zset, -1, true, 0.05, true);
+  print_detailed_test_result_int("zset_test_fractional_scores: range below the set is empty", (count == 0), 0, count);
+  range_list = zrangebyscore(zset, -1, true, 0.05, true, false, NULL);
+  length = range_list ? (long)range_list->length : -1;
+  print_detailed_test_result_int("zset_test_fractional_scores: range below the set lists nothing", (length == 0), 0, length);
+  free_dblist(range_list);
+
+  // a range starting below the lowest score takes the whole set
+  db_uint_t removed = zremrangebyscore(zset, 0, true, 1, true);
+  print_detailed_test_result_int("zset_test_fractional_scores: ZREMRANGEBYSCORE from below", (removed == 5 && zcard(zset) == 0), 5, removed);
+
+  free_dbzset(zset);
+}
+
 static void zset_test_zrem()
 {
   DBZSet *zset = zset_create();
@@ -320,6 +649,24 @@ static void zset_test_zremrangebyscore()
 
   free_dbobj(b_score);
   free_dbzset(zset);
+
+  // (x (x holds nothing, on the skiplist too
+  zset = zset_create();
+  char member[16];
+  for (int n = 0; n <= ZSET_PACKED_MAX_MEMBERS; ++n)
+  {
+    snprintf(member, sizeof(member), "m%03d", n);
+    zadd(zset, n, member);
+  }
+  DBList *range_list = zrangebyscore(zset, 4, false, 4, false, false, NULL);
+  db_uint_t length = range_list ? range_list->length : DB_UINT_MAX;
+  print_detailed_test_result_int("zset_test_zremrangebyscore: ZRANGEBYSCORE (x (x is empty", (length == 0), 0, length);
+  free_dblist(range_list);
+  removed = zremrangebyscore(zset, 4, false, 4, false);
+  c = zcard(zset);
+  db_bool_t is_kept = zset->encoding == DB_ENCODING_SKIPLIST && removed == 0 && c == ZSET_PACKED_MAX_MEMBERS + 1;
+  print_detailed_test_result_int("zset_test_zremrangebyscore: (x (x removes nothing", is_kept, 0, removed);
+  free_dbzset(zset);
 }
 
 static void zset_test_zinterstore()
@@ -395,11 +742,3677 @@ static void zset_test_zunionstore()
   free_dblist(zsets);
 }
 
+// Enough members for the work to be split over threads, with weights and every aggregate
+static void zset_test_zaggregate_large()
+{
+  char member[16];
+  DBZSet *zset1 = zset_create();
+  DBZSet *zset2 = zset_create();
+  DBZSet *zset3 = zset_create();
+  for (int i = 0; i < 60000; ++i)
+  {
+    snprintf(member, sizeof(member), "m%d", i);
+    zadd(zset1, i, member);
+    snprintf(member, sizeof(member), "m%d", i + 30000);
+    zadd(zset2, 1, member);
+  }
+  zadd(zset3, 5, "m0");
+  zadd(zset3, 5, "m40000");
+  zadd(zset3, 5, "x");
+
+  DBList *zsets = create_dblist();
+  rpush(zsets, create_dblistnode(dbobj_create_zset(zset1)));
+  rpush(zsets, create_dblistnode(dbobj_create_zset(zset2)));
+  DBList *weights = create_dblist();
+  rpush(weights, create_dblistnode(dbobj_create_double(1)));
+  rpush(weights, create_dblistnode(dbobj_create_double(2)));
+
+  DBZSet *union_zset = dbobj_extract_zset(zunionstore(zsets, weights, DB_AGG_SUM));
+  db_uint_t card = zcard(union_zset);
+  print_detailed_test_result_int("zset_test_zaggregate_large: union zcard == 90000", card == 90000, 90000, card);
+  DBObj *score = zscore(union_zset, "m30000");
+  double value = dbobj_is_double(score) ? score->value.double_value : -1;
+  print_detailed_test_result_double("zset_test_zaggregate_large: union 'm30000' == 30002", value == 30002, 30002, value);
+  free_dbobj(score);
+  score = zscore(union_zset, "m89999");
+  value = dbobj_is_double(score) ? score->value.double_value : -1;
+  print_detailed_test_result_double("zset_test_zaggregate_large: union 'm89999' == 2", value == 2, 2, value);
+  free_dbobj(score);
+
+  DBZSetIter iter;
+  const char *prev_member = NULL, *curr_member;
+  db_double_t prev_score = 0, curr_score;
+  bool sorted = true;
+  zset_iter_init(union_zset, &iter);
+  while ((curr_member = zset_iter_next(&iter, &curr_score)))
+  {
+    if (prev_member && (curr_score < prev_score || (curr_score == prev_score && strcmp(prev_member, curr_member) >= 0)))
+      sorted = false;
+    prev_member = curr_member;
+    prev_score = curr_score;
+  }
+  print_detailed_test_result_bool("zset_test_zaggregate_large: union sorted by score then member", sorted, true, sorted);
+  free_dbzset(union_zset);
+
+  weights->tail->data->value.double_value = 100000;
+  DBZSet *inter_zset = dbobj_extract_zset(zinterstore(zsets, weights, DB_AGG_MAX));
+  card = zcard(inter_zset);
+  print_detailed_test_result_int("zset_test_zaggregate_large: inter zcard == 30000", card == 30000, 30000, card);
+  score = zscore(inter_zset, "m59999");
+  value = dbobj_is_double(score) ? score->value.double_value : -1;
+  print_detailed_test_result_double("zset_test_zaggregate_large: inter MAX 'm59999' == 100000", value == 100000, 100000, value);
+  free_dbobj(score);
+  free_dbzset(inter_zset);
+
+  // the smallest set comes last, but the scores are still combined in the order of the sets
+  rpush(zsets, create_dblistnode(dbobj_create_zset(zset3)));
+  inter_zset = dbobj_extract_zset(zinterstore(zsets, NULL, DB_AGG_MIN));
+  card = zcard(inter_zset);
+  print_detailed_test_result_int("zset_test_zaggregate_large: inter of 3 zcard == 1", card == 1, 1, card);
+  score = zscore(inter_zset, "m40000");
+  value = dbobj_is_double(score) ? score->value.double_value : -1;
+  print_detailed_test_result_double("zset_test_zaggregate_large: inter MIN 'm40000' == 1", value == 1, 1, value);
+  free_dbobj(score);
+  free_dbzset(inter_zset);
+
+  free_dblist(weights);
+  free_dblist(zsets);
+}
+
+static void zset_test_zadd_bulk()
+{
+  char member[16];
+  DBZSetPair pairs[1024];
+  char members[1024][16];
+  for (int i = 0; i < 1024; ++i)
+  {
+    snprintf(members[i], sizeof(members[i]), "b%d", i);
+    pairs[i] = (DBZSetPair){.member = members[i], .length = strlen(members[i]), .score = i % 100};
+  }
+  DBZSet *zset = zset_create();
+  db_uint_t added = zadd_bulk(zset, pairs, 1024);
+  print_detailed_test_result_int("zset_test_zadd_bulk: all added to an empty set", added == 1024, 1024, added);
+  // rank 1024 is divisible by 4 five times, so it reaches level 6 and nothing goes higher
+  print_detailed_test_result_int("zset_test_zadd_bulk: balanced levels", zset->level == 6, 6, zset->level);
+
+  // 200 new members, 100 current ones moved to the front, and one member given twice
+  for (int i = 0; i < 300; ++i)
+  {
+    if (i < 200)
+      snprintf(members[i], sizeof(members[i]), "n%d", i);
+    else
+      snprintf(members[i], sizeof(members[i]), "b%d", i * 3);
+    pairs[i] = (DBZSetPair){.member = members[i], .length = strlen(members[i]), .score = i < 200 ? 50.5 : -1};
+  }
+  pairs[300] = (DBZSetPair){.member = "n7", .length = 2, .score = 7};
+  added = zadd_bulk(zset, pairs, 301);
+  print_detailed_test_result_int("zset_test_zadd_bulk: merged new members counted", added == 200, 200, added);
+  db_uint_t card = zcard(zset);
+  print_detailed_test_result_int("zset_test_zadd_bulk: zcard after merge", card == 1224, 1224, card);
+
+  DBObj *score = zscore(zset, "n7");
+  double value = dbobj_is_double(score) ? score->value.double_value : -1;
+  print_detailed_test_result_double("zset_test_zadd_bulk: last pair of a member wins", value == 7, 7, value);
+  free_dbobj(score);
+  score = zscore(zset, "b600");
+  value = dbobj_is_double(score) ? score->value.double_value : 0;
+  print_detailed_test_result_double("zset_test_zadd_bulk: current member updated", value == -1, -1, value);
+  free_dbobj(score);
+
+  // ranks agree with the order of the iteration, so the spans were rebuilt with the links
+  DBZSetIter iter;
+  const char *curr_member;
+  db_double_t curr_score;
+  long rank = 0;
+  bool ranked = true;
+  zset_iter_init(zset, &iter);
+  while ((curr_member = zset_iter_next(&iter, &curr_score)))
+  {
+    DBObj *rank_obj = zrank(zset, curr_member, false);
+    if (!dbobj_is_int(rank_obj) || rank_obj->value.int_value != rank)
+      ranked = false;
+    free_dbobj(rank_obj);
+    ++rank;
+  }
+  print_detailed_test_result_bool("zset_test_zadd_bulk: ranks follow the order", ranked && rank == 1224, true, ranked && rank == 1224);
+  snprintf(member, sizeof(member), "b%d", 3 * 200);
+  DBObj *first = zrank(zset, member, false);
+  print_detailed_test_result_bool("zset_test_zadd_bulk: updated members come first", dbobj_is_int(first) && first->value.int_value == 0, true, dbobj_is_int(first) && first->value.int_value == 0);
+  free_dbobj(first);
+
+  free_dbzset(zset);
+}
+
+static void core_test_request_reply()
+{
+  dbapi_set("core_test:key", "value");
+  char *value = dbapi_get("core_test:key");
+  bool got = value && strcmp(value, "value") == 0;
+  print_detailed_test_result_str("core_test_request_reply: GET after SET", got, "value", value);
+  dbapi_free(value);
+
+  // Queue several requests before waiting on any of them.
+  DBRequest *requests[8];
+  DBReply *replies[8];
+  for (int i = 0; i < 8; ++i)
+  {
+    requests[i] = create_request(DB_RPUSH);
+    add_request_arg(requests[i], dbobj_create_string_with_dup("core_test:list"));
+    add_request_arg(requests[i], dbobj_create_string_with_dup("x"));
+    replies[i] = dbapi_request_async(requests[i]);
+  }
+  db_uint_t last_length = 0;
+  for (int i = 0; i < 8; ++i)
+  {
+    dbapi_await_reply(replies[i]);
+    if (dbobj_is_uint(replies[i]->data))
+      last_length = replies[i]->data->value.uint_value;
+    free_reply(replies[i]);
+    free_request(requests[i]);
+  }
+  print_detailed_test_result_int("core_test_request_reply: async replies complete in order", (last_length == 8), 8, last_length);
+
+  dbapi_del("core_test:key");
+  dbapi_del("core_test:list");
+}
+
+static void core_test_pipeline()
+{
+  DBPipeline *pipeline = create_pipeline();
+  DBRequest *request;
+
+  for (int i = 0; i < 64; ++i)
+  {
+    request = create_request(DB_RPUSH);
+    add_request_arg(request, dbobj_create_string_with_dup("core_test:pipeline"));
+    add_request_arg(request, dbobj_create_string_with_dup("x"));
+    add_pipeline_request(pipeline, request);
+  }
+  request = create_request(DB_LLEN);
+  add_request_arg(request, dbobj_create_string_with_dup("core_test:pipeline"));
+  add_pipeline_request(pipeline, request);
+
+  dbapi_pipeline_sync(pipeline);
+  db_bool_t all_done = true;
+  for (db_uint_t i = 0; i < pipeline->length; ++i)
+    all_done = all_done && pipeline->replies[i]->done;
+  DBObj *length_obj = pipeline->replies[pipeline->length - 1]->data;
+  db_uint_t length = dbobj_is_uint(length_obj) ? length_obj->value.uint_value : 0;
+  print_detailed_test_result_bool("core_test_pipeline: every reply is done", all_done, true, all_done);
+  print_detailed_test_result_int("core_test_pipeline: requests run in order", (length == 64), 64, length);
+
+  free_pipeline(pipeline);
+  dbapi_del("core_test:pipeline");
+}
+
+static DBReply *core_test_command(db_action_t action, int argc, const char *argv[])
+{
+  DBRequest *request = create_request(action);
+  for (int i = 0; i < argc; ++i)
+    add_request_arg(request, dbobj_create_string_with_dup(argv[i]));
+  DBReply *reply = dbapi_request_sync(request);
+  free_request(request);
+  return reply;
+}
+
+static void core_test_pipeline_add(DBPipeline *pipeline, db_action_t action, int argc, const char *argv[])
+{
+  DBRequest *request = create_request(action);
+  for (int i = 0; i < argc; ++i)
+    add_request_arg(request, dbobj_create_string_with_dup(argv[i]));
+  add_pipeline_request(pipeline, request);
+}
+
+// The reply of the last request of the pipeline, after submitting it and waiting for it
+static DBObj *core_test_pipeline_last(DBPipeline *pipeline)
+{
+  dbapi_pipeline_sync(pipeline);
+  return pipeline->replies[pipeline->length - 1]->data;
+}
+
+static void core_test_transaction()
+{
+  DBPipeline *pipeline = create_pipeline();
+  DBPipeline *other = create_pipeline();
+  dbapi_del("transaction:counter");
+
+  core_test_pipeline_add(pipeline, DB_MULTI, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_INCR, 1, (const char *[]){"transaction:counter"});
+  core_test_pipeline_add(pipeline, DB_INCR, 1, (const char *[]){"transaction:counter"});
+  core_test_pipeline_add(pipeline, DB_GET, 1, (const char *[]){"transaction:counter"});
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  DBObj *data = core_test_pipeline_last(pipeline);
+  DBObj *queued = pipeline->replies[1]->data;
+  db_bool_t is_queued = dbobj_is_string(queued) && strcmp(queued->value.string, QUEUED) == 0;
+  print_detailed_test_result_bool("core_test_transaction: commands after MULTI are queued", is_queued, true, is_queued);
+  db_bool_t is_run = dbobj_is_list(data) && data->value.list->length == 3 &&
+                     strcmp(data->value.list->tail->data->value.string, "2") == 0;
+  print_detailed_test_result_bool("core_test_transaction: EXEC replies with every reply in order", is_run, true, is_run);
+  reset_pipeline(pipeline);
+
+  // Another client writes the watched key between WATCH and EXEC.
+  dbapi_set("transaction:watched", "before");
+  core_test_pipeline_add(pipeline, DB_WATCH, 1, (const char *[]){"transaction:watched"});
+  core_test_pipeline_last(pipeline);
+  reset_pipeline(pipeline);
+  core_test_pipeline_add(other, DB_SET, 2, (const char *[]){"transaction:watched", "other"});
+  core_test_pipeline_last(other);
+  core_test_pipeline_add(pipeline, DB_MULTI, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_SET, 2, (const char *[]){"transaction:watched", "mine"});
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  data = core_test_pipeline_last(pipeline);
+  char *value = dbapi_get("transaction:watched");
+  db_bool_t is_aborted = dbobj_is_null(data) && value && strcmp(value, "other") == 0;
+  print_detailed_test_result_bool("core_test_transaction: a watched key written by another client fails EXEC", is_aborted, true, is_aborted);
+  dbapi_free(value);
+  reset_pipeline(pipeline);
+
+  core_test_pipeline_add(pipeline, DB_WATCH, 1, (const char *[]){"transaction:watched"});
+  core_test_pipeline_add(pipeline, DB_MULTI, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_SET, 2, (const char *[]){"transaction:watched", "mine"});
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  data = core_test_pipeline_last(pipeline);
+  value = dbapi_get("transaction:watched");
+  is_run = dbobj_is_list(data) && value && strcmp(value, "mine") == 0;
+  print_detailed_test_result_bool("core_test_transaction: an unchanged watched key lets EXEC run", is_run, true, is_run);
+  dbapi_free(value);
+  reset_pipeline(pipeline);
+
+  core_test_pipeline_add(pipeline, DB_MULTI, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_SET, 1, (const char *[]){"transaction:watched"});
+  core_test_pipeline_add(pipeline, DB_SET, 2, (const char *[]){"transaction:watched", "never"});
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  core_test_pipeline_last(pipeline);
+  value = dbapi_get("transaction:watched");
+  DBObj *exec = pipeline->replies[3]->data, *again = pipeline->replies[4]->data;
+  is_aborted = dbobj_is_error(exec) && strcmp(exec->value.message, DB_ERR_EXECABORT) == 0 &&
+               dbobj_is_error(again) && strcmp(again->value.message, DB_ERR_EXEC_WITHOUT_MULTI) == 0 &&
+               value && strcmp(value, "mine") == 0;
+  print_detailed_test_result_bool("core_test_transaction: a refused command discards the transaction", is_aborted, true, is_aborted);
+  dbapi_free(value);
+  reset_pipeline(pipeline);
+
+  // Across shards EXEC runs as a barrier, and a pop that would block answers at once.
+  dbapi_shutdown();
+  server_config_shard_count(4);
+  dbapi_start_server();
+  dbapi_rpush("transaction:list", "a");
+  core_test_pipeline_add(pipeline, DB_WATCH, 2, (const char *[]){"transaction:list", "transaction:counter"});
+  core_test_pipeline_add(pipeline, DB_MULTI, 0, NULL);
+  core_test_pipeline_add(pipeline, DB_MSET, 4, (const char *[]){"transaction:a", "1", "transaction:b", "2"});
+  core_test_pipeline_add(pipeline, DB_BLPOP, 2, (const char *[]){"transaction:list", "0"});
+  core_test_pipeline_add(pipeline, DB_BLPOP, 2, (const char *[]){"transaction:list", "0"});
+  core_test_pipeline_add(pipeline, DB_MGET, 2, (const char *[]){"transaction:a", "transaction:b"});
+  core_test_pipeline_add(pipeline, DB_EXEC, 0, NULL);
+  data = core_test_pipeline_last(pipeline);
+  DBListNode *node = dbobj_is_list(data) && data->value.list->length == 4 ? data->value.list->head : NULL;
+  is_run = node && dbobj_is_list(node->next->data) && dbobj_is_null(node->next->next->data) &&
+           dbobj_is_list(node->next->next->next->data) && node->next->next->next->data->value.list->length == 2;
+  print_detailed_test_result_bool("core_test_transaction: EXEC across shards", is_run, true, is_run);
+  reset_pipeline(pipeline);
+  dbapi_del("transaction:a");
+  dbapi_del("transaction:b");
+  dbapi_shutdown();
+  server_config_shard_count(1);
+  dbapi_start_server();
+
+  DBReply *reply = core_test_command(DB_MULTI, 0, NULL);
+  db_bool_t is_error = dbobj_is_error(reply->data);
+  print_detailed_test_result_bool("core_test_transaction: MULTI needs a pipeline", is_error, true, is_error);
+  free_reply(reply);
+
+  free_pipeline(pipeline);
+  free_pipeline(other);
+  dbapi_del("transaction:counter");
+  dbapi_del("transaction:watched");
+  dbapi_del("transaction:list");
+}
+
+static void core_test_bgsave()
+{
+  dbapi_set("core_test:bgsave", "value");
+  db_bool_t started = dbapi_bgsave();
+  print_detailed_test_result_bool("core_test_bgsave: BGSAVE starts", started, true, started);
+
+  // Poll the persistence info until the child is reaped.
+  db_bool_t finished = false, is_ok = false;
+  for (int i = 0; i < 500 && !finished; ++i)
+  {
+    DBReply *reply = core_test_command(DB_INFO_PERSISTENCE, 0, NULL);
+    for (DBListNode *node = dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL; node; node = node->next)
+    {
+      if (strcmp(node->data->value.string, "bgsave_in_progress:0") == 0)
+        finished = true;
+      if (strcmp(node->data->value.string, "last_bgsave_status:ok") == 0)
+        is_ok = true;
+    }
+    free_reply(reply);
+    if (!finished)
+      thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  }
+  print_detailed_test_result_bool("core_test_bgsave: child finishes successfully", finished && is_ok, true, finished && is_ok);
+  db_uint_t lastsave = dbapi_lastsave();
+  print_detailed_test_result_bool("core_test_bgsave: LASTSAVE is set", lastsave > 0, true, lastsave > 0);
+
+  dbapi_del("core_test:bgsave");
+}
+
+static void core_test_sharded()
+{
+  dbapi_shutdown();
+  server_config_shard_count(4);
+  dbapi_start_server();
+
+  char key[32], new_key[32];
+  for (int i = 0; i < 32; ++i)
+  {
+    sprintf(key, "shard_test:%d", i);
+    dbapi_set(key, key);
+  }
+  // Some of these moves cross shards.
+  for (int i = 0; i < 8; ++i)
+  {
+    sprintf(key, "shard_test:%d", i);
+    sprintf(new_key, "shard_test:moved:%d", i);
+    dbapi_rename(key, new_key);
+  }
+
+  int key_count = 0;
+  DBList *keys = dbapi_keys();
+  for (DBListNode *node = keys ? keys->head : NULL; node; node = node->next)
+    if (strncmp(node->data->value.string, "shard_test:", 11) == 0)
+      ++key_count;
+  dbapi_free_list(keys);
+  print_detailed_test_result_int("core_test_sharded: KEYS sees every shard", (key_count == 32), 32, key_count);
+
+  char *value = dbapi_get("shard_test:moved:3");
+  bool got = value && strcmp(value, "shard_test:3") == 0;
+  print_detailed_test_result_str("core_test_sharded: RENAME moves the value", got, "shard_test:3", value);
+  dbapi_free(value);
+
+  DBList *values = dbapi_mget("shard_test:10", "shard_test:20", "shard_test:30", NULL);
+  got = values && values->length == 3 && dbobj_is_string(values->tail->data) && strcmp(values->tail->data->value.string, "shard_test:30") == 0;
+  print_detailed_test_result_bool("core_test_sharded: MGET across shards", got, true, got);
+  dbapi_free_list(values);
+
+  // Keys of a single shard, routed as core_route_key does, are served by that shard alone.
+  char same_shard[32];
+  DBKey first = ht_key("shard_test:local");
+  for (int i = 0;; ++i)
+  {
+    sprintf(same_shard, "shard_test:local:%d", i);
+    DBKey other = ht_key(same_shard);
+    if (((uint64_t)other.hash * 4) >> 32 == ((uint64_t)first.hash * 4) >> 32)
+      break;
+  }
+  dbapi_mset("shard_test:local", "a", same_shard, "b", NULL);
+  values = dbapi_mget("shard_test:local", same_shard, NULL);
+  got = values && values->length == 2 && strcmp(values->head->data->value.string, "a") == 0 &&
+        strcmp(values->tail->data->value.string, "b") == 0;
+  print_detailed_test_result_bool("core_test_sharded: MSET and MGET within a shard", got, true, got);
+  dbapi_free_list(values);
+  DBReply *local_del = core_test_command(DB_DEL, 2, (const char *[]){"shard_test:local", same_shard});
+  got = dbobj_is_uint(local_del->data) && local_del->data->value.uint_value == 2;
+  print_detailed_test_result_bool("core_test_sharded: DEL within a shard", got, true, got);
+  free_reply(local_del);
+
+  dbapi_rpush("shard_test:blocking", "x");
+  value = dbapi_blpop("shard_test:blocking", 1);
+  DBReply *popped = core_test_command(DB_BLPOP, 3, (const char *[]){"shard_test:10", "shard_test:none", "1"});
+  got = value && strcmp(value, "x") == 0 && popped->data && popped->data->type == DB_TYPE_ERROR;
+  print_detailed_test_result_bool("core_test_sharded: BLPOP across shards checks every key's type", got, true, got);
+  free_reply(popped);
+  dbapi_free(value);
+  dbapi_del("shard_test:blocking");
+
+  free_reply(core_test_command(DB_ZADD, 5, (const char *[]){"shard_test:za", "1", "a", "2", "b"}));
+  free_reply(core_test_command(DB_ZADD, 5, (const char *[]){"shard_test:zb", "3", "b", "4", "c"}));
+  DBReply *reply = core_test_command(DB_ZUNIONSTORE, 4, (const char *[]){"shard_test:zu", "2", "shard_test:za", "shard_test:zb"});
+  db_uint_t card = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_sharded: ZUNIONSTORE across shards", (card == 3), 3, card);
+  free_reply(reply);
+  reply = core_test_command(DB_ZSCORE, 2, (const char *[]){"shard_test:zu", "b"});
+  double score = dbobj_is_double(reply->data) ? reply->data->value.double_value : -1;
+  print_detailed_test_result_double("core_test_sharded: union score of 'b' == 5", (score == 5.0), 5.0, score);
+  free_reply(reply);
+
+  DBRequest *request = create_request(DB_DEL);
+  keys = dbapi_keys();
+  for (DBListNode *node = keys ? keys->head : NULL; node; node = node->next)
+    if (strncmp(node->data->value.string, "shard_test:", 11) == 0)
+      add_request_arg(request, dbobj_create_string_with_dup(node->data->value.string));
+  dbapi_free_list(keys);
+  reply = dbapi_request_sync(request);
+  db_uint_t deleted = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_sharded: DEL across shards", (deleted == 35), 35, deleted);
+  free_reply(reply);
+  free_request(request);
+
+  dbapi_shutdown();
+  server_config_shard_count(1);
+  dbapi_start_server();
+}
+
+static void core_test_copy_file(const char *from, const char *to)
+{
+  char buffer[4096];
+  size_t n;
+  FILE *in = fopen(from, "rb");
+  FILE *out = fopen(to, "wb");
+  while (in && out && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    fwrite(buffer, 1, n, out);
+  if (in)
+    fclose(in);
+  if (out)
+    fclose(out);
+}
+
+// Restarts from the log alone, as if the process had died without saving
+static void core_test_crash_restart()
+{
+  core_test_copy_file("test.aof", "test.aof.crash");
+  dbapi_shutdown();
+  remove("test-aof.snapshot");
+  rename("test.aof.crash", "test.aof");
+  dbapi_start_server();
+}
+
+static void core_test_aof()
+{
+  dbapi_shutdown();
+  remove("test.aof");
+  remove("test-aof.snapshot");
+  server_config_persistence_filepath("test-aof.snapshot");
+  server_config_aof_enabled(true);
+  server_config_aof_filepath("test.aof");
+  server_config_aof_fsync(DB_AOF_FSYNC_ALWAYS);
+  dbapi_start_server();
+
+  dbapi_set("aof_test:string", "value");
+  dbapi_rpush_n("aof_test:list", "a", "b", NULL);
+  free_reply(core_test_command(DB_HSET, 3, (const char *[]){"aof_test:hash", "field", "x"}));
+  free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"aof_test:zset", "2.5", "m"}));
+  free_reply(core_test_command(DB_EXPIRE, 2, (const char *[]){"aof_test:string", "1000"}));
+  dbapi_set("aof_test:deleted", "value");
+  dbapi_del("aof_test:deleted");
+  core_test_crash_restart();
+
+  char *value = dbapi_get("aof_test:string");
+  bool got = value && strcmp(value, "value") == 0;
+  print_detailed_test_result_str("core_test_aof: SET is replayed", got, "value", value);
+  dbapi_free(value);
+  db_uint_t length = dbapi_llen("aof_test:list");
+  print_detailed_test_result_int("core_test_aof: RPUSH is replayed once", (length == 2), 2, length);
+  DBReply *reply = core_test_command(DB_ZSCORE, 2, (const char *[]){"aof_test:zset", "m"});
+  double score = dbobj_is_double(reply->data) ? reply->data->value.double_value : -1;
+  print_detailed_test_result_double("core_test_aof: ZADD is replayed", (score == 2.5), 2.5, score);
+  free_reply(reply);
+  value = dbapi_get("aof_test:deleted");
+  print_detailed_test_result_str("core_test_aof: DEL is replayed", (value == NULL), "(null)", value);
+  dbapi_free(value);
+
+  db_bool_t started = dbapi_bgrewriteaof();
+  print_detailed_test_result_bool("core_test_aof: BGREWRITEAOF starts", started, true, started);
+  db_bool_t finished = false, is_ok = false;
+  for (int i = 0; i < 500 && !finished; ++i)
+  {
+    reply = core_test_command(DB_INFO_PERSISTENCE, 0, NULL);
+    for (DBListNode *node = dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL; node; node = node->next)
+    {
+      if (strcmp(node->data->value.string, "aof_rewrite_in_progress:0") == 0)
+        finished = true;
+      if (strcmp(node->data->value.string, "aof_last_bgrewrite_status:ok") == 0)
+        is_ok = true;
+    }
+    free_reply(reply);
+    if (!finished)
+      thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  }
+  print_detailed_test_result_bool("core_test_aof: rewrite finishes successfully", finished && is_ok, true, finished && is_ok);
+
+  dbapi_rpush("aof_test:list", "c");
+  core_test_crash_restart();
+
+  length = dbapi_llen("aof_test:list");
+  print_detailed_test_result_int("core_test_aof: rewritten log keeps later writes", (length == 3), 3, length);
+  reply = core_test_command(DB_HGET, 2, (const char *[]){"aof_test:hash", "field"});
+  got = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, "x") == 0;
+  print_detailed_test_result_str("core_test_aof: rewritten log keeps hashes", got, "x", got ? reply->data->value.string : NULL);
+  free_reply(reply);
+
+  dbapi_shutdown();
+  remove("test.aof");
+  remove("test-aof.snapshot");
+  server_config_aof_enabled(false);
+  server_config_persistence_filepath(DEFAULT_SNAPSHOT_FILE);
+  dbapi_start_server();
+}
+
+typedef struct JsonTestInput
+{
+  const char *data;
+  size_t offset;
+} JsonTestInput;
+
+// Hands the input over a byte at a time, so every member is cut across reads
+static size_t json_test_read_byte(void *context, char *buffer, size_t size)
+{
+  JsonTestInput *input = (JsonTestInput *)context;
+  if (!size || !input->data[input->offset])
+    return 0;
+  buffer[0] = input->data[input->offset++];
+  return 1;
+}
+
+static void json_test_stream()
+{
+  JsonTestInput input = {.data = " {\"a\": \"x,}\\\"\", \"b\": {\"c\": [1, {\"d\": \"]\"}]}, \"e\": null}", .offset = 0};
+  cJSON_Stream *stream = cJSON_StreamNew(json_test_read_byte, &input);
+  cJSON *member;
+  char keys[16] = "";
+  db_bool_t values_ok = true;
+
+  while ((member = cJSON_StreamNextMember(stream)))
+  {
+    strcat(keys, member->string);
+    if (strcmp(member->string, "a") == 0)
+      values_ok = values_ok && cJSON_IsString(member) && strcmp(member->valuestring, "x,}\"") == 0;
+    else if (strcmp(member->string, "b") == 0)
+      values_ok = values_ok && cJSON_GetArraySize(cJSON_GetObjectItem(member, "c")) == 2;
+    else
+      values_ok = values_ok && cJSON_IsNull(member);
+    cJSON_Delete(member);
+  }
+  db_bool_t failed = cJSON_StreamFailed(stream);
+  cJSON_StreamDelete(stream);
+  print_detailed_test_result_str("json_test_stream: members come one at a time in order", strcmp(keys, "abe") == 0, "abe", keys);
+  print_detailed_test_result_bool("json_test_stream: members parse across chunks", values_ok && !failed, true, values_ok && !failed);
+
+  input = (JsonTestInput){.data = "{\"a\": 1, \"b\": [2,", .offset = 0};
+  stream = cJSON_StreamNew(json_test_read_byte, &input);
+  int members = 0;
+  while ((member = cJSON_StreamNextMember(stream)))
+  {
+    ++members;
+    cJSON_Delete(member);
+  }
+  failed = cJSON_StreamFailed(stream);
+  cJSON_StreamDelete(stream);
+  print_detailed_test_result_bool("json_test_stream: cut off input fails after the whole members", failed && members == 1, true, failed && members == 1);
+}
+
+// Strings with a byte that needs escaping at every offset of a few vector widths, so the plain runs
+// before and after it end in and out of the SIMD loops
+static void json_test_strings()
+{
+  static const char specials[] = {'"', '\\', '\n', '\t', '\x01', '\x1f'};
+  char original[80];
+  int mismatches = 0;
+
+  for (size_t special = 0; special < sizeof(specials); ++special)
+    for (size_t length = 1; length < sizeof(original); length += 7)
+      for (size_t offset = 0; offset < length; ++offset)
+      {
+        for (size_t i = 0; i < length; ++i)
+          original[i] = (char)(i % 2 ? 'a' + i % 26 : 0xC3 + (i % 4 == 0));
+        original[offset] = specials[special];
+        original[length] = '\0';
+
+        cJSON *item = cJSON_CreateString(original);
+        char *printed = cJSON_PrintUnformatted(item);
+        cJSON *parsed = cJSON_Parse(printed);
+        if (!cJSON_IsString(parsed) || strcmp(parsed->valuestring, original) != 0)
+          ++mismatches;
+        cJSON_free(printed);
+        cJSON_Delete(parsed);
+        cJSON_Delete(item);
+      }
+  print_detailed_test_result_int("json_test_strings: escaped strings survive print and parse", mismatches == 0, 0, mismatches);
+
+  cJSON *parsed = cJSON_Parse("\"0123456789abcdef0123456789abcdef0123456789\\");
+  print_detailed_test_result_bool("json_test_strings: a long string cut off at a backslash fails", parsed == NULL, true, parsed == NULL);
+  cJSON_Delete(parsed);
+}
+
+static void json_test_arena()
+{
+  cJSON_Arena *arena = cJSON_ArenaNew(256);
+  cJSON_Arena *previous = cJSON_ArenaUse(arena);
+  cJSON *root = cJSON_Parse("{\"name\": \"Zane\", \"phoneNumbers\": [\"333-444-5555\"], \"age\": 36}");
+  cJSON_SetValuestring(cJSON_GetObjectItem(root, "name"), "Zane the Longer Named");
+  cJSON_ReplaceItemInObject(root, "age", cJSON_CreateNumber(37));
+  cJSON_AddItemToObject(root, "copy", cJSON_Duplicate(cJSON_GetObjectItem(root, "phoneNumbers"), true));
+  cJSON_DeleteItemFromArray(cJSON_GetObjectItem(root, "phoneNumbers"), 0);
+  // Bigger than a block, so it gets a block of its own
+  char long_string[600];
+  memset(long_string, 'x', sizeof(long_string) - 1);
+  long_string[sizeof(long_string) - 1] = '\0';
+  cJSON_AddStringToObject(root, "long", long_string);
+  cJSON_ArenaUse(previous);
+
+  cJSON *heap_item = cJSON_CreateString("heap");
+  cJSON_Delete(heap_item);
+
+  char *printed = cJSON_PrintUnformatted(cJSON_GetObjectItem(root, "copy"));
+  print_detailed_test_result_str("json_test_arena: a tree built in an arena can be edited", printed && strcmp(printed, "[\"333-444-5555\"]") == 0, "[\"333-444-5555\"]", printed);
+  cJSON_free(printed);
+  db_bool_t values_ok = strcmp(cJSON_GetObjectItem(root, "name")->valuestring, "Zane the Longer Named") == 0 &&
+                        cJSON_GetNumberValue(cJSON_GetObjectItem(root, "age")) == 37 &&
+                        cJSON_GetArraySize(cJSON_GetObjectItem(root, "phoneNumbers")) == 0 &&
+                        strlen(cJSON_GetObjectItem(root, "long")->valuestring) == sizeof(long_string) - 1;
+  print_detailed_test_result_bool("json_test_arena: arena strings grow and replace", values_ok, true, values_ok);
+  print_detailed_test_result_bool("json_test_arena: the arena takes more than one block", cJSON_ArenaSize(arena) > 2 * 256, true, cJSON_ArenaSize(arena) > 2 * 256);
+
+  // Deleting an arena node leaves it to the arena; resetting keeps one block
+  cJSON_Delete(root);
+  cJSON_ArenaReset(arena);
+  size_t size_after_reset = cJSON_ArenaSize(arena);
+  previous = cJSON_ArenaUse(arena);
+  root = cJSON_Parse("[1]");
+  cJSON_ArenaUse(previous);
+  print_detailed_test_result_bool("json_test_arena: a reset arena builds again in its kept block", cJSON_GetArraySize(root) == 1 && cJSON_ArenaSize(arena) == size_after_reset, true, cJSON_GetArraySize(root) == 1 && cJSON_ArenaSize(arena) == size_after_reset);
+  cJSON_ArenaDelete(arena);
+}
+
+static void core_test_persistence_types()
+{
+  const db_persistence_format_t formats[] = {DB_PERSISTENCE_SNAPSHOT, DB_PERSISTENCE_JSON};
+  const char *names[] = {"snapshot", "json"};
+  char test_name[96], deadline[16];
+  sprintf(deadline, "%u", (db_uint_t)time(NULL) - 1);
+
+  for (int i = 0; i < 2; ++i)
+  {
+    dbapi_shutdown();
+    server_config_persistence_filepath("test-types.db");
+    server_config_persistence_format(formats[i]);
+    dbapi_start_server();
+
+    free_reply(core_test_command(DB_HSET, 3, (const char *[]){"types_test:hash", "field", "x"}));
+    free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"types_test:zset", "2.5", "m"}));
+    dbapi_rpush_n("types_test:list", "a", "b", NULL);
+    free_reply(core_test_command(DB_EXPIRE, 2, (const char *[]){"types_test:list", "1000"}));
+    dbapi_set("types_test:expired", "value");
+    free_reply(core_test_command(DB_EXPIREAT, 2, (const char *[]){"types_test:expired", deadline}));
+
+    dbapi_shutdown();
+    dbapi_start_server();
+
+    DBReply *reply = core_test_command(DB_HGET, 2, (const char *[]){"types_test:hash", "field"});
+    bool got = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, "x") == 0;
+    sprintf(test_name, "core_test_persistence_types: %s keeps hashes", names[i]);
+    print_detailed_test_result_str(test_name, got, "x", got ? reply->data->value.string : NULL);
+    free_reply(reply);
+    reply = core_test_command(DB_ZSCORE, 2, (const char *[]){"types_test:zset", "m"});
+    double score = dbobj_is_double(reply->data) ? reply->data->value.double_value : -1;
+    sprintf(test_name, "core_test_persistence_types: %s keeps sorted sets", names[i]);
+    print_detailed_test_result_double(test_name, (score == 2.5), 2.5, score);
+    free_reply(reply);
+    db_uint_t length = dbapi_llen("types_test:list");
+    sprintf(test_name, "core_test_persistence_types: %s keeps lists with a TTL", names[i]);
+    print_detailed_test_result_int(test_name, (length == 2), 2, length);
+    char *value = dbapi_get("types_test:expired");
+    sprintf(test_name, "core_test_persistence_types: %s skips expired keys", names[i]);
+    print_detailed_test_result_str(test_name, (value == NULL), "(null)", value);
+    dbapi_free(value);
+
+    dbapi_flushall();
+  }
+
+  dbapi_shutdown();
+  remove("test-types.db");
+  server_config_persistence_format(DB_PERSISTENCE_SNAPSHOT);
+  server_config_persistence_filepath(DEFAULT_SNAPSHOT_FILE);
+  dbapi_start_server();
+}
+
+// Recounts the bytes of a table the slow way, to check the running count kept by hash.c
+static size_t core_test_walk_table_memory(DBHash *ht)
+{
+  size_t memory = dbutil_alloc_size(ht) + pages_alloc_size(ht->buckets0) + pages_alloc_size(ht->buckets1);
+  for (db_uint_t t = 0; t < 2; ++t)
+    for (db_uint_t b = 0; b < (t ? ht->size1 : ht->size0); ++b)
+      for (DBHashEntry *entry = (t ? ht->buckets1 : ht->buckets0)[b]; entry; entry = entry->next)
+        memory += ht_entry_overhead(entry) + dbobj_shallow_memory_usage(entry->data);
+  return memory;
+}
+
+static size_t core_test_info_field(DBReply *reply, const char *field)
+{
+  size_t field_length = strlen(field);
+  for (DBListNode *node = dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL; node; node = node->next)
+    if (strncmp(node->data->value.string, field, field_length) == 0 && node->data->value.string[field_length] == ':')
+      return strtoull(node->data->value.string + field_length + 1, NULL, 10);
+  return 0;
+}
+
+static void core_test_mapped_snapshot()
+{
+  dbapi_shutdown();
+  server_config_persistence_filepath("test-mapped.db");
+  dbapi_start_server();
+  dbapi_set("mapped:string", "value");
+  dbapi_rpush_n("mapped:list", "a", "b", "c", "d", NULL);
+  free_reply(core_test_command(DB_ZADD, 7, (const char *[]){"mapped:zset", "1", "a", "2", "b", "3", "c"}));
+  free_reply(core_test_command(DB_HSET, 3, (const char *[]){"mapped:hash", "field", "x"}));
+  dbapi_set("mapped:ttl", "value");
+  free_reply(core_test_command(DB_EXPIRE, 2, (const char *[]){"mapped:ttl", "1000"}));
+  dbapi_shutdown();
+  server_config_mapped_load(true);
+  dbapi_start_server();
+
+  // The key with a deadline is loaded as usual
+  DBReply *reply = core_test_command(DB_INFO_PERSISTENCE, 0, NULL);
+  size_t mapped_keys = core_test_info_field(reply, "mapped_keys");
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_mapped_snapshot: keys without a deadline stay in the mapping", mapped_keys == 4, 4, mapped_keys);
+
+  char *value = dbapi_get("mapped:string");
+  print_detailed_test_result_str("core_test_mapped_snapshot: GET reads the mapping", value && strcmp(value, "value") == 0, "value", value);
+  dbapi_free(value);
+  reply = core_test_command(DB_LRANGE, 3, (const char *[]){"mapped:list", "1", "2"});
+  DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t is_range = list && list->length == 2 && strcmp(list->head->data->value.string, "b") == 0 && strcmp(list->tail->data->value.string, "c") == 0;
+  print_detailed_test_result_bool("core_test_mapped_snapshot: LRANGE reads the mapping", is_range, true, is_range);
+  free_reply(reply);
+  reply = core_test_command(DB_ZRANGE, 4, (const char *[]){"mapped:zset", "1", "-1", "WITHSCORES"});
+  list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  is_range = list && list->length == 4 && strcmp(list->head->data->value.string, "b") == 0 && list->tail->data->value.double_value == 3;
+  print_detailed_test_result_bool("core_test_mapped_snapshot: ZRANGE reads the mapping in score order", is_range, true, is_range);
+  free_reply(reply);
+  reply = core_test_command(DB_ZRANGE, 3, (const char *[]){"mapped:list", "0", "-1"});
+  db_bool_t got;
+  got = dbobj_is_error(reply->data);
+  print_detailed_test_result_bool("core_test_mapped_snapshot: ZRANGE of a mapped list is of the wrong type", got, true, got);
+  free_reply(reply);
+  reply = core_test_command(DB_INFO_PERSISTENCE, 0, NULL);
+  mapped_keys = core_test_info_field(reply, "mapped_keys");
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_mapped_snapshot: reads leave the keys in the mapping", mapped_keys == 4, 4, mapped_keys);
+
+  // Any other command copies the key it names into the keyspace first
+  dbapi_rpush_n("mapped:list", "e", NULL);
+  db_uint_t length = dbapi_llen("mapped:list");
+  print_detailed_test_result_int("core_test_mapped_snapshot: a write sees the mapped value", length == 5, 5, length);
+  reply = core_test_command(DB_HGET, 2, (const char *[]){"mapped:hash", "field"});
+  got = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, "x") == 0;
+  print_detailed_test_result_bool("core_test_mapped_snapshot: HGET copies a mapped hash", got, true, got);
+  free_reply(reply);
+  dbapi_del("mapped:string");
+  value = dbapi_get("mapped:string");
+  print_detailed_test_result_str("core_test_mapped_snapshot: a deleted key no longer reads from the mapping", value == NULL, "(null)", value);
+  dbapi_free(value);
+  reply = core_test_command(DB_INFO_PERSISTENCE, 0, NULL);
+  mapped_keys = core_test_info_field(reply, "mapped_keys");
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_mapped_snapshot: only the zset is left in the mapping", mapped_keys == 1, 1, mapped_keys);
+
+  reply = core_test_command(DB_KEYS, 1, (const char *[]){"mapped:*"});
+  length = dbobj_is_list(reply->data) ? reply->data->value.list->length : 0;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_mapped_snapshot: KEYS sees every key", length == 4, 4, length);
+
+  // The save at shutdown holds the writes made over the mapping
+  dbapi_shutdown();
+  server_config_mapped_load(false);
+  dbapi_start_server();
+  length = dbapi_llen("mapped:list");
+  reply = core_test_command(DB_ZCARD, 1, (const char *[]){"mapped:zset"});
+  got = length == 5 && dbobj_is_uint(reply->data) && reply->data->value.uint_value == 3;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_mapped_snapshot: a save keeps mapped and copied keys", got, true, got);
+
+  dbapi_flushall();
+  dbapi_shutdown();
+  remove("test-mapped.db");
+  server_config_persistence_filepath(DEFAULT_SNAPSHOT_FILE);
+  dbapi_start_server();
+}
+
+static void core_test_worker_idle()
+{
+  // Requests a millisecond apart find the worker still polling
+  server_config_worker_idle(100000, false);
+  DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t hits_before = core_test_info_field(reply, "worker_busy_poll_hits");
+  free_reply(reply);
+  for (int i = 0; i < 10; ++i)
+  {
+    thrd_sleep(&(struct timespec){.tv_nsec = 1000000L}, NULL);
+    dbapi_set("idle:key", "value");
+  }
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t hits = core_test_info_field(reply, "worker_busy_poll_hits") - hits_before;
+  free_reply(reply);
+  server_config_worker_idle(0, false);
+  print_detailed_test_result_bool("core_test_worker_idle: busy polling takes requests a millisecond apart", hits >= 5, true, hits >= 5);
+
+  // Without polling, a request after a pause wakes a parked worker
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t wakeups_before = core_test_info_field(reply, "worker_wakeups");
+  hits_before = core_test_info_field(reply, "worker_busy_poll_hits");
+  free_reply(reply);
+  thrd_sleep(&(struct timespec){.tv_nsec = 5 * 1000000L}, NULL);
+  dbapi_set("idle:key", "value");
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t wakeups = core_test_info_field(reply, "worker_wakeups") - wakeups_before;
+  hits = core_test_info_field(reply, "worker_busy_poll_hits") - hits_before;
+  size_t parks = core_test_info_field(reply, "worker_parks");
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_worker_idle: a parked worker records its wake-up", wakeups >= 1 && parks >= 1, true, wakeups >= 1 && parks >= 1);
+  print_detailed_test_result_int("core_test_worker_idle: no polling without a window", hits == 0, 0, hits);
+
+  // Pinned workers serve requests as before
+  dbapi_shutdown();
+  server_config_worker_idle(0, true);
+  dbapi_start_server();
+  dbapi_set("idle:key", "pinned");
+  char *value = dbapi_get("idle:key");
+  print_detailed_test_result_str("core_test_worker_idle: pinned workers serve requests", value && strcmp(value, "pinned") == 0, "pinned", value);
+  dbapi_free(value);
+  dbapi_del("idle:key");
+  dbapi_shutdown();
+  server_config_worker_idle(0, false);
+  dbapi_start_server();
+}
+
+static void core_test_memory()
+{
+  char key[32];
+  DBHash *ht = ht_create();
+  for (int i = 0; i < 1000; ++i)
+  {
+    sprintf(key, "field:%d", i);
+    hset(ht, key, dbobj_create_string_with_dup(key), NULL);
+  }
+  for (int i = 0; i < 1000; i += 2)
+  {
+    sprintf(key, "field:%d", i);
+    hdel(ht, key, NULL);
+  }
+  size_t walked = core_test_walk_table_memory(ht);
+  print_detailed_test_result_int("core_test_memory: hash count matches a walk", (ht->memory == walked), walked, ht->memory);
+  ht_free(ht);
+
+  DBList *list = create_dblist();
+  size_t empty_list = list->memory;
+  for (int i = 0; i < 100; ++i)
+    rpush(list, create_dblistnode_with_string("element"));
+  while (list->length)
+    free_dblistnode(lpop(list));
+  print_detailed_test_result_int("core_test_memory: popped list returns to empty", (list->memory == empty_list), empty_list, list->memory);
+  free_dblist(list);
+
+  dbapi_flushall();
+  dbapi_set("memory_test:string", "value");
+  db_uint_t small = dbapi_memory_usage("memory_test:string");
+  print_detailed_test_result_bool("core_test_memory: string has a size", (small > 0), true, small > 0);
+  dbapi_rpush("memory_test:list", "a");
+  db_uint_t short_list = dbapi_memory_usage("memory_test:list");
+  for (int i = 0; i < 100; ++i)
+    dbapi_rpush("memory_test:list", "a string that takes some room");
+  db_uint_t long_list = dbapi_memory_usage("memory_test:list");
+  print_detailed_test_result_bool("core_test_memory: list grows with its elements", (long_list > short_list + 100 * 30), true, long_list > short_list + 100 * 30);
+  db_uint_t missing = dbapi_memory_usage("memory_test:missing");
+  print_detailed_test_result_int("core_test_memory: missing key", (missing == 0), 0, missing);
+
+  DBReply *reply = core_test_command(DB_INFO_DATASET_MEMORY, 0, NULL);
+  size_t strings = core_test_info_field(reply, "dataset_strings_keys");
+  size_t lists = core_test_info_field(reply, "dataset_lists_keys");
+  size_t list_bytes = core_test_info_field(reply, "dataset_lists_bytes");
+  size_t total = core_test_info_field(reply, "dataset_total_bytes");
+  print_detailed_test_result_int("core_test_memory: INFO counts the string", (strings == 1), 1, strings);
+  print_detailed_test_result_int("core_test_memory: INFO counts the list", (lists == 1), 1, lists);
+  print_detailed_test_result_bool("core_test_memory: INFO list bytes", (list_bytes > 100 * 30 && list_bytes < long_list), true, list_bytes > 100 * 30 && list_bytes < long_list);
+  print_detailed_test_result_bool("core_test_memory: INFO total covers the keys", (total >= long_list + small), true, total >= long_list + small);
+  free_reply(reply);
+
+  dbapi_flushall();
+}
+
+static void core_test_key_handle()
+{
+  DBRequest *request = create_request(DB_GET);
+  add_request_arg(request, dbobj_create_string_with_dup("handle:key"));
+  add_request_arg(request, dbobj_create_string_with_dup("handle:other"));
+  db_uint_t expected_hash = murmurhash2("handle:key", strlen("handle:key"));
+  print_detailed_test_result_str("core_test_key_handle: first argument is the key", (request->key.string && strcmp(request->key.string, "handle:key") == 0), "handle:key", request->key.string ? request->key.string : "(null)");
+  print_detailed_test_result_int("core_test_key_handle: key hash", (request->key.hash == expected_hash), expected_hash, request->key.hash);
+  print_detailed_test_result_int("core_test_key_handle: key length", (request->key.length == 10), 10, request->key.length);
+  reset_request(request, DB_GET);
+  print_detailed_test_result_bool("core_test_key_handle: reset clears the key", (request->key.string == NULL), true, request->key.string == NULL);
+  free_request(request);
+
+  char key[32];
+  DBKey handle;
+  int found = 0;
+  DBHash *ht = ht_create();
+  DBHash *expires = ht_create();
+  for (int i = 0; i < 5000; ++i)
+  {
+    sprintf(key, "handle:%d", i);
+    handle = ht_key(key);
+    hset_key(ht, &handle, dbobj_create_string_with_dup(key), expires);
+  }
+  // Lookups by string compute the same handle, and survive the rehashes above.
+  for (int i = 0; i < 5000; ++i)
+  {
+    sprintf(key, "handle:%d", i);
+    DBHashEntry *entry = hget(ht, key, expires);
+    found += entry && entry->hash == murmurhash2(key, strlen(key)) && strcmp(entry->data->value.string, key) == 0;
+  }
+  print_detailed_test_result_int("core_test_key_handle: every key found", (found == 5000), 5000, found);
+
+  ht_rename(ht, "handle:1", "handle:renamed", expires);
+  handle = ht_key("handle:renamed");
+  db_bool_t has_renamed = ht_has_key(ht, &handle, expires);
+  print_detailed_test_result_bool("core_test_key_handle: renamed key found", has_renamed, true, has_renamed);
+  handle = ht_key("handle:2");
+  ht_expire_key(ht, &handle, 1, expires);
+  db_bool_t has_expired = ht_has_key(ht, &handle, expires);
+  print_detailed_test_result_bool("core_test_key_handle: expired key is gone", !has_expired, false, has_expired);
+  ht_free(expires);
+  ht_free(ht);
+}
+
+static void core_test_embedded_expire()
+{
+  char key[32];
+  DBKey handle;
+  DBHash *ht = ht_create();
+  DBHash *expires = ht_create();
+  uint64_t deadline = ht_clock_ms() + 1000000;
+
+  hset(ht, "embedded:ttl", dbobj_create_string_with_dup("value"), expires);
+  hset(ht, "embedded:plain", dbobj_create_string_with_dup("value"), expires);
+  handle = ht_key("embedded:ttl");
+  db_bool_t is_set = ht_expire_key(ht, &handle, deadline, expires);
+  handle = ht_key("embedded:missing");
+  db_bool_t is_set_missing = ht_expire_key(ht, &handle, deadline, expires);
+  DBHashEntry *entry = hget(ht, "embedded:ttl", expires);
+  DBHashEntry *plain = hget(ht, "embedded:plain", expires);
+  print_detailed_test_result_bool("core_test_embedded_expire: expire an existing key", is_set, true, is_set);
+  print_detailed_test_result_bool("core_test_embedded_expire: expire a missing key", !is_set_missing, false, is_set_missing);
+  print_detailed_test_result_int("core_test_embedded_expire: deadline in the entry", (entry && entry->expire_at_ms == deadline), (long)deadline, entry ? (long)entry->expire_at_ms : 0);
+  print_detailed_test_result_int("core_test_embedded_expire: no deadline", (plain && plain->expire_at_ms == 0), 0, plain ? (long)plain->expire_at_ms : 1);
+
+  hdel(ht, "embedded:ttl", expires);
+  db_uint_t expires_count = expires->count0 + expires->count1;
+  print_detailed_test_result_int("core_test_embedded_expire: delete drops the deadline", (expires_count == 0), 0, expires_count);
+
+  for (int i = 0; i < 100; ++i)
+  {
+    sprintf(key, "embedded:%d", i);
+    handle = ht_key(key);
+    hset_key(ht, &handle, dbobj_create_string_with_dup(key), expires);
+    ht_expire_key(ht, &handle, ht_clock_ms() - 1, expires);
+  }
+  // Due keys come off the timer heap, without looking at the others.
+  db_uint_t expired = ht_expire_due(ht, expires, 1000);
+  print_detailed_test_result_int("core_test_embedded_expire: the timer heap reports the expired keys", (expired == 100), 100, expired);
+  db_uint_t count = ht->count0 + ht->count1;
+  expires_count = expires->count0 + expires->count1;
+  print_detailed_test_result_int("core_test_embedded_expire: expired keys are removed", (count == 1), 1, count);
+  print_detailed_test_result_int("core_test_embedded_expire: their deadlines too", (expires_count == 0), 0, expires_count);
+
+  ht_free(expires);
+  ht_free(ht);
+}
+
+static void core_test_timer_heap()
+{
+  char key[32];
+  DBKey handle;
+  DBHash *ht = ht_create();
+  DBHash *expires = ht_create();
+  uint64_t now = ht_clock_ms();
+
+  // Deadlines in a scrambled order, later moved into the past but for one key that is pushed
+  // back instead; 10 keys are deleted before they expire.
+  for (int i = 0; i < 200; ++i)
+  {
+    sprintf(key, "timer:%d", (i * 37) % 200);
+    handle = ht_key(key);
+    hset_key(ht, &handle, dbobj_create_string_with_dup(key), expires);
+    ht_expire_key(ht, &handle, now + 1000000 + (i * 37) % 200, expires);
+  }
+  for (int i = 0; i < 200; i += 20)
+  {
+    sprintf(key, "timer:%d", i);
+    hdel(ht, key, expires);
+  }
+  for (int i = 0; i < 200; ++i)
+  {
+    sprintf(key, "timer:%d", (i * 53) % 200);
+    handle = ht_key(key);
+    ht_expire_key(ht, &handle, (i * 53) % 200 == 199 ? now + 2000000 : now - 1000 + (i * 53) % 200, expires);
+  }
+
+  char next_key[32];
+  int in_order = 0, expected = 0, next;
+  for (int i = 0; i < 199; ++i)
+  {
+    if (i % 20 == 0)
+      continue;
+    ++expected;
+    next = (i + 1) % 20 == 0 ? i + 2 : i + 1;
+    sprintf(key, "timer:%d", i);
+    sprintf(next_key, "timer:%d", next);
+    ht_expire_due(ht, expires, 1);
+    // The soonest deadline goes first, so the next key only goes with the next call.
+    in_order += !ht_has(ht, key, NULL) && (next >= 199 || ht_has(ht, next_key, NULL));
+  }
+  print_detailed_test_result_int("core_test_timer_heap: keys expire soonest first", (in_order == expected), expected, in_order);
+  db_uint_t count = ht->count0 + ht->count1;
+  print_detailed_test_result_int("core_test_timer_heap: the key pushed back is left", (count == 1 && ht_has(ht, "timer:199", expires)), 1, count);
+  db_uint_t expired = ht_expire_due(ht, expires, 100);
+  print_detailed_test_result_int("core_test_timer_heap: nothing else is due", (expired == 0), 0, expired);
+
+  ht_free(expires);
+  ht_free(ht);
+}
+
+static void core_test_ht_scan_visit(DBHashEntry *entry, void *arg)
+{
+  int index;
+  if (sscanf(entry->key, "scan:%d", &index) == 1)
+    ++((int *)arg)[index];
+}
+
+// Keys present for the whole scan are all seen while the table grows and rehashes under it
+static void core_test_ht_scan()
+{
+  char key[32];
+  int seen[500] = {0};
+  DBHash *ht = ht_create();
+  for (int i = 0; i < 500; ++i)
+  {
+    sprintf(key, "scan:%d", i);
+    hset(ht, key, dbobj_create_string_with_dup(key), NULL);
+  }
+
+  db_uint_t cursor = 0, calls = 0, extra = 0;
+  db_bool_t rehashed_during_scan = false;
+  do
+  {
+    cursor = ht_scan(ht, cursor, core_test_ht_scan_visit, seen);
+    // growing for good, the table would outrun the scan
+    for (int i = 0; i < 8 && calls < 200; ++i, ++extra)
+    {
+      sprintf(key, "extra:%u", extra);
+      hset(ht, key, dbobj_create_string_with_dup(key), NULL);
+    }
+    rehashed_during_scan |= ht->rehashing_index != -1;
+    ++calls;
+  } while (cursor && calls < 100000);
+
+  int missing = 0;
+  for (int i = 0; i < 500; ++i)
+    missing += !seen[i];
+  print_detailed_test_result_bool("core_test_ht_scan: the table rehashed during the scan", rehashed_during_scan, true, rehashed_during_scan);
+  print_detailed_test_result_int("core_test_ht_scan: every key seen", missing == 0, 0, missing);
+  ht_free(ht);
+}
+
+static db_uint_t core_test_ht_filled_buckets(DBHash *ht)
+{
+  db_uint_t filled = 0;
+  for (db_int_t b = 0; b <= ht->rehashing_index; ++b)
+    filled += ht->buckets0[b] != NULL;
+  return filled;
+}
+
+// Each operation moves a few non-empty buckets, and a budgeted call finishes the rest
+static void core_test_ht_rehash()
+{
+  char key[32];
+  int count = 0;
+  DBHash *ht = ht_create();
+  while (ht->rehashing_index == -1 || ht->size0 < 4096)
+  {
+    sprintf(key, "rehash:%d", count++);
+    hset(ht, key, dbobj_create_string_with_dup(key), NULL);
+  }
+
+  db_uint_t filled_before = core_test_ht_filled_buckets(ht);
+  hget(ht, "rehash:0", NULL);
+  db_uint_t moved = filled_before - core_test_ht_filled_buckets(ht);
+  print_detailed_test_result_bool("core_test_ht_rehash: a lookup moves a few buckets", moved >= 1 && moved <= HT_REHASH_STEP_BUCKETS, true, moved >= 1 && moved <= HT_REHASH_STEP_BUCKETS);
+
+  db_bool_t is_rehashing = ht_rehash_for(ht, 1000000000);
+  print_detailed_test_result_bool("core_test_ht_rehash: a budgeted call finishes the rehash", !is_rehashing && ht->rehashing_index == -1, true, !is_rehashing && ht->rehashing_index == -1);
+  int found = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    sprintf(key, "rehash:%d", i);
+    found += hget(ht, key, NULL) != NULL;
+  }
+  print_detailed_test_result_int("core_test_ht_rehash: every key survives", found == count, count, found);
+  ht_free(ht);
+
+  // Idle workers finish what their tables started without any more commands.
+  dbapi_flushall();
+  for (int i = 0; i < 20000; ++i)
+  {
+    sprintf(key, "rehash_idle:%d", i);
+    dbapi_set(key, "value");
+  }
+  size_t rehashing = 1;
+  for (int i = 0; i < 50 && rehashing; ++i)
+  {
+    DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+    rehashing = core_test_info_field(reply, "rehashing_tables");
+    free_reply(reply);
+    if (rehashing)
+      thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  }
+  print_detailed_test_result_int("core_test_ht_rehash: idle workers finish rehashing", rehashing == 0, 0, rehashing);
+  dbapi_flushall();
+}
+
+static void core_test_ht_batch_lookup()
+{
+  char key[32], names[80][32];
+  DBKey keys[80];
+  DBHashEntry *entries[80];
+  DBHash *ht = ht_create(), *expires_ht = ht_create();
+  int count = 0;
+  // Both tables of a rehash hold keys.
+  while (ht->rehashing_index == -1 || ht->size0 < 1024)
+  {
+    sprintf(key, "batch:%d", count++);
+    hset(ht, key, dbobj_create_string_with_dup(key), expires_ht);
+  }
+
+  // Present keys, missing ones, a key past its deadline and no key at all, more than one batch of them.
+  for (int i = 0; i < 80; ++i)
+  {
+    sprintf(names[i], i % 3 ? "batch:%d" : "batch:missing:%d", i * 7);
+    keys[i] = ht_key(names[i]);
+  }
+  keys[79] = ht_key(NULL);
+  ht_expire_key(ht, &keys[1], 1, expires_ht);
+  db_uint_t found = hget_keys(ht, keys, 80, entries, expires_ht);
+
+  db_bool_t is_same = true;
+  db_uint_t expected = 0;
+  for (int i = 0; i < 79; ++i)
+  {
+    DBHashEntry *entry = hget(ht, names[i], expires_ht);
+    is_same = is_same && entries[i] == entry && (!entry || strcmp(entry->data->value.string, names[i]) == 0);
+    expected += entry != NULL;
+  }
+  is_same = is_same && !entries[1] && !entries[79] && found == expected;
+  print_detailed_test_result_bool("core_test_ht_batch_lookup: hget_keys finds what hget does", is_same, true, is_same);
+
+  ht_free(ht);
+  ht_free(expires_ht);
+}
+
+static void core_test_pages()
+{
+  pages_config_mode(DB_PAGES_TRANSPARENT);
+  size_t size = 3 * PAGES_MIN_SIZE;
+  char *large = (char *)pages_alloc(size), *small = (char *)pages_alloc(64);
+  db_bool_t is_zero = true;
+  for (size_t i = 0; i < size; i += 4096)
+    is_zero = is_zero && large[i] == 0 && large[size - 1] == 0;
+  large[size - 1] = 1;
+  size_t mapped = pages_alloc_size(large);
+  print_detailed_test_result_bool("core_test_pages: large blocks are zeroed", is_zero, true, is_zero);
+  print_detailed_test_result_bool("core_test_pages: large blocks are mapped in huge pages", mapped >= size && mapped % PAGES_HUGE_SIZE == 0, true, mapped >= size && mapped % PAGES_HUGE_SIZE == 0);
+  print_detailed_test_result_bool("core_test_pages: small blocks come from malloc", pages_alloc_size(small) < PAGES_MIN_SIZE, true, pages_alloc_size(small) < PAGES_MIN_SIZE);
+  pages_free(large);
+  pages_free(small);
+
+  // A table big enough to get mapped buckets works and counts them.
+  char key[32];
+  DBHash *ht = ht_create();
+  for (int i = 0; i < 200000; ++i)
+  {
+    sprintf(key, "pages:%d", i);
+    hset(ht, key, dbobj_shared_null(), NULL);
+  }
+  while (ht_rehash_for(ht, 1000000))
+    ;
+  sprintf(key, "pages:%d", 199999);
+  db_bool_t is_found = hget(ht, key, NULL) != NULL && pages_alloc_size(ht->buckets0) % PAGES_HUGE_SIZE == 0;
+  print_detailed_test_result_bool("core_test_pages: tables work on mapped buckets", is_found, true, is_found);
+  print_detailed_test_result_int("core_test_pages: mapped buckets are counted whole", ht->memory == core_test_walk_table_memory(ht), (long)core_test_walk_table_memory(ht), (long)ht->memory);
+  ht_free(ht);
+  pages_config_mode(DB_PAGES_DEFAULT);
+}
+
+// Large values and whole keyspaces go to the lazy free thread, small values are freed in place
+static void core_test_lazyfree()
+{
+  char score[16], member[32];
+  const char *argv[3] = {"lazyfree:zset", score, member};
+
+  dbapi_flushall();
+  for (int i = 0; i < 1000; ++i)
+  {
+    sprintf(score, "%d", i);
+    sprintf(member, "member:%d", i);
+    free_reply(core_test_command(DB_ZADD, 3, argv));
+  }
+  dbapi_set("lazyfree:small", "value");
+
+  db_uint_t freed_before = lazyfree_freed();
+  DBReply *reply = core_test_command(DB_UNLINK, 3, (const char *[]){"lazyfree:zset", "lazyfree:small", "lazyfree:missing"});
+  db_uint_t unlinked = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_lazyfree: UNLINK counts the keys it removed", unlinked == 2, 2, unlinked);
+  char *value = dbapi_get("lazyfree:small");
+  print_detailed_test_result_bool("core_test_lazyfree: unlinked keys are gone", value == NULL, true, value == NULL);
+  dbapi_free(value);
+  lazyfree_drain();
+  db_uint_t freed = lazyfree_freed() - freed_before;
+  print_detailed_test_result_int("core_test_lazyfree: only the large value is freed in the background", freed == 1, 1, freed);
+
+  for (int i = 0; i < 1000; ++i)
+  {
+    sprintf(member, "lazyfree:%d", i);
+    dbapi_set(member, "value");
+  }
+  reply = core_test_command(DB_FLUSHALL, 1, (const char *[]){"ASYNC"});
+  db_bool_t is_ok = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, OK) == 0;
+  free_reply(reply);
+  reply = core_test_command(DB_INFO_DATASET_MEMORY, 0, NULL);
+  size_t strings = core_test_info_field(reply, "dataset_strings_keys");
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_lazyfree: FLUSHALL ASYNC empties the keyspace at once", is_ok && strings == 0, 0, strings);
+  dbapi_set("lazyfree:after", "value");
+  value = dbapi_get("lazyfree:after");
+  is_ok = value && strcmp(value, "value") == 0;
+  dbapi_free(value);
+  print_detailed_test_result_bool("core_test_lazyfree: the flushed shards take new keys", is_ok, true, is_ok);
+  lazyfree_drain();
+  print_detailed_test_result_int("core_test_lazyfree: the detached tables are freed", lazyfree_pending() == 0, 0, lazyfree_pending());
+
+  reply = core_test_command(DB_FLUSHALL, 1, (const char *[]){"LATER"});
+  db_bool_t is_error = reply->data && reply->data->type == DB_TYPE_ERROR;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_lazyfree: FLUSHALL rejects other modes", is_error, true, is_error);
+  dbapi_flushall();
+}
+
+static void core_test_packed_hash()
+{
+  char field[16], long_value[HASH_PACKED_MAX_LENGTH + 2];
+  DBObj *hash = hashobj_create();
+
+  hashobj_set(hash, "a", "1");
+  hashobj_set(hash, "b", "2");
+  hashobj_set(hash, "a", "one");
+  hashobj_del(hash, "b");
+  const char *value = hashobj_get(hash, "a");
+  db_bool_t is_packed = hash->encoding == DB_ENCODING_HASH_PACKED;
+  print_detailed_test_result_bool("core_test_packed_hash: a small hash is packed", is_packed && hashobj_length(hash) == 1, true, is_packed);
+  print_detailed_test_result_str("core_test_packed_hash: packed fields are overwritten", value && strcmp(value, "one") == 0, "one", value);
+
+  memset(long_value, 'x', sizeof(long_value) - 1);
+  long_value[sizeof(long_value) - 1] = '\0';
+  hashobj_set(hash, "long", long_value);
+  is_packed = hash->encoding == DB_ENCODING_HASH_PACKED;
+  value = hashobj_get(hash, "a");
+  print_detailed_test_result_bool("core_test_packed_hash: a long value converts to a table", !is_packed && value && strcmp(value, "one") == 0, false, is_packed);
+  free_dbobj(hash);
+
+  hash = hashobj_create();
+  for (int i = 0; i <= HASH_PACKED_MAX_FIELDS; ++i)
+  {
+    sprintf(field, "f%d", i);
+    hashobj_set(hash, field, field);
+  }
+  is_packed = hash->encoding == DB_ENCODING_HASH_PACKED;
+  db_uint_t length = hashobj_length(hash);
+  print_detailed_test_result_bool("core_test_packed_hash: too many fields convert to a table", !is_packed && length == HASH_PACKED_MAX_FIELDS + 1, false, is_packed);
+  free_dbobj(hash);
+
+  free_reply(core_test_command(DB_HSET, 5, (const char *[]){"packed:hash", "a", "1", "b", "2"}));
+  DBReply *reply = core_test_command(DB_HMGET, 4, (const char *[]){"packed:hash", "b", "missing", "a"});
+  DBListNode *node = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL;
+  db_bool_t is_ok = node && strcmp(node->data->value.string, "2") == 0 && node->next->data->type == DB_TYPE_NULL &&
+                    strcmp(node->next->next->data->value.string, "1") == 0;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_packed_hash: HMGET replies null for missing fields", is_ok, true, is_ok);
+
+  reply = core_test_command(DB_HGETALL, 1, (const char *[]){"packed:hash"});
+  length = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->length : 0;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_packed_hash: HGETALL replies every field and value", length == 4, 4, length);
+
+  free_reply(core_test_command(DB_HINCRBY, 3, (const char *[]){"packed:hash", "a", "41"}));
+  reply = core_test_command(DB_HINCRBY, 3, (const char *[]){"packed:hash", "new", "-5"});
+  db_int_t number = dbobj_is_int(reply->data) ? reply->data->value.int_value : 0;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_packed_hash: HINCRBY starts a missing field at 0", number == -5, -5, number);
+  reply = core_test_command(DB_HGET, 2, (const char *[]){"packed:hash", "a"});
+  const char *string = reply->data && dbobj_is_string(reply->data) ? reply->data->value.string : "";
+  print_detailed_test_result_str("core_test_packed_hash: HINCRBY stores the sum", strcmp(string, "42") == 0, "42", string);
+  free_reply(reply);
+  reply = core_test_command(DB_HINCRBY, 3, (const char *[]){"packed:hash", "a", "x"});
+  db_bool_t is_error = reply->data && reply->data->type == DB_TYPE_ERROR;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_packed_hash: HINCRBY rejects a non-integer increment", is_error, true, is_error);
+
+  reply = core_test_command(DB_HSCAN, 2, (const char *[]){"packed:hash", "0"});
+  length = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->length - 1 : 0;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_packed_hash: HSCAN of a packed hash replies every field", length == 6, 6, length);
+  dbapi_del("packed:hash");
+}
+
+static void core_test_multi_key()
+{
+  char key[32];
+  dbapi_mset("multi:a", "1", "multi:b", "2", NULL);
+  dbapi_lpush("multi:list", "x");
+
+  DBList *values = dbapi_mget("multi:a", "multi:missing", "multi:list", "multi:b", NULL);
+  DBListNode *node = values ? values->head : NULL;
+  db_bool_t is_ok = values && values->length == 4 && strcmp(node->data->value.string, "1") == 0 &&
+                    node->next->data->type == DB_TYPE_NULL && node->next->next->data->type == DB_TYPE_NULL &&
+                    strcmp(node->next->next->next->data->value.string, "2") == 0;
+  print_detailed_test_result_bool("core_test_multi_key: MGET replies every key in order", is_ok, true, is_ok);
+  dbapi_free_list(values);
+
+  DBReply *reply = core_test_command(DB_MSETNX, 4, (const char *[]){"multi:c", "3", "multi:a", "x"});
+  db_int_t set = dbobj_is_int(reply->data) ? reply->data->value.int_value : -1;
+  free_reply(reply);
+  char *value = dbapi_get("multi:c");
+  print_detailed_test_result_bool("core_test_multi_key: MSETNX sets nothing if a key exists", set == 0 && value == NULL, true, set == 0);
+  dbapi_free(value);
+  reply = core_test_command(DB_MSETNX, 4, (const char *[]){"multi:c", "3", "multi:d", "4"});
+  set = dbobj_is_int(reply->data) ? reply->data->value.int_value : -1;
+  free_reply(reply);
+  value = dbapi_get("multi:d");
+  is_ok = set == 1 && value && strcmp(value, "4") == 0;
+  print_detailed_test_result_bool("core_test_multi_key: MSETNX sets every pair if no key exists", is_ok, true, is_ok);
+  dbapi_free(value);
+
+  reply = core_test_command(DB_MSET, 3, (const char *[]){"multi:a", "1", "multi:b"});
+  db_bool_t is_error = reply->data && reply->data->type == DB_TYPE_ERROR;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_multi_key: MSET rejects a key without a value", is_error, true, is_error);
+
+  for (int i = 0; i < 5; ++i)
+  {
+    sprintf(key, "%d", i);
+    dbapi_rpush("multi:pop", key);
+  }
+  values = dbapi_lpop_n("multi:pop", 3);
+  db_uint_t length = values ? values->length : 0;
+  is_ok = length == 3 && strcmp(values->head->data->value.string, "0") == 0;
+  print_detailed_test_result_int("core_test_multi_key: LPOP with a count pops that many", is_ok, 3, length);
+  dbapi_free_list(values);
+  values = dbapi_rpop_n("multi:pop", 10);
+  length = values ? values->length : 0;
+  is_ok = length == 2 && strcmp(values->head->data->value.string, "4") == 0;
+  print_detailed_test_result_int("core_test_multi_key: RPOP with a count stops at the end", is_ok, 2, length);
+  dbapi_free_list(values);
+
+  dbapi_del("multi:a");
+  dbapi_del("multi:b");
+  dbapi_del("multi:c");
+  dbapi_del("multi:d");
+  dbapi_del("multi:list");
+  dbapi_del("multi:pop");
+}
+
+// Waits until BLPOP is parked on the key, then pushes to it and reports how many clients were blocked
+static int core_test_blocking_producer(void *arg)
+{
+  size_t blocked = 0;
+  for (int i = 0; i < 100 && !blocked; ++i)
+  {
+    thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+    DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+    blocked = core_test_info_field(reply, "blocked_clients");
+    free_reply(reply);
+  }
+  dbapi_rpush((const char *)arg, "pushed");
+  return (int)blocked;
+}
+
+static void core_test_blocking()
+{
+  dbapi_rpush("blocking:list", "a");
+  char *value = dbapi_blpop("blocking:list", 0);
+  db_bool_t is_ok = value && strcmp(value, "a") == 0;
+  print_detailed_test_result_str("core_test_blocking: BLPOP pops at once from a non-empty list", is_ok, "a", value);
+  dbapi_free(value);
+
+  thrd_t producer;
+  int blocked = 0;
+  thrd_create(&producer, core_test_blocking_producer, "blocking:wait");
+  value = dbapi_blpop("blocking:wait", 0);
+  thrd_join(producer, &blocked);
+  is_ok = value && strcmp(value, "pushed") == 0;
+  print_detailed_test_result_str("core_test_blocking: BLPOP is answered by a later push", is_ok, "pushed", value);
+  print_detailed_test_result_int("core_test_blocking: INFO counts the blocked client", blocked == 1, 1, blocked);
+  dbapi_free(value);
+
+  uint64_t started_at = latency_now_ns();
+  value = dbapi_brpop("blocking:none", 0.1);
+  uint64_t waited_ms = (latency_now_ns() - started_at) / 1000000;
+  is_ok = value == NULL && waited_ms >= 100;
+  print_detailed_test_result_int("core_test_blocking: BRPOP times out with a null", is_ok, 100, (int)waited_ms);
+  dbapi_free(value);
+
+  dbapi_rpush("blocking:multi", "x");
+  dbapi_rpush("blocking:multi", "y");
+  DBReply *reply = core_test_command(DB_BRPOP, 3, (const char *[]){"blocking:empty", "blocking:multi", "0"});
+  DBList *pair = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  is_ok = pair && pair->length == 2 && strcmp(pair->head->data->value.string, "blocking:multi") == 0 &&
+          strcmp(pair->tail->data->value.string, "y") == 0;
+  print_detailed_test_result_bool("core_test_blocking: BRPOP pops the first non-empty key", is_ok, true, is_ok);
+  free_reply(reply);
+
+  reply = core_test_command(DB_BLPOP, 2, (const char *[]){"blocking:multi", "-1"});
+  db_bool_t is_error = reply->data && reply->data->type == DB_TYPE_ERROR;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_blocking: a negative timeout is an error", is_error, true, is_error);
+
+  dbapi_del("blocking:list");
+  dbapi_del("blocking:wait");
+  dbapi_del("blocking:multi");
+}
+
+static void core_test_scan()
+{
+  char key[32], field[16];
+  dbapi_flushall();
+  for (int i = 0; i < 300; ++i)
+  {
+    sprintf(key, "scan:%s:%d", i % 3 ? "other" : "match", i);
+    dbapi_set(key, "value");
+  }
+
+  // MATCH filters what a cursor yields, it doesn't stop the walk
+  int found = 0, calls = 0;
+  char cursor[24] = "0";
+  DBReply *reply;
+  do
+  {
+    reply = core_test_command(DB_SCAN, 5, (const char *[]){cursor, "MATCH", "scan:match:*", "COUNT", "7"});
+    DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+    if (!list)
+      break;
+    strcpy(cursor, list->head->data->value.string);
+    for (DBListNode *node = list->head->next; node; node = node->next)
+      found += strncmp(node->data->value.string, "scan:match:", 11) == 0 ? 1 : 1000;
+    free_reply(reply);
+    ++calls;
+  } while (strcmp(cursor, "0") != 0 && calls < 10000);
+  print_detailed_test_result_int("core_test_scan: SCAN MATCH sees each matching key", found == 100, 100, found);
+  print_detailed_test_result_bool("core_test_scan: SCAN takes several calls", calls > 1, true, calls > 1);
+
+  reply = core_test_command(DB_SCAN, 2, (const char *[]){"0", "BOGUS"});
+  db_bool_t is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_SYNTAX_ERROR) == 0;
+  print_detailed_test_result_bool("core_test_scan: unknown option", is_error, true, is_error);
+  free_reply(reply);
+
+  for (int i = 0; i < 200; ++i)
+  {
+    sprintf(field, "f%d", i);
+    free_reply(core_test_command(DB_HSET, 3, (const char *[]){"scan:hash", field, "v"}));
+  }
+  found = 0;
+  strcpy(cursor, "0");
+  do
+  {
+    reply = core_test_command(DB_HSCAN, 2, (const char *[]){"scan:hash", cursor});
+    DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+    if (!list)
+      break;
+    strcpy(cursor, list->head->data->value.string);
+    found += (list->length - 1) / 2;
+    free_reply(reply);
+  } while (strcmp(cursor, "0") != 0);
+  print_detailed_test_result_int("core_test_scan: HSCAN sees every field", found == 200, 200, found);
+
+  free_reply(core_test_command(DB_ZADD, 5, (const char *[]){"scan:zset", "1", "a", "2", "b"}));
+  reply = core_test_command(DB_ZSCAN, 4, (const char *[]){"scan:zset", "0", "MATCH", "b"});
+  DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t correct = list && list->length == 3 && strcmp(list->head->data->value.string, "0") == 0 &&
+                      strcmp(list->head->next->data->value.string, "b") == 0 &&
+                      dbobj_is_double(list->tail->data) && list->tail->data->value.double_value == 2;
+  print_detailed_test_result_bool("core_test_scan: ZSCAN of a packed set", correct, true, correct);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZSCAN, 2, (const char *[]){"scan:hash", "0"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_WRONGTYPE) == 0;
+  print_detailed_test_result_bool("core_test_scan: ZSCAN of a hash", is_error, true, is_error);
+  free_reply(reply);
+}
+
+static void radix_test_collect(const char *key, db_uint_t length, void *arg)
+{
+  DBList *keys = (DBList *)arg;
+  rpush(keys, create_dblistnode_with_string((char *)key));
+}
+
+static void radix_test_tree()
+{
+  const char *words[] = {"tenant:1:a", "tenant:1:b", "tenant:10:a", "tenant:2", "tenant", "other", "tenant:1"};
+  DBRadixTree *tree = radix_create();
+  size_t empty_memory = tree->memory;
+  for (int i = 0; i < 7; ++i)
+    radix_insert(tree, words[i], strlen(words[i]));
+  db_bool_t again = radix_insert(tree, "tenant:2", 8);
+  print_detailed_test_result_bool("radix_test_tree: a key goes in once", !again && tree->count == 7, true, !again && tree->count == 7);
+
+  DBList *keys = create_dblist();
+  radix_walk_prefix(tree, "tenant:1", 8, radix_test_collect, keys);
+  const char *expected[] = {"tenant:1", "tenant:10:a", "tenant:1:a", "tenant:1:b"};
+  db_bool_t correct = keys->length == 4;
+  DBListNode *node = keys->head;
+  for (int i = 0; correct && i < 4; ++i, node = node->next)
+    correct = strcmp(node->data->value.string, expected[i]) == 0;
+  print_detailed_test_result_bool("radix_test_tree: prefix walk in byte order", correct, true, correct);
+  free_dblist(keys);
+
+  // a prefix ending inside a label, and one nothing starts with
+  keys = create_dblist();
+  radix_walk_prefix(tree, "ten", 3, radix_test_collect, keys);
+  radix_walk_prefix(tree, "tenants", 7, radix_test_collect, keys);
+  print_detailed_test_result_int("radix_test_tree: prefix inside a label", keys->length == 6, 6, keys->length);
+  free_dblist(keys);
+
+  radix_remove(tree, "tenant:1", 8);
+  db_bool_t missing = radix_remove(tree, "tenant:3", 8);
+  keys = create_dblist();
+  radix_walk_prefix(tree, "", 0, radix_test_collect, keys);
+  print_detailed_test_result_bool("radix_test_tree: removed keys are gone", !missing && keys->length == 6 && tree->count == 6, true, !missing && keys->length == 6);
+  free_dblist(keys);
+
+  for (int i = 0; i < 7; ++i)
+    radix_remove(tree, words[i], strlen(words[i]));
+  print_detailed_test_result_int("radix_test_tree: emptied tree holds no nodes", tree->memory == empty_memory, empty_memory, tree->memory);
+  radix_free(tree);
+}
+
+static void core_test_key_index()
+{
+  char key[32];
+  dbapi_shutdown();
+  server_config_key_index(true);
+  dbapi_start_server();
+  dbapi_flushall();
+
+  for (int i = 0; i < 300; ++i)
+  {
+    sprintf(key, "tenant:%d:%d", i % 3, i);
+    dbapi_set(key, "value");
+  }
+  dbapi_rename("tenant:1:1", "tenant:2:moved");
+  dbapi_del("tenant:1:4");
+  free_reply(core_test_command(DB_PEXPIRE, 2, (const char *[]){"tenant:1:7", "1"}));
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 5 * 1000000L};
+  thrd_sleep(&pause, NULL);
+
+  DBReply *reply = core_test_command(DB_KEYS, 1, (const char *[]){"tenant:1:*"});
+  long count = dbobj_is_list(reply->data) ? reply->data->value.list->length : -1;
+  print_detailed_test_result_int("core_test_key_index: KEYS by prefix after RENAME, DEL and expiry", count == 97, 97, count);
+  free_reply(reply);
+
+  reply = core_test_command(DB_KEYS, 1, (const char *[]){"tenant:2:m?ved"});
+  count = dbobj_is_list(reply->data) ? reply->data->value.list->length : -1;
+  print_detailed_test_result_int("core_test_key_index: the rest of the pattern still applies", count == 1, 1, count);
+  free_reply(reply);
+
+  reply = core_test_command(DB_KEYS, 1, (const char *[]){"*:0:*"});
+  count = dbobj_is_list(reply->data) ? reply->data->value.list->length : -1;
+  print_detailed_test_result_int("core_test_key_index: patterns without a prefix walk the table", count == 100, 100, count);
+  free_reply(reply);
+
+  dbapi_flushall();
+  reply = core_test_command(DB_KEYS, 1, (const char *[]){"tenant:*"});
+  count = dbobj_is_list(reply->data) ? reply->data->value.list->length : -1;
+  print_detailed_test_result_int("core_test_key_index: FLUSHALL empties the index", count == 0, 0, count);
+  free_reply(reply);
+
+  dbapi_shutdown();
+  server_config_key_index(false);
+  dbapi_start_server();
+}
+
+static void core_test_shared_reply()
+{
+  char value[256];
+  memset(value, 'v', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+  dbapi_set("shared_reply:key", value);
+
+  DBReply *reply = core_test_command(DB_GET, 1, (const char *[]){"shared_reply:key"});
+  db_bool_t is_shared = dbobj_is_string(reply->data) && dbobj_is_shared(reply->data);
+  print_detailed_test_result_bool("core_test_shared_reply: GET shares the stored string", is_shared, true, is_shared);
+
+  // The reply keeps the old value alive through an overwrite and a delete
+  dbapi_set("shared_reply:key", "other");
+  dbapi_del("shared_reply:key");
+  is_shared = dbobj_is_shared(reply->data);
+  print_detailed_test_result_bool("core_test_shared_reply: the reply is the last holder", !is_shared, false, is_shared);
+  db_bool_t is_same = strcmp(reply->data->value.string, value) == 0;
+  print_detailed_test_result_bool("core_test_shared_reply: the reply still reads the old value", is_same, true, is_same);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_HSET, 3, (const char *[]){"shared_reply:hash", "field", value}));
+  reply = core_test_command(DB_HGET, 2, (const char *[]){"shared_reply:hash", "field"});
+  is_shared = dbobj_is_string(reply->data) && dbobj_is_shared(reply->data);
+  print_detailed_test_result_bool("core_test_shared_reply: HGET shares the stored string", is_shared, true, is_shared);
+  free_reply(reply);
+
+  // A copy comes out of a shared reply, and the stored value stays intact
+  char *copy = dbapi_get("shared_reply:missing");
+  print_detailed_test_result_bool("core_test_shared_reply: GET of a missing key", copy == NULL, true, copy == NULL);
+  dbapi_set("shared_reply:key", value);
+  copy = dbapi_get("shared_reply:key");
+  char *again = dbapi_get("shared_reply:key");
+  is_same = copy && again && copy != again && strcmp(copy, value) == 0 && strcmp(again, value) == 0;
+  print_detailed_test_result_bool("core_test_shared_reply: dbapi_get copies a shared string out", is_same, true, is_same);
+  dbapi_free(copy);
+  dbapi_free(again);
+  dbapi_del("shared_reply:key");
+  dbapi_del("shared_reply:hash");
+}
+
+static void core_test_shared_integers()
+{
+  dbapi_set("shared_integers:small", "42");
+  dbapi_set("shared_integers:large", "10000");
+  dbapi_set("shared_integers:padded", "042");
+
+  DBReply *reply = core_test_command(DB_GET, 1, (const char *[]){"shared_integers:small"});
+  db_bool_t is_shared = reply->data == dbobj_shared_integer(42);
+  print_detailed_test_result_bool("core_test_shared_integers: a small integer is stored as the shared one", is_shared, true, is_shared);
+  free_reply(reply);
+  reply = core_test_command(DB_GET, 1, (const char *[]){"shared_integers:large"});
+  is_shared = dbobj_shared_integer(10000) != NULL || atomic_load(&reply->data->refcount) == DBOBJ_REFCOUNT_IMMORTAL;
+  print_detailed_test_result_bool("core_test_shared_integers: integers past the range get objects of their own", !is_shared, false, is_shared);
+  free_reply(reply);
+  char *padded = dbapi_get("shared_integers:padded");
+  db_bool_t is_same = padded && strcmp(padded, "042") == 0;
+  print_detailed_test_result_bool("core_test_shared_integers: non-canonical digits keep their form", is_same, true, is_same);
+  dbapi_free(padded);
+
+  // Freed by every reply that held them, and still intact
+  for (int i = 0; i < 3; ++i)
+    free_reply(core_test_command(DB_SET, 2, (const char *[]){"shared_integers:small", "7"}));
+  reply = core_test_command(DB_SET, 2, (const char *[]){"shared_integers:small", "7"});
+  db_bool_t is_ok = reply->data == dbobj_shared_ok() && strcmp(dbobj_shared_ok()->value.string, OK) == 0;
+  print_detailed_test_result_bool("core_test_shared_integers: OK is one object for every reply", is_ok, true, is_ok);
+  free_reply(reply);
+  int64_t number = -1;
+  db_bool_t is_intact = dbobj_string_as_int64(dbobj_shared_integer(7), &number) && number == 7 && strcmp(dbobj_shared_integer(7)->value.string, "7") == 0;
+  print_detailed_test_result_bool("core_test_shared_integers: shared objects survive free_dbobj", is_intact, true, is_intact);
+
+  DBObj *loaded = dbobj_try_share_integer(dbobj_create_string_with_dup("9999"));
+  is_shared = loaded == dbobj_shared_integer(9999);
+  print_detailed_test_result_bool("core_test_shared_integers: a loaded integer is swapped for the shared one", is_shared, true, is_shared);
+  free_dbobj(loaded);
+
+  dbapi_del("shared_integers:small");
+  dbapi_del("shared_integers:large");
+  dbapi_del("shared_integers:padded");
+}
+
+static void core_test_incr()
+{
+  dbapi_del("incr:counter");
+  dbapi_set("incr:word", "abc");
+  dbapi_lpush("incr:list", "a");
+
+  DBReply *reply = core_test_command(DB_INCR, 1, (const char *[]){"incr:counter"});
+  db_bool_t is_one = reply->data && reply->data->value.int_value == 1;
+  print_detailed_test_result_bool("core_test_incr: a missing key counts from 0", is_one, true, is_one);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_INCRBY, 2, (const char *[]){"incr:counter", "99999"}));
+  reply = core_test_command(DB_GET, 1, (const char *[]){"incr:counter"});
+  DBObj *stored = reply->data;
+  free_reply(reply);
+  free_reply(core_test_command(DB_INCR, 1, (const char *[]){"incr:counter"}));
+  reply = core_test_command(DB_GET, 1, (const char *[]){"incr:counter"});
+  db_bool_t is_in_place = reply->data == stored && strcmp(reply->data->value.string, "100001") == 0;
+  print_detailed_test_result_bool("core_test_incr: a large counter is rewritten in place", is_in_place, true, is_in_place);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_DECRBY, 2, (const char *[]){"incr:counter", "100000"}));
+  free_reply(core_test_command(DB_DECR, 1, (const char *[]){"incr:counter"}));
+  reply = core_test_command(DB_GET, 1, (const char *[]){"incr:counter"});
+  db_bool_t is_zero = reply->data && strcmp(reply->data->value.string, "0") == 0;
+  print_detailed_test_result_bool("core_test_incr: DECR and DECRBY count down", is_zero, true, is_zero);
+  free_reply(reply);
+
+  reply = core_test_command(DB_INCRBY, 2, (const char *[]){"incr:counter", "2147483648"});
+  db_bool_t is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_INCR_OVERFLOW) == 0;
+  print_detailed_test_result_bool("core_test_incr: overflow is an error", is_error, true, is_error);
+  free_reply(reply);
+  reply = core_test_command(DB_INCR, 1, (const char *[]){"incr:word"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_NOT_INTEGER) == 0;
+  print_detailed_test_result_bool("core_test_incr: a non-integer value is an error", is_error, true, is_error);
+  free_reply(reply);
+  reply = core_test_command(DB_INCR, 1, (const char *[]){"incr:list"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_WRONGTYPE) == 0;
+  print_detailed_test_result_bool("core_test_incr: a list is the wrong type", is_error, true, is_error);
+  free_reply(reply);
+
+  dbapi_set("incr:float", "10.5");
+  reply = core_test_command(DB_INCRBYFLOAT, 2, (const char *[]){"incr:float", "0.1"});
+  db_bool_t is_same = reply->data && strcmp(reply->data->value.string, "10.6") == 0;
+  print_detailed_test_result_bool("core_test_incr: INCRBYFLOAT replies with the shortest form", is_same, true, is_same);
+  free_reply(reply);
+  reply = core_test_command(DB_INCRBYFLOAT, 2, (const char *[]){"incr:float", "1e308x"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_NOT_FLOAT) == 0;
+  print_detailed_test_result_bool("core_test_incr: INCRBYFLOAT rejects what isn't a number", is_error, true, is_error);
+  free_reply(reply);
+  free_reply(core_test_command(DB_SET, 2, (const char *[]){"incr:float", "1.7e308"}));
+  reply = core_test_command(DB_INCRBYFLOAT, 2, (const char *[]){"incr:float", "1.7e308"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_INCR_NOT_FINITE) == 0;
+  print_detailed_test_result_bool("core_test_incr: INCRBYFLOAT never stores Infinity", is_error, true, is_error);
+  free_reply(reply);
+
+  dbapi_del("incr:counter");
+  dbapi_del("incr:word");
+  dbapi_del("incr:list");
+  dbapi_del("incr:float");
+}
+
+// A string of `length` bytes cycling through the alphabet, which the caller frees
+static char *core_test_alphabet(size_t length)
+{
+  char *string = malloc(length + 1);
+  for (size_t i = 0; i < length; ++i)
+    string[i] = (char)('a' + i % 26);
+  string[length] = '\0';
+  return string;
+}
+
+static void core_test_rope()
+{
+  size_t length = 200 * 1000;
+  char *value = core_test_alphabet(length);
+  dbapi_set("rope:value", value);
+
+  DBReply *reply = core_test_command(DB_STRLEN, 1, (const char *[]){"rope:value"});
+  db_uint_t strlen_reply = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_rope: STRLEN of a large string", strlen_reply == length, (int)length, strlen_reply);
+  free_reply(reply);
+
+  reply = core_test_command(DB_GET, 1, (const char *[]){"rope:value"});
+  DBObj *held = dbobj_share(reply->data);
+  db_bool_t is_rope = held->encoding == DB_ENCODING_ROPE && held->value.rope->length == (length + ROPE_CHUNK_SIZE - 1) / ROPE_CHUNK_SIZE;
+  print_detailed_test_result_bool("core_test_rope: a large string is stored in chunks", is_rope, true, is_rope);
+  free_reply(reply);
+
+  // Across the boundary of the first two chunks
+  char start[16], end[16];
+  sprintf(start, "%d", ROPE_CHUNK_SIZE - 3);
+  sprintf(end, "%d", ROPE_CHUNK_SIZE + 2);
+  reply = core_test_command(DB_GETRANGE, 3, (const char *[]){"rope:value", start, end});
+  db_bool_t is_same = dbobj_is_string(reply->data) && strlen(reply->data->value.string) == 6 &&
+                      strncmp(reply->data->value.string, value + ROPE_CHUNK_SIZE - 3, 6) == 0;
+  print_detailed_test_result_bool("core_test_rope: GETRANGE across chunks", is_same, true, is_same);
+  free_reply(reply);
+
+  reply = core_test_command(DB_GETRANGE, 3, (const char *[]){"rope:value", "-3", "-1"});
+  is_same = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, value + length - 3) == 0;
+  print_detailed_test_result_bool("core_test_rope: GETRANGE counts negative indexes from the end", is_same, true, is_same);
+  free_reply(reply);
+
+  reply = core_test_command(DB_GETRANGE, 3, (const char *[]){"rope:value", "0", "-1"});
+  is_same = dbobj_is_string(reply->data) && reply->data->encoding == DB_ENCODING_ROPE && reply->data->value.rope->size == length;
+  print_detailed_test_result_bool("core_test_rope: a long GETRANGE shares the chunks", is_same, true, is_same);
+  free_reply(reply);
+
+  // The value GET replied with stays as it was through the writes.
+  reply = core_test_command(DB_APPEND, 2, (const char *[]){"rope:value", "XYZ"});
+  db_uint_t new_length = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_rope: APPEND replies with the new length", new_length == length + 3, (int)length + 3, new_length);
+  free_reply(reply);
+  free_reply(core_test_command(DB_SETRANGE, 3, (const char *[]){"rope:value", "0", "ABC"}));
+  char *held_string = dbobj_extract_string(held);
+  is_same = held_string && strcmp(held_string, value) == 0;
+  print_detailed_test_result_bool("core_test_rope: a held reply is not changed by writes", is_same, true, is_same);
+  free(held_string);
+
+  char *stored = dbapi_get("rope:value");
+  is_same = stored && strlen(stored) == length + 3 && strncmp(stored, "ABC", 3) == 0 && strcmp(stored + length, "XYZ") == 0 &&
+            strncmp(stored + 3, value + 3, length - 3) == 0;
+  print_detailed_test_result_bool("core_test_rope: APPEND and SETRANGE write through", is_same, true, is_same);
+  free(stored);
+
+  // A short string grows into a rope, and SETRANGE past the end fills the gap with zero bytes.
+  dbapi_del("rope:grown");
+  for (int i = 0; i < 20; ++i)
+    free_reply(core_test_command(DB_APPEND, 2, (const char *[]){"rope:grown", value}));
+  sprintf(start, "%zu", length * 20 + 10);
+  reply = core_test_command(DB_SETRANGE, 3, (const char *[]){"rope:grown", start, "end"});
+  new_length = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_rope: SETRANGE past the end", new_length == length * 20 + 13, (int)(length * 20 + 13), new_length);
+  free_reply(reply);
+  // The last appended byte, then the gap
+  reply = core_test_command(DB_GETRANGE, 3, (const char *[]){"rope:grown", "-14", "-1"});
+  is_same = dbobj_is_string(reply->data) && reply->data->value.string[0] == value[length - 1] && reply->data->value.string[1] == '\0';
+  print_detailed_test_result_bool("core_test_rope: the gap reads as zero bytes", is_same, true, is_same);
+  free_reply(reply);
+  reply = core_test_command(DB_GETRANGE, 3, (const char *[]){"rope:grown", "-3", "-1"});
+  is_same = dbobj_is_string(reply->data) && strcmp(reply->data->value.string, "end") == 0;
+  print_detailed_test_result_bool("core_test_rope: SETRANGE writes after the gap", is_same, true, is_same);
+  free_reply(reply);
+
+  dbapi_set("rope:short", "hello");
+  reply = core_test_command(DB_SETRANGE, 3, (const char *[]){"rope:short", "1", "ipp"});
+  free_reply(reply);
+  reply = core_test_command(DB_APPEND, 2, (const char *[]){"rope:short", "!"});
+  free_reply(reply);
+  stored = dbapi_get("rope:short");
+  is_same = stored && strcmp(stored, "hippo!") == 0;
+  print_detailed_test_result_str("core_test_rope: short strings stay plain", is_same, "hippo!", stored);
+  free(stored);
+
+  dbapi_lpush("rope:list", "a");
+  reply = core_test_command(DB_APPEND, 2, (const char *[]){"rope:list", "b"});
+  db_bool_t is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_WRONGTYPE) == 0;
+  print_detailed_test_result_bool("core_test_rope: a list is the wrong type", is_error, true, is_error);
+  free_reply(reply);
+  reply = core_test_command(DB_INCR, 1, (const char *[]){"rope:value"});
+  is_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_NOT_INTEGER) == 0;
+  print_detailed_test_result_bool("core_test_rope: a rope is not an integer", is_error, true, is_error);
+  free_reply(reply);
+
+  free(value);
+  dbapi_del("rope:value");
+  dbapi_del("rope:grown");
+  dbapi_del("rope:short");
+  dbapi_del("rope:list");
+}
+
+static void core_test_reply_arena()
+{
+  char member[96];
+  for (int i = 0; i < 200; ++i)
+  {
+    sprintf(member, "reply_arena:member:%03d:padded-past-the-embedded-limit-of-objects", i);
+    free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"reply_arena:zset", i % 2 ? "1.5" : "2.5", member}));
+  }
+
+  DBReply *reply = core_test_command(DB_ZRANGE, 4, (const char *[]){"reply_arena:zset", "0", "-1", "WITHSCORES"});
+  DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t in_arena = reply->arena && dbobj_is_in_arena(reply->data) && list && list->head && dbobj_is_in_arena(list->head->data);
+  print_detailed_test_result_bool("core_test_reply_arena: ZRANGE WITHSCORES is allocated from its reply", in_arena, true, in_arena);
+  db_bool_t is_ordered = list && list->length == 400 && strcmp(list->head->data->value.string, "reply_arena:member:001:padded-past-the-embedded-limit-of-objects") == 0 &&
+                         dbobj_is_double(list->head->next->data) && list->head->next->data->value.double_value == 1.5;
+  print_detailed_test_result_bool("core_test_reply_arena: members and scores read as before", is_ordered, true, is_ordered);
+
+  // Copied out, the list outlives the reply
+  DBList *copy = dbobj_extract_list(reply->data);
+  reply->data = NULL;
+  free_reply(reply);
+  db_bool_t is_copied = copy && copy->length == 400 && !dbobj_is_in_arena(copy->tail->data) && copy->tail->data->value.double_value == 2.5;
+  print_detailed_test_result_bool("core_test_reply_arena: an extracted list is copied out of the arena", is_copied, true, is_copied);
+  free_dblist(copy);
+
+  DBArena *arena = arena_create();
+  for (int i = 0; i < 1000; ++i)
+    arena_alloc(arena, 24);
+  void *large = arena_alloc(arena, ARENA_CHUNK_MAX_SIZE * 2);
+  db_bool_t is_aligned = ((uintptr_t)large % ARENA_ALIGNMENT) == 0 && arena->memory >= ARENA_CHUNK_MAX_SIZE * 2;
+  print_detailed_test_result_bool("core_test_reply_arena: blocks larger than a chunk get their own", is_aligned, true, is_aligned);
+  arena_free(arena);
+
+  dbapi_del("reply_arena:zset");
+}
+
+// Fills a list with "<prefix><i>" for i from 0 up to `length`, a thousand per push
+static void core_test_fill_list(const char *key, const char *prefix, int length)
+{
+  char element[32];
+  for (int i = 0; i < length;)
+  {
+    DBRequest *request = create_request(DB_RPUSH);
+    add_request_arg(request, dbobj_create_string_with_dup(key));
+    for (int end = i + 1000; i < end && i < length; ++i)
+    {
+      sprintf(element, "%s%d", prefix, i);
+      add_request_arg(request, dbobj_create_string_with_dup(element));
+    }
+    free_reply(dbapi_request_sync(request));
+    free_request(request);
+  }
+}
+
+static void core_test_stream()
+{
+  char element[32];
+  core_test_fill_list("stream:list", "e", 20000);
+
+  // Writes queued behind the stream change a copy, never what it reads
+  DBRequest *range = create_request(DB_LRANGE);
+  add_request_arg(range, dbobj_create_string_with_dup("stream:list"));
+  add_request_arg(range, dbobj_create_string_with_dup("0"));
+  add_request_arg(range, dbobj_create_string_with_dup("-1"));
+  DBReply *reply = dbapi_request_async(range);
+  free_reply(core_test_command(DB_LPOP, 1, (const char *[]){"stream:list"}));
+  free_reply(core_test_command(DB_LSET, 3, (const char *[]){"stream:list", "5", "changed"}));
+  free_reply(core_test_command(DB_RPUSH, 2, (const char *[]){"stream:list", "pushed"}));
+  reply_wait(reply);
+  DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  print_detailed_test_result_bool("core_test_stream: a long LRANGE is streamed", reply->is_streamed, true, reply->is_streamed);
+  db_bool_t is_stable = list && list->length == 20000 && reply->stream_length == 20000;
+  db_uint_t index = 0;
+  for (DBListNode *node = list ? list->head : NULL; is_stable && node; node = node->next, ++index)
+  {
+    sprintf(element, "e%u", index);
+    is_stable = strcmp(node->data->value.string, element) == 0;
+  }
+  print_detailed_test_result_bool("core_test_stream: the stream reads the list as LRANGE found it", is_stable, true, is_stable);
+  free_reply(reply);
+  free_request(range);
+
+  reply = core_test_command(DB_LRANGE, 3, (const char *[]){"stream:list", "5", "6"});
+  list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t is_written = list && list->length == 2 && strcmp(list->head->data->value.string, "changed") == 0 && dbapi_llen("stream:list") == 20000;
+  print_detailed_test_result_bool("core_test_stream: the writes went to the key", is_written, true, is_written);
+  free_reply(reply);
+
+  // A range in the middle, and one short of the threshold
+  reply = core_test_command(DB_LRANGE, 3, (const char *[]){"stream:list", "10000", "-1"});
+  list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t is_range = reply->is_streamed && list && list->length == 10000 && strcmp(list->head->data->value.string, "e10001") == 0 &&
+                       strcmp(list->tail->data->value.string, "pushed") == 0;
+  print_detailed_test_result_bool("core_test_stream: a streamed range starts where asked", is_range, true, is_range);
+  free_reply(reply);
+  sprintf(element, "%d", CORE_STREAM_MIN_LENGTH - 2);
+  reply = core_test_command(DB_LRANGE, 3, (const char *[]){"stream:list", "0", element});
+  print_detailed_test_result_bool("core_test_stream: a shorter range is answered at once", !reply->is_streamed, true, !reply->is_streamed);
+  free_reply(reply);
+
+  // A sorted set, deleted while it is streamed
+  DBRequest *request = create_request(DB_ZADD);
+  add_request_arg(request, dbobj_create_string_with_dup("stream:zset"));
+  for (int i = 0; i < 10000; ++i)
+  {
+    sprintf(element, "%d", i);
+    add_request_arg(request, dbobj_create_string_with_dup(element));
+    sprintf(element, "m%05d", i);
+    add_request_arg(request, dbobj_create_string_with_dup(element));
+  }
+  free_reply(dbapi_request_sync(request));
+  free_request(request);
+  range = create_request(DB_ZREVRANGE);
+  add_request_arg(range, dbobj_create_string_with_dup("stream:zset"));
+  add_request_arg(range, dbobj_create_string_with_dup("0"));
+  add_request_arg(range, dbobj_create_string_with_dup("-1"));
+  add_request_arg(range, dbobj_create_string_with_dup("WITHSCORES"));
+  reply = dbapi_request_async(range);
+  free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"stream:zset", "-1", "m09999"}));
+  dbapi_del("stream:zset");
+  reply_wait(reply);
+  list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  is_stable = reply->is_streamed && list && list->length == 20000 && strcmp(list->head->data->value.string, "m09999") == 0 &&
+              list->head->next->data->value.double_value == 9999 && list->tail->data->value.double_value == 0;
+  print_detailed_test_result_bool("core_test_stream: ZREVRANGE WITHSCORES streams a set deleted meanwhile", is_stable, true, is_stable);
+  free_reply(reply);
+  free_request(range);
+
+  dbapi_del("stream:list");
+}
+
+static void core_test_pexpire()
+{
+  dbapi_flushall();
+  dbapi_set("pexpire:key", "value");
+  dbapi_set("pexpire:plain", "value");
+
+  DBReply *reply = core_test_command(DB_PEXPIRE, 2, (const char *[]){"pexpire:key", "1500"});
+  long is_set = dbobj_is_int(reply->data) ? reply->data->value.int_value : -3;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_pexpire: PEXPIRE an existing key", (is_set == 1), 1, is_set);
+
+  reply = core_test_command(DB_PTTL, 1, (const char *[]){"pexpire:key"});
+  long pttl = dbobj_is_int(reply->data) ? reply->data->value.int_value : -3;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_pexpire: PTTL in milliseconds", (pttl > 1000 && pttl <= 1500), 1500, pttl);
+  reply = core_test_command(DB_TTL, 1, (const char *[]){"pexpire:key"});
+  long ttl = dbobj_is_int(reply->data) ? reply->data->value.int_value : -3;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_pexpire: TTL rounds to seconds", (ttl == 1 || ttl == 2), 2, ttl);
+  reply = core_test_command(DB_TTL, 1, (const char *[]){"pexpire:plain"});
+  ttl = dbobj_is_int(reply->data) ? reply->data->value.int_value : -3;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_pexpire: TTL without a deadline", (ttl == -1), -1, ttl);
+  reply = core_test_command(DB_PTTL, 1, (const char *[]){"pexpire:missing"});
+  pttl = dbobj_is_int(reply->data) ? reply->data->value.int_value : -3;
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_pexpire: PTTL of a missing key", (pttl == -2), -2, pttl);
+
+  free_reply(core_test_command(DB_PEXPIRE, 2, (const char *[]){"pexpire:key", "20"}));
+  struct timespec pause = {0, 60 * 1000000L};
+  thrd_sleep(&pause, NULL);
+  char *value = dbapi_get("pexpire:key");
+  print_detailed_test_result_str("core_test_pexpire: gone after its milliseconds", (value == NULL), "(null)", value ? value : "(null)");
+  free(value);
+}
+
+static int slab_test_thread(void *arg)
+{
+  (void)arg;
+  void *blocks[10];
+  for (int i = 0; i < 10; ++i)
+    blocks[i] = slab_alloc(120);
+  for (int i = 0; i < 10; ++i)
+    slab_free(blocks[i], 120);
+  return 0;
+}
+
+static void slab_test_pools()
+{
+  void *blocks[1000];
+  SlabStats before, after;
+  int aligned = 0, distinct = 0;
+
+  print_detailed_test_result_int("slab_test_pools: DBObj size class", (slab_size(sizeof(DBObj)) == 16), 16, slab_size(sizeof(DBObj)));
+  print_detailed_test_result_int("slab_test_pools: size rounds up", (slab_size(20) == 24), 24, slab_size(20));
+
+  // Only hash entries with keys of 64 to 71 bytes take 120 bytes, so nothing else allocates from it meanwhile.
+  slab_stats(14, &before);
+  for (int i = 0; i < 1000; ++i)
+  {
+    blocks[i] = slab_alloc(120);
+    memset(blocks[i], i & 0xFF, 120);
+    aligned += ((uintptr_t)blocks[i] % SLAB_GRANULARITY) == 0;
+  }
+  // Every block kept its own bytes, so none of them overlap.
+  for (int i = 0; i < 1000; ++i)
+    distinct += ((unsigned char *)blocks[i])[119] == (i & 0xFF) && ((unsigned char *)blocks[i])[0] == (i & 0xFF);
+  for (int i = 0; i < 1000; ++i)
+    slab_free(blocks[i], 120);
+  slab_stats(14, &after);
+
+  print_detailed_test_result_int("slab_test_pools: blocks are aligned", (aligned == 1000), 1000, aligned);
+  print_detailed_test_result_int("slab_test_pools: blocks don't overlap", (distinct == 1000), 1000, distinct);
+  long allocations = (long)(after.allocations - before.allocations);
+  long frees = (long)(after.frees - before.frees);
+  print_detailed_test_result_int("slab_test_pools: allocations counted", (allocations == 1000), 1000, allocations);
+  print_detailed_test_result_int("slab_test_pools: frees counted", (frees == 1000), 1000, frees);
+
+  // A thread that exits publishes what it counted, short of a batch or not.
+  thrd_t thread;
+  slab_stats(14, &before);
+  thrd_create(&thread, slab_test_thread, NULL);
+  thrd_join(thread, NULL);
+  slab_stats(14, &after);
+  allocations = (long)(after.allocations - before.allocations);
+  frees = (long)(after.frees - before.frees);
+  db_bool_t is_published = allocations == 10 && frees == 10;
+  print_detailed_test_result_bool("slab_test_pools: an exiting thread gives its cache back", is_published, true, is_published);
+
+  dbapi_flushall();
+  dbapi_set("slab:key", "value");
+  DBReply *reply = core_test_command(DB_MEMORY_STATS, 0, NULL);
+  // The entry of "slab:key" embeds its key, which takes it to 64 bytes.
+  size_t entry_allocations = core_test_info_field(reply, "slab_64_allocations");
+  size_t reserved = core_test_info_field(reply, "slab_reserved_bytes");
+  size_t used = core_test_info_field(reply, "slab_used_bytes");
+  free_reply(reply);
+  print_detailed_test_result_bool("slab_test_pools: MEMORY_STATS reports hash entries", entry_allocations > 0, true, entry_allocations > 0);
+  print_detailed_test_result_bool("slab_test_pools: used bytes fit in the reserved ones", used > 0 && used <= reserved, true, used > 0 && used <= reserved);
+}
+
+static void obj_test_embedded_strings()
+{
+  int64_t number = 0;
+  // Too long to embed either as a value or as a key
+  char long_value[96];
+  memset(long_value, 'x', sizeof(long_value) - 1);
+  long_value[sizeof(long_value) - 1] = '\0';
+
+  DBObj *int_obj = dbobj_create_string_with_dup("12345");
+  DBObj *short_obj = dbobj_create_string_with_dup("hello");
+  DBObj *padded_obj = dbobj_create_string_with_dup("007");
+  DBObj *long_obj = dbobj_create_string_with_dup(long_value);
+
+  print_detailed_test_result_int("obj_test_embedded_strings: integer encoding", (int_obj->encoding == DB_ENCODING_INT), DB_ENCODING_INT, int_obj->encoding);
+  print_detailed_test_result_bool("obj_test_embedded_strings: integer is cached", dbobj_string_as_int64(int_obj, &number) && number == 12345, true, number == 12345);
+  print_detailed_test_result_str("obj_test_embedded_strings: integer keeps its text", strcmp(int_obj->value.string, "12345") == 0, "12345", int_obj->value.string);
+  print_detailed_test_result_int("obj_test_embedded_strings: short string is embedded", (short_obj->encoding == DB_ENCODING_EMBSTR), DB_ENCODING_EMBSTR, short_obj->encoding);
+  print_detailed_test_result_bool("obj_test_embedded_strings: bytes follow the object", short_obj->value.string == (char *)(short_obj + 1), true, short_obj->value.string == (char *)(short_obj + 1));
+  // Leading zeros would not survive a round trip through the number.
+  print_detailed_test_result_int("obj_test_embedded_strings: non-canonical number stays a string", (padded_obj->encoding == DB_ENCODING_EMBSTR), DB_ENCODING_EMBSTR, padded_obj->encoding);
+  print_detailed_test_result_int("obj_test_embedded_strings: long string is raw", (long_obj->encoding == DB_ENCODING_RAW), DB_ENCODING_RAW, long_obj->encoding);
+
+  char *extracted = dbobj_extract_string(short_obj);
+  print_detailed_test_result_str("obj_test_embedded_strings: extracted copy", strcmp(extracted, "hello") == 0, "hello", extracted);
+  free(extracted);
+  free_dbobj(int_obj);
+  free_dbobj(padded_obj);
+  free_dbobj(long_obj);
+
+  DBHashEntry *short_entry = ht_create_entry(dbutil_strdup("short"), dbobj_create_uint(1));
+  DBHashEntry *long_entry = ht_create_entry(dbutil_strdup(long_value), dbobj_create_uint(2));
+  print_detailed_test_result_bool("obj_test_embedded_strings: short key is embedded", short_entry->key == (char *)(short_entry + 1), true, short_entry->key == (char *)(short_entry + 1));
+  print_detailed_test_result_str("obj_test_embedded_strings: embedded key", strcmp(short_entry->key, "short") == 0, "short", short_entry->key);
+  print_detailed_test_result_bool("obj_test_embedded_strings: long key is separate", long_entry->key != (char *)(long_entry + 1), true, long_entry->key != (char *)(long_entry + 1));
+  print_detailed_test_result_str("obj_test_embedded_strings: separate key", strcmp(long_entry->key, long_value) == 0, long_value, long_entry->key);
+  ht_free_entry(short_entry);
+  ht_free_entry(long_entry);
+
+  dbapi_flushall();
+  dbapi_set("embedded:int", "42");
+  char *value = dbapi_get("embedded:int");
+  print_detailed_test_result_str("obj_test_embedded_strings: GET of an integer", strcmp(value, "42") == 0, "42", value);
+  free(value);
+}
+
+static void quicklist_test_blocks()
+{
+  char value[16], expected[16];
+  char large[200];
+  memset(large, 'L', sizeof(large) - 1);
+  large[sizeof(large) - 1] = '\0';
+
+  // Small blocks, so a few dozen elements already span many of them.
+  db_uint_t block_size = ql_block_size;
+  ql_block_size = 64;
+  DBQuickList *list = ql_create();
+  ql_block_size = block_size;
+  size_t empty_memory = list->memory;
+
+  // 0..49 pushed to the back, -1..-50 to the front, and one element larger than a block last
+  for (int i = 0; i < 50; ++i)
+  {
+    snprintf(value, sizeof(value), "%d", i);
+    ql_rpush(list, value);
+    snprintf(value, sizeof(value), "%d", -i - 1);
+    ql_lpush(list, value);
+  }
+  ql_rpush(list, large);
+
+  print_detailed_test_result_int("quicklist_test_blocks: length", (list->length == 101), 101, list->length);
+  print_detailed_test_result_bool("quicklist_test_blocks: elements span blocks", list->block_count > 4, true, list->block_count > 4);
+
+  int in_order = 0, index = 0;
+  db_uint_t length;
+  DBQuickListIter iter;
+  const char *string;
+  ql_iter_init(list, &iter);
+  while ((string = ql_iter_next(&iter, &length)) && index < 100)
+  {
+    snprintf(expected, sizeof(expected), "%d", index - 50);
+    in_order += strcmp(string, expected) == 0 && length == strlen(expected);
+    ++index;
+  }
+  print_detailed_test_result_int("quicklist_test_blocks: iteration order", (in_order == 100), 100, in_order);
+  print_detailed_test_result_bool("quicklist_test_blocks: large element last", string && strcmp(string, large) == 0, true, string && strcmp(string, large) == 0);
+
+  DBList *range = ql_lrange(list, 45, 54);
+  int range_matches = 0;
+  index = 45;
+  for (DBListNode *node = range ? range->head : NULL; node; node = node->next, ++index)
+  {
+    snprintf(expected, sizeof(expected), "%d", index - 50);
+    range_matches += strcmp(node->data->value.string, expected) == 0;
+  }
+  print_detailed_test_result_int("quicklist_test_blocks: range across blocks", (range_matches == 10), 10, range_matches);
+  free_dblist(range);
+  DBList *out_of_range = ql_lrange(list, 200, 300);
+  print_detailed_test_result_bool("quicklist_test_blocks: range past the end", out_of_range == NULL, true, out_of_range == NULL);
+
+  char *popped = dbobj_extract_string(ql_rpop(list));
+  print_detailed_test_result_bool("quicklist_test_blocks: rpop large element", popped && strcmp(popped, large) == 0, true, popped && strcmp(popped, large) == 0);
+  free(popped);
+  popped = dbobj_extract_string(ql_lpop(list));
+  print_detailed_test_result_str("quicklist_test_blocks: lpop", popped && strcmp(popped, "-50") == 0, "-50", popped);
+  free(popped);
+  popped = dbobj_extract_string(ql_rpop(list));
+  print_detailed_test_result_str("quicklist_test_blocks: rpop", popped && strcmp(popped, "49") == 0, "49", popped);
+  free(popped);
+
+  DBList *head = ql_lpop_n(list, 3);
+  string = head && head->tail ? head->tail->data->value.string : NULL;
+  print_detailed_test_result_str("quicklist_test_blocks: lpop count keeps order", string && strcmp(string, "-47") == 0, "-47", string);
+  free_dblist(head);
+  DBList *tail = ql_rpop_n(list, 1000);
+  long popped_count = tail ? (long)tail->length : -1;
+  print_detailed_test_result_int("quicklist_test_blocks: rpop count drains the list", (popped_count == 95), 95, popped_count);
+  free_dblist(tail);
+
+  print_detailed_test_result_int("quicklist_test_blocks: no blocks left", (list->block_count == 0), 0, list->block_count);
+  print_detailed_test_result_int("quicklist_test_blocks: memory back to empty", (list->memory == empty_memory), empty_memory, list->memory);
+  print_detailed_test_result_bool("quicklist_test_blocks: pop from empty list", ql_lpop(list) == NULL && ql_rpop(list) == NULL, true, ql_lpop(list) == NULL);
+  ql_free(list);
+}
+
+// Checks every position of the list against `model`; returns how many match
+static int quicklist_test_matches(DBQuickList *list, char model[][24], int length)
+{
+  int matches = 0;
+  for (int i = 0; i < length; ++i)
+  {
+    char *value = dbobj_extract_string(ql_lindex(list, i));
+    matches += value && strcmp(value, model[i]) == 0;
+    free(value);
+  }
+  return matches;
+}
+
+static void quicklist_test_index()
+{
+  static char model[3000][24];
+  int length = 0;
+  unsigned int seed = 12345;
+  char value[24];
+
+  db_uint_t block_size = ql_block_size;
+  ql_block_size = 128;
+  DBQuickList *list = ql_create();
+  ql_block_size = block_size;
+
+  for (int i = 0; i < 1000; ++i)
+  {
+    snprintf(model[length++], sizeof(model[0]), "v%d", i);
+    ql_rpush(list, model[length - 1]);
+  }
+  int matches = quicklist_test_matches(list, model, length);
+  print_detailed_test_result_int("quicklist_test_index: lindex after rpush", (matches == length), length, matches);
+
+  // Pushes and pops at the head shift every position after the block table was built.
+  for (int i = 0; i < 300; ++i)
+  {
+    memmove(model[1], model[0], length * sizeof(model[0]));
+    snprintf(model[0], sizeof(model[0]), "h%d", i);
+    ++length;
+    ql_lpush(list, model[0]);
+    if (i % 3 == 0)
+    {
+      free_dbobj(ql_lpop(list));
+      memmove(model[0], model[1], --length * sizeof(model[0]));
+    }
+  }
+  matches = quicklist_test_matches(list, model, length);
+  print_detailed_test_result_int("quicklist_test_index: lindex after lpush and lpop", (matches == length), length, matches);
+
+  // Values of every size replace and join elements anywhere in the list.
+  int set_ok = 0, insert_ok = 0;
+  for (int i = 0; i < 400; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int position = (int)((seed >> 8) % length);
+    int padding = (int)((seed >> 20) % 16);
+    snprintf(value, sizeof(value), "%.*s%d", padding, "xxxxxxxxxxxxxxxx", i);
+    if (i % 2)
+    {
+      set_ok += ql_lset(list, position, value);
+      strcpy(model[position], value);
+    }
+    else
+    {
+      // Inserted before the pivot, which is unique in the list
+      insert_ok += ql_linsert(list, model[position], value, true);
+      memmove(model[position + 1], model[position], (length - position) * sizeof(model[0]));
+      strcpy(model[position], value);
+      ++length;
+    }
+  }
+  print_detailed_test_result_int("quicklist_test_index: lset in range", (set_ok == 200), 200, set_ok);
+  print_detailed_test_result_int("quicklist_test_index: linsert finds the pivot", (insert_ok == 200), 200, insert_ok);
+  print_detailed_test_result_int("quicklist_test_index: length after inserts", (list->length == (db_uint_t)length), length, list->length);
+  matches = quicklist_test_matches(list, model, length);
+  print_detailed_test_result_int("quicklist_test_index: lindex after lset and linsert", (matches == length), length, matches);
+
+  DBList *range = ql_lrange(list, length / 2, length / 2 + 9);
+  int range_matches = 0, index = length / 2;
+  for (DBListNode *node = range ? range->head : NULL; node; node = node->next, ++index)
+    range_matches += strcmp(node->data->value.string, model[index]) == 0;
+  print_detailed_test_result_int("quicklist_test_index: deep lrange", (range_matches == 10), 10, range_matches);
+  free_dblist(range);
+
+  db_bool_t missing = !ql_linsert(list, "missing", "x", false) && !ql_lset(list, length, "x") && !ql_lindex(list, length);
+  print_detailed_test_result_bool("quicklist_test_index: out of range and missing pivot", missing, true, missing);
+  ql_free(list);
+}
+
+static void core_test_list_index()
+{
+  dbapi_flushall();
+  dbapi_rpush_n("core_test:list_index", "a", "b", "c", NULL);
+
+  DBReply *reply = core_test_command(DB_LINDEX, 2, (const char *[]){"core_test:list_index", "-1"});
+  const char *string = dbobj_is_string(reply->data) ? reply->data->value.string : NULL;
+  print_detailed_test_result_str("core_test_list_index: LINDEX -1", string && strcmp(string, "c") == 0, "c", string);
+  free_reply(reply);
+  reply = core_test_command(DB_LINDEX, 2, (const char *[]){"core_test:list_index", "3"});
+  print_detailed_test_result_bool("core_test_list_index: LINDEX out of range", dbobj_is_null(reply->data), true, dbobj_is_null(reply->data));
+  free_reply(reply);
+
+  reply = core_test_command(DB_LSET, 3, (const char *[]){"core_test:list_index", "1", "B"});
+  print_detailed_test_result_bool("core_test_list_index: LSET", dbobj_is_string(reply->data), true, dbobj_is_string(reply->data));
+  free_reply(reply);
+  reply = core_test_command(DB_LSET, 3, (const char *[]){"core_test:list_index", "5", "x"});
+  db_bool_t is_range_error = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_INDEX_OUT_OF_RANGE) == 0;
+  print_detailed_test_result_bool("core_test_list_index: LSET out of range", is_range_error, true, is_range_error);
+  free_reply(reply);
+
+  reply = core_test_command(DB_LINSERT, 4, (const char *[]){"core_test:list_index", "AFTER", "B", "b2"});
+  long length = dbobj_is_int(reply->data) ? reply->data->value.int_value : -100;
+  print_detailed_test_result_int("core_test_list_index: LINSERT returns the length", (length == 4), 4, length);
+  free_reply(reply);
+  reply = core_test_command(DB_LINSERT, 4, (const char *[]){"core_test:list_index", "BEFORE", "z", "y"});
+  length = dbobj_is_int(reply->data) ? reply->data->value.int_value : -100;
+  print_detailed_test_result_int("core_test_list_index: LINSERT without the pivot", (length == -1), -1, length);
+  free_reply(reply);
+
+  DBList *list = dbapi_lrange("core_test:list_index", 0, DB_UINT_MAX);
+  const char *expected[] = {"a", "B", "b2", "c"};
+  int matches = 0, i = 0;
+  for (DBListNode *node = list ? list->head : NULL; node && i < 4; node = node->next, ++i)
+    matches += strcmp(node->data->value.string, expected[i]) == 0;
+  print_detailed_test_result_int("core_test_list_index: list after LSET and LINSERT", (matches == 4), 4, matches);
+  dbapi_free_list(list);
+
+  dbapi_set("core_test:list_index:string", "value");
+  reply = core_test_command(DB_LINDEX, 2, (const char *[]){"core_test:list_index:string", "0"});
+  db_bool_t is_wrongtype = dbobj_is_error(reply->data) && strcmp(reply->data->value.message, DB_ERR_WRONGTYPE) == 0;
+  print_detailed_test_result_bool("core_test_list_index: LINDEX of a string", is_wrongtype, true, is_wrongtype);
+  free_reply(reply);
+}
+
+static void core_test_zset_reverse()
+{
+  dbapi_flushall();
+  DBReply *reply = core_test_command(DB_ZADD, 7, (const char *[]){"core_test:zrev", "1", "a", "2", "b", "3", "c"});
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZREVRANGE, 3, (const char *[]){"core_test:zrev", "0", "-2"});
+  DBList *list = dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  db_bool_t correct = list && list->length == 2 && strcmp(list->head->data->value.string, "c") == 0 &&
+                      strcmp(list->tail->data->value.string, "b") == 0;
+  print_detailed_test_result_bool("core_test_zset_reverse: ZREVRANGE 0 -2 == {c,b}", correct, true, correct);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZREVRANK, 2, (const char *[]){"core_test:zrev", "a"});
+  long rank = dbobj_is_int(reply->data) ? reply->data->value.int_value : -1;
+  print_detailed_test_result_int("core_test_zset_reverse: ZREVRANK of 'a'", (rank == 2), 2, rank);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZREVRANK, 2, (const char *[]){"core_test:zrev", "missing"});
+  print_detailed_test_result_bool("core_test_zset_reverse: ZREVRANK of a missing member", dbobj_is_null(reply->data), true, dbobj_is_null(reply->data));
+  free_reply(reply);
+}
+
+static void core_test_zadd_pairs()
+{
+  dbapi_flushall();
+  DBReply *reply = core_test_command(DB_ZADD, 7, (const char *[]){"core_test:zadd", "1", "a", "2", "b", "3", "a"});
+  long added = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : -1;
+  print_detailed_test_result_int("core_test_zadd_pairs: a member given twice is added once", added == 2, 2, added);
+  free_reply(reply);
+
+  const char *argv[81];
+  char scores[40][8], members[40][8];
+  argv[0] = "core_test:zadd";
+  for (int i = 0; i < 40; ++i)
+  {
+    sprintf(scores[i], "%d", 40 - i);
+    sprintf(members[i], "m%d", i);
+    argv[1 + 2 * i] = scores[i];
+    argv[2 + 2 * i] = members[i];
+  }
+  reply = core_test_command(DB_ZADD, 81, argv);
+  added = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : -1;
+  print_detailed_test_result_int("core_test_zadd_pairs: a batch is merged", added == 40, 40, added);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZSCORE, 2, (const char *[]){"core_test:zadd", "a"});
+  double score = dbobj_is_double(reply->data) ? reply->data->value.double_value : -1;
+  print_detailed_test_result_double("core_test_zadd_pairs: the last score of 'a' is kept", score == 3, 3, score);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZRANK, 2, (const char *[]){"core_test:zadd", "m39"});
+  long rank = dbobj_is_int(reply->data) ? reply->data->value.int_value : -1;
+  print_detailed_test_result_int("core_test_zadd_pairs: ZRANK after the batch", rank == 0, 0, rank);
+  free_reply(reply);
+
+  reply = core_test_command(DB_ZCARD, 1, (const char *[]){"core_test:zadd"});
+  long card = dbobj_is_uint(reply->data) ? reply->data->value.uint_value : -1;
+  print_detailed_test_result_int("core_test_zadd_pairs: ZCARD", card == 42, 42, card);
+  free_reply(reply);
+}
+
+static void latency_test_histogram()
+{
+  DBLatencyHistogram histogram = {0};
+  for (uint64_t ns = 1; ns <= 100000; ++ns)
+    latency_record(&histogram, ns);
+  uint64_t p50 = latency_percentile(&histogram, 50);
+  db_bool_t is_close = p50 >= 50000 && p50 <= 50000 + 50000 / 16;
+  print_detailed_test_result_int("latency_test_histogram: p50 within a bucket width", is_close, 50000, (int)p50);
+  uint64_t p100 = latency_percentile(&histogram, 100);
+  print_detailed_test_result_int("latency_test_histogram: p100 is the max", p100 == 100000, 100000, (int)p100);
+  uint64_t p0 = latency_percentile(&histogram, 0);
+  print_detailed_test_result_int("latency_test_histogram: small values are exact", p0 == 1, 1, (int)p0);
+}
+
+static void core_test_commandstats()
+{
+  server_config_slowlog(0, 4);
+  free_reply(core_test_command(DB_SLOWLOG_RESET, 0, NULL));
+  dbapi_set("stats_test:key", "value");
+  free_reply(core_test_command(DB_GET, 1, (const char *[]){"stats_test:key"}));
+
+  DBReply *reply = core_test_command(DB_SLOWLOG_GET, 1, (const char *[]){"2"});
+  DBList *entries = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  // The newest entry is the GET, the one before it the SET
+  DBList *fields = entries && entries->length == 2 ? entries->head->data->value.list : NULL;
+  DBList *args = fields && fields->length == 4 ? fields->tail->data->value.list : NULL;
+  db_bool_t is_logged = args && args->length == 2 && strcmp(args->head->data->value.string, "GET") == 0 &&
+                        strcmp(args->tail->data->value.string, "stats_test:key") == 0;
+  print_detailed_test_result_bool("core_test_commandstats: slow log keeps the arguments", is_logged, true, is_logged);
+  free_reply(reply);
+
+  for (int i = 0; i < 6; ++i)
+    free_reply(core_test_command(DB_PING, 0, NULL));
+  reply = core_test_command(DB_SLOWLOG_LEN, 0, NULL);
+  db_uint_t length = reply->data ? reply->data->value.uint_value : 0;
+  print_detailed_test_result_int("core_test_commandstats: slow log is capped", length == 4, 4, (int)length);
+  free_reply(reply);
+  // With the default threshold the RESET itself isn't logged.
+  server_config_slowlog(SLOWLOG_DEFAULT_THRESHOLD_US, 4);
+  free_reply(core_test_command(DB_SLOWLOG_RESET, 0, NULL));
+  reply = core_test_command(DB_SLOWLOG_LEN, 0, NULL);
+  length = reply->data ? reply->data->value.uint_value : 1;
+  print_detailed_test_result_int("core_test_commandstats: SLOWLOG_RESET empties the log", length == 0, 0, (int)length);
+  free_reply(reply);
+  server_config_slowlog(SLOWLOG_DEFAULT_THRESHOLD_US, SLOWLOG_DEFAULT_MAX_LENGTH);
+
+  reply = core_test_command(DB_INFO_COMMANDSTATS, 0, NULL);
+  db_bool_t has_get = false;
+  for (DBListNode *node = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL; node; node = node->next)
+    has_get = has_get || strncmp(node->data->value.string, "cmdstat_get:calls=", 18) == 0;
+  print_detailed_test_result_bool("core_test_commandstats: INFO_COMMANDSTATS counts GET", has_get, true, has_get);
+  free_reply(reply);
+  dbapi_del("stats_test:key");
+}
+
+static void core_test_hotkeys()
+{
+  char key[32], big[20001];
+  free_reply(core_test_command(DB_HOTKEYS_RESET, 0, NULL));
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  dbapi_set("hotkeys_test:hot", "v");
+  dbapi_set("hotkeys_test:big", big);
+  for (int i = 0; i < 50; ++i)
+  {
+    sprintf(key, "hotkeys_test:cold:%d", i);
+    dbapi_set(key, "v");
+  }
+  for (int i = 0; i < 800; ++i)
+    free_reply(core_test_command(DB_GET, 1, (const char *[]){"hotkeys_test:hot"}));
+  for (int i = 0; i < 200; ++i)
+    free_reply(core_test_command(DB_GET, 1, (const char *[]){"hotkeys_test:big"}));
+
+  DBReply *reply = core_test_command(DB_HOTKEYS_GET, 1, (const char *[]){"1"});
+  DBList *entries = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  DBList *fields = entries && entries->length == 1 ? entries->head->data->value.list : NULL;
+  const char *hottest = fields && fields->length == 4 ? fields->head->data->value.string : "";
+  print_detailed_test_result_str("core_test_hotkeys: HOTKEYS_GET ranks the most read key first", strcmp(hottest, "hotkeys_test:hot") == 0,
+                                 "hotkeys_test:hot", hottest);
+  db_uint_t accesses = fields ? fields->head->next->data->value.uint_value : 0;
+  // 800 reads sampled one in 8 on average
+  print_detailed_test_result_bool("core_test_hotkeys: accesses are estimated from the samples", accesses >= 400 && accesses <= 1600, true,
+                                  accesses >= 400 && accesses <= 1600);
+  free_reply(reply);
+
+  reply = core_test_command(DB_HOTKEYS_BYTES, 1, (const char *[]){"1"});
+  entries = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list : NULL;
+  fields = entries && entries->length == 1 ? entries->head->data->value.list : NULL;
+  const char *largest = fields && fields->length == 4 ? fields->head->data->value.string : "";
+  print_detailed_test_result_str("core_test_hotkeys: HOTKEYS_BYTES ranks the largest value first", strcmp(largest, "hotkeys_test:big") == 0,
+                                 "hotkeys_test:big", largest);
+  db_uint_t read_bytes = fields ? fields->tail->prev->data->value.uint_value : 0;
+  print_detailed_test_result_bool("core_test_hotkeys: bytes read count whole values", read_bytes >= 20000 && read_bytes % 20000 == 0, true,
+                                  read_bytes >= 20000 && read_bytes % 20000 == 0);
+  free_reply(reply);
+
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t samples = core_test_info_field(reply, "hotkeys_samples");
+  print_detailed_test_result_bool("core_test_hotkeys: INFO_STATS counts the samples", samples > 0, true, samples > 0);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_HOTKEYS_RESET, 0, NULL));
+  reply = core_test_command(DB_HOTKEYS_GET, 0, NULL);
+  db_uint_t length = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->length : 1;
+  print_detailed_test_result_int("core_test_hotkeys: HOTKEYS_RESET forgets every key", length == 0, 0, (int)length);
+  free_reply(reply);
+
+  dbapi_del("hotkeys_test:hot");
+  dbapi_del("hotkeys_test:big");
+  for (int i = 0; i < 50; ++i)
+  {
+    sprintf(key, "hotkeys_test:cold:%d", i);
+    dbapi_del(key);
+  }
+}
+
+static void core_test_trace()
+{
+  free_reply(core_test_command(DB_TRACE_START, 0, NULL));
+  dbapi_set("trace_test:key", "value");
+  free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"trace_test:zset", "1", "a"}));
+  free_reply(core_test_command(DB_TRACE_STOP, 0, NULL));
+  dbapi_set("trace_test:untraced", "value");
+
+  DBReply *reply = core_test_command(DB_TRACE_GET, 1, (const char *[]){"1000"});
+  db_bool_t has_hset = false, has_dispatch = false, has_untraced = false;
+  for (DBListNode *node = reply->data && dbobj_is_list(reply->data) ? reply->data->value.list->head : NULL; node; node = node->next)
+  {
+    has_hset = has_hset || strstr(node->data->value.string, " hset ") != NULL;
+    has_dispatch = has_dispatch || strstr(node->data->value.string, " dispatch ") != NULL;
+  }
+  print_detailed_test_result_bool("core_test_trace: hash writes are traced", has_hset, true, has_hset);
+  print_detailed_test_result_bool("core_test_trace: dispatches are traced", has_dispatch, true, has_dispatch);
+  free_reply(reply);
+
+  // Nothing is recorded once tracing is off.
+  DBTraceEvent events[4];
+  db_uint_t before = trace_collect(events, 4);
+  uint64_t last_before = before ? events[before - 1].started_at : 0;
+  dbapi_set("trace_test:untraced", "other");
+  db_uint_t after = trace_collect(events, 4);
+  has_untraced = after != before || (after && events[after - 1].started_at != last_before);
+  print_detailed_test_result_bool("core_test_trace: stopped tracing records nothing", !has_untraced, false, has_untraced);
+  dbapi_del("trace_test:key");
+  dbapi_del("trace_test:zset");
+  dbapi_del("trace_test:untraced");
+}
+
+static void core_test_active_expire()
+{
+  char key[32], deadline[16];
+  const char *argv[2];
+  int count = 2000;
+
+  dbapi_flushall();
+  DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t expired_before = core_test_info_field(reply, "expired_keys");
+  free_reply(reply);
+
+  sprintf(deadline, "%u", (db_uint_t)time(NULL) - 1);
+  argv[1] = deadline;
+  for (int i = 0; i < count; ++i)
+  {
+    sprintf(key, "active_expire:%d", i);
+    dbapi_set(key, "value");
+    argv[0] = key;
+    free_reply(core_test_command(DB_EXPIREAT, 2, argv));
+  }
+
+  // Nothing reads the keys again, the idle workers have to find them on their own.
+  size_t expired = expired_before;
+  for (int i = 0; i < 50 && expired - expired_before < (size_t)count; ++i)
+  {
+    thrd_sleep(&(struct timespec){.tv_nsec = 100 * 1000000L}, NULL);
+    reply = core_test_command(DB_INFO_STATS, 0, NULL);
+    expired = core_test_info_field(reply, "expired_keys");
+    free_reply(reply);
+  }
+  print_detailed_test_result_int("core_test_active_expire: idle workers expire every key", (expired - expired_before == (size_t)count), count, expired - expired_before);
+
+  reply = core_test_command(DB_INFO_DATASET_MEMORY, 0, NULL);
+  size_t strings = core_test_info_field(reply, "dataset_strings_keys");
+  free_reply(reply);
+  print_detailed_test_result_int("core_test_active_expire: keyspace is empty", (strings == 0), 0, strings);
+
+  dbapi_flushall();
+}
+
+static void flathash_test_basic()
+{
+  char key[32];
+  int count = 10000;
+  int found = 0;
+  DBFlatHash *ht = fht_create();
+
+  for (int i = 0; i < count; ++i)
+  {
+    sprintf(key, "flat:%d", i);
+    fht_set(ht, key, dbobj_create_string_with_dup(key));
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    sprintf(key, "flat:%d", i);
+    DBObj *value = fht_get(ht, key);
+    found += value && strcmp(value->value.string, key) == 0;
+  }
+  print_detailed_test_result_int("flathash_test_basic: every key found", (found == count), count, found);
+  print_detailed_test_result_int("flathash_test_basic: count", (fht_count(ht) == count), count, fht_count(ht));
+
+  fht_set(ht, "flat:7", dbobj_create_string_with_dup("replaced"));
+  DBObj *replaced = fht_get(ht, "flat:7");
+  print_detailed_test_result_str("flathash_test_basic: overwrite", (replaced && strcmp(replaced->value.string, "replaced") == 0), "replaced", replaced ? replaced->value.string : "(null)");
+  print_detailed_test_result_int("flathash_test_basic: overwrite keeps count", (fht_count(ht) == count), count, fht_count(ht));
+
+  int deleted = 0;
+  for (int i = 0; i < count; i += 2)
+  {
+    sprintf(key, "flat:%d", i);
+    deleted += fht_delete(ht, key);
+  }
+  print_detailed_test_result_int("flathash_test_basic: delete half", (deleted == count / 2), count / 2, deleted);
+  db_bool_t deleted_again = fht_delete(ht, "flat:0");
+  print_detailed_test_result_bool("flathash_test_basic: delete missing", !deleted_again, false, deleted_again);
+
+  found = 0;
+  int missing = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    sprintf(key, "flat:%d", i);
+    if (fht_get(ht, key))
+      found += i % 2;
+    else
+      missing += i % 2 == 0;
+  }
+  print_detailed_test_result_int("flathash_test_basic: odd keys remain", (found == count / 2), count / 2, found);
+  print_detailed_test_result_int("flathash_test_basic: even keys are gone", (missing == count / 2), count / 2, missing);
+  print_detailed_test_result_int("flathash_test_basic: count after delete", (fht_count(ht) == count / 2), count / 2, fht_count(ht));
+
+  for (int i = 1; i < count; i += 2)
+  {
+    sprintf(key, "flat:%d", i);
+    fht_delete(ht, key);
+  }
+  // Shrinking happens over the next operations, one group at a time.
+  for (int i = 0; i < count; ++i)
+    fht_get(ht, "flat:missing");
+  print_detailed_test_result_int("flathash_test_basic: empty count", (fht_count(ht) == 0), 0, fht_count(ht));
+  // The allocator may hand back a slightly larger chunk for the shrunk arrays, so count what they got.
+  size_t empty_memory = dbutil_alloc_size(ht) + dbutil_alloc_size(ht->tables[0].ctrl) + dbutil_alloc_size(ht->tables[0].slots);
+  print_detailed_test_result_int("flathash_test_basic: memory returns to empty", (ht->memory == empty_memory && ht->tables[0].groups == FHT_INITIAL_GROUPS), empty_memory, ht->memory);
+  fht_free(ht);
+}
+
+static void snapshot_test_load_entry(char *key, DBObj *value, uint64_t expire_at_ms, void *context)
+{
+  DBHash **tables = (DBHash **)context;
+  DBKey handle = ht_key(key);
+  hset_key(tables[0], &handle, value, NULL);
+  if (expire_at_ms)
+    ht_expire_key(tables[0], &handle, expire_at_ms, tables[1]);
+  free(key);
+}
+
+static void snapshot_test_roundtrip()
+{
+  const char *filepath = "test.snapshot";
+  DBHash *ht = ht_create();
+
+  hset(ht, "string", dbobj_create_string_with_dup("value"), NULL);
+  DBQuickList *list = ql_create();
+  ql_rpush(list, "a");
+  ql_rpush(list, "b");
+  hset(ht, "list", dbobj_create_quicklist(list), NULL);
+  DBHash *hash = ht_create();
+  hset(hash, "field", dbobj_create_string_with_dup("x"), NULL);
+  hset(ht, "hash", dbobj_create_hash(hash), NULL);
+  DBZSet *zset = zset_create();
+  zadd(zset, 2.5, "m");
+  hset(ht, "zset", dbobj_create_zset(zset), NULL);
+  char *long_string = core_test_alphabet(ROPE_MIN_LENGTH + ROPE_CHUNK_SIZE / 2);
+  hset(ht, "rope", dbobj_create_stored_string(long_string), NULL);
+  DBHash *expires = ht_create();
+  DBKey handle = ht_key("string");
+  ht_expire_key(ht, &handle, 4000000000123ULL, expires);
+
+  db_bool_t saved = snapshot_save(filepath, &ht, &expires, 1, NULL);
+  print_detailed_test_result_bool("snapshot_test_roundtrip: save succeeds", saved, true, saved);
+
+  DBHash *loaded = ht_create();
+  DBHash *loaded_expires = ht_create();
+  db_bool_t is_loaded = snapshot_load(filepath, snapshot_test_load_entry, (DBHash *[]){loaded, loaded_expires});
+  print_detailed_test_result_bool("snapshot_test_roundtrip: load passes the checksum", is_loaded, true, is_loaded);
+
+  DBHashEntry *entry = hget(loaded, "string", NULL);
+  const char *string = entry && dbobj_is_string(entry->data) ? entry->data->value.string : NULL;
+  print_detailed_test_result_str("snapshot_test_roundtrip: string value", string && strcmp(string, "value") == 0, "value", string);
+  entry = hget(loaded, "list", NULL);
+  long length = entry && dbobj_is_list(entry->data) ? entry->data->value.quicklist->length : -1;
+  print_detailed_test_result_int("snapshot_test_roundtrip: list length", (length == 2), 2, length);
+  entry = hget(loaded, "hash", NULL);
+  string = entry && dbobj_is_hash(entry->data) ? hashobj_get(entry->data, "field") : NULL;
+  print_detailed_test_result_str("snapshot_test_roundtrip: hash field", string && strcmp(string, "x") == 0, "x", string);
+  entry = hget(loaded, "zset", NULL);
+  DBObj *score_obj = entry && dbobj_is_zset(entry->data) ? zscore(entry->data->value.zset, "m") : NULL;
+  double score = dbobj_is_double(score_obj) ? score_obj->value.double_value : -1;
+  print_detailed_test_result_double("snapshot_test_roundtrip: zset score", (score == 2.5), 2.5, score);
+  free_dbobj(score_obj);
+  entry = hget(loaded, "rope", NULL);
+  char *flat = entry && entry->data->encoding == DB_ENCODING_ROPE ? rope_flatten(entry->data->value.rope) : NULL;
+  db_bool_t is_same = flat && strcmp(flat, long_string) == 0;
+  print_detailed_test_result_bool("snapshot_test_roundtrip: a rope is read back in chunks", is_same, true, is_same);
+  free(flat);
+  free(long_string);
+  entry = hget(loaded_expires, "string", NULL);
+  db_uint_t deadline = entry && dbobj_is_uint(entry->data) ? entry->data->value.uint_value : 0;
+  print_detailed_test_result_int("snapshot_test_roundtrip: deadline", (deadline == 4000000000u), 4000000000u, deadline);
+  entry = hget(loaded, "string", NULL);
+  long deadline_ms = entry ? (long)entry->expire_at_ms : 0;
+  print_detailed_test_result_int("snapshot_test_roundtrip: deadline keeps its milliseconds", (deadline_ms == 4000000000123L), 4000000000123L, deadline_ms);
+
+  // Flip one byte of the payload, the checksum must catch it.
+  FILE *file = fopen(filepath, "r+b");
+  fseek(file, 8, SEEK_SET);
+  int c = fgetc(file);
+  fseek(file, 8, SEEK_SET);
+  fputc(c ^ 0x01, file);
+  fclose(file);
+  DBHash *corrupted = ht_create();
+  DBHash *corrupted_expires = ht_create();
+  is_loaded = snapshot_load(filepath, snapshot_test_load_entry, (DBHash *[]){corrupted, corrupted_expires});
+  print_detailed_test_result_bool("snapshot_test_roundtrip: corruption is detected", !is_loaded, true, !is_loaded);
+
+  remove(filepath);
+  ht_free(corrupted_expires);
+  ht_free(corrupted);
+  ht_free(loaded_expires);
+  ht_free(loaded);
+  ht_free(expires);
+  ht_free(ht);
+}
+
+typedef struct SnapshotTestCounter
+{
+  mtx_t lock;
+  db_uint_t entries;
+  db_uint_t chunks;
+  uint64_t reserved;
+} SnapshotTestCounter;
+
+static void snapshot_test_reserve(uint64_t key_count, uint64_t expires_count, void *context)
+{
+  ((SnapshotTestCounter *)context)->reserved = key_count;
+}
+
+static void snapshot_test_count_chunk(SnapshotEntry *entries, db_uint_t length, void *context)
+{
+  SnapshotTestCounter *counter = (SnapshotTestCounter *)context;
+  for (db_uint_t i = 0; i < length; ++i)
+  {
+    free(entries[i].key);
+    free_dbobj(entries[i].value);
+  }
+  mtx_lock(&counter->lock);
+  counter->entries += length;
+  ++counter->chunks;
+  mtx_unlock(&counter->lock);
+}
+
+static void snapshot_test_parallel_load()
+{
+  const char *filepath = "test-parallel.snapshot";
+  const db_uint_t count = 20000;
+  char key[32], value[64];
+  DBHash *ht = ht_create();
+
+  for (db_uint_t i = 0; i < count; ++i)
+  {
+    sprintf(key, "key:%u", i);
+    sprintf(value, "value of a key that takes some room in the snapshot %u", i);
+    hset(ht, key, dbobj_create_string_with_dup(value), NULL);
+  }
+  db_bool_t saved = snapshot_save(filepath, &ht, NULL, 1, NULL);
+  print_detailed_test_result_bool("snapshot_test_parallel_load: save succeeds", saved, true, saved);
+
+  SnapshotTestCounter counter = {.entries = 0, .chunks = 0, .reserved = 0};
+  mtx_init(&counter.lock, mtx_plain);
+  db_bool_t is_loaded = snapshot_load_parallel(filepath, 4, snapshot_test_reserve, snapshot_test_count_chunk, &counter);
+  print_detailed_test_result_bool("snapshot_test_parallel_load: load passes the checksum", is_loaded, true, is_loaded);
+  print_detailed_test_result_int("snapshot_test_parallel_load: header key count", (counter.reserved == count), count, counter.reserved);
+  print_detailed_test_result_int("snapshot_test_parallel_load: every entry decoded", (counter.entries == count), count, counter.entries);
+  print_detailed_test_result_bool("snapshot_test_parallel_load: several chunks", (counter.chunks > 1), true, counter.chunks > 1);
+
+  // Cut the file short, the loader must report it after the decoders finish.
+  FILE *file = fopen(filepath, "r+b");
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  truncate(filepath, size / 2);
+  counter.entries = 0;
+  is_loaded = snapshot_load_parallel(filepath, 4, NULL, snapshot_test_count_chunk, &counter);
+  print_detailed_test_result_bool("snapshot_test_parallel_load: truncation is detected", !is_loaded, true, !is_loaded);
+
+  mtx_destroy(&counter.lock);
+  remove(filepath);
+  ht_free(ht);
+}
+
+static void interaction_test_commands()
+{
+  db_bool_t round_trips = true;
+  for (int action = DB_UNKNOWN_COMMAND + 1; action <= DB_SHUTDOWN; ++action)
+    round_trips = round_trips && db_action_from_name(db_action_name(action)) == action;
+  print_detailed_test_result_bool("interaction_test_commands: every name maps back to its action", round_trips, true, round_trips);
+  db_action_t action = db_action_from_name("zRangeByScore");
+  print_detailed_test_result_int("interaction_test_commands: names match in any case", (action == DB_ZRANGEBYSCORE), DB_ZRANGEBYSCORE, action);
+  action = db_action_from_slice("GETX", 3);
+  print_detailed_test_result_int("interaction_test_commands: a slice is looked up by its length", (action == DB_GET), DB_GET, action);
+  action = db_action_from_name("GETX");
+  print_detailed_test_result_int("interaction_test_commands: unknown name", (action == DB_UNKNOWN_COMMAND), DB_UNKNOWN_COMMAND, action);
+
+  DBReply *reply = core_test_command(DB_GET, 2, (const char *[]){"a", "b"});
+  db_bool_t is_rejected = dbobj_is_error(reply->data) && strcmp(reply->data->value.string, DB_ERR_ARG_ERROR) == 0;
+  print_detailed_test_result_bool("interaction_test_commands: wrong argument count is rejected", is_rejected, true, is_rejected);
+  free_reply(reply);
+
+  dbapi_run_command("  set \"parse test\"  \"a \\\"b\\\"\"");
+  char *value = dbapi_get("parse test");
+  db_bool_t got = value && strcmp(value, "a \"b\"") == 0;
+  print_detailed_test_result_str("interaction_test_commands: quoted arguments", got, "a \"b\"", value);
+  dbapi_free(value);
+  dbapi_run_command("Rpush parse:list 42 -7");
+  DBList *range = dbapi_lrange("parse:list", 0, DB_UINT_MAX);
+  int64_t number = 0;
+  db_bool_t is_int = range && range->length == 2 && strcmp(range->head->data->value.string, "42") == 0;
+  print_detailed_test_result_bool("interaction_test_commands: bare arguments", is_int, true, is_int);
+  dbapi_free_list(range);
+  DBRequest *request = create_request(DB_SET);
+  add_request_arg(request, dbobj_create_string_from_bytes("12345678", 5));
+  is_int = dbobj_string_as_int64(request->args->head->data, &number) && number == 12345;
+  print_detailed_test_result_int("interaction_test_commands: numbers are decoded as they are parsed", is_int, 12345, number);
+  free_request(request);
+  dbapi_del("parse test");
+  dbapi_del("parse:list");
+}
+
+static void uring_test_write()
+{
+  const char *filepath = "uring_test.tmp";
+  char data[3000];
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = (char)('a' + i % 26);
+
+  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  db_bool_t is_written = fd >= 0 && uring_write_all(fd, data, 1000, false) && uring_write_all(fd, data + 1000, 2000, true);
+  if (fd >= 0)
+    close(fd);
+  print_detailed_test_result_bool("uring_test_write: appends and syncs", is_written, true, is_written);
+
+  char read_back[3001];
+  FILE *file = fopen(filepath, "rb");
+  size_t length = file ? fread(read_back, 1, sizeof(read_back), file) : 0;
+  if (file)
+    fclose(file);
+  db_bool_t is_equal = length == sizeof(data) && memcmp(read_back, data, sizeof(data)) == 0;
+  print_detailed_test_result_int("uring_test_write: file holds both writes in order", is_equal, sizeof(data), length);
+  remove(filepath);
+}
+
+#define NET_TEST_PORT 26379
+
+static int net_test_serve(void *arg)
+{
+  (void)arg;
+  return dbapi_start_network_server(NET_TEST_PORT) ? 0 : 1;
+}
+
+static int net_test_connect()
+{
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NET_TEST_PORT)};
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = -1;
+  for (int attempt = 0; attempt < 100 && fd < 0; ++attempt)
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+      break;
+    close(fd);
+    fd = -1;
+    thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000 * 1000}, NULL);
+  }
+  return fd;
+}
+
+// Sends `input` and reads until the server closes the connection
+static char *net_test_exchange(const char *input)
+{
+  int fd = net_test_connect();
+  if (fd < 0)
+    return NULL;
+  write(fd, input, strlen(input));
+  size_t length = 0;
+  char *output = malloc(4096);
+  ssize_t n;
+  while (length < 4095 && (n = read(fd, output + length, 4095 - length)) > 0)
+    length += (size_t)n;
+  output[length] = '\0';
+  close(fd);
+  return output;
+}
+
+static void net_test_resp()
+{
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+
+  char *output = net_test_exchange("*3\r\n$3\r\nSET\r\n$7\r\nnet:key\r\n$5\r\nvalue\r\n"
+                                   "*2\r\n$3\r\nGET\r\n$7\r\nnet:key\r\n"
+                                   "*2\r\n$3\r\nGET\r\n$11\r\nnet:missing\r\n"
+                                   "PING\r\n"
+                                   "rpush net:list a b\r\n"
+                                   "*1\r\n$4\r\nQUIT\r\n"
+                                   "PING\r\n");
+  const char *expected = "+OK\r\n$5\r\nvalue\r\n$-1\r\n+PONG\r\n:2\r\n+OK\r\n";
+  db_bool_t is_equal = output && strcmp(output, expected) == 0;
+  print_detailed_test_result_str("net_test_resp: pipelined and inline commands", is_equal, expected, output);
+  free(output);
+
+  output = net_test_exchange("MULTI\r\nset net:tx 1\r\nincr net:tx\r\nget net:tx\r\nEXEC\r\nQUIT\r\n");
+  expected = "+OK\r\n+QUEUED\r\n+QUEUED\r\n+QUEUED\r\n*3\r\n+OK\r\n:2\r\n$1\r\n2\r\n+OK\r\n";
+  is_equal = output && strcmp(output, expected) == 0;
+  print_detailed_test_result_str("net_test_resp: a transaction", is_equal, expected, output);
+  free(output);
+
+  output = net_test_exchange("*2\r\n$3\r\nGET\r\n$7\r\nnet:key\r\n*1\r\nx");
+  expected = "$5\r\nvalue\r\n-ERR Protocol error\r\n";
+  is_equal = output && strcmp(output, expected) == 0;
+  print_detailed_test_result_str("net_test_resp: protocol error closes the connection", is_equal, expected, output);
+  free(output);
+
+  dbapi_stop_network_server();
+  int result = 1;
+  thrd_join(server, &result);
+  print_detailed_test_result_int("net_test_resp: server stops", result == 0, 0, result);
+  dbapi_del("net:key");
+  dbapi_del("net:list");
+}
+
+static void net_test_blocking()
+{
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+
+  int fd = net_test_connect();
+  const char *command = "BLPOP net:block 0\r\n";
+  if (fd >= 0)
+    write(fd, command, strlen(command));
+  thrd_sleep(&(struct timespec){.tv_nsec = 50 * 1000000L}, NULL);
+  free(net_test_exchange("RPUSH net:block v\r\nQUIT\r\n"));
+
+  const char *expected = "*2\r\n$9\r\nnet:block\r\n$1\r\nv\r\n";
+  char output[64] = {0};
+  size_t length = 0, expected_length = strlen(expected);
+  ssize_t n;
+  while (fd >= 0 && length < expected_length && (n = read(fd, output + length, expected_length - length)) > 0)
+    length += (size_t)n;
+  db_bool_t is_equal = strcmp(output, expected) == 0;
+  print_detailed_test_result_str("net_test_blocking: BLPOP is answered once another client pushes", is_equal, expected, output);
+  if (fd >= 0)
+    close(fd);
+
+  // A client that leaves while blocked must not hold the server up.
+  fd = net_test_connect();
+  command = "BLPOP net:gone 0\r\n";
+  if (fd >= 0)
+  {
+    write(fd, command, strlen(command));
+    thrd_sleep(&(struct timespec){.tv_nsec = 50 * 1000000L}, NULL);
+    close(fd);
+  }
+  thrd_sleep(&(struct timespec){.tv_nsec = 300 * 1000000L}, NULL);
+  DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t blocked = core_test_info_field(reply, "blocked_clients");
+  free_reply(reply);
+  print_detailed_test_result_int("net_test_blocking: a client that went away is unblocked", blocked == 0, 0, (int)blocked);
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  dbapi_del("net:block");
+}
+
+static void net_test_stream()
+{
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+  core_test_fill_list("net:stream", "", 10000);
+
+  // The elements and then the reply to QUIT, in order
+  size_t expected_length = strlen("*10000\r\n+OK\r\n");
+  for (int i = 0; i < 10000; ++i)
+    expected_length += i < 10 ? 7 : i < 100 ? 8 : i < 1000 ? 9 : 10;
+  const char *command = "LRANGE net:stream 0 -1\r\nQUIT\r\n";
+  int fd = net_test_connect();
+  if (fd >= 0)
+    write(fd, command, strlen(command));
+  char *output = malloc(expected_length + 1);
+  size_t length = 0;
+  ssize_t n;
+  while (fd >= 0 && length < expected_length && (n = read(fd, output + length, expected_length - length)) > 0)
+    length += (size_t)n;
+  output[length] = '\0';
+  if (fd >= 0)
+    close(fd);
+  db_bool_t is_whole = length == expected_length && strncmp(output, "*10000\r\n$1\r\n0\r\n$1\r\n1\r\n", 22) == 0 &&
+                       strcmp(output + length - 15, "$4\r\n9999\r\n+OK\r\n") == 0;
+  print_detailed_test_result_bool("net_test_stream: a streamed LRANGE is sent whole and in order", is_whole, true, is_whole);
+  free(output);
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  dbapi_del("net:stream");
+}
+
+static void net_test_rope()
+{
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+  size_t value_length = 3 * ROPE_CHUNK_SIZE + 5 + ROPE_MIN_LENGTH;
+  char *value = core_test_alphabet(value_length);
+  dbapi_set("net:rope", value);
+
+  // The chunks, header and all, and then the reply to QUIT
+  char header[32];
+  sprintf(header, "$%zu\r\n", value_length);
+  size_t expected_length = strlen(header) + value_length + strlen("\r\n+OK\r\n");
+  const char *command = "GET net:rope\r\nQUIT\r\n";
+  int fd = net_test_connect();
+  if (fd >= 0)
+    write(fd, command, strlen(command));
+  char *output = malloc(expected_length + 1);
+  size_t length = 0;
+  ssize_t n;
+  while (fd >= 0 && length < expected_length && (n = read(fd, output + length, expected_length - length)) > 0)
+    length += (size_t)n;
+  output[length] = '\0';
+  if (fd >= 0)
+    close(fd);
+  db_bool_t is_whole = length == expected_length && strncmp(output, header, strlen(header)) == 0 &&
+                       memcmp(output + strlen(header), value, value_length) == 0 &&
+                       strcmp(output + strlen(header) + value_length, "\r\n+OK\r\n") == 0;
+  print_detailed_test_result_bool("net_test_rope: GET sends the chunks of a rope whole and in order", is_whole, true, is_whole);
+  free(output);
+  free(value);
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  dbapi_del("net:rope");
+}
+
+static void net_test_io_threads()
+{
+  enum
+  {
+    CLIENTS = 8
+  };
+  server_config_net_io_threads(3);
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+
+  int fds[CLIENTS];
+  char command[128], expected[CLIENTS][64];
+  for (int i = 0; i < CLIENTS; ++i)
+  {
+    fds[i] = net_test_connect();
+    snprintf(command, sizeof(command), "SET net:io:%d v%d\r\nGET net:io:%d\r\nPING\r\n", i, i, i);
+    snprintf(expected[i], sizeof(expected[i]), "+OK\r\n$2\r\nv%d\r\n+PONG\r\n", i);
+    if (fds[i] >= 0)
+      write(fds[i], command, strlen(command));
+  }
+
+  int matched = 0;
+  for (int i = 0; i < CLIENTS; ++i)
+  {
+    char output[64] = {0};
+    size_t length = 0, expected_length = strlen(expected[i]);
+    ssize_t n;
+    while (fds[i] >= 0 && length < expected_length && (n = read(fds[i], output + length, expected_length - length)) > 0)
+      length += (size_t)n;
+    matched += strcmp(output, expected[i]) == 0;
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+  print_detailed_test_result_int("net_test_io_threads: every client gets its own replies", matched == CLIENTS, CLIENTS, matched);
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  server_config_net_io_threads(0);
+  for (int i = 0; i < CLIENTS; ++i)
+  {
+    snprintf(command, sizeof(command), "net:io:%d", i);
+    dbapi_del(command);
+  }
+}
+
+// Reads one line, without its CRLF, a byte at a time so nothing after it is taken
+static db_bool_t net_test_read_line(int fd, char *line, size_t size)
+{
+  size_t length = 0;
+  while (length + 1 < size && read(fd, line + length, 1) == 1)
+    if (line[length++] == '\n')
+    {
+      line[length > 1 && line[length - 2] == '\r' ? length - 2 : length - 1] = '\0';
+      return true;
+    }
+  line[length] = '\0';
+  return false;
+}
+
+// Whether `pattern` is in the first `length` bytes of `data`, which may hold NULs
+static db_bool_t net_test_contains(const char *data, size_t length, const char *pattern)
+{
+  size_t pattern_length = strlen(pattern);
+  for (size_t i = 0; i + pattern_length <= length; ++i)
+    if (memcmp(data + i, pattern, pattern_length) == 0)
+      return true;
+  return false;
+}
+
+static void net_test_replication()
+{
+  thrd_t server;
+  thrd_create(&server, net_test_serve, NULL);
+
+  char line[128] = "", id[REPL_ID_LENGTH + 1] = "", records[256] = "";
+  unsigned long long offset = 0;
+  long long length = -1;
+  struct timeval timeout = {.tv_sec = 2};
+  int fd = net_test_connect();
+  const char *command = "PSYNC ? -1\r\n";
+  if (fd >= 0)
+  {
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    write(fd, command, strlen(command));
+  }
+  db_bool_t is_full = fd >= 0 && net_test_read_line(fd, line, sizeof(line)) && sscanf(line, "+FULLRESYNC %40s %llu", id, &offset) == 2;
+  print_detailed_test_result_str("net_test_replication: a new replica gets a full sync", is_full, "+FULLRESYNC <id> <offset>", line);
+  if (is_full && net_test_read_line(fd, line, sizeof(line)) && sscanf(line, "$%lld", &length) == 1)
+    for (char byte; length > 0 && read(fd, &byte, 1) == 1;)
+      --length;
+  print_detailed_test_result_int("net_test_replication: the snapshot follows as a bulk string", (length == 0), 0, (long)length);
+
+  dbapi_set("net:repl", "streamed");
+  size_t received = 0;
+  ssize_t n;
+  // Records are in the binary format of the append-only log.
+  while (is_full && !net_test_contains(records, received, "net:repl") && received < sizeof(records) &&
+         (n = read(fd, records + received, sizeof(records) - received)) > 0)
+    received += (size_t)n;
+  db_bool_t is_streamed = net_test_contains(records, received, "net:repl");
+  print_detailed_test_result_bool("net_test_replication: a write on the primary is streamed", is_streamed, true, is_streamed);
+  if (fd >= 0)
+    close(fd);
+
+  // A replica that lost its link picks up from the offset it had.
+  fd = net_test_connect();
+  char continue_command[128];
+  snprintf(continue_command, sizeof(continue_command), "PSYNC %s %llu\r\n", id, offset + received);
+  line[0] = '\0';
+  if (fd >= 0)
+  {
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    write(fd, continue_command, strlen(continue_command));
+    net_test_read_line(fd, line, sizeof(line));
+    close(fd);
+  }
+  db_bool_t is_continued = strncmp(line, "+CONTINUE ", 10) == 0 && strcmp(line + 10, id) == 0;
+  print_detailed_test_result_str("net_test_replication: a reconnecting replica continues the stream", is_continued, "+CONTINUE <id>", line);
+
+  dbapi_stop_network_server();
+  thrd_join(server, NULL);
+  dbapi_del("net:repl");
+}
+
+// Plays a primary for net_test_replica: answers the PSYNC of the replica with a full sync of one
+// key, streams one write and waits for the replica to hang up
+static int net_test_fake_primary(void *arg)
+{
+  const char *filepath = "test.repl.snapshot";
+  char buffer[4096], header[128];
+  int fd = accept(*(int *)arg, NULL, NULL);
+  if (fd < 0)
+    return 1;
+  read(fd, buffer, sizeof(buffer));
+
+  DBHash *ht = ht_create();
+  DBHash *expires = ht_create();
+  hset(ht, "repl:snapshot", dbobj_create_string_with_dup("synced"), NULL);
+  snapshot_save(filepath, &ht, &expires, 1, NULL);
+  ht_free(expires);
+  ht_free(ht);
+  FILE *file = fopen(filepath, "rb");
+  size_t length = file ? fread(buffer, 1, sizeof(buffer), file) : 0;
+  if (file)
+    fclose(file);
+  remove(filepath);
+
+  snprintf(header, sizeof(header), "+FULLRESYNC %0*d 0\r\n$%zu\r\n", REPL_ID_LENGTH, 7, length);
+  write(fd, header, strlen(header));
+  write(fd, buffer, length);
+  DBAofBuffer record = {0};
+  aof_buffer_begin(&record, 3);
+  aof_buffer_append_arg(&record, "SET");
+  aof_buffer_append_arg(&record, "repl:streamed");
+  aof_buffer_append_arg(&record, "v");
+  aof_buffer_write_fd(&record, fd);
+  aof_buffer_free(&record);
+
+  while (read(fd, buffer, sizeof(buffer)) > 0)
+    ;
+  close(fd);
+  return 0;
+}
+
+static void net_test_replica()
+{
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0), yes = 1;
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NET_TEST_PORT + 1)};
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 1) != 0)
+  {
+    print_detailed_test_result_bool("net_test_replica: the fake primary listens", false, true, false);
+    close(listen_fd);
+    return;
+  }
+  thrd_t primary;
+  thrd_create(&primary, net_test_fake_primary, &listen_fd);
+
+  dbapi_replicaof("127.0.0.1", NET_TEST_PORT + 1);
+  char *streamed = NULL;
+  for (int attempt = 0; attempt < 200 && !(streamed = dbapi_get("repl:streamed")); ++attempt)
+    thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  print_detailed_test_result_str("net_test_replica: the replica applies the stream", streamed && strcmp(streamed, "v") == 0, "v", streamed);
+  char *synced = dbapi_get("repl:snapshot");
+  print_detailed_test_result_str("net_test_replica: the replica loads the full sync", synced && strcmp(synced, "synced") == 0, "synced", synced);
+  dbapi_free(streamed);
+  dbapi_free(synced);
+
+  db_bool_t is_set = dbapi_set("repl:local", "x");
+  print_detailed_test_result_bool("net_test_replica: a replica refuses writes", !is_set, true, !is_set);
+
+  dbapi_replicaof(NULL, 0);
+  thrd_join(primary, NULL);
+  close(listen_fd);
+  is_set = dbapi_set("repl:local", "x");
+  print_detailed_test_result_bool("net_test_replica: REPLICAOF NO ONE takes writes again", is_set, true, is_set);
+  dbapi_del("repl:local");
+  dbapi_del("repl:snapshot");
+  dbapi_del("repl:streamed");
+}
+
+static void cluster_test_keyslot()
+{
+  uint16_t crc = cluster_crc16("123456789", 9);
+  print_detailed_test_result_int("cluster_test_keyslot: CRC16 check value", (crc == 0x31C3), 0x31C3, crc);
+  db_uint_t slot = cluster_keyslot("foo");
+  print_detailed_test_result_int("cluster_test_keyslot: same slot as Redis Cluster", (slot == 12182), 12182, (long)slot);
+  db_bool_t is_same = cluster_keyslot("{user1000}.following") == cluster_keyslot("{user1000}.followers");
+  print_detailed_test_result_bool("cluster_test_keyslot: keys with one hash tag share a slot", is_same, true, is_same);
+  is_same = cluster_keyslot("foo{}{bar}") == (cluster_crc16("foo{}{bar}", 10) & (CLUSTER_SLOTS - 1));
+  print_detailed_test_result_bool("cluster_test_keyslot: an empty tag hashes the whole key", is_same, true, is_same);
+}
+
+// The error of a reply, or NULL if it isn't one
+static const char *core_test_reply_error(DBReply *reply)
+{
+  return reply->data && reply->data->type == DB_TYPE_ERROR ? reply->data->value.string : NULL;
+}
+
+// Plays the target of a MIGRATE for core_test_cluster: takes the four commands moving a string,
+// answers each and keeps what it was sent in `arg`
+static int core_test_migrate_target(void *arg)
+{
+  char *received = (char *)arg;
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0), yes = 1;
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NET_TEST_PORT + 2)};
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 1) != 0)
+  {
+    close(listen_fd);
+    return 1;
+  }
+  int fd = accept(listen_fd, NULL, NULL);
+  size_t length = 0;
+  int commands = 0;
+  ssize_t n;
+  // ASKING, DEL, ASKING and SET; none of the arguments starts a line with `*`.
+  while (commands < 4 && length < 1023 && (n = read(fd, received + length, 1023 - length)) > 0)
+  {
+    for (ssize_t i = 0; i < n; ++i)
+      commands += received[length + i] == '*' && (length + i == 0 || received[length + i - 1] == '\n');
+    length += (size_t)n;
+  }
+  received[length] = '\0';
+  for (int i = 0; i < commands; ++i)
+    write(fd, "+OK\r\n", 5);
+  close(fd);
+  close(listen_fd);
+  return 0;
+}
+
+static void core_test_cluster()
+{
+  char slot_string[16], port_string[16], expected[64];
+  db_uint_t slot = cluster_keyslot("foo");
+  sprintf(slot_string, "%llu", (unsigned long long)slot);
+  sprintf(port_string, "%d", NET_TEST_PORT + 2);
+
+  server_config_cluster_enabled(true);
+  cluster_reset();
+  DBReply *reply = core_test_command(DB_GET, 1, (const char *[]){"foo"});
+  const char *error = core_test_reply_error(reply);
+  print_detailed_test_result_str("core_test_cluster: a slot nobody owns is not served", error && strcmp(error, DB_ERR_CLUSTERDOWN) == 0, DB_ERR_CLUSTERDOWN, error);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_CLUSTER_ADDSLOTS, 2, (const char *[]){"0", "16383"}));
+  db_bool_t is_set = dbapi_set("foo", "v");
+  print_detailed_test_result_bool("core_test_cluster: the slots added are served", is_set, true, is_set);
+
+  reply = core_test_command(DB_MGET, 2, (const char *[]){"foo", "bar"});
+  error = core_test_reply_error(reply);
+  print_detailed_test_result_str("core_test_cluster: keys of several slots are refused", error && strcmp(error, DB_ERR_CROSSSLOT) == 0, DB_ERR_CROSSSLOT, error);
+  free_reply(reply);
+  free_reply(core_test_command(DB_MSET, 4, (const char *[]){"{t}a", "1", "{t}b", "2"}));
+  reply = core_test_command(DB_CLUSTER_COUNTKEYSINSLOT, 1, (const char *[]){"15891"});
+  long count = dbobj_is_uint(reply->data) ? (long)reply->data->value.uint_value : -1;
+  print_detailed_test_result_int("core_test_cluster: keys with one hash tag go together", (count == 2 && cluster_keyslot("{t}a") == 15891), 2, count);
+  free_reply(reply);
+
+  // Moving the slot out key by key: the old owner asks clients to go to the new one for what it gave away.
+  char received[1024] = "";
+  thrd_t target;
+  thrd_create(&target, core_test_migrate_target, received);
+  free_reply(core_test_command(DB_CLUSTER_SETSLOT, 4, (const char *[]){slot_string, "MIGRATING", "127.0.0.1", port_string}));
+  reply = NULL;
+  for (int attempt = 0; attempt < 100; ++attempt)
+  {
+    reply = core_test_command(DB_MIGRATE, 3, (const char *[]){"foo", "127.0.0.1", port_string});
+    if (!core_test_reply_error(reply))
+      break;
+    // The target may not be listening yet.
+    free_reply(reply);
+    reply = NULL;
+    thrd_sleep(&(struct timespec){.tv_nsec = 10 * 1000000L}, NULL);
+  }
+  db_bool_t is_migrated = reply && dbobj_is_string(reply->data) && strcmp(reply->data->value.string, OK) == 0;
+  print_detailed_test_result_bool("core_test_cluster: MIGRATE moves a key", is_migrated, true, is_migrated);
+  free_reply(reply);
+  thrd_join(target, NULL);
+  db_bool_t is_sent = strstr(received, "ASKING") && strstr(received, "SET\r\n$3\r\nfoo\r\n$1\r\nv\r\n");
+  print_detailed_test_result_bool("core_test_cluster: the target gets the commands rebuilding the key", is_sent, true, is_sent);
+
+  reply = core_test_command(DB_GET, 1, (const char *[]){"foo"});
+  error = core_test_reply_error(reply);
+  sprintf(expected, "ASK %s 127.0.0.1:%s", slot_string, port_string);
+  print_detailed_test_result_str("core_test_cluster: a migrated key is asked for on the target", error && strcmp(error, expected) == 0, expected, error);
+  free_reply(reply);
+
+  free_reply(core_test_command(DB_CLUSTER_SETSLOT, 4, (const char *[]){slot_string, "NODE", "127.0.0.1", port_string}));
+  reply = core_test_command(DB_GET, 1, (const char *[]){"foo"});
+  error = core_test_reply_error(reply);
+  sprintf(expected, "MOVED %s 127.0.0.1:%s", slot_string, port_string);
+  print_detailed_test_result_str("core_test_cluster: a slot given away is moved", error && strcmp(error, expected) == 0, expected, error);
+  free_reply(reply);
+  reply = core_test_command(DB_CLUSTER_SLOTS, 0, NULL);
+  long runs = dbobj_is_list(reply->data) ? (long)reply->data->value.list->length : -1;
+  print_detailed_test_result_int("core_test_cluster: CLUSTER_SLOTS lists each run of slots", (runs == 3), 3, runs);
+  free_reply(reply);
+
+  // Importing, the slot is only served right after ASKING.
+  free_reply(core_test_command(DB_CLUSTER_SETSLOT, 4, (const char *[]){slot_string, "IMPORTING", "127.0.0.1", port_string}));
+  DBRequest *request = create_request(DB_GET);
+  add_request_arg(request, dbobj_create_string_with_dup("foo"));
+  request->is_asking = true;
+  reply = dbapi_request_sync(request);
+  free_request(request);
+  db_bool_t is_served = !core_test_reply_error(reply);
+  print_detailed_test_result_bool("core_test_cluster: an imported slot is served after ASKING", is_served, true, is_served);
+  free_reply(reply);
+
+  cluster_reset();
+  server_config_cluster_enabled(false);
+  dbapi_del("{t}a");
+  dbapi_del("{t}b");
+}
+
+#define CORE_TEST_CONCURRENT_KEYS 2000
+
+// GETs its keys over and over while the main thread rewrites them; counts values it never set
+static int core_test_concurrent_reader(void *arg)
+{
+  _Atomic db_bool_t *is_done = (_Atomic db_bool_t *)arg;
+  char key[32], expected[32];
+  int bad = 0;
+  for (int round = 0; !atomic_load(is_done); ++round)
+  {
+    int i = round % CORE_TEST_CONCURRENT_KEYS;
+    sprintf(key, "concurrent:%d", i);
+    sprintf(expected, "value:%d", i);
+    char *value = dbapi_get(key);
+    if (value && strcmp(value, expected) != 0 && strcmp(value, "other") != 0)
+      ++bad;
+    dbapi_free(value);
+  }
+  return bad;
+}
+
+static void core_test_concurrent_reads()
+{
+  char key[32], value[32];
+  _Atomic db_bool_t is_done = false;
+  thrd_t readers[4];
+  int bad = 0, result;
+
+  dbapi_flushall();
+  server_config_concurrent_reads(true);
+  DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t served_before = core_test_info_field(reply, "concurrent_reads");
+  free_reply(reply);
+
+  for (int i = 0; i < 4; ++i)
+    thrd_create(&readers[i], core_test_concurrent_reader, &is_done);
+  // Growing the table rehashes it, and the overwrites and deletes retire what readers may hold.
+  for (int round = 0; round < 3; ++round)
+  {
+    for (int i = 0; i < CORE_TEST_CONCURRENT_KEYS; ++i)
+    {
+      sprintf(key, "concurrent:%d", i);
+      sprintf(value, "value:%d", i);
+      dbapi_set(key, i % 2 ? value : "other");
+      dbapi_set(key, value);
+    }
+    for (int i = 0; i < CORE_TEST_CONCURRENT_KEYS; i += 2)
+    {
+      sprintf(key, "concurrent:%d", i);
+      dbapi_del(key);
+    }
+    free_reply(core_test_command(DB_FLUSHALL, 1, (const char *[]){round ? "ASYNC" : "SYNC"}));
+  }
+  atomic_store(&is_done, true);
+  for (int i = 0; i < 4; ++i)
+  {
+    thrd_join(readers[i], &result);
+    bad += result;
+  }
+  print_detailed_test_result_int("core_test_concurrent_reads: readers only see values that were set", bad == 0, 0, bad);
+
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t served = core_test_info_field(reply, "concurrent_reads") - served_before;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_concurrent_reads: GETs skip the queue", served > 0, true, served > 0);
+
+  dbapi_set("concurrent:expiring", "value");
+  free_reply(core_test_command(DB_PEXPIRE, 2, (const char *[]){"concurrent:expiring", "1"}));
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 5 * 1000000L};
+  thrd_sleep(&pause, NULL);
+  char *expired = dbapi_get("concurrent:expiring");
+  print_detailed_test_result_bool("core_test_concurrent_reads: an expired key reads as null", expired == NULL, true, expired == NULL);
+  dbapi_free(expired);
+
+  free_reply(core_test_command(DB_RPUSH, 2, (const char *[]){"concurrent:list", "a"}));
+  reply = core_test_command(DB_GET, 1, (const char *[]){"concurrent:list"});
+  db_bool_t is_null = dbobj_is_null(reply->data);
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_concurrent_reads: a key of another type reads as null", is_null, true, is_null);
+
+  server_config_concurrent_reads(false);
+  dbapi_flushall();
+}
+
+// The figure maxmemory is held to, and with `counted` the total INFO gets by visiting every key
+static size_t core_test_used_memory(size_t *counted)
+{
+  DBReply *reply = core_test_command(DB_INFO_DATASET_MEMORY, 0, NULL);
+  size_t used = core_test_info_field(reply, "used_memory");
+  if (counted)
+    *counted = core_test_info_field(reply, "dataset_total_bytes");
+  free_reply(reply);
+  return used;
+}
+
+static void core_test_maxmemory()
+{
+  char key[32], value[32];
+  size_t counted;
+
+  dbapi_flushall();
+  for (int i = 0; i < 200; ++i)
+  {
+    sprintf(value, "%d", i);
+    free_reply(core_test_command(DB_RPUSH, 2, (const char *[]){"maxmemory:list", value}));
+    free_reply(core_test_command(DB_HSET, 3, (const char *[]){"maxmemory:hash", value, value}));
+    free_reply(core_test_command(DB_ZADD, 3, (const char *[]){"maxmemory:zset", value, value}));
+  }
+  free_reply(core_test_command(DB_ZUNIONSTORE, 4, (const char *[]){"maxmemory:union", "2", "maxmemory:zset", "maxmemory:zset"}));
+  free_reply(core_test_command(DB_RENAME, 2, (const char *[]){"maxmemory:union", "maxmemory:renamed"}));
+  free_reply(core_test_command(DB_LPOP, 1, (const char *[]){"maxmemory:list"}));
+  free_reply(core_test_command(DB_DEL, 2, (const char *[]){"maxmemory:hash", "maxmemory:hash"}));
+  free_reply(core_test_command(DB_RPUSH, 4, (const char *[]){"maxmemory:expiring", "a", "b", "c"}));
+  free_reply(core_test_command(DB_PEXPIRE, 2, (const char *[]){"maxmemory:expiring", "1"}));
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 5 * 1000000L};
+  thrd_sleep(&pause, NULL);
+  // Deleted on a read, which only the keyspace sees.
+  free_reply(core_test_command(DB_LLEN, 1, (const char *[]){"maxmemory:expiring"}));
+  size_t used = core_test_used_memory(&counted);
+  print_detailed_test_result_int("core_test_maxmemory: used memory follows the writes", used == counted, (int)counted, (int)used);
+
+  dbapi_flushall();
+  size_t limit = core_test_used_memory(NULL) + 64 * 1024;
+  DBReply *reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t evicted_before = core_test_info_field(reply, "evicted_keys");
+  free_reply(reply);
+  server_config_maxmemory(limit, DB_MAXMEMORY_ALLKEYS_LFU);
+  dbapi_set("maxmemory:hot", "value");
+  size_t peak = 0;
+  for (int i = 0; i < 5000; ++i)
+  {
+    sprintf(key, "maxmemory:key:%d", i);
+    dbapi_set(key, "value");
+    dbapi_free(dbapi_get("maxmemory:hot"));
+    used = core_test_used_memory(NULL);
+    peak = used > peak ? used : peak;
+  }
+  // A write only makes room before it runs, so it may end up over by what it added.
+  print_detailed_test_result_bool("core_test_maxmemory: eviction keeps the dataset near maxmemory", peak < limit + 1024, true, peak < limit + 1024);
+  reply = core_test_command(DB_INFO_STATS, 0, NULL);
+  size_t evicted = core_test_info_field(reply, "evicted_keys") - evicted_before;
+  free_reply(reply);
+  print_detailed_test_result_bool("core_test_maxmemory: keys are evicted", evicted > 0, true, evicted > 0);
+  char *hot = dbapi_get("maxmemory:hot");
+  print_detailed_test_result_bool("core_test_maxmemory: LFU keeps the key read the most", hot != NULL, true, hot != NULL);
+  dbapi_free(hot);
+
+  // The dataset is over a limit that nothing may be evicted to meet.
+  server_config_maxmemory(limit / 2, DB_MAXMEMORY_NOEVICTION);
+  reply = core_test_command(DB_SET, 2, (const char *[]){"maxmemory:new", "value"});
+  const char *error = core_test_reply_error(reply);
+  db_bool_t is_oom = error && strcmp(error, DB_ERR_OOM) == 0;
+  print_detailed_test_result_bool("core_test_maxmemory: noeviction refuses writes that add memory", is_oom, true, is_oom);
+  free_reply(reply);
+  reply = core_test_command(DB_DEL, 1, (const char *[]){"maxmemory:hot"});
+  error = core_test_reply_error(reply);
+  print_detailed_test_result_bool("core_test_maxmemory: noeviction still takes deletes", error == NULL, true, error == NULL);
+  free_reply(reply);
+
+  server_config_maxmemory(0, DB_MAXMEMORY_NOEVICTION);
+  dbapi_flushall();
+  for (int i = 0; i < 20; ++i)
+  {
+    sprintf(key, "maxmemory:persistent:%d", i);
+    dbapi_set(key, "value");
+  }
+  limit = core_test_used_memory(NULL) + 64 * 1024;
+  server_config_maxmemory(limit, DB_MAXMEMORY_VOLATILE_TTL);
+  for (int i = 0; i < 3000; ++i)
+  {
+    sprintf(key, "maxmemory:volatile:%d", i);
+    sprintf(value, "%d", 1000 + i);
+    dbapi_set(key, "value");
+    free_reply(core_test_command(DB_EXPIRE, 2, (const char *[]){key, value}));
+  }
+  db_bool_t kept = true;
+  for (int i = 0; i < 20; ++i)
+  {
+    sprintf(key, "maxmemory:persistent:%d", i);
+    char *got = dbapi_get(key);
+    kept = kept && got;
+    dbapi_free(got);
+  }
+  print_detailed_test_result_bool("core_test_maxmemory: volatile-ttl keeps keys without a TTL", kept, true, kept);
+  char *soonest = dbapi_get("maxmemory:volatile:0");
+  char *latest = dbapi_get("maxmemory:volatile:2999");
+  db_bool_t in_order = !soonest && latest;
+  print_detailed_test_result_bool("core_test_maxmemory: volatile-ttl evicts the nearest deadline first", in_order, true, in_order);
+  dbapi_free(soonest);
+  dbapi_free(latest);
+
+  server_config_maxmemory(0, DB_MAXMEMORY_NOEVICTION);
+  dbapi_flushall();
+}
+static void queue_test_ring()
+{
+  DBTaskQueue *queue = queue_create(3, DB_QUEUE_REJECT);
+  print_detailed_test_result_int("queue_test_ring: capacity rounds up to 4", (queue->capacity == 4), 4, queue->capacity);
+
+  DBTask task = {.created_at = 0, .request = NULL, .reply = NULL};
+  int pushed = 0;
+  for (int i = 0; i < 6; ++i)
+  {
+    task.created_at = i;
+    if (queue_push(queue, &task))
+      ++pushed;
+  }
+  print_detailed_test_result_int("queue_test_ring: reject policy stops at capacity", (pushed == 4), 4, pushed);
+
+  // Wrap around the ring a few times and check FIFO order.
+  db_bool_t in_order = true;
+  long expected = 0;
+  for (int lap = 0; lap < 3; ++lap)
+  {
+    while (queue_pop(queue, &task))
+      in_order = in_order && task.created_at == expected++;
+    for (int i = 0; i < 4; ++i)
+    {
+      task.created_at = expected + i;
+      queue_push(queue, &task);
+    }
+  }
+  print_detailed_test_result_bool("queue_test_ring: tasks pop in FIFO order across laps", in_order, true, in_order);
+
+  queue_free(queue);
+}
+
 int main()
 {
   dbapi_start_server();
 
   // test_dbutil_match_keys();
+  test_glob_match();
   zset_test_zadd();
   zset_test_zscore();
   zset_test_zcard();
@@ -407,10 +4420,81 @@ int main()
   zset_test_zrange();
   zset_test_zrangebyscore();
   zset_test_zrank();
+  zset_test_spans();
+  zset_test_element_layout();
+  zset_test_dict();
+  zset_test_packed();
+  zset_test_zrevrange();
+  zset_test_fractional_scores();
   zset_test_zrem();
   zset_test_zremrangebyscore();
   zset_test_zinterstore();
   zset_test_zunionstore();
+  zset_test_zaggregate_large();
+  zset_test_zadd_bulk();
+  core_test_request_reply();
+  core_test_pipeline();
+  core_test_sharded();
+  core_test_transaction();
+  core_test_bgsave();
+  core_test_aof();
+  json_test_stream();
+  json_test_strings();
+  json_test_arena();
+  core_test_persistence_types();
+  core_test_mapped_snapshot();
+  core_test_worker_idle();
+  core_test_memory();
+  core_test_key_handle();
+  core_test_embedded_expire();
+  core_test_timer_heap();
+  core_test_ht_scan();
+  core_test_ht_rehash();
+  core_test_ht_batch_lookup();
+  core_test_pages();
+  core_test_lazyfree();
+  core_test_packed_hash();
+  core_test_multi_key();
+  core_test_blocking();
+  core_test_scan();
+  radix_test_tree();
+  core_test_key_index();
+  core_test_shared_reply();
+  core_test_shared_integers();
+  core_test_incr();
+  core_test_rope();
+  core_test_reply_arena();
+  core_test_stream();
+  core_test_pexpire();
+  slab_test_pools();
+  obj_test_embedded_strings();
+  quicklist_test_blocks();
+  quicklist_test_index();
+  core_test_list_index();
+  core_test_zset_reverse();
+  core_test_zadd_pairs();
+  core_test_active_expire();
+  latency_test_histogram();
+  core_test_commandstats();
+  core_test_hotkeys();
+  core_test_trace();
+  flathash_test_basic();
+  interaction_test_commands();
+  uring_test_write();
+  net_test_resp();
+  net_test_blocking();
+  net_test_stream();
+  net_test_rope();
+  net_test_io_threads();
+  net_test_replication();
+  net_test_replica();
+  cluster_test_keyslot();
+  core_test_cluster();
+  core_test_concurrent_reads();
+  core_test_maxmemory();
+  queue_test_ring();
+  snapshot_test_roundtrip();
+  snapshot_test_parallel_load();
 
   printf("DONE!\n");
 
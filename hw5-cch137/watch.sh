@@ -11,7 +11,7 @@ ENTRY_POINT="main"             # Default entry point
 
 # Function to display the selection menu with arrow keys
 function select_entry_point {
-    local options=("main" "test")
+    local options=("main" "test" "bench")
     local selected=0
 
     while true; do
@@ -59,9 +59,11 @@ function select_entry_point {
 function compile_and_run {
     # Filter .c files based on the selected entry point
     if [ "$ENTRY_POINT" == "main" ]; then
-        c_files=$(find . -type f -name "*.c" ! -path "*/\.*/*" ! -name ".*" ! -name "test.c" -print | tr '\n' ' ')
+        c_files=$(find . -type f -name "*.c" ! -path "*/\.*/*" ! -name ".*" ! -name "test.c" ! -name "bench*.c" -print | tr '\n' ' ')
+    elif [ "$ENTRY_POINT" == "test" ]; then
+        c_files=$(find . -type f -name "*.c" ! -path "*/\.*/*" ! -name ".*" ! -name "main.c" ! -name "bench*.c" -print | tr '\n' ' ')
     else
-        c_files=$(find . -type f -name "*.c" ! -path "*/\.*/*" ! -name ".*" ! -name "main.c" -print | tr '\n' ' ')
+        c_files=$(find . -type f -name "*.c" ! -path "*/\.*/*" ! -name ".*" ! -name "main.c" ! -name "test.c" -print | tr '\n' ' ')
     fi
 
     compile_command="gcc -o $OUTPUT_EXECUTABLE $c_files"  # Build command